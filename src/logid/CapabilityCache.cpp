@@ -0,0 +1,156 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <CapabilityCache.h>
+#include <util/log.h>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cctype>
+
+using namespace logid;
+
+namespace {
+    std::string to_hex(const std::vector<uint8_t>& bytes) {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string hex;
+        for (auto byte: bytes) {
+            hex += digits[byte >> 4];
+            hex += digits[byte & 0xf];
+        }
+        return hex;
+    }
+
+    std::optional<std::vector<uint8_t>> from_hex(const std::string& hex) {
+        if (hex.size() % 2)
+            return {};
+
+        std::vector<uint8_t> bytes;
+        for (std::size_t i = 0; i < hex.size(); i += 2) {
+            try {
+                std::size_t end;
+                auto byte = std::stoul(hex.substr(i, 2), &end, 16);
+                if (end != 2)
+                    return {};
+                bytes.push_back(byte);
+            } catch (std::exception& e) {
+                return {};
+            }
+        }
+        return bytes;
+    }
+}
+
+CapabilityCache::CapabilityCache(std::filesystem::path directory) :
+        _directory(std::move(directory)) {
+}
+
+std::filesystem::path CapabilityCache::_path(uint16_t pid,
+                                             const std::string& firmware) const {
+    char pid_str[8];
+    snprintf(pid_str, sizeof(pid_str), "%04x-", pid);
+    std::string name = pid_str;
+    for (auto c: firmware)
+        name += std::isalnum(c) || c == '.' ? c : '_';
+
+    return _directory / (name + ".cache");
+}
+
+std::optional<CapabilityCache::Capabilities> CapabilityCache::load(
+        uint16_t pid, const std::string& firmware) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto path = _path(pid, firmware);
+    std::ifstream file(path);
+    if (!file)
+        return {};
+
+    std::string header;
+    int file_version = 0;
+    file >> header >> file_version;
+    if (header != "logid-capabilities" || file_version != version) {
+        logPrintf(DEBUG, "Ignoring stale capability cache %s", path.c_str());
+        return {};
+    }
+
+    Capabilities capabilities;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty())
+            continue;
+
+        std::istringstream entry(line);
+        std::string type, first, second;
+        entry >> type >> first >> second;
+
+        auto key = from_hex(first);
+        auto value = from_hex(second);
+        if (type == "feature" && key && value &&
+            key->size() == 2 && value->size() == 1) {
+            capabilities.features[((*key)[0] << 8) | (*key)[1]] = (*value)[0];
+        } else if (type == "response" && key && value) {
+            capabilities.responses[*key] = *value;
+        } else {
+            logPrintf(WARN, "Corrupt capability cache %s, ignoring it", path.c_str());
+            return {};
+        }
+    }
+
+    return capabilities;
+}
+
+void CapabilityCache::store(uint16_t pid, const std::string& firmware,
+                            const Capabilities& capabilities) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto path = _path(pid, firmware);
+    auto tmp_path = path;
+    tmp_path += ".tmp";
+
+    std::error_code error;
+    std::filesystem::create_directories(_directory, error);
+    if (error) {
+        logPrintf(WARN, "Could not create %s: %s", _directory.c_str(),
+                  error.message().c_str());
+        return;
+    }
+
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        file << "logid-capabilities " << version << "\n";
+        for (auto& feature: capabilities.features) {
+            file << "feature "
+                 << to_hex({static_cast<uint8_t>(feature.first >> 8),
+                            static_cast<uint8_t>(feature.first & 0xff)})
+                 << " " << to_hex({feature.second}) << "\n";
+        }
+        for (auto& response: capabilities.responses)
+            file << "response " << to_hex(response.first) << " "
+                 << to_hex(response.second) << "\n";
+
+        if (!file.flush()) {
+            logPrintf(WARN, "Could not write %s", tmp_path.c_str());
+            std::filesystem::remove(tmp_path, error);
+            return;
+        }
+    }
+
+    // Readers never see a partially written cache
+    std::filesystem::rename(tmp_path, path, error);
+    if (error)
+        logPrintf(WARN, "Could not write %s: %s", path.c_str(),
+                  error.message().c_str());
+}
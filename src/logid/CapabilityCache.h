@@ -0,0 +1,55 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_CAPABILITYCACHE_H
+#define LOGID_CAPABILITYCACHE_H
+
+#include <backend/hidpp20/Device.h>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace logid {
+    /* Stores what device discovery learned on disk, keyed by PID and
+     * firmware version, so that later inits can skip straight to
+     * configuration. Failures are logged and treated as cache misses. */
+    class CapabilityCache {
+    public:
+        typedef backend::hidpp20::Device::Capabilities Capabilities;
+
+        static constexpr int version = 1;
+
+        explicit CapabilityCache(std::filesystem::path directory);
+
+        [[nodiscard]] std::optional<Capabilities> load(uint16_t pid,
+                                                       const std::string& firmware) const;
+
+        void store(uint16_t pid, const std::string& firmware,
+                   const Capabilities& capabilities) const;
+
+    private:
+        [[nodiscard]] std::filesystem::path _path(uint16_t pid,
+                                                  const std::string& firmware) const;
+
+        const std::filesystem::path _directory;
+        mutable std::mutex _mutex;
+    };
+}
+
+#endif //LOGID_CAPABILITYCACHE_H
@@ -17,56 +17,791 @@
  */
 
 #include <Configuration.h>
+#include <InputDevice.h>
+#include <actions/GestureAction.h>
 #include <util/log.h>
 #include <utility>
 #include <filesystem>
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <ipc_defs.h>
 
 using namespace logid;
 using namespace libconfig;
 using namespace logid::config;
 
-Configuration::Configuration(std::string config_file) :
-        _config_file(std::move(config_file)) {
+#ifndef LOGIOPS_VERSION
+#define LOGIOPS_VERSION "null"
+#endif
+
+namespace {
+    // GUIs save after every change, a burst within this window is one write
+    constexpr std::chrono::milliseconds save_delay(500);
+
+    // Any change to this build invalidates snapshots
+    constexpr auto snapshot_magic = "logid-config " LOGIOPS_VERSION;
+
+    uint64_t fnv1a(const char* data, std::size_t size) {
+        uint64_t hash = 0xcbf29ce484222325;
+        for (std::size_t i = 0; i < size; ++i) {
+            hash ^= static_cast<uint8_t>(data[i]);
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    // So does any change to the keys or types of the schema
+    uint64_t snapshotVersion() {
+        static const uint64_t version = []() {
+            bin_signature signature;
+            sign<config::Config>(signature);
+            return fnv1a(signature.out.data(), signature.out.size());
+        }();
+        return version;
+    }
+
+    /* Files pulled in by @include are not part of the hash, a config
+     * using them is always parsed */
+    std::optional<uint64_t> sourceHash(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return std::nullopt;
+        std::string source(std::istreambuf_iterator<char>(file), {});
+        if (source.find("@include") != std::string::npos)
+            return std::nullopt;
+        return fnv1a(source.data(), source.size());
+    }
+}
+
+Configuration::Configuration(std::string config_file, std::string cache_dir) :
+        _config_file(std::move(config_file)), _cache_dir(std::move(cache_dir)) {
     if (std::filesystem::exists(_config_file)) {
-        try {
-            _config.readFile(_config_file.c_str());
-        } catch (const FileIOException& e) {
-            logPrintf(ERROR, "I/O Error while reading %s: %s", _config_file.c_str(),
-                  e.what());
-            throw;
-        } catch (const ParseException& e) {
-            logPrintf(ERROR, "Parse error in %s, line %d: %s", e.getFile(),
-                  e.getLine(), e.getError());
-            throw;
+        const auto start = std::chrono::steady_clock::now();
+
+        std::optional<uint64_t> hash;
+        if (!_cache_dir.empty())
+            hash = sourceHash(_config_file);
+
+        if (!hash || !_loadSnapshot(hash.value())) {
+            _readFile(_config_file, _config);
+            Config::operator=(get<Config>(_config.getRoot()));
+            _parsed = true;
+            if (hash)
+                _storeSnapshot(hash.value());
         }
+        _resolveTemplates(*this);
+        validate(*this);
 
-        Config::operator=(get<Config>(_config.getRoot()));
+        logPrintf(DEBUG, "Loaded %s in %lld us", _config_file.c_str(),
+                  (long long) std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - start).count());
     } else {
         logPrintf(INFO, "Config file does not exist, using empty config.");
     }
 
     if (!devices.has_value())
         devices.emplace();
+
+    indexDevices();
 }
 
 Configuration::Configuration() {
     devices.emplace();
+    indexDevices();
 }
 
-void Configuration::save() {
-    config::set(_config.getRoot(), *this);
+void Configuration::_readFile(const std::string& path, libconfig::Config& config) {
     try {
-        _config.writeFile(_config_file.c_str());
+        config.readFile(path.c_str());
     } catch (const FileIOException& e) {
-        logPrintf(ERROR, "I/O Error while writing %s: %s",
-                  _config_file.c_str(), e.what());
+        logPrintf(ERROR, "I/O Error while reading %s: %s", path.c_str(),
+                  e.what());
+        throw;
+    } catch (const ParseException& e) {
+        logPrintf(ERROR, "Parse error in %s, line %d: %s", e.getFile(),
+                  e.getLine(), e.getError());
         throw;
+    }
+}
+
+config::Config Configuration::read() const {
+    config::Config next;
+    if (std::filesystem::exists(_config_file)) {
+        libconfig::Config file;
+        _readFile(_config_file, file);
+        next = get<Config>(file.getRoot());
+        _resolveTemplates(next);
+        validate(next);
+    }
+
+    if (!next.devices.has_value())
+        next.devices.emplace();
+    return next;
+}
+
+namespace {
+    // Every profile a device entry holds
+    template<typename F>
+    void eachProfile(config::Devices& devices, F&& f) {
+        for (auto& device: devices) {
+            if (auto* profile = std::get_if<config::Profile>(&device.second)) {
+                f(*profile);
+            } else {
+                for (auto& profile: std::get<config::Device>(device.second).profiles)
+                    f(profile.second);
+            }
+        }
+    }
+
+    const config::Profile* resolveTemplate(config::Templates& templates,
+                                           const std::string& name,
+                                           std::set<std::string>& resolved,
+                                           std::set<std::string>& visiting) {
+        auto it = templates.find(name);
+        if (it == templates.end()) {
+            logPrintf(WARN, "Profile template %s does not exist", name.c_str());
+            return nullptr;
+        }
+
+        if (!resolved.contains(name)) {
+            if (!visiting.insert(name).second) {
+                logPrintf(WARN, "Profile template %s inherits from itself", name.c_str());
+                return nullptr;
+            }
+
+            auto& profile = it->second;
+            if (profile.inherits.has_value()) {
+                if (auto* base = resolveTemplate(templates, profile.inherits.value(),
+                                                 resolved, visiting))
+                    profile._inherit(*base);
+            }
+
+            visiting.erase(name);
+            resolved.insert(name);
+        }
+
+        return &it->second;
+    }
+}
+
+void Configuration::_resolveTemplates(config::Config& config) {
+    if (!config.templates.has_value())
+        return;
+
+    auto& templates = config.templates.value();
+    std::set<std::string> resolved, visiting;
+    for (auto& entry: templates)
+        resolveTemplate(templates, entry.first, resolved, visiting);
+
+    if (config.devices.has_value()) {
+        eachProfile(config.devices.value(), [&](config::Profile& profile) {
+            if (profile.inherits.has_value())
+                if (auto* base = resolveTemplate(templates, profile.inherits.value(),
+                                                 resolved, visiting))
+                    profile._inherit(*base);
+        });
+    }
+}
+
+void Configuration::_stripTemplates(config::Config& config) {
+    if (!config.templates.has_value())
+        return;
+
+    // Stripped against templates as they are in memory, fully resolved
+    const auto resolved = config.templates.value();
+    auto strip = [&resolved](config::Profile& profile) {
+        if (!profile.inherits.has_value())
+            return;
+        auto base = resolved.find(profile.inherits.value());
+        if (base != resolved.end())
+            profile._strip(base->second);
+    };
+
+    if (config.devices.has_value())
+        eachProfile(config.devices.value(), strip);
+    for (auto& entry: config.templates.value())
+        strip(entry.second);
+}
+
+const std::string& Configuration::path() const {
+    return _config_file;
+}
+
+std::mutex& Configuration::devicesMutex() const {
+    return _devices_mutex;
+}
+
+config::Device& Configuration::deviceConfig(std::variant<config::Device, config::Profile>& device) {
+    if (std::holds_alternative<config::Profile>(device)) {
+        config::Device d;
+        d.profiles["default"] = std::get<config::Profile>(device);
+        d.default_profile = "default";
+        device = std::move(d);
+    }
+
+    auto& conf = std::get<config::Device>(device);
+    if (conf.profiles.empty()) {
+        conf.profiles["default"] = {};
+        conf.default_profile = "default";
+    }
+
+    return conf;
+}
+
+namespace {
+    std::string fold(const std::string& name) {
+        std::string folded(name);
+        std::transform(folded.begin(), folded.end(), folded.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+        return folded;
+    }
+
+    std::optional<uint16_t> productId(const std::string& name) {
+        if (name.size() < 3 || name.size() > 6 || name[0] != '0' ||
+            (name[1] != 'x' && name[1] != 'X'))
+            return std::nullopt;
+
+        uint16_t pid = 0;
+        auto [end, error] = std::from_chars(name.data() + 2,
+                                            name.data() + name.size(), pid, 16);
+        if (error != std::errc() || end != name.data() + name.size())
+            return std::nullopt;
+        return pid;
+    }
+}
+
+config::Device* Configuration::device_index::find(const std::string& name,
+                                                  uint16_t pid) const {
+    if (auto it = names.find(name); it != names.end())
+        return it->second;
+    if (auto it = folded.find(fold(name)); it != folded.end())
+        return it->second;
+    if (auto it = pids.find(pid); pid && it != pids.end())
+        return it->second;
+    return nullptr;
+}
+
+std::shared_ptr<const Configuration::device_index> Configuration::index(
+        config::Devices& devices) {
+    auto index = std::make_shared<device_index>();
+    for (auto& entry: devices) {
+        auto* conf = &deviceConfig(entry.second);
+        index->names.emplace(entry.first, conf);
+        index->folded.emplace(fold(entry.first), conf);
+        if (auto pid = productId(entry.first))
+            index->pids.emplace(pid.value(), conf);
+    }
+    return index;
+}
+
+void Configuration::indexDevices() {
+    _device_index.store(index(devices.value()));
+}
+
+config::Devices::iterator Configuration::retireDevice(config::Devices::iterator it) {
+    auto next = std::next(it);
+    _retired_devices.push_back(devices.value().extract(it));
+    return next;
+}
+
+config::Device& Configuration::device(const std::string& name, uint16_t pid) {
+    if (auto* conf = _device_index.load()->find(name, pid))
+        return *conf;
+
+    std::lock_guard lock(_devices_mutex);
+    // Another device of the same name may have been first
+    if (auto* conf = _device_index.load()->find(name, pid))
+        return *conf;
+
+    auto& entry = devices.value().emplace(name, config::Device()).first->second;
+    indexDevices();
+    return std::get<config::Device>(entry);
+}
+
+Configuration::~Configuration() {
+    // A save still waiting is written before going away
+    bool pending;
+    {
+        std::lock_guard lock(_save_lock);
+        pending = _pending_save.cancel();
+    }
+
+    if (pending) {
+        try {
+            saveNow();
+        } catch (std::exception& e) {
+        }
+    }
+
+    std::lock_guard running(_save_running);
+}
+
+void Configuration::save() {
+    std::lock_guard lock(_save_lock);
+    if (!_pending_save.done())
+        return;
+
+    _pending_save = run_task_after([self_weak = weak_from_this()]() {
+        auto self = self_weak.lock();
+        if (!self)
+            return;
+
+        {
+            // Changes from here on are picked up by another save
+            std::lock_guard lock(self->_save_lock);
+            self->_pending_save = {};
+        }
+
+        try {
+            self->saveNow();
+        } catch (std::exception& e) {
+            // Already logged
+        }
+    }, save_delay, task_priority::background);
+    _save_tasks.add(_pending_save);
+}
+
+void Configuration::saveNow() {
+    std::lock_guard running(_save_running);
+
+    std::string contents;
+    try {
+        contents = _serialize();
     } catch (const std::exception& e) {
         logPrintf(ERROR, "Error while writing %s: %s",
                   _config_file.c_str(), e.what());
         throw;
     }
+
+    {
+        // Compared with the file itself, it may have been edited since
+        std::ifstream current(_config_file);
+        if (current && std::string(std::istreambuf_iterator<char>(current), {}) == contents) {
+            logPrintf(DEBUG, "%s is unchanged, not writing it", _config_file.c_str());
+            return;
+        }
+    }
+
+    struct stat original{};
+    const bool exists = stat(_config_file.c_str(), &original) == 0;
+
+    // Written next to the file so the rename stays on one filesystem
+    const auto temp_file = _config_file + ".tmp";
+    FILE* file = fopen(temp_file.c_str(), "w");
+    // The file keeps its mode, and its owner where that is allowed
+    if (file && exists && fchown(fileno(file), original.st_uid, original.st_gid) != 0)
+        logPrintf(DEBUG, "Could not keep the owner of %s: %s", _config_file.c_str(),
+                  strerror(errno));
+    bool written = file &&
+                   (!exists || fchmod(fileno(file), original.st_mode & 07777) == 0) &&
+                   fwrite(contents.data(), 1, contents.size(), file) == contents.size() &&
+                   fflush(file) == 0 && fsync(fileno(file)) == 0;
+    int error = errno;
+    if (file)
+        fclose(file);
+
+    if (!written || rename(temp_file.c_str(), _config_file.c_str()) != 0) {
+        if (written)
+            error = errno;
+        unlink(temp_file.c_str());
+        logPrintf(ERROR, "I/O Error while writing %s: %s",
+                  _config_file.c_str(), strerror(error));
+        throw std::system_error(error, std::generic_category(), _config_file);
+    }
+}
+
+std::string Configuration::_snapshotPath() const {
+    char name[32];
+    snprintf(name, sizeof(name), "config-%016llx.snapshot",
+             (unsigned long long) fnv1a(_config_file.data(), _config_file.size()));
+    return (std::filesystem::path(_cache_dir) / name).string();
+}
+
+bool Configuration::_loadSnapshot(uint64_t hash) {
+    const auto path = _snapshotPath();
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    const std::string data(std::istreambuf_iterator<char>(file), {});
+
+    bin_reader reader{data.data(), data.data() + data.size()};
+    try {
+        std::string magic;
+        uint64_t version;
+        uint64_t source_hash;
+        unpack(reader, magic);
+        unpack(reader, version);
+        unpack(reader, source_hash);
+        if (magic != snapshot_magic || version != snapshotVersion() || source_hash != hash) {
+            logPrintf(DEBUG, "Ignoring stale config snapshot %s", path.c_str());
+            return false;
+        }
+
+        config::Config snapshot;
+        unpack(reader, snapshot);
+        if (reader.pos != reader.end)
+            throw std::out_of_range("trailing data");
+        Config::operator=(std::move(snapshot));
+    } catch (std::exception& e) {
+        logPrintf(WARN, "Corrupt config snapshot %s, ignoring it", path.c_str());
+        return false;
+    }
+
+    logPrintf(DEBUG, "Loaded config snapshot %s", path.c_str());
+    return true;
+}
+
+void Configuration::_storeSnapshot(uint64_t hash) const {
+    std::string data;
+    bin_writer writer{data};
+    pack(writer, std::string(snapshot_magic));
+    pack(writer, snapshotVersion());
+    pack(writer, hash);
+    pack(writer, static_cast<const config::Config&>(*this));
+
+    std::error_code error;
+    std::filesystem::create_directories(_cache_dir, error);
+    if (error) {
+        logPrintf(WARN, "Could not create %s: %s", _cache_dir.c_str(),
+                  error.message().c_str());
+        return;
+    }
+
+    const auto path = _snapshotPath();
+    const auto tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), (std::streamsize) data.size());
+        if (!file.flush()) {
+            logPrintf(WARN, "Could not write %s", tmp_path.c_str());
+            std::filesystem::remove(tmp_path, error);
+            return;
+        }
+    }
+
+    // Readers never see a partially written snapshot
+    std::filesystem::rename(tmp_path, path, error);
+    if (error)
+        logPrintf(WARN, "Could not write %s: %s", path.c_str(),
+                  error.message().c_str());
+}
+
+std::string Configuration::_serialize() {
+    /* Settings logid does not know about are kept in the tree, it is read
+     * now if a snapshot stood in for it */
+    if (!_parsed) {
+        if (std::filesystem::exists(_config_file))
+            _readFile(_config_file, _config);
+        _parsed = true;
+    }
+
+    config::Config out;
+    {
+        std::unique_lock edits(config::edit_mutex::edits());
+        std::lock_guard lock(_devices_mutex);
+        out = *this;
+    }
+    // Maps are written out whole, nothing stripped lingers in the tree
+    _stripTemplates(out);
+    config::set(_config.getRoot(), out);
+
+    char* buffer = nullptr;
+    std::size_t size = 0;
+    FILE* stream = open_memstream(&buffer, &size);
+    if (!stream)
+        throw std::system_error(errno, std::generic_category(), "open_memstream");
+    _config.write(stream);
+    fclose(stream);
+
+    std::string contents(buffer, size);
+    free(buffer);
+    return contents;
+}
+
+namespace {
+    struct input_collector {
+        std::set<uint>& keys;
+        std::set<uint>& axes;
+        // Names that did not resolve, if they are to be reported
+        std::vector<std::string>* problems = nullptr;
+
+        void problem(std::string what) {
+            if (problems)
+                problems->push_back(std::move(what));
+        }
+
+        void key(const std::variant<uint, std::string>& key) {
+            try {
+                if (std::holds_alternative<uint>(key))
+                    keys.insert(std::get<uint>(key));
+                else
+                    keys.insert(InputDevice::toKeyCode(std::get<std::string>(key)));
+            } catch (InputDevice::InvalidEventCode&) {
+                problem("invalid key " + std::get<std::string>(key));
+            }
+        }
+
+        void operator()(const KeypressAction& action) {
+            if (!action.keys.has_value())
+                return;
+
+            auto& config = action.keys.value();
+            if (std::holds_alternative<std::string>(config))
+                key(std::get<std::string>(config));
+            else if (std::holds_alternative<uint>(config))
+                key(std::get<uint>(config));
+            else
+                for (auto& k: std::get<std::list<std::variant<uint, std::string>>>(config))
+                    key(k);
+        }
+
+        void axis(const std::variant<std::string, uint>& axis) {
+            try {
+                uint code = std::holds_alternative<uint>(axis) ? std::get<uint>(axis) :
+                            InputDevice::toAxisCode(std::get<std::string>(axis));
+                axes.insert(code);
+                int low_res = InputDevice::getLowResAxis(code);
+                if (low_res != -1)
+                    axes.insert(low_res);
+            } catch (InputDevice::InvalidEventCode&) {
+                problem("invalid axis " + std::get<std::string>(axis));
+            }
+        }
+
+        void operator()(const MacroAction& action) {
+            if (!action.steps.has_value())
+                return;
+
+            for (auto& step: action.steps.value()) {
+                if (step.key.has_value())
+                    key(step.key.value());
+                else if (step.axis.has_value())
+                    axis(step.axis.value());
+            }
+        }
+
+        void operator()(const AxisGesture& gesture) {
+            if (gesture.axis.has_value())
+                axis(gesture.axis.value());
+        }
+
+        void operator()(const MomentumGesture& gesture) {
+            (*this)(static_cast<const AxisGesture&>(gesture));
+        }
+
+        void operator()(const ChordAction& action) {
+            (*this)(action.chord);
+            (*this)(action.fallback);
+        }
+
+        void operator()(const GestureAction& action) {
+            if (!action.gestures.has_value())
+                return;
+
+            for (auto& gesture: action.gestures.value()) {
+                try {
+                    actions::GestureAction::toDirection(gesture.first);
+                } catch (std::invalid_argument&) {
+                    problem(gesture.first + " is not a direction");
+                }
+                (*this)(gesture.second);
+            }
+        }
+
+        // Other actions and gestures, which may wrap an action
+        template<typename T>
+        void operator()(const T& t) {
+            if constexpr (requires { t.action; })
+                (*this)(t.action);
+        }
+
+        template<typename... T>
+        void operator()(const std::variant<T...>& v) {
+            std::visit(*this, v);
+        }
+
+        template<typename T>
+        void operator()(const std::optional<T>& o) {
+            if (o.has_value())
+                (*this)(o.value());
+        }
+
+        void operator()(const Profile& profile) {
+            if (profile.buttons.has_value())
+                for (auto& button: profile.buttons.value())
+                    (*this)(button.second.action);
+
+            if (profile.hiresscroll.has_value() &&
+                std::holds_alternative<HiresScroll>(profile.hiresscroll.value())) {
+                auto& hires = std::get<HiresScroll>(profile.hiresscroll.value());
+                (*this)(hires.up);
+                (*this)(hires.down);
+            }
+
+            if (profile.thumbwheel.has_value()) {
+                auto& wheel = profile.thumbwheel.value();
+                (*this)(wheel.left);
+                (*this)(wheel.right);
+                (*this)(wheel.proxy);
+                (*this)(wheel.touch);
+                (*this)(wheel.tap);
+            }
+        }
+
+        void operator()(const config::Device& device) {
+            for (auto& profile: device.profiles)
+                (*this)(profile.second);
+        }
+    };
+}
+
+namespace {
+    struct feature_collector {
+        std::set<std::string>& features;
+
+        void operator()(const CycleDPI&) {
+            features.insert("dpi");
+        }
+
+        void operator()(const ChangeDPI&) {
+            features.insert("dpi");
+        }
+
+        void operator()(const ToggleSmartShift&) {
+            features.insert("smartshift");
+        }
+
+        void operator()(const ToggleHiresScroll&) {
+            features.insert("hiresscroll");
+        }
+
+        void operator()(const ChordAction& action) {
+            features.insert("remapbutton");
+            (*this)(action.chord);
+            (*this)(action.fallback);
+        }
+
+        void operator()(const GestureAction& action) {
+            if (action.gestures.has_value())
+                for (auto& gesture: action.gestures.value())
+                    (*this)(gesture.second);
+        }
+
+        template<typename T>
+        void operator()(const T& t) {
+            if constexpr (requires { t.action; })
+                (*this)(t.action);
+        }
+
+        template<typename... T>
+        void operator()(const std::variant<T...>& v) {
+            std::visit(*this, v);
+        }
+
+        template<typename T>
+        void operator()(const std::optional<T>& o) {
+            if (o.has_value())
+                (*this)(o.value());
+        }
+
+        void operator()(const Profile& profile) {
+            if (profile.dpi.has_value())
+                features.insert("dpi");
+            if (profile.smartshift.has_value())
+                features.insert("smartshift");
+            if (profile.onboard.has_value())
+                features.insert("onboard");
+            if (profile.report_rate.has_value())
+                features.insert("reportrate");
+            if (profile.adaptive.has_value())
+                features.insert("adaptive");
+
+            if (profile.buttons.has_value()) {
+                features.insert("remapbutton");
+                for (auto& button: profile.buttons.value())
+                    (*this)(button.second.action);
+            }
+
+            if (profile.hiresscroll.has_value()) {
+                features.insert("hiresscroll");
+                if (std::holds_alternative<HiresScroll>(profile.hiresscroll.value())) {
+                    auto& hires = std::get<HiresScroll>(profile.hiresscroll.value());
+                    (*this)(hires.up);
+                    (*this)(hires.down);
+                }
+            }
+
+            if (profile.thumbwheel.has_value()) {
+                features.insert("thumbwheel");
+                auto& wheel = profile.thumbwheel.value();
+                (*this)(wheel.left);
+                (*this)(wheel.right);
+                (*this)(wheel.proxy);
+                (*this)(wheel.touch);
+                (*this)(wheel.tap);
+            }
+        }
+    };
+}
+
+std::set<std::string> Configuration::usedFeatures(const config::Device& device) {
+    std::set<std::string> features;
+    feature_collector collector{features};
+    for (auto& profile: device.profiles)
+        collector(profile.second);
+    return features;
+}
+
+void Configuration::inputEvents(std::set<uint>& keys, std::set<uint>& axes) const {
+    input_collector collector{keys, axes};
+    if (devices.has_value())
+        for (auto& device: devices.value())
+            collector(device.second);
+}
+
+std::size_t Configuration::validate(const config::Config& config) {
+    std::set<uint> keys, axes;
+    std::vector<std::string> problems;
+    input_collector collector{keys, axes, &problems};
+
+    auto check = [&](const std::string& where, const config::Profile& profile) {
+        problems.clear();
+        collector(profile);
+        for (auto& problem: problems)
+            logPrintf(WARN, "%s: %s", where.c_str(), problem.c_str());
+        return problems.size();
+    };
+
+    std::size_t count = 0;
+    if (config.devices.has_value()) {
+        for (auto& device: config.devices.value()) {
+            if (auto* profile = std::get_if<config::Profile>(&device.second)) {
+                count += check(device.first, *profile);
+            } else {
+                for (auto& profile: std::get<config::Device>(device.second).profiles)
+                    count += check(device.first + ", profile " + profile.first,
+                                   profile.second);
+            }
+        }
+    }
+    if (config.templates.has_value()) {
+        for (auto& profile: config.templates.value())
+            count += check("Template " + profile.first, profile.second);
+    }
+
+    return count;
+}
+
+void Configuration::inputEvents(const config::Device& device,
+                                std::set<uint>& keys, std::set<uint>& axes) {
+    input_collector collector{keys, axes};
+    collector(device);
 }
 
 Configuration::IPC::IPC(Configuration* config) :
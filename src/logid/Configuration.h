@@ -20,37 +20,177 @@
 #define LOGID_CONFIGURATION_H
 
 #include <config/schema.h>
+#include <config/edit_mutex.h>
 #include <ipcgull/interface.h>
 #include <libconfig.h++>
+#include <util/task.h>
 #include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <mutex>
 #include <chrono>
 #include <set>
+#include <list>
 
 namespace logid {
     namespace defaults {
         static constexpr double io_timeout = 500;
+        static constexpr double io_slo = 0;
         static constexpr int workers = 4;
+        static constexpr int max_workers = 16;
+        static constexpr bool io_timers = false;
+        // Workers with io_timers unless workers is set
+        static constexpr int io_timers_workers = 1;
+        static constexpr bool lock_memory = false;
+        // Heap faulted in when locking memory, per configured device on top
+        static constexpr std::size_t locked_heap = 1024 * 1024;
+        static constexpr std::size_t locked_heap_per_device = 256 * 1024;
+        static constexpr int read_batch = 8;
+        static constexpr int io_threads = 1;
+        static constexpr bool edge_triggered = false;
+        // Logitech, the only vendor whose hidraw nodes are opened
+        static constexpr uint16_t vendor = 0x046d;
+        static constexpr bool per_device_input = false;
+        static constexpr bool per_seat_input = true;
+        static constexpr bool lazy_features = false;
+        static constexpr bool watch_config = true;
+        // An empty cache_dir disables the capability cache
+        static constexpr auto cache_dir = "/var/cache/logid";
+        static constexpr int stability_pings = 5;
+        // Milliseconds, coalesces connection events of a flapping link
+        static constexpr int connection_debounce = 100;
+        // Milliseconds, 0 tears a device down as soon as it disconnects
+        static constexpr int reconnect_grace = 10000;
+        // Milliseconds, how long a device sent to another host is kept
+        static constexpr int switched_host_grace = 8 * 60 * 60 * 1000;
         static constexpr int gesture_threshold = 50;
+        // Upper bound on the gain of an accelerated axis gesture
+        static constexpr double gesture_max_gain = 8;
+        // How many times the other axis the committed direction must lead by
+        static constexpr int gesture_commit_ratio = 2;
+        static constexpr double momentum_friction = 0.1;
+        static constexpr int momentum_rate = 60;
+        static constexpr int hires_session_gap = 1000;
+        static constexpr int adaptive_hysteresis = 25;
+        static constexpr int adaptive_interval = 250;
+        static constexpr int adaptive_window = 100;
+        static constexpr int onboard_profile = 1;
     }
 
-    class Configuration : public config::Config {
+    class Configuration : public config::Config,
+                          public std::enable_shared_from_this<Configuration> {
     public:
-        explicit Configuration(std::string config_file);
+        /* With a cache_dir, a snapshot of the parsed file is kept there
+         * and loaded instead of parsing while the file is unchanged */
+        explicit Configuration(std::string config_file, std::string cache_dir = {});
 
         Configuration();
 
-        // Reloading is not safe, references will be invalidated
-        //void reload();
+        /* Parses the config file again without touching this one, devices
+         * hold references into it so a reload is applied piece by piece */
+        [[nodiscard]] config::Config read() const;
+
+        [[nodiscard]] const std::string& path() const;
+
+        // Guards the devices map against connecting devices and reloads
+        [[nodiscard]] std::mutex& devicesMutex() const;
+
+        /* Turns a bare profile into a device with it as its default
+         * profile, and gives a device without profiles an empty one */
+        static config::Device& deviceConfig(std::variant<config::Device, config::Profile>& device);
+
+        /* The entry for a device by its name, ignoring case, or by its
+         * product ID in hex (e.g. "0xb023"). Known devices are found in an
+         * index built at load time without locking, the others are given
+         * an empty entry. */
+        config::Device& device(const std::string& name, uint16_t pid);
+
+        // Rebuilds the index device() looks in, devicesMutex must be held
+        void indexDevices();
+
+        /* Takes an entry out of devices but keeps it alive, as a device
+         * being probed or parked may still refer to it. devicesMutex must
+         * be held. Returns the entry after it. */
+        config::Devices::iterator retireDevice(config::Devices::iterator it);
+
+        struct device_index {
+            std::unordered_map<std::string, config::Device*> names;
+            // Names lowercased, the first of names differing only in case wins
+            std::unordered_map<std::string, config::Device*> folded;
+            std::unordered_map<uint16_t, config::Device*> pids;
+
+            [[nodiscard]] config::Device* find(const std::string& name, uint16_t pid) const;
+        };
+
+        // Normalizes every entry with deviceConfig and indexes them
+        [[nodiscard]] static std::shared_ptr<const device_index> index(config::Devices& devices);
+
+        /* Queued on a background worker, saves asked for within a short
+         * window are written once. The file is replaced atomically, keeping
+         * its mode and owner, and left alone if its contents would not
+         * change. Only for a Configuration owned by a shared_ptr. */
         void save();
 
+        // Writes now on the calling thread, errors are thrown
+        void saveNow();
+
+        ~Configuration();
+
+        /* Every key and axis any profile may emit, so the virtual input
+         * device can be created with all of them up front */
+        void inputEvents(std::set<uint>& keys, std::set<uint>& axes) const;
+
+        static void inputEvents(const config::Device& device,
+                                std::set<uint>& keys, std::set<uint>& axes);
+
+        /* Warns about every key, axis and gesture direction in the config
+         * that is not known, once on load rather than whenever an action
+         * using it is made. Returns how many there were. */
+        static std::size_t validate(const config::Config& config);
+
+        /* Names of the device features any profile configures or has an
+         * action for */
+        [[nodiscard]] static std::set<std::string> usedFeatures(const config::Device& device);
+
         class IPC : public ipcgull::interface {
         public:
             explicit IPC(Configuration* config);
         };
 
     private:
+        static void _readFile(const std::string& path, libconfig::Config& config);
+
+        /* Fills the sections profiles and templates inherit, the first of
+         * these as it was loaded and the second as it is to be written */
+        static void _resolveTemplates(config::Config& config);
+
+        static void _stripTemplates(config::Config& config);
+
+        /* The file as it would be written now, taken while no setter is
+         * changing the config */
+        [[nodiscard]] std::string _serialize();
+
+        [[nodiscard]] std::string _snapshotPath() const;
+
+        [[nodiscard]] bool _loadSnapshot(uint64_t hash);
+
+        void _storeSnapshot(uint64_t hash) const;
+
         std::string _config_file;
+        std::string _cache_dir;
         libconfig::Config _config;
+        // A config loaded from a snapshot is parsed when first saved
+        bool _parsed = false;
+        mutable std::mutex _devices_mutex;
+        std::atomic<std::shared_ptr<const device_index>> _device_index;
+        // Entries dropped by a reload, guarded by _devices_mutex
+        std::list<config::Devices::node_type> _retired_devices;
+
+        std::mutex _save_lock;
+        task_handle _pending_save;
+        task_set _save_tasks;
+        // Held while writing, saves never overlap
+        std::mutex _save_running;
     };
 
 }
@@ -18,15 +18,27 @@
 
 #include <Device.h>
 #include <DeviceManager.h>
+#include <InputDevice.h>
 #include <features/SmartShift.h>
 #include <features/DPI.h>
 #include <features/RemapButton.h>
 #include <features/HiresScroll.h>
 #include <features/DeviceStatus.h>
 #include <features/ThumbWheel.h>
+#include <features/Battery.h>
+#include <features/OnboardProfiles.h>
+#include <features/ReportRate.h>
+#include <features/Adaptive.h>
 #include <backend/hidpp20/features/Reset.h>
+#include <backend/hidpp20/Batch.h>
+#include <backend/hidpp20/features/FeatureSet.h>
+#include <backend/hidpp20/features/FirmwareVersion.h>
+#include <config/binary.h>
 #include <util/task.h>
 #include <util/log.h>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
 #include <thread>
 #include <utility>
 #include <ipc_defs.h>
@@ -34,6 +46,17 @@
 using namespace logid;
 using namespace logid::backend;
 
+/* Devices keep their state through short sleeps, avoid trusting that for long */
+static constexpr auto max_retained_sleep = std::chrono::minutes(10);
+// Wakeup triggers are gathered for this long before one wakeup runs
+static constexpr auto wakeup_delay = std::chrono::milliseconds(100);
+/* A wakeup this soon after the last one only checks that the device still
+ * holds what was written */
+static constexpr auto wakeup_holdoff = std::chrono::seconds(2);
+// Subscribers see at most one change of these properties per window
+static constexpr auto awake_notify_window = std::chrono::milliseconds(1000);
+static constexpr auto profile_notify_window = std::chrono::milliseconds(100);
+
 DeviceNickname::DeviceNickname(const std::shared_ptr<DeviceManager>& manager) :
         _nickname(manager->newDeviceNickname()), _manager(manager) {
 }
@@ -43,10 +66,8 @@ DeviceNickname::operator std::string() const {
 }
 
 DeviceNickname::~DeviceNickname() {
-    if (auto manager = _manager.lock()) {
-        std::lock_guard<std::mutex> lock(manager->_nick_lock);
-        manager->_device_nicknames.erase(_nickname);
-    }
+    if (auto manager = _manager.lock())
+        manager->_device_nicknames.release(_nickname);
 }
 
 namespace logid {
@@ -66,6 +87,7 @@ std::shared_ptr<Device> Device::make(
     ret->_self = ret;
     ret->_ipc_node->manage(ret);
     ret->_ipc_interface = ret->_ipc_node->make_interface<IPC>(ret.get());
+    ret->_ipc_stats = ret->_ipc_node->make_interface<StatsIPC>(ret.get());
     return ret;
 }
 
@@ -79,6 +101,7 @@ std::shared_ptr<Device> Device::make(
     ret->_self = ret;
     ret->_ipc_node->manage(ret);
     ret->_ipc_interface = ret->_ipc_node->make_interface<IPC>(ret.get());
+    ret->_ipc_stats = ret->_ipc_node->make_interface<StatsIPC>(ret.get());
     return ret;
 }
 
@@ -89,6 +112,18 @@ std::shared_ptr<Device> Device::make(
     ret->_self = ret;
     ret->_ipc_node->manage(ret);
     ret->_ipc_interface = ret->_ipc_node->make_interface<IPC>(ret.get());
+    ret->_ipc_stats = ret->_ipc_node->make_interface<StatsIPC>(ret.get());
+    return ret;
+}
+
+std::shared_ptr<Device> Device::make(
+        std::shared_ptr<backend::hidpp20::Device> device,
+        std::shared_ptr<DeviceManager> manager) {
+    auto ret = std::make_shared<DeviceWrapper>(std::move(device), std::move(manager));
+    ret->_self = ret;
+    ret->_ipc_node->manage(ret);
+    ret->_ipc_interface = ret->_ipc_node->make_interface<IPC>(ret.get());
+    ret->_ipc_stats = ret->_ipc_node->make_interface<StatsIPC>(ret.get());
     return ret;
 }
 
@@ -97,13 +132,13 @@ Device::Device(std::string path, backend::hidpp::DeviceIndex index,
         _hidpp20(hidpp20::Device::make(path, index, manager,
                                        manager->config()->io_timeout.value_or(
                                                defaults::io_timeout))),
-        _path(std::move(path)), _index(index),
-        _config(_getConfig(manager, _hidpp20->name())),
-        _profile_name(ipcgull::property_readable, ""),
+        _index(index),
+        _config(manager->config()->device(_hidpp20->name(), _hidpp20->pid())),
+        _profile_name(ipcgull::property_readable, "", profile_notify_window),
         _manager(manager),
         _nickname(manager),
         _ipc_node(manager->devicesNode()->make_child(_nickname)),
-        _awake(ipcgull::property_readable, true) {
+        _awake(ipcgull::property_readable, true, awake_notify_window) {
     _init();
 }
 
@@ -112,13 +147,13 @@ Device::Device(std::shared_ptr<backend::raw::RawDevice> raw_device,
         _hidpp20(hidpp20::Device::make(
                 std::move(raw_device), index,
                 manager->config()->io_timeout.value_or(defaults::io_timeout))),
-        _path(raw_device->rawPath()), _index(index),
-        _config(_getConfig(manager, _hidpp20->name())),
-        _profile_name(ipcgull::property_readable, ""),
+        _index(index),
+        _config(manager->config()->device(_hidpp20->name(), _hidpp20->pid())),
+        _profile_name(ipcgull::property_readable, "", profile_notify_window),
         _manager(manager),
         _nickname(manager),
         _ipc_node(manager->devicesNode()->make_child(_nickname)),
-        _awake(ipcgull::property_readable, true) {
+        _awake(ipcgull::property_readable, true, awake_notify_window) {
     _init();
 }
 
@@ -127,13 +162,26 @@ Device::Device(Receiver* receiver, hidpp::DeviceIndex index,
         _hidpp20(hidpp20::Device::make(
                 receiver->rawReceiver(), index,
                 manager->config()->io_timeout.value_or(defaults::io_timeout))),
-        _path(receiver->path()), _index(index),
-        _config(_getConfig(manager, _hidpp20->name())),
-        _profile_name(ipcgull::property_readable, ""),
+        _index(index),
+        _config(manager->config()->device(_hidpp20->name(), _hidpp20->pid())),
+        _profile_name(ipcgull::property_readable, "", profile_notify_window),
         _manager(manager),
         _nickname(manager),
         _ipc_node(manager->devicesNode()->make_child(_nickname)),
-        _awake(ipcgull::property_readable, true) {
+        _awake(ipcgull::property_readable, true, awake_notify_window) {
+    _init();
+}
+
+Device::Device(std::shared_ptr<backend::hidpp20::Device> device,
+               const std::shared_ptr<DeviceManager>& manager) :
+        _hidpp20(std::move(device)),
+        _index(_hidpp20->deviceIndex()),
+        _config(manager->config()->device(_hidpp20->name(), _hidpp20->pid())),
+        _profile_name(ipcgull::property_readable, "", profile_notify_window),
+        _manager(manager),
+        _nickname(manager),
+        _ipc_node(manager->devicesNode()->make_child(_nickname)),
+        _awake(ipcgull::property_readable, true, awake_notify_window) {
     _init();
 }
 
@@ -141,28 +189,151 @@ void Device::_init() {
     logPrintf(INFO, "Device found: %s on %s:%d", name().c_str(),
               hidpp20().devicePath().c_str(), _index);
 
+    std::optional<hidpp::ScopedSpan> init_span;
+    init_span.emplace(_hidpp20.get(), "init");
+
+    if (auto manager = _manager.lock())
+        _events = manager->eventStream();
+
     {
         std::unique_lock lock(_profile_mutex);
         _profile = _config.profiles.find(_config.default_profile);
         if (_profile == _config.profiles.end())
             _profile = _config.profiles.insert({_config.default_profile, {}}).first;
-        _profile_name = _config.default_profile;
+        _active_config = &_profile->second;
+        _profile_name.set(_config.default_profile);
+        _publishProfiles();
     }
 
-    _addFeature<features::DPI>("dpi");
-    _addFeature<features::SmartShift>("smartshift");
-    _addFeature<features::HiresScroll>("hiresscroll");
-    _addFeature<features::RemapButton>("remapbutton");
-    _addFeature<features::DeviceStatus>("devicestatus");
-    _addFeature<features::ThumbWheel>("thumbwheel");
+    std::optional<std::string> uncached_firmware;
+    {
+        hidpp::ScopedSpan span(_hidpp20.get(), "discover");
+        uncached_firmware = _discover();
+    }
+    {
+        hidpp::ScopedSpan span(_hidpp20.get(), "input");
+        _makeVirtualInput();
+    }
+
+    /* DeviceStatus and Battery have no configuration, they are always made */
+    std::set<std::string> used;
+    auto manager = _manager.lock();
+    if (manager && manager->config()->lazy_features.value_or(defaults::lazy_features))
+        used = Configuration::usedFeatures(_config);
+    else
+        used = {"dpi", "smartshift", "hiresscroll", "remapbutton", "thumbwheel",
+                "onboard", "reportrate", "adaptive"};
+    used.insert("devicestatus");
+    used.insert("battery");
+    manager.reset();
+
+    _addFeature<features::DPI>("dpi", used);
+    _addFeature<features::SmartShift>("smartshift", used);
+    _addFeature<features::HiresScroll>("hiresscroll", used);
+    _addFeature<features::RemapButton>("remapbutton", used);
+    _addFeature<features::DeviceStatus>("devicestatus", used);
+    _addFeature<features::ThumbWheel>("thumbwheel", used);
+    _addFeature<features::Battery>("battery", used);
+    _addFeature<features::OnboardProfiles>("onboard", used);
+    _addFeature<features::ReportRate>("reportrate", used);
+    _addFeature<features::Adaptive>("adaptive", used);
 
     _makeResetMechanism();
-    reset();
+    _reconfigure(true);
 
-    for (auto& feature: _features) {
-        feature.second->configure();
-        feature.second->listen();
+    {
+        hidpp::ScopedSpan span(_hidpp20.get(), "listen");
+        for (auto& feature: _featureList())
+            feature->listen();
+    }
+
+    {
+        std::lock_guard lock(_feature_mutex);
+        _features_ready = true;
+        if (!_deferred.empty())
+            logPrintf(DEBUG, "%s:%d: %zu unused features deferred",
+                      _hidpp20->devicePath().c_str(), _index, _deferred.size());
     }
+
+    init_span.reset();
+    if (global_loglevel <= DEBUG) {
+        std::string summary;
+        for (auto& span: _hidpp20->initSpans()) {
+            char buf[96];
+            snprintf(buf, sizeof(buf), "%s%s %.1fms/%" PRIu64, summary.empty() ? "" : ", ",
+                     span.name.c_str(), static_cast<double>(span.time.count()) / 1000,
+                     span.reports);
+            summary += buf;
+        }
+        logPrintf(DEBUG, "%s:%d: init spans (time/reports): %s",
+                  _hidpp20->devicePath().c_str(), _index, summary.c_str());
+    }
+
+    if (uncached_firmware) {
+        auto capabilities = _hidpp20->capabilities();
+        auto manager = _manager.lock();
+        if (capabilities && manager && manager->capabilityCache())
+            manager->capabilityCache()->store(_hidpp20->pid(), uncached_firmware.value(),
+                                              capabilities.value());
+    }
+}
+
+std::optional<std::string> Device::_discover() {
+    auto manager = _manager.lock();
+    auto cache = manager ? manager->capabilityCache() : nullptr;
+    std::string firmware;
+
+    if (cache) {
+        try {
+            firmware = hidpp20::FirmwareVersion(_hidpp20.get()).getFirmwareString();
+        } catch (hidpp20::UnsupportedFeature& e) {
+        } catch (hidpp20::Error& e) {
+            logPrintf(DEBUG, "%s:%d: failed to read firmware version: %s",
+                      hidpp20().devicePath().c_str(), _index, e.what());
+        }
+    }
+
+    if (!firmware.empty()) {
+        if (auto cached = cache->load(_hidpp20->pid(), firmware)) {
+            /* Cheap fingerprint: the indexes resolved so far and the
+             * feature count must match what was cached. */
+            try {
+                hidpp20::FeatureSet feature_set(_hidpp20.get());
+                auto& features = cached->features;
+                auto cached_index = [&features](uint16_t id) {
+                    auto it = features.find(id);
+                    return it == features.end() ? 0 : it->second;
+                };
+
+                if (cached_index(hidpp20::FeatureSet::ID) == feature_set.featureIndex() &&
+                    cached_index(hidpp20::FirmwareVersion::ID) ==
+                    _hidpp20->cachedFeatureIndex(hidpp20::FirmwareVersion::ID) &&
+                    feature_set.getFeatureCount() == features.size()) {
+                    _hidpp20->loadCapabilities(cached.value());
+                    logPrintf(DEBUG, "%s:%d: using cached capabilities",
+                              hidpp20().devicePath().c_str(), _index);
+                    return {};
+                }
+            } catch (hidpp20::UnsupportedFeature& e) {
+            }
+
+            logPrintf(INFO, "%s:%d: cached capabilities are stale, rediscovering",
+                      hidpp20().devicePath().c_str(), _index);
+        }
+    }
+
+    try {
+        if (!_hidpp20->enumerateFeatures())
+            logPrintf(DEBUG, "%s:%d: no FeatureSet, probing features individually",
+                      hidpp20().devicePath().c_str(), _index);
+    } catch (hidpp20::Error& e) {
+        logPrintf(WARN, "%s:%d: failed to read the feature table: %s",
+                  hidpp20().devicePath().c_str(), _index, e.what());
+    }
+
+    if (firmware.empty())
+        return {};
+    return firmware;
 }
 
 std::string Device::name() {
@@ -173,44 +344,203 @@ uint16_t Device::pid() {
     return _hidpp20->pid();
 }
 
+std::string Device::nickname() const {
+    return _nickname;
+}
+
+bool Device::awake() const {
+    return _is_awake;
+}
+
+uint64_t Device::reconnects() const {
+    return _reconnects;
+}
+
+void Device::requestSleep() {
+    _cancelWakeup();
+    post([device = this]() { device->sleep(); });
+}
+
+void Device::_cancelWakeup() {
+    std::lock_guard lock(_wakeup_lock);
+    _pending_wakeup.cancel();
+    _pending_wakeup = {};
+}
+
 void Device::sleep() {
+    // A link that went down within wakeup_delay must not end up awake
+    _cancelWakeup();
+
     std::lock_guard<std::mutex> lock(_state_lock);
-    if (_awake) {
-        logPrintf(INFO, "%s:%d fell asleep.", _path.c_str(), _index);
-        _awake = false;
+    if (_is_awake) {
+        logPrintf(INFO, "%s:%d fell asleep.", _hidpp20->devicePath().c_str(), _index);
+        {
+            std::lock_guard held_lock(_held_lock);
+            _is_awake = false;
+        }
+        _awake.set(false);
+        _sleep_time = std::chrono::steady_clock::now();
         _ipc_interface->notifyStatus();
     }
 }
 
 void Device::wakeup() {
     std::lock_guard<std::mutex> lock(_state_lock);
+    auto now = std::chrono::steady_clock::now();
+
+    /* After a short sleep, or right after another wakeup, one read back
+     * tells whether the device kept its configuration. If so, only writes
+     * that differ from it are sent. */
+    bool switched = _switched_host.exchange(false);
+    bool recent = !switched &&
+                  (_is_awake ? (_wakeup_time && now - _wakeup_time.value() < wakeup_holdoff) :
+                   now - _sleep_time < max_retained_sleep);
+    bool retained = recent && _hidpp20->verifyShadow();
+
+    if (retained)
+        logPrintf(DEBUG, "%s:%d retained its configuration.", _hidpp20->devicePath().c_str(), _index);
+
+    /* The other host may have changed any setting, one read back proves
+     * nothing. Everything is written again, without a reset. */
+    if (switched)
+        _hidpp20->invalidateShadow();
 
-    reconfigure();
+    _reconfigure(!retained && !switched);
+    _wakeup_time = std::chrono::steady_clock::now();
 
-    if (!_awake) {
-        _awake = true;
+    if (!_is_awake) {
+        {
+            std::lock_guard held_lock(_held_lock);
+            _is_awake = true;
+        }
+        ++_reconnects;
+        _awake.set(true);
         _ipc_interface->notifyStatus();
     }
 
-    logPrintf(INFO, "%s:%d woke up.", _path.c_str(), _index);
+    // The profile is applied, writes made meanwhile go on top of it
+    _flushHeldWrites();
+
+    if (switched)
+        logPrintf(INFO, "%s:%d came back from another host.",
+                  _hidpp20->devicePath().c_str(), _index);
+    else
+        logPrintf(INFO, "%s:%d woke up.", _hidpp20->devicePath().c_str(), _index);
+}
+
+void Device::hostSwitched(bool switched) {
+    _switched_host = switched;
+}
+
+bool Device::switchedHost() const {
+    return _switched_host;
+}
+
+void Device::requestWakeup() {
+    std::lock_guard lock(_wakeup_lock);
+    if (!_pending_wakeup.done())
+        return;
+
+    _pending_wakeup = run_task_after([self_weak = _self]() {
+        if (auto self = self_weak.lock()) {
+            {
+                // Later triggers queue a new wakeup from here on
+                std::lock_guard lock(self->_wakeup_lock);
+                self->_pending_wakeup = {};
+            }
+            self->post([device = self.get()]() { device->wakeup(); });
+        }
+    }, wakeup_delay);
+    _tasks.add(_pending_wakeup);
+}
+
+void Device::rebind(std::shared_ptr<backend::raw::RawDevice> raw_device) {
+    _hidpp20->rebind(std::move(raw_device));
+    logPrintf(INFO, "%s:%d reconnected.", _hidpp20->devicePath().c_str(), _index);
+
+    // Same as waking up, a short absence leaves the config to verify only
+    post([device = this]() { device->wakeup(); });
 }
 
 void Device::reconfigure() {
-    reset();
+    _reconfigure(true);
+}
 
-    for (auto& feature: _features)
-        feature.second->configure();
+void Device::_reconfigure(bool reset) {
+    std::vector<std::pair<std::string, std::shared_ptr<features::DeviceFeature>>> features;
+    bool trace;
+    {
+        std::lock_guard lock(_feature_mutex);
+        features.assign(_features.begin(), _features.end());
+        // Only bring-up is traced, the spans are kept for the device's life
+        trace = !_features_ready;
+    }
+
+    std::optional<hidpp::ScopedSpan> span;
+    if (reset) {
+        if (trace)
+            span.emplace(_hidpp20.get(), "reset");
+        this->reset();
+        span.reset();
+    }
+
+    /* Every feature's writes go out together */
+    hidpp20::Batch batch(_hidpp20.get());
+    for (auto& [name, feature]: features) {
+        if (trace)
+            span.emplace(_hidpp20.get(), "configure " + name);
+        feature->configure();
+        span.reset();
+    }
+
+    if (trace)
+        span.emplace(_hidpp20.get(), "commit");
+    batch.commit();
 }
 
 void Device::reset() {
+    // The device may drop back to its defaults, nothing shadowed is valid now
+    _hidpp20->invalidateShadow();
+
     if (_reset_mechanism)
         (*_reset_mechanism)();
     else
         logPrintf(DEBUG, "%s:%d tried to reset, but no reset mechanism was "
-                         "available.", _path.c_str(), _index);
+                         "available.", _hidpp20->devicePath().c_str(), _index);
+}
+
+void Device::_makeVirtualInput() {
+    auto manager = _manager.lock();
+    if (!manager)
+        return;
+
+    if (!manager->config()->per_device_input.value_or(defaults::per_device_input)) {
+        // Seats never share one, input from one does not wait on another
+        if (manager->config()->per_seat_input.value_or(defaults::per_seat_input)) {
+            auto seat = manager->seat(_hidpp20->devicePath());
+            if (seat != DeviceManager::default_seat)
+                _virtual_input = manager->virtualInput(seat);
+        }
+        return;
+    }
+
+    /* Events of this device no longer contend with other devices */
+    std::set<uint> keys, axes;
+    Configuration::inputEvents(_config, keys, axes);
+    try {
+        _virtual_input = std::make_shared<InputDevice>(
+                ("LogiOps Virtual Input (" + name() + ")").c_str(), keys, axes);
+        _own_input = true;
+    } catch (std::system_error& e) {
+        logPrintf(WARN, "%s:%d: Could not create input device, using the "
+                        "shared one: %s", _hidpp20->devicePath().c_str(), _index, e.what());
+    }
 }
 
 std::shared_ptr<InputDevice> Device::virtualInput() const {
+    if (_virtual_input)
+        return _virtual_input;
+
     if (auto manager = _manager.lock()) {
         return manager->virtualInput();
     } else {
@@ -240,48 +570,335 @@ std::vector<std::string> Device::getProfiles() const {
 void Device::setProfile(const std::string& profile) {
     std::unique_lock lock(_profile_mutex);
 
+    auto& from = _profile->second;
     _profile = _config.profiles.find(profile);
     if (_profile == _config.profiles.end())
         _profile = _config.profiles.insert({profile, {}}).first;
-    _profile_name = profile;
+    _active_config = &_profile->second;
+    _profile_name.set(profile);
+    _publishProfiles();
+    auto& to = _profile->second;
+
+    _applyProfile(from, to);
+}
 
-    for (auto& feature : _features)
-        feature.second->setProfile(_profile->second);
+void Device::_applyProfile(const config::Profile& from, config::Profile& to) {
+    auto features = _featureList();
+    for (auto& feature: features)
+        feature->setProfile(to);
 
-    reconfigure();
+    // Only features whose config differs are written, a reset if one needs it
+    std::vector<std::shared_ptr<features::DeviceFeature>> changed;
+    for (auto& feature: features) {
+        switch (feature->compareProfiles(from, to)) {
+            case features::DeviceFeature::Unchanged:
+                break;
+            case features::DeviceFeature::Changed:
+                changed.push_back(feature);
+                break;
+            case features::DeviceFeature::NeedsReset:
+                reconfigure();
+                return;
+        }
+    }
+
+    if (changed.empty())
+        return;
+
+    hidpp20::Batch batch(_hidpp20.get());
+    for (auto& feature: changed)
+        feature->configure();
+    batch.commit();
+}
+
+void Device::reloadConfig(const std::vector<std::shared_ptr<Device>>& devices,
+                          const config::Device& next) {
+    if (devices.empty())
+        return;
+
+    // Devices of the same name share their config
+    auto& config = devices.front()->_config;
+
+    std::vector<std::unique_lock<config::edit_mutex>> locks;
+    locks.reserve(devices.size());
+    for (auto& device: devices)
+        locks.emplace_back(device->_profile_mutex);
+
+    std::set<std::string> changed;
+    for (auto& profile: config.profiles) {
+        auto it = next.profiles.find(profile.first);
+        if (it == next.profiles.end() || !config::equal(profile.second, it->second))
+            changed.insert(profile.first);
+    }
+
+    bool added = std::any_of(next.profiles.begin(), next.profiles.end(),
+                             [&config](const auto& profile) {
+                                 return !config.profiles.contains(profile.first);
+                             });
+    const std::string default_profile = next.default_profile;
+
+    if (changed.empty() && !added && default_profile == (std::string) config.default_profile)
+        return;
+
+    /* Where each device goes once the profiles are replaced, and what it
+     * ran before for the diff. Devices on an untouched profile stay put. */
+    struct Move {
+        std::string to;
+        std::optional<config::Profile> from;
+    };
+    std::vector<Move> moves;
+    for (auto& device: devices) {
+        auto& move = moves.emplace_back();
+        const std::string& active = device->_profile->first;
+        move.to = next.profiles.contains(active) ? active : default_profile;
+        if (move.to != active || changed.contains(active))
+            move.from = device->_profile->second;
+    }
+
+    // Anything kept that refers to a profile about to be replaced has to go
+    for (auto& device: devices) {
+        auto features = device->_featureList();
+        for (auto& name: changed) {
+            for (auto& feature: features)
+                feature->dropProfile(config.profiles.at(name));
+        }
+    }
+
+    // Replaced in place, the map nodes of kept profiles stay where they are
+    for (auto& name: changed) {
+        auto it = next.profiles.find(name);
+        if (it != next.profiles.end())
+            config.profiles.at(name) = it->second;
+        else
+            config.profiles.erase(name);
+    }
+    for (auto& profile: next.profiles) {
+        if (!config.profiles.contains(profile.first))
+            config.profiles.emplace(profile.first, profile.second);
+    }
+    config.default_profile = default_profile;
+
+    for (std::size_t i = 0; i < devices.size(); ++i) {
+        auto& device = devices[i];
+        auto& move = moves[i];
+        if (!move.from)
+            continue;
+
+        device->_profile = config.profiles.find(move.to);
+        if (device->_profile == config.profiles.end())
+            device->_profile = config.profiles.insert({move.to, {}}).first;
+        device->_active_config = &device->_profile->second;
+        device->_profile_name.set(move.to);
+        device->_publishProfiles();
+
+        device->_applyProfile(move.from.value(), device->_profile->second);
+        logPrintf(INFO, "%s:%d: reloaded profile %s", device->hidpp20().devicePath().c_str(),
+                  device->_index, move.to.c_str());
+    }
+
+    // Devices that stayed put list the new profiles too
+    for (std::size_t i = 0; i < devices.size(); ++i) {
+        if (!moves[i].from)
+            devices[i]->_publishProfiles();
+    }
 }
 
 void Device::setProfileDelayed(const std::string& profile) {
-    run_task([self_weak = _self, profile](){
+    _tasks.add(post([this, profile]() {
+        // Chosen by hand, losing focus no longer goes back on it
+        _focus_return.reset();
+        setProfile(profile);
+    }));
+}
+
+void Device::clearProfileDelayed(const std::string& profile) {
+    // From the snapshot, the bus does not wait on the profile lock either
+    auto profiles = _profile_state.load();
+    if (!profiles || std::find(profiles->names.begin(), profiles->names.end(),
+                               profile) == profiles->names.end())
+        throw std::invalid_argument("unknown profile");
+
+    postIPC([this, profile]() { clearProfile(profile); });
+}
+
+void Device::setFocus(const std::string& application) {
+    {
+        std::lock_guard lock(_focus_lock);
+        const bool queued = _focus_next.has_value();
+        _focus_next = application;
+        if (queued)
+            return;
+    }
+
+    _tasks.add(post([this]() {
+        std::string application;
+        {
+            std::lock_guard lock(_focus_lock);
+            application = std::move(_focus_next.value());
+            _focus_next.reset();
+        }
+        _applyFocus(application);
+    }));
+}
+
+void Device::_applyFocus(const std::string& application) {
+    std::string active, target;
+    {
+        std::shared_lock lock(_profile_mutex);
+        active = activeProfileName();
+        for (auto& profile: _config.profiles) {
+            auto& applications = profile.second.applications;
+            if (applications && applications->contains(application)) {
+                target = profile.first;
+                break;
+            }
+        }
+
+        if (target.empty()) {
+            if (!_focus_return)
+                return;
+            // The profile may have gone with a reload since
+            target = _config.profiles.contains(*_focus_return) ?
+                     *_focus_return : (std::string) _config.default_profile;
+            _focus_return.reset();
+        } else if (!_focus_return) {
+            _focus_return = active;
+        }
+    }
+
+    if (target == active)
+        return;
+
+    logPrintf(DEBUG, "%s:%d: %s has focus, switching to profile %s",
+              _hidpp20->devicePath().c_str(), _index, application.c_str(), target.c_str());
+    setProfile(target);
+}
+
+task_handle Device::post(std::function<void()> function, std::source_location location) {
+    return _strand.post([self_weak = _self, function = std::move(function)]() {
         if (auto self = self_weak.lock())
-            self->setProfile(profile);
-    });
+            function();
+    }, location);
+}
+
+void Device::postIPC(std::function<void()> function, std::source_location location) {
+    _tasks.add(post([this, function = std::move(function)]() {
+        try {
+            function();
+        } catch (std::exception& e) {
+            logPrintf(WARN, "%s:%d: IPC call failed: %s",
+                      _hidpp20->devicePath().c_str(), _index, e.what());
+        }
+    }, location));
+}
+
+void Device::postWrite(const std::string& setting, std::function<void()> function,
+                       std::source_location location) {
+    auto window = _hidpp20->transport().write_window;
+    {
+        std::lock_guard lock(_held_lock);
+        if (!_is_awake) {
+            _held_writes[setting] = std::move(function);
+            return;
+        }
+
+        /* The first write schedules the flush, later ones join it until
+         * it runs, replacing any earlier write of the same setting */
+        bool first = _held_writes.empty();
+        _held_writes[setting] = std::move(function);
+        if (!first)
+            return;
+    }
+
+    if (window.count() > 0) {
+        _tasks.add(run_task_after([self_weak = _self, location]() {
+            if (auto self = self_weak.lock())
+                self->post([device = self.get()]() { device->_flushHeldWrites(); },
+                           location);
+        }, window));
+    } else {
+        _tasks.add(post([this]() { _flushHeldWrites(); }, location));
+    }
+}
+
+void Device::_flushHeldWrites() {
+    std::map<std::string, std::function<void()>> writes;
+    {
+        std::lock_guard lock(_held_lock);
+        // Asleep again since the window opened, wakeup sends them
+        if (!_is_awake)
+            return;
+        writes.swap(_held_writes);
+    }
+
+    if (writes.empty())
+        return;
+
+    logPrintf(DEBUG, "%s:%d: sending %zu writes",
+              _hidpp20->devicePath().c_str(), _index, writes.size());
+
+    // Feature writes are queued on the batch, reads still go out in place
+    hidpp20::Batch batch(_hidpp20.get());
+    for (auto& [setting, function]: writes) {
+        try {
+            function();
+        } catch (std::exception& e) {
+            logPrintf(WARN, "%s:%d: %s write failed: %s",
+                      _hidpp20->devicePath().c_str(), _index, setting.c_str(), e.what());
+        }
+    }
+
+    try {
+        batch.commit();
+    } catch (std::exception& e) {
+        logPrintf(WARN, "%s:%d: writes failed: %s",
+                  _hidpp20->devicePath().c_str(), _index, e.what());
+    }
 }
 
 void Device::removeProfile(const std::string& profile) {
     std::unique_lock lock(_profile_mutex);
 
-    if (profile == (std::string)_profile_name)
+    if (profile == _profile->first)
         throw std::invalid_argument("cannot remove active profile");
     else if (profile == (std::string)_config.default_profile)
         throw std::invalid_argument("cannot remove default profile");
 
-    _config.profiles.erase(profile);
+    auto it = _config.profiles.find(profile);
+    if (it == _config.profiles.end())
+        return;
+
+    for (auto& feature: _featureList())
+        feature->dropProfile(it->second);
+    _config.profiles.erase(it);
+    _publishProfiles();
+}
+
+void Device::_publishProfiles() {
+    auto state = std::make_shared<profile_state>();
+    state->active = _profile->first;
+    for (auto& profile: _config.profiles)
+        state->names.push_back(profile.first);
+    _profile_state.store(std::move(state));
 }
 
 void Device::clearProfile(const std::string& profile) {
     std::unique_lock lock(_profile_mutex);
 
-    if (profile == (std::string)_profile_name) {
+    if (profile == _profile->first) {
+        for (auto& feature: _featureList())
+            feature->dropProfile(_profile->second);
         _profile->second = config::Profile();
 
-        for (auto& feature : _features)
-            feature.second->setProfile(_profile->second);
+        for (auto& feature: _featureList())
+            feature->setProfile(_profile->second);
 
         reconfigure();
     } else {
         auto it = _config.profiles.find(profile);
         if (it != _config.profiles.end()) {
+            for (auto& feature: _featureList())
+                feature->dropProfile(it->second);
             it->second = config::Profile();
         } else {
             throw std::invalid_argument("unknown profile");
@@ -289,6 +906,170 @@ void Device::clearProfile(const std::string& profile) {
     }
 }
 
+std::shared_ptr<features::DeviceFeature> Device::_getFeature(const std::string& name) {
+    std::function<std::shared_ptr<features::DeviceFeature>(config::Profile&)> make;
+    std::promise<std::shared_ptr<features::DeviceFeature>> made;
+    std::shared_future<std::shared_ptr<features::DeviceFeature>> pending;
+    {
+        std::lock_guard lock(_feature_mutex);
+        auto it = _features.find(name);
+        if (it != _features.end())
+            return it->second;
+
+        auto deferred = _deferred.find(name);
+        if (deferred == _deferred.end())
+            return nullptr;
+
+        if (deferred->second.made.valid()) {
+            pending = deferred->second.made;
+        } else {
+            make = deferred->second.make;
+            deferred->second.made = made.get_future().share();
+        }
+    }
+
+    // Another caller is making it
+    if (pending.valid())
+        return pending.get();
+
+    /* Not made under the feature lock. The profile is handed in, the
+     * caller may hold the profile lock (e.g. actions made by setProfile). */
+    config::Profile* profile = _active_config;
+    std::shared_ptr<features::DeviceFeature> feature;
+    try {
+        feature = make(*profile);
+    } catch (features::UnsupportedFeature& e) {
+    } catch (...) {
+        // Left deferred, the next caller tries again
+        {
+            std::lock_guard lock(_feature_mutex);
+            _deferred.at(name).made = {};
+        }
+        made.set_value(nullptr);
+        throw;
+    }
+
+    bool ready;
+    {
+        std::lock_guard lock(_feature_mutex);
+        if (feature)
+            _features.emplace(name, feature);
+        _deferred.erase(name);
+        ready = _features_ready;
+    }
+    made.set_value(feature);
+
+    if (!feature)
+        return nullptr;
+
+    logPrintf(DEBUG, "%s:%d: made deferred feature %s",
+              _hidpp20->devicePath().c_str(), _index, name.c_str());
+
+    // A profile switch that listed the features before this one missed it
+    if (config::Profile* active = _active_config; active != profile)
+        feature->setProfile(*active);
+
+    // Otherwise _init configures it with the rest
+    if (ready) {
+        feature->configure();
+        feature->listen();
+    }
+
+    return feature;
+}
+
+std::vector<std::shared_ptr<features::DeviceFeature>> Device::_featureList() {
+    std::lock_guard lock(_feature_mutex);
+    std::vector<std::shared_ptr<features::DeviceFeature>> ret;
+    ret.reserve(_features.size());
+    for (auto& feature: _features)
+        ret.push_back(feature.second);
+    return ret;
+}
+
+Device::cached_state Device::cachedState() {
+    cached_state state;
+    state.active = _is_awake;
+    {
+        // Profiles added by a device sharing the config show up here
+        std::shared_lock lock(_profile_mutex, std::try_to_lock);
+        if (lock.owns_lock())
+            _publishProfiles();
+    }
+    if (auto profiles = _profile_state.load()) {
+        state.profile = profiles->active;
+        state.profiles = profiles->names;
+    }
+
+    std::vector<std::pair<std::string, std::shared_ptr<features::DeviceFeature>>> features;
+    {
+        std::lock_guard lock(_feature_mutex);
+        features.assign(_features.begin(), _features.end());
+    }
+    for (auto& [name, feature]: features) {
+        auto feature_state = feature->cachedState();
+        if (!feature_state.empty())
+            state.features.emplace(name, std::move(feature_state));
+    }
+
+    return state;
+}
+
+std::tuple<double, double> Device::getLatency() const {
+    using ms = std::chrono::duration<double, std::milli>;
+    return {ms(_hidpp20->roundTripTime()).count(), ms(_hidpp20->ioTimeout()).count()};
+}
+
+std::tuple<std::vector<std::string>, std::vector<double>, std::vector<uint64_t>>
+Device::getInitBreakdown() const {
+    std::tuple<std::vector<std::string>, std::vector<double>, std::vector<uint64_t>> ret;
+    for (auto& span: _hidpp20->initSpans()) {
+        std::get<0>(ret).push_back(span.name);
+        std::get<1>(ret).push_back(static_cast<double>(span.time.count()) / 1000);
+        std::get<2>(ret).push_back(span.reports);
+    }
+    return ret;
+}
+
+const std::shared_ptr<memory_account>& Device::memoryAccount() const {
+    return _memory;
+}
+
+std::map<std::string, uint64_t> Device::memoryUsage() const {
+    std::map<std::string, uint64_t> usage = {
+            {"device",   sizeof(Device)},
+            {"features", _memory->bytes(memory_account::features)},
+            {"actions",  _memory->bytes(memory_account::actions)},
+            {"handlers", _hidpp20->handlerFootprint()},
+    };
+
+    if (_own_input)
+        usage.emplace("input", sizeof(InputDevice));
+
+    std::string packed;
+    {
+        std::shared_lock lock(_profile_mutex);
+        config::bin_writer writer{packed};
+        config::pack(writer, _config);
+    }
+    usage.emplace("config_snapshot", packed.size());
+
+    return usage;
+}
+
+std::tuple<std::vector<std::string>, std::vector<uint64_t>> Device::getMemory() const {
+    std::tuple<std::vector<std::string>, std::vector<uint64_t>> ret;
+    for (auto& [kind, bytes]: memoryUsage()) {
+        std::get<0>(ret).push_back(kind);
+        std::get<1>(ret).push_back(bytes);
+    }
+    return ret;
+}
+
+std::string Device::activeProfileName() const {
+    return _profile->first;
+}
+
 config::Profile& Device::activeProfile() {
     std::shared_lock lock(_profile_mutex);
     return _profile->second;
@@ -316,51 +1097,79 @@ Device::IPC::IPC(Device* device) :
                 SERVICE_ROOT_NAME ".Device",
                 {
                         {"GetProfiles", {device, &Device::getProfiles, {"profiles"}}},
-                        {"SetProfile", {device, &Device::setProfile, {"profile"}}},
+                        {"SetProfile", {device, &Device::setProfileDelayed, {"profile"}}},
                         {"RemoveProfile", {device, &Device::removeProfile, {"profile"}}},
-                        {"ClearProfile", {device, &Device::clearProfile, {"profile"}}}
+                        {"ClearProfile", {device, &Device::clearProfileDelayed, {"profile"}}},
+                        {"GetLatency", {device, &Device::getLatency, {"rtt", "timeout"}}},
+                        {"GetInitBreakdown", {device, &Device::getInitBreakdown,
+                                              {"spans", "time", "reports"}}},
+                        {"GetMemory", {device, &Device::getMemory, {"kinds", "bytes"}}}
                 },
                 {
                         {"Name",           ipcgull::property<std::string>(
                                 ipcgull::property_readable, device->name())},
                         {"ProductID",      ipcgull::property<uint16_t>(
                                 ipcgull::property_readable, device->pid())},
-                        {"Active",         device->_awake},
+                        {"Active",         device->_awake.property()},
                         {"DefaultProfile", device->_config.default_profile},
-                        {"ActiveProfile", device->_profile_name}
+                        {"ActiveProfile", device->_profile_name.property()}
                 }, {
                         {"StatusChanged", ipcgull::signal::make_signal<bool>({"active"})}
                 }), _device(*device) {
 }
 
-void Device::IPC::notifyStatus() const {
-    emit_signal("StatusChanged", (bool) (_device._awake));
+Device::StatsIPC::StatsIPC(Device* device) :
+        ipcgull::interface(
+                SERVICE_ROOT_NAME ".Device.Stats",
+                {
+                        {"GetCounters", {this, &StatsIPC::getCounters,
+                                         {"requests", "responses", "timeouts", "hidpp10Errors",
+                                          "hidpp20Errors", "retries", "unmatched"}}},
+                        {"GetRttHistogram", {this, &StatsIPC::getRttHistogram, {"buckets"}}},
+                        {"GetEvents", {this, &StatsIPC::getEvents,
+                                       {"indexes", "features", "counts"}}}
+                }, {}, {}), _device(*device) {
 }
 
-config::Device& Device::_getConfig(
-        const std::shared_ptr<DeviceManager>& manager,
-        const std::string& name) {
-    static std::mutex config_mutex;
-    std::lock_guard<std::mutex> lock(config_mutex);
-    auto& devices = manager->config()->devices.value();
+std::tuple<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t>
+Device::StatsIPC::getCounters() const {
+    auto stats = _device._hidpp20->transportStats();
+    return {stats.requests, stats.responses, stats.timeouts, stats.hidpp10_errors,
+            stats.hidpp20_errors, stats.retries, stats.unmatched};
+}
 
-    if (!devices.count(name)) {
-        devices.emplace(name, config::Device());
-    }
+std::vector<uint64_t> Device::StatsIPC::getRttHistogram() const {
+    auto stats = _device._hidpp20->transportStats();
+    return {stats.rtt_us.begin(), stats.rtt_us.end()};
+}
 
-    auto& device = devices.at(name);
-    if (std::holds_alternative<config::Profile>(device)) {
-        config::Device d;
-        d.profiles["default"] = std::get<config::Profile>(device);
-        d.default_profile = "default";
-        device = std::move(d);
+std::tuple<std::vector<uint16_t>, std::vector<uint16_t>, std::vector<uint64_t>>
+Device::StatsIPC::getEvents() const {
+    auto stats = _device._hidpp20->transportStats();
+
+    std::map<uint8_t, uint16_t> feature_ids;
+    if (auto capabilities = _device._hidpp20->capabilities()) {
+        for (auto& [id, index]: capabilities->features)
+            feature_ids[index] = id;
     }
 
-    auto& conf = std::get<config::Device>(device);
-    if (conf.profiles.empty()) {
-        conf.profiles["default"] = {};
-        conf.default_profile = "default";
+    std::tuple<std::vector<uint16_t>, std::vector<uint16_t>, std::vector<uint64_t>> ret;
+    for (std::size_t i = 0; i < stats.events.size(); ++i) {
+        if (!stats.events[i])
+            continue;
+        auto id = feature_ids.find(i);
+        std::get<0>(ret).push_back(i);
+        std::get<1>(ret).push_back(id == feature_ids.end() ? 0xffff : id->second);
+        std::get<2>(ret).push_back(stats.events[i]);
     }
+    return ret;
+}
 
-    return conf;
+void Device::IPC::notifyStatus() const {
+    emit_signal("StatusChanged", (bool) _device._is_awake);
+    auto manager = _device._manager.lock();
+    auto self = _device._self.lock();
+    if (manager && self)
+        manager->deviceStatusChanged(self);
 }
+
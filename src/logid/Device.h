@@ -22,9 +22,17 @@
 #include <features/DeviceFeature.h>
 #include <backend/hidpp20/Device.h>
 #include <backend/hidpp/defs.h>
+#include <util/task.h>
+#include <util/coalesced_property.h>
+#include <util/memory.h>
 #include <ipcgull/node.h>
 #include <ipcgull/interface.h>
 #include <Configuration.h>
+#include <config/edit_mutex.h>
+#include <EventStream.h>
+#include <atomic>
+#include <map>
+#include <future>
 
 namespace logid {
     class DeviceManager;
@@ -62,18 +70,74 @@ namespace logid {
 
         uint16_t pid();
 
+        // The name of its IPC node, unique among connected devices
+        [[nodiscard]] std::string nickname() const;
+
+        [[nodiscard]] bool awake() const;
+
+        // Times it woke up after falling asleep or disconnecting
+        [[nodiscard]] uint64_t reconnects() const;
+
         [[nodiscard]] config::Profile& activeProfile();
 
+        /* For features to call from setProfile and dropProfile, which run
+         * with the profile lock already held */
+        [[nodiscard]] std::string activeProfileName() const;
+
         [[nodiscard]] std::vector<std::string> getProfiles() const;
 
         void setProfile(const std::string& profile);
 
         void setProfileDelayed(const std::string& profile);
 
+        /* Switches to the first profile listing application, or back to the
+         * profile from before the last such switch if none does, unless a
+         * profile was set through setProfileDelayed since. Changes queued
+         * faster than they apply are folded into the latest one. */
+        void setFocus(const std::string& application);
+
+        /* Replaces the config devices share with next. Profiles that kept
+         * their contents are left alone, a device on one that changed only
+         * writes the features whose config differs. */
+        static void reloadConfig(const std::vector<std::shared_ptr<Device>>& devices,
+                                 const config::Device& next);
+
         void removeProfile(const std::string& profile);
 
         void clearProfile(const std::string& profile);
 
+        // Through postIPC, clearing the active profile reconfigures the device
+        void clearProfileDelayed(const std::string& profile);
+
+        /* Measured round trip time and current I/O timeout, in ms */
+        [[nodiscard]] std::tuple<double, double> getLatency() const;
+
+        /* Where bringing the device up went: each span with its time in ms
+         * and the reports it wrote, in the order they finished */
+        [[nodiscard]] std::tuple<std::vector<std::string>, std::vector<double>,
+                std::vector<uint64_t>> getInitBreakdown() const;
+
+        struct cached_state {
+            bool active;
+            std::string profile;
+            std::vector<std::string> profiles;
+            // By feature, deferred features and ones that read nothing yet are left out
+            std::map<std::string, std::map<std::string, std::string>> features;
+        };
+
+        /* Served from what is already known, the device is never asked */
+        [[nodiscard]] cached_state cachedState();
+
+        // Features, actions and gestures made for the device charge this
+        [[nodiscard]] const std::shared_ptr<memory_account>& memoryAccount() const;
+
+        /* Bytes held for the device by what they are for. The config is
+         * not measured, config_snapshot is the size of it packed. */
+        [[nodiscard]] std::map<std::string, uint64_t> memoryUsage() const;
+
+        [[nodiscard]] std::tuple<std::vector<std::string>, std::vector<uint64_t>>
+        getMemory() const;
+
         backend::hidpp20::Device& hidpp20();
 
         static std::shared_ptr<Device> make(
@@ -91,28 +155,73 @@ namespace logid {
                 backend::hidpp::DeviceIndex index,
                 std::shared_ptr<DeviceManager> manager);
 
+        /* Takes over an already initialized device, e.g. a probe */
+        static std::shared_ptr<Device> make(
+                std::shared_ptr<backend::hidpp20::Device> device,
+                std::shared_ptr<DeviceManager> manager);
+
         void wakeup();
 
+        /* Triggers arriving while a wakeup is pending fold into it, so a
+         * link event and a reconfiguration broadcast cost one wakeup */
+        void requestWakeup();
+
+        // Drops a pending wakeup and queues sleep() behind anything posted
+        void requestSleep();
+
         void sleep();
 
+        /* Set by ChangeHostAction as it sends the device to another host.
+         * Its state is not touched meanwhile, so on return the config is
+         * only verified, however long it was away. */
+        void hostSwitched(bool switched = true);
+
+        [[nodiscard]] bool switchedHost() const;
+
+        /* Revives a device parked after a disconnect on the node it came
+         * back on. Throws if the node holds a different device. */
+        void rebind(std::shared_ptr<backend::raw::RawDevice> raw_device);
+
         void reconfigure();
 
         void reset();
 
+        /* Runs function on this device's strand, after anything posted
+         * before it. Skipped if the device is gone by then. */
+        task_handle post(std::function<void()> function,
+                         std::source_location location = std::source_location::current());
+
+        /* For IPC handlers, the bus is not held up by a slow device. The
+         * reply goes out before function runs, what it throws is logged. */
+        void postIPC(std::function<void()> function,
+                     std::source_location location = std::source_location::current());
+
+        /* Like postIPC, for a write of one setting: written from the
+         * device's strand, the reply does not wait for it. Writes posted
+         * before the strand gets to them are committed as one batch, with
+         * only the latest write per setting kept. While the device sleeps
+         * they are kept until wakeup instead of each timing out first. On
+         * a bus with a write window (Bluetooth), writes are gathered the
+         * same way for the length of the window. */
+        void postWrite(const std::string& setting, std::function<void()> function,
+                       std::source_location location = std::source_location::current());
+
         [[nodiscard]] std::shared_ptr<InputDevice> virtualInput() const;
 
+        /* Hands a decoded input event to IPC subscribers, a load and a
+         * branch while there are none */
+        void recordEvent(EventStream::Kind kind, uint16_t code, int16_t x = 0, int16_t y = 0) {
+            if (_events && _events->active())
+                _events->record(_self.lock(), kind, code, x, y);
+        }
+
         [[nodiscard]] std::shared_ptr<ipcgull::node> ipcNode() const;
 
+        /* Makes a deferred feature on first use, which blocks on the device.
+         * Callers asking for it meanwhile wait for that one. */
         template<typename T>
         std::shared_ptr<T> getFeature(const std::string& name) {
-            auto it = _features.find(name);
-            if (it == _features.end())
-                return nullptr;
-            try {
-                return std::dynamic_pointer_cast<T>(it->second);
-            } catch (std::bad_cast& e) {
-                return nullptr;
-            }
+            return std::dynamic_pointer_cast<T>(_getFeature(name));
         }
 
         Device(const Device&) = delete;
@@ -132,35 +241,100 @@ namespace logid {
         Device(Receiver* receiver, backend::hidpp::DeviceIndex index,
                const std::shared_ptr<DeviceManager>& manager);
 
-        static config::Device& _getConfig(
-                const std::shared_ptr<DeviceManager>& manager,
-                const std::string& name);
+        Device(std::shared_ptr<backend::hidpp20::Device> device,
+               const std::shared_ptr<DeviceManager>& manager);
 
         void _init();
 
-        /* Adds a feature without calling an error if unsupported */
+        void _reconfigure(bool reset);
+
+        /* Loads the feature table and static responses from the capability
+         * cache, or enumerates the features. Returns the firmware string
+         * to store the results under once init is done, if any. */
+        std::optional<std::string> _discover();
+
+        /* Moves the features from one profile to another and writes what
+         * differs, requires the profile lock */
+        void _applyProfile(const config::Profile& from, config::Profile& to);
+
+        /* Adds a feature without calling an error if unsupported, which
+         * T::supported checks against the device's feature table before
+         * anything is constructed. One not in use is deferred until
+         * getFeature asks for it. */
         template<typename T>
-        void _addFeature(std::string name) {
+        void _addFeature(std::string name, const std::set<std::string>& used) {
+            backend::hidpp::ScopedSpan span(_hidpp20.get(), "feature " + name);
+            if (!T::supported(this))
+                return;
+
+            if (!used.contains(name)) {
+                std::lock_guard lock(_feature_mutex);
+                _deferred[std::move(name)].make = [this](config::Profile& profile) {
+                    return _makeFeature<T>(profile);
+                };
+                return;
+            }
+
             try {
-                _features.emplace(name, features::DeviceFeature::make<T>(this));
+                auto feature = _makeFeature<T>(*_active_config);
+                std::lock_guard lock(_feature_mutex);
+                _features.emplace(std::move(name), std::move(feature));
             } catch (features::UnsupportedFeature& e) {
             }
         }
 
+        /* Features are given the profile, not reading it from the device,
+         * they may be made while the profile lock is held */
+        template<typename T>
+        std::shared_ptr<features::DeviceFeature> _makeFeature(config::Profile& profile) {
+            auto feature = features::DeviceFeature::make<T>(this, std::ref(profile));
+            feature->_account(_memory, sizeof(features::_featureWrapper<T>));
+            return feature;
+        }
+
+        std::shared_ptr<features::DeviceFeature> _getFeature(const std::string& name);
+
+        // Copied so features can be called without holding _feature_mutex
+        [[nodiscard]] std::vector<std::shared_ptr<features::DeviceFeature>> _featureList();
+
         std::shared_ptr<backend::hidpp20::Device> _hidpp20;
-        std::string _path;
         backend::hidpp::DeviceIndex _index;
+        const std::shared_ptr<memory_account> _memory = std::make_shared<memory_account>();
+        std::mutex _feature_mutex;
         std::map<std::string, std::shared_ptr<features::DeviceFeature>> _features;
+        // Supported but not made yet, only filled with lazy_features
+        struct deferred_feature {
+            std::function<std::shared_ptr<features::DeviceFeature>(config::Profile&)> make;
+            // Valid once a caller is making it, the others wait on it
+            std::shared_future<std::shared_ptr<features::DeviceFeature>> made;
+        };
+        std::map<std::string, deferred_feature> _deferred;
+        // Set once _init has configured the features made there
+        bool _features_ready = false;
 
         config::Device& _config;
-        mutable std::shared_mutex _profile_mutex;
-        ipcgull::property<std::string> _profile_name;
+        mutable config::edit_mutex _profile_mutex;
+        coalesced_property<std::string> _profile_name;
         std::map<std::string, config::Profile>::iterator _profile;
+        // _profile's config, read without the profile lock by _getFeature
+        std::atomic<config::Profile*> _active_config = nullptr;
+
+        struct profile_state {
+            std::string active;
+            std::vector<std::string> names;
+        };
+        // Served by cachedState while setProfile holds the lock for device I/O
+        std::atomic<std::shared_ptr<const profile_state>> _profile_state;
+
+        // Requires _profile_mutex
+        void _publishProfiles();
 
         const std::weak_ptr<DeviceManager> _manager;
 
         void _makeResetMechanism();
 
+        void _makeVirtualInput();
+
         std::unique_ptr<std::function<void()>> _reset_mechanism;
 
         const DeviceNickname _nickname;
@@ -175,12 +349,70 @@ namespace logid {
             void notifyStatus() const;
         };
 
-        ipcgull::property<bool> _awake;
+        class StatsIPC : public ipcgull::interface {
+        private:
+            Device& _device;
+        public:
+            explicit StatsIPC(Device* device);
+
+            [[nodiscard]] std::tuple<uint64_t, uint64_t, uint64_t, uint64_t, uint64_t,
+                    uint64_t, uint64_t> getCounters() const;
+
+            [[nodiscard]] std::vector<uint64_t> getRttHistogram() const;
+
+            /* Reports that were not responses by feature index, with the
+             * feature id where it is known (0xffff otherwise) */
+            [[nodiscard]] std::tuple<std::vector<uint16_t>, std::vector<uint16_t>,
+                    std::vector<uint64_t>> getEvents() const;
+        };
+
+        // Published from _is_awake, a flapping link sends one change per window
+        coalesced_property<bool> _awake;
+        std::atomic_bool _is_awake = true;
+        std::atomic<uint64_t> _reconnects = 0;
+        std::chrono::steady_clock::time_point _sleep_time;
+        // When the last wakeup finished, requires _state_lock
+        std::optional<std::chrono::steady_clock::time_point> _wakeup_time;
         std::mutex _state_lock;
+        std::atomic_bool _switched_host = false;
+
+        std::mutex _wakeup_lock;
+        task_handle _pending_wakeup;
+
+        void _cancelWakeup();
+
+        /* Writes waiting for their batch, held while asleep or for a write
+         * window. _is_awake changes under the lock. */
+        std::mutex _held_lock;
+        std::map<std::string, std::function<void()>> _held_writes;
+
+        void _flushHeldWrites();
+
+        void _applyFocus(const std::string& application);
+
+        // Set while a focus change is queued, the latest one wins
+        std::mutex _focus_lock;
+        std::optional<std::string> _focus_next;
+        // Only used on the strand, the profile a focus switch came from
+        std::optional<std::string> _focus_return;
 
         std::weak_ptr<Device> _self;
 
+        std::shared_ptr<EventStream> _events;
+
+        // Set with per_device_input or on a seat besides seat0, else the manager's is used
+        std::shared_ptr<InputDevice> _virtual_input;
+        // Made for this device alone rather than shared
+        bool _own_input = false;
+
+        // Delayed profile switches still queued are dropped with the device
+        task_set _tasks;
+
+        // Serializes state changes without parking a worker on _state_lock
+        strand _strand;
+
         std::shared_ptr<IPC> _ipc_interface;
+        std::shared_ptr<StatsIPC> _ipc_stats;
     };
 }
 
@@ -19,26 +19,115 @@
 #include <DeviceManager.h>
 #include <backend/Error.h>
 #include <util/log.h>
+#include <util/notify.h>
+#include <algorithm>
 #include <thread>
 #include <sstream>
 #include <utility>
+#include <InputDevice.h>
+#include <Metrics.h>
+#include <FocusSource.h>
+#include <backend/raw/IOMonitor.h>
 #include <ipc_defs.h>
+#include <filesystem>
+#include <csignal>
+#include <sched.h>
+#include <cstring>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
 
 using namespace logid;
 using namespace logid::backend;
 
+namespace {
+    // An editor's save shows up as several file events
+    constexpr std::chrono::milliseconds reload_delay(200);
+    // Long enough to cover a receiver bringing up all of its devices
+    constexpr std::chrono::milliseconds changes_delay(250);
+    // How often the I/O threads are checked for a handler that is stuck
+    constexpr std::chrono::milliseconds io_watchdog_interval(1000);
+
+    bool noDevice(const RequestError& e) {
+        return e.is(RequestError::Hidpp10, hidpp10::Error::UnknownDevice) ||
+               e.is(RequestError::Hidpp20, hidpp20::Error::UnknownDevice);
+    }
+
+    DeviceNotReady::Reason notReady(const RequestError& e) {
+        switch (e.kind) {
+            case RequestError::Timeout:
+                return DeviceNotReady::Asleep;
+            case RequestError::Unstable:
+                return DeviceNotReady::Unstable;
+            default:
+                return DeviceNotReady::Unknown;
+        }
+    }
+
+    thread_sched ioScheduling(const Configuration& config) {
+        thread_sched sched;
+        if (!config.io_scheduling)
+            return sched;
+
+        const auto& io = *config.io_scheduling;
+        if (io.policy) {
+            if (*io.policy == "fifo")
+                sched.policy = SCHED_FIFO;
+            else if (*io.policy == "rr")
+                sched.policy = SCHED_RR;
+            else if (*io.policy != "other")
+                logPrintf(WARN, "Unknown io_scheduling policy %s, ignoring it",
+                          io.policy->c_str());
+        }
+        sched.priority = io.priority.value_or(sched.priority);
+        sched.nice = io.nice;
+        sched.cpus = io.cpus.value_or(std::set<int>());
+
+        return sched;
+    }
+
+    template<typename T>
+    void publish(std::atomic<std::shared_ptr<const std::vector<std::shared_ptr<T>>>>& list,
+                 const std::shared_ptr<T>& item, bool added) {
+        auto next = std::make_shared<std::vector<std::shared_ptr<T>>>(*list.load());
+        if (added)
+            next->push_back(item);
+        else
+            std::erase(*next, item);
+        list.store(std::move(next));
+    }
+}
+
 DeviceManager::DeviceManager(std::shared_ptr<Configuration> config,
                              std::shared_ptr<InputDevice> virtual_input,
                              std::shared_ptr<ipcgull::server> server) :
-        backend::raw::DeviceMonitor(),
+        backend::raw::DeviceMonitor(config->read_batch.value_or(defaults::read_batch),
+                                    config->io_threads.value_or(defaults::io_threads),
+                                    config->edge_triggered.value_or(defaults::edge_triggered),
+                                    config->vendors.value_or(
+                                            std::set<uint16_t>{defaults::vendor}),
+                                    ioScheduling(*config)),
         _server(std::move(server)), _config(std::move(config)),
         _virtual_input(std::move(virtual_input)),
         _root_node(ipcgull::node::make_root("")),
         _device_node(ipcgull::node::make_root("devices")),
-        _receiver_node(ipcgull::node::make_root("receivers")) {
+        _receiver_node(ipcgull::node::make_root("receivers")),
+        _device_list(std::make_shared<const std::vector<std::shared_ptr<Device>>>()),
+        _receiver_list(std::make_shared<const std::vector<std::shared_ptr<Receiver>>>()) {
+    hidpp::Device::setStabilityPings(
+            _config->stability_pings.value_or(defaults::stability_pings));
+    backend::raw::IOMonitor::setDispatchBudget(std::chrono::microseconds(
+            (int64_t) (_config->io_slo.value_or(defaults::io_slo) * 1000)));
+
+    std::string cache_dir = _config->cache_dir.value_or(defaults::cache_dir);
+    if (!cache_dir.empty())
+        _capability_cache = std::make_shared<CapabilityCache>(cache_dir);
+
     _ipc_devices = _root_node->make_interface<DevicesIPC>(this);
     _ipc_receivers = _root_node->make_interface<ReceiversIPC>(this);
     _ipc_config = _root_node->make_interface<Configuration::IPC>(_config.get());
+    _ipc_tasks = _root_node->make_interface<TasksIPC>();
+    _event_stream = EventStream::make(_root_node);
     _device_node->add_server(_server);
     _receiver_node->add_server(_server);
     _root_node->add_server(_server);
@@ -52,6 +141,40 @@ std::shared_ptr<InputDevice> DeviceManager::virtualInput() const {
     return _virtual_input;
 }
 
+std::shared_ptr<InputDevice> DeviceManager::virtualInput(const std::string& seat) {
+    if (seat == default_seat)
+        return _virtual_input;
+
+    std::lock_guard lock(_seat_input_lock);
+    auto it = _seat_inputs.find(seat);
+    if (it != _seat_inputs.end())
+        return it->second;
+
+    /* Named after the seat, so that a udev rule can assign it there */
+    std::set<uint> keys, axes;
+    _config->inputEvents(keys, axes);
+    std::shared_ptr<InputDevice> input;
+    try {
+        input = std::make_shared<InputDevice>(
+                ("LogiOps Virtual Input (" + seat + ")").c_str(), keys, axes);
+        logPrintf(INFO, "Created input device for %s", seat.c_str());
+    } catch (std::system_error& e) {
+        logPrintf(WARN, "Could not create input device for %s, using the "
+                        "shared one: %s", seat.c_str(), e.what());
+        input = _virtual_input;
+    }
+
+    return _seat_inputs.emplace(seat, std::move(input)).first->second;
+}
+
+std::shared_ptr<const CapabilityCache> DeviceManager::capabilityCache() const {
+    return _capability_cache;
+}
+
+std::shared_ptr<EventStream> DeviceManager::eventStream() const {
+    return _event_stream;
+}
+
 std::shared_ptr<const ipcgull::node> DeviceManager::devicesNode() const {
     return _device_node;
 }
@@ -60,125 +183,733 @@ std::shared_ptr<const ipcgull::node> DeviceManager::receiversNode() const {
     return _receiver_node;
 }
 
-void DeviceManager::addDevice(std::string path) {
+std::optional<DeviceNotReady::Reason> DeviceManager::addDevice(std::string path) {
     bool defaultExists = true;
     bool isReceiver = false;
+    auto timeout = config()->io_timeout.value_or(defaults::io_timeout);
+
+    /* The node is only opened once, and the probe on the default index
+     * becomes the final device if it isn't a receiver. */
+    std::shared_ptr<backend::raw::RawDevice> raw_device;
+    try {
+        raw_device = backend::raw::RawDevice::make(path, self<DeviceManager>().lock());
+    } catch (std::system_error& e) {
+        logPrintf(WARN, "I/O error on %s: %s, skipping device.", path.c_str(), e.what());
+        return {};
+    }
 
     // Check if device is ignored before continuing
     {
-        auto raw_dev = raw::RawDevice::make(path, self<DeviceManager>().lock());
+        auto pid = raw_device->productId();
         if (config()->ignore.has_value() &&
-            config()->ignore.value().contains(raw_dev->productId())) {
+            config()->ignore.value().contains(pid)) {
             logPrintf(DEBUG, "%s: Device 0x%04x ignored.",
-                      path.c_str(), raw_dev->productId());
-            return;
+                      path.c_str(), pid);
+            return {};
         }
     }
 
-    try {
-        auto device = hidpp::Device::make(
-                path, hidpp::DefaultDevice, self<DeviceManager>().lock(),
-                config()->io_timeout.value_or(defaults::io_timeout));
-        isReceiver = device->version() == std::make_tuple(1, 0);
-    } catch (hidpp20::Error& e) {
-        if (e.code() != hidpp20::Error::UnknownDevice)
-            throw DeviceNotReady();
-        defaultExists = false;
-    } catch (hidpp10::Error& e) {
-        if (e.code() != hidpp10::Error::UnknownDevice)
-            throw DeviceNotReady();
-        defaultExists = false;
-    } catch (hidpp::Device::InvalidDevice& e) {
-        if (e.code() == hidpp::Device::InvalidDevice::VirtualNode) {
-            logPrintf(DEBUG, "Ignoring virtual node on %s", path.c_str());
-        } else if (e.code() == hidpp::Device::InvalidDevice::Asleep) {
-            /* May be a valid device, wait */
-            throw DeviceNotReady();
+    if (_revive(raw_device, path))
+        return {};
+
+    // Virtual nodes are left to the probe, which skips them
+    auto kind = raw_device->isSubDevice() ? hidpp::ProductKind::Unknown :
+                _productKind(raw_device->vendorId(), raw_device->productId());
+
+    if (kind == hidpp::ProductKind::Receiver) {
+        try {
+            _addReceiver(raw_device, path);
+            return {};
+        } catch (hidpp10::InvalidReceiver& e) {
+            logPrintf(WARN, "%s: 0x%04x is listed as a receiver but is not one, probing it",
+                      path.c_str(), raw_device->productId());
+        } catch (TimeoutError& e) {
+            return DeviceNotReady::Asleep;
+        } catch (hidpp::Device::InvalidDevice& e) {
+            // The receiver's keyboard and mouse nodes, ignored like the probe does
+            if (e.code() == hidpp::Device::InvalidDevice::Asleep)
+                return DeviceNotReady::Asleep;
+            return {};
+        } catch (std::system_error& e) {
+            logPrintf(WARN, "I/O error on %s: %s, skipping device.", path.c_str(), e.what());
+            return {};
         }
+    }
 
-        return;
-    } catch (std::system_error& e) {
-        logPrintf(WARN, "I/O error on %s: %s, skipping device.", path.c_str(), e.what());
-        return;
-    } catch (TimeoutError& e) {
-        /* Ready and valid non-default devices should throw an UnknownDevice error */
-        throw DeviceNotReady();
+    std::shared_ptr<hidpp20::Device> probe;
+    // Known corded devices skip straight to the corded index
+    if (kind == hidpp::ProductKind::Corded) {
+        defaultExists = false;
+    } else {
+        try {
+            auto result = hidpp20::Device::tryProbe(raw_device, hidpp::DefaultDevice, timeout);
+            if (result) {
+                probe = std::move(*result);
+                isReceiver = probe->version() == std::make_tuple(1, 0);
+            } else if (noDevice(result.error())) {
+                defaultExists = false;
+            } else {
+                /* Ready and valid non-default devices should return an UnknownDevice error */
+                return notReady(result.error());
+            }
+        } catch (hidpp::Device::InvalidDevice& e) {
+            if (e.code() == hidpp::Device::InvalidDevice::VirtualNode) {
+                logPrintf(DEBUG, "Ignoring virtual node on %s", path.c_str());
+            } else if (e.code() == hidpp::Device::InvalidDevice::Asleep) {
+                /* May be a valid device, wait */
+                return DeviceNotReady::Asleep;
+            }
+
+            return {};
+        } catch (std::system_error& e) {
+            logPrintf(WARN, "I/O error on %s: %s, skipping device.", path.c_str(), e.what());
+            return {};
+        }
     }
 
     if (isReceiver) {
-        logPrintf(INFO, "Detected receiver at %s", path.c_str());
-        auto receiver = Receiver::make(path, self<DeviceManager>().lock());
-        std::lock_guard<std::mutex> lock(_map_lock);
-        _receivers.emplace(path, receiver);
-        _ipc_receivers->receiverAdded(receiver);
-    } else {
-        /* TODO: Can non-receivers only contain 1 device?
-        * If the device exists, it is guaranteed to be an HID++ 2.0 device */
-        if (defaultExists) {
-            auto device = Device::make(path, hidpp::DefaultDevice, self<DeviceManager>().lock());
-            std::lock_guard<std::mutex> lock(_map_lock);
-            _devices.emplace(path, device);
-            _ipc_devices->deviceAdded(device);
-        } else {
-            try {
-                auto device = Device::make(path, hidpp::CordedDevice, self<DeviceManager>().lock());
-                std::lock_guard<std::mutex> lock(_map_lock);
-                _devices.emplace(path, device);
-                _ipc_devices->deviceAdded(device);
-            } catch (hidpp10::Error& e) {
-                if (e.code() != hidpp10::Error::UnknownDevice)
-                    throw DeviceNotReady();
-            } catch (hidpp20::Error& e) {
-                if (e.code() != hidpp20::Error::UnknownDevice)
-                    throw DeviceNotReady();
-            } catch (hidpp::Device::InvalidDevice& e) {
-                if (e.code() == hidpp::Device::InvalidDevice::Asleep)
-                    throw DeviceNotReady();
-            } catch (std::system_error& e) {
-                // This error should have been thrown previously
-                logPrintf(WARN, "I/O error on %s: %s", path.c_str(), e.what());
-            } catch (TimeoutError& e) {
-                throw DeviceNotReady();
+        probe.reset();
+        _addReceiver(raw_device, path);
+        return {};
+    }
+
+    /* TODO: Can non-receivers only contain 1 device?
+     * If the device exists, it is guaranteed to be an HID++ 2.0 device */
+    if (!defaultExists) {
+        try {
+            auto result = hidpp20::Device::tryProbe(raw_device, hidpp::CordedDevice, timeout);
+            if (!result) {
+                if (noDevice(result.error()))
+                    return {};
+                return notReady(result.error());
             }
+            probe = std::move(*result);
+        } catch (hidpp::Device::InvalidDevice& e) {
+            if (e.code() == hidpp::Device::InvalidDevice::Asleep)
+                return DeviceNotReady::Asleep;
+            return {};
+        } catch (std::system_error& e) {
+            // Known corded devices are first talked to here
+            logPrintf(WARN, "I/O error on %s: %s", path.c_str(), e.what());
+            return {};
         }
+
+        if (std::get<0>(probe->version()) < 2)
+            throw std::invalid_argument("not a hid++ 2.0 device");
+    }
+
+    auto device = Device::make(std::move(probe), self<DeviceManager>().lock());
+    {
+        std::lock_guard<std::mutex> lock(_map_lock);
+        _devices.emplace(path, device);
+    }
+    addExternalDevice(device);
+    return {};
+}
+
+hidpp::ProductKind DeviceManager::_productKind(uint16_t vid, uint16_t pid) const {
+    // The product IDs are Logitech's, other vendors reuse them
+    if (vid != defaults::vendor)
+        return hidpp::ProductKind::Unknown;
+    if (config()->receivers && config()->receivers->contains(pid))
+        return hidpp::ProductKind::Receiver;
+    if (config()->corded && config()->corded->contains(pid))
+        return hidpp::ProductKind::Corded;
+    return hidpp::knownProduct(pid);
+}
+
+void DeviceManager::_addReceiver(const std::shared_ptr<backend::raw::RawDevice>& raw_device,
+                                 const std::string& path) {
+    auto receiver = Receiver::make(raw_device, self<DeviceManager>().lock());
+    logPrintf(INFO, "Detected receiver at %s", path.c_str());
+    {
+        std::lock_guard<std::mutex> lock(_map_lock);
+        _receivers.emplace(path, receiver);
+        publish(_receiver_list, receiver, true);
     }
+    _ipc_receivers->receiverAdded(receiver);
 }
 
 void DeviceManager::addExternalDevice(const std::shared_ptr<Device>& d) {
+    {
+        std::lock_guard<std::mutex> lock(_map_lock);
+        publish(_device_list, d, true);
+    }
+    {
+        std::lock_guard lock(_focus_lock);
+        if (!_focused.empty())
+            d->setFocus(_focused);
+    }
     _ipc_devices->deviceAdded(d);
+    _queueChange(d, change::added);
 }
 
 void DeviceManager::removeExternalDevice(const std::shared_ptr<Device>& d) {
+    {
+        std::lock_guard<std::mutex> lock(_map_lock);
+        publish(_device_list, d, false);
+    }
     _ipc_devices->deviceRemoved(d);
+    _queueChange(d, change::removed);
 }
 
-std::mutex& DeviceManager::mutex() const {
-    return _map_lock;
+void DeviceManager::deviceStatusChanged(const std::shared_ptr<Device>& d) {
+    _queueChange(d, change::status);
 }
 
-void DeviceManager::removeDevice(std::string path) {
+void DeviceManager::_queueChange(const std::shared_ptr<Device>& device, change kind) {
+    std::lock_guard lock(_changes_lock);
+    switch (kind) {
+        case change::added:
+            std::erase(_removed, device);
+            _added.push_back(device);
+            break;
+        case change::removed:
+            std::erase(_changed, device);
+            // Came and went within the burst, nobody has seen it
+            if (!std::erase(_added, device))
+                _removed.push_back(device);
+            break;
+        case change::status:
+            // A device listed as added is sent with its current status
+            if (std::find(_added.begin(), _added.end(), device) == _added.end() &&
+                std::find(_changed.begin(), _changed.end(), device) == _changed.end())
+                _changed.push_back(device);
+            break;
+    }
+
+    if (!_pending_changes.done())
+        return;
+
+    _pending_changes = run_task_after([self_weak = self<DeviceManager>()]() {
+        if (auto self = self_weak.lock())
+            self->_emitChanges();
+    }, changes_delay, task_priority::background);
+    _changes_tasks.add(_pending_changes);
+}
+
+void DeviceManager::_emitChanges() {
+    std::vector<std::shared_ptr<Device>> added, removed, changed;
+    {
+        std::lock_guard lock(_changes_lock);
+        _pending_changes = {};
+        added.swap(_added);
+        removed.swap(_removed);
+        changed.swap(_changed);
+    }
+
+    if (!added.empty() || !removed.empty() || !changed.empty())
+        _ipc_devices->devicesChanged(added, removed, changed);
+}
+
+bool DeviceManager::_park(const std::shared_ptr<Device>& device, const std::string& path) {
+    auto grace = _config->reconnect_grace.value_or(defaults::reconnect_grace);
+    // Sent away by ChangeHost, it is kept much longer, but not forever
+    bool switched = device->switchedHost();
+    if (switched)
+        grace = std::max(grace, defaults::switched_host_grace);
+    if (grace <= 0)
+        return false;
+
+    device->requestSleep();
+    {
+        // The expiry waits for the lock, it cannot miss the entry
+        std::lock_guard<std::mutex> lock(_map_lock);
+        auto expiry = run_task_after(
+                [self_weak = self<DeviceManager>(), device_weak = std::weak_ptr(device)]() {
+                    auto self = self_weak.lock();
+                    auto device = device_weak.lock();
+                    if (self && device)
+                        self->_unpark(device);
+                }, std::chrono::milliseconds(grace), task_priority::background);
+        _park_tasks.add(expiry);
+        _parked.emplace(device->pid(), parked_device{device, std::move(expiry)});
+    }
+
+    if (switched)
+        logPrintf(INFO, "Device on %s switched to another host, keeping it for %d ms",
+                  path.c_str(), grace);
+    else
+        logPrintf(INFO, "Device on %s disconnected, keeping it for %d ms",
+                  path.c_str(), grace);
+    return true;
+}
+
+bool DeviceManager::_revive(const std::shared_ptr<backend::raw::RawDevice>& raw_device,
+                            const std::string& path) {
+    std::shared_ptr<Device> device;
+    {
+        std::lock_guard<std::mutex> lock(_map_lock);
+        auto it = _parked.find(raw_device->productId());
+        if (it == _parked.end())
+            return false;
+        it->second.expiry.cancel();
+        device = std::move(it->second.device);
+        _parked.erase(it);
+    }
+
+    try {
+        device->rebind(raw_device);
+    } catch (std::exception& e) {
+        logPrintf(DEBUG, "%s: Could not revive %s, probing it again: %s",
+                  path.c_str(), device->name().c_str(), e.what());
+        removeExternalDevice(device);
+        return false;
+    }
+
     std::lock_guard<std::mutex> lock(_map_lock);
-    auto receiver = _receivers.find(path);
+    _devices.emplace(path, device);
+    return true;
+}
 
-    if (receiver != _receivers.end()) {
-        _ipc_receivers->receiverRemoved(receiver->second);
-        _receivers.erase(receiver);
-        logPrintf(INFO, "Receiver on %s disconnected", path.c_str());
+void DeviceManager::_unpark(const std::shared_ptr<Device>& device) {
+    {
+        std::lock_guard<std::mutex> lock(_map_lock);
+        auto it = std::find_if(_parked.begin(), _parked.end(), [&device](auto& parked) {
+            return parked.second.device == device;
+        });
+        // Revived in the meantime
+        if (it == _parked.end())
+            return;
+        _parked.erase(it);
+    }
+
+    removeExternalDevice(device);
+    logPrintf(INFO, "%s did not reconnect, removed it", device->name().c_str());
+}
+
+DeviceManager::~DeviceManager() {
+    _io_watchdog.cancel();
+    _metrics.reset();
+    _focus_source.reset();
+    _park_tasks.cancel();
+    _changes_tasks.cancel();
+    _reload_tasks.cancel();
+
+    if (_timer_monitor)
+        _timer_monitor->remove(timer_event_fd());
+
+    if (_watch_monitor) {
+        if (_signal_fd >= 0)
+            _watch_monitor->remove(_signal_fd);
+        if (_inotify_fd >= 0)
+            _watch_monitor->remove(_inotify_fd);
+    }
+
+    if (_signal_fd >= 0)
+        close(_signal_fd);
+    if (_inotify_fd >= 0)
+        close(_inotify_fd);
+}
+
+void DeviceManager::watchConfig() {
+    if (_watch_monitor)
+        return;
+    _watch_monitor = ioMonitor();
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    _signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (_signal_fd < 0) {
+        logPrintf(WARN, "Could not listen for SIGHUP: %s", strerror(errno));
     } else {
-        auto device = _devices.find(path);
-        if (device != _devices.end()) {
-            _ipc_devices->deviceRemoved(device->second);
-            _devices.erase(device);
-            logPrintf(INFO, "Device on %s disconnected", path.c_str());
+        _watch_monitor->add(_signal_fd, {
+                [self_weak = self<DeviceManager>()]() {
+                    if (auto self = self_weak.lock())
+                        self->_readSignals();
+                },
+                []() {
+                    throw std::runtime_error("signalfd hangup");
+                },
+                []() {
+                    throw std::runtime_error("signalfd error");
+                }
+        });
+    }
+
+    if (!_config->watch_config.value_or(defaults::watch_config))
+        return;
+
+    /* Editors tend to replace the file rather than write it, so the
+     * directory is watched for the file's name */
+    const std::filesystem::path path(_config->path());
+    auto directory = path.parent_path();
+    if (directory.empty())
+        directory = ".";
+
+    _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotify_fd < 0 ||
+        inotify_add_watch(_inotify_fd, directory.c_str(),
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        logPrintf(WARN, "Could not watch %s for changes: %s",
+                  directory.c_str(), strerror(errno));
+        if (_inotify_fd >= 0)
+            close(_inotify_fd);
+        _inotify_fd = -1;
+        return;
+    }
+
+    _watch_monitor->add(_inotify_fd, {
+            [self_weak = self<DeviceManager>()]() {
+                if (auto self = self_weak.lock())
+                    self->_readFileEvents();
+            },
+            []() {
+                throw std::runtime_error("inotify hangup");
+            },
+            []() {
+                throw std::runtime_error("inotify error");
+            }
+    });
+}
+
+void DeviceManager::watchIO() {
+    if (_config->io_slo.value_or(defaults::io_slo) <= 0)
+        return;
+
+    _io_watchdog = run_task_after([self_weak = self<DeviceManager>()]() {
+        if (auto self = self_weak.lock()) {
+            self->_checkIO();
+            self->watchIO();
+        }
+    }, io_watchdog_interval, task_priority::background);
+}
+
+void DeviceManager::_checkIO() {
+    auto stalls = ioStalls();
+    for (std::size_t i = 0; i < stalls.size(); ++i) {
+        if (auto& stall = stalls[i])
+            logPrintf(WARN, "I/O thread %zu has been in the handler of %s made at %s:%u "
+                            "for %lld ms", i, stall->name ? stall->name : "an fd",
+                      stall->file, (unsigned) stall->line,
+                      (long long) (stall->running.count() / 1000));
+    }
+}
+
+void DeviceManager::watchFocus() {
+    if (_focus_source || !_config->focus)
+        return;
+
+    try {
+        _focus_source = FocusSource::make(
+                _config->focus.value(), ioMonitor(),
+                [self_weak = self<DeviceManager>()](const std::string& application) {
+                    if (auto self = self_weak.lock())
+                        self->setFocus(application);
+                });
+    } catch (std::exception& e) {
+        logPrintf(WARN, "Could not follow focus: %s", e.what());
+    }
+}
+
+void DeviceManager::setFocus(const std::string& application) {
+    {
+        std::lock_guard lock(_focus_lock);
+        if (application == _focused)
+            return;
+        _focused = application;
+    }
+
+    for (auto& device: *_device_list.load())
+        device->setFocus(application);
+}
+
+void DeviceManager::driveTimers() {
+    if (_timer_monitor || timer_event_fd() < 0)
+        return;
+    _timer_monitor = ioMonitor();
+
+    _timer_monitor->add(timer_event_fd(), {
+            []() { run_timers(); },
+            []() {
+                throw std::runtime_error("timerfd hangup");
+            },
+            []() {
+                throw std::runtime_error("timerfd error");
+            }
+    });
+}
+
+void DeviceManager::serveMetrics() {
+    if (_metrics || !_config->metrics_socket || _config->metrics_socket->empty())
+        return;
+
+    try {
+        _metrics = std::make_unique<MetricsServer>(
+                _config->metrics_socket.value(), ioMonitor(),
+                [self_weak = self<DeviceManager>()]() -> std::string {
+                    if (auto self = self_weak.lock())
+                        return self->_renderMetrics();
+                    return {};
+                });
+        logPrintf(INFO, "Serving metrics on %s", _config->metrics_socket->c_str());
+    } catch (std::exception& e) {
+        logPrintf(WARN, "Could not serve metrics on %s: %s",
+                  _config->metrics_socket->c_str(), e.what());
+    }
+}
+
+std::string DeviceManager::_renderMetrics() const {
+    typedef MetricsWriter::labels labels;
+    MetricsWriter out;
+
+    auto tasks = get_task_stats();
+    out.family("logid_tasks_workers", "gauge", "Worker threads running");
+    out.sample("logid_tasks_workers", {}, static_cast<uint64_t>(tasks.workers));
+    out.family("logid_tasks_queued", "gauge", "Tasks waiting for a worker");
+    out.sample("logid_tasks_queued", {}, tasks.queued);
+    out.family("logid_tasks_max_queued", "gauge", "Most tasks ever waiting at once");
+    out.sample("logid_tasks_max_queued", {}, tasks.max_queued);
+    out.family("logid_tasks_runs", "counter", "Tasks run");
+    out.sample("logid_tasks_runs_total", {}, tasks.runs);
+    out.family("logid_tasks_timers", "gauge", "Delayed tasks waiting");
+    out.sample("logid_tasks_timers", {}, tasks.timers);
+    out.family("logid_tasks_timer_wakeups", "counter", "Times the task timers woke up");
+    out.sample("logid_tasks_timer_wakeups_total", {}, tasks.timer_wakeups);
+    out.family("logid_task_wait_seconds", "histogram", "Time from queueing to running a task");
+    out.histogram("logid_task_wait_seconds", {}, tasks.wait_us.data(), tasks.wait_us.size());
+    out.family("logid_task_run_seconds", "histogram", "Time a task ran for");
+    out.histogram("logid_task_run_seconds", {}, tasks.run_us.data(), tasks.run_us.size());
+
+    auto handlers = ioHandlerCounts();
+    out.family("logid_io_handlers", "gauge", "File descriptors watched by each I/O thread");
+    for (std::size_t i = 0; i < handlers.size(); ++i)
+        out.sample("logid_io_handlers", {{"thread", std::to_string(i)}},
+                   static_cast<uint64_t>(handlers[i]));
+
+    if (_config->io_slo.value_or(defaults::io_slo) > 0) {
+        auto dispatch = ioDispatchStats();
+        out.family("logid_io_slow_dispatches", "counter",
+                   "I/O handler runs longer than io_slo");
+        for (std::size_t i = 0; i < dispatch.size(); ++i)
+            out.sample("logid_io_slow_dispatches_total", {{"thread", std::to_string(i)}},
+                       dispatch[i].slow_dispatches);
+        out.family("logid_io_slow_batches", "counter",
+                   "Batches of I/O events handled in longer than io_slo");
+        for (std::size_t i = 0; i < dispatch.size(); ++i)
+            out.sample("logid_io_slow_batches_total", {{"thread", std::to_string(i)}},
+                       dispatch[i].slow_batches);
+        out.family("logid_io_max_dispatch_seconds", "gauge",
+                   "Longest an I/O handler has run for");
+        for (std::size_t i = 0; i < dispatch.size(); ++i)
+            out.sample("logid_io_max_dispatch_seconds", {{"thread", std::to_string(i)}},
+                       (double) dispatch[i].max_dispatch.count() / 1e6);
+    }
+
+    auto latency = InputDevice::emitLatency();
+    out.family("logid_input_emit_latency_seconds", "histogram",
+               "Time from reading a report to emitting its input events");
+    out.histogram("logid_input_emit_latency_seconds", {}, latency.data(), latency.size());
+
+    auto devices = listDevices();
+    out.family("logid_receivers", "gauge", "Receivers connected");
+    out.sample("logid_receivers", {}, static_cast<uint64_t>(listReceivers().size()));
+
+    uint64_t awake = 0;
+    for (auto& device: devices)
+        awake += device->awake();
+    out.family("logid_devices", "gauge", "Devices known, asleep ones included");
+    out.sample("logid_devices", {{"state", "awake"}}, awake);
+    out.sample("logid_devices", {{"state", "asleep"}}, devices.size() - awake);
+
+    std::vector<labels> device_labels;
+    std::vector<backend::hidpp::Device::TransportStats> stats;
+    for (auto& device: devices) {
+        device_labels.push_back({{"device", device->nickname()}, {"name", device->name()}});
+        stats.push_back(device->hidpp20().transportStats());
+    }
+
+    out.family("logid_device_reconnects", "counter", "Times a device woke up or reconnected");
+    for (std::size_t i = 0; i < devices.size(); ++i)
+        out.sample("logid_device_reconnects_total", device_labels[i], devices[i]->reconnects());
+
+    out.family("logid_device_memory_bytes", "gauge", "Memory held for a device by kind");
+    for (std::size_t i = 0; i < devices.size(); ++i) {
+        for (auto& [kind, bytes]: devices[i]->memoryUsage()) {
+            auto memory_labels = device_labels[i];
+            memory_labels.emplace_back("kind", kind);
+            out.sample("logid_device_memory_bytes", memory_labels, bytes);
         }
     }
+
+    typedef backend::hidpp::Device::TransportStats TransportStats;
+    const std::tuple<const char*, const char*, uint64_t TransportStats::*> counters[] = {
+            {"logid_hidpp_requests", "Requests sent", &TransportStats::requests},
+            {"logid_hidpp_responses", "Responses received", &TransportStats::responses},
+            {"logid_hidpp_timeouts", "Requests that timed out", &TransportStats::timeouts},
+            {"logid_hidpp_retries", "Writes retried by the node", &TransportStats::retries},
+            {"logid_hidpp_unmatched", "Responses that matched no request",
+             &TransportStats::unmatched}
+    };
+    for (auto& [name, help, member]: counters) {
+        out.family(name, "counter", help);
+        for (std::size_t i = 0; i < devices.size(); ++i)
+            out.sample(std::string(name) + "_total", device_labels[i], stats[i].*member);
+    }
+
+    out.family("logid_hidpp_errors", "counter", "Error responses received");
+    for (std::size_t i = 0; i < devices.size(); ++i) {
+        auto error_labels = device_labels[i];
+        error_labels.emplace_back("protocol", "1.0");
+        out.sample("logid_hidpp_errors_total", error_labels, stats[i].hidpp10_errors);
+        error_labels.back().second = "2.0";
+        out.sample("logid_hidpp_errors_total", error_labels, stats[i].hidpp20_errors);
+    }
+
+    out.family("logid_hidpp_events", "counter", "Reports received that were not responses");
+    for (std::size_t i = 0; i < devices.size(); ++i) {
+        uint64_t events = 0;
+        for (auto count: stats[i].events)
+            events += count;
+        out.sample("logid_hidpp_events_total", device_labels[i], events);
+    }
+
+    out.family("logid_hidpp_round_trip_seconds", "histogram", "Request round trip times");
+    for (std::size_t i = 0; i < devices.size(); ++i)
+        out.histogram("logid_hidpp_round_trip_seconds", device_labels[i],
+                      stats[i].rtt_us.data(), stats[i].rtt_us.size());
+
+    return out.finish();
+}
+
+void DeviceManager::_readSignals() {
+    // Drained, required in edge-triggered mode
+    struct signalfd_siginfo info{};
+    bool hangup = false;
+    while (::read(_signal_fd, &info, sizeof(info)) == sizeof(info))
+        hangup |= info.ssi_signo == SIGHUP;
+
+    if (hangup) {
+        logPrintf(INFO, "Got SIGHUP, reloading %s", _config->path().c_str());
+        _scheduleReload();
+    }
+}
+
+void DeviceManager::_readFileEvents() {
+    const auto name = std::filesystem::path(_config->path()).filename().string();
+    alignas(struct inotify_event) char buffer[4096];
+    bool changed = false;
+
+    ssize_t length;
+    while ((length = ::read(_inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < length;) {
+            auto event = reinterpret_cast<const struct inotify_event*>(buffer + i);
+            if (event->len && name == event->name)
+                changed = true;
+            i += (ssize_t) (sizeof(struct inotify_event) + event->len);
+        }
+    }
+
+    if (changed)
+        _scheduleReload();
+}
+
+void DeviceManager::_scheduleReload() {
+    std::lock_guard lock(_reload_lock);
+    if (!_pending_reload.done())
+        return;
+
+    _pending_reload = run_task_after([self_weak = self<DeviceManager>()]() {
+        if (auto self = self_weak.lock()) {
+            {
+                // Changes from here on are picked up by another reload
+                std::lock_guard lock(self->_reload_lock);
+                self->_pending_reload = {};
+            }
+            self->reloadConfig();
+        }
+    }, reload_delay, task_priority::background);
+    _reload_tasks.add(_pending_reload);
+}
+
+void DeviceManager::reloadConfig() {
+    std::lock_guard running(_reload_running);
+
+    config::Config next;
+    try {
+        next = _config->read();
+    } catch (std::exception& e) {
+        logPrintf(WARN, "Not reloading %s: %s", _config->path().c_str(), e.what());
+        return;
+    }
+
+    // Devices that resolved to the same entry share it
+    std::map<config::Device*, std::vector<std::shared_ptr<Device>>> connected;
+    for (auto& device: listDevices())
+        connected[&_config->device(device->name(), device->pid())].push_back(device);
+
+    auto& incoming = next.devices.value();
+    auto next_index = Configuration::index(incoming);
+
+    {
+        std::lock_guard lock(_config->devicesMutex());
+        auto& devices = _config->devices.value();
+
+        /* Devices being probed or parked may still hold the entries of
+         * devices that are not connected, so those are only retired */
+        for (auto it = devices.begin(); it != devices.end();) {
+            if (connected.contains(&Configuration::deviceConfig(it->second)))
+                ++it;
+            else
+                it = _config->retireDevice(it);
+        }
+        for (auto& device: incoming)
+            devices.emplace(device.first, device.second);
+
+        _config->indexDevices();
+    }
+
+    // Talks to the devices, so only once the lock is released
+    std::variant<config::Device, config::Profile> unconfigured = config::Device();
+    for (auto& device: connected) {
+        auto& first = device.second.front();
+        auto* entry = next_index->find(first->name(), first->pid());
+        Device::reloadConfig(device.second, entry ? *entry :
+                                            Configuration::deviceConfig(unconfigured));
+    }
+
+    logPrintf(INFO, "Reloaded %s", _config->path().c_str());
+}
+
+void DeviceManager::removeDevice(std::string path) {
+    /* Dropped once the lock is released, a receiver going away removes
+     * its devices, which takes it again */
+    std::shared_ptr<Receiver> receiver;
+    std::shared_ptr<Device> device;
+    {
+        std::lock_guard<std::mutex> lock(_map_lock);
+        if (auto it = _receivers.find(path); it != _receivers.end()) {
+            receiver = std::move(it->second);
+            _receivers.erase(it);
+            publish(_receiver_list, receiver, false);
+        } else if (auto dev = _devices.find(path); dev != _devices.end()) {
+            device = std::move(dev->second);
+            _devices.erase(dev);
+        }
+    }
+
+    if (receiver) {
+        _ipc_receivers->receiverRemoved(receiver);
+        logPrintf(INFO, "Receiver on %s disconnected", path.c_str());
+    } else if (device && !_park(device, path)) {
+        removeExternalDevice(device);
+        logPrintf(INFO, "Device on %s disconnected", path.c_str());
+    }
 }
 
 DeviceManager::DevicesIPC::DevicesIPC(DeviceManager* manager) :
         ipcgull::interface(
                 SERVICE_ROOT_NAME ".Devices",
                 {
-                        {"Enumerate", {manager, &DeviceManager::listDevices, {"devices"}}}
+                        {"Enumerate", {manager, &DeviceManager::listDevices, {"devices"}}},
+                        {"SetFocus", {manager, &DeviceManager::setFocus, {"application"}}},
+                        {"GetState", {manager, &DeviceManager::getState,
+                                      {"devices", "active", "activeProfiles", "profiles",
+                                       "features"}}},
+                        {"GetEnumerationProgress",
+                                {static_cast<DeviceMonitor*>(manager),
+                                 &DeviceMonitor::enumerationState, {"probed", "total"}}}
                 },
                 {},
                 {
@@ -187,29 +918,69 @@ DeviceManager::DevicesIPC::DevicesIPC(DeviceManager* manager) :
                                         {"device"})},
                         {"DeviceRemoved",
                                 ipcgull::make_signal<std::shared_ptr<Device>>(
-                                        {"device"})}
+                                        {"device"})},
+                        {"EnumerationProgress",
+                                ipcgull::make_signal<uint32_t, uint32_t>(
+                                        {"probed", "total"})},
+                        {"DevicesChanged",
+                                ipcgull::make_signal<std::vector<std::shared_ptr<Device>>,
+                                        std::vector<std::shared_ptr<Device>>,
+                                        std::vector<std::shared_ptr<Device>>>(
+                                        {"added", "removed", "changed"})}
                 }) {
 }
 
+void DeviceManager::DevicesIPC::enumerationProgress(uint32_t probed, uint32_t total) {
+    emit_signal("EnumerationProgress", probed, total);
+}
+
+void DeviceManager::DevicesIPC::devicesChanged(
+        const std::vector<std::shared_ptr<Device>>& added,
+        const std::vector<std::shared_ptr<Device>>& removed,
+        const std::vector<std::shared_ptr<Device>>& changed) {
+    emit_signal("DevicesChanged", added, removed, changed);
+}
+
+void DeviceManager::enumerationProgress(uint32_t probed, uint32_t total) {
+    _ipc_devices->enumerationProgress(probed, total);
+    if (probed == total) {
+        logPrintf(INFO, "Startup enumeration done, %u nodes probed", total);
+        notifyServiceManager("STATUS=Running");
+    } else {
+        notifyServiceManager("STATUS=Probing devices (" + std::to_string(probed) +
+                             "/" + std::to_string(total) + ")");
+    }
+}
+
 std::vector<std::shared_ptr<Device>> DeviceManager::listDevices() const {
-    std::lock_guard<std::mutex> lock(_map_lock);
-    std::vector<std::shared_ptr<Device>> devices;
-    for (auto& x: _devices)
-        devices.emplace_back(x.second);
-    for (auto& x: _receivers) {
-        for (auto& d: x.second->devices())
-            devices.emplace_back(d.second);
+    return *_device_list.load();
+}
+
+std::tuple<std::vector<std::shared_ptr<Device>>,
+        std::vector<bool>, std::vector<std::string>,
+        std::vector<std::vector<std::string>>,
+        std::vector<std::map<std::string, std::map<std::string, std::string>>>>
+DeviceManager::getState() const {
+    auto devices = listDevices();
+    std::vector<bool> active;
+    std::vector<std::string> active_profiles;
+    std::vector<std::vector<std::string>> profiles;
+    std::vector<std::map<std::string, std::map<std::string, std::string>>> features;
+
+    for (auto& device: devices) {
+        auto state = device->cachedState();
+        active.push_back(state.active);
+        active_profiles.push_back(std::move(state.profile));
+        profiles.push_back(std::move(state.profiles));
+        features.push_back(std::move(state.features));
     }
 
-    return devices;
+    return {std::move(devices), std::move(active), std::move(active_profiles),
+            std::move(profiles), std::move(features)};
 }
 
 std::vector<std::shared_ptr<Receiver>> DeviceManager::listReceivers() const {
-    std::lock_guard<std::mutex> lock(_map_lock);
-    std::vector<std::shared_ptr<Receiver>> receivers;
-    for (auto& x: _receivers)
-        receivers.emplace_back(x.second);
-    return receivers;
+    return *_receiver_list.load();
 }
 
 void DeviceManager::DevicesIPC::deviceAdded(
@@ -250,71 +1021,69 @@ void DeviceManager::ReceiversIPC::receiverRemoved(
     emit_signal("ReceiverRemoved", r);
 }
 
-int DeviceManager::newDeviceNickname() {
-    std::lock_guard<std::mutex> lock(_nick_lock);
+DeviceManager::TasksIPC::TasksIPC() :
+        ipcgull::interface(
+                SERVICE_ROOT_NAME ".Tasks",
+                {
+                        {"GetCounters", {this, &TasksIPC::getCounters,
+                                         {"workers", "queued", "maxQueued", "runs"}}},
+                        {"GetWaitHistogram", {this, &TasksIPC::getWaitHistogram,
+                                              {"buckets"}}},
+                        {"GetRunHistogram", {this, &TasksIPC::getRunHistogram,
+                                             {"buckets"}}},
+                        {"GetOrigins", {this, &TasksIPC::getOrigins,
+                                        {"locations", "runs", "runTime", "maxRunTime"}}},
+                        {"GetEmitLatency", {this, &TasksIPC::getEmitLatency,
+                                            {"buckets"}}},
+                        {"GetTimers", {this, &TasksIPC::getTimers,
+                                       {"pending", "wakeups"}}}
+                }, {}, {}) {
+}
 
-    auto begin = _device_nicknames.begin();
-    if (begin != _device_nicknames.end()) {
-        if (*begin != 0) {
-            _device_nicknames.insert(0);
-            return 0;
-        }
-    }
+std::tuple<uint32_t, uint64_t, uint64_t, uint64_t>
+DeviceManager::TasksIPC::getCounters() const {
+    auto stats = get_task_stats();
+    return {stats.workers, stats.queued, stats.max_queued, stats.runs};
+}
+
+std::tuple<uint64_t, uint64_t> DeviceManager::TasksIPC::getTimers() const {
+    auto stats = get_task_stats();
+    return {stats.timers, stats.timer_wakeups};
+}
 
-    const auto i = std::adjacent_find(_device_nicknames.begin(),
-                                      _device_nicknames.end(),
-                                      [](int l, int r) { return l + 1 < r; });
+std::vector<uint64_t> DeviceManager::TasksIPC::getWaitHistogram() const {
+    auto stats = get_task_stats();
+    return {stats.wait_us.begin(), stats.wait_us.end()};
+}
 
+std::vector<uint64_t> DeviceManager::TasksIPC::getRunHistogram() const {
+    auto stats = get_task_stats();
+    return {stats.run_us.begin(), stats.run_us.end()};
+}
 
-    if (i == _device_nicknames.end()) {
-        auto end = _device_nicknames.rbegin();
-        if (end != _device_nicknames.rend()) {
-            auto ret = *end + 1;
-            assert(ret > 0);
-            _device_nicknames.insert(ret);
-            return ret;
-        } else {
-            _device_nicknames.insert(0);
-            return 0;
-        }
+std::tuple<std::vector<std::string>, std::vector<uint64_t>,
+        std::vector<uint64_t>, std::vector<uint64_t>>
+DeviceManager::TasksIPC::getOrigins() const {
+    std::tuple<std::vector<std::string>, std::vector<uint64_t>,
+            std::vector<uint64_t>, std::vector<uint64_t>> ret;
+    for (auto& origin: get_task_stats().origins) {
+        std::get<0>(ret).push_back(origin.location);
+        std::get<1>(ret).push_back(origin.runs);
+        std::get<2>(ret).push_back(origin.run_us);
+        std::get<3>(ret).push_back(origin.max_run_us);
     }
-
-    auto ret = *i + 1;
-    assert(ret > 0);
-    _device_nicknames.insert(ret);
     return ret;
 }
 
-int DeviceManager::newReceiverNickname() {
-    std::lock_guard<std::mutex> lock(_nick_lock);
-
-    auto begin = _receiver_nicknames.begin();
-    if (begin != _receiver_nicknames.end()) {
-        if (*begin != 0) {
-            _receiver_nicknames.insert(0);
-            return 0;
-        }
-    }
+std::vector<uint64_t> DeviceManager::TasksIPC::getEmitLatency() const {
+    auto latency = InputDevice::emitLatency();
+    return {latency.begin(), latency.end()};
+}
 
-    const auto i = std::adjacent_find(_receiver_nicknames.begin(),
-                                      _receiver_nicknames.end(),
-                                      [](int l, int r) { return l + 1 < r; });
-
-    if (i == _receiver_nicknames.end()) {
-        auto end = _receiver_nicknames.rbegin();
-        if (end != _receiver_nicknames.rend()) {
-            auto ret = *end + 1;
-            assert(ret > 0);
-            _receiver_nicknames.insert(ret);
-            return ret;
-        } else {
-            _receiver_nicknames.insert(0);
-            return 0;
-        }
-    }
+int DeviceManager::newDeviceNickname() {
+    return _device_nicknames.allocate();
+}
 
-    auto ret = *i + 1;
-    assert(ret > 0);
-    _receiver_nicknames.insert(ret);
-    return ret;
+int DeviceManager::newReceiverNickname() {
+    return _receiver_nicknames.allocate();
 }
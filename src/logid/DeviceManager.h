@@ -20,13 +20,18 @@
 #define LOGID_DEVICEMANAGER_H
 
 #include <backend/raw/DeviceMonitor.h>
+#include <backend/hidpp/product_defs.h>
 #include <Device.h>
 #include <Receiver.h>
+#include <CapabilityCache.h>
+#include <util/id_allocator.h>
 #include <ipcgull/node.h>
 #include <ipcgull/interface.h>
 
 namespace logid {
     class InputDevice;
+    class MetricsServer;
+    class FocusSource;
 
     class DeviceManager : public backend::raw::DeviceMonitor {
     public:
@@ -35,6 +40,15 @@ namespace logid {
 
         [[nodiscard]] std::shared_ptr<InputDevice> virtualInput() const;
 
+        /* The input device of a seat, made on first use. seat0 and seats
+         * whose device could not be made get the shared one. */
+        [[nodiscard]] std::shared_ptr<InputDevice> virtualInput(const std::string& seat);
+
+        /* nullptr if disabled in the config */
+        [[nodiscard]] std::shared_ptr<const CapabilityCache> capabilityCache() const;
+
+        [[nodiscard]] std::shared_ptr<EventStream> eventStream() const;
+
         [[nodiscard]] std::shared_ptr<const ipcgull::node> devicesNode() const;
 
         [[nodiscard]] std::shared_ptr<const ipcgull::node>
@@ -44,17 +58,49 @@ namespace logid {
 
         void removeExternalDevice(const std::shared_ptr<Device>& d);
 
-        std::mutex& mutex() const;
+        // Folded into the next DevicesChanged, called on every status change
+        void deviceStatusChanged(const std::shared_ptr<Device>& d);
+
+        /* Reloads the config on SIGHUP, and when the file changes unless
+         * watch_config is off. SIGHUP must be blocked in every thread. */
+        void watchConfig();
+
+        /* Serves metrics on metrics_socket if it is set, a bad socket is
+         * only logged. Nothing runs for it otherwise. */
+        void serveMetrics();
+
+        /* Follows the config's focus source if there is one, a source that
+         * cannot start is only logged */
+        void watchFocus();
+
+        /* Checks the I/O threads for a stuck handler while io_slo is set,
+         * dispatch itself is timed by the I/O threads */
+        void watchIO();
+
+        // Every device, and any connecting later, picks a profile for it
+        void setFocus(const std::string& application);
+
+        /* Drives the task timers from the I/O thread if the workers were
+         * started without a timer thread, does nothing otherwise. */
+        void driveTimers();
+
+        /* Applies the config file as it is now to every connected device,
+         * the current config is kept if it does not parse */
+        void reloadConfig();
+
+        ~DeviceManager() override;
 
     protected:
         DeviceManager(std::shared_ptr<Configuration> config,
                       std::shared_ptr<InputDevice> virtual_input,
                       std::shared_ptr<ipcgull::server> server);
 
-        void addDevice(std::string path) final;
+        std::optional<backend::DeviceNotReady::Reason> addDevice(std::string path) final;
 
         void removeDevice(std::string path) final;
 
+        void enumerationProgress(uint32_t probed, uint32_t total) final;
+
     private:
         class DevicesIPC : public ipcgull::interface {
         public:
@@ -63,11 +109,25 @@ namespace logid {
             void deviceAdded(const std::shared_ptr<Device>& d);
 
             void deviceRemoved(const std::shared_ptr<Device>& d);
+
+            void enumerationProgress(uint32_t probed, uint32_t total);
+
+            void devicesChanged(const std::vector<std::shared_ptr<Device>>& added,
+                                const std::vector<std::shared_ptr<Device>>& removed,
+                                const std::vector<std::shared_ptr<Device>>& changed);
         };
 
         [[nodiscard]]
         std::vector<std::shared_ptr<Device>> listDevices() const;
 
+        /* Every device with its status, profiles and the feature state it
+         * has cached, in one call and without touching any device */
+        [[nodiscard]] std::tuple<std::vector<std::shared_ptr<Device>>,
+                std::vector<bool>, std::vector<std::string>,
+                std::vector<std::vector<std::string>>,
+                std::vector<std::map<std::string, std::map<std::string, std::string>>>>
+        getState() const;
+
         class ReceiversIPC : public ipcgull::interface {
         public:
             explicit ReceiversIPC(DeviceManager* manager);
@@ -80,9 +140,32 @@ namespace logid {
         [[nodiscard]]
         std::vector<std::shared_ptr<Receiver>> listReceivers() const;
 
+        class TasksIPC : public ipcgull::interface {
+        public:
+            TasksIPC();
+
+            [[nodiscard]] std::tuple<uint32_t, uint64_t, uint64_t, uint64_t>
+            getCounters() const;
+
+            // Wakeups keep counting while timers are pending and stop otherwise
+            [[nodiscard]] std::tuple<uint64_t, uint64_t> getTimers() const;
+
+            [[nodiscard]] std::vector<uint64_t> getWaitHistogram() const;
+
+            [[nodiscard]] std::vector<uint64_t> getRunHistogram() const;
+
+            [[nodiscard]] std::tuple<std::vector<std::string>, std::vector<uint64_t>,
+                    std::vector<uint64_t>, std::vector<uint64_t>> getOrigins() const;
+
+            [[nodiscard]] std::vector<uint64_t> getEmitLatency() const;
+        };
+
         std::shared_ptr<ipcgull::server> _server;
         std::shared_ptr<Configuration> _config;
         std::shared_ptr<InputDevice> _virtual_input;
+        std::mutex _seat_input_lock;
+        std::map<std::string, std::shared_ptr<InputDevice>> _seat_inputs;
+        std::shared_ptr<CapabilityCache> _capability_cache;
 
         std::shared_ptr<ipcgull::node> _root_node;
 
@@ -92,10 +175,58 @@ namespace logid {
         std::shared_ptr<Configuration::IPC> _ipc_config;
         std::shared_ptr<DevicesIPC> _ipc_devices;
         std::shared_ptr<ReceiversIPC> _ipc_receivers;
+        std::shared_ptr<TasksIPC> _ipc_tasks;
+        std::shared_ptr<EventStream> _event_stream;
 
         std::map<std::string, std::shared_ptr<Device>> _devices;
         std::map<std::string, std::shared_ptr<Receiver>> _receivers;
 
+        /* Disconnected directly connected devices by PID, until their
+         * reconnect_grace runs out. Still listed, only asleep. */
+        struct parked_device {
+            std::shared_ptr<Device> device;
+            // Cancelled on revival, it would otherwise end a later park early
+            task_handle expiry;
+        };
+        std::multimap<uint16_t, parked_device> _parked;
+        task_set _park_tasks;
+
+        // Parks a device rather than dropping it, false if it is not kept
+        bool _park(const std::shared_ptr<Device>& device, const std::string& path);
+
+        // Takes a parked device over to path, false if none came back there
+        bool _revive(const std::shared_ptr<backend::raw::RawDevice>& raw_device,
+                     const std::string& path);
+
+        void _unpark(const std::shared_ptr<Device>& device);
+
+        // Config entries first, then the built-in table, Logitech's vendor ID only
+        [[nodiscard]] backend::hidpp::ProductKind _productKind(uint16_t vid, uint16_t pid) const;
+
+        void _addReceiver(const std::shared_ptr<backend::raw::RawDevice>& raw_device,
+                          const std::string& path);
+
+        /* Hotplug bursts and status changes are also sent as one
+         * DevicesChanged after changes_delay, next to the single signals */
+        enum class change { added, removed, status };
+
+        void _queueChange(const std::shared_ptr<Device>& device, change kind);
+
+        void _emitChanges();
+
+        std::mutex _changes_lock;
+        std::vector<std::shared_ptr<Device>> _added, _removed, _changed;
+        task_handle _pending_changes;
+        task_set _changes_tasks;
+
+        /* Every device, receivers' included, and every receiver. Replaced
+         * whole on a change so readers never lock or wait on hotplug. */
+        template<typename T>
+        using snapshot = std::atomic<std::shared_ptr<const std::vector<std::shared_ptr<T>>>>;
+        snapshot<Device> _device_list;
+        snapshot<Receiver> _receiver_list;
+
+        // Held by writers only, never while calling into a receiver
         mutable std::mutex _map_lock;
 
         friend class DeviceNickname;
@@ -106,9 +237,38 @@ namespace logid {
 
         [[nodiscard]] int newReceiverNickname();
 
-        std::mutex _nick_lock;
-        std::set<int> _device_nicknames;
-        std::set<int> _receiver_nicknames;
+        // Folds file events and signals arriving close together into one reload
+        void _scheduleReload();
+
+        void _readSignals();
+
+        void _readFileEvents();
+
+        [[nodiscard]] std::string _renderMetrics() const;
+
+        void _checkIO();
+
+        task_handle _io_watchdog;
+
+        std::unique_ptr<MetricsServer> _metrics;
+
+        std::shared_ptr<backend::raw::IOMonitor> _watch_monitor;
+        std::shared_ptr<backend::raw::IOMonitor> _timer_monitor;
+
+        std::unique_ptr<FocusSource> _focus_source;
+        std::mutex _focus_lock;
+        std::string _focused;
+        int _signal_fd = -1;
+        int _inotify_fd = -1;
+
+        std::mutex _reload_lock;
+        task_handle _pending_reload;
+        task_set _reload_tasks;
+        // Held while a reload runs, they never overlap
+        std::mutex _reload_running;
+
+        id_allocator _device_nicknames;
+        id_allocator _receiver_nicknames;
     };
 
 }
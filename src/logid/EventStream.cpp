@@ -0,0 +1,137 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <EventStream.h>
+#include <Device.h>
+#include <ipc_defs.h>
+#include <algorithm>
+
+using namespace logid;
+
+std::shared_ptr<EventStream> EventStream::make(const std::shared_ptr<ipcgull::node>& node) {
+    std::shared_ptr<EventStream> ret(new EventStream());
+    ret->_self = ret;
+    ret->_ipc_interface = node->make_interface<IPC>(ret.get());
+    return ret;
+}
+
+EventStream::~EventStream() {
+    _tasks.cancel();
+}
+
+void EventStream::record(std::shared_ptr<Device> device, Kind kind,
+                         uint16_t code, int16_t x, int16_t y) {
+    auto time = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch());
+
+    std::lock_guard lock(_mutex);
+    // May have expired since the caller checked
+    if (!_active)
+        return;
+
+    _devices.push_back(std::move(device));
+    _times.push_back(time.count());
+    _kinds.push_back(kind);
+    _codes.push_back(code);
+    _x.push_back(x);
+    _y.push_back(y);
+
+    if (!_pending_flush.done())
+        return;
+
+    _pending_flush = run_task_after([self_weak = _self]() {
+        if (auto self = self_weak.lock())
+            self->_flush();
+    }, batch_delay, task_priority::background);
+    _tasks.add(_pending_flush);
+}
+
+void EventStream::subscribe(uint32_t seconds) {
+    seconds = std::min(seconds, max_subscription);
+    if (!seconds)
+        return;
+
+    std::lock_guard lock(_mutex);
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    if (_active && until <= _until)
+        return;
+
+    _until = until;
+    _active = true;
+    _pending_expiry.cancel();
+    _pending_expiry = run_task_after([self_weak = _self]() {
+        if (auto self = self_weak.lock())
+            self->_expire();
+    }, std::chrono::seconds(seconds), task_priority::background);
+    _tasks.add(_pending_expiry);
+}
+
+void EventStream::_expire() {
+    std::lock_guard lock(_mutex);
+    // Renewed after the task fired
+    if (std::chrono::steady_clock::now() < _until)
+        return;
+    _active = false;
+}
+
+void EventStream::_flush() {
+    std::vector<std::shared_ptr<Device>> devices;
+    std::vector<uint64_t> times;
+    std::vector<uint8_t> kinds;
+    std::vector<uint16_t> codes;
+    std::vector<int16_t> x, y;
+    {
+        std::lock_guard lock(_mutex);
+        _pending_flush = {};
+        devices.swap(_devices);
+        times.swap(_times);
+        kinds.swap(_kinds);
+        codes.swap(_codes);
+        x.swap(_x);
+        y.swap(_y);
+    }
+
+    if (!devices.empty())
+        _ipc_interface->events(devices, times, kinds, codes, x, y);
+}
+
+EventStream::IPC::IPC(EventStream* stream) :
+        ipcgull::interface(
+                SERVICE_ROOT_NAME ".Events",
+                {
+                        {"Subscribe", {stream, &EventStream::subscribe, {"seconds"}}}
+                },
+                {},
+                {
+                        {"Events",
+                                ipcgull::make_signal<std::vector<std::shared_ptr<Device>>,
+                                        std::vector<uint64_t>, std::vector<uint8_t>,
+                                        std::vector<uint16_t>, std::vector<int16_t>,
+                                        std::vector<int16_t>>(
+                                        {"devices", "times", "kinds", "codes", "x", "y"})}
+                }) {
+}
+
+void EventStream::IPC::events(const std::vector<std::shared_ptr<Device>>& devices,
+                              const std::vector<uint64_t>& times,
+                              const std::vector<uint8_t>& kinds,
+                              const std::vector<uint16_t>& codes,
+                              const std::vector<int16_t>& x,
+                              const std::vector<int16_t>& y) {
+    emit_signal("Events", devices, times, kinds, codes, x, y);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_EVENTSTREAM_H
+#define LOGID_EVENTSTREAM_H
+
+#include <util/task.h>
+#include <ipcgull/node.h>
+#include <ipcgull/interface.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace logid {
+    class Device;
+
+    /* Decoded input events for IPC clients, sent in batches. Clients
+     * subscribe for a number of seconds and renew before it runs out,
+     * while nobody is subscribed events are not even collected. The bus
+     * policy keeps the interface to root and the input group, the signal
+     * carries every key press. */
+    class EventStream {
+    public:
+        // What code, x and y hold for each kind
+        enum Kind : uint8_t {
+            ButtonPress,   // Control ID
+            ButtonRelease, // Control ID
+            Move,          // Control ID, raw x and y
+            Scroll,        // Whether in hires mode, y is the delta
+            ThumbWheel     // Event flags, x is the rotation
+        };
+
+        // Events are held back this long to go out together
+        static constexpr std::chrono::milliseconds batch_delay{20};
+        static constexpr uint32_t max_subscription = 300;
+
+        static std::shared_ptr<EventStream> make(const std::shared_ptr<ipcgull::node>& node);
+
+        // A relaxed load, checked before an event is even put together
+        [[nodiscard]] bool active() const {
+            return _active.load(std::memory_order_relaxed);
+        }
+
+        void record(std::shared_ptr<Device> device, Kind kind,
+                    uint16_t code, int16_t x, int16_t y);
+
+        // Extends the subscription to at least seconds from now
+        void subscribe(uint32_t seconds);
+
+        EventStream(const EventStream&) = delete;
+
+        EventStream(EventStream&&) = delete;
+
+        ~EventStream();
+
+    private:
+        EventStream() = default;
+
+        void _flush();
+
+        void _expire();
+
+        std::atomic_bool _active = false;
+
+        std::mutex _mutex;
+        std::chrono::steady_clock::time_point _until;
+        task_handle _pending_expiry;
+        task_handle _pending_flush;
+        task_set _tasks;
+
+        std::vector<std::shared_ptr<Device>> _devices;
+        std::vector<uint64_t> _times;
+        std::vector<uint8_t> _kinds;
+        std::vector<uint16_t> _codes;
+        std::vector<int16_t> _x, _y;
+
+        class IPC : public ipcgull::interface {
+        public:
+            explicit IPC(EventStream* stream);
+
+            void events(const std::vector<std::shared_ptr<Device>>& devices,
+                        const std::vector<uint64_t>& times,
+                        const std::vector<uint8_t>& kinds,
+                        const std::vector<uint16_t>& codes,
+                        const std::vector<int16_t>& x,
+                        const std::vector<int16_t>& y);
+        };
+
+        std::shared_ptr<IPC> _ipc_interface;
+        std::weak_ptr<EventStream> _self;
+    };
+}
+
+#endif //LOGID_EVENTSTREAM_H
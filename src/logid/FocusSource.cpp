@@ -0,0 +1,189 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <FocusSource.h>
+#include <backend/raw/IOMonitor.h>
+#include <util/log.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace logid;
+
+namespace {
+    // Until the compositor comes up, or after it went away
+    constexpr std::chrono::seconds reconnect_delay(2);
+    // A line longer than this is not an event, it is dropped
+    constexpr std::size_t max_line = 4096;
+    constexpr std::string_view active_window = "activewindow>>";
+}
+
+std::unique_ptr<FocusSource> FocusSource::make(const config::Focus& config,
+                                               std::shared_ptr<backend::raw::IOMonitor> monitor,
+                                               callback focus) {
+    if (!config.source || config.source->empty())
+        return nullptr;
+
+    if (*config.source == "hyprland") {
+        if (!config.socket || config.socket->empty())
+            throw std::invalid_argument("the hyprland focus source needs a socket");
+        return std::make_unique<HyprlandFocus>(config.socket.value(), std::move(monitor),
+                                               std::move(focus));
+    }
+
+    throw std::invalid_argument("unknown focus source " + config.source.value());
+}
+
+struct HyprlandFocus::state {
+    const std::string path;
+    const std::shared_ptr<backend::raw::IOMonitor> monitor;
+    const callback focus;
+
+    std::mutex mutex;
+    bool stopped = false;
+    int fd = -1;
+    // Only touched by the read handler
+    std::string buffer;
+    task_handle retry;
+};
+
+HyprlandFocus::HyprlandFocus(std::string path,
+                             std::shared_ptr<backend::raw::IOMonitor> monitor, callback focus) :
+        _state(std::make_shared<state>(std::move(path), std::move(monitor), std::move(focus))) {
+    sockaddr_un addr{};
+    if (_state->path.size() >= sizeof(addr.sun_path))
+        throw std::invalid_argument("focus socket path too long");
+
+    _connect(_state);
+}
+
+HyprlandFocus::~HyprlandFocus() {
+    std::lock_guard lock(_state->mutex);
+    _state->stopped = true;
+    _state->retry.cancel();
+    if (_state->fd >= 0) {
+        _state->monitor->remove(_state->fd);
+        ::close(_state->fd);
+        _state->fd = -1;
+    }
+}
+
+void HyprlandFocus::_connect(const std::shared_ptr<state>& s) {
+    std::lock_guard lock(s->mutex);
+    if (s->stopped || s->fd >= 0)
+        return;
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, s->path.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+        s->fd = fd;
+        s->buffer.clear();
+        std::weak_ptr<state> weak = s;
+        s->monitor->add(fd, {
+                [weak]() {
+                    if (auto s = weak.lock())
+                        _read(s);
+                },
+                [weak]() {
+                    if (auto s = weak.lock())
+                        _disconnect(s);
+                },
+                [weak]() {
+                    if (auto s = weak.lock())
+                        _disconnect(s);
+                }
+        });
+        logPrintf(INFO, "Following focus on %s", s->path.c_str());
+        return;
+    }
+
+    logPrintf(DEBUG, "Could not connect to %s: %s", s->path.c_str(), strerror(errno));
+    if (fd >= 0)
+        ::close(fd);
+
+    s->retry = run_task_after([weak = std::weak_ptr<state>(s)]() {
+        if (auto s = weak.lock())
+            _connect(s);
+    }, reconnect_delay);
+}
+
+void HyprlandFocus::_read(const std::shared_ptr<state>& s) {
+    int fd;
+    {
+        std::lock_guard lock(s->mutex);
+        fd = s->fd;
+    }
+    if (fd < 0)
+        return;
+
+    // Drained, the monitor may be edge-triggered
+    char chunk[1024];
+    while (true) {
+        auto ret = ::read(fd, chunk, sizeof(chunk));
+        if (ret == 0) {
+            _disconnect(s);
+            return;
+        } else if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                _disconnect(s);
+            break;
+        }
+        s->buffer.append(chunk, ret);
+    }
+
+    // Events are lines of EVENT>>DATA, activewindow's data is CLASS,TITLE
+    std::size_t start = 0, end;
+    while ((end = s->buffer.find('\n', start)) != std::string::npos) {
+        std::string_view line(s->buffer.data() + start, end - start);
+        start = end + 1;
+
+        if (!line.starts_with(active_window))
+            continue;
+        line.remove_prefix(active_window.size());
+        s->focus(std::string(line.substr(0, line.find(','))));
+    }
+    s->buffer.erase(0, start);
+    if (s->buffer.size() > max_line)
+        s->buffer.clear();
+}
+
+void HyprlandFocus::_disconnect(const std::shared_ptr<state>& s) {
+    std::lock_guard lock(s->mutex);
+    if (s->stopped || s->fd < 0)
+        return;
+
+    s->monitor->remove(s->fd);
+    ::close(s->fd);
+    s->fd = -1;
+    logPrintf(INFO, "Lost focus events from %s, reconnecting", s->path.c_str());
+
+    s->retry = run_task_after([weak = std::weak_ptr<state>(s)]() {
+        if (auto s = weak.lock())
+            _connect(s);
+    }, reconnect_delay);
+}
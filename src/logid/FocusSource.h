@@ -0,0 +1,75 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_FOCUSSOURCE_H
+#define LOGID_FOCUSSOURCE_H
+
+#include <config/schema.h>
+#include <util/task.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace logid {
+    namespace backend::raw {
+        class IOMonitor;
+    }
+
+    /* Reports which application has focus. A backend calls focus with
+     * the application's ID (e.g. a window class) every time it changes,
+     * from the I/O thread. */
+    class FocusSource {
+    public:
+        typedef std::function<void(const std::string&)> callback;
+
+        virtual ~FocusSource() = default;
+
+        /* Null without a source, throws if it is unknown or has no socket */
+        static std::unique_ptr<FocusSource> make(const config::Focus& config,
+                                                 std::shared_ptr<backend::raw::IOMonitor> monitor,
+                                                 callback focus);
+    };
+
+    /* Follows the event socket (socket2) of Hyprland. The compositor runs
+     * in a session and may come and go, so it is reconnected to. */
+    class HyprlandFocus : public FocusSource {
+    public:
+        HyprlandFocus(std::string path, std::shared_ptr<backend::raw::IOMonitor> monitor,
+                      callback focus);
+
+        HyprlandFocus(const HyprlandFocus&) = delete;
+
+        HyprlandFocus(HyprlandFocus&&) = delete;
+
+        ~HyprlandFocus() override;
+
+    private:
+        struct state;
+
+        static void _connect(const std::shared_ptr<state>& s);
+
+        static void _read(const std::shared_ptr<state>& s);
+
+        static void _disconnect(const std::shared_ptr<state>& s);
+
+        const std::shared_ptr<state> _state;
+    };
+}
+
+#endif //LOGID_FOCUSSOURCE_H
@@ -17,8 +17,19 @@
  */
 
 #include <InputDevice.h>
+#include <backend/raw/RawDevice.h>
+#include <util/log.h>
+#include <util/trace.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <system_error>
 #include <mutex>
+#include <cerrno>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
 
 extern "C"
 {
@@ -28,6 +39,39 @@ extern "C"
 
 using namespace logid;
 
+/* Registrations arrive in bursts, e.g. every action of a new profile */
+static constexpr auto rebuild_delay = std::chrono::milliseconds(100);
+
+static std::array<std::atomic<uint64_t>, InputDevice::latency_buckets> emit_latency{};
+
+namespace {
+    /* libevdev looks names up with a linear search, tables for the event
+     * types we use are built once on first use instead. */
+    struct event_names {
+        std::vector<const char*> names;
+        std::unordered_map<std::string_view, uint> codes;
+
+        event_names(uint type, uint max) : names(max + 1) {
+            for (uint code = 0; code <= max; ++code) {
+                names[code] = libevdev_event_code_get_name(type, code);
+                if (names[code])
+                    codes.emplace(names[code], code);
+            }
+        }
+    };
+
+    const event_names* names_of(uint type) {
+        static const event_names keys(EV_KEY, KEY_MAX);
+        static const event_names axes(EV_REL, REL_MAX);
+
+        if (type == EV_KEY)
+            return &keys;
+        else if (type == EV_REL)
+            return &axes;
+        return nullptr;
+    }
+}
+
 InputDevice::InvalidEventCode::InvalidEventCode(const std::string& name) :
         _what("Invalid event code " + name) {
 }
@@ -40,27 +84,43 @@ const char* InputDevice::InvalidEventCode::what() const noexcept {
     return _what.c_str();
 }
 
-InputDevice::InputDevice(const char* name) {
+InputDevice::InputDevice(const char* name, const std::set<uint>& keys,
+                         const std::set<uint>& axes) :
+        InputDevice(name, Sink(), keys, axes) {
+}
+
+InputDevice::InputDevice(const char* name, Sink sink, const std::set<uint>& keys,
+                         const std::set<uint>& axes) : _sink(std::move(sink)) {
     device = libevdev_new();
     libevdev_set_name(device, name);
 
     libevdev_enable_event_type(device, EV_KEY);
-    for (unsigned int i = 0; i < KEY_CNT; i++) {
-        // Enable some keys which a normal keyboard should have
-        // by default, i.e. a-z, modifier keys and so on, see:
-        // /usr/include/linux/input-event-codes.h
-        if (i < 128) {
-            registered_keys[i] = true;
-            libevdev_enable_event_code(device, EV_KEY, i, nullptr);
-        } else {
-            registered_keys[i] = false;
+    // Enable some keys which a normal keyboard should have
+    // by default, i.e. a-z, modifier keys and so on, see:
+    // /usr/include/linux/input-event-codes.h
+    for (unsigned int i = 0; i < 128; i++) {
+        registered_keys[i] = true;
+        libevdev_enable_event_code(device, EV_KEY, i, nullptr);
+    }
+
+    libevdev_enable_event_type(device, EV_REL);
+
+    for (auto key: keys) {
+        if (key < KEY_CNT && !registered_keys[key]) {
+            registered_keys[key] = true;
+            libevdev_enable_event_code(device, EV_KEY, key, nullptr);
         }
     }
 
-    for (bool& axis: registered_axis)
-        axis = false;
+    for (auto axis: axes) {
+        if (axis < REL_CNT && !registered_axis[axis]) {
+            registered_axis[axis] = true;
+            libevdev_enable_event_code(device, EV_REL, axis, nullptr);
+        }
+    }
 
-    libevdev_enable_event_type(device, EV_REL);
+    if (_sink)
+        return;
 
     int err = libevdev_uinput_create_from_device(device,
                                                  LIBEVDEV_UINPUT_OPEN_MANAGED, &ui_device);
@@ -72,15 +132,21 @@ InputDevice::InputDevice(const char* name) {
 }
 
 InputDevice::~InputDevice() {
-    libevdev_uinput_destroy(ui_device);
-    libevdev_free(device);
+    _tasks.cancel();
+    if (ui_device)
+        libevdev_uinput_destroy(ui_device);
+    if (device)
+        libevdev_free(device);
 }
 
 void InputDevice::registerKey(uint code) {
     // TODO: Maybe print error message, if wrong code is passed?
-    if (code >= KEY_CNT || registered_keys[code]) {
+    if (code >= KEY_CNT)
+        return;
+
+    std::lock_guard lock(_input_mutex);
+    if (registered_keys[code])
         return;
-    }
 
     _enableEvent(EV_KEY, code);
 
@@ -89,9 +155,12 @@ void InputDevice::registerKey(uint code) {
 
 void InputDevice::registerAxis(uint axis) {
     // TODO: Maybe print error message, if wrong code is passed?
-    if (axis >= REL_CNT || registered_axis[axis]) {
+    if (axis >= REL_CNT)
+        return;
+
+    std::lock_guard lock(_input_mutex);
+    if (registered_axis[axis])
         return;
-    }
 
     _enableEvent(EV_REL, axis);
 
@@ -110,6 +179,35 @@ void InputDevice::releaseKey(uint code) {
     _sendEvent(EV_KEY, code, 0);
 }
 
+bool InputDevice::_keyDown(uint code) {
+    if (code >= KEY_CNT)
+        return true;
+    return _key_holds[code]++ == 0;
+}
+
+bool InputDevice::_keyUp(uint code) {
+    if (code >= KEY_CNT)
+        return true;
+
+    // Releasing a key that is not held writes nothing
+    auto& holds = _key_holds[code];
+    if (holds == 0)
+        return false;
+    return --holds == 0;
+}
+
+std::size_t InputDevice::_countKeys(input_event* events, std::size_t count) {
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        auto& event = events[i];
+        if (event.type == EV_KEY &&
+            !(event.value ? _keyDown(event.code) : _keyUp(event.code)))
+            continue;
+        events[kept++] = event;
+    }
+    return kept;
+}
+
 std::string InputDevice::toKeyName(uint code) {
     return _toEventName(EV_KEY, code);
 }
@@ -141,8 +239,19 @@ int InputDevice::getLowResAxis(const uint axis_code) {
     return -1;
 }
 
+std::array<uint64_t, InputDevice::latency_buckets> InputDevice::emitLatency() {
+    std::array<uint64_t, latency_buckets> ret{};
+    for (std::size_t i = 0; i < latency_buckets; ++i)
+        ret[i] = emit_latency[i].load(std::memory_order_relaxed);
+    return ret;
+}
+
 std::string InputDevice::_toEventName(uint type, uint code) {
-    const char* ret = libevdev_event_code_get_name(type, code);
+    const char* ret;
+    if (auto table = names_of(type))
+        ret = code < table->names.size() ? table->names[code] : nullptr;
+    else
+        ret = libevdev_event_code_get_name(type, code);
 
     if (!ret)
         throw InvalidEventCode(code);
@@ -151,6 +260,13 @@ std::string InputDevice::_toEventName(uint type, uint code) {
 }
 
 uint InputDevice::_toEventCode(uint type, const std::string& name) {
+    if (auto table = names_of(type)) {
+        auto it = table->codes.find(name);
+        if (it != table->codes.end())
+            return it->second;
+    }
+
+    // Aliases (e.g. KEY_MIN_INTERESTING) only map one way
     int code = libevdev_event_code_from_name(type, name.c_str());
 
     if (code == -1)
@@ -160,24 +276,137 @@ uint InputDevice::_toEventCode(uint type, const std::string& name) {
 }
 
 void InputDevice::_enableEvent(const uint type, const uint code) {
+    libevdev_enable_event_code(device, type, code, nullptr);
+
+    if (!_rebuild_pending) {
+        _rebuild_pending = true;
+        _tasks.add(run_task_after([self_weak = weak_from_this()]() {
+            if (auto self = self_weak.lock())
+                self->_rebuild();
+        }, rebuild_delay));
+    }
+}
+
+void InputDevice::_rebuild() {
     std::unique_lock lock(_input_mutex);
-    libevdev_uinput_destroy(ui_device);
+    _rebuild_pending = false;
+    if (_sink)
+        return;
 
-    libevdev_enable_event_code(device, type, code, nullptr);
+    logPrintf(DEBUG, "Recreating virtual input device for new event codes");
+    if (ui_device)
+        libevdev_uinput_destroy(ui_device);
 
     int err = libevdev_uinput_create_from_device(device,
                                                  LIBEVDEV_UINPUT_OPEN_MANAGED, &ui_device);
 
     if (err != 0) {
-        libevdev_free(device);
-        device = nullptr;
         ui_device = nullptr;
         throw std::system_error(-err, std::generic_category());
     }
 }
 
 void InputDevice::_sendEvent(uint type, uint code, int value) {
-    std::unique_lock lock(_input_mutex);
-    libevdev_uinput_write_event(ui_device, type, code, value);
-    libevdev_uinput_write_event(ui_device, EV_SYN, SYN_REPORT, 0);
+    std::array<input_event, 2> events{};
+    events[0].type = type;
+    events[0].code = code;
+    events[0].value = value;
+    _writeFrame(events.data(), 1);
+}
+
+void InputDevice::_writeFrame(input_event* events, std::size_t count) {
+    /* Keys are counted as they are written, so a release cannot be
+     * overtaken by another frame pressing the key again */
+    bool keys = std::any_of(events, events + count, [](const input_event& event) {
+        return event.type == EV_KEY;
+    });
+    std::shared_lock shared_lock(_input_mutex, std::defer_lock);
+    std::unique_lock unique_lock(_input_mutex, std::defer_lock);
+    if (keys) {
+        unique_lock.lock();
+        count = _countKeys(events, count);
+        if (!count)
+            return;
+    } else {
+        shared_lock.lock();
+    }
+
+    events[count] = {};
+    events[count].type = EV_SYN;
+    events[count].code = SYN_REPORT;
+
+    if (_sink) {
+        _sink({events, count});
+        _recordLatency();
+        return;
+    }
+    if (!ui_device)
+        return;
+
+    /* uinput takes any number of events per write and stamps them itself,
+     * this skips libevdev's per-event checks. */
+    int fd = libevdev_uinput_get_fd(ui_device);
+    LOGID_TRACE(input_emit, fd, count);
+    auto data = reinterpret_cast<const char*>(events);
+    std::size_t left = (count + 1) * sizeof(input_event);
+    while (left) {
+        auto ret = ::write(fd, data, left);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            logPrintf(WARN, "Failed to write input events: %s", strerror(errno));
+            return;
+        }
+        data += ret;
+        left -= ret;
+    }
+
+    _recordLatency();
+}
+
+void InputDevice::_recordLatency() {
+    if (auto read_time = backend::raw::RawDevice::readTime()) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - *read_time).count();
+        auto bucket = std::min<std::size_t>(std::bit_width((uint64_t) us), latency_buckets - 1);
+        emit_latency[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+InputDevice::Frame::Frame(std::shared_ptr<InputDevice> device) :
+        _device(std::move(device)) {
+}
+
+InputDevice::Frame::~Frame() {
+    flush();
+}
+
+void InputDevice::Frame::moveAxis(uint axis, int movement) {
+    _add(EV_REL, axis, movement);
+}
+
+void InputDevice::Frame::pressKey(uint code) {
+    _add(EV_KEY, code, 1);
+}
+
+void InputDevice::Frame::releaseKey(uint code) {
+    _add(EV_KEY, code, 0);
+}
+
+void InputDevice::Frame::flush() {
+    if (_count) {
+        _device->_writeFrame(_events.data(), _count);
+        _count = 0;
+    }
+}
+
+void InputDevice::Frame::_add(uint type, uint code, int value) {
+    if (_count == max_events)
+        flush();
+
+    auto& event = _events[_count++];
+    event = {};
+    event.type = type;
+    event.code = code;
+    event.value = value;
 }
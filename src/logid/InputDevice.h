@@ -19,9 +19,17 @@
 #ifndef LOGID_INPUTDEVICE_H
 #define LOGID_INPUTDEVICE_H
 
+#include <util/task.h>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <functional>
 #include <memory>
+#include <set>
 #include <string>
 #include <mutex>
+#include <shared_mutex>
+#include <span>
 
 extern "C"
 {
@@ -30,7 +38,8 @@ extern "C"
 }
 
 namespace logid {
-    class InputDevice {
+    // Held through a shared_ptr, so a pending rebuild can tell it is gone
+    class InputDevice : public std::enable_shared_from_this<InputDevice> {
     public:
         class InvalidEventCode : public std::exception {
         public:
@@ -44,7 +53,50 @@ namespace logid {
             const std::string _what;
         };
 
-        explicit InputDevice(const char* name);
+        /* Collects events that are written together and synced once, so
+         * a chord or a hi-res scroll with its low-res step arrive as one
+         * frame. Flushed when full and when destroyed. */
+        class Frame {
+        public:
+            explicit Frame(std::shared_ptr<InputDevice> device);
+
+            Frame(const Frame&) = delete;
+
+            Frame& operator=(const Frame&) = delete;
+
+            ~Frame();
+
+            void moveAxis(uint axis, int movement);
+
+            void pressKey(uint code);
+
+            void releaseKey(uint code);
+
+            void flush();
+
+        private:
+            void _add(uint type, uint code, int value);
+
+            static constexpr std::size_t max_events = 32;
+
+            std::shared_ptr<InputDevice> _device;
+            // One more for the SYN_REPORT
+            std::array<input_event, max_events + 1> _events{};
+            std::size_t _count = 0;
+        };
+
+        /* keys and axes are enabled from the start. Codes registered later
+         * are batched into a single rebuild of the uinput device. */
+        explicit InputDevice(const char* name, const std::set<uint>& keys = {},
+                             const std::set<uint>& axes = {});
+
+        // Gets each frame, without its SYN_REPORT, in place of a write
+        typedef std::function<void(std::span<const input_event>)> Sink;
+
+        /* Frames go to sink and no uinput device is made, for tools that
+         * run actions without /dev/uinput */
+        InputDevice(const char* name, Sink sink, const std::set<uint>& keys = {},
+                    const std::set<uint>& axes = {});
 
         ~InputDevice();
 
@@ -54,6 +106,8 @@ namespace logid {
 
         void moveAxis(uint axis, int movement);
 
+        /* Keys are reference counted, so only the first press and the last
+         * release of a key held by several actions are written */
         void pressKey(uint code);
 
         void releaseKey(uint code);
@@ -68,21 +122,54 @@ namespace logid {
 
         static int getLowResAxis(uint axis_code);
 
+        static constexpr std::size_t latency_buckets = 24;
+
+        /* Time from reading the HID++ report to writing the resulting
+         * events, bucket n counts [2^(n-1), 2^n) microseconds. uinput
+         * stamps events itself, so this is the delay applications see. */
+        [[nodiscard]] static std::array<uint64_t, latency_buckets> emitLatency();
+
     private:
         void _sendEvent(uint type, uint code, int value);
 
+        // events must have room for the SYN_REPORT after count
+        void _writeFrame(input_event* events, std::size_t count);
+
+        // Requires _input_mutex
         void _enableEvent(uint type, uint name);
 
+        void _rebuild();
+
+        static void _recordLatency();
+
         static std::string _toEventName(uint type, uint code);
 
         static uint _toEventCode(uint type, const std::string& name);
 
-        bool registered_keys[KEY_CNT]{};
-        bool registered_axis[REL_CNT]{};
+        // Whether the press or release changes the key's state
+        bool _keyDown(uint code);
+
+        bool _keyUp(uint code);
+
+        /* Drops the key events that change nothing, returns how many are
+         * left. Requires _input_mutex exclusively. */
+        std::size_t _countKeys(input_event* events, std::size_t count);
+
+        // Guarded by _input_mutex
+        std::array<uint16_t, KEY_CNT> _key_holds{};
+        std::bitset<KEY_CNT> registered_keys;
+        std::bitset<REL_CNT> registered_axis;
         libevdev* device;
         libevdev_uinput* ui_device{};
+        const Sink _sink;
+
+        /* Shared by writers, the kernel keeps each write() together.
+         * Exclusive while the uinput device is changed and for frames
+         * with keys, whose holds are counted as they are written. */
+        std::shared_mutex _input_mutex;
 
-        std::mutex _input_mutex;
+        bool _rebuild_pending = false;
+        task_set _tasks;
     };
 }
 
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <Metrics.h>
+#include <backend/raw/IOMonitor.h>
+#include <util/log.h>
+#include <util/task.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace logid;
+
+namespace {
+    // A client that has not sent its request by then gets the bare text
+    constexpr timeval request_timeout{0, 100000};
+    constexpr timeval send_timeout{1, 0};
+    constexpr int backlog = 8;
+
+    std::string escapeLabel(const std::string& value) {
+        std::string ret;
+        ret.reserve(value.size());
+        for (char c: value) {
+            if (c == '\\' || c == '"')
+                ret += '\\';
+            if (c == '\n')
+                ret += "\\n";
+            else
+                ret += c;
+        }
+        return ret;
+    }
+
+    void serve(int fd, const std::function<std::string()>& render) {
+        char request[512];
+        ssize_t length = ::recv(fd, request, sizeof(request), 0);
+        bool http = length >= 4 && std::memcmp(request, "GET ", 4) == 0;
+
+        std::string body;
+        try {
+            body = render();
+        } catch (std::exception& e) {
+            logPrintf(WARN, "Could not render metrics: %s", e.what());
+        }
+
+        std::string response;
+        if (http) {
+            response = "HTTP/1.0 200 OK\r\n"
+                       "Content-Type: application/openmetrics-text; version=1.0.0; "
+                       "charset=utf-8\r\n"
+                       "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                       "Connection: close\r\n\r\n";
+        }
+        response += body;
+
+        std::size_t sent = 0;
+        while (sent < response.size()) {
+            ssize_t ret = ::send(fd, response.data() + sent, response.size() - sent,
+                                 MSG_NOSIGNAL);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+                break;
+            sent += ret;
+        }
+
+        ::close(fd);
+    }
+
+    void accept(int fd, const std::shared_ptr<const std::function<std::string()>>& render) {
+        // Drained, required in edge-triggered mode
+        int client;
+        while ((client = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+            ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &request_timeout,
+                         sizeof(request_timeout));
+            ::setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+            run_task([client, render]() { serve(client, *render); });
+        }
+    }
+}
+
+void MetricsWriter::family(const std::string& name, const char* type, const char* help) {
+    _text += "# TYPE " + name + " " + type + "\n";
+    _text += "# HELP " + name + " " + help + "\n";
+}
+
+void MetricsWriter::sample(const std::string& name, const labels& labels, uint64_t value) {
+    _sample(name, labels, std::to_string(value));
+}
+
+void MetricsWriter::sample(const std::string& name, const labels& labels, double value) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.9g", value);
+    _sample(name, labels, buf);
+}
+
+void MetricsWriter::histogram(const std::string& name, const labels& labels,
+                              const uint64_t* buckets, std::size_t count) {
+    uint64_t total = 0;
+    auto bucket_labels = labels;
+    bucket_labels.emplace_back("le", "");
+    for (std::size_t i = 0; i + 1 < count; ++i) {
+        total += buckets[i];
+        char le[32];
+        std::snprintf(le, sizeof(le), "%.9g", static_cast<double>(1ull << i) / 1e6);
+        bucket_labels.back().second = le;
+        _sample(name + "_bucket", bucket_labels, std::to_string(total));
+    }
+    if (count > 0)
+        total += buckets[count - 1];
+
+    bucket_labels.back().second = "+Inf";
+    _sample(name + "_bucket", bucket_labels, std::to_string(total));
+    _sample(name + "_count", labels, std::to_string(total));
+}
+
+std::string MetricsWriter::finish() {
+    _text += "# EOF\n";
+    return std::move(_text);
+}
+
+void MetricsWriter::_sample(const std::string& name, const labels& labels,
+                            const std::string& value) {
+    _text += name;
+    if (!labels.empty()) {
+        _text += '{';
+        for (std::size_t i = 0; i < labels.size(); ++i) {
+            if (i)
+                _text += ',';
+            _text += labels[i].first + "=\"" + escapeLabel(labels[i].second) + "\"";
+        }
+        _text += '}';
+    }
+    _text += ' ';
+    _text += value;
+    _text += '\n';
+}
+
+MetricsServer::MetricsServer(std::string path, std::shared_ptr<backend::raw::IOMonitor> monitor,
+                             std::function<std::string()> render) :
+        _path(std::move(path)), _monitor(std::move(monitor)),
+        _render(std::make_shared<const std::function<std::string()>>(std::move(render))) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (_path.size() >= sizeof(addr.sun_path))
+        throw std::invalid_argument("metrics socket path too long");
+    std::strcpy(addr.sun_path, _path.c_str());
+
+    // Left over from a daemon that did not exit cleanly
+    struct stat info{};
+    if (::lstat(_path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+        ::unlink(_path.c_str());
+
+    _fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_fd < 0)
+        throw std::system_error(errno, std::system_category(), "socket");
+
+    if (::bind(_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        ::listen(_fd, backlog) < 0) {
+        int err = errno;
+        ::close(_fd);
+        throw std::system_error(err, std::system_category(), _path);
+    }
+
+    _monitor->add(_fd, {
+            [fd = _fd, render = _render]() { accept(fd, render); },
+            []() {
+                throw std::runtime_error("metrics socket hangup");
+            },
+            []() {
+                throw std::runtime_error("metrics socket error");
+            }
+    });
+}
+
+MetricsServer::~MetricsServer() {
+    _monitor->remove(_fd);
+    ::close(_fd);
+    ::unlink(_path.c_str());
+}
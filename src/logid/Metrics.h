@@ -0,0 +1,80 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_METRICS_H
+#define LOGID_METRICS_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace logid {
+    namespace backend::raw {
+        class IOMonitor;
+    }
+
+    /* Builds OpenMetrics text. Every sample of a family must be written
+     * right after its family(), counters are given without _total. */
+    class MetricsWriter {
+    public:
+        typedef std::vector<std::pair<std::string, std::string>> labels;
+
+        void family(const std::string& name, const char* type, const char* help);
+
+        void sample(const std::string& name, const labels& labels, uint64_t value);
+
+        void sample(const std::string& name, const labels& labels, double value);
+
+        /* Bucket n counts [2^(n-1), 2^n) microseconds and the last one is
+         * open, as the scheduler and transport histograms are kept */
+        void histogram(const std::string& name, const labels& labels,
+                       const uint64_t* buckets, std::size_t count);
+
+        [[nodiscard]] std::string finish();
+
+    private:
+        void _sample(const std::string& name, const labels& labels, const std::string& value);
+
+        std::string _text;
+    };
+
+    /* Listens on a Unix socket and answers every connection with the text
+     * render returns, behind an HTTP header if the client sent a GET.
+     * Rendering runs on the worker pool, never on the I/O thread. */
+    class MetricsServer {
+    public:
+        MetricsServer(std::string path, std::shared_ptr<backend::raw::IOMonitor> monitor,
+                      std::function<std::string()> render);
+
+        MetricsServer(const MetricsServer&) = delete;
+
+        MetricsServer(MetricsServer&&) = delete;
+
+        ~MetricsServer();
+
+    private:
+        const std::string _path;
+        const std::shared_ptr<backend::raw::IOMonitor> _monitor;
+        const std::shared_ptr<const std::function<std::string()>> _render;
+        int _fd = -1;
+    };
+}
+
+#endif //LOGID_METRICS_H
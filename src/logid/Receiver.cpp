@@ -20,6 +20,7 @@
 #include <DeviceManager.h>
 #include <backend/Error.h>
 #include <util/log.h>
+#include <util/task.h>
 #include <ipc_defs.h>
 
 using namespace logid;
@@ -35,10 +36,8 @@ ReceiverNickname::operator std::string() const {
 }
 
 ReceiverNickname::~ReceiverNickname() {
-    if (auto manager = _manager.lock()) {
-        std::lock_guard<std::mutex> lock(manager->_nick_lock);
-        manager->_receiver_nicknames.erase(_nickname);
-    }
+    if (auto manager = _manager.lock())
+        manager->_receiver_nicknames.release(_nickname);
 }
 
 std::shared_ptr<Receiver> Receiver::make(
@@ -46,6 +45,16 @@ std::shared_ptr<Receiver> Receiver::make(
         const std::shared_ptr<DeviceManager>& manager) {
     auto ret = ReceiverMonitor::make<Receiver>(path, manager);
     ret->_ipc_node->manage(ret);
+    ret->_invalidatePaired();
+    return ret;
+}
+
+std::shared_ptr<Receiver> Receiver::make(
+        std::shared_ptr<backend::raw::RawDevice> raw_device,
+        const std::shared_ptr<DeviceManager>& manager) {
+    auto ret = ReceiverMonitor::make<Receiver>(std::move(raw_device), manager);
+    ret->_ipc_node->manage(ret);
+    ret->_invalidatePaired();
     return ret;
 }
 
@@ -54,12 +63,28 @@ Receiver::Receiver(const std::string& path,
                    const std::shared_ptr<DeviceManager>& manager) :
         hidpp10::ReceiverMonitor(path, manager,
                                  manager->config()->io_timeout.value_or(
-                                         defaults::io_timeout)),
+                                         defaults::io_timeout),
+                                 std::chrono::milliseconds(
+                                         manager->config()->connection_debounce.value_or(
+                                                 defaults::connection_debounce))),
         _path(path), _manager(manager), _nickname(manager),
         _ipc_node(manager->receiversNode()->make_child(_nickname)),
         _ipc_interface(_ipc_node->make_interface<IPC>(this)) {
 }
 
+Receiver::Receiver(std::shared_ptr<backend::raw::RawDevice> raw_device,
+                   const std::shared_ptr<DeviceManager>& manager) :
+        hidpp10::ReceiverMonitor(std::move(raw_device),
+                                 manager->config()->io_timeout.value_or(
+                                         defaults::io_timeout),
+                                 std::chrono::milliseconds(
+                                         manager->config()->connection_debounce.value_or(
+                                                 defaults::connection_debounce))),
+        _path(receiver()->devicePath()), _manager(manager), _nickname(manager),
+        _ipc_node(manager->receiversNode()->make_child(_nickname)),
+        _ipc_interface(_ipc_node->make_interface<IPC>(this)) {
+}
+
 const Receiver::DeviceList& Receiver::devices() const {
     return _devices;
 }
@@ -71,8 +96,15 @@ Receiver::~Receiver() noexcept {
     }
 }
 
+std::mutex& Receiver::_indexLock(hidpp::DeviceIndex index) {
+    std::lock_guard<std::mutex> lock(_devices_change);
+    return _index_locks[index];
+}
+
 void Receiver::addDevice(hidpp::DeviceConnectionEvent event) {
-    std::unique_lock<std::mutex> lock(_devices_change);
+    /* Only events for the same index are serialized, so devices on
+     * different slots initialize concurrently on the worker pool. */
+    std::lock_guard<std::mutex> index_lock(_indexLock(event.index));
 
     auto manager = _manager.lock();
     if (!manager) {
@@ -89,21 +121,46 @@ void Receiver::addDevice(hidpp::DeviceConnectionEvent event) {
             return;
         }
 
-        auto dev = _devices.find(event.index);
-        if (dev != _devices.end()) {
+        std::shared_ptr<Device> existing;
+        {
+            std::lock_guard<std::mutex> lock(_devices_change);
+            auto dev = _devices.find(event.index);
+            if (dev != _devices.end())
+                existing = dev->second;
+        }
+
+        if (existing) {
             if (event.linkEstablished)
-                dev->second->wakeup();
+                existing->requestWakeup();
             else
-                dev->second->sleep();
+                existing->requestSleep();
             return;
         }
 
         if (!event.linkEstablished)
             return;
 
-        auto hidpp_device = hidpp::Device::make(
+        // A new device may have just been paired
+        _invalidatePaired();
+
+        /* The probe becomes the device, so init only happens once */
+        auto result = hidpp20::Device::tryProbe(
                 receiver(), event, manager->config()->io_timeout.value_or(defaults::io_timeout));
 
+        if (!result) {
+            // A sleeping device is the common case, anything else is reported below
+            if (result.error().kind != RequestError::Timeout)
+                result.error().raise();
+
+            if (!event.fromTimeoutCheck)
+                logPrintf(DEBUG, "%s:%d timed out, waiting for input from device to"
+                                 " initialize.", _path.c_str(), event.index);
+            waitForDevice(event.index);
+            return;
+        }
+
+        auto hidpp_device = std::move(*result);
+
         auto version = hidpp_device->version();
 
         if (std::get<0>(version) < 2) {
@@ -112,10 +169,8 @@ void Receiver::addDevice(hidpp::DeviceConnectionEvent event) {
             return;
         }
 
-        hidpp_device.reset();
-
-        auto device = Device::make(this, event.index, manager);
-        std::lock_guard<std::mutex> manager_lock(manager->mutex());
+        auto device = Device::make(std::move(hidpp_device), manager);
+        std::lock_guard<std::mutex> lock(_devices_change);
         _devices.emplace(event.index, device);
         manager->addExternalDevice(device);
 
@@ -134,16 +189,17 @@ void Receiver::addDevice(hidpp::DeviceConnectionEvent event) {
 }
 
 void Receiver::removeDevice(hidpp::DeviceIndex index) {
+    // Waits for an init in progress on this index
+    std::lock_guard<std::mutex> index_lock(_indexLock(index));
     std::unique_lock<std::mutex> lock(_devices_change);
-    std::unique_lock<std::mutex> manager_lock;
-    if (auto manager = _manager.lock())
-        manager_lock = std::unique_lock<std::mutex>(manager->mutex());
     auto device = _devices.find(index);
     if (device != _devices.end()) {
         if (auto manager = _manager.lock())
             manager->removeExternalDevice(device->second);
         _devices.erase(device);
     }
+
+    _invalidatePaired();
 }
 
 void Receiver::pairReady(const hidpp10::DeviceDiscoveryEvent& event,
@@ -183,8 +239,24 @@ std::shared_ptr<hidpp10::Receiver> Receiver::rawReceiver() {
     return receiver();
 }
 
-std::vector<std::tuple<int, uint16_t, std::string, uint32_t>> Receiver::pairedDevices() const {
-    std::vector<std::tuple<int, uint16_t, std::string, uint32_t>> ret;
+Receiver::PairedList Receiver::pairedDevices() const {
+    {
+        std::lock_guard<std::mutex> lock(_paired_mutex);
+        if (_paired.has_value())
+            return _paired.value();
+    }
+
+    return _readPaired();
+}
+
+Receiver::PairedList Receiver::_readPaired() const {
+    std::size_t generation;
+    {
+        std::lock_guard<std::mutex> lock(_paired_mutex);
+        generation = _paired_generation;
+    }
+
+    PairedList ret;
     for (int i = hidpp::WirelessDevice1; i <= hidpp::WirelessDevice6; ++i) {
         try {
             auto index(static_cast<hidpp::DeviceIndex>(i));
@@ -197,19 +269,52 @@ std::vector<std::tuple<int, uint16_t, std::string, uint32_t>> Receiver::pairedDe
         }
     }
 
+    std::lock_guard<std::mutex> lock(_paired_mutex);
+    if (generation == _paired_generation)
+        _paired = ret;
+
     return ret;
 }
 
+void Receiver::_invalidatePaired() {
+    {
+        std::lock_guard<std::mutex> lock(_paired_mutex);
+        _paired.reset();
+        ++_paired_generation;
+    }
+
+    run_task([self_weak = self<Receiver>()]() {
+        if (auto self = self_weak.lock())
+            (void) self->_readPaired();
+    }, task_priority::background);
+}
+
 void Receiver::startPair(uint8_t timeout) {
-    _startPair(timeout);
+    _postIPC([this, timeout]() { _startPair(timeout); });
 }
 
 void Receiver::stopPair() {
-    _stopPair();
+    _postIPC([this]() { _stopPair(); });
 }
 
 void Receiver::unpair(int device) {
-    receiver()->disconnect(static_cast<hidpp::DeviceIndex>(device));
+    _postIPC([this, device]() {
+        receiver()->disconnect(static_cast<hidpp::DeviceIndex>(device));
+        _invalidatePaired();
+    });
+}
+
+void Receiver::_postIPC(std::function<void()> function, std::source_location location) {
+    _tasks.add(_strand.post([self_weak = self<Receiver>(), function = std::move(function)]() {
+        auto self = self_weak.lock();
+        if (!self)
+            return;
+        try {
+            function();
+        } catch (std::exception& e) {
+            logPrintf(WARN, "%s: IPC call failed: %s", self->_path.c_str(), e.what());
+        }
+    }, location));
 }
 
 Receiver::IPC::IPC(Receiver* receiver) :
@@ -47,21 +47,31 @@ namespace logid {
         typedef std::map<backend::hidpp::DeviceIndex, std::shared_ptr<Device>>
                 DeviceList;
 
+        // Index, PID, name and serial number
+        typedef std::vector<std::tuple<int, uint16_t, std::string, uint32_t>>
+                PairedList;
+
         ~Receiver() noexcept override;
 
         static std::shared_ptr<Receiver> make(
                 const std::string& path,
                 const std::shared_ptr<DeviceManager>& manager);
 
+        static std::shared_ptr<Receiver> make(
+                std::shared_ptr<backend::raw::RawDevice> raw_device,
+                const std::shared_ptr<DeviceManager>& manager);
+
         [[nodiscard]] const std::string& path() const;
 
         std::shared_ptr<backend::hidpp10::Receiver> rawReceiver();
 
         [[nodiscard]] const DeviceList& devices() const;
 
-        [[nodiscard]] std::vector<std::tuple<int, uint16_t, std::string, uint32_t>>
-        pairedDevices() const;
+        /* Cached, refreshed in the background whenever pairings may change */
+        [[nodiscard]] PairedList pairedDevices() const;
 
+        /* These talk to the receiver from its strand, the IPC reply goes
+         * out before they run and what they throw is logged */
         void startPair(uint8_t timeout);
 
         void stopPair();
@@ -72,6 +82,9 @@ namespace logid {
         Receiver(const std::string& path,
                  const std::shared_ptr<DeviceManager>& manager);
 
+        Receiver(std::shared_ptr<backend::raw::RawDevice> raw_device,
+                 const std::shared_ptr<DeviceManager>& manager);
+
         void addDevice(backend::hidpp::DeviceConnectionEvent event) override;
 
         void removeDevice(backend::hidpp::DeviceIndex index) override;
@@ -80,8 +93,24 @@ namespace logid {
                        const std::string& passkey) override;
 
     private:
+        PairedList _readPaired() const;
+
+        void _invalidatePaired();
+
+        void _postIPC(std::function<void()> function,
+                      std::source_location location = std::source_location::current());
+
+        mutable std::mutex _paired_mutex;
+        mutable std::optional<PairedList> _paired;
+        // Keeps a read from before an invalidation from being cached
+        std::size_t _paired_generation = 0;
+
+        std::mutex& _indexLock(backend::hidpp::DeviceIndex index);
+
+        // Guards _devices and _index_locks, never held during device init
         std::mutex _devices_change;
         DeviceList _devices;
+        std::map<backend::hidpp::DeviceIndex, std::mutex> _index_locks;
         std::string _path;
         std::weak_ptr<DeviceManager> _manager;
 
@@ -94,6 +123,10 @@ namespace logid {
         };
 
         std::shared_ptr<ipcgull::interface> _ipc_interface;
+
+        task_set _tasks;
+        // Pairing calls keep their order
+        strand _strand;
     };
 }
 
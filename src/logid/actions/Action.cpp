@@ -26,6 +26,9 @@
 #include <actions/ChangeDPI.h>
 #include <actions/ChangeHostAction.h>
 #include <actions/ChangeProfile.h>
+#include <actions/MacroAction.h>
+#include <actions/ChordAction.h>
+#include <Device.h>
 #include <ipc_defs.h>
 
 using namespace logid;
@@ -49,8 +52,10 @@ namespace logid::actions {
     std::shared_ptr<Action> _makeAction(
             Device* device, T& action,
             const std::shared_ptr<ipcgull::node>& parent) {
-        return parent->make_interface<typename action_type<T>::type>(
+        auto ret = parent->make_interface<typename action_type<T>::type>(
                 device, std::forward<T&>(action), parent);
+        ret->_account(sizeof(typename action_type<T>::type));
+        return ret;
     }
 
     template<typename T>
@@ -74,6 +79,8 @@ namespace logid::actions {
             config = config::ToggleSmartShift();
         } else if (name == ChangeProfile::interface_name) {
             config = config::ChangeProfile();
+        } else if (name == MacroAction::interface_name) {
+            config = config::MacroAction();
         } else if (name == "Default") {
             config.reset();
             return nullptr;
@@ -108,6 +115,9 @@ std::shared_ptr<Action> Action::makeAction(
         if (name == GestureAction::interface_name) {
             config = config::GestureAction();
             return makeAction(device, config.value(), parent);
+        } else if (name == ChordAction::interface_name) {
+            config = config::ChordAction();
+            return makeAction(device, config.value(), parent);
         }
         throw;
     }
@@ -137,6 +147,10 @@ std::shared_ptr<Action> Action::makeAction(
     return ret;
 }
 
+void Action::_account(std::size_t bytes) {
+    _charge.charge(_device->memoryAccount(), memory_account::actions, bytes);
+}
+
 Action::Action(Device* device, const std::string& name, tables t) :
         ipcgull::interface(SERVICE_ROOT_NAME ".Action." + name, std::move(t)),
         _device(device), _pressed(false) {
@@ -25,6 +25,8 @@
 #include <ipcgull/node.h>
 #include <ipcgull/interface.h>
 #include <config/schema.h>
+#include <config/edit_mutex.h>
+#include <util/memory.h>
 
 namespace logid {
     class Device;
@@ -77,6 +79,9 @@ namespace logid::actions {
 
         [[nodiscard]] virtual uint8_t reprogFlags() const = 0;
 
+        // Counts bytes, the action's own size, against its device
+        void _account(std::size_t bytes);
+
         virtual ~Action() = default;
 
     protected:
@@ -84,7 +89,7 @@ namespace logid::actions {
 
         Device* _device;
         std::atomic<bool> _pressed;
-        mutable std::shared_mutex _config_mutex;
+        mutable config::edit_mutex _config_mutex;
 
         template <typename T>
         [[nodiscard]] std::weak_ptr<T> self() const {
@@ -93,6 +98,7 @@ namespace logid::actions {
 
     private:
         std::weak_ptr<Action> _self;
+        memory_charge _charge;
     };
 }
 
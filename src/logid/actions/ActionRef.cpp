@@ -0,0 +1,79 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <actions/ActionRef.h>
+#include <actions/ChangeDPI.h>
+#include <actions/ChangeHostAction.h>
+#include <actions/ChangeProfile.h>
+#include <actions/ChordAction.h>
+#include <actions/CycleDPI.h>
+#include <actions/GestureAction.h>
+#include <actions/KeypressAction.h>
+#include <actions/MacroAction.h>
+#include <actions/NullAction.h>
+#include <actions/ToggleHiresScroll.h>
+#include <actions/ToggleSmartShift.h>
+#include <type_traits>
+
+using namespace logid::actions;
+
+namespace {
+    /* Tries each alternative after std::monostate in turn, the last one
+     * is Action* and matches any action */
+    template<typename Variant, std::size_t I = 1>
+    void resolve(Variant& out, Action* action) {
+        if constexpr (I < std::variant_size_v<Variant>) {
+            using T = std::variant_alternative_t<I, Variant>;
+            if (auto concrete = dynamic_cast<T>(action))
+                out = concrete;
+            else
+                resolve<Variant, I + 1>(out, action);
+        }
+    }
+}
+
+ActionRef::ActionRef(Action* action) {
+    if (action)
+        resolve(_action, action);
+}
+
+template<typename F>
+auto ActionRef::_visit(F&& f) const {
+    typedef decltype(f(static_cast<NullAction*>(nullptr))) result;
+    return std::visit([&f](auto action) -> result {
+        if constexpr (std::is_same_v<decltype(action), std::monostate>)
+            return result();
+        else
+            return f(action);
+    }, _action);
+}
+
+void ActionRef::press() const {
+    _visit([](auto* action) { action->press(); });
+}
+
+void ActionRef::release() const {
+    _visit([](auto* action) { action->release(); });
+}
+
+void ActionRef::move(int16_t x, int16_t y) const {
+    _visit([x, y](auto* action) { action->move(x, y); });
+}
+
+bool ActionRef::pressed() const {
+    return _visit([](auto* action) { return action->pressed(); });
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_ACTION_ACTIONREF_H
+#define LOGID_ACTION_ACTIONREF_H
+
+#include <actions/Action.h>
+#include <variant>
+
+namespace logid::actions {
+    class KeypressAction;
+    class GestureAction;
+    class ChordAction;
+    class MacroAction;
+    class ChangeDPI;
+    class CycleDPI;
+    class ToggleSmartShift;
+    class ToggleHiresScroll;
+    class ChangeHostAction;
+    class ChangeProfile;
+    class NullAction;
+
+    /* An action with its concrete type resolved once, so the event path
+     * dispatches on a jump table and calls the final class directly
+     * rather than through its vtable. Does not own the action. */
+    class ActionRef {
+    public:
+        ActionRef() = default;
+
+        explicit ActionRef(Action* action);
+
+        // Without an action these do nothing, pressed returns false
+        void press() const;
+
+        void release() const;
+
+        void move(int16_t x, int16_t y) const;
+
+        [[nodiscard]] bool pressed() const;
+
+        explicit operator bool() const {
+            return !std::holds_alternative<std::monostate>(_action);
+        }
+
+    private:
+        template<typename F>
+        auto _visit(F&& f) const;
+
+        // Types not listed fall through to Action* and its vtable
+        std::variant<std::monostate,
+                KeypressAction*, GestureAction*, ChordAction*, MacroAction*,
+                ChangeDPI*, CycleDPI*, ToggleSmartShift*, ToggleHiresScroll*,
+                ChangeHostAction*, ChangeProfile*, NullAction*, Action*> _action;
+    };
+}
+
+#endif //LOGID_ACTION_ACTIONREF_H
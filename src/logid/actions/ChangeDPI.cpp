@@ -62,7 +62,7 @@ void ChangeDPI::press() {
                         throw e;
                 }
             }
-        });
+        }, task_priority::interactive);
     }
 }
 
@@ -22,7 +22,7 @@
 #include <features/DPI.h>
 
 namespace logid::actions {
-    class ChangeDPI : public Action {
+    class ChangeDPI final : public Action {
     public:
         static const char* interface_name;
 
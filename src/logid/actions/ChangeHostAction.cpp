@@ -19,7 +19,6 @@
 #include <Device.h>
 #include <backend/hidpp20/features/ReprogControls.h>
 #include <algorithm>
-#include <util/task.h>
 #include <util/log.h>
 
 using namespace logid::actions;
@@ -78,32 +77,95 @@ void ChangeHostAction::setHost(std::string host) {
 }
 
 void ChangeHostAction::press() {
-    // Do nothing, wait until release
+    // Switching waits until release, read the host info ahead of it
+    std::lock_guard lock(_host_mutex);
+    if (_change_host && _host_stale)
+        _refreshHostInfo();
 }
 
 void ChangeHostAction::release() {
     std::shared_lock lock(_config_mutex);
-    if (_change_host && _config.host.has_value()) {
-        run_task([self_weak = self<ChangeHostAction>(), host = _config.host.value()] {
-            if (auto self = self_weak.lock()) {
-                auto host_info = self->_change_host->getHostInfo();
-                int next_host;
-                if (std::holds_alternative<std::string>(host)) {
-                    const auto& host_str = std::get<std::string>(host);
-                    if (host_str == "next")
-                        next_host = host_info.currentHost + 1;
-                    else if (host_str == "prev" || host_str == "previous")
-                        next_host = host_info.currentHost - 1;
-                    else
-                        next_host = host_info.currentHost;
-                } else {
-                    next_host = std::get<int>(host) - 1;
+    if (!_change_host || !_config.host.has_value())
+        return;
+
+    std::unique_lock host_lock(_host_mutex);
+    if (!_host_info) {
+        _pending_host = _config.host.value();
+        _refreshHostInfo();
+        return;
+    }
+
+    auto info = _host_info.value();
+    _host_stale = true;
+    host_lock.unlock();
+
+    _switchHost(info, _config.host.value());
+}
+
+void ChangeHostAction::_refreshHostInfo() {
+    if (_host_refreshing)
+        return;
+    _host_refreshing = true;
+
+    _change_host->getHostInfo(
+            [self_weak = self<ChangeHostAction>()](hidpp20::ChangeHost::HostInfo info) {
+                auto self = self_weak.lock();
+                if (!self)
+                    return;
+                std::unique_lock lock(self->_host_mutex);
+                self->_host_info = info;
+                self->_host_stale = false;
+                self->_host_refreshing = false;
+                auto pending = std::move(self->_pending_host);
+                self->_pending_host.reset();
+                if (pending) {
+                    self->_host_stale = true;
+                    lock.unlock();
+                    self->_switchHost(info, pending.value());
                 }
-                next_host %= host_info.hostCount;
-                if (next_host != host_info.currentHost)
-                    self->_change_host->setHost(next_host);
-            }
-        });
+            },
+            [self_weak = self<ChangeHostAction>()](std::exception_ptr error) {
+                if (auto self = self_weak.lock()) {
+                    std::lock_guard lock(self->_host_mutex);
+                    self->_host_refreshing = false;
+                    self->_pending_host.reset();
+                }
+                std::rethrow_exception(error);
+            });
+}
+
+void ChangeHostAction::_switchHost(const hidpp20::ChangeHost::HostInfo& info,
+                                   const host_t& host) {
+    if (!info.hostCount)
+        return;
+
+    int next_host;
+    if (std::holds_alternative<std::string>(host)) {
+        const auto& host_str = std::get<std::string>(host);
+        if (host_str == "next")
+            next_host = info.currentHost + 1;
+        else if (host_str == "prev" || host_str == "previous")
+            next_host = info.currentHost - 1;
+        else
+            next_host = info.currentHost;
+    } else {
+        next_host = std::get<int>(host) - 1;
+    }
+    next_host = (next_host % info.hostCount + info.hostCount) % info.hostCount;
+    if (next_host == info.currentHost)
+        return;
+
+    // Set first, the device may be gone before setHost returns
+    _device->hostSwitched();
+
+    // No response is expected, this only writes to the device
+    try {
+        _change_host->setHost(next_host);
+    } catch (hidpp20::Error& e) {
+        _device->hostSwitched(false);
+        logPrintf(WARN, "%s:%d: Could not switch to host %d: %s",
+                  _device->hidpp20().devicePath().c_str(),
+                  _device->hidpp20().deviceIndex(), next_host + 1, e.what());
     }
 }
 
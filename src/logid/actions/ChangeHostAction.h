@@ -22,7 +22,7 @@
 #include <backend/hidpp20/features/ChangeHost.h>
 
 namespace logid::actions {
-    class ChangeHostAction : public Action {
+    class ChangeHostAction final : public Action {
     public:
         static const char* interface_name;
 
@@ -40,8 +40,26 @@ namespace logid::actions {
         [[nodiscard]] uint8_t reprogFlags() const final;
 
     protected:
+        typedef std::variant<int, std::string> host_t;
+
+        // Requires _host_mutex
+        void _refreshHostInfo();
+
+        void _switchHost(const backend::hidpp20::ChangeHost::HostInfo& info,
+                         const host_t& host);
+
         std::shared_ptr<backend::hidpp20::ChangeHost> _change_host;
         config::ChangeHost& _config;
+
+        /* The host count and this host's index, read ahead on press so a
+         * release does not wait for the device. Stale after a switch, since
+         * hosts may be paired while the device is away. */
+        std::mutex _host_mutex;
+        std::optional<backend::hidpp20::ChangeHost::HostInfo> _host_info;
+        bool _host_stale = true;
+        bool _host_refreshing = false;
+        // A release that arrived before the host info
+        std::optional<host_t> _pending_host;
     };
 }
 
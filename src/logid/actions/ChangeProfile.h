@@ -21,7 +21,7 @@
 #include <actions/Action.h>
 
 namespace logid::actions {
-    class ChangeProfile : public Action {
+    class ChangeProfile final : public Action {
     public:
         static const char* interface_name;
 
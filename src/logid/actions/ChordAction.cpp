@@ -0,0 +1,89 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <actions/ChordAction.h>
+#include <Device.h>
+#include <backend/hidpp20/features/ReprogControls.h>
+#include <util/log.h>
+
+using namespace logid::actions;
+using namespace logid::backend;
+
+const char* ChordAction::interface_name = "Chord";
+
+ChordAction::ChordAction(Device* device, config::ChordAction& config,
+                         const std::shared_ptr<ipcgull::node>& parent) :
+        Action(device, interface_name), _config(config) {
+    try {
+        if (_config.chord.has_value())
+            _action = Action::makeAction(device, _config.chord.value(),
+                                         parent->make_child("chord"));
+        if (_config.fallback.has_value())
+            _fallback = Action::makeAction(device, _config.fallback.value(),
+                                           parent->make_child("fallback"));
+    } catch (InvalidAction& e) {
+        logPrintf(WARN, "Mapping chord to invalid action");
+    }
+}
+
+void ChordAction::press() {
+    std::lock_guard lock(_chord_mutex);
+    if (_pressed.exchange(true))
+        return;
+
+    if (!_mask) {
+        auto buttons = _device->getFeature<features::RemapButton>("remapbutton");
+        if (!buttons)
+            return;
+        const auto cids = _config.buttons.value_or(std::list<int>());
+        _mask = buttons->maskOf({cids.begin(), cids.end()});
+        _buttons = buttons;
+    }
+
+    bool matched = false;
+    if (auto buttons = _buttons.lock())
+        matched = _mask->any() && buttons->held(*_mask);
+
+    _active = matched ? _action : _fallback;
+    if (_active)
+        _active->press();
+}
+
+void ChordAction::release() {
+    std::lock_guard lock(_chord_mutex);
+    if (!_pressed.exchange(false))
+        return;
+
+    if (_active)
+        _active->release();
+    _active.reset();
+}
+
+void ChordAction::move(int16_t x, int16_t y) {
+    std::lock_guard lock(_chord_mutex);
+    if (_active)
+        _active->move(x, y);
+}
+
+uint8_t ChordAction::reprogFlags() const {
+    uint8_t flags = hidpp20::ReprogControls::TemporaryDiverted;
+    if (_action)
+        flags |= _action->reprogFlags();
+    if (_fallback)
+        flags |= _fallback->reprogFlags();
+    return flags;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_ACTION_CHORDACTION_H
+#define LOGID_ACTION_CHORDACTION_H
+
+#include <actions/Action.h>
+#include <features/RemapButton.h>
+#include <mutex>
+
+namespace logid::actions {
+    /* Runs action if the listed buttons are held when this one is pressed,
+     * fallback otherwise. The one that was pressed gets the release. */
+    class ChordAction final : public Action {
+    public:
+        static const char* interface_name;
+
+        ChordAction(Device* device, config::ChordAction& config,
+                    const std::shared_ptr<ipcgull::node>& parent);
+
+        void press() final;
+
+        void release() final;
+
+        void move(int16_t x, int16_t y) final;
+
+        [[nodiscard]] uint8_t reprogFlags() const final;
+
+    protected:
+        config::ChordAction& _config;
+        std::shared_ptr<Action> _action;
+        std::shared_ptr<Action> _fallback;
+
+        std::mutex _chord_mutex;
+        std::shared_ptr<Action> _active;
+        // Resolved on the first press, RemapButton is still being built before
+        std::optional<features::RemapButton::button_mask> _mask;
+        std::weak_ptr<features::RemapButton> _buttons;
+    };
+}
+
+#endif //LOGID_ACTION_CHORDACTION_H
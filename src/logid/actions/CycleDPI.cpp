@@ -65,30 +65,47 @@ void CycleDPI::press() {
     _pressed = true;
     std::shared_lock lock(_config_mutex);
     std::lock_guard dpi_lock(_dpi_mutex);
-    if (_dpi && _config.dpis.has_value() && _config.dpis.value().empty()) {
+    if (_dpi && _config.dpis.has_value() && !_config.dpis.value().empty()) {
         ++_current_dpi;
         if (_current_dpi == _config.dpis.value().end())
             _current_dpi = _config.dpis.value().begin();
 
-        run_task([self_weak = self<CycleDPI>(), dpi = *_current_dpi] {
-            if (auto self = self_weak.lock()) {
-                try {
-                    self->_dpi->setDPI(dpi, self->_config.sensor.value_or(0));
-                } catch (backend::hidpp20::Error& e) {
-                    if (e.code() == backend::hidpp20::Error::InvalidArgument)
-                        logPrintf(WARN, "%s:%d: Could not set DPI to %d for "
-                                        "sensor %d",
-                                        self->_device->hidpp20().devicePath().c_str(),
-                                        self->_device->hidpp20().deviceIndex(), dpi,
-                                        self->_config.sensor.value_or(0));
-                    else
-                        throw e;
+        auto dpi = *_current_dpi;
+        auto sensor = _config.sensor.value_or(0);
+        // Only waits on a worker if the DPI list still has to be read
+        if (!_dpi->setDPI(dpi, sensor, _dpiError(dpi, sensor))) {
+            run_task([self_weak = self<CycleDPI>(), dpi, sensor] {
+                if (auto self = self_weak.lock()) {
+                    try {
+                        self->_dpi->setDPI(dpi, sensor);
+                    } catch (...) {
+                        self->_dpiError(dpi, sensor)(std::current_exception());
+                    }
                 }
-            }
-        });
+            }, task_priority::interactive);
+        }
     }
 }
 
+std::function<void(std::exception_ptr)> CycleDPI::_dpiError(int dpi, int sensor) const {
+    return [self_weak = self<CycleDPI>(), dpi, sensor](std::exception_ptr error) {
+        auto self = self_weak.lock();
+        if (!self)
+            return;
+        try {
+            std::rethrow_exception(error);
+        } catch (backend::hidpp20::Error& e) {
+            if (e.code() == backend::hidpp20::Error::InvalidArgument)
+                logPrintf(WARN, "%s:%d: Could not set DPI to %d for "
+                                "sensor %d",
+                          self->_device->hidpp20().devicePath().c_str(),
+                          self->_device->hidpp20().deviceIndex(), dpi, sensor);
+            else
+                throw;
+        }
+    };
+}
+
 void CycleDPI::release() {
     _pressed = false;
 }
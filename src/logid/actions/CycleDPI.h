@@ -22,7 +22,7 @@
 #include <features/DPI.h>
 
 namespace logid::actions {
-    class CycleDPI : public Action {
+    class CycleDPI final : public Action {
     public:
         static const char* interface_name;
 
@@ -40,6 +40,9 @@ namespace logid::actions {
         [[nodiscard]] uint8_t reprogFlags() const final;
 
     protected:
+        // Logs a rejected DPI, any other error is rethrown
+        [[nodiscard]] std::function<void(std::exception_ptr)> _dpiError(int dpi, int sensor) const;
+
         std::mutex _dpi_mutex;
         config::CycleDPI& _config;
         std::shared_ptr<features::DPI> _dpi;
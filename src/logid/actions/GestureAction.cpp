@@ -17,8 +17,10 @@
  */
 #include <actions/GestureAction.h>
 #include <backend/hidpp20/features/ReprogControls.h>
+#include <Configuration.h>
 #include <util/log.h>
 #include <algorithm>
+#include <strings.h>
 
 using namespace logid::actions;
 using namespace logid;
@@ -26,21 +28,43 @@ using namespace logid::backend;
 
 const char* GestureAction::interface_name = "Gesture";
 
-GestureAction::Direction GestureAction::toDirection(std::string direction) {
-    std::transform(direction.begin(), direction.end(), direction.begin(),
-                   ::tolower);
-    if (direction == "up")
-        return Up;
-    else if (direction == "down")
-        return Down;
-    else if (direction == "left")
-        return Left;
-    else if (direction == "right")
-        return Right;
-    else if (direction == "none")
-        return None;
-    else
-        throw std::invalid_argument("direction");
+namespace {
+    /* Each direction as the axis it lies on and its sign there, a gesture
+     * only sees the part of a position on its side of the origin */
+    struct direction_axis {
+        bool vertical;
+        int32_t sign;
+    };
+
+    constexpr std::array<direction_axis, GestureAction::direction_count> direction_axes = {{
+            {false, 0},  // None
+            {true, -1},  // Up
+            {true, 1},   // Down
+            {false, -1}, // Left
+            {false, 1}   // Right
+    }};
+
+    // How far a position has gone in a direction
+    constexpr int32_t extent(GestureAction::Direction d, int32_t x, int32_t y) {
+        auto& axis = direction_axes[d];
+        return (axis.vertical ? y : x) * axis.sign;
+    }
+}
+
+GestureAction::Direction GestureAction::toDirection(const std::string& direction) {
+    static constexpr std::pair<const char*, Direction> names[] = {
+            {"up",    Up},
+            {"down",  Down},
+            {"left",  Left},
+            {"right", Right},
+            {"none",  None}
+    };
+
+    for (auto& name: names) {
+        if (strcasecmp(direction.c_str(), name.first) == 0)
+            return name.second;
+    }
+    throw std::invalid_argument("direction");
 }
 
 std::string GestureAction::fromDirection(Direction direction) {
@@ -82,139 +106,164 @@ GestureAction::GestureAction(Device* dev, config::GestureAction& config,
                        {},
                        {}
                }),
-        _node(parent->make_child("gestures")), _config(config) {
+        _node(std::make_shared<lazy_node>(parent, "gestures")),
+        _commit_distance(std::max(config.commit.value_or(0), 0)),
+        _deadzone(std::max(config.deadzone.value_or(0), 0)),
+        _hysteresis(std::max(config.hysteresis.value_or(0), 0)), _config(config) {
     if (_config.gestures.has_value()) {
         auto& gestures = _config.gestures.value();
         for (auto&& x: gestures) {
             try {
                 auto direction = toDirection(x.first);
-                _gestures.emplace(
-                        direction,Gesture::makeGesture(
-                                dev, x.second,
-                                _node->make_child(fromDirection(direction))));
+                // Gestures read their threshold when created
                 if (direction == None) {
                     auto& gesture = x.second;
                     std::visit([](auto&& x) {
                         x.threshold.emplace(0);
                     }, gesture);
                 }
+                _gestures[direction] = Gesture::makeGesture(
+                        dev, x.second, _node->get()->make_child(fromDirection(direction)));
             } catch (std::invalid_argument& e) {
-                logPrintf(WARN, "%s is not a direction", x.first.c_str());
+                // Reported when the config is loaded
+                logPrintf(DEBUG, "%s is not a direction", x.first.c_str());
             }
         }
     }
+
+    _publish();
+}
+
+void GestureAction::_publish() {
+    auto table = std::make_shared<gesture_table>();
+    table->owned = _gestures;
+    for (std::size_t i = 0; i < direction_count; ++i)
+        table->gestures[i] = table->owned[i].get();
+    _published.store(std::move(table), std::memory_order_release);
 }
 
 void GestureAction::press() {
-    std::shared_lock lock(_config_mutex);
+    auto snapshot = _published.load(std::memory_order_acquire);
+    auto& gestures = snapshot->gestures;
 
     _pressed = true;
     _x = 0, _y = 0;
-    for (auto& gesture: _gestures)
-        gesture.second->press(false);
+    _committed = None;
+    _direction = None;
+    for (auto gesture: gestures)
+        if (gesture)
+            gesture->press(false);
 }
 
 void GestureAction::release() {
-    std::shared_lock lock(_config_mutex);
+    auto snapshot = _published.load(std::memory_order_acquire);
+    auto& gestures = snapshot->gestures;
 
     _pressed = false;
     bool threshold_met = false;
 
-    auto d = toDirection(_x, _y);
-    auto primary_gesture = _gestures.find(d);
-    if (primary_gesture != _gestures.end()) {
-        threshold_met = primary_gesture->second->metThreshold();
-        primary_gesture->second->release(true);
+    auto d = _committed != None ? _committed :
+             (_hysteresis ? _direction : toDirection(_x, _y));
+    if (auto primary_gesture = gestures[d]) {
+        threshold_met = primary_gesture->metThreshold();
+        primary_gesture->release(true);
     }
 
-    for (auto& gesture: _gestures) {
-        if (gesture.first == d || gesture.first == None)
+    for (std::size_t i = 0; i < gestures.size(); ++i) {
+        auto gesture = gestures[i];
+        if (!gesture || i == d || i == None)
             continue;
-        if (!threshold_met) {
-            if (gesture.second->metThreshold()) {
+        if (!threshold_met && _committed == None) {
+            if (gesture->metThreshold()) {
                 // If the primary gesture did not meet its threshold, use the
                 // secondary one.
                 threshold_met = true;
-                gesture.second->release(true);
+                gesture->release(true);
             }
         } else {
-            gesture.second->release(false);
+            gesture->release(false);
         }
     }
 
-    auto none_gesture = _gestures.find(None);
-    if (none_gesture != _gestures.end()) {
-        none_gesture->second->release(!threshold_met);
-    }
+    if (auto none_gesture = gestures[None])
+        none_gesture->release(!threshold_met);
 }
 
 void GestureAction::move(int16_t x, int16_t y) {
-    std::shared_lock lock(_config_mutex);
-
-    int32_t new_x = _x + x, new_y = _y + y;
-
-    if (abs(x) > 0) {
-        if (_x < 0 && new_x >= 0) { // Left -> Origin/Right
-            auto left = _gestures.find(Left);
-            if (left != _gestures.end() && left->second)
-                left->second->move((int16_t) _x);
-            if (new_x) { // Ignore to origin
-                auto right = _gestures.find(Right);
-                if (right != _gestures.end() && right->second)
-                    right->second->move((int16_t) new_x);
-            }
-        } else if (_x > 0 && new_x <= 0) { // Right -> Origin/Left
-            auto right = _gestures.find(Right);
-            if (right != _gestures.end() && right->second)
-                right->second->move((int16_t) -_x);
-            if (new_x) { // Ignore to origin
-                auto left = _gestures.find(Left);
-                if (left != _gestures.end() && left->second)
-                    left->second->move((int16_t) -new_x);
-            }
-        } else if (new_x < 0) { // Origin/Left to Left
-            auto left = _gestures.find(Left);
-            if (left != _gestures.end() && left->second)
-                left->second->move((int16_t) -x);
-        } else if (new_x > 0) { // Origin/Right to Right
-            auto right = _gestures.find(Right);
-            if (right != _gestures.end() && right->second)
-                right->second->move(x);
-        }
+    auto snapshot = _published.load(std::memory_order_acquire);
+    auto& gestures = snapshot->gestures;
+
+    if (_committed != None) {
+        _moveCommitted(gestures, x, y);
+        return;
     }
 
-    if (abs(y) > 0) {
-        if (_y > 0 && new_y <= 0) { // Up -> Origin/Down
-            auto up = _gestures.find(Up);
-            if (up != _gestures.end() && up->second)
-                up->second->move((int16_t) _y);
-            if (new_y) { // Ignore to origin
-                auto down = _gestures.find(Down);
-                if (down != _gestures.end() && down->second)
-                    down->second->move((int16_t) new_y);
-            }
-        } else if (_y < 0 && new_y >= 0) { // Down -> Origin/Up
-            auto down = _gestures.find(Down);
-            if (down != _gestures.end() && down->second)
-                down->second->move((int16_t) -_y);
-            if (new_y) { // Ignore to origin
-                auto up = _gestures.find(Up);
-                if (up != _gestures.end() && up->second)
-                    up->second->move((int16_t) -new_y);
-            }
-        } else if (new_y < 0) { // Origin/Up to Up
-            auto up = _gestures.find(Up);
-            if (up != _gestures.end() && up->second)
-                up->second->move((int16_t) -y);
-        } else if (new_y > 0) {// Origin/Down to Down
-            auto down = _gestures.find(Down);
-            if (down != _gestures.end() && down->second)
-                down->second->move(y);
-        }
+    /* The split below runs on positions with the deadzone taken out, so
+     * jitter around the origin does not reach the gestures */
+    const int32_t raw_x = _x + x, raw_y = _y + y;
+    const int32_t old_x = _outsideDeadzone(_x), old_y = _outsideDeadzone(_y);
+    const int32_t new_x = _outsideDeadzone(raw_x), new_y = _outsideDeadzone(raw_y);
+
+    // What each direction gained, crossing the origin takes from one side
+    std::array<int32_t, direction_count> deltas{};
+    for (std::size_t d = Up; d < direction_count; ++d) {
+        auto direction = static_cast<Direction>(d);
+        deltas[d] = std::max(extent(direction, new_x, new_y), 0) -
+                    std::max(extent(direction, old_x, old_y), 0);
+    }
+
+    // The side left behind is unwound before the one entered moves
+    for (std::size_t d = Up; d < direction_count; ++d)
+        if (deltas[d] < 0 && gestures[d])
+            gestures[d]->move((int16_t) deltas[d]);
+    for (std::size_t d = Up; d < direction_count; ++d)
+        if (deltas[d] > 0 && gestures[d])
+            gestures[d]->move((int16_t) deltas[d]);
+
+    _x = raw_x;
+    _y = raw_y;
+
+    if (_hysteresis)
+        _trackDirection();
+
+    if (_commit_distance) {
+        auto major = std::max(abs(_x), abs(_y)), minor = std::min(abs(_x), abs(_y));
+        if (major >= _commit_distance &&
+            major >= minor * defaults::gesture_commit_ratio)
+            _committed = toDirection(_x, _y);
     }
+}
+
+void GestureAction::_moveCommitted(const std::array<Gesture*, direction_count>& gestures,
+                                   int16_t x, int16_t y) {
+    _x += x;
+    _y += y;
 
-    _x = new_x;
-    _y = new_y;
+    auto gesture = gestures[_committed];
+    if (!gesture)
+        return;
+
+    // Movement against the direction runs the gesture backwards
+    if (auto delta = extent(_committed, x, y))
+        gesture->move((int16_t) delta);
+}
+
+int32_t GestureAction::_outsideDeadzone(int32_t position) const {
+    if (position > _deadzone)
+        return position - _deadzone;
+    if (position < -_deadzone)
+        return position + _deadzone;
+    return 0;
+}
+
+void GestureAction::_trackDirection() {
+    auto candidate = toDirection(_x, _y);
+    if (candidate == _direction)
+        return;
+
+    if (_direction == None ||
+        extent(candidate, _x, _y) >= extent(_direction, _x, _y) + _hysteresis)
+        _direction = candidate;
 }
 
 uint8_t GestureAction::reprogFlags() const {
@@ -227,14 +276,9 @@ void GestureAction::setGesture(const std::string& direction, const std::string&
 
     Direction d = toDirection(direction);
 
-    auto it = _gestures.find(d);
-
-    if (it != _gestures.end()) {
-        if (pressed()) {
-            auto current = toDirection(_x, _y);
-            if (it->second)
-                it->second->release(current == d);
-        }
+    if (_gestures[d] && pressed()) {
+        auto current = toDirection(_x, _y);
+        _gestures[d]->release(current == d);
     }
 
     auto dir_name = fromDirection(d);
@@ -242,20 +286,26 @@ void GestureAction::setGesture(const std::string& direction, const std::string&
     auto& gesture = _config.gestures.value()[dir_name];
 
     _gestures[d].reset();
+    _publish();
+
     try {
-        _gestures[d] = Gesture::makeGesture(
-                _device, type, gesture,
-                _node->make_child(dir_name));
+        Gesture::resetConfig(type, gesture);
     } catch (InvalidGesture& e) {
         _gestures[d] = Gesture::makeGesture(
                 _device, gesture,
-                _node->make_child(dir_name));
+                _node->get()->make_child(dir_name));
+        _publish();
         throw std::invalid_argument("Invalid gesture type");
     }
 
+    // Gestures read their threshold when created
     if (d == None) {
         std::visit([](auto&& x) {
             x.threshold = 0;
         }, gesture);
     }
+
+    _gestures[d] = Gesture::makeGesture(
+            _device, gesture, _node->get()->make_child(dir_name));
+    _publish();
 }
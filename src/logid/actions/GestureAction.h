@@ -18,12 +18,14 @@
 #ifndef LOGID_ACTION_GESTUREACTION_H
 #define LOGID_ACTION_GESTUREACTION_H
 
-#include <map>
+#include <array>
+#include <atomic>
 #include <actions/Action.h>
 #include <actions/gesture/Gesture.h>
+#include <util/lazy_node.h>
 
 namespace logid::actions {
-    class GestureAction : public Action {
+    class GestureAction final : public Action {
     public:
         static const char* interface_name;
 
@@ -35,7 +37,10 @@ namespace logid::actions {
             Right
         };
 
-        static Direction toDirection(std::string direction);
+        static constexpr std::size_t direction_count = Right + 1;
+
+        // Ignores case, throws std::invalid_argument for anything else
+        static Direction toDirection(const std::string& direction);
 
         static std::string fromDirection(Direction direction);
 
@@ -56,9 +61,42 @@ namespace logid::actions {
                         const std::string& type);
 
     protected:
+        // Indexed by Direction, null where no gesture is configured
+        typedef std::array<std::shared_ptr<Gesture>, direction_count> gesture_list;
+
+        /* What press, move and release run on, rebuilt whenever a gesture
+         * changes. The event path walks the raw pointers in order, owned
+         * holds them for as long as a snapshot is in use. */
+        struct gesture_table {
+            gesture_list owned;
+            std::array<Gesture*, direction_count> gestures{};
+        };
+
+        // Requires unique lock on _config_mutex or construction
+        void _publish();
+
+        // Sends a move to the committed gesture only
+        void _moveCommitted(const std::array<Gesture*, direction_count>& gestures,
+                            int16_t x, int16_t y);
+
+        // Position on an axis with the deadzone taken out
+        [[nodiscard]] int32_t _outsideDeadzone(int32_t position) const;
+
+        // Requires _hysteresis
+        void _trackDirection();
+
         int32_t _x{}, _y{};
-        std::shared_ptr<ipcgull::node> _node;
-        std::map<Direction, std::shared_ptr<Gesture>> _gestures;
+        std::shared_ptr<lazy_node> _node;
+        gesture_list _gestures;
+        // Read by press/move/release, replaced under _config_mutex
+        std::atomic<std::shared_ptr<const gesture_table>> _published;
+        int _commit_distance = 0;
+        // None until a direction has been committed to
+        Direction _committed = None;
+        const int32_t _deadzone;
+        const int32_t _hysteresis;
+        // Direction release picks when _hysteresis is set
+        Direction _direction = None;
         config::GestureAction& _config;
     };
 }
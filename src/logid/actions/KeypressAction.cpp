@@ -42,16 +42,21 @@ KeypressAction::KeypressAction(
 
 void KeypressAction::press() {
     std::shared_lock lock(_config_mutex);
-    _pressed = true;
+    // Keys are counted per press, a repeated press would leave them held
+    if (_pressed.exchange(true))
+        return;
+    InputDevice::Frame frame(_device->virtualInput());
     for (auto& key: _keys)
-        _device->virtualInput()->pressKey(key);
+        frame.pressKey(key);
 }
 
 void KeypressAction::release() {
     std::shared_lock lock(_config_mutex);
-    _pressed = false;
+    if (!_pressed.exchange(false))
+        return;
+    InputDevice::Frame frame(_device->virtualInput());
     for (auto& key: _keys)
-        _device->virtualInput()->releaseKey(key);
+        frame.releaseKey(key);
 }
 
 void KeypressAction::_setConfig() {
@@ -69,7 +74,7 @@ void KeypressAction::_setConfig() {
             _device->virtualInput()->registerKey(code);
             _keys.emplace_back(code);
         } catch (InputDevice::InvalidEventCode& e) {
-            logPrintf(WARN, "Invalid keycode %s, skipping.", key.c_str());
+            logPrintf(DEBUG, "Invalid keycode %s, skipping.", key.c_str());
         }
     } else if (std::holds_alternative<uint>(_config.keys.value())) {
         const auto& key = std::get<uint>(config);
@@ -87,7 +92,7 @@ void KeypressAction::_setConfig() {
                     _device->virtualInput()->registerKey(code);
                     _keys.emplace_back(code);
                 } catch (InputDevice::InvalidEventCode& e) {
-                    logPrintf(WARN, "Invalid keycode %s, skipping.",
+                    logPrintf(DEBUG, "Invalid keycode %s, skipping.",
                               key_str.c_str());
                 }
             } else if (std::holds_alternative<uint>(key)) {
@@ -113,10 +118,16 @@ std::vector<std::string> KeypressAction::getKeys() const {
 }
 
 void KeypressAction::setKeys(const std::vector<std::string>& keys) {
+    // An unknown name fails the call, nothing is changed
+    for (auto& key: keys)
+        InputDevice::toKeyCode(key);
+
     std::unique_lock lock(_config_mutex);
-    if (_pressed)
+    if (_pressed.exchange(false)) {
+        InputDevice::Frame frame(_device->virtualInput());
         for (auto& key: _keys)
-            _device->virtualInput()->releaseKey(key);
+            frame.releaseKey(key);
+    }
     _config.keys = std::list<std::variant<uint, std::string>>();
     auto& config = std::get<std::list<std::variant<uint, std::string>>>(
             _config.keys.value());
@@ -22,7 +22,7 @@
 #include <actions/Action.h>
 
 namespace logid::actions {
-    class KeypressAction : public Action {
+    class KeypressAction final : public Action {
     public:
         static const char* interface_name;
 
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <actions/MacroAction.h>
+#include <Device.h>
+#include <InputDevice.h>
+#include <backend/hidpp20/features/ReprogControls.h>
+#include <util/log.h>
+#include <map>
+
+using namespace logid::actions;
+using namespace logid::backend;
+using namespace std::chrono;
+
+const char* MacroAction::interface_name = "Macro";
+
+MacroAction::MacroAction(Device* device, config::MacroAction& config,
+                         [[maybe_unused]] const std::shared_ptr<ipcgull::node>& parent) :
+        Action(device, interface_name), _config(config) {
+    _compile();
+}
+
+MacroAction::~MacroAction() {
+    std::lock_guard lock(_playback->mutex);
+    _playback->stop();
+}
+
+void MacroAction::_compile() {
+    auto timeline = std::make_shared<Timeline>();
+    auto& events = timeline->events;
+    auto& frames = timeline->frames;
+    auto input = _device->virtualInput();
+
+    milliseconds at{};
+    std::size_t begin = 0;
+    // Presses minus releases, whatever is left is released at the end
+    std::map<uint, int> held;
+
+    auto close = [&]() {
+        if (events.size() != begin)
+            frames.push_back({at, begin, events.size()});
+        begin = events.size();
+    };
+
+    for (auto& step: _config.steps.value_or(std::list<config::MacroStep>())) {
+        if (step.key.has_value()) {
+            uint code;
+            auto& key = step.key.value();
+            try {
+                code = std::holds_alternative<uint>(key) ? std::get<uint>(key) :
+                       InputDevice::toKeyCode(std::get<std::string>(key));
+            } catch (InputDevice::InvalidEventCode& e) {
+                logPrintf(DEBUG, "Invalid keycode %s in macro, skipping.", e.what());
+                continue;
+            }
+            input->registerKey(code);
+
+            if (!step.value.has_value() || step.value.value()) {
+                events.push_back({EV_KEY, (uint16_t) code, 1});
+                ++held[code];
+            }
+            // A tap's release goes out in a frame of its own
+            if (!step.value.has_value())
+                close();
+            if (!step.value.value_or(0) && held[code] > 0) {
+                events.push_back({EV_KEY, (uint16_t) code, 0});
+                --held[code];
+            }
+        } else if (step.axis.has_value()) {
+            uint code;
+            auto& axis = step.axis.value();
+            try {
+                code = std::holds_alternative<uint>(axis) ? std::get<uint>(axis) :
+                       InputDevice::toAxisCode(std::get<std::string>(axis));
+            } catch (InputDevice::InvalidEventCode& e) {
+                logPrintf(DEBUG, "Invalid axis %s in macro, skipping.", e.what());
+                continue;
+            }
+            input->registerAxis(code);
+            if (step.value.value_or(0))
+                events.push_back({EV_REL, (uint16_t) code, step.value.value()});
+        }
+
+        if (step.delay.value_or(0) > 0) {
+            close();
+            at += milliseconds(step.delay.value());
+        }
+    }
+
+    for (auto& [code, count]: held)
+        for (; count > 0; --count)
+            events.push_back({EV_KEY, (uint16_t) code, 0});
+    close();
+
+    _timeline = std::move(timeline);
+}
+
+void MacroAction::press() {
+    _pressed = true;
+    if (_timeline->frames.empty())
+        return;
+
+    {
+        std::lock_guard lock(_playback->mutex);
+        // A press while playing does not restart the macro
+        if (_playback->playing)
+            return;
+        _playback->input = _device->virtualInput();
+        _playback->timeline = _timeline;
+        _playback->next = 0;
+        _playback->start = steady_clock::now();
+        _playback->playing = true;
+    }
+
+    // Frames due now are written here, without a worker hop
+    Playback::run(_playback);
+}
+
+void MacroAction::release() {
+    _pressed = false;
+}
+
+void MacroAction::Playback::run(const std::shared_ptr<Playback>& self) {
+    std::lock_guard lock(self->mutex);
+    auto& playback = *self;
+    // This task counts as pending until it returns
+    playback.tick = {};
+    if (!playback.playing)
+        return;
+
+    auto& frames = playback.timeline->frames;
+    auto& events = playback.timeline->events;
+    auto elapsed = duration_cast<milliseconds>(steady_clock::now() - playback.start);
+
+    for (; playback.next < frames.size() && frames[playback.next].at <= elapsed;
+           ++playback.next) {
+        auto& frame = frames[playback.next];
+        InputDevice::Frame output(playback.input);
+        for (auto i = frame.begin; i < frame.end; ++i) {
+            auto& event = events[i];
+            if (event.type == EV_REL)
+                output.moveAxis(event.code, event.value);
+            else if (event.value)
+                output.pressKey(event.code);
+            else
+                output.releaseKey(event.code);
+        }
+    }
+
+    if (playback.next == frames.size()) {
+        playback.playing = false;
+        playback.input.reset();
+        return;
+    }
+
+    playback.tick = run_task_after([weak = std::weak_ptr<Playback>(self)]() {
+        if (auto playback = weak.lock())
+            run(playback);
+    }, frames[playback.next].at - elapsed, task_priority::interactive);
+}
+
+void MacroAction::Playback::stop() {
+    tick.cancel();
+    if (!playing)
+        return;
+    playing = false;
+
+    // Frames from next on were never written
+    auto& frames = timeline->frames;
+    auto& events = timeline->events;
+    auto written = next < frames.size() ? frames[next].begin : events.size();
+    std::map<uint, int> held;
+    for (std::size_t i = 0; i < written; ++i) {
+        if (events[i].type == EV_KEY)
+            held[events[i].code] += events[i].value ? 1 : -1;
+    }
+
+    InputDevice::Frame output(input);
+    for (auto& [code, count]: held)
+        for (; count > 0; --count)
+            output.releaseKey(code);
+    input.reset();
+}
+
+uint8_t MacroAction::reprogFlags() const {
+    return hidpp20::ReprogControls::TemporaryDiverted;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_ACTION_MACROACTION_H
+#define LOGID_ACTION_MACROACTION_H
+
+#include <actions/Action.h>
+#include <util/task.h>
+#include <chrono>
+#include <vector>
+
+namespace logid {
+    class InputDevice;
+}
+
+namespace logid::actions {
+    /* Plays a sequence of key and axis events on press. The steps are
+     * compiled into a timeline once, and playback waits on the timer
+     * rather than on a worker. */
+    class MacroAction final : public Action {
+    public:
+        static const char* interface_name;
+
+        MacroAction(Device* device, config::MacroAction& config,
+                    const std::shared_ptr<ipcgull::node>& parent);
+
+        ~MacroAction() override;
+
+        void press() final;
+
+        void release() final;
+
+        [[nodiscard]] uint8_t reprogFlags() const final;
+
+    protected:
+        struct Event {
+            uint16_t type;
+            uint16_t code;
+            int32_t value;
+        };
+
+        // Events written as one frame, at an offset from the press
+        struct Frame {
+            std::chrono::milliseconds at;
+            std::size_t begin, end;
+        };
+
+        struct Timeline {
+            std::vector<Event> events;
+            std::vector<Frame> frames;
+        };
+
+        // Shared with the playback task, which may outlive the action
+        struct Playback {
+            std::mutex mutex;
+            std::shared_ptr<InputDevice> input;
+            std::shared_ptr<const Timeline> timeline;
+            std::size_t next = 0;
+            std::chrono::steady_clock::time_point start;
+            bool playing = false;
+            task_handle tick;
+
+            // Requires mutex, releases the keys pressed so far
+            void stop();
+
+            static void run(const std::shared_ptr<Playback>& self);
+        };
+
+        void _compile();
+
+        config::MacroAction& _config;
+        std::shared_ptr<const Timeline> _timeline;
+        std::shared_ptr<Playback> _playback = std::make_shared<Playback>();
+    };
+}
+
+#endif //LOGID_ACTION_MACROACTION_H
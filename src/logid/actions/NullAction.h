@@ -21,7 +21,7 @@
 #include <actions/Action.h>
 
 namespace logid::actions {
-    class NullAction : public Action {
+    class NullAction final : public Action {
     public:
         static const char* interface_name;
 
@@ -47,7 +47,7 @@ void ToggleHiresScroll::press() {
                 mode ^= backend::hidpp20::HiresScroll::HiRes;
                 self->_hires_scroll->setMode(mode);
             }
-        });
+        }, task_priority::interactive);
     }
 }
 
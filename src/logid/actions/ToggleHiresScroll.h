@@ -22,7 +22,7 @@
 #include <features/HiresScroll.h>
 
 namespace logid::actions {
-    class ToggleHiresScroll : public Action {
+    class ToggleHiresScroll final : public Action {
     public:
         static const char* interface_name;
 
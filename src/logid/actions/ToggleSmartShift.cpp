@@ -49,7 +49,7 @@ void ToggleSmartShift::press() {
                 status.active = !status.active;
                 self->_smartshift->setStatus(status);
             }
-        });
+        }, task_priority::interactive);
     }
 }
 
@@ -22,7 +22,7 @@
 #include <features/SmartShift.h>
 
 namespace logid::actions {
-    class ToggleSmartShift : public Action {
+    class ToggleSmartShift final : public Action {
     public:
         static const char* interface_name;
 
@@ -15,10 +15,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#include <algorithm>
 #include <cmath>
 #include <actions/gesture/AxisGesture.h>
 #include <Device.h>
 #include <InputDevice.h>
+#include <backend/raw/RawDevice.h>
 #include <util/log.h>
 
 using namespace logid::actions;
@@ -27,7 +29,13 @@ const char* AxisGesture::interface_name = "Axis";
 
 AxisGesture::AxisGesture(Device* device, config::AxisGesture& config,
                          const std::shared_ptr<ipcgull::node>& parent) :
-        Gesture(device, parent, interface_name, {
+        AxisGesture(device, config, parent, interface_name) {
+}
+
+AxisGesture::AxisGesture(Device* device, config::AxisGesture& config,
+                         const std::shared_ptr<ipcgull::node>& parent,
+                         const char* name) :
+        Gesture(device, parent, name, {
             {
                     {"GetConfig", {this, &AxisGesture::getConfig, {"axis", "multiplier", "threshold"}}},
                     {"SetThreshold", {this, &AxisGesture::setThreshold, {"threshold"}}},
@@ -44,9 +52,9 @@ AxisGesture::AxisGesture(Device* device, config::AxisGesture& config,
             const auto& axis = std::get<std::string>(_config.axis.value());
             try {
                 _input_axis = _device->virtualInput()->toAxisCode(axis);
-                logPrintf(INFO, "axis %d %s", _input_axis, axis.c_str());
             } catch (InputDevice::InvalidEventCode& e) {
-                logPrintf(WARN, "Invalid axis %s.", axis.c_str());
+                // Reported when the config is loaded
+                logPrintf(DEBUG, "Invalid axis %s.", axis.c_str());
             }
         }
 
@@ -54,6 +62,24 @@ AxisGesture::AxisGesture(Device* device, config::AxisGesture& config,
 
     if (_input_axis.has_value())
         registerAxis(_input_axis.value());
+
+    _publish();
+}
+
+void AxisGesture::_publish() {
+    Settings settings;
+    settings.input_axis = _input_axis;
+    settings.low_res_axis = _input_axis ? InputDevice::getLowResAxis(*_input_axis) : -1;
+    settings.threshold = _config.threshold.value_or(defaults::gesture_threshold);
+    settings.axis_multiplier = _config.axis_multiplier.value_or(1);
+    settings.negative_multiplier = settings.axis_multiplier < 0;
+    settings.scale = std::llround(std::abs(settings.axis_multiplier) * _multiplier *
+                                  (int64_t(1) << scale_shift));
+    settings.coalesce = _config.coalesce.value_or(0);
+    settings.smoothing = (float) std::clamp(_config.smoothing.value_or(0), 0.0, 0.99);
+    settings.acceleration = (float) std::max(_config.acceleration.value_or(0), 0.0);
+    settings.max_gain = (float) defaults::gesture_max_gain;
+    _settings.store(std::move(settings));
 }
 
 void AxisGesture::registerAxis(uint axis) {
@@ -65,15 +91,17 @@ void AxisGesture::registerAxis(uint axis) {
 }
 
 void AxisGesture::press(bool init_threshold) {
-    std::shared_lock lock(_config_mutex);
+    auto settings = _settings.load();
     logPrintf(RAWREPORT, "press %d %d\n", _axis, init_threshold);
     if (init_threshold) {
-        _axis = (int32_t) (_config.threshold.value_or(defaults::gesture_threshold));
+        _axis = settings->threshold;
     } else {
         _axis = 0;
     }
     _axis_remainder = 0;
     _hires_remainder = 0;
+    _velocity = 0;
+    _last_move.reset();
 }
 
 void AxisGesture::release(bool primary) {
@@ -82,42 +110,33 @@ void AxisGesture::release(bool primary) {
 }
 
 void AxisGesture::move(int16_t axis) {
-    std::shared_lock lock(_config_mutex);
-    if (!_input_axis.has_value())
+    auto settings = _settings.load();
+    if (!settings->input_axis.has_value())
         return;
 
-
-    const auto threshold = _config.threshold.value_or(
-            defaults::gesture_threshold);
+    const auto input_axis = settings->input_axis.value();
+    const auto threshold = settings->threshold;
+    const auto axis_multiplier = settings->axis_multiplier;
     int32_t new_axis = _axis + axis;
-    int low_res_axis = InputDevice::getLowResAxis(_input_axis.value());
+    int low_res_axis = settings->low_res_axis;
     int hires_remainder = _hires_remainder;
 
-
     if (new_axis > threshold) {
-        double move = axis;
+        int32_t move = axis;
         if (_axis < threshold)
             move = new_axis - threshold;
-        bool negative_multiplier = _config.axis_multiplier.value_or(1) < 0;
-        if (negative_multiplier)
-            move *= -_config.axis_multiplier.value_or(1);
-        else
-            move *= _config.axis_multiplier.value_or(1);
-        // Handle hi-res multiplier
-        move *= _multiplier;
-
-        double move_floor = floor(move);
-        _axis_remainder = move - move_floor;
-        if (_axis_remainder >= 1) {
-            double int_remainder = floor(_axis_remainder);
-            move_floor += int_remainder;
-            _axis_remainder -= int_remainder;
-        }
+        const bool negative_multiplier = settings->negative_multiplier;
+
+        // Right shift floors, the low bits carry over to the next move
+        int64_t scaled = ((move * settings->scale * _gain(*settings, axis)) >> scale_shift) +
+                _axis_remainder;
+        auto move_floor = (int) (scaled >> scale_shift);
+        _axis_remainder = scaled & ((int64_t(1) << scale_shift) - 1);
 
         if (low_res_axis != -1) {
             int lowres_movement = 0;
-            int hires_movement = (int) move_floor;
-            _device->virtualInput()->moveAxis(_input_axis.value(), hires_movement);
+            bool lowres_event = false;
+            int hires_movement = move_floor;
             hires_remainder += hires_movement;
             if (abs(hires_remainder) >= 1) {
                 lowres_movement = hires_remainder / 120;
@@ -132,27 +151,100 @@ void AxisGesture::move(int16_t axis) {
                 }
 
                 hires_remainder -= lowres_movement * 120;
-
-                _device->virtualInput()->moveAxis(low_res_axis, lowres_movement);
+                lowres_event = true;
             }
 
+            // Both axes go out in one frame
+            _emit(*settings, hires_movement, lowres_movement, lowres_event);
+
             logPrintf(RAWREPORT, "move %ld [%.2f], l_mv:%d h_mv:%d code:%d/%d;"
-                   " axis %d/%d; new_axis %d; hires_rem %d th %d neg %d mv %.1f\n", 
-                time(NULL), _config.axis_multiplier.value_or(1), lowres_movement, hires_movement,
-                 _input_axis.value(),  low_res_axis, axis, _axis, new_axis, hires_remainder, 
+                   " axis %d/%d; new_axis %d; hires_rem %d th %d neg %d mv %d\n", 
+                time(NULL), axis_multiplier, lowres_movement, hires_movement,
+                 input_axis,  low_res_axis, axis, _axis, new_axis, hires_remainder, 
                  threshold, negative_multiplier, move);
 
             _hires_remainder = hires_remainder;
         } else {
-            _device->virtualInput()->moveAxis(_input_axis.value(), (int) move_floor);
+            _emit(*settings, move_floor, 0, false);
         }
     }
     _axis = new_axis;
 }
 
+int64_t AxisGesture::_gain(const Settings& settings, int32_t delta) {
+    constexpr int64_t unity = int64_t(1) << scale_shift;
+    if (settings.acceleration <= 0)
+        return unity;
+
+    auto now = backend::raw::RawDevice::readTime().value_or(
+            std::chrono::steady_clock::now());
+    auto last = _last_move;
+    _last_move = now;
+    // The first report of a press has no interval to measure speed over
+    if (!last)
+        return unity;
+
+    // Reports batched into one read share a timestamp, assume 1ms apart
+    float interval = std::max(
+            std::chrono::duration<float, std::milli>(now - *last).count(), 1.0f);
+    float speed = (float) std::abs(delta) / interval;
+    _velocity = settings.smoothing * _velocity + (1 - settings.smoothing) * speed;
+
+    float gain = std::min(1 + settings.acceleration * _velocity, settings.max_gain);
+    return std::lround(gain * (float) unity);
+}
+
+void AxisGesture::_emit(const Settings& settings, int movement, int low_res_movement,
+                        bool low_res_event) {
+    auto axis = settings.input_axis.value();
+    auto low_res_axis = settings.low_res_axis;
+    auto window = settings.coalesce;
+    if (window <= 0) {
+        InputDevice::Frame frame(_device->virtualInput());
+        frame.moveAxis(axis, movement);
+        if (low_res_event)
+            frame.moveAxis(low_res_axis, low_res_movement);
+        return;
+    }
+
+    /* The flush task owns the pending state, it may outlive the gesture */
+    auto& pending = *_pending;
+    std::lock_guard lock(pending.mutex);
+    if (pending.axis && (*pending.axis != axis || pending.low_res_axis != low_res_axis))
+        pending.flush();
+
+    pending.input = _device->virtualInput();
+    pending.axis = axis;
+    pending.low_res_axis = low_res_axis;
+    pending.movement += movement;
+    pending.low_res_movement += low_res_movement;
+
+    if (!pending.scheduled) {
+        pending.scheduled = true;
+        run_task_after([pending = _pending]() {
+            std::lock_guard lock(pending->mutex);
+            pending->scheduled = false;
+            pending->flush();
+        }, std::chrono::milliseconds(window), task_priority::interactive);
+    }
+}
+
+void AxisGesture::PendingMovement::flush() {
+    if (axis && input) {
+        InputDevice::Frame frame(input);
+        if (movement)
+            frame.moveAxis(*axis, movement);
+        if (low_res_axis != -1 && low_res_movement)
+            frame.moveAxis(low_res_axis, low_res_movement);
+    }
+
+    axis.reset();
+    movement = 0;
+    low_res_movement = 0;
+}
+
 bool AxisGesture::metThreshold() const {
-    std::shared_lock lock(_config_mutex);
-    return _axis >= _config.threshold.value_or(defaults::gesture_threshold);
+    return _axis >= _settings.load()->threshold;
 }
 
 bool AxisGesture::wheelCompatibility() const {
@@ -165,6 +257,7 @@ void AxisGesture::setHiresMultiplier(double multiplier) {
         if (InputDevice::getLowResAxis(_input_axis.value()) != -1)
             _multiplier = _config.axis_multiplier.value_or(1) * multiplier;
     }
+    _publish();
 }
 
 std::tuple<std::string, double, int> AxisGesture::getConfig() const {
@@ -207,4 +300,5 @@ void AxisGesture::setThreshold(int threshold) {
         _config.threshold.reset();
     else
         _config.threshold = threshold;
+    _publish();
 }
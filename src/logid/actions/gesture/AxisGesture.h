@@ -19,6 +19,12 @@
 #define LOGID_ACTION_AXISGESTURE_H
 
 #include <actions/gesture/Gesture.h>
+#include <chrono>
+#include <mutex>
+
+namespace logid {
+    class InputDevice;
+}
 
 namespace logid::actions {
     class AxisGesture : public Gesture {
@@ -28,11 +34,11 @@ namespace logid::actions {
         AxisGesture(Device* device, config::AxisGesture& config,
                     const std::shared_ptr<ipcgull::node>& parent);
 
-        void press(bool init_threshold) final;
+        void press(bool init_threshold) override;
 
-        void release(bool primary) final;
+        void release(bool primary) override;
 
-        void move(int16_t axis) final;
+        void move(int16_t axis) override;
 
         [[nodiscard]] bool wheelCompatibility() const final;
 
@@ -49,12 +55,63 @@ namespace logid::actions {
         void setThreshold(int threshold);
 
     protected:
+        AxisGesture(Device* device, config::AxisGesture& config,
+                    const std::shared_ptr<ipcgull::node>& parent,
+                    const char* name);
+
         void registerAxis(uint axis);
 
+        /* Movement summed over the coalescing window, low_res_axis is -1
+         * if the axis has no low-res counterpart */
+        struct PendingMovement {
+            std::mutex mutex;
+            std::shared_ptr<InputDevice> input;
+            std::optional<uint> axis;
+            int low_res_axis = -1;
+            int movement = 0;
+            int low_res_movement = 0;
+            bool scheduled = false;
+
+            // Requires mutex
+            void flush();
+        };
+
+        struct Settings {
+            std::optional<uint> input_axis;
+            int low_res_axis = -1;
+            int32_t threshold = 0;
+            double axis_multiplier = 1;
+            bool negative_multiplier = false;
+            // Effective multiplier in Q16 fixed point, never negative
+            int64_t scale = int64_t(1) << scale_shift;
+            int coalesce = 0;
+            float smoothing = 0;
+            float acceleration = 0;
+            float max_gain = 1;
+        };
+
+        static constexpr int scale_shift = 16;
+
+        void _publish();
+
+        // Q16 gain for a move of delta at the current velocity
+        int64_t _gain(const Settings& settings, int32_t delta);
+
+        void _emit(const Settings& settings, int movement, int low_res_movement,
+                   bool low_res_event);
+
+        Published<Settings> _settings;
+
+        std::shared_ptr<PendingMovement> _pending = std::make_shared<PendingMovement>();
+
     protected:
         int32_t _axis{};
-        double _axis_remainder{};
+        // Fraction of a unit left over by the last move, in Q16
+        int64_t _axis_remainder{};
         int _hires_remainder{};
+        // Smoothed speed in units/ms, only tracked while accelerating
+        float _velocity{};
+        std::optional<std::chrono::steady_clock::time_point> _last_move;
         std::optional<uint> _input_axis;
         double _multiplier;
         double _hires_multiplier = 1.0;
@@ -22,7 +22,9 @@
 #include <actions/gesture/ThresholdGesture.h>
 #include <actions/gesture/IntervalGesture.h>
 #include <actions/gesture/AxisGesture.h>
+#include <actions/gesture/MomentumGesture.h>
 #include <actions/gesture/NullGesture.h>
+#include <Device.h>
 #include <ipc_defs.h>
 
 using namespace logid;
@@ -53,11 +55,17 @@ namespace {
     std::shared_ptr<Gesture> _makeGesture(
             Device* device, T& gesture,
             const std::shared_ptr<ipcgull::node>& parent) {
-        return parent->make_interface<typename gesture_type<T>::type>(
+        auto ret = parent->make_interface<typename gesture_type<T>::type>(
                 device, std::forward<T&>(gesture), parent);
+        ret->_account(sizeof(typename gesture_type<T>::type));
+        return ret;
     }
 }
 
+void Gesture::_account(std::size_t bytes) {
+    _charge.charge(_device->memoryAccount(), memory_account::actions, bytes);
+}
+
 std::shared_ptr<Gesture> Gesture::makeGesture(
         Device* device, config::Gesture& gesture,
         const std::shared_ptr<ipcgull::node>& parent) {
@@ -70,8 +78,15 @@ std::shared_ptr<Gesture> Gesture::makeGesture(
         Device* device, const std::string& type,
         config::Gesture& config,
         const std::shared_ptr<ipcgull::node>& parent) {
+    resetConfig(type, config);
+    return makeGesture(device, config, parent);
+}
+
+void Gesture::resetConfig(const std::string& type, config::Gesture& config) {
     if (type == AxisGesture::interface_name) {
         config = config::AxisGesture();
+    } else if (type == MomentumGesture::interface_name) {
+        config = config::MomentumGesture();
     } else if (type == IntervalGesture::interface_name) {
         config = config::IntervalGesture();
     } else if (type == ReleaseGesture::interface_name) {
@@ -83,6 +98,4 @@ std::shared_ptr<Gesture> Gesture::makeGesture(
     } else {
         throw InvalidGesture();
     }
-
-    return makeGesture(device, config, parent);
 }
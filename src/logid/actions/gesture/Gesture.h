@@ -20,6 +20,9 @@
 
 #include <utility>
 #include <actions/Action.h>
+#include <util/memory.h>
+#include <atomic>
+#include <memory>
 
 namespace logid::actions {
     class InvalidGesture : public std::exception {
@@ -58,15 +61,50 @@ namespace logid::actions {
                 config::Gesture& gesture,
                 const std::shared_ptr<ipcgull::node>& parent);
 
+        // Replaces gesture with a default config of the named type
+        static void resetConfig(const std::string& type,
+                                config::Gesture& gesture);
+
+        // Counts bytes, the gesture's own size, against its device
+        void _account(std::size_t bytes);
+
     protected:
         Gesture(Device* device,
                 std::shared_ptr<ipcgull::node> parent,
                 const std::string& name, tables t = {});
 
-        mutable std::shared_mutex _config_mutex;
+        /* Settings the event path reads without taking _config_mutex,
+         * setters publish a new snapshot while holding it */
+        template<typename T>
+        class Published {
+        public:
+            [[nodiscard]] std::shared_ptr<const T> load() const {
+                return _value.load(std::memory_order_acquire);
+            }
+
+            // Requires a unique lock on _config_mutex, or the constructor
+            void store(T value) {
+                _value.store(std::make_shared<const T>(std::move(value)),
+                             std::memory_order_release);
+            }
+
+        private:
+            std::atomic<std::shared_ptr<const T>> _value;
+        };
+
+        // Of the gestures that run an action once past a threshold
+        struct ActionSettings {
+            int32_t threshold;
+            std::shared_ptr<Action> action;
+        };
+
+        mutable config::edit_mutex _config_mutex;
 
         const std::shared_ptr<ipcgull::node> _node;
         Device* _device;
+
+    private:
+        memory_charge _charge;
     };
 }
 
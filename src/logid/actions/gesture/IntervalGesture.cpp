@@ -44,12 +44,18 @@ IntervalGesture::IntervalGesture(
             logPrintf(WARN, "Mapping gesture to invalid action");
         }
     }
+
+    _publish();
+}
+
+void IntervalGesture::_publish() {
+    _settings.store({{_config.threshold.value_or(defaults::gesture_threshold), _action},
+                     _config.interval});
 }
 
 void IntervalGesture::press(bool init_threshold) {
-    std::shared_lock lock(_config_mutex);
     if (init_threshold) {
-        _axis = (int32_t) _config.threshold.value_or(defaults::gesture_threshold);
+        _axis = _settings.load()->threshold;
     } else {
         _axis = 0;
     }
@@ -60,21 +66,20 @@ void IntervalGesture::release([[maybe_unused]] bool primary) {
 }
 
 void IntervalGesture::move(int16_t axis) {
-    std::shared_lock lock(_config_mutex);
-    if (!_config.interval.has_value())
+    auto settings = _settings.load();
+    if (!settings->interval.has_value())
         return;
 
-    const auto threshold =
-            _config.threshold.value_or(defaults::gesture_threshold);
+    const auto threshold = settings->threshold;
     _axis += axis;
     if (_axis < threshold)
         return;
 
-    int32_t new_interval_count = (_axis - threshold) / _config.interval.value();
+    int32_t new_interval_count = (_axis - threshold) / settings->interval.value();
     if (new_interval_count > _interval_pass_count) {
-        if (_action) {
-            _action->press();
-            _action->release();
+        if (settings->action) {
+            settings->action->press();
+            settings->action->release();
         }
     }
     _interval_pass_count = new_interval_count;
@@ -85,8 +90,7 @@ bool IntervalGesture::wheelCompatibility() const {
 }
 
 bool IntervalGesture::metThreshold() const {
-    std::shared_lock lock(_config_mutex);
-    return _axis >= _config.threshold.value_or(defaults::gesture_threshold);
+    return _axis >= _settings.load()->threshold;
 }
 
 std::tuple<int, int> IntervalGesture::getConfig() const {
@@ -100,6 +104,7 @@ void IntervalGesture::setInterval(int interval) {
         _config.interval.reset();
     else
         _config.interval = interval;
+    _publish();
 }
 
 void IntervalGesture::setThreshold(int threshold) {
@@ -108,10 +113,13 @@ void IntervalGesture::setThreshold(int threshold) {
         _config.threshold.reset();
     else
         _config.threshold = threshold;
+    _publish();
 }
 
 void IntervalGesture::setAction(const std::string& type) {
     std::unique_lock lock(_config_mutex);
     _action.reset();
+    _publish();
     _action = Action::makeAction(_device, type, _config.action, _node);
+    _publish();
 }
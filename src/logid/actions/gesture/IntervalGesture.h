@@ -47,10 +47,17 @@ namespace logid::actions {
         void setAction(const std::string& type);
 
     protected:
+        struct Settings : ActionSettings {
+            std::optional<int> interval;
+        };
+
+        void _publish();
+
         int32_t _axis;
         int32_t _interval_pass_count;
         std::shared_ptr<Action> _action;
         config::IntervalGesture& _config;
+        Published<Settings> _settings;
     private:
     };
 }
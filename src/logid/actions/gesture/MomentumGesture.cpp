@@ -0,0 +1,136 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <actions/gesture/MomentumGesture.h>
+#include <Configuration.h>
+#include <algorithm>
+#include <cmath>
+
+using namespace logid::actions;
+using namespace std::chrono;
+
+const char* MomentumGesture::interface_name = "Momentum";
+
+namespace {
+    // Weight of the previous estimate when a new move is measured
+    constexpr float velocity_weight = 0.5;
+    // A pause this long (ms) starts the estimate over
+    constexpr float velocity_reset = 100;
+    // Coasting under this many input units per frame stops
+    constexpr float min_step = 0.5;
+}
+
+MomentumGesture::MomentumGesture(Device* device, config::MomentumGesture& config,
+                                 const std::shared_ptr<ipcgull::node>& parent) :
+        AxisGesture(device, config, parent, interface_name) {
+    int rate = std::clamp(config.rate.value_or(defaults::momentum_rate), 1, 1000);
+    double friction = std::clamp(config.friction.value_or(defaults::momentum_friction),
+                                 0.001, 0.999);
+
+    _coast->gesture = this;
+    _coast->frame = milliseconds(std::max(1000 / rate, 1));
+    _coast->decay = (float) std::pow(friction, duration<double>(_coast->frame).count());
+}
+
+MomentumGesture::~MomentumGesture() {
+    std::lock_guard lock(_coast->mutex);
+    _coast->gesture = nullptr;
+    _coast->tick.cancel();
+}
+
+void MomentumGesture::press(bool init_threshold) {
+    std::lock_guard lock(_coast->mutex);
+    // Touching the input again stops a coast, a drive keeps its speed
+    if (_coast->coasting)
+        _coast->stop();
+    AxisGesture::press(init_threshold);
+}
+
+void MomentumGesture::release(bool primary) {
+    std::lock_guard lock(_coast->mutex);
+    if (!primary)
+        _coast->stop();
+    AxisGesture::release(primary);
+}
+
+void MomentumGesture::move(int16_t axis) {
+    std::lock_guard lock(_coast->mutex);
+    auto& coast = *_coast;
+
+    auto now = steady_clock::now();
+    float interval = velocity_reset;
+    if (coast.last_move)
+        interval = duration<float, std::milli>(now - *coast.last_move).count();
+    if (coast.coasting || interval >= velocity_reset)
+        coast.velocity = 0;
+    coast.coasting = false;
+    coast.remainder = 0;
+    coast.last_move = now;
+
+    float speed = (float) axis / std::max(interval, 1.0f);
+    coast.velocity = velocity_weight * coast.velocity + (1 - velocity_weight) * speed;
+
+    AxisGesture::move(axis);
+    coast.schedule(_coast);
+}
+
+void MomentumGesture::Coast::stop() {
+    coasting = false;
+    velocity = 0;
+    remainder = 0;
+}
+
+void MomentumGesture::Coast::schedule(const std::shared_ptr<Coast>& self) {
+    if (!tick.done())
+        return;
+    tick = run_task_after([weak = std::weak_ptr<Coast>(self)]() {
+        if (auto coast = weak.lock())
+            run(coast);
+    }, frame, task_priority::interactive);
+}
+
+void MomentumGesture::Coast::run(const std::shared_ptr<Coast>& self) {
+    std::lock_guard lock(self->mutex);
+    auto& coast = *self;
+    // This task counts as pending until it returns
+    coast.tick = {};
+    if (!coast.gesture)
+        return;
+
+    // Still being driven
+    if (!coast.coasting && coast.last_move &&
+        steady_clock::now() - *coast.last_move < coast.frame) {
+        coast.schedule(self);
+        return;
+    }
+
+    float step = coast.velocity * (float) coast.frame.count();
+    if (std::abs(step) < min_step) {
+        coast.stop();
+        return;
+    }
+
+    coast.coasting = true;
+    step += coast.remainder;
+    auto movement = (int16_t) std::clamp(std::trunc(step), -32767.0f, 32767.0f);
+    coast.remainder = step - movement;
+    if (movement)
+        coast.gesture->AxisGesture::move(movement);
+
+    coast.velocity *= coast.decay;
+    coast.schedule(self);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_ACTION_MOMENTUMGESTURE_H
+#define LOGID_ACTION_MOMENTUMGESTURE_H
+
+#include <actions/gesture/AxisGesture.h>
+#include <util/task.h>
+
+namespace logid::actions {
+    /* An axis gesture that keeps scrolling once input stops, slowing down
+     * at the configured friction until it comes to rest. Coasting starts
+     * after a frame without movement, so wheels (which are never released)
+     * coast as well as gesture buttons. */
+    class MomentumGesture : public AxisGesture {
+    public:
+        static const char* interface_name;
+
+        MomentumGesture(Device* device, config::MomentumGesture& config,
+                        const std::shared_ptr<ipcgull::node>& parent);
+
+        ~MomentumGesture() override;
+
+        void press(bool init_threshold) final;
+
+        void release(bool primary) final;
+
+        void move(int16_t axis) final;
+
+    protected:
+        /* Shared with the frame task, which may outlive the gesture.
+         * The mutex also serializes moves from the device and the task. */
+        struct Coast {
+            std::mutex mutex;
+            MomentumGesture* gesture = nullptr;
+            std::chrono::milliseconds frame{};
+            // Speed multiplier per frame
+            float decay = 0;
+            // Input units per ms, signed
+            float velocity = 0;
+            float remainder = 0;
+            bool coasting = false;
+            std::optional<std::chrono::steady_clock::time_point> last_move;
+            task_handle tick;
+
+            // Requires mutex
+            void stop();
+
+            // Requires mutex
+            void schedule(const std::shared_ptr<Coast>& self);
+
+            static void run(const std::shared_ptr<Coast>& self);
+        };
+
+        std::shared_ptr<Coast> _coast = std::make_shared<Coast>();
+    };
+}
+
+#endif //LOGID_ACTION_MOMENTUMGESTURE_H
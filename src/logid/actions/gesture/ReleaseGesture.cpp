@@ -35,22 +35,28 @@ ReleaseGesture::ReleaseGesture(Device* device, config::ReleaseGesture& config,
         }), _config(config) {
     if (_config.action.has_value())
         _action = Action::makeAction(device, _config.action.value(), _node);
+
+    _publish();
+}
+
+void ReleaseGesture::_publish() {
+    _settings.store({_config.threshold.value_or(defaults::gesture_threshold), _action});
 }
 
 void ReleaseGesture::press(bool init_threshold) {
-    std::shared_lock lock(_config_mutex);
     if (init_threshold) {
-        _axis = (int32_t) (_config.threshold.value_or(defaults::gesture_threshold));
+        _axis = _settings.load()->threshold;
     } else {
         _axis = 0;
     }
 }
 
 void ReleaseGesture::release(bool primary) {
-    if (metThreshold() && primary) {
-        if (_action) {
-            _action->press();
-            _action->release();
+    auto settings = _settings.load();
+    if (_axis >= settings->threshold && primary) {
+        if (settings->action) {
+            settings->action->press();
+            settings->action->release();
         }
     }
 }
@@ -64,8 +70,7 @@ bool ReleaseGesture::wheelCompatibility() const {
 }
 
 bool ReleaseGesture::metThreshold() const {
-    std::shared_lock lock(_config_mutex);
-    return _axis >= _config.threshold.value_or(defaults::gesture_threshold);
+    return _axis >= _settings.load()->threshold;
 }
 
 
@@ -80,10 +85,13 @@ void ReleaseGesture::setThreshold(int threshold) {
         _config.threshold.reset();
     else
         _config.threshold = threshold;
+    _publish();
 }
 
 void ReleaseGesture::setAction(const std::string& type) {
     std::unique_lock lock(_config_mutex);
     _action.reset();
+    _publish();
     _action = Action::makeAction(_device, type, _config.action, _node);
+    _publish();
 }
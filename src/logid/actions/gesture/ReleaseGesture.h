@@ -45,9 +45,12 @@ namespace logid::actions {
         void setAction(const std::string& type);
 
     protected:
+        void _publish();
+
         int32_t _axis{};
         std::shared_ptr<Action> _action;
         config::ReleaseGesture& _config;
+        Published<ActionSettings> _settings;
     };
 }
 
@@ -42,11 +42,16 @@ ThresholdGesture::ThresholdGesture(
             logPrintf(WARN, "Mapping gesture to invalid action");
         }
     }
+
+    _publish();
+}
+
+void ThresholdGesture::_publish() {
+    _settings.store({_config.threshold.value_or(defaults::gesture_threshold), _action});
 }
 
 void ThresholdGesture::press(bool init_threshold) {
-    std::shared_lock lock(_config_mutex);
-    _axis = init_threshold ? (int32_t) _config.threshold.value_or(defaults::gesture_threshold) : 0;
+    _axis = init_threshold ? _settings.load()->threshold : 0;
     this->_executed = false;
 }
 
@@ -57,18 +62,21 @@ void ThresholdGesture::release([[maybe_unused]] bool primary) {
 void ThresholdGesture::move(int16_t axis) {
     _axis += axis;
 
-    if (!this->_executed && metThreshold()) {
-        if (_action) {
-            _action->press();
-            _action->release();
+    if (this->_executed)
+        return;
+
+    auto settings = _settings.load();
+    if (_axis >= settings->threshold) {
+        if (settings->action) {
+            settings->action->press();
+            settings->action->release();
         }
         this->_executed = true;
     }
 }
 
 bool ThresholdGesture::metThreshold() const {
-    std::shared_lock lock(_config_mutex);
-    return _axis >= _config.threshold.value_or(defaults::gesture_threshold);
+    return _axis >= _settings.load()->threshold;
 }
 
 bool ThresholdGesture::wheelCompatibility() const {
@@ -86,10 +94,13 @@ void ThresholdGesture::setThreshold(int threshold) {
         _config.threshold.reset();
     else
         _config.threshold = threshold;
+    _publish();
 }
 
 void ThresholdGesture::setAction(const std::string& type) {
     std::unique_lock lock(_config_mutex);
     _action.reset();
+    _publish();
     _action = Action::makeAction(_device, type, _config.action, _node);
+    _publish();
 }
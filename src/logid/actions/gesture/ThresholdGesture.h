@@ -45,9 +45,12 @@ namespace logid::actions {
         void setAction(const std::string& type);
 
     protected:
+        void _publish();
+
         int32_t _axis{};
         std::shared_ptr<actions::Action> _action;
         config::ThresholdGesture& _config;
+        Published<ActionSettings> _settings;
 
     private:
         bool _executed = false;
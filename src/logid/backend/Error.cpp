@@ -17,6 +17,8 @@
  */
 
 #include <backend/Error.h>
+#include <backend/hidpp10/Error.h>
+#include <backend/hidpp20/Error.h>
 
 using namespace logid::backend;
 
@@ -24,6 +26,25 @@ const char* DeviceNotReady::what() const noexcept {
     return "device not ready";
 }
 
+DeviceNotReady::Reason DeviceNotReady::reason() const noexcept {
+    return _reason;
+}
+
 const char* TimeoutError::what() const noexcept {
     return "Device timed out";
 }
+
+void RequestError::raise() const {
+    auto index = static_cast<hidpp::DeviceIndex>(device_index);
+    switch (kind) {
+        case Hidpp10:
+            throw hidpp10::Error(code, index);
+        case Hidpp20:
+            throw hidpp20::Error(code, index);
+        case Unstable:
+            throw DeviceNotReady(DeviceNotReady::Unstable);
+        case Timeout:
+        default:
+            throw TimeoutError();
+    }
+}
@@ -19,12 +19,30 @@
 #ifndef LOGID_BACKEND_ERROR_H
 #define LOGID_BACKEND_ERROR_H
 
+#include <cstdint>
 #include <stdexcept>
+#include <utility>
+#include <variant>
 
 namespace logid::backend {
     class DeviceNotReady : public std::exception {
     public:
+        enum Reason {
+            Unknown,
+            // Not answering, e.g. a sleeping wireless device
+            Asleep,
+            // Answering, but not consistently yet
+            Unstable
+        };
+
+        explicit DeviceNotReady(Reason reason = Unknown) : _reason(reason) {}
+
         [[nodiscard]] const char* what() const noexcept override;
+
+        [[nodiscard]] Reason reason() const noexcept;
+
+    private:
+        Reason _reason;
     };
 
     class TimeoutError : public std::exception {
@@ -33,6 +51,70 @@ namespace logid::backend {
 
         [[nodiscard]] const char* what() const noexcept override;
     };
+
+    /* A failure that is part of normal operation, e.g. a sleeping device
+     * timing out or an absent one answering with an error. Returned by
+     * the try* calls rather than thrown, raise() throws it for callers
+     * that want an exception. */
+    struct RequestError {
+        enum Kind : uint8_t {
+            Timeout,
+            Hidpp10,  // code is an hidpp10::Error code
+            Hidpp20,  // code is an hidpp20::Error code
+            Unstable  // Only from a probe, some stability pings went unanswered
+        };
+
+        Kind kind;
+        uint8_t code = 0;
+        uint8_t device_index = 0;
+
+        [[nodiscard]] bool is(Kind k, uint8_t c) const {
+            return kind == k && code == c;
+        }
+
+        // TimeoutError, hidpp10::Error, hidpp20::Error or DeviceNotReady
+        [[noreturn]] void raise() const;
+    };
+
+    template <typename T>
+    class Result {
+    public:
+        // NOLINTNEXTLINE(google-explicit-constructor)
+        Result(T value) : _result(std::in_place_index<0>, std::move(value)) {}
+
+        // NOLINTNEXTLINE(google-explicit-constructor)
+        Result(RequestError error) : _result(std::in_place_index<1>, error) {}
+
+        [[nodiscard]] bool ok() const {
+            return _result.index() == 0;
+        }
+
+        explicit operator bool() const {
+            return ok();
+        }
+
+        // Raises the error if there is no value
+        T& value() {
+            if (!ok())
+                error().raise();
+            return std::get<0>(_result);
+        }
+
+        [[nodiscard]] const RequestError& error() const {
+            return std::get<1>(_result);
+        }
+
+        T& operator*() {
+            return std::get<0>(_result);
+        }
+
+        T* operator->() {
+            return &std::get<0>(_result);
+        }
+
+    private:
+        std::variant<T, RequestError> _result;
+    };
 }
 
 #endif //LOGID_BACKEND_ERROR_H
\ No newline at end of file
@@ -20,71 +20,180 @@
 #ifndef LOGID_EVENTHANDLERLIST_H
 #define LOGID_EVENTHANDLERLIST_H
 
+#include <backend/raw/IOMonitor.h>
+#include <util/trace.h>
 #include <memory>
 #include <mutex>
-#include <shared_mutex>
-#include <list>
+#include <vector>
+#include <array>
 #include <atomic>
+#include <thread>
+#include <algorithm>
+#include <source_location>
 
 template <class T>
 class EventHandlerLock;
 
+/* Removing a handler waits out every dispatch that may still be running
+ * it, so once its EventHandlerLock is released a callback is neither
+ * running nor will run again. Callbacks may therefore capture a raw
+ * pointer to the lock's owner instead of locking a weak_ptr per event,
+ * as long as the owner releases the lock before destroying anything the
+ * callback uses, e.g. by declaring the lock after those members. */
 template <class T>
 class EventHandlerList {
+    struct Entry {
+        Entry(typename T::EventHandler h, std::source_location loc) :
+                handler(std::move(h)), location(loc) {}
+
+        typename T::EventHandler handler;
+        std::atomic_bool active = true;
+        // Where it was added, a stall while it runs is put on it
+        std::source_location location;
+    };
+
+    typedef std::vector<std::shared_ptr<Entry>> snapshot_t;
+
+    /* Counts a dispatch as a reader for its whole duration, even when a
+     * callback throws. Also links it into this thread's dispatches,
+     * innermost first. */
+    class Dispatch {
+    public:
+        explicit Dispatch(EventHandlerList* list) : _list(list), _outer(dispatching) {
+            for (;;) {
+                auto current = list->epoch.load();
+                _slot = current & 1;
+                list->readers[_slot].fetch_add(1);
+                // A removal flipped the epoch in between, it may not wait for us
+                if (list->epoch.load() == current)
+                    break;
+                list->readers[_slot].fetch_sub(1);
+            }
+            dispatching = this;
+        }
+
+        Dispatch(const Dispatch&) = delete;
+        Dispatch& operator=(const Dispatch&) = delete;
+
+        ~Dispatch() {
+            dispatching = _outer;
+            _list->readers[_slot].fetch_sub(1);
+        }
+
+        EventHandlerList* const _list;
+        const Dispatch* const _outer;
+        uint32_t _slot = 0;
+    };
+
 public:
-    typedef std::list<std::pair<typename T::EventHandler, std::atomic_bool>> list_t;
-    typedef typename list_t::iterator iterator_t;
+    typedef std::shared_ptr<Entry> iterator_t;
 private:
-    list_t list;
-    std::shared_mutex mutex;
-    std::shared_mutex add_mutex;
-
-    void cleanup() {
-        std::unique_lock lock(mutex, std::try_to_lock);
-        if (lock.owns_lock()) {
-            std::list<iterator_t> to_remove;
-            for (auto it = list.begin(); it != list.end(); ++it) {
-                if (!it->second)
-                    to_remove.push_back(it);
-            }
+    /* Copy on write, run_all walks an immutable snapshot without taking
+     * any lock. Only add and remove serialize on mutex. */
+    std::atomic<std::shared_ptr<const snapshot_t>> snapshot =
+            std::make_shared<const snapshot_t>();
+    std::mutex mutex;
+
+    /* Each dispatch counts itself in the reader slot of the epoch it
+     * started in. A removal advances the epoch and waits for the old
+     * slot to drain, any dispatch counted in the new one has already
+     * seen the handler unlinked. grace_mutex keeps removals from
+     * flipping the epoch under each other. */
+    std::atomic<uint32_t> epoch = 0;
+    std::array<std::atomic<uint32_t>, 2> readers{};
+    std::mutex grace_mutex;
+
+    static inline thread_local const Dispatch* dispatching = nullptr;
+
+    [[nodiscard]] uint32_t _nested() const {
+        uint32_t count = 0;
+        for (auto frame = dispatching; frame; frame = frame->_outer)
+            if (frame->_list == this)
+                ++count;
+        return count;
+    }
 
-            for(auto& it : to_remove)
-                list.erase(it);
+    void _synchronize() {
+        /* A callback removing a handler from the list it is called from
+         * can't wait for its own dispatch. It waits for every other one
+         * instead, which can't be held up by this thread. */
+        if (auto nested = _nested()) {
+            while (readers[0].load() + readers[1].load() > nested)
+                std::this_thread::yield();
+            return;
         }
+
+        std::lock_guard lock(grace_mutex);
+        auto slot = epoch.fetch_add(1) & 1;
+        while (readers[slot].load())
+            std::this_thread::yield();
     }
 public:
-    iterator_t add(typename T::EventHandler handler) {
-        std::unique_lock add_lock(add_mutex);
-        list.emplace_front(std::move(handler), true);
-        return list.begin();
+    iterator_t add(typename T::EventHandler handler,
+                   std::source_location location = std::source_location::current()) {
+        auto entry = std::make_shared<Entry>(std::move(handler), location);
+
+        std::lock_guard lock(mutex);
+        auto next = std::make_shared<snapshot_t>();
+        auto current = snapshot.load();
+        next->reserve(current->size() + 1);
+        next->push_back(entry);
+        next->insert(next->end(), current->begin(), current->end());
+        snapshot.store(std::move(next));
+
+        return entry;
     }
 
     void remove(iterator_t iterator) {
-        std::unique_lock lock(mutex, std::try_to_lock);
-        if (lock.owns_lock()) {
-            std::unique_lock add_lock(add_mutex);
-            list.erase(iterator);
-        } else {
-            iterator->second = false;
+        // Handlers still running from an older snapshot skip it
+        iterator->active = false;
+
+        {
+            std::lock_guard lock(mutex);
+            auto next = std::make_shared<snapshot_t>(*snapshot.load());
+            next->erase(std::remove(next->begin(), next->end(), iterator), next->end());
+            snapshot.store(std::move(next));
         }
+
+        _synchronize();
+    }
+
+    // Bytes the list and its entries take, not counting what callbacks capture
+    [[nodiscard]] std::size_t footprint() const {
+        auto handlers = snapshot.load();
+        return sizeof(*this) + sizeof(snapshot_t) +
+               handlers->capacity() * sizeof(typename snapshot_t::value_type) +
+               handlers->size() * sizeof(Entry);
     }
 
     template <typename Arg>
     void run_all(Arg arg) {
-        cleanup();
-        std::shared_lock lock(mutex);
-        std::shared_lock add_lock(add_mutex);
-        for (auto& handler : list) {
-            add_lock.unlock();
-            if (handler.second) {
-                if (handler.first.condition(arg))
-                    handler.first.callback(arg);
+        Dispatch dispatch(this);
+
+        auto handlers = snapshot.load();
+        LOGID_TRACE(dispatch_begin, this, handlers->size());
+        for (auto& entry : *handlers) {
+            if (!entry->active)
+                continue;
+
+            // Declarative match keys are checked before the condition
+            if constexpr (requires { entry->handler.matches(arg); }) {
+                if (!entry->handler.matches(arg))
+                    continue;
+            }
+
+            // Handlers without a condition take every event
+            if (!entry->handler.condition || entry->handler.condition(arg)) {
+                logid::backend::raw::IOMonitor::Tag tag(entry->location);
+                entry->handler.callback(arg);
             }
-            add_lock.lock();
         }
+        LOGID_TRACE(dispatch_end, this);
     }
 };
 
+/* A handler whose callback captures its owner's this is declared last in
+ * the owner, so it is released before the members the callback uses */
 template <class T>
 class EventHandlerLock {
     typedef EventHandlerList<T> list_t;
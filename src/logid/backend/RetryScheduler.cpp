@@ -0,0 +1,78 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <backend/RetryScheduler.h>
+#include <util/task.h>
+#include <algorithm>
+
+using namespace logid;
+using namespace logid::backend;
+using namespace std::chrono;
+
+RetryScheduler::RetryScheduler(int max_tries, milliseconds max_delay,
+                               milliseconds spacing) :
+        _max_tries(max_tries), _max_delay(max_delay), _spacing(spacing),
+        _rng(std::random_device()()) {
+}
+
+milliseconds RetryScheduler::baseDelay(DeviceNotReady::Reason reason) {
+    switch (reason) {
+        case DeviceNotReady::Unstable:
+            return milliseconds(50);
+        case DeviceNotReady::Asleep:
+            return milliseconds(500);
+        default:
+            return milliseconds(250);
+    }
+}
+
+RetryScheduler::~RetryScheduler() {
+    for (auto& [key, task]: _pending)
+        task.cancel();
+}
+
+bool RetryScheduler::schedule(const std::string& key, DeviceNotReady::Reason reason, int tries,
+                              std::function<void()> retry) {
+    if (tries >= _max_tries)
+        return false;
+
+    auto delay = std::min<milliseconds>(baseDelay(reason) * (1 << tries), _max_delay);
+
+    std::lock_guard lock(_mutex);
+    // Jitter within [delay/2, delay] so devices that failed together don't retry together
+    std::uniform_int_distribution<milliseconds::rep> jitter(delay.count() / 2, delay.count());
+    auto now = steady_clock::now();
+    auto at = std::max(now + milliseconds(jitter(_rng)), _next_slot);
+    _next_slot = at + _spacing;
+
+    std::erase_if(_pending, [](const auto& pending) { return pending.second.done(); });
+    auto& task = _pending[key];
+    task.cancel();
+    task = run_task_after(std::move(retry), duration_cast<milliseconds>(at - now),
+                          task_priority::background);
+    return true;
+}
+
+void RetryScheduler::cancel(const std::string& key) {
+    std::lock_guard lock(_mutex);
+    auto it = _pending.find(key);
+    if (it != _pending.end()) {
+        it->second.cancel();
+        _pending.erase(it);
+    }
+}
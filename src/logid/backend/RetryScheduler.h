@@ -0,0 +1,69 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_RETRYSCHEDULER_H
+#define LOGID_BACKEND_RETRYSCHEDULER_H
+
+#include <backend/Error.h>
+#include <util/task.h>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+
+namespace logid::backend {
+    /* Schedules retries for devices that were not ready. Delays back off
+     * exponentially from a base picked by the reason, with jitter, and
+     * all retries of one owner (e.g. a receiver or the device monitor)
+     * share a budget that spaces them out so a hotplugged hub can't cause
+     * a retry storm. */
+    class RetryScheduler {
+    public:
+        RetryScheduler(int max_tries, std::chrono::milliseconds max_delay,
+                       std::chrono::milliseconds spacing);
+
+        /* Returns false once all tries are spent. A retry still waiting
+         * for the same key is replaced. */
+        bool schedule(const std::string& key, DeviceNotReady::Reason reason, int tries,
+                      std::function<void()> retry);
+
+        // Drops the retry waiting for key, e.g. once its device is gone
+        void cancel(const std::string& key);
+
+        ~RetryScheduler();
+
+        [[nodiscard]] static std::chrono::milliseconds baseDelay(
+                DeviceNotReady::Reason reason);
+
+    private:
+        const int _max_tries;
+        const std::chrono::milliseconds _max_delay;
+        const std::chrono::milliseconds _spacing;
+
+        std::mutex _mutex;
+        std::chrono::steady_clock::time_point _next_slot;
+        std::minstd_rand _rng;
+
+        // Retries still waiting are cancelled with the scheduler's owner
+        std::map<std::string, task_handle> _pending;
+    };
+}
+
+#endif //LOGID_BACKEND_RETRYSCHEDULER_H
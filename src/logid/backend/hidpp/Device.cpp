@@ -21,15 +21,33 @@
 #include <backend/hidpp20/features/DeviceName.h>
 #include <backend/hidpp20/Feature.h>
 #include <backend/hidpp10/Receiver.h>
+#include <backend/hidpp10/defs.h>
 #include <backend/Error.h>
+#include <util/trace.h>
 #include <cassert>
 #include <utility>
+#include <algorithm>
+#include <atomic>
+#include <bit>
 
 using namespace logid::backend;
 using namespace logid::backend::hidpp;
 
 using namespace std::chrono;
 
+/* Keeps slow but valid responses (e.g. flash reads) from timing out */
+static constexpr milliseconds min_io_timeout(100);
+/* BLE round trips take at least a connection interval each way, and peripheral
+ * latency lets a device skip some intervals, they vary far more than USB */
+static constexpr milliseconds min_bluetooth_timeout(250);
+// About two 7.5ms connection intervals
+static constexpr milliseconds bluetooth_write_window(15);
+static constexpr int max_rtt_backoff = 6;
+
+static std::atomic<int> stability_pings = 5;
+// Ping payloads must be distinct to match them
+static constexpr int max_stability_pings = 16;
+
 const char* Device::InvalidDevice::what() const noexcept {
     switch (_reason) {
         case NoHIDPPReport:
@@ -91,7 +109,8 @@ Device::Device(const std::shared_ptr<hidpp10::Receiver>& receiver,
     _pid = receiver->getPairingInfo(_index).pid;
 }
 
-const std::string& Device::devicePath() const {
+std::string Device::devicePath() const {
+    std::lock_guard lock(_raw_mutex);
     return _path;
 }
 
@@ -104,8 +123,12 @@ const std::tuple<uint8_t, uint8_t>& Device::version() const {
 }
 
 
-void Device::_setupReportsAndInit() {
+std::optional<RequestError> Device::_setupReportsAndInit() {
     _event_handlers = std::make_shared<EventHandlerList<Device>>();
+    {
+        std::lock_guard lock(_rtt_mutex);
+        _policy = transportPolicy(_raw_device->busType());
+    }
 
     supported_reports = getSupportedReports(_raw_device->reportDescriptor());
     if (!supported_reports)
@@ -117,49 +140,93 @@ void Device::_setupReportsAndInit() {
     if (_raw_device->isSubDevice())
         throw InvalidDevice(InvalidDevice::VirtualNode);
 
-    _raw_handler = _raw_device->addEventHandler(
-            {[index = _index](
-                    const std::vector<uint8_t>& report) -> bool {
-                return (report[Offset::Type] == Report::Type::Short ||
-                        report[Offset::Type] == Report::Type::Long) &&
-                       (report[Offset::DeviceIndex] == index);
-            },
-             [self_weak = _self](const std::vector<uint8_t>& report) -> void {
-                 Report _report(report);
-                 if(auto self = self_weak.lock())
-                     self->handleEvent(_report);
+    _raw_handler = _addRawHandler(_raw_device);
+
+    return _init();
+}
+
+EventHandlerLock<raw::RawDevice> Device::_addRawHandler(
+        const std::shared_ptr<raw::RawDevice>& raw_device) {
+    return raw_device->addEventHandler(
+            {{.hidpp = true, .device_index = _index}, {},
+             [this](raw::RawReport report) -> void {
+                 handleEvent(ReportView(report));
              }});
+}
 
-    _init();
+void Device::_releaseRawHandler() {
+    EventHandlerLock<raw::RawDevice> handler;
+    {
+        std::lock_guard lock(_raw_mutex);
+        std::swap(_raw_handler, handler);
+    }
 }
 
-void Device::_init() {
-    try {
-        hidpp20::Root root(this);
-        _version = root.getVersion();
-    } catch (hidpp10::Error& e) {
-        // Valid HID++ 1.0 devices should send an InvalidSubID error
-        if (e.code() != hidpp10::Error::InvalidSubID)
-            throw;
-
-        // HID++ 2.0 is not supported, assume HID++ 1.0
-        _version = std::make_tuple(1, 0);
-    } catch (hidpp20::Error& e) {
-        /* Should never happen, device not ready? */
+void Device::rebind(std::shared_ptr<raw::RawDevice> raw_device) {
+    // A receiver's devices follow the receiver, they are never rebound
+    if (_receiver || raw_device->productId() != _pid)
+        throw InvalidDevice(InvalidDevice::InvalidRawDevice);
+    if (raw_device->isSubDevice())
+        throw InvalidDevice(InvalidDevice::VirtualNode);
+    if (getSupportedReports(raw_device->reportDescriptor()) != supported_reports)
+        throw InvalidDevice(InvalidDevice::NoHIDPPReport);
+
+    auto handler = _addRawHandler(raw_device);
+    auto policy = transportPolicy(raw_device->busType());
+    {
+        std::lock_guard lock(_raw_mutex);
+        _path = raw_device->rawPath();
+        // The old node and its handler are dropped after unlocking
+        std::swap(_raw_device, raw_device);
+        std::swap(_raw_handler, handler);
+    }
+
+    {
+        // The estimate was for the old node, which may have been on another bus
+        std::lock_guard lock(_rtt_mutex);
+        _policy = policy;
+        _srtt.reset();
+        _rtt_backoff = 0;
+    }
+
+    // The old node is gone, anything still waiting on it times out
+    hidpp20::Root root(this);
+    if (root.getVersion() != _version)
+        throw InvalidDevice(InvalidDevice::InvalidRawDevice);
+}
+
+void Device::_raiseInitError(const RequestError& error) {
+    /* Should never happen, device not ready? */
+    if (error.kind == RequestError::Hidpp20)
         throw DeviceNotReady();
+    error.raise();
+}
+
+std::optional<RequestError> Device::_init() {
+    {
+        ScopedSpan span(this, "version");
+        hidpp20::Root root(this);
+        auto version = root.tryGetVersion();
+        if (version) {
+            _version = *version;
+        } else if (version.error().is(RequestError::Hidpp10, hidpp10::Error::InvalidSubID)) {
+            // HID++ 2.0 is not supported, assume HID++ 1.0
+            _version = std::make_tuple(1, 0);
+        } else {
+            // Valid HID++ 1.0 devices should send an InvalidSubID error
+            return version.error();
+        }
     }
 
     /* Do a stability test before going further */
-    if (std::get<0>(_version) >= 2) {
-        if (!isStable20()) {
-            throw DeviceNotReady();
-        }
-    } else {
-        if (!isStable10()) {
-            throw DeviceNotReady();
-        }
+    {
+        ScopedSpan span(this, "stability");
+        bool stable = std::get<0>(_version) >= 2 ? isStable20() : isStable10();
+        if (!stable)
+            return RequestError{RequestError::Unstable};
     }
 
+    ScopedSpan span(this, "name");
     if (!_receiver) {
         _pid = _raw_device->productId();
         if (std::get<0>(_version) >= 2) {
@@ -184,77 +251,166 @@ void Device::_init() {
             _name = _receiver->getDeviceName(_index);
         }
     }
+
+    return {};
+}
+
+std::size_t Device::handlerFootprint() const {
+    return _event_handlers->footprint();
+}
+
+EventHandlerLock<Device> Device::addEventHandler(EventHandler handler,
+                                                 std::source_location location) {
+    return addEventHandler(_event_handlers, std::move(handler), location);
+}
+
+EventHandlerLock<Device> Device::addEventHandler(
+        const std::shared_ptr<EventHandlerList<Device>>& list, EventHandler handler,
+        std::source_location location) {
+    return {list, list->add(std::move(handler), location)};
+}
+
+bool Device::_maybeResponse(ReportView report) {
+    /* Register accesses and errors have the high bit set in the sub id,
+     * other responses echo our nonzero software id. */
+    return (report.subId() & 0x80) || report.swId() != 0;
+}
+
+bool Device::_looksLikeResponse(ReportView report) {
+    Report::Hidpp10Error hidpp10_error{};
+    Report::Hidpp20Error hidpp20_error{};
+    if (report.isError10(hidpp10_error) || report.isError20(hidpp20_error))
+        return true;
+
+    // Register replies come in the size the access returns
+    switch (report.subId()) {
+        case hidpp10::SetRegisterShort:
+        case hidpp10::GetRegisterShort:
+        case hidpp10::SetRegisterLong:
+            return report.type() == Report::Type::Short;
+        case hidpp10::GetRegisterLong:
+            return report.type() == Report::Type::Long;
+        default:
+            break;
+    }
+
+    /* HID++ 1.0 notifications (sub id 0x40 and up, e.g. connection events)
+     * have data where the sw id would be, only feature replies echo one */
+    return report.subId() < 0x40 && report.swId() != 0;
 }
 
-EventHandlerLock<Device> Device::addEventHandler(EventHandler handler) {
-    return {_event_handlers, _event_handlers->add(std::move(handler))};
+void Device::requestStarted() {
+    ++_outstanding_requests;
 }
 
-void Device::handleEvent(Report& report) {
-    if (responseReport(report))
-        return;
+void Device::requestFinished() {
+    --_outstanding_requests;
+}
+
+void Device::handleEvent(ReportView report) {
+    /* High rate notifications (e.g. diverted XY or wheel events) skip
+     * response matching and never take _response_mutex. */
+    if (_maybeResponse(report)) {
+        if (_outstanding_requests) {
+            if (_pingResponse(report))
+                return;
+
+            if (responseReport(report))
+                return;
+        }
+
+        if (_looksLikeResponse(report))
+            _stats.unmatched.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        _stats.events[report.subId()].fetch_add(1, std::memory_order_relaxed);
+    }
 
+    dispatchEvent(report);
+}
+
+void Device::dispatchEvent(ReportView report) {
     _event_handlers->run_all(report);
 }
 
 Report Device::sendReport(const Report& report) {
+    return trySendReport(report).value();
+}
+
+Result<Report> Device::trySendReport(const Report& report) {
     /* Must complete transaction before next send */
     std::lock_guard send_lock(_send_mutex);
     _sent_sub_id = report.subId();
     _sent_address = report.address();
     std::unique_lock lock(_response_mutex);
-    _sendReport(report);
+    auto sent = steady_clock::now();
+    LOGID_TRACE(hidpp_send_begin, this, report.deviceIndex(), report.subId(), report.address());
+    requestStarted();
+    try {
+        _sendReport(report);
+    } catch (...) {
+        requestFinished();
+        _sent_sub_id.reset();
+        throw;
+    }
 
     bool valid = _response_cv.wait_for(
-            lock, io_timeout, [this]() {
+            lock, ioTimeout(), [this]() {
                 return _response.has_value();
             });
+    requestFinished();
+    LOGID_TRACE(hidpp_send_end, this, valid);
 
     if (!valid) {
         _sent_sub_id.reset();
-        throw TimeoutError();
+        roundTripTimedOut();
+        return RequestError{RequestError::Timeout};
     }
 
+    sampleRoundTrip(steady_clock::now() - sent);
+
     Response response = _response.value();
     _response.reset();
     _sent_sub_id.reset();
     _sent_address.reset();
 
-    if (std::holds_alternative<Report>(response)) {
-        return std::get<Report>(response);
-    } else if (std::holds_alternative<Report::Hidpp10Error>(response)) {
+    if (std::holds_alternative<Report::Hidpp10Error>(response)) {
         auto error = std::get<Report::Hidpp10Error>(response);
-        throw hidpp10::Error(error.error_code, error.device_index);
+        return RequestError{RequestError::Hidpp10, error.error_code, error.device_index};
     } else if (std::holds_alternative<Report::Hidpp20Error>(response)) {
         auto error = std::get<Report::Hidpp20Error>(response);
-        throw hidpp20::Error(error.error_code, error.device_index);
+        return RequestError{RequestError::Hidpp20, error.error_code, error.device_index};
     }
 
-    // Should not be reached
-    throw std::runtime_error("unhandled variant type");
+    return std::get<Report>(response);
 }
 
-bool Device::responseReport(const Report& report) {
+bool Device::responseReport(ReportView report) {
     std::lock_guard lock(_response_mutex);
-    Response response = report;
+    Response response = Report(report.rawReport());
     uint8_t sub_id;
     uint8_t address;
 
     Report::Hidpp10Error hidpp10_error{};
     Report::Hidpp20Error hidpp20_error{};
+    std::optional<bool> error_hidpp20;
     if (report.isError10(hidpp10_error)) {
         sub_id = hidpp10_error.sub_id;
         address = hidpp10_error.address;
         response = hidpp10_error;
+        error_hidpp20 = false;
     } else if (report.isError20(hidpp20_error)) {
         sub_id = hidpp20_error.feature_index;
         address = (hidpp20_error.function << 4) | (hidpp20_error.software_id & 0x0f);
+        response = hidpp20_error;
+        error_hidpp20 = true;
     } else {
         sub_id = report.subId();
         address = report.address();
     }
 
     if (sub_id == _sent_sub_id && address == _sent_address) {
+        if (error_hidpp20)
+            errorReceived(error_hidpp20.value());
         _response = response;
         _response_cv.notify_all();
         return true;
@@ -264,13 +420,50 @@ bool Device::responseReport(const Report& report) {
 
 }
 
-const std::shared_ptr<raw::RawDevice>& Device::rawDevice() const {
+std::shared_ptr<raw::RawDevice> Device::rawDevice() const {
+    std::lock_guard lock(_raw_mutex);
     return _raw_device;
 }
 
 void Device::_sendReport(Report report) {
     reportFixup(report);
-    _raw_device->sendReport(report.rawReport());
+    std::shared_ptr<raw::RawDevice> raw_device;
+    {
+        std::lock_guard lock(_raw_mutex);
+        raw_device = _raw_device;
+    }
+    raw_device->sendReport(report.rawReport());
+    ++_reports_sent;
+}
+
+bool Device::linkDown() const {
+    return _receiver &&
+           _receiver->linkState(_index) == hidpp10::Receiver::LinkState::Down;
+}
+
+uint64_t Device::reportsSent() const {
+    return _reports_sent;
+}
+
+void Device::recordSpan(InitSpan span) {
+    std::lock_guard lock(_span_mutex);
+    _init_spans.push_back(std::move(span));
+}
+
+std::vector<InitSpan> Device::initSpans() const {
+    std::lock_guard lock(_span_mutex);
+    return _init_spans;
+}
+
+ScopedSpan::ScopedSpan(Device* device, std::string name) :
+        _device(device), _name(std::move(name)), _start(steady_clock::now()),
+        _reports(device->reportsSent()) {
+}
+
+ScopedSpan::~ScopedSpan() {
+    _device->recordSpan({std::move(_name),
+                         duration_cast<microseconds>(steady_clock::now() - _start),
+                         _device->reportsSent() - _reports});
 }
 
 void Device::sendReportNoACK(const Report& report) {
@@ -282,20 +475,65 @@ bool Device::isStable10() {
     return true;
 }
 
+void Device::setStabilityPings(int pings) {
+    stability_pings = std::clamp(pings, 0, max_stability_pings);
+}
+
 bool Device::isStable20() {
-    static const std::string ping_seq = "hello";
+    int pings = stability_pings;
+    if (!pings)
+        return true;
 
-    hidpp20::Root root(this);
+    /* All pings are sent at once and matched by their payload */
+    std::lock_guard send_lock(_send_mutex);
+    std::unique_lock lock(_response_mutex);
+    _ping_failed = false;
+    requestStarted();
 
     try {
-        for (auto c: ping_seq) {
-            if (root.ping(c) != c)
-                return false;
+        for (int i = 0; i < pings; ++i) {
+            uint8_t payload = 'a' + i;
+            Report ping(Report::Type::Short, _index, 0,
+                        hidpp20::Root::Ping, hidpp::softwareID);
+            ping.paramBegin()[2] = payload;
+            _pending_pings.insert(payload);
+            _sendReport(ping);
         }
     } catch (std::exception& e) {
+        _pending_pings.clear();
+        requestFinished();
         return false;
     }
 
+    bool stable = _response_cv.wait_for(lock, ioTimeout(), [this]() {
+        return _pending_pings.empty() || _ping_failed;
+    }) && !_ping_failed;
+
+    _pending_pings.clear();
+    requestFinished();
+    return stable;
+}
+
+bool Device::_pingResponse(ReportView report) {
+    std::lock_guard lock(_response_mutex);
+    if (_pending_pings.empty())
+        return false;
+
+    Report::Hidpp20Error error{};
+    if (report.isError20(error)) {
+        if (error.feature_index != 0 || error.function != hidpp20::Root::Ping ||
+            error.software_id != hidpp::softwareID)
+            return false;
+        _ping_failed = true;
+    } else {
+        if (report.feature() != 0 || report.function() != hidpp20::Root::Ping ||
+            report.swId() != hidpp::softwareID)
+            return false;
+        if (!_pending_pings.erase(report.paramBegin()[2]))
+            _ping_failed = true;
+    }
+
+    _response_cv.notify_all();
     return true;
 }
 
@@ -311,6 +549,88 @@ void Device::reportFixup(Report& report) const {
     }
 }
 
+std::chrono::microseconds Device::roundTripTime() const {
+    std::lock_guard lock(_rtt_mutex);
+    return duration_cast<microseconds>(_srtt.value_or(microseconds::zero()));
+}
+
+std::chrono::milliseconds Device::ioTimeout() const {
+    std::lock_guard lock(_rtt_mutex);
+    if (!_srtt)
+        return io_timeout;
+
+    // RFC 6298: RTO = SRTT + 4 * RTTVAR, doubled on every timeout
+    auto rto = duration_cast<milliseconds>(_srtt.value() + 4 * _rttvar) * (1 << _rtt_backoff);
+    return std::clamp(rto, std::min(_policy.min_timeout, io_timeout), io_timeout);
+}
+
+Device::TransportPolicy Device::transportPolicy(raw::RawDevice::BusType bus) {
+    switch (bus) {
+        case raw::RawDevice::Bluetooth:
+            return {min_bluetooth_timeout, bluetooth_write_window};
+        default:
+            return {min_io_timeout, milliseconds::zero()};
+    }
+}
+
+Device::TransportPolicy Device::transport() const {
+    std::lock_guard lock(_rtt_mutex);
+    return _policy;
+}
+
+void Device::sampleRoundTrip(std::chrono::steady_clock::duration rtt) {
+    std::lock_guard lock(_rtt_mutex);
+    std::chrono::duration<double, std::micro> sample = rtt;
+
+    if (!_srtt) {
+        _srtt = sample;
+        _rttvar = sample / 2;
+    } else {
+        auto delta = _srtt.value() - sample;
+        _rttvar = 0.75 * _rttvar + 0.25 * (delta < delta.zero() ? -delta : delta);
+        _srtt = 0.875 * _srtt.value() + 0.125 * sample;
+    }
+
+    _rtt_backoff = 0;
+
+    auto us = static_cast<uint64_t>(sample.count());
+    auto bucket = std::min<std::size_t>(std::bit_width(us), TransportStats::rtt_buckets - 1);
+    _stats.rtt_us[bucket].fetch_add(1, std::memory_order_relaxed);
+    _stats.responses.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Device::errorReceived(bool hidpp20) {
+    (hidpp20 ? _stats.hidpp20_errors : _stats.hidpp10_errors).fetch_add(
+            1, std::memory_order_relaxed);
+}
+
+Device::TransportStats Device::transportStats() const {
+    TransportStats stats{};
+    stats.requests = _reports_sent;
+    stats.responses = _stats.responses.load(std::memory_order_relaxed);
+    stats.timeouts = _stats.timeouts.load(std::memory_order_relaxed);
+    stats.hidpp10_errors = _stats.hidpp10_errors.load(std::memory_order_relaxed);
+    stats.hidpp20_errors = _stats.hidpp20_errors.load(std::memory_order_relaxed);
+    stats.unmatched = _stats.unmatched.load(std::memory_order_relaxed);
+
+    for (std::size_t i = 0; i < stats.rtt_us.size(); ++i)
+        stats.rtt_us[i] = _stats.rtt_us[i].load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < stats.events.size(); ++i)
+        stats.events[i] = _stats.events[i].load(std::memory_order_relaxed);
+
+    std::lock_guard lock(_raw_mutex);
+    stats.retries = _raw_device->writeRetries();
+    return stats;
+}
+
+void Device::roundTripTimedOut() {
+    _stats.timeouts.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard lock(_rtt_mutex);
+    // No point backing off past io_timeout, which is reached well before this
+    if (_rtt_backoff < max_rtt_backoff)
+        ++_rtt_backoff;
+}
+
 const std::string& Device::name() const {
     return _name;
 }
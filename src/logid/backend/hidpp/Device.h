@@ -23,12 +23,19 @@
 #include <backend/hidpp/Report.h>
 #include <backend/hidpp/defs.h>
 #include <backend/EventHandlerList.h>
+#include <backend/Error.h>
+#include <util/function.h>
 #include <optional>
 #include <variant>
 #include <string>
 #include <memory>
 #include <functional>
 #include <map>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <vector>
 
 namespace logid::backend::hidpp10 {
     // Need to define here for a constructor
@@ -38,6 +45,14 @@ namespace logid::backend::hidpp10 {
 namespace logid::backend::hidpp {
     struct DeviceConnectionEvent;
 
+    /* One part of bringing a device up: wall time and the reports written
+     * meanwhile, each of them a round trip unless sent without an ACK */
+    struct InitSpan {
+        std::string name;
+        std::chrono::microseconds time;
+        uint64_t reports;
+    };
+
     template<typename T>
     class _deviceWrapper : public T {
         friend class Device;
@@ -59,8 +74,8 @@ namespace logid::backend::hidpp {
 
     public:
         struct EventHandler {
-            std::function<bool(Report&)> condition;
-            std::function<void(Report&)> callback;
+            unique_function<bool(ReportView)> condition;
+            unique_function<void(ReportView)> callback;
         };
 
         class InvalidDevice : std::exception {
@@ -82,7 +97,8 @@ namespace logid::backend::hidpp {
             Reason _reason;
         };
 
-        [[nodiscard]] const std::string& devicePath() const;
+        // Copied, a rebind may replace it
+        [[nodiscard]] std::string devicePath() const;
 
         [[nodiscard]] DeviceIndex deviceIndex() const;
 
@@ -92,15 +108,86 @@ namespace logid::backend::hidpp {
 
         [[nodiscard]] uint16_t pid() const;
 
-        EventHandlerLock<Device> addEventHandler(EventHandler handler);
+        /* Smoothed round trip time, zero until the first response */
+        [[nodiscard]] std::chrono::microseconds roundTripTime() const;
+
+        /* Derived from the RTT estimate like a TCP RTO, bounded by io_timeout */
+        [[nodiscard]] std::chrono::milliseconds ioTimeout() const;
+
+        /* Transport tuning that depends on the bus the device is reached on */
+        struct TransportPolicy {
+            // Lower bound of the RTT derived timeout
+            std::chrono::milliseconds min_timeout;
+            /* Setting writes posted within this window go out as one batch.
+             * A BLE connection interval carries several reports for the
+             * price of one, so waiting a little is cheaper than a round
+             * trip per write. Zero sends each at once. */
+            std::chrono::milliseconds write_window;
+        };
+
+        [[nodiscard]] static TransportPolicy transportPolicy(raw::RawDevice::BusType bus);
+
+        // Follows the raw device across a rebind
+        [[nodiscard]] TransportPolicy transport() const;
+
+        EventHandlerLock<Device> addEventHandler(
+                EventHandler handler,
+                std::source_location location = std::source_location::current());
 
-        virtual Report sendReport(const Report& report);
+        // Throws the errors trySendReport returns
+        Report sendReport(const Report& report);
+
+        /* A timeout or an error response is returned, not thrown, so that
+         * probing absent or sleeping devices does not unwind. I/O errors
+         * still throw. */
+        [[nodiscard]] virtual Result<Report> trySendReport(const Report& report);
 
         virtual void sendReportNoACK(const Report& report);
 
-        void handleEvent(Report& report);
+        void handleEvent(ReportView report);
+
+        // Bytes taken by the device's event handler lists
+        [[nodiscard]] virtual std::size_t handlerFootprint() const;
+
+        // Copied, a rebind may replace it
+        [[nodiscard]] std::shared_ptr<raw::RawDevice> rawDevice() const;
+
+        /* Moves a directly connected device over to a new node after it
+         * reconnected, handlers and state are kept. Throws InvalidDevice if
+         * the node is not this device, or whatever the check ping throws. */
+        void rebind(std::shared_ptr<raw::RawDevice> raw_device);
+
+        /* Reports written to the device so far */
+        [[nodiscard]] uint64_t reportsSent() const;
+
+        /* Traffic with the device since it was made */
+        struct TransportStats {
+            static constexpr std::size_t rtt_buckets = 24;
+
+            uint64_t requests;
+            uint64_t responses;
+            uint64_t timeouts;
+            uint64_t hidpp10_errors;
+            uint64_t hidpp20_errors;
+            // Writes retried by the node, shared by all devices of a receiver
+            uint64_t retries;
+            // Looked like responses but matched no request, e.g. after a timeout
+            uint64_t unmatched;
+            // Bucket n counts round trips in [2^(n-1), 2^n) microseconds, the last one is open
+            std::array<uint64_t, rtt_buckets> rtt_us;
+            // Other reports by feature index, or sub id for HID++ 1.0
+            std::array<uint64_t, 256> events;
+        };
+
+        [[nodiscard]] TransportStats transportStats() const;
 
-        [[nodiscard]] const std::shared_ptr<raw::RawDevice>& rawDevice() const;
+        void recordSpan(InitSpan span);
+
+        // In the order they finished
+        [[nodiscard]] std::vector<InitSpan> initSpans() const;
+
+        /* Pings sent by the HID++ 2.0 stability check, 0 disables it */
+        static void setStabilityPings(int pings);
 
         Device(const Device&) = delete;
 
@@ -121,8 +208,25 @@ namespace logid::backend::hidpp {
         Device(const std::shared_ptr<hidpp10::Receiver>& receiver,
                DeviceIndex index, double timeout);
 
+        /* The raw handler calls into this device without holding a reference,
+         * subclasses stop it first thing in their destructor. */
+        void _releaseRawHandler();
+
         // Returns whether the report is a response
-        virtual bool responseReport(const Report& report);
+        virtual bool responseReport(ReportView report);
+
+        // Runs the handlers for a report that is not a response
+        virtual void dispatchEvent(ReportView report);
+
+        // For derived classes keeping handler lists of their own
+        static EventHandlerLock<Device> addEventHandler(
+                const std::shared_ptr<EventHandlerList<Device>>& list, EventHandler handler,
+                std::source_location location = std::source_location::current());
+
+        template<typename T>
+        [[nodiscard]] std::weak_ptr<T> self() const {
+            return std::dynamic_pointer_cast<T>(_self.lock());
+        }
 
         bool isStable20();
 
@@ -132,20 +236,51 @@ namespace logid::backend::hidpp {
 
         void reportFixup(Report& report) const;
 
+        void sampleRoundTrip(std::chrono::steady_clock::duration rtt);
+
+        // Backs off the derived timeout until the next response
+        void roundTripTimedOut();
+
+        // A request was answered with an error
+        void errorReceived(bool hidpp20);
+
+        /* Bracket every period where a response may arrive, handleEvent only
+         * tries to match responses (and lock) while one is outstanding. */
+        void requestStarted();
+
+        void requestFinished();
+
+        /* The receiver reported the link to this device down, a request
+         * would only wait out the timeout. The device announces itself
+         * again on wakeup. */
+        [[nodiscard]] bool linkDown() const;
+
         const std::chrono::milliseconds io_timeout;
         uint8_t supported_reports{};
 
         std::mutex _response_mutex;
         std::condition_variable _response_cv;
     private:
-        void _setupReportsAndInit();
+        // Problems with the node throw, a device that does not answer is returned
+        [[nodiscard]] std::optional<RequestError> _setupReportsAndInit();
+
+        [[nodiscard]] std::optional<RequestError> _init();
 
-        void _init();
+        // Throws what a failed _init would have
+        [[noreturn]] static void _raiseInitError(const RequestError& error);
+
+        [[nodiscard]] EventHandlerLock<raw::RawDevice> _addRawHandler(
+                const std::shared_ptr<raw::RawDevice>& raw_device);
+
+        // Returns whether the report answers a stability ping
+        bool _pingResponse(ReportView report);
 
         std::shared_ptr<raw::RawDevice> _raw_device;
         EventHandlerLock<raw::RawDevice> _raw_handler;
         std::shared_ptr<hidpp10::Receiver> _receiver;
         std::string _path;
+        // Guards _raw_device and _path against a rebind
+        mutable std::mutex _raw_mutex;
         DeviceIndex _index;
 
         std::tuple<uint8_t, uint8_t> _version;
@@ -154,23 +289,66 @@ namespace logid::backend::hidpp {
 
         std::mutex _send_mutex;
 
+        std::atomic<int> _outstanding_requests = 0;
+        std::atomic<uint64_t> _reports_sent = 0;
+
+        // Updated relaxed, only read for TransportStats
+        struct {
+            std::atomic<uint64_t> responses = 0;
+            std::atomic<uint64_t> timeouts = 0;
+            std::atomic<uint64_t> hidpp10_errors = 0;
+            std::atomic<uint64_t> hidpp20_errors = 0;
+            std::atomic<uint64_t> unmatched = 0;
+            std::array<std::atomic<uint64_t>, TransportStats::rtt_buckets> rtt_us{};
+            std::array<std::atomic<uint64_t>, 256> events{};
+        } _stats;
+
+        mutable std::mutex _span_mutex;
+        std::vector<InitSpan> _init_spans;
+
+        // Checked without locking, false for notifications
+        [[nodiscard]] static bool _maybeResponse(ReportView report);
+
+        // Whether an unmatched report counts as a lost reply in _stats
+        [[nodiscard]] static bool _looksLikeResponse(ReportView report);
+
+        mutable std::mutex _rtt_mutex;
+        // Guarded by _rtt_mutex
+        TransportPolicy _policy{};
+        std::optional<std::chrono::duration<double, std::micro>> _srtt;
+        std::chrono::duration<double, std::micro> _rttvar{};
+        int _rtt_backoff = 0;
+
         typedef std::variant<Report, Report::Hidpp10Error, Report::Hidpp20Error> Response;
 
         std::optional<Response> _response;
         std::optional<uint8_t> _sent_sub_id{};
         std::optional<uint8_t> _sent_address{};
 
+        /* Outstanding stability ping payloads, guarded by _response_mutex */
+        std::set<uint8_t> _pending_pings;
+        bool _ping_failed = false;
+
         std::shared_ptr<EventHandlerList<Device>> _event_handlers;
 
         std::weak_ptr<Device> _self;
 
     protected:
         template<typename T, typename... Args>
-        static std::shared_ptr<T> makeDerived(Args... args) {
+        static Result<std::shared_ptr<T>> tryMakeDerived(Args... args) {
             auto device = _deviceWrapper<T>::make(std::forward<Args>(args)...);
             device->_self = device;
-            device->_setupReportsAndInit();
-            return device;
+            if (auto error = device->_setupReportsAndInit())
+                return error.value();
+            return std::shared_ptr<T>(std::move(device));
+        }
+
+        template<typename T, typename... Args>
+        static std::shared_ptr<T> makeDerived(Args... args) {
+            auto device = tryMakeDerived<T>(std::forward<Args>(args)...);
+            if (!device)
+                _raiseInitError(device.error());
+            return std::move(*device);
         }
 
     public:
@@ -181,6 +359,24 @@ namespace logid::backend::hidpp {
     };
 
     typedef Device::EventHandler EventHandler;
+
+    /* Records an InitSpan on the device when it goes out of scope */
+    class ScopedSpan {
+    public:
+        ScopedSpan(Device* device, std::string name);
+
+        ~ScopedSpan();
+
+        ScopedSpan(const ScopedSpan&) = delete;
+
+        ScopedSpan& operator=(const ScopedSpan&) = delete;
+
+    private:
+        Device* _device;
+        std::string _name;
+        std::chrono::steady_clock::time_point _start;
+        uint64_t _reports;
+    };
 }
 
 #endif //LOGID_BACKEND_HIDPP_DEVICE_H
\ No newline at end of file
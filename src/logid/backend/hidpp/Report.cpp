@@ -106,6 +106,15 @@ uint8_t hidpp::getSupportedReports(const std::vector<uint8_t>& report_desc) {
     return ret;
 }
 
+std::vector<uint8_t> hidpp::makeReportDescriptor(uint8_t reports) {
+    std::vector<uint8_t> report_desc;
+    if (reports & ShortReportSupported)
+        report_desc.insert(report_desc.end(), ShortReportDesc.begin(), ShortReportDesc.end());
+    if (reports & LongReportSupported)
+        report_desc.insert(report_desc.end(), LongReportDesc.begin(), LongReportDesc.end());
+    return report_desc;
+}
+
 const char* Report::InvalidReportID::what() const noexcept {
     return "Invalid report ID";
 }
@@ -118,10 +127,10 @@ Report::Report(Report::Type type, DeviceIndex device_index,
                uint8_t sub_id, uint8_t address) {
     switch (type) {
         case Type::Short:
-            _data.resize(HeaderLength + ShortParamLength);
+            _resize(HeaderLength + ShortParamLength);
             break;
         case Type::Long:
-            _data.resize(HeaderLength + LongParamLength);
+            _resize(HeaderLength + LongParamLength);
             break;
         default:
             throw InvalidReportID();
@@ -140,10 +149,10 @@ Report::Report(Report::Type type, DeviceIndex device_index,
 
     switch (type) {
         case Type::Short:
-            _data.resize(HeaderLength + ShortParamLength);
+            _resize(HeaderLength + ShortParamLength);
             break;
         case Type::Long:
-            _data.resize(HeaderLength + LongParamLength);
+            _resize(HeaderLength + LongParamLength);
             break;
         default:
             throw InvalidReportID();
@@ -156,23 +165,33 @@ Report::Report(Report::Type type, DeviceIndex device_index,
                               (sw_id & 0x0f);
 }
 
-Report::Report(const std::vector<uint8_t>& data) :
-        _data(data) {
-    _data.resize(HeaderLength + LongParamLength);
-
+Report::Report(std::span<const uint8_t> data) {
     // Truncating data is entirely valid here.
+    const auto length = std::min(data.size(), _data.size());
+    std::copy(data.begin(), data.begin() + (std::ptrdiff_t) length, _data.begin());
+
     switch (_data[Offset::Type]) {
         case Type::Short:
-            _data.resize(HeaderLength + ShortParamLength);
+            _length = HeaderLength + ShortParamLength;
             break;
         case Type::Long:
-            _data.resize(HeaderLength + LongParamLength);
+            _length = HeaderLength + LongParamLength;
             break;
         default:
             throw InvalidReportID();
     }
 }
 
+void Report::_resize(std::size_t length) {
+    assert(length <= _data.size());
+
+    // Behave like std::vector::resize, growing zero-fills the new bytes
+    if (length > _length)
+        std::fill(_data.begin() + (std::ptrdiff_t) _length,
+                  _data.begin() + (std::ptrdiff_t) length, 0);
+    _length = length;
+}
+
 Report::Type Report::type() const {
     return static_cast<Report::Type>(_data[Offset::Type]);
 }
@@ -180,10 +199,10 @@ Report::Type Report::type() const {
 void Report::setType(Report::Type type) {
     switch (type) {
         case Type::Short:
-            _data.resize(HeaderLength + ShortParamLength);
+            _resize(HeaderLength + ShortParamLength);
             break;
         case Type::Long:
-            _data.resize(HeaderLength + LongParamLength);
+            _resize(HeaderLength + LongParamLength);
             break;
         default:
             throw InvalidReportID();
@@ -242,30 +261,61 @@ uint8_t Report::address() const {
     _data[Offset::Address] = address;
 }
 
-std::vector<uint8_t>::iterator Report::paramBegin() {
+Report::data_t::iterator Report::paramBegin() {
     return _data.begin() + Offset::Parameters;
 }
 
-std::vector<uint8_t>::iterator Report::paramEnd() {
-    return _data.end();
+Report::data_t::iterator Report::paramEnd() {
+    return _data.begin() + (std::ptrdiff_t) _length;
 }
 
-std::vector<uint8_t>::const_iterator Report::paramBegin() const {
+Report::data_t::const_iterator Report::paramBegin() const {
     return _data.begin() + Offset::Parameters;
 }
 
-std::vector<uint8_t>::const_iterator Report::paramEnd() const {
-    return _data.end();
+Report::data_t::const_iterator Report::paramEnd() const {
+    return _data.begin() + (std::ptrdiff_t) _length;
 }
 
-void Report::setParams(const std::vector<uint8_t>& _params) {
-    assert(_params.size() <= _data.size() - HeaderLength);
+void Report::setParams(std::span<const uint8_t> _params) {
+    assert(_params.size() <= _length - HeaderLength);
 
     for (std::size_t i = 0; i < _params.size(); i++)
         _data[Offset::Parameters + i] = _params[i];
 }
 
 bool Report::isError10(Report::Hidpp10Error& error) const {
+    return ReportView(*this).isError10(error);
+}
+
+bool Report::isError20(Report::Hidpp20Error& error) const {
+    return ReportView(*this).isError20(error);
+}
+
+std::span<const uint8_t> Report::rawReport() const {
+    return {_data.data(), _length};
+}
+
+ReportView::ReportView(std::span<const uint8_t> data) {
+    std::size_t length;
+    switch (data.empty() ? 0 : data[Offset::Type]) {
+        case Type::Short:
+            length = Report::HeaderLength + ShortParamLength;
+            break;
+        case Type::Long:
+            length = Report::HeaderLength + LongParamLength;
+            break;
+        default:
+            throw Report::InvalidReportID();
+    }
+
+    if (data.size() < length)
+        throw Report::InvalidReportLength();
+
+    _data = data.first(length);
+}
+
+bool ReportView::isError10(Report::Hidpp10Error& error) const {
     if (_data[Offset::Type] != Type::Short ||
         _data[Offset::SubID] != hidpp10::ErrorID)
         return false;
@@ -278,7 +328,7 @@ bool Report::isError10(Report::Hidpp10Error& error) const {
     return true;
 }
 
-bool Report::isError20(Report::Hidpp20Error& error) const {
+bool ReportView::isError20(Report::Hidpp20Error& error) const {
     if (_data[Offset::Type] != Type::Long ||
         _data[Offset::Feature] != hidpp20::ErrorID)
         return false;
@@ -291,7 +341,3 @@ bool Report::isError20(Report::Hidpp20Error& error) const {
 
     return true;
 }
-
-const std::vector<uint8_t>& Report::rawReport() const {
-    return _data;
-}
@@ -22,10 +22,15 @@
 #include <backend/raw/RawDevice.h>
 #include <backend/hidpp/defs.h>
 #include <cstdint>
+#include <array>
+#include <span>
 
 namespace logid::backend::hidpp {
     uint8_t getSupportedReports(const std::vector<uint8_t>& report_desc);
 
+    // A descriptor getSupportedReports() reads back as reports, for simulated devices
+    std::vector<uint8_t> makeReportDescriptor(uint8_t reports);
+
     /* Some devices only support a subset of these reports */
     static constexpr uint8_t ShortReportSupported = 1U;
     static constexpr uint8_t LongReportSupported = (1U<<1);
@@ -70,7 +75,7 @@ namespace logid::backend::hidpp {
                uint8_t function,
                uint8_t sw_id);
 
-        explicit Report(const std::vector<uint8_t>& data);
+        explicit Report(std::span<const uint8_t> data);
 
         [[nodiscard]] Report::Type type() const;
 
@@ -100,15 +105,17 @@ namespace logid::backend::hidpp {
 
         [[maybe_unused]] void setAddress(uint8_t address);
 
-        [[nodiscard]] std::vector<uint8_t>::iterator paramBegin();
+        typedef std::array<uint8_t, MaxDataLength> data_t;
+
+        [[nodiscard]] data_t::iterator paramBegin();
 
-        [[nodiscard]] std::vector<uint8_t>::iterator paramEnd();
+        [[nodiscard]] data_t::iterator paramEnd();
 
-        [[nodiscard]] std::vector<uint8_t>::const_iterator paramBegin() const;
+        [[nodiscard]] data_t::const_iterator paramBegin() const;
 
-        [[nodiscard]] std::vector<uint8_t>::const_iterator paramEnd() const;
+        [[nodiscard]] data_t::const_iterator paramEnd() const;
 
-        void setParams(const std::vector<uint8_t>& _params);
+        void setParams(std::span<const uint8_t> _params);
 
         struct Hidpp10Error {
             hidpp::DeviceIndex device_index;
@@ -124,11 +131,80 @@ namespace logid::backend::hidpp {
 
         bool isError20(Hidpp20Error& error) const;
 
-        [[nodiscard]] const std::vector<uint8_t>& rawReport() const;
+        [[nodiscard]] std::span<const uint8_t> rawReport() const;
 
         static constexpr std::size_t HeaderLength = 4;
     private:
-        std::vector<uint8_t> _data;
+        void _resize(std::size_t length);
+
+        /* Inline storage, reports never touch the heap */
+        data_t _data{};
+        std::size_t _length = 0;
+    };
+
+    /* Non-owning view over an inbound report, used on the event path so
+     * handlers parse the raw buffer without copying it. The viewed data
+     * must outlive the view. */
+    class ReportView {
+    public:
+        typedef ReportType::ReportType Type;
+
+        // Throws Report::InvalidReportID or Report::InvalidReportLength
+        explicit ReportView(std::span<const uint8_t> data);
+
+        // NOLINTNEXTLINE(google-explicit-constructor)
+        ReportView(const Report& report) : _data(report.rawReport()) {}
+
+        [[nodiscard]] constexpr Type type() const {
+            return static_cast<Type>(_data[Offset::Type]);
+        }
+
+        [[nodiscard]] constexpr DeviceIndex deviceIndex() const {
+            return static_cast<DeviceIndex>(_data[Offset::DeviceIndex]);
+        }
+
+        [[nodiscard]] constexpr uint8_t feature() const {
+            return _data[Offset::Feature];
+        }
+
+        [[nodiscard]] constexpr uint8_t subId() const {
+            return _data[Offset::SubID];
+        }
+
+        [[nodiscard]] constexpr uint8_t function() const {
+            return (_data[Offset::Function] >> 4) & 0x0f;
+        }
+
+        [[nodiscard]] constexpr uint8_t swId() const {
+            return _data[Offset::Function] & 0x0f;
+        }
+
+        [[nodiscard]] constexpr uint8_t address() const {
+            return _data[Offset::Address];
+        }
+
+        [[nodiscard]] constexpr std::span<const uint8_t>::iterator paramBegin() const {
+            return _data.begin() + Offset::Parameters;
+        }
+
+        [[nodiscard]] constexpr std::span<const uint8_t>::iterator paramEnd() const {
+            return _data.end();
+        }
+
+        [[nodiscard]] constexpr std::span<const uint8_t> params() const {
+            return _data.subspan(Offset::Parameters);
+        }
+
+        bool isError10(Report::Hidpp10Error& error) const;
+
+        bool isError20(Report::Hidpp20Error& error) const;
+
+        [[nodiscard]] constexpr std::span<const uint8_t> rawReport() const {
+            return _data;
+        }
+
+    private:
+        std::span<const uint8_t> _data;
     };
 }
 
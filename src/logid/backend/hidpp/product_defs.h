@@ -0,0 +1,55 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_HIDPP_PRODUCT_DEFS_H
+#define LOGID_BACKEND_HIDPP_PRODUCT_DEFS_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+namespace logid::backend::hidpp {
+    /* What a product ID is known to be, so that hotplug can skip probing.
+     * Corded devices answer on CordedDevice rather than DefaultDevice. */
+    enum class ProductKind {
+        Unknown,
+        Receiver,
+        Corded,
+    };
+
+    // Unifying, Nano, Lightspeed and Bolt receivers
+    inline constexpr std::array<uint16_t, 17> known_receivers = {
+            // Unifying
+            0xc52b, 0xc532,
+            // Nano
+            0xc51b, 0xc521, 0xc525, 0xc526, 0xc52e, 0xc52f, 0xc534,
+            // Lightspeed
+            0xc539, 0xc53a, 0xc53d, 0xc53f, 0xc541, 0xc545, 0xc547,
+            // Bolt
+            0xc548,
+    };
+
+    [[nodiscard]] constexpr ProductKind knownProduct(uint16_t pid) {
+        if (std::find(known_receivers.begin(), known_receivers.end(), pid) !=
+            known_receivers.end())
+            return ProductKind::Receiver;
+        return ProductKind::Unknown;
+    }
+}
+
+#endif //LOGID_BACKEND_HIDPP_PRODUCT_DEFS_H
@@ -56,66 +56,89 @@ Device::Device(const std::shared_ptr<hidpp10::Receiver>& receiver,
         : hidpp::Device(receiver, index, timeout) {
 }
 
-void Device::ResponseSlot::reset() {
-    response.reset();
-    sub_id.reset();
+Device::~Device() {
+    _releaseRawHandler();
 }
 
-hidpp::Report Device::sendReport(const hidpp::Report& report) {
-    auto& response_slot = _responses[report.subId() % SubIDCount];
+Result<hidpp::Report> Device::trySendReport(const hidpp::Report& report) {
+    if (linkDown())
+        return RequestError{RequestError::Timeout};
 
     std::unique_lock<std::mutex> lock(_response_mutex);
-    _response_cv.wait(lock, [&response_slot]() {
-        return !response_slot.sub_id.has_value();
+    auto& response_slot = _responses[{report.subId(), report.address()}];
+    response_slot.cv.wait(lock, [&response_slot]() {
+        return !response_slot.busy;
     });
-    response_slot.sub_id = report.subId();
+    response_slot.busy = true;
+    response_slot.response.reset();
+
+    auto release = [&response_slot]() {
+        response_slot.response.reset();
+        response_slot.busy = false;
+        response_slot.cv.notify_all();
+    };
+
+    auto sent = std::chrono::steady_clock::now();
+    requestStarted();
+    try {
+        _sendReport(report);
+    } catch (...) {
+        requestFinished();
+        release();
+        throw;
+    }
 
-    _sendReport(report);
-    bool valid = _response_cv.wait_for(lock, io_timeout, [&response_slot]() {
+    bool valid = response_slot.cv.wait_for(lock, ioTimeout(), [&response_slot]() {
         return response_slot.response.has_value();
     });
+    requestFinished();
 
     if (!valid) {
-        response_slot.reset();
-        throw TimeoutError();
+        release();
+        roundTripTimedOut();
+        return RequestError{RequestError::Timeout};
     }
 
+    sampleRoundTrip(std::chrono::steady_clock::now() - sent);
+
     auto response = response_slot.response.value();
-    response_slot.reset();
+    release();
 
     if (std::holds_alternative<hidpp::Report>(response)) {
         return std::get<hidpp::Report>(response);
     } else { // if(std::holds_alternative<hidpp::Report::Hidpp10Error>(response))
         auto error = std::get<hidpp::Report::Hidpp10Error>(response);
-        throw Error(error.error_code, error.device_index);
+        return RequestError{RequestError::Hidpp10, error.error_code, error.device_index};
     }
 }
 
-bool Device::responseReport(const hidpp::Report& report) {
+bool Device::responseReport(hidpp::ReportView report) {
     std::lock_guard<std::mutex> lock(_response_mutex);
-    uint8_t sub_id;
+    uint8_t sub_id, address;
 
     bool is_error = false;
     hidpp::Report::Hidpp10Error hidpp10_error{};
     if (report.isError10(hidpp10_error)) {
         sub_id = hidpp10_error.sub_id;
+        address = hidpp10_error.address;
         is_error = true;
     } else {
         sub_id = report.subId();
+        address = report.address();
     }
 
-    auto& response_slot = _responses[sub_id % SubIDCount];
-
-    if (!response_slot.sub_id.has_value() || response_slot.sub_id.value() != sub_id)
+    auto it = _responses.find({sub_id, address});
+    if (it == _responses.end() || !it->second.busy)
         return false;
 
+    auto& response_slot = it->second;
     if (is_error) {
         response_slot.response = hidpp10_error;
     } else {
-        response_slot.response = report;
+        response_slot.response = hidpp::Report(report.rawReport());
     }
 
-    _response_cv.notify_all();
+    response_slot.cv.notify_all();
     return true;
 }
 
@@ -21,6 +21,8 @@
 
 #include <optional>
 #include <variant>
+#include <map>
+#include <condition_variable>
 #include <backend/hidpp/Device.h>
 #include <backend/hidpp10/Error.h>
 #include <backend/hidpp10/defs.h>
@@ -28,8 +30,10 @@
 namespace logid::backend::hidpp10 {
     class Device : public hidpp::Device {
     public:
+        ~Device() override;
 
-        hidpp::Report sendReport(const hidpp::Report& report) final;
+
+        [[nodiscard]] Result<hidpp::Report> trySendReport(const hidpp::Report& report) final;
 
         std::vector<uint8_t> getRegister(uint8_t address,
                                          const std::vector<uint8_t>& params,
@@ -52,19 +56,21 @@ namespace logid::backend::hidpp10 {
         Device(const std::shared_ptr<hidpp10::Receiver>& receiver,
                hidpp::DeviceIndex index, double timeout);
 
-        bool responseReport(const hidpp::Report& report) final;
+        bool responseReport(hidpp::ReportView report) final;
 
     private:
         typedef std::variant<hidpp::Report, hidpp::Report::Hidpp10Error> Response;
 
         struct ResponseSlot {
             std::optional<Response> response;
-            std::optional<uint8_t> sub_id;
-
-            void reset();
+            bool busy = false;
+            // Only wakes requests for this slot
+            std::condition_variable cv;
         };
 
-        std::array<ResponseSlot, SubIDCount> _responses;
+        /* Keyed by (sub id, address) so that different registers can be
+         * accessed in parallel. The device index is fixed per device. */
+        std::map<std::pair<uint8_t, uint8_t>, ResponseSlot> _responses;
 
         std::vector<uint8_t> accessRegister(
                 uint8_t sub_id, uint8_t address, const std::vector<uint8_t>& params);
@@ -30,6 +30,10 @@ Receiver::Receiver(const std::string& path, const std::shared_ptr<raw::DeviceMon
                    double timeout) : Device(path, hidpp::DefaultDevice, monitor, timeout) {
 }
 
+Receiver::Receiver(std::shared_ptr<raw::RawDevice> raw_device, double timeout) :
+        Device(std::move(raw_device), hidpp::DefaultDevice, timeout) {
+}
+
 void Receiver::_receiverCheck() {
     // Check if the device is a receiver
     try {
@@ -71,6 +75,41 @@ void Receiver::enumerate() {
     setRegisterNoResponse(ConnectionState, {2}, hidpp::ReportType::Short);
 }
 
+void Receiver::_trackLinks() {
+    _link_handler = rawDevice()->addEventHandler(
+            {{.hidpp = true}, {}, [this](raw::RawReport raw) {
+                hidpp::ReportView report(raw);
+                auto index = report.deviceIndex();
+
+                if (report.subId() == DeviceConnection) {
+                    _setLinkState(index, deviceConnectionEvent(report).linkEstablished ?
+                                         LinkState::Up : LinkState::Down);
+                } else if (report.subId() == DeviceDisconnection) {
+                    // Unpaired, a new device on the index announces itself
+                    _setLinkState(index, LinkState::Unknown);
+                } else if (hidpp::Report::Hidpp10Error error{}; !report.isError10(error)) {
+                    /* Anything else from the index means the link is up, but
+                     * HID++ 1.0 errors may be the receiver answering for it */
+                    _setLinkState(index, LinkState::Up);
+                }
+            }});
+}
+
+void Receiver::_setLinkState(hidpp::DeviceIndex index, LinkState state) {
+    if (index >= _links.size())
+        return;
+
+    auto& link = _links[index];
+    if (link.load(std::memory_order_relaxed) != state)
+        link.store(state, std::memory_order_release);
+}
+
+Receiver::LinkState Receiver::linkState(hidpp::DeviceIndex index) const {
+    if (index >= _links.size())
+        return LinkState::Unknown;
+    return _links[index].load(std::memory_order_acquire);
+}
+
 ///TODO: Investigate usage
 uint8_t Receiver::getConnectionState(hidpp::DeviceIndex index) {
     auto response = getRegister(ConnectionState, {index}, hidpp::ReportType::Short);
@@ -273,12 +312,12 @@ std::string Receiver::getDeviceName(hidpp::DeviceIndex index) {
     return name;
 }
 
-hidpp::DeviceIndex Receiver::deviceDisconnectionEvent(const hidpp::Report& report) {
+hidpp::DeviceIndex Receiver::deviceDisconnectionEvent(hidpp::ReportView report) {
     assert(report.subId() == DeviceDisconnection);
     return report.deviceIndex();
 }
 
-hidpp::DeviceConnectionEvent Receiver::deviceConnectionEvent(const hidpp::Report& report) {
+hidpp::DeviceConnectionEvent Receiver::deviceConnectionEvent(hidpp::ReportView report) {
     assert(report.subId() == DeviceConnection);
 
     auto data = report.paramBegin();
@@ -298,7 +337,7 @@ hidpp::DeviceConnectionEvent Receiver::deviceConnectionEvent(const hidpp::Report
 }
 
 bool Receiver::fillDeviceDiscoveryEvent(DeviceDiscoveryEvent& event,
-                                        const hidpp::Report& report) {
+                                        hidpp::ReportView report) {
     assert(report.subId() == DeviceDiscovered);
 
     auto data = report.paramBegin();
@@ -342,7 +381,7 @@ bool Receiver::fillDeviceDiscoveryEvent(DeviceDiscoveryEvent& event,
     }
 }
 
-PairStatusEvent Receiver::pairStatusEvent(const hidpp::Report& report) {
+PairStatusEvent Receiver::pairStatusEvent(hidpp::ReportView report) {
     assert(report.subId() == PairStatus);
 
     return {
@@ -351,7 +390,7 @@ PairStatusEvent Receiver::pairStatusEvent(const hidpp::Report& report) {
     };
 }
 
-BoltPairStatusEvent Receiver::boltPairStatusEvent(const hidpp::Report& report) {
+BoltPairStatusEvent Receiver::boltPairStatusEvent(hidpp::ReportView report) {
     assert(report.subId() == BoltPairStatus);
 
     return {
@@ -360,7 +399,7 @@ BoltPairStatusEvent Receiver::boltPairStatusEvent(const hidpp::Report& report) {
     };
 }
 
-DiscoveryStatusEvent Receiver::discoveryStatusEvent(const hidpp::Report& report) {
+DiscoveryStatusEvent Receiver::discoveryStatusEvent(hidpp::ReportView report) {
     assert(report.subId() == DiscoveryStatus);
 
     return {
@@ -369,7 +408,7 @@ DiscoveryStatusEvent Receiver::discoveryStatusEvent(const hidpp::Report& report)
     };
 }
 
-std::string Receiver::passkeyEvent(const hidpp::Report& report) {
+std::string Receiver::passkeyEvent(hidpp::ReportView report) {
     assert(report.subId() == PasskeyRequest);
 
     return {report.paramBegin(), report.paramBegin() + 6};
@@ -19,8 +19,10 @@
 #ifndef LOGID_BACKEND_DJ_RECEIVER_H
 #define LOGID_BACKEND_DJ_RECEIVER_H
 
-#include <cstdint>
 #include <backend/hidpp10/Device.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
 
 namespace logid::backend::hidpp {
     enum DeviceType : uint8_t {
@@ -144,6 +146,17 @@ namespace logid::backend::hidpp10 {
 
         std::map<hidpp::DeviceIndex, uint8_t> getDeviceActivity();
 
+        enum class LinkState : uint8_t {
+            Unknown,
+            Up,
+            Down
+        };
+
+        /* Last link state seen for a paired index, from connection
+         * notifications (enumerate has the receiver send one for each
+         * paired device) and reports coming from the device. */
+        [[nodiscard]] LinkState linkState(hidpp::DeviceIndex index) const;
+
         [[nodiscard]] bool bolt() const;
 
         struct PairingInfo {
@@ -181,37 +194,48 @@ namespace logid::backend::hidpp10 {
 
         std::string getDeviceName(hidpp::DeviceIndex index);
 
-        static hidpp::DeviceIndex deviceDisconnectionEvent(const hidpp::Report& report);
+        static hidpp::DeviceIndex deviceDisconnectionEvent(hidpp::ReportView report);
 
-        static hidpp::DeviceConnectionEvent deviceConnectionEvent(const hidpp::Report& report);
+        static hidpp::DeviceConnectionEvent deviceConnectionEvent(hidpp::ReportView report);
 
-        static PairStatusEvent pairStatusEvent(const hidpp::Report& report);
+        static PairStatusEvent pairStatusEvent(hidpp::ReportView report);
 
-        static BoltPairStatusEvent boltPairStatusEvent(const hidpp::Report& report);
+        static BoltPairStatusEvent boltPairStatusEvent(hidpp::ReportView report);
 
-        static DiscoveryStatusEvent discoveryStatusEvent(const hidpp::Report& report);
+        static DiscoveryStatusEvent discoveryStatusEvent(hidpp::ReportView report);
 
         static bool fillDeviceDiscoveryEvent(DeviceDiscoveryEvent& event,
-                                             const hidpp::Report& report);
+                                             hidpp::ReportView report);
 
-        static std::string passkeyEvent(const hidpp::Report& report);
+        static std::string passkeyEvent(hidpp::ReportView report);
 
     protected:
         Receiver(const std::string& path,
                  const std::shared_ptr<raw::DeviceMonitor>& monitor,
                  double timeout);
 
+        Receiver(std::shared_ptr<raw::RawDevice> raw_device, double timeout);
+
     private:
         void _receiverCheck();
 
+        void _trackLinks();
+
+        void _setLinkState(hidpp::DeviceIndex index, LinkState state);
+
         bool _is_bolt = false;
 
+        std::array<std::atomic<LinkState>, hidpp::WirelessDevice6 + 1> _links{};
+
+        EventHandlerLock<raw::RawDevice> _link_handler;
+
     public:
         template <typename... Args>
         static std::shared_ptr<Receiver> make(Args... args) {
             auto receiver = makeDerived<Receiver>(std::forward<Args>(args)...);
 
             receiver->_receiverCheck();
+            receiver->_trackLinks();
 
             return receiver;
         }
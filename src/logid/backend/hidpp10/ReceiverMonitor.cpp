@@ -25,8 +25,23 @@ using namespace logid::backend::hidpp10;
 using namespace logid::backend::hidpp;
 
 ReceiverMonitor::ReceiverMonitor(const std::string& path,
-                                 const std::shared_ptr<raw::DeviceMonitor>& monitor, double timeout)
-        : _receiver(Receiver::make(path, monitor, timeout)) {
+                                 const std::shared_ptr<raw::DeviceMonitor>& monitor, double timeout,
+                                 std::chrono::milliseconds connection_debounce)
+        : _receiver(Receiver::make(path, monitor, timeout)),
+          _retry(max_tries, std::chrono::milliseconds(ready_backoff * 8),
+                 std::chrono::milliseconds(retry_spacing)),
+          _connection_debounce(connection_debounce) {
+
+    Receiver::NotificationFlags notification_flags{true, true, true};
+    _receiver->setNotifications(notification_flags);
+}
+
+ReceiverMonitor::ReceiverMonitor(std::shared_ptr<raw::RawDevice> raw_device, double timeout,
+                                 std::chrono::milliseconds connection_debounce)
+        : _receiver(Receiver::make(std::move(raw_device), timeout)),
+          _retry(max_tries, std::chrono::milliseconds(ready_backoff * 8),
+                 std::chrono::milliseconds(retry_spacing)),
+          _connection_debounce(connection_debounce) {
 
     Receiver::NotificationFlags notification_flags{true, true, true};
     _receiver->setNotifications(notification_flags);
@@ -35,32 +50,34 @@ ReceiverMonitor::ReceiverMonitor(const std::string& path,
 void ReceiverMonitor::_ready() {
     if (_connect_ev_handler.empty()) {
         _connect_ev_handler = _receiver->rawDevice()->addEventHandler(
-                {[](const std::vector<uint8_t>& report) -> bool {
-                    if (report[Offset::Type] == Report::Type::Short ||
-                        report[Offset::Type] == Report::Type::Long) {
-                        uint8_t sub_id = report[Offset::SubID];
-                        return (sub_id == Receiver::DeviceConnection ||
-                                sub_id == Receiver::DeviceDisconnection);
-                    }
-                    return false;
-                }, [self_weak = _self](const std::vector<uint8_t>& raw) -> void {
+                {{.hidpp = true}, [](raw::RawReport report) -> bool {
+                    uint8_t sub_id = report[Offset::SubID];
+                    return (sub_id == Receiver::DeviceConnection ||
+                            sub_id == Receiver::DeviceDisconnection);
+                }, [self_weak = _self](raw::RawReport raw) -> void {
                     /* Running in a new thread prevents deadlocks since the
                      * receiver may be enumerating.
                      */
                     hidpp::Report report(raw);
 
                     if (auto self = self_weak.lock()) {
-                        run_task([self_weak, report]() {
+                        self->_tasks.add(run_task([self_weak, report]() {
                             auto self = self_weak.lock();
                             if (!self)
                                 return;
 
                             if (report.subId() == Receiver::DeviceConnection) {
-                                self->_addHandler(Receiver::deviceConnectionEvent(report));
+                                self->_debounceConnection(
+                                        Receiver::deviceConnectionEvent(report));
                             } else if (report.subId() == Receiver::DeviceDisconnection) {
-                                self->_removeHandler(Receiver::deviceDisconnectionEvent(report));
+                                auto index = Receiver::deviceDisconnectionEvent(report);
+                                {
+                                    std::lock_guard lock(self->_debounce_mutex);
+                                    self->_pending_connections.erase(index);
+                                }
+                                self->_removeHandler(index);
                             }
-                        });
+                        }));
                     }
 
                 }
@@ -69,11 +86,11 @@ void ReceiverMonitor::_ready() {
 
     if (_discover_ev_handler.empty()) {
         _discover_ev_handler = _receiver->addEventHandler(
-                {[](const hidpp::Report& report) -> bool {
+                {[](hidpp::ReportView report) -> bool {
                     return (report.subId() == Receiver::DeviceDiscovered) &&
                            (report.type() == Report::Type::Long);
                 },
-                 [self_weak = _self](const hidpp::Report& report) {
+                 [self_weak = _self](hidpp::ReportView report) {
                      auto self = self_weak.lock();
                      if (!self)
                          return;
@@ -84,10 +101,11 @@ void ReceiverMonitor::_ready() {
 
                          if (filled) {
                              self->_pair_state = FindingPasskey;
-                             run_task([self_weak, event = self->_discovery_event]() {
+                             self->_tasks.add(run_task(
+                                     [self_weak, event = self->_discovery_event]() {
                                  if (auto self = self_weak.lock())
                                      self->receiver()->startBoltPairing(event);
-                             });
+                             }));
                          }
                      }
                  }
@@ -96,11 +114,11 @@ void ReceiverMonitor::_ready() {
 
     if (_passkey_ev_handler.empty()) {
         _passkey_ev_handler = _receiver->addEventHandler(
-                {[](const hidpp::Report& report) -> bool {
+                {[](hidpp::ReportView report) -> bool {
                     return report.subId() == Receiver::PasskeyRequest &&
                            report.type() == hidpp::Report::Type::Long;
                 },
-                 [self_weak = _self](const hidpp::Report& report) {
+                 [self_weak = _self](hidpp::ReportView report) {
                      if (auto self = self_weak.lock()) {
                          std::lock_guard lock(self->_pair_mutex);
                          if (self->_pair_state == FindingPasskey) {
@@ -116,12 +134,12 @@ void ReceiverMonitor::_ready() {
 
     if (_pair_status_handler.empty()) {
         _pair_status_handler = _receiver->addEventHandler(
-                {[](const hidpp::Report& report) -> bool {
+                {[](hidpp::ReportView report) -> bool {
                     return report.subId() == Receiver::DiscoveryStatus ||
                            report.subId() == Receiver::PairStatus ||
                            report.subId() == Receiver::BoltPairStatus;
                 },
-                 [self_weak = _self](const hidpp::Report& report) {
+                 [self_weak = _self](hidpp::ReportView report) {
                      auto self = self_weak.lock();
                      if (!self)
                          return;
@@ -161,25 +179,25 @@ void ReceiverMonitor::waitForDevice(hidpp::DeviceIndex index) {
     const std::lock_guard lock(_wait_mutex);
     if (!_waiters.count(index)) {
         _waiters.emplace(index, _receiver->rawDevice()->addEventHandler(
-                {[index](const std::vector<uint8_t>& report) -> bool {
+                {{.device_index = index}, [](raw::RawReport report) -> bool {
                     /* Connection events should be handled by connect_ev_handler */
                     auto sub_id = report[Offset::SubID];
-                    return report[Offset::DeviceIndex] == index &&
-                           sub_id != Receiver::DeviceConnection &&
+                    return sub_id != Receiver::DeviceConnection &&
                            sub_id != Receiver::DeviceDisconnection;
                 },
                  [self_weak = _self, index](
-                         [[maybe_unused]] const std::vector<uint8_t>& report) {
+                         [[maybe_unused]] raw::RawReport report) {
                      hidpp::DeviceConnectionEvent event{};
                      event.withPayload = false;
                      event.linkEstablished = true;
                      event.index = index;
                      event.fromTimeoutCheck = true;
 
-                     run_task([self_weak, event]() {
-                         if (auto self = self_weak.lock())
-                             self->_addHandler(event);
-                     });
+                     if (auto self = self_weak.lock())
+                         self->_tasks.add(run_task([self_weak, event]() {
+                             if (auto self = self_weak.lock())
+                                 self->_addHandler(event);
+                         }, task_priority::background));
                  }
                 }));
     }
@@ -223,26 +241,58 @@ void ReceiverMonitor::_addHandler(const hidpp::DeviceConnectionEvent& event, int
         const std::lock_guard lock(_wait_mutex);
         _waiters.erase(event.index);
     } catch (DeviceNotReady& e) {
-        if (tries == max_tries) {
-            logPrintf(WARN, "Failed to add device %s:%d after %d tries."
+        // A sleeping device is left to addDevice, which waits for its next report
+        bool scheduled = _retry.schedule(std::to_string(event.index), e.reason(), tries,
+                                         [self_weak = _self, event, tries]() {
+            if (auto self = self_weak.lock())
+                self->_addHandler(event, tries + 1);
+        });
+        if (scheduled)
+            logPrintf(DEBUG, "Failed to add device %s:%d on try %d, retrying",
+                      device_path.c_str(), event.index, tries + 1);
+        else
+            logPrintf(WARN, "Failed to add device %s:%d after %d tries. "
                             "Treating as failure.", device_path.c_str(), event.index, max_tries);
-        } else {
-            /* Do exponential backoff for 2^tries * backoff ms. */
-            std::chrono::milliseconds wait((1 << tries) * ready_backoff);
-            logPrintf(DEBUG, "Failed to add device %s:%d on try %d, backing off for %dms",
-                      device_path.c_str(), event.index, tries + 1, wait.count());
-            run_task_after([self_weak = _self, event, tries]() {
-                if (auto self = self_weak.lock())
-                    self->_addHandler(event, tries + 1);
-            }, wait);
-        }
     } catch (std::exception& e) {
         logPrintf(ERROR, "Failed to add device %d to receiver on %s: %s",
                   event.index, device_path.c_str(), e.what());
     }
 }
 
+void ReceiverMonitor::_debounceConnection(const hidpp::DeviceConnectionEvent& event) {
+    if (_connection_debounce.count() <= 0) {
+        _addHandler(event);
+        return;
+    }
+
+    {
+        std::lock_guard lock(_debounce_mutex);
+        // An armed timer picks up the latest event when it fires
+        if (!_pending_connections.insert_or_assign(event.index, event).second)
+            return;
+    }
+
+    _tasks.add(run_task_after([self_weak = _self, index = event.index]() {
+        auto self = self_weak.lock();
+        if (!self)
+            return;
+
+        hidpp::DeviceConnectionEvent latest{};
+        {
+            std::lock_guard lock(self->_debounce_mutex);
+            auto it = self->_pending_connections.find(index);
+            if (it == self->_pending_connections.end())
+                return;
+            latest = it->second;
+            self->_pending_connections.erase(it);
+        }
+
+        self->_addHandler(latest);
+    }, _connection_debounce));
+}
+
 void ReceiverMonitor::_removeHandler(hidpp::DeviceIndex index) {
+    _retry.cancel(std::to_string(index));
     try {
         removeDevice(index);
     } catch (std::exception& e) {
@@ -21,8 +21,11 @@
 
 #include <backend/hidpp10/Receiver.h>
 #include <backend/hidpp/defs.h>
+#include <backend/RetryScheduler.h>
+#include <util/task.h>
 #include <cstdint>
 #include <string>
+#include <chrono>
 
 namespace logid::backend::hidpp10 {
 
@@ -42,6 +45,7 @@ namespace logid::backend::hidpp10 {
 
     static constexpr int max_tries = 5;
     static constexpr int ready_backoff = 250;
+    static constexpr int retry_spacing = 20;
 
     // This class will run on the RawDevice thread,
     class ReceiverMonitor {
@@ -53,9 +57,14 @@ namespace logid::backend::hidpp10 {
         ReceiverMonitor(ReceiverMonitor&&) = delete;
 
     protected:
+        /* Connection events for an index within connection_debounce of each
+         * other are coalesced into the last one, 0 disables this. */
         ReceiverMonitor(const std::string& path,
                         const std::shared_ptr<raw::DeviceMonitor>& monitor,
-                        double timeout);
+                        double timeout, std::chrono::milliseconds connection_debounce);
+
+        ReceiverMonitor(std::shared_ptr<raw::RawDevice> raw_device, double timeout,
+                        std::chrono::milliseconds connection_debounce);
 
 
         virtual void addDevice(hidpp::DeviceConnectionEvent event) = 0;
@@ -73,11 +82,18 @@ namespace logid::backend::hidpp10 {
 
         [[nodiscard]] std::shared_ptr<Receiver> receiver() const;
 
+        template<typename T>
+        [[nodiscard]] std::weak_ptr<T> self() const {
+            return std::dynamic_pointer_cast<T>(_self.lock());
+        }
+
     private:
         void _ready();
 
         void _addHandler(const hidpp::DeviceConnectionEvent& event, int tries = 0);
 
+        void _debounceConnection(const hidpp::DeviceConnectionEvent& event);
+
         void _removeHandler(hidpp::DeviceIndex index);
 
         std::shared_ptr<Receiver> _receiver;
@@ -101,9 +117,20 @@ namespace logid::backend::hidpp10 {
 
         std::weak_ptr<ReceiverMonitor> _self;
 
+        // Retries of all devices on this receiver share one budget
+        RetryScheduler _retry;
+
         std::mutex _wait_mutex;
         std::map<hidpp::DeviceIndex, EventHandlerLock<raw::RawDevice>> _waiters;
 
+        const std::chrono::milliseconds _connection_debounce;
+        std::mutex _debounce_mutex;
+        // Latest event per index while its debounce timer is armed
+        std::map<hidpp::DeviceIndex, hidpp::DeviceConnectionEvent> _pending_connections;
+
+        // Queued connection work is dropped with the monitor
+        task_set _tasks;
+
     public:
         template<typename T, typename... Args>
         static std::shared_ptr<T> make(Args... args) {
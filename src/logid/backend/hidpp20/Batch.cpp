@@ -0,0 +1,107 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <backend/hidpp20/Batch.h>
+#include <backend/hidpp20/Device.h>
+#include <backend/Error.h>
+#include <mutex>
+#include <condition_variable>
+
+using namespace logid::backend;
+using namespace logid::backend::hidpp20;
+
+static thread_local Batch* open_batch = nullptr;
+
+Batch::Batch(Device* device) : _device(device), _previous(open_batch) {
+    open_batch = this;
+}
+
+Batch::~Batch() {
+    open_batch = _previous;
+}
+
+Batch* Batch::current(const Device* device) {
+    for (auto batch = open_batch; batch; batch = batch->_previous) {
+        if (batch->_device == device)
+            return batch;
+    }
+
+    return nullptr;
+}
+
+void Batch::add(uint8_t feature_index, uint8_t function, std::vector<uint8_t> params,
+                std::function<void()> acked) {
+    _writes.push_back({feature_index, function, std::move(params), std::move(acked)});
+}
+
+void Batch::commit() {
+    if (_writes.empty())
+        return;
+
+    /* Shared with the callbacks, which may outlive a timed out commit */
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::size_t remaining;
+        std::exception_ptr error;
+    };
+
+    auto state = std::make_shared<State>();
+    state->remaining = _writes.size();
+
+    auto done = [state](std::exception_ptr error) {
+        std::lock_guard lock(state->mutex);
+        if (error && !state->error)
+            state->error = error;
+        --state->remaining;
+        state->cv.notify_all();
+    };
+
+    std::vector<Write> writes;
+    writes.swap(_writes);
+
+    for (auto& write: writes) {
+        /* Callbacks run in place on the I/O thread, so waiting here never
+         * depends on a free worker. */
+        _device->_sendReportAsync(
+                Device::_makeRequest(_device->deviceIndex(), write.feature_index,
+                                     write.function, write.params),
+                [done, acked = std::move(write.acked)](const Device::Response& response) {
+                    if (std::holds_alternative<hidpp::Report::Hidpp20Error>(response)) {
+                        auto e = std::get<hidpp::Report::Hidpp20Error>(response);
+                        done(std::make_exception_ptr(Error(e.error_code, e.device_index)));
+                    } else {
+                        if (acked)
+                            acked();
+                        done(nullptr);
+                    }
+                }, done, true);
+    }
+
+    /* Each write has its own timeout once it gets a sw id, in the worst case
+     * they get one after the other. */
+    std::unique_lock lock(state->mutex);
+    bool finished = state->cv.wait_for(
+            lock, _device->io_timeout * writes.size(),
+            [&state]() { return state->remaining == 0; });
+
+    if (!finished)
+        throw TimeoutError();
+
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_BACKEND_HIDPP20_BATCH_H
+#define LOGID_BACKEND_HIDPP20_BATCH_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace logid::backend::hidpp20 {
+    class Device;
+
+    /* While a batch is open on a thread, writes made through
+     * Feature::writeFunction on its device are queued instead of sent.
+     * commit() then sends them all at once using tagged requests and waits
+     * for every response, so N writes cost about one round trip.
+     *
+     * Uncommitted writes are dropped when the batch is destroyed. */
+    class Batch {
+    public:
+        explicit Batch(Device* device);
+
+        ~Batch();
+
+        Batch(const Batch&) = delete;
+
+        Batch(Batch&&) = delete;
+
+        Batch& operator=(const Batch&) = delete;
+
+        Batch& operator=(Batch&&) = delete;
+
+        // Throws the first error after all writes have completed
+        void commit();
+
+        /* acked is run on the I/O thread once the device accepts the write */
+        void add(uint8_t feature_index, uint8_t function, std::vector<uint8_t> params,
+                 std::function<void()> acked = {});
+
+        // Returns the innermost open batch for device on this thread, if any
+        [[nodiscard]] static Batch* current(const Device* device);
+
+    private:
+        struct Write {
+            uint8_t feature_index;
+            uint8_t function;
+            std::vector<uint8_t> params;
+            std::function<void()> acked;
+        };
+
+        Device* const _device;
+        Batch* const _previous;
+        std::vector<Write> _writes;
+    };
+}
+
+#endif //LOGID_BACKEND_HIDPP20_BATCH_H
@@ -20,6 +20,14 @@
 #include <backend/hidpp20/Device.h>
 #include <backend/Error.h>
 #include <backend/hidpp10/Receiver.h>
+#include <backend/hidpp20/features/FeatureSet.h>
+#include <backend/hidpp20/features/Root.h>
+#include <util/task.h>
+#include <util/trace.h>
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <condition_variable>
 
 using namespace logid::backend;
 using namespace logid::backend::hidpp20;
@@ -44,8 +52,12 @@ Device::Device(const std::shared_ptr<hidpp10::Receiver>& receiver,
         : hidpp::Device(receiver, index, timeout) {
 }
 
-std::vector<uint8_t> Device::callFunction(uint8_t feature_index,
-                                          uint8_t function, std::vector<uint8_t>& params) {
+Device::~Device() {
+    _releaseRawHandler();
+}
+
+hidpp::Report Device::_makeRequest(hidpp::DeviceIndex index, uint8_t feature_index,
+                                   uint8_t function, std::span<const uint8_t> params) {
     hidpp::Report::Type type;
 
     assert(params.size() <= hidpp::LongParamLength);
@@ -56,65 +68,452 @@ std::vector<uint8_t> Device::callFunction(uint8_t feature_index,
     else
         throw hidpp::Report::InvalidReportID();
 
-    hidpp::Report request(type, deviceIndex(), feature_index, function,
-                          hidpp::softwareID);
+    hidpp::Report request(type, index, feature_index, function, hidpp::softwareID);
     std::copy(params.begin(), params.end(), request.paramBegin());
 
-    auto response = this->sendReport(request);
+    return request;
+}
+
+std::vector<uint8_t> Device::callFunction(uint8_t feature_index,
+                                          uint8_t function, std::vector<uint8_t>& params) {
+    auto response = callFunction(feature_index, function, std::span<const uint8_t>(params));
     return {response.paramBegin(), response.paramEnd()};
 }
 
+hidpp::Report Device::callFunction(uint8_t feature_index, uint8_t function,
+                                   std::span<const uint8_t> params) {
+    return this->sendReport(_makeRequest(deviceIndex(), feature_index, function, params));
+}
+
+Result<hidpp::Report> Device::tryCallFunction(uint8_t feature_index, uint8_t function,
+                                              std::span<const uint8_t> params) {
+    return this->trySendReport(_makeRequest(deviceIndex(), feature_index, function, params));
+}
+
+void Device::callFunction(uint8_t feature_index, uint8_t function,
+                          std::vector<uint8_t>& params,
+                          ResponseCallback callback, ErrorCallback error) {
+    _sendReportAsync(
+            _makeRequest(deviceIndex(), feature_index, function, params),
+            [callback = std::move(callback), error](Response response) {
+                if (std::holds_alternative<hidpp::Report>(response)) {
+                    auto& report = std::get<hidpp::Report>(response);
+                    callback({report.paramBegin(), report.paramEnd()});
+                } else if (error) {
+                    auto e = std::get<hidpp::Report::Hidpp20Error>(response);
+                    error(std::make_exception_ptr(Error(e.error_code, e.device_index)));
+                }
+            }, error);
+}
+
 void Device::callFunctionNoResponse(uint8_t feature_index, uint8_t function,
                                     std::vector<uint8_t>& params) {
-    hidpp::Report::Type type;
+    this->sendReportNoACK(_makeRequest(deviceIndex(), feature_index, function, params));
+}
 
-    assert(params.size() <= hidpp::LongParamLength);
-    if (params.size() <= hidpp::ShortParamLength)
-        type = hidpp::Report::Type::Short;
-    else if (params.size() <= hidpp::LongParamLength)
-        type = hidpp::Report::Type::Long;
+std::vector<uint8_t> Device::_shadowKey(uint8_t feature_index, uint8_t function,
+                                       const std::vector<uint8_t>& params,
+                                       std::size_t key_length) {
+    std::vector<uint8_t> key {feature_index, function};
+    key.insert(key.end(), params.begin(),
+               params.begin() + (long) std::min(key_length, params.size()));
+    return key;
+}
+
+bool Device::shadowMatches(uint8_t feature_index, uint8_t function,
+                           const std::vector<uint8_t>& params,
+                           std::size_t key_length) const {
+    std::lock_guard<std::mutex> lock(_shadow_mutex);
+    auto it = _shadow.find(_shadowKey(feature_index, function, params, key_length));
+    return it != _shadow.end() && it->second.params == params;
+}
+
+void Device::shadowStore(uint8_t feature_index, uint8_t function,
+                         const std::vector<uint8_t>& params, std::size_t key_length,
+                         std::optional<uint8_t> readback, std::size_t readback_length) {
+    std::lock_guard<std::mutex> lock(_shadow_mutex);
+    _shadow[_shadowKey(feature_index, function, params, key_length)] = {
+            params, key_length, readback, readback_length};
+}
+
+void Device::invalidateShadow() {
+    std::lock_guard<std::mutex> lock(_shadow_mutex);
+    _shadow.clear();
+}
+
+void Device::invalidateShadow(uint8_t feature_index) {
+    std::lock_guard<std::mutex> lock(_shadow_mutex);
+    std::erase_if(_shadow, [feature_index](const auto& entry) {
+        return entry.first.front() == feature_index;
+    });
+}
+
+std::optional<uint8_t> Device::cachedFeatureIndex(uint16_t feature_id) const {
+    std::lock_guard<std::mutex> lock(_feature_index_mutex);
+    auto it = _feature_indexes.find(feature_id);
+    if (it == _feature_indexes.end()) {
+        if (_feature_table_complete)
+            return 0;
+        return {};
+    }
+    return it->second;
+}
+
+void Device::cacheFeatureIndex(uint16_t feature_id, uint8_t index) {
+    std::lock_guard<std::mutex> lock(_feature_index_mutex);
+    _feature_indexes[feature_id] = index;
+}
+
+Result<uint8_t> Device::tryFeatureIndex(uint16_t feature_id) {
+    if (auto cached = cachedFeatureIndex(feature_id))
+        return cached.value();
+
+    char span_name[16];
+    snprintf(span_name, sizeof(span_name), "lookup %04x", feature_id);
+    hidpp::ScopedSpan span(this, span_name);
+
+    const std::array<uint8_t, 2> params = {
+            static_cast<uint8_t>((feature_id >> 8) & 0xff),
+            static_cast<uint8_t>(feature_id & 0xff)};
+
+    auto response = tryCallFunction(FeatureID::ROOT, Root::GetFeature, params);
+    uint8_t index;
+    if (response)
+        index = response->paramBegin()[0];
+    else if (response.error().is(RequestError::Hidpp20, Error::InvalidFeatureIndex))
+        index = 0;
     else
-        throw hidpp::Report::InvalidReportID();
+        return response.error();
 
-    hidpp::Report request(type, deviceIndex(), feature_index, function, hidpp::softwareID);
-    std::copy(params.begin(), params.end(), request.paramBegin());
+    cacheFeatureIndex(feature_id, index);
+    return index;
+}
+
+bool Device::featureSupported(uint16_t feature_id) const {
+    auto index = cachedFeatureIndex(feature_id);
+    return !index.has_value() || index.value() != 0;
+}
+
+std::vector<uint8_t> Device::callStaticFunction(uint8_t feature_index, uint8_t function,
+                                                std::vector<uint8_t>& params) {
+    auto key = _shadowKey(feature_index, function, params, params.size());
+    {
+        std::lock_guard<std::mutex> lock(_static_mutex);
+        auto it = _static_responses.find(key);
+        if (it != _static_responses.end())
+            return it->second;
+    }
+
+    auto response = callFunction(feature_index, function, params);
+
+    std::lock_guard<std::mutex> lock(_static_mutex);
+    _static_responses[key] = response;
+    return response;
+}
+
+std::optional<Device::Capabilities> Device::capabilities() const {
+    Capabilities capabilities;
+    {
+        std::lock_guard<std::mutex> lock(_feature_index_mutex);
+        if (!_feature_table_complete)
+            return {};
+        for (auto& feature: _feature_indexes) {
+            if (feature.second)
+                capabilities.features.insert(feature);
+        }
+    }
 
-    this->sendReportNoACK(request);
+    std::lock_guard<std::mutex> lock(_static_mutex);
+    capabilities.responses = _static_responses;
+    return capabilities;
 }
 
-hidpp::Report Device::sendReport(const hidpp::Report& report) {
-    auto& response_slot = _responses[report.feature() % _responses.size()];
+void Device::loadCapabilities(const Capabilities& capabilities) {
+    {
+        std::lock_guard<std::mutex> lock(_feature_index_mutex);
+        for (auto& feature: capabilities.features)
+            _feature_indexes[feature.first] = feature.second;
+        _feature_table_complete = true;
+    }
+
+    std::lock_guard<std::mutex> lock(_static_mutex);
+    for (auto& response: capabilities.responses)
+        _static_responses.insert(response);
+}
+
+bool Device::enumerateFeatures() {
+    uint8_t feature_set_index;
+    uint8_t count;
+
+    try {
+        FeatureSet feature_set(this);
+        feature_set_index = feature_set.featureIndex();
+        count = feature_set.getFeatureCount();
+    } catch (UnsupportedFeature& e) {
+        return false;
+    }
+
+    /* Shared with the callbacks, which may outlive a timed out enumeration */
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::size_t remaining;
+        std::exception_ptr error;
+        std::vector<uint16_t> ids;
+    };
+
+    auto state = std::make_shared<State>();
+    state->remaining = count;
+    state->ids.resize(count + 1);
+
+    auto done = [state](std::exception_ptr error) {
+        std::lock_guard lock(state->mutex);
+        if (error && !state->error)
+            state->error = error;
+        --state->remaining;
+        state->cv.notify_all();
+    };
+
+    /* The count excludes the root feature, which is always at index 0 */
+    for (uint16_t i = 1; i <= count; ++i) {
+        std::vector<uint8_t> params {static_cast<uint8_t>(i)};
+        _sendReportAsync(
+                _makeRequest(deviceIndex(), feature_set_index, FeatureSet::GetFeature, params),
+                [state, done, i](const Response& response) {
+                    if (std::holds_alternative<hidpp::Report::Hidpp20Error>(response)) {
+                        auto e = std::get<hidpp::Report::Hidpp20Error>(response);
+                        done(std::make_exception_ptr(Error(e.error_code, e.device_index)));
+                    } else {
+                        auto params = std::get<hidpp::Report>(response).paramBegin();
+                        {
+                            std::lock_guard lock(state->mutex);
+                            state->ids[i] = (params[0] << 8) | params[1];
+                        }
+                        done(nullptr);
+                    }
+                }, done, true);
+    }
+
+    std::unique_lock lock(state->mutex);
+    bool finished = state->cv.wait_for(
+            lock, ioTimeout() * std::max<std::size_t>(count, 1),
+            [&state]() { return state->remaining == 0; });
+
+    if (!finished)
+        throw TimeoutError();
+
+    if (state->error)
+        std::rethrow_exception(state->error);
+
+    std::lock_guard<std::mutex> index_lock(_feature_index_mutex);
+    for (uint16_t i = 1; i <= count; ++i)
+        _feature_indexes[state->ids[i]] = i;
+    _feature_table_complete = true;
+
+    return true;
+}
+
+bool Device::verifyShadow() {
+    std::optional<std::pair<std::vector<uint8_t>, ShadowEntry>> probe;
+    {
+        std::lock_guard<std::mutex> lock(_shadow_mutex);
+        for (auto& entry: _shadow) {
+            if (entry.second.readback.has_value()) {
+                probe = entry;
+                break;
+            }
+        }
+    }
+
+    if (!probe)
+        return false;
+
+    auto& [key, entry] = probe.value();
+    // The key is the feature index and function followed by the selector params
+    std::vector<uint8_t> params(key.begin() + 2, key.end());
+
+    try {
+        auto response = callFunction(key[0], entry.readback.value(), params);
+        auto length = std::min(entry.readback_length, entry.params.size());
+        return response.size() >= length &&
+               std::equal(entry.params.begin(), entry.params.begin() + (long) length,
+                          response.begin());
+    } catch (std::exception& e) {
+        return false;
+    }
+}
+
+std::optional<uint8_t> Device::_allocSwId() {
+    /* Round-robin so a late response to a timed out request is unlikely
+     * to be matched to a newer one. */
+    for (std::size_t i = 0; i < _responses.size(); ++i) {
+        uint8_t sw_id = _next_sw_id;
+        _next_sw_id = (_next_sw_id + 1) % _responses.size();
+
+        if (sw_id == 0 || sw_id == hidpp::noAckSoftwareID)
+            continue;
+
+        if (!_responses[sw_id].sw_id.has_value())
+            return sw_id;
+    }
+
+    return {};
+}
+
+Result<hidpp::Report> Device::trySendReport(const hidpp::Report& report) {
+    if (linkDown())
+        return RequestError{RequestError::Timeout};
 
     std::unique_lock<std::mutex> response_lock(_response_mutex);
-    _response_cv.wait(response_lock, [&response_slot]() {
-        return !response_slot.feature.has_value();
+
+    std::optional<uint8_t> sw_id;
+    _response_cv.wait(response_lock, [this, &sw_id]() {
+        return (sw_id = _allocSwId()).has_value();
     });
 
+    auto& response_slot = _responses[sw_id.value()];
+    response_slot.sw_id = sw_id;
     response_slot.feature = report.feature();
+    response_slot.function = report.function();
 
-    _sendReport(report);
+    hidpp::Report tagged_report(report);
+    tagged_report.setSwId(sw_id.value());
+    response_slot.sent = std::chrono::steady_clock::now();
+    LOGID_TRACE(hidpp_send_begin, this, report.deviceIndex(), report.feature(), report.function());
+    requestStarted();
+    try {
+        _sendReport(std::move(tagged_report));
+    } catch (...) {
+        requestFinished();
+        response_slot.reset();
+        _startPending();
+        _response_cv.notify_all();
+        throw;
+    }
 
     bool valid = _response_cv.wait_for(
-            response_lock, io_timeout,
+            response_lock, ioTimeout(),
             [&response_slot]() {
                 return response_slot.response.has_value();
             });
+    requestFinished();
+    LOGID_TRACE(hidpp_send_end, this, valid);
 
     if (!valid) {
         response_slot.reset();
-        throw TimeoutError();
+        _startPending();
+        _response_cv.notify_all();
+        roundTripTimedOut();
+        return RequestError{RequestError::Timeout};
     }
 
     assert(response_slot.response.has_value());
     auto response = response_slot.response.value();
     response_slot.reset();
+    // Hand the sw id to any sender waiting for a free one
+    _startPending();
+    _response_cv.notify_all();
 
     if (std::holds_alternative<hidpp::Report>(response)) {
         return std::get<hidpp::Report>(response);
     } else { // if(std::holds_alternative<Error::ErrorCode>(response))
         auto error = std::get<hidpp::Report::Hidpp20Error>(response);
-        throw Error(error.error_code, error.device_index);
+        return RequestError{RequestError::Hidpp20, error.error_code, error.device_index};
+    }
+}
+
+void Device::_sendReportAsync(hidpp::Report report, AsyncHandler callback,
+                              ErrorCallback error, bool direct) {
+    if (linkDown()) {
+        // Fails like a timeout would, without waiting for it
+        if (error && direct)
+            error(std::make_exception_ptr(TimeoutError()));
+        else if (error)
+            run_task([error]() { error(std::make_exception_ptr(TimeoutError())); });
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_response_mutex);
+
+    AsyncRequest request {std::move(report), std::move(callback), std::move(error), direct};
+
+    /* Don't overtake requests that are already waiting */
+    std::optional<uint8_t> sw_id;
+    if (_pending_async.empty())
+        sw_id = _allocSwId();
+
+    if (sw_id)
+        _startAsync(sw_id.value(), std::move(request));
+    else
+        _pending_async.push_back(std::move(request));
+}
+
+void Device::_startAsync(uint8_t sw_id, AsyncRequest request) {
+    auto& response_slot = _responses[sw_id];
+    response_slot.sw_id = sw_id;
+    response_slot.feature = request.report.feature();
+    response_slot.function = request.report.function();
+    response_slot.callback = std::move(request.callback);
+    response_slot.error = std::move(request.error);
+    response_slot.direct = request.direct;
+    auto generation = ++response_slot.generation;
+
+    request.report.setSwId(sw_id);
+    response_slot.sent = std::chrono::steady_clock::now();
+    LOGID_TRACE(hidpp_send_begin, this, request.report.deviceIndex(), request.report.feature(),
+                request.report.function());
+    requestStarted();
+    try {
+        _sendReport(std::move(request.report));
+    } catch (...) {
+        requestFinished();
+        auto error = std::move(response_slot.error);
+        bool direct = response_slot.direct;
+        response_slot.reset();
+        if (error && direct)
+            error(std::current_exception());
+        else if (error)
+            run_task([error, e = std::current_exception()]() { error(e); });
+        return;
     }
+
+    response_slot.timeout = run_task_after([self_weak = self<Device>(), sw_id, generation]() {
+        if (auto self = self_weak.lock())
+            self->_asyncTimeout(sw_id, generation);
+    }, ioTimeout());
+}
+
+void Device::_startPending() {
+    std::optional<uint8_t> sw_id;
+    while (!_pending_async.empty() && (sw_id = _allocSwId())) {
+        auto request = std::move(_pending_async.front());
+        _pending_async.pop_front();
+        _startAsync(sw_id.value(), std::move(request));
+    }
+}
+
+void Device::_asyncTimeout(uint8_t sw_id, std::size_t generation) {
+    ErrorCallback error;
+    {
+        std::lock_guard<std::mutex> lock(_response_mutex);
+        auto& response_slot = _responses[sw_id];
+
+        // Already answered, the sw id may have been reused since
+        if (response_slot.generation != generation || !response_slot.callback)
+            return;
+
+        error = std::move(response_slot.error);
+        response_slot.reset();
+        requestFinished();
+        _startPending();
+        _response_cv.notify_all();
+    }
+
+    LOGID_TRACE(hidpp_send_end, this, false);
+    roundTripTimedOut();
+
+    if (error)
+        error(std::make_exception_ptr(TimeoutError()));
 }
 
 void Device::sendReportNoACK(const hidpp::Report& report) {
@@ -123,10 +522,9 @@ void Device::sendReportNoACK(const hidpp::Report& report) {
     _sendReport(std::move(no_ack_report));
 }
 
-bool Device::responseReport(const hidpp::Report& report) {
-    auto& response_slot = _responses[report.feature() % _responses.size()];
+bool Device::responseReport(hidpp::ReportView report) {
     std::lock_guard<std::mutex> lock(_response_mutex);
-    uint8_t sw_id, feature;
+    uint8_t sw_id, feature, function;
 
     bool is_error = false;
     hidpp::Report::Hidpp20Error hidpp20_error{};
@@ -134,29 +532,105 @@ bool Device::responseReport(const hidpp::Report& report) {
         is_error = true;
         sw_id = hidpp20_error.software_id;
         feature = hidpp20_error.feature_index;
+        function = hidpp20_error.function;
     } else {
         sw_id = report.swId();
         feature = report.feature();
+        function = report.function();
     }
 
-    if (sw_id != hidpp::softwareID)
+    if (sw_id == 0 || sw_id >= _responses.size())
         return false;
 
-    if (!response_slot.feature || response_slot.feature.value() != feature) {
+    // Only a reply echoing the outstanding request's tag answers it
+    auto& response_slot = _responses[sw_id];
+    if (response_slot.sw_id != sw_id || response_slot.feature != feature ||
+        response_slot.function != function) {
         return false;
     }
 
-    if (is_error) {
-        response_slot.response = hidpp20_error;
+    // Already answered, e.g. a duplicate report
+    if (response_slot.response.has_value())
+        return true;
+
+    Response response = is_error ? Response(hidpp20_error) : Response(hidpp::Report(report.rawReport()));
+    sampleRoundTrip(std::chrono::steady_clock::now() - response_slot.sent);
+    if (is_error)
+        errorReceived(true);
+
+    if (response_slot.callback) {
+        /* Don't run feature code on the I/O thread */
+        if (response_slot.direct)
+            response_slot.callback(response);
+        else
+            run_task([callback = std::move(response_slot.callback), response]() {
+                callback(response);
+            });
+        response_slot.reset();
+        requestFinished();
+        LOGID_TRACE(hidpp_send_end, this, true);
+        _startPending();
     } else {
-        response_slot.response = report;
+        response_slot.response = response;
     }
 
     _response_cv.notify_all();
     return true;
 }
 
+EventHandlerLock<hidpp::Device> Device::addEventRoute(
+        uint8_t feature_index, uint8_t function,
+        std::function<void(hidpp::ReportView)> callback, std::source_location location) {
+    assert(function < std::tuple_size_v<decltype(EventRoutes::lists)>);
+
+    std::lock_guard lock(_event_routes_mutex);
+    auto routes = _event_routes[feature_index].load(std::memory_order_relaxed);
+    if (!routes) {
+        auto& storage = _event_route_storage.emplace_back(std::make_unique<EventRoutes>());
+        routes = storage.get();
+        _event_routes[feature_index].store(routes, std::memory_order_release);
+    }
+
+    auto& list = routes->owners[function];
+    if (!list) {
+        list = std::make_shared<EventHandlerList<hidpp::Device>>();
+        routes->lists[function].store(list.get(), std::memory_order_release);
+    }
+
+    return hidpp::Device::addEventHandler(list, {{}, std::move(callback)}, location);
+}
+
+std::size_t Device::handlerFootprint() const {
+    auto bytes = hidpp::Device::handlerFootprint() + sizeof(_event_routes);
+    std::lock_guard lock(_event_routes_mutex);
+    for (auto& routes: _event_route_storage) {
+        bytes += sizeof(EventRoutes);
+        for (auto& list: routes->owners)
+            if (list)
+                bytes += list->footprint();
+    }
+    return bytes;
+}
+
+void Device::dispatchEvent(hidpp::ReportView report) {
+    if (auto routes = _event_routes[report.feature()].load(std::memory_order_acquire)) {
+        auto list = routes->lists[report.function()].load(std::memory_order_acquire);
+        if (list)
+            list->run_all(report);
+    }
+
+    // Handlers not bound to one feature event
+    hidpp::Device::dispatchEvent(report);
+}
+
 void Device::ResponseSlot::reset() {
+    timeout.cancel();
+    timeout = {};
     response.reset();
+    sw_id.reset();
     feature.reset();
+    function.reset();
+    callback = nullptr;
+    error = nullptr;
+    direct = false;
 }
@@ -22,24 +22,121 @@
 #include <cstdint>
 #include <optional>
 #include <variant>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <map>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <span>
 #include <backend/hidpp20/Error.h>
 #include <backend/hidpp/Device.h>
+#include <util/task.h>
 
 namespace logid::backend::hidpp20 {
+    class Batch;
+
     class Device : public hidpp::Device {
+        friend class Batch;
     public:
+        ~Device() override;
+
+        typedef std::function<void(std::vector<uint8_t>)> ResponseCallback;
+        typedef std::function<void(std::exception_ptr)> ErrorCallback;
+
         std::vector<uint8_t> callFunction(uint8_t feature_index,
                                           uint8_t function,
                                           std::vector<uint8_t>& params);
 
+        /* Same as above without touching the allocator, the response
+         * params are read from the returned report. */
+        hidpp::Report callFunction(uint8_t feature_index,
+                                   uint8_t function,
+                                   std::span<const uint8_t> params);
+
+        // A timeout or error response is returned instead of thrown
+        [[nodiscard]] Result<hidpp::Report> tryCallFunction(uint8_t feature_index,
+                                                           uint8_t function,
+                                                           std::span<const uint8_t> params);
+
+        /* Returns immediately, the callbacks are run on a worker thread once
+         * the response, an error or a timeout arrives. */
+        void callFunction(uint8_t feature_index,
+                          uint8_t function,
+                          std::vector<uint8_t>& params,
+                          ResponseCallback callback,
+                          ErrorCallback error = {});
+
         void callFunctionNoResponse(uint8_t feature_index,
                                     uint8_t function,
                                     std::vector<uint8_t>& params);
 
-        hidpp::Report sendReport(const hidpp::Report& report) final;
+        /* Shadow of the last acknowledged writes, used to skip redundant ones.
+         * The first key_length params select which state a write replaces. */
+        [[nodiscard]] bool shadowMatches(uint8_t feature_index, uint8_t function,
+                                         const std::vector<uint8_t>& params,
+                                         std::size_t key_length) const;
+
+        void shadowStore(uint8_t feature_index, uint8_t function,
+                         const std::vector<uint8_t>& params, std::size_t key_length,
+                         std::optional<uint8_t> readback, std::size_t readback_length);
+
+        void invalidateShadow();
+
+        // Drops the writes to one feature, e.g. for state the device changed itself
+        void invalidateShadow(uint8_t feature_index);
+
+        /* Feature ID to index lookups resolved so far, 0 if unsupported */
+        [[nodiscard]] std::optional<uint8_t> cachedFeatureIndex(uint16_t feature_id) const;
+
+        void cacheFeatureIndex(uint16_t feature_id, uint8_t index);
+
+        /* Cached, or asked of the device and cached. 0 if unsupported, an
+         * absent feature is not an error. */
+        [[nodiscard]] Result<uint8_t> tryFeatureIndex(uint16_t feature_id);
+
+        /* Reads the whole feature table at once with pipelined FeatureSet
+         * requests. Returns false if the device has no FeatureSet. */
+        bool enumerateFeatures();
+
+        /* Only false once the feature table is known to lack the feature */
+        [[nodiscard]] bool featureSupported(uint16_t feature_id) const;
+
+        /* For functions whose response only describes the hardware, those
+         * never change for a given firmware and are only read once. */
+        std::vector<uint8_t> callStaticFunction(uint8_t feature_index,
+                                                uint8_t function,
+                                                std::vector<uint8_t>& params);
+
+        /* What discovery learned about the device, see CapabilityCache */
+        struct Capabilities {
+            std::map<uint16_t, uint8_t> features;
+            std::map<std::vector<uint8_t>, std::vector<uint8_t>> responses;
+        };
+
+        /* Empty until the whole feature table is known */
+        [[nodiscard]] std::optional<Capabilities> capabilities() const;
+
+        void loadCapabilities(const Capabilities& capabilities);
+
+        /* Reads back one shadowed state to check the device still holds it.
+         * Returns false if nothing can be verified this way. */
+        bool verifyShadow();
+
+        [[nodiscard]] Result<hidpp::Report> trySendReport(const hidpp::Report& report) final;
 
         void sendReportNoACK(const hidpp::Report& report) final;
 
+        /* Handles one event of a feature, found with a table lookup instead
+         * of testing the condition of every handler on the device. */
+        EventHandlerLock<hidpp::Device> addEventRoute(
+                uint8_t feature_index, uint8_t function,
+                std::function<void(hidpp::ReportView)> callback,
+                std::source_location location = std::source_location::current());
+
+        [[nodiscard]] std::size_t handlerFootprint() const final;
+
     protected:
         Device(const std::string& path, hidpp::DeviceIndex index,
                const std::shared_ptr<raw::DeviceMonitor>& monitor, double timeout);
@@ -53,23 +150,116 @@ namespace logid::backend::hidpp20 {
         Device(const std::shared_ptr<hidpp10::Receiver>& receiver,
                hidpp::DeviceIndex index, double timeout);
 
-        bool responseReport(const hidpp::Report& report) final;
+        bool responseReport(hidpp::ReportView report) final;
+
+        void dispatchEvent(hidpp::ReportView report) final;
 
     private:
         typedef std::variant<hidpp::Report, hidpp::Report::Hidpp20Error> Response;
+        typedef std::function<void(Response)> AsyncHandler;
+
+        static hidpp::Report _makeRequest(hidpp::DeviceIndex index, uint8_t feature_index,
+                                          uint8_t function, std::span<const uint8_t> params);
+
         struct ResponseSlot {
             std::optional<Response> response;
+            // The tag the outstanding request went out with
+            std::optional<uint8_t> sw_id;
             std::optional<uint8_t> feature;
+            std::optional<uint8_t> function;
+            /* Set for async requests, nobody waits on the slot for these */
+            AsyncHandler callback;
+            ErrorCallback error;
+            /* Run callbacks in place (e.g. on the I/O thread), they must be trivial */
+            bool direct = false;
+            std::chrono::steady_clock::time_point sent;
+            std::size_t generation = 0;
+            // Async timeout, cancelled once the slot is answered
+            task_handle timeout;
             void reset();
         };
 
-        /* Multiplex responses on lower nibble of SubID, ignore upper nibble for space */
+        struct AsyncRequest {
+            hidpp::Report report;
+            AsyncHandler callback;
+            ErrorCallback error;
+            bool direct;
+        };
+
+        void _sendReportAsync(hidpp::Report report, AsyncHandler callback,
+                              ErrorCallback error, bool direct = false);
+
+        /* Must be called with _response_mutex held */
+        std::optional<uint8_t> _allocSwId();
+
+        void _startAsync(uint8_t sw_id, AsyncRequest request);
+
+        void _startPending();
+
+        void _asyncTimeout(uint8_t sw_id, std::size_t generation);
+
+        /* Software IDs tag outstanding requests, so that responses are matched
+         * by (feature, function, sw id) and several requests can be in flight.
+         * 0 is used by notifications and noAckSoftwareID is never tagged. */
         std::array<ResponseSlot, 16> _responses;
+        uint8_t _next_sw_id = hidpp::softwareID;
+
+        /* Async requests waiting for a free sw id */
+        std::deque<AsyncRequest> _pending_async;
+
+        struct ShadowEntry {
+            std::vector<uint8_t> params;
+            std::size_t key_length;
+            std::optional<uint8_t> readback;
+            std::size_t readback_length;
+        };
+
+        static std::vector<uint8_t> _shadowKey(uint8_t feature_index, uint8_t function,
+                                               const std::vector<uint8_t>& params,
+                                               std::size_t key_length);
+
+        mutable std::mutex _shadow_mutex;
+        std::map<std::vector<uint8_t>, ShadowEntry> _shadow;
+
+        /* The feature table is fixed by the firmware, so this is never cleared */
+        mutable std::mutex _feature_index_mutex;
+        std::map<uint16_t, uint8_t> _feature_indexes;
+        bool _feature_table_complete = false;
+
+        /* A feature's routes by function. Only functions something listens
+         * to get a list, most features send one or two events at most. */
+        struct EventRoutes {
+            std::array<std::atomic<EventHandlerList<hidpp::Device>*>, 16> lists{};
+            // Own lists, only touched with _event_routes_mutex held
+            std::array<std::shared_ptr<EventHandlerList<hidpp::Device>>, 16> owners;
+        };
+
+        /* Indexed by feature index then function, routes are allocated on
+         * first use and live as long as the device. */
+        std::array<std::atomic<EventRoutes*>, 256> _event_routes{};
+        mutable std::mutex _event_routes_mutex;
+        std::vector<std::unique_ptr<EventRoutes>> _event_route_storage;
+
+        mutable std::mutex _static_mutex;
+        std::map<std::vector<uint8_t>, std::vector<uint8_t>> _static_responses;
 
     public:
+        /* Like make, but leaves the version check to the caller so that a
+         * probe can become the final device instead of being rebuilt. */
+        template <typename... Args>
+        static std::shared_ptr<Device> probe(Args... args) {
+            return makeDerived<Device>(std::forward<Args>(args)...);
+        }
+
+        /* Like probe, but reports expected failures instead of throwing */
+        template <typename... Args>
+        static Result<std::shared_ptr<Device>> tryProbe(Args... args) {
+            return tryMakeDerived<Device>(std::forward<Args>(args)...);
+        }
+
         template <typename... Args>
         static std::shared_ptr<Device> make(Args... args) {
-            auto device = makeDerived<Device>(std::forward<Args>(args)...);
+            auto device = probe(std::forward<Args>(args)...);
 
             if (std::get<0>(device->version()) < 2)
                 throw std::invalid_argument("not a hid++ 2.0 device");
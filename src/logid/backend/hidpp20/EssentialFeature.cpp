@@ -22,10 +22,16 @@
 #include <backend/hidpp20/Error.h>
 #include <cassert>
 
+using namespace logid::backend;
 using namespace logid::backend::hidpp20;
 
 std::vector<uint8_t> EssentialFeature::callFunction(uint8_t function_id,
                                                     std::vector<uint8_t>& params) {
+    return tryCallFunction(function_id, params).value();
+}
+
+Result<std::vector<uint8_t>> EssentialFeature::tryCallFunction(
+        uint8_t function_id, const std::vector<uint8_t>& params) {
     hidpp::Report::Type type;
 
     assert(params.size() <= hidpp::LongParamLength);
@@ -39,8 +45,10 @@ std::vector<uint8_t> EssentialFeature::callFunction(uint8_t function_id,
     hidpp::Report request(type, _device->deviceIndex(), _index, function_id, hidpp::softwareID);
     std::copy(params.begin(), params.end(), request.paramBegin());
 
-    auto response = _device->sendReport(request);
-    return {response.paramBegin(), response.paramEnd()};
+    auto response = _device->trySendReport(request);
+    if (!response)
+        return response.error();
+    return std::vector<uint8_t>(response->paramBegin(), response->paramEnd());
 }
 
 EssentialFeature::EssentialFeature(hidpp::Device* dev, uint16_t _id) :
@@ -40,6 +40,9 @@ namespace logid::backend::hidpp20 {
         std::vector<uint8_t> callFunction(uint8_t function_id,
                                           std::vector<uint8_t>& params);
 
+        [[nodiscard]] Result<std::vector<uint8_t>> tryCallFunction(
+                uint8_t function_id, const std::vector<uint8_t>& params);
+
         hidpp::Device* const _device;
         uint8_t _index;
     };
@@ -18,8 +18,10 @@
 
 #include <backend/hidpp20/Feature.h>
 #include <backend/hidpp20/Device.h>
-#include <backend/hidpp20/features/Root.h>
+#include <backend/hidpp20/Batch.h>
+#include <backend/hidpp20/feature_defs.h>
 
+using namespace logid::backend;
 using namespace logid::backend::hidpp20;
 
 const char* UnsupportedFeature::what() const noexcept {
@@ -35,27 +37,69 @@ std::vector<uint8_t> Feature::callFunction(uint8_t function_id,
     return _device->callFunction(_index, function_id, params);
 }
 
+hidpp::Report Feature::callFunction(uint8_t function_id, std::span<const uint8_t> params) {
+    return _device->callFunction(_index, function_id, params);
+}
+
+void Feature::callFunction(uint8_t function_id, std::vector<uint8_t>& params,
+                           std::function<void(std::vector<uint8_t>)> callback,
+                           std::function<void(std::exception_ptr)> error) {
+    _device->callFunction(_index, function_id, params,
+                          std::move(callback), std::move(error));
+}
+
 void Feature::callFunctionNoResponse(uint8_t function_id,
                                      std::vector<uint8_t>& params) {
     _device->callFunctionNoResponse(_index, function_id, params);
 }
 
+std::vector<uint8_t> Feature::callStaticFunction(uint8_t function_id,
+                                                 std::vector<uint8_t>& params) {
+    return _device->callStaticFunction(_index, function_id, params);
+}
+
+void Feature::invalidateWrites() {
+    _device->invalidateShadow(_index);
+}
+
+void Feature::writeFunction(uint8_t function_id, std::vector<uint8_t>& params,
+                            const ShadowKey& key) {
+    if (_device->shadowMatches(_index, function_id, params, key.length))
+        return;
+
+    auto acked = [device = _device, index = _index, function_id, params, key]() {
+        device->shadowStore(index, function_id, params, key.length,
+                            key.readback, key.readback_length);
+    };
+
+    if (auto batch = Batch::current(_device)) {
+        batch->add(_index, function_id, params, std::move(acked));
+    } else {
+        _device->callFunction(_index, function_id, params);
+        acked();
+    }
+}
+
+void Feature::writeFunction(uint8_t function_id, std::vector<uint8_t>& params,
+                            const ShadowKey& key,
+                            std::function<void(std::exception_ptr)> error) {
+    if (_device->shadowMatches(_index, function_id, params, key.length))
+        return;
+
+    _device->callFunction(
+            _index, function_id, params,
+            [device = _device, index = _index, function_id, params, key](
+                    const std::vector<uint8_t>&) {
+                device->shadowStore(index, function_id, params, key.length,
+                                    key.readback, key.readback_length);
+            }, std::move(error));
+}
+
 Feature::Feature(Device* dev, uint16_t _id) : _device(dev) {
     _index = hidpp20::FeatureID::ROOT;
 
     if (_id) {
-        std::vector<uint8_t> getFunc_req(2);
-        getFunc_req[0] = (_id >> 8) & 0xff;
-        getFunc_req[1] = _id & 0xff;
-
-        try {
-            auto getFunc_resp = this->callFunction(Root::GetFeature, getFunc_req);
-            _index = getFunc_resp[0];
-        } catch (Error& e) {
-            if (e.code() == Error::InvalidFeatureIndex)
-                throw UnsupportedFeature(_id);
-            throw e;
-        }
+        _index = _device->tryFeatureIndex(_id).value();
 
         // 0 if not found
         if (!_index)
@@ -21,7 +21,12 @@
 
 #include <cstdint>
 #include <exception>
+#include <functional>
+#include <optional>
 #include <vector>
+#include <span>
+#include <backend/hidpp/Report.h>
+#include <backend/hidpp20/FunctionDescriptor.h>
 
 namespace logid::backend::hidpp20 {
     class Device;
@@ -38,6 +43,15 @@ namespace logid::backend::hidpp20 {
         uint16_t _f_id;
     };
 
+    /* Identifies the device state a write replaces, see Feature::writeFunction */
+    struct ShadowKey {
+        // Leading params that select the state (e.g. a sensor or CID)
+        std::size_t length = 0;
+        // Getter whose response starts with the same bytes as the write params
+        std::optional<uint8_t> readback = {};
+        std::size_t readback_length = 0;
+    };
+
     class Feature {
     public:
         static const uint16_t ID;
@@ -46,6 +60,10 @@ namespace logid::backend::hidpp20 {
 
         [[nodiscard]] uint8_t featureIndex() const;
 
+        /* Forgets the feature's acknowledged writes so the next ones are
+         * sent, for when the device changed the state on its own */
+        void invalidateWrites();
+
         virtual ~Feature() = default;
 
     protected:
@@ -53,10 +71,77 @@ namespace logid::backend::hidpp20 {
 
         std::vector<uint8_t> callFunction(uint8_t function_id, std::vector<uint8_t>& params);
 
+        hidpp::Report callFunction(uint8_t function_id, std::span<const uint8_t> params);
+
+        /* Non-blocking, see hidpp20::Device::callFunction */
+        void callFunction(uint8_t function_id, std::vector<uint8_t>& params,
+                          std::function<void(std::vector<uint8_t>)> callback,
+                          std::function<void(std::exception_ptr)> error = {});
+
         void callFunctionNoResponse(uint8_t function_id, std::vector<uint8_t>& params);
 
+        /* Read once per firmware, see hidpp20::Device::callStaticFunction */
+        std::vector<uint8_t> callStaticFunction(uint8_t function_id,
+                                                std::vector<uint8_t>& params);
+
+        /* For writes whose response is not needed, queued if a Batch is open.
+         * Skipped if the device's shadow state shows the write is redundant. */
+        void writeFunction(uint8_t function_id, std::vector<uint8_t>& params,
+                           const ShadowKey& key = {});
+
+        /* Non-blocking, ignores an open Batch. Safe to call on the I/O thread. */
+        void writeFunction(uint8_t function_id, std::vector<uint8_t>& params,
+                           const ShadowKey& key,
+                           std::function<void(std::exception_ptr)> error);
+
+        /* Typed wrappers around the calls above, see FunctionDescriptor */
+        template<typename F>
+        typename F::response_t call(const typename F::request_t& request = {}) {
+            auto params = F::request_t::layout::pack(request);
+            auto response = callFunction(F::function, std::span<const uint8_t>(params));
+            return _unpack<F>(&*response.paramBegin());
+        }
+
+        template<typename F>
+        void call(const typename F::request_t& request,
+                  std::function<void(typename F::response_t)> callback,
+                  std::function<void(std::exception_ptr)> error = {}) {
+            auto params = _packVector<F>(request);
+            callFunction(F::function, params,
+                         [callback = std::move(callback)](std::vector<uint8_t> response) {
+                             response.resize(hidpp::LongParamLength);
+                             callback(_unpack<F>(response.data()));
+                         }, std::move(error));
+        }
+
+        template<typename F>
+        typename F::response_t callStatic(const typename F::request_t& request = {}) {
+            auto params = _packVector<F>(request);
+            auto response = callStaticFunction(F::function, params);
+            response.resize(hidpp::LongParamLength);
+            return _unpack<F>(response.data());
+        }
+
+        template<typename F>
+        void write(const typename F::request_t& request, const ShadowKey& key = {}) {
+            auto params = _packVector<F>(request);
+            writeFunction(F::function, params, key);
+        }
+
         Device* const _device;
         uint8_t _index;
+
+    private:
+        template<typename F>
+        static std::vector<uint8_t> _packVector(const typename F::request_t& request) {
+            auto params = F::request_t::layout::pack(request);
+            return {params.begin(), params.end()};
+        }
+
+        template<typename F>
+        static typename F::response_t _unpack(const uint8_t* params) {
+            return F::response_t::layout::template unpack<typename F::response_t>(params);
+        }
     };
 }
 
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_HIDPP20_FUNCTIONDESCRIPTOR_H
+#define LOGID_BACKEND_HIDPP20_FUNCTIONDESCRIPTOR_H
+
+#include <backend/hidpp/defs.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
+namespace logid::backend::hidpp20 {
+    namespace detail {
+        template<typename>
+        struct member_traits;
+
+        template<typename C, typename T>
+        struct member_traits<T C::*> {
+            typedef C object_t;
+            typedef T value_t;
+        };
+
+        template<typename T>
+        struct wire_type {
+            typedef std::make_unsigned_t<T> type;
+        };
+
+        template<typename T> requires std::is_enum_v<T>
+        struct wire_type<T> {
+            typedef std::make_unsigned_t<std::underlying_type_t<T>> type;
+        };
+
+        template<>
+        struct wire_type<bool> {
+            typedef uint8_t type;
+        };
+    }
+
+    /* A big-endian integer, enum or bool member stored at a fixed offset
+     * in the function params. */
+    template<std::size_t Offset, auto Member>
+    struct Field {
+        typedef typename detail::member_traits<decltype(Member)>::object_t object_t;
+        typedef typename detail::member_traits<decltype(Member)>::value_t value_t;
+        typedef typename detail::wire_type<value_t>::type wire_t;
+
+        static constexpr std::size_t size = sizeof(wire_t);
+        static constexpr std::size_t end = Offset + size;
+
+        static constexpr void pack(const object_t& object, uint8_t* data) {
+            auto value = static_cast<wire_t>(object.*Member);
+            for (std::size_t i = 0; i < size; ++i)
+                data[Offset + i] = static_cast<uint8_t>(value >> (8 * (size - 1 - i)));
+        }
+
+        static constexpr void unpack(object_t& object, const uint8_t* data) {
+            wire_t value = 0;
+            for (std::size_t i = 0; i < size; ++i)
+                value = static_cast<wire_t>((value << 8) | data[Offset + i]);
+            object.*Member = static_cast<value_t>(value);
+        }
+    };
+
+    /* Wire layout of a request or response, structs describe themselves
+     * with a layout typedef listing their fields. */
+    template<typename... Fields>
+    struct Layout {
+        static constexpr std::size_t size = std::max({std::size_t(0), Fields::end...});
+        static_assert(size <= hidpp::LongParamLength, "layout does not fit in a report");
+
+        template<typename T>
+        static constexpr std::array<uint8_t, size> pack(const T& object) {
+            std::array<uint8_t, size> data{};
+            (Fields::pack(object, data.data()), ...);
+            return data;
+        }
+
+        /* data must hold hidpp::LongParamLength bytes, short responses
+         * are zero padded. */
+        template<typename T>
+        static constexpr T unpack(const uint8_t* data) {
+            T object{};
+            (Fields::unpack(object, data), ...);
+            return object;
+        }
+    };
+
+    struct NoParams {
+        typedef Layout<> layout;
+    };
+
+    /* Describes a feature function, used with Feature::call and friends
+     * to pack requests and parse responses without hand-written code. */
+    template<uint8_t Function, typename Request = NoParams, typename Response = NoParams>
+    struct FunctionDescriptor {
+        static constexpr uint8_t function = Function;
+        typedef Request request_t;
+        typedef Response response_t;
+    };
+}
+
+#endif //LOGID_BACKEND_HIDPP20_FUNCTIONDESCRIPTOR_H
@@ -0,0 +1,213 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <backend/hidpp20/MockTransport.h>
+#include <backend/hidpp20/feature_defs.h>
+#include <backend/hidpp20/Error.h>
+#include <backend/hidpp/Report.h>
+#include <algorithm>
+
+using namespace logid::backend::hidpp20;
+using namespace logid::backend;
+using namespace logid;
+
+namespace {
+    constexpr std::size_t response_length = hidpp::Report::HeaderLength + hidpp::LongParamLength;
+
+    std::vector<uint8_t> makeResponse(uint8_t index, uint8_t feature_index, uint8_t address,
+                                      std::span<const uint8_t> params) {
+        std::vector<uint8_t> response(response_length, 0);
+        response[hidpp::Offset::Type] = hidpp::ReportType::Long;
+        response[hidpp::Offset::DeviceIndex] = index;
+        response[hidpp::Offset::Feature] = feature_index;
+        response[hidpp::Offset::Function] = address;
+        std::copy_n(params.begin(), std::min(params.size(), hidpp::LongParamLength),
+                    response.begin() + hidpp::Offset::Parameters);
+        return response;
+    }
+
+    std::vector<uint8_t> makeError(uint8_t index, uint8_t feature_index, uint8_t address,
+                                   uint8_t code) {
+        const uint8_t params[] = {address, code};
+        return makeResponse(index, ErrorID, feature_index, params);
+    }
+}
+
+MockTransport::MockTransport(MockModel model) : _model(std::move(model)) {
+    _features.push_back(FeatureID::ROOT);
+    _features.push_back(FeatureID::FEATURE_SET);
+    for (auto& feature: _model.features)
+        _features.push_back(feature.id);
+}
+
+std::shared_ptr<raw::RawDevice> MockTransport::makeDevice(
+        const std::string& path, const std::shared_ptr<MockTransport>& transport) {
+    auto& model = transport->model();
+    raw::RawDevice::node_info info{
+            .info = {.vid = model.vid, .pid = model.pid, .bus_type = raw::RawDevice::USB},
+            .phys = path,
+            .name = model.name,
+            .report_desc = hidpp::makeReportDescriptor(
+                    hidpp::ShortReportSupported | hidpp::LongReportSupported),
+            .sub_device = false
+    };
+
+    return raw::RawDevice::make(path, std::move(info),
+                                std::static_pointer_cast<raw::Transport>(transport));
+}
+
+void MockTransport::send(raw::RawReport report) {
+    if (!_connected)
+        return;
+
+    ++_requests;
+    auto response = _answer(report);
+    if (response.empty())
+        return;
+
+    if (_model.latency.count() == 0) {
+        _deliver(std::move(response));
+    } else {
+        run_task_after([self_weak = weak_from_this(), response]() {
+            if (auto self = self_weak.lock())
+                self->_deliver(response);
+        }, _model.latency);
+    }
+}
+
+void MockTransport::notify(hidpp::DeviceIndex index, uint16_t feature_id, uint8_t function,
+                           std::span<const uint8_t> params) {
+    auto it = std::find(_features.begin(), _features.end(), feature_id);
+    if (it == _features.end())
+        return;
+
+    auto feature_index = static_cast<uint8_t>(it - _features.begin());
+    _deliver(makeResponse(index, feature_index, (function << 4) & 0xf0, params));
+}
+
+void MockTransport::inject(std::span<const uint8_t> report) {
+    _deliver({report.begin(), report.end()});
+}
+
+void MockTransport::disconnect() {
+    _connected = false;
+    hangup();
+}
+
+const MockModel& MockTransport::model() const {
+    return _model;
+}
+
+uint64_t MockTransport::requests() const {
+    return _requests;
+}
+
+std::vector<uint8_t> MockTransport::_answer(raw::RawReport request) const {
+    if (request.size() < hidpp::Report::HeaderLength + hidpp::ShortParamLength ||
+        (request[hidpp::Offset::Type] != hidpp::ReportType::Short &&
+         request[hidpp::Offset::Type] != hidpp::ReportType::Long))
+        return {};
+
+    const uint8_t index = request[hidpp::Offset::DeviceIndex];
+    const uint8_t feature_index = request[hidpp::Offset::Feature];
+    const uint8_t address = request[hidpp::Offset::Function];
+    const uint8_t function = address >> 4;
+    auto params = request.subspan(hidpp::Offset::Parameters);
+
+    if (feature_index >= _features.size())
+        return makeError(index, feature_index, address, Error::InvalidFeatureIndex);
+
+    if (feature_index == 0) {
+        if (function == 0) {
+            // GetFeature, answers index 0 for unsupported features
+            uint16_t id = (params[0] << 8) | params[1];
+            uint8_t result[3] = {};
+            for (std::size_t i = 1; i < _features.size(); ++i) {
+                if (_features[i] == id) {
+                    result[0] = static_cast<uint8_t>(i);
+                    if (i >= 2) {
+                        result[1] = _model.features[i - 2].flags;
+                        result[2] = _model.features[i - 2].version;
+                    }
+                    break;
+                }
+            }
+            return makeResponse(index, feature_index, address, result);
+        } else if (function == 1) {
+            // Ping, echoes the ping byte
+            const uint8_t result[3] = {std::get<0>(_model.protocol),
+                                       std::get<1>(_model.protocol), params[2]};
+            return makeResponse(index, feature_index, address, result);
+        }
+    } else if (feature_index == 1) {
+        if (function == 0) {
+            // The count excludes the root feature
+            const uint8_t result[1] = {static_cast<uint8_t>(_features.size() - 1)};
+            return makeResponse(index, feature_index, address, result);
+        } else if (function == 1) {
+            if (params[0] >= _features.size())
+                return makeError(index, feature_index, address, Error::OutOfRange);
+            auto id = _features[params[0]];
+            uint8_t result[4] = {static_cast<uint8_t>(id >> 8),
+                                 static_cast<uint8_t>(id & 0xff), 0, 0};
+            if (params[0] >= 2) {
+                result[2] = _model.features[params[0] - 2].flags;
+                result[3] = _model.features[params[0] - 2].version;
+            }
+            return makeResponse(index, feature_index, address, result);
+        }
+    } else {
+        if (!_model.recorded.empty()) {
+            auto end = params.end();
+            while (end != params.begin() && !*(end - 1))
+                --end;
+            auto recorded = _model.recorded.find(
+                    {_features[feature_index], function, {params.begin(), end}});
+            if (recorded != _model.recorded.end())
+                return makeResponse(index, feature_index, address, recorded->second);
+        }
+
+        auto it = _model.responses.find({_features[feature_index], function});
+        if (it != _model.responses.end())
+            return makeResponse(index, feature_index, address, it->second);
+
+        if (_features[feature_index] == FeatureID::DEVICE_NAME) {
+            // GetLength and GetName answer with the model name
+            if (function == 0) {
+                const uint8_t result[1] = {static_cast<uint8_t>(_model.name.size())};
+                return makeResponse(index, feature_index, address, result);
+            } else if (function == 1) {
+                auto offset = std::min<std::size_t>(params[0], _model.name.size());
+                auto name = std::span(reinterpret_cast<const uint8_t*>(_model.name.data()),
+                                      _model.name.size()).subspan(offset);
+                return makeResponse(index, feature_index, address, name);
+            }
+        }
+    }
+
+    return makeError(index, feature_index, address, Error::InvalidFunctionID);
+}
+
+void MockTransport::_deliver(std::vector<uint8_t> report) {
+    _strand.post([self_weak = weak_from_this(), report = std::move(report)]() {
+        if (auto self = self_weak.lock()) {
+            if (self->_connected)
+                self->receive(report);
+        }
+    });
+}
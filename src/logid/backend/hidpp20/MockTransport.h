@@ -0,0 +1,107 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_HIDPP20_MOCKTRANSPORT_H
+#define LOGID_BACKEND_HIDPP20_MOCKTRANSPORT_H
+
+#include <backend/raw/Transport.h>
+#include <backend/raw/RawDevice.h>
+#include <backend/hidpp/defs.h>
+#include <util/task.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <span>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace logid::backend::hidpp20 {
+    /* What a simulated device answers. Root and FeatureSet are answered
+     * from the feature list and DeviceName from the name, any other
+     * function from the scripted responses, or with InvalidFunctionID if
+     * there is none. */
+    struct MockModel {
+        struct MockFeature {
+            uint16_t id;
+            uint8_t version = 0;
+            uint8_t flags = 0;
+        };
+
+        int16_t vid = 0x046d;
+        int16_t pid = 0x4000;
+        std::string name = "Mock Device";
+        std::tuple<uint8_t, uint8_t> protocol = {4, 2};
+
+        // Indexed in order after Root and FeatureSet, which are implied
+        std::vector<MockFeature> features;
+
+        // Keyed by feature id and function, the parameters of the response
+        std::map<std::tuple<uint16_t, uint8_t>, std::vector<uint8_t>> responses;
+
+        /* Looked up before responses, keyed as well by the parameters of
+         * the request without trailing zeros. Captures answer this way. */
+        std::map<std::tuple<uint16_t, uint8_t, std::vector<uint8_t>>,
+                std::vector<uint8_t>> recorded;
+
+        // Time between a request and its response
+        std::chrono::milliseconds latency{0};
+    };
+
+    class MockTransport : public raw::Transport,
+                          public std::enable_shared_from_this<MockTransport> {
+    public:
+        explicit MockTransport(MockModel model);
+
+        // A RawDevice for the model that reads and writes through transport
+        static std::shared_ptr<raw::RawDevice> makeDevice(
+                const std::string& path, const std::shared_ptr<MockTransport>& transport);
+
+        void send(raw::RawReport report) final;
+
+        // Sends an event of feature_id as the device would
+        void notify(hidpp::DeviceIndex index, uint16_t feature_id, uint8_t function,
+                    std::span<const uint8_t> params);
+
+        // Delivers a whole report as if the device sent it, e.g. a captured one
+        void inject(std::span<const uint8_t> report);
+
+        // Reports are no longer answered and no longer read
+        void disconnect();
+
+        [[nodiscard]] const MockModel& model() const;
+
+        [[nodiscard]] uint64_t requests() const;
+
+    private:
+        [[nodiscard]] std::vector<uint8_t> _answer(raw::RawReport request) const;
+
+        void _deliver(std::vector<uint8_t> report);
+
+        const MockModel _model;
+        // Feature id by index
+        std::vector<uint16_t> _features;
+
+        // Keeps events and responses in order
+        strand _strand;
+        std::atomic_bool _connected = true;
+        std::atomic<uint64_t> _requests = 0;
+    };
+}
+
+#endif //LOGID_BACKEND_HIDPP20_MOCKTRANSPORT_H
@@ -81,6 +81,7 @@ namespace logid::backend::hidpp20 {
             THUMB_WHEEL = 0x2150,
             MOUSE_POINTER = 0x2200, // Possibly predecessor to 0x2201?
             ADJUSTABLE_DPI = 0x2201,
+            EXTENDED_ADJUSTABLE_DPI = 0x2202,
             ANGLE_SNAPPING = 0x2230,
             SURFACE_TUNING = 0x2240,
             HYBRID_TRACKING = 0x2400,
@@ -113,7 +114,8 @@ namespace logid::backend::hidpp20 {
             RGB_EFFECTS_V2 = 0x8071,
             PER_KEY_LIGHTING = 0x8080,
             PER_KEY_LIGHTING_V2 = 0x8081,
-            MODE_STATUS = 0x8100,
+            MODE_STATUS = 0x8090,
+            ONBOARD_PROFILES = 0x8100,
             MOUSE_BUTTON_SPY = 0x8110,
             LATENCY_MONITORING = 0x8111,
             GAMING_ATTACHMENTS = 0x8120,
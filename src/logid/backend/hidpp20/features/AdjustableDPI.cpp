@@ -16,15 +16,52 @@
  *
  */
 #include <backend/hidpp20/features/AdjustableDPI.h>
+#include <backend/hidpp20/Device.h>
 
 using namespace logid::backend::hidpp20;
 
-AdjustableDPI::AdjustableDPI(Device* dev) : Feature(dev, ID) {
+namespace {
+    // Pages of DPI ranges read before giving up on a terminator
+    constexpr uint8_t max_range_pages = 8;
+}
+
+AdjustableDPI::AdjustableDPI(Device* dev) : AdjustableDPI(dev, ID) {
+}
+
+AdjustableDPI::AdjustableDPI(Device* dev, uint16_t feature_id) : Feature(dev, feature_id) {
+}
+
+std::shared_ptr<AdjustableDPI> AdjustableDPI::autoVersion(Device* dev) {
+    if (dev->featureSupported(ExtendedAdjustableDPI::ID)) {
+        try {
+            return std::make_shared<ExtendedAdjustableDPI>(dev);
+        } catch (UnsupportedFeature& e) {
+        }
+    }
+
+    return std::make_shared<AdjustableDPI>(dev);
+}
+
+bool AdjustableDPI::parseDPIList(SensorDPIList& list, const uint8_t* data, std::size_t size) {
+    for (std::size_t i = 0; i + 1 < size; i += 2) {
+        uint16_t dpi = data[i + 1];
+        dpi |= (data[i] << 8);
+        if (!dpi)
+            return true;
+        if (dpi >= 0xe000) {
+            list.isRange = true;
+            list.dpiStep = dpi - 0xe000;
+        } else {
+            list.dpis.push_back(dpi);
+        }
+    }
+
+    return false;
 }
 
 uint8_t AdjustableDPI::getSensorCount() {
     std::vector<uint8_t> params(0);
-    auto response = callFunction(GetSensorCount, params);
+    auto response = callStaticFunction(GetSensorCount, params);
     return response[0];
 }
 
@@ -32,21 +69,10 @@ AdjustableDPI::SensorDPIList AdjustableDPI::getSensorDPIList(uint8_t sensor) {
     SensorDPIList dpi_list{};
     std::vector<uint8_t> params(1);
     params[0] = sensor;
-    auto response = callFunction(GetSensorDPIList, params);
+    auto response = callStaticFunction(GetSensorDPIList, params);
 
     dpi_list.dpiStep = false;
-    for (std::size_t i = 1; i < response.size(); i += 2) {
-        uint16_t dpi = response[i + 1];
-        dpi |= (response[i] << 8);
-        if (!dpi)
-            break;
-        if (dpi >= 0xe000) {
-            dpi_list.isRange = true;
-            dpi_list.dpiStep = dpi - 0xe000;
-        } else {
-            dpi_list.dpis.push_back(dpi);
-        }
-    }
+    parseDPIList(dpi_list, response.data() + 1, response.size() - 1);
 
     return dpi_list;
 }
@@ -78,5 +104,99 @@ void AdjustableDPI::setSensorDPI(uint8_t sensor, uint16_t dpi) {
     params[0] = sensor;
     params[1] = (dpi >> 8);
     params[2] = (dpi & 0xFF);
-    callFunction(SetSensorDPI, params);
-}
\ No newline at end of file
+    writeFunction(SetSensorDPI, params, {.length = 1, .readback = GetSensorDPI,
+                                         .readback_length = 3});
+}
+
+void AdjustableDPI::setSensorDPI(uint8_t sensor, uint16_t dpi,
+                                 std::function<void(std::exception_ptr)> error) {
+    std::vector<uint8_t> params(3);
+    params[0] = sensor;
+    params[1] = (dpi >> 8);
+    params[2] = (dpi & 0xFF);
+    writeFunction(SetSensorDPI, params, {.length = 1, .readback = GetSensorDPI,
+                                         .readback_length = 3}, std::move(error));
+}
+
+ExtendedAdjustableDPI::ExtendedAdjustableDPI(Device* dev) : AdjustableDPI(dev, ID) {
+}
+
+uint8_t ExtendedAdjustableDPI::getSensorCount() {
+    std::vector<uint8_t> params(0);
+    auto response = callStaticFunction(GetSensorCount, params);
+    return response[0];
+}
+
+uint8_t ExtendedAdjustableDPI::_capabilities(uint8_t sensor) {
+    std::vector<uint8_t> params = {sensor};
+    auto response = callStaticFunction(GetCapabilities, params);
+    return response[2];
+}
+
+AdjustableDPI::SensorDPIList ExtendedAdjustableDPI::getSensorDPIList(uint8_t sensor) {
+    SensorDPIList dpi_list{};
+
+    // Ranges of the X direction, Y shares them when set together
+    for (uint8_t page = 0; page < max_range_pages; ++page) {
+        std::vector<uint8_t> params = {sensor, 0, page};
+        auto response = callStaticFunction(GetSensorDPIRanges, params);
+        if (response.size() <= 3 ||
+            parseDPIList(dpi_list, response.data() + 3, response.size() - 3))
+            break;
+    }
+
+    /* Writes need both, reading them here keeps the non-blocking write
+     * from waiting on the device */
+    _capabilities(sensor);
+    getSensorDPI(sensor);
+
+    return dpi_list;
+}
+
+uint16_t ExtendedAdjustableDPI::getDefaultSensorDPI(uint8_t sensor) {
+    std::vector<uint8_t> params = {sensor};
+    auto response = callFunction(GetSensorDPIParameters, params);
+
+    return (uint16_t) (response[3] << 8 | response[4]);
+}
+
+uint16_t ExtendedAdjustableDPI::getSensorDPI(uint8_t sensor) {
+    std::vector<uint8_t> params = {sensor};
+    auto response = callFunction(GetSensorDPIParameters, params);
+
+    {
+        std::lock_guard lock(_lod_mutex);
+        _lod[sensor] = response[9];
+    }
+
+    return (uint16_t) (response[1] << 8 | response[2]);
+}
+
+std::vector<uint8_t> ExtendedAdjustableDPI::_setParams(uint8_t sensor, uint16_t dpi) {
+    const uint8_t capabilities = _capabilities(sensor);
+    const uint16_t dpi_y = (capabilities & SeparateY) ? dpi : 0;
+    uint8_t lod = 0;
+    if (capabilities & LiftOffDistance) {
+        std::lock_guard lock(_lod_mutex);
+        auto it = _lod.find(sensor);
+        if (it != _lod.end())
+            lod = it->second;
+    }
+
+    return {sensor, (uint8_t) (dpi >> 8), (uint8_t) (dpi & 0xff),
+            (uint8_t) (dpi_y >> 8), (uint8_t) (dpi_y & 0xff), lod};
+}
+
+void ExtendedAdjustableDPI::setSensorDPI(uint8_t sensor, uint16_t dpi) {
+    auto params = _setParams(sensor, dpi);
+    writeFunction(SetSensorDPIParameters, params,
+                  {.length = 1, .readback = GetSensorDPIParameters, .readback_length = 3});
+}
+
+void ExtendedAdjustableDPI::setSensorDPI(uint8_t sensor, uint16_t dpi,
+                                         std::function<void(std::exception_ptr)> error) {
+    auto params = _setParams(sensor, dpi);
+    writeFunction(SetSensorDPIParameters, params,
+                  {.length = 1, .readback = GetSensorDPIParameters, .readback_length = 3},
+                  std::move(error));
+}
@@ -20,13 +20,16 @@
 
 #include <backend/hidpp20/Feature.h>
 #include <backend/hidpp20/feature_defs.h>
+#include <map>
+#include <memory>
+#include <mutex>
 
 namespace logid::backend::hidpp20 {
     class AdjustableDPI : public Feature {
     public:
         static const uint16_t ID = FeatureID::ADJUSTABLE_DPI;
 
-        [[nodiscard]] uint16_t getID() final { return ID; }
+        [[nodiscard]] uint16_t getID() override { return ID; }
 
         enum Function {
             GetSensorCount = 0,
@@ -37,7 +40,7 @@ namespace logid::backend::hidpp20 {
 
         explicit AdjustableDPI(Device* dev);
 
-        uint8_t getSensorCount();
+        virtual uint8_t getSensorCount();
 
         struct SensorDPIList {
             std::vector<uint16_t> dpis;
@@ -45,13 +48,71 @@ namespace logid::backend::hidpp20 {
             uint16_t dpiStep;
         };
 
-        SensorDPIList getSensorDPIList(uint8_t sensor);
+        virtual SensorDPIList getSensorDPIList(uint8_t sensor);
+
+        virtual uint16_t getDefaultSensorDPI(uint8_t sensor);
+
+        virtual uint16_t getSensorDPI(uint8_t sensor);
+
+        virtual void setSensorDPI(uint8_t sensor, uint16_t dpi);
+
+        // Non-blocking, error is run on a worker thread
+        virtual void setSensorDPI(uint8_t sensor, uint16_t dpi,
+                                  std::function<void(std::exception_ptr)> error);
+
+        // The extended feature if the device has it
+        [[nodiscard]] static std::shared_ptr<AdjustableDPI> autoVersion(Device* dev);
+
+    protected:
+        AdjustableDPI(Device* dev, uint16_t feature_id);
+
+        // Parses 16-bit DPIs from data until a 0, 0xe0xx is a range step
+        static bool parseDPIList(SensorDPIList& list, const uint8_t* data, std::size_t size);
+    };
+
+    /* Sets X and Y together and keeps the sensor's lift-off distance */
+    class ExtendedAdjustableDPI : public AdjustableDPI {
+    public:
+        static const uint16_t ID = FeatureID::EXTENDED_ADJUSTABLE_DPI;
+
+        [[nodiscard]] uint16_t getID() final { return ID; }
+
+        enum Function {
+            GetSensorCount = 0,
+            GetCapabilities = 1,
+            GetSensorDPIRanges = 2,
+            GetSensorDPIParameters = 5,
+            SetSensorDPIParameters = 6
+        };
+
+        enum Capability : uint8_t {
+            SeparateY = 1 << 0,
+            LiftOffDistance = 1 << 1
+        };
+
+        explicit ExtendedAdjustableDPI(Device* dev);
+
+        uint8_t getSensorCount() final;
+
+        SensorDPIList getSensorDPIList(uint8_t sensor) final;
+
+        uint16_t getDefaultSensorDPI(uint8_t sensor) final;
+
+        uint16_t getSensorDPI(uint8_t sensor) final;
+
+        void setSensorDPI(uint8_t sensor, uint16_t dpi) final;
+
+        void setSensorDPI(uint8_t sensor, uint16_t dpi,
+                          std::function<void(std::exception_ptr)> error) final;
 
-        uint16_t getDefaultSensorDPI(uint8_t sensor);
+    private:
+        [[nodiscard]] uint8_t _capabilities(uint8_t sensor);
 
-        uint16_t getSensorDPI(uint8_t sensor);
+        std::vector<uint8_t> _setParams(uint8_t sensor, uint16_t dpi);
 
-        void setSensorDPI(uint8_t sensor, uint16_t dpi);
+        std::mutex _lod_mutex;
+        // Lift-off distance last read per sensor
+        std::map<uint8_t, uint8_t> _lod;
     };
 }
 
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <backend/hidpp20/features/BatteryStatus.h>
+#include <cassert>
+
+using namespace logid::backend::hidpp20;
+
+namespace {
+    struct StatusResponse {
+        uint8_t level;
+        uint8_t next_level;
+        uint8_t status;
+
+        typedef Layout<Field<0, &StatusResponse::level>,
+                Field<1, &StatusResponse::next_level>,
+                Field<2, &StatusResponse::status>> layout;
+    };
+
+    namespace fn {
+        typedef FunctionDescriptor<BatteryStatus::GetBatteryLevelStatus,
+                NoParams, StatusResponse> GetBatteryLevelStatus;
+    }
+}
+
+BatteryStatus::BatteryStatus(Device* dev) : Feature(dev, ID) {
+}
+
+BatteryStatus::Status BatteryStatus::getStatus() {
+    auto response = call<fn::GetBatteryLevelStatus>();
+    return {response.level, response.next_level, response.status};
+}
+
+BatteryStatus::Status BatteryStatus::statusBroadcastEvent(hidpp::ReportView report) {
+    assert(report.function() == StatusBroadcast);
+    auto params = report.paramBegin();
+    return {params[0], params[1], params[2]};
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_BACKEND_HIDPP20_FEATURE_BATTERYSTATUS_H
+#define LOGID_BACKEND_HIDPP20_FEATURE_BATTERYSTATUS_H
+
+#include <backend/hidpp20/Feature.h>
+#include <backend/hidpp20/feature_defs.h>
+#include <backend/hidpp/Report.h>
+
+namespace logid::backend::hidpp20 {
+    class BatteryStatus : public Feature {
+    public:
+        static constexpr uint16_t ID = FeatureID::BATTERY_STATUS;
+
+        [[nodiscard]] uint16_t getID() final { return ID; }
+
+        enum Function : uint8_t {
+            GetBatteryLevelStatus = 0,
+            GetBatteryCapability = 1
+        };
+
+        enum Event : uint8_t {
+            StatusBroadcast = 0
+        };
+
+        enum ChargeStatus : uint8_t {
+            Discharging = 0,
+            Recharging = 1,
+            AlmostFull = 2,
+            Full = 3,
+            SlowRecharge = 4,
+            InvalidBattery = 5,
+            ThermalError = 6,
+            OtherError = 7
+        };
+
+        // Levels are in percent, 0 if the device does not report one
+        struct Status {
+            uint8_t level;
+            uint8_t nextLevel;
+            uint8_t status;
+        };
+
+        explicit BatteryStatus(Device* dev);
+
+        [[nodiscard]] Status getStatus();
+
+        static Status statusBroadcastEvent(hidpp::ReportView report);
+    };
+}
+
+#endif //LOGID_BACKEND_HIDPP20_FEATURE_BATTERYSTATUS_H
@@ -25,8 +25,19 @@ ChangeHost::ChangeHost(Device* dev) : Feature(dev, ID), _host_count(0) {
 
 ChangeHost::HostInfo ChangeHost::getHostInfo() {
     std::vector<uint8_t> params(0);
-    auto response = callFunction(GetHostInfo, params);
+    return _parseHostInfo(callFunction(GetHostInfo, params));
+}
+
+void ChangeHost::getHostInfo(std::function<void(HostInfo)> callback,
+                             std::function<void(std::exception_ptr)> error) {
+    std::vector<uint8_t> params(0);
+    callFunction(GetHostInfo, params,
+                 [this, callback = std::move(callback)](std::vector<uint8_t> response) {
+                     callback(_parseHostInfo(response));
+                 }, std::move(error));
+}
 
+ChangeHost::HostInfo ChangeHost::_parseHostInfo(const std::vector<uint8_t>& response) {
     HostInfo info{};
     info.hostCount = response[0];
     info.currentHost = response[1];
@@ -19,6 +19,7 @@
 #define LOGID_BACKEND_HIDPP20_FEATURE_CHANGEHOST_H
 
 #include <backend/hidpp20/feature_defs.h>
+#include <atomic>
 #include <backend/hidpp20/Feature.h>
 
 namespace logid::backend::hidpp20 {
@@ -45,6 +46,10 @@ namespace logid::backend::hidpp20 {
 
         HostInfo getHostInfo();
 
+        // Non-blocking, the callbacks are run on a worker thread
+        void getHostInfo(std::function<void(HostInfo)> callback,
+                         std::function<void(std::exception_ptr)> error = {});
+
         void setHost(uint8_t host);
 
         [[maybe_unused]] [[maybe_unused]] std::vector<uint8_t> getCookies();
@@ -52,7 +57,9 @@ namespace logid::backend::hidpp20 {
         [[maybe_unused]] [[maybe_unused]] void setCookie(uint8_t host, uint8_t cookie);
 
     private:
-        uint8_t _host_count;
+        HostInfo _parseHostInfo(const std::vector<uint8_t>& response);
+
+        std::atomic<uint8_t> _host_count;
     };
 }
 
@@ -43,7 +43,8 @@ uint16_t FeatureSet::getFeature(uint8_t feature_index) {
 std::map<uint8_t, uint16_t> FeatureSet::getFeatures() {
     uint8_t feature_count = getFeatureCount();
     std::map<uint8_t, uint16_t> features;
-    for (uint8_t i = 0; i < feature_count; i++)
+    // The count excludes the root feature at index 0
+    for (uint16_t i = 0; i <= feature_count; i++)
         features[i] = getFeature(i);
     return features;
 }
\ No newline at end of file
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <backend/hidpp20/features/FirmwareVersion.h>
+#include <cstdio>
+
+using namespace logid::backend::hidpp20;
+
+FirmwareVersion::FirmwareVersion(Device* device) : Feature(device, ID) {
+}
+
+uint8_t FirmwareVersion::getEntityCount() {
+    std::vector<uint8_t> params(0);
+    auto response = callFunction(GetEntityCount, params);
+    return response[0];
+}
+
+FirmwareVersion::FirmwareInfo FirmwareVersion::getFirmwareInfo(uint8_t entity) {
+    std::vector<uint8_t> params(1);
+    params[0] = entity;
+    auto response = callFunction(GetFirmwareInfo, params);
+
+    FirmwareInfo info{};
+    info.type = response[0] & 0x0f;
+    for (std::size_t i = 1; i < 4 && response[i]; i++)
+        info.name += (char) response[i];
+    info.number = response[4];
+    info.revision = response[5];
+    info.build = (response[6] << 8) | response[7];
+
+    return info;
+}
+
+std::string FirmwareVersion::getFirmwareString() {
+    uint8_t entities = getEntityCount();
+    for (uint8_t i = 0; i < entities; i++) {
+        auto info = getFirmwareInfo(i);
+        if (info.type != MainApplication)
+            continue;
+
+        // Number, revision and build are BCD encoded
+        char version[16];
+        snprintf(version, sizeof(version), "%02x.%02x_B%04x",
+                 info.number, info.revision, info.build);
+        return info.name + version;
+    }
+
+    return {};
+}
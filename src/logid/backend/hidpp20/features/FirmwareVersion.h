@@ -0,0 +1,62 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_BACKEND_HIDPP20_FEATURE_FIRMWAREVERSION_H
+#define LOGID_BACKEND_HIDPP20_FEATURE_FIRMWAREVERSION_H
+
+#include <backend/hidpp20/Feature.h>
+#include <backend/hidpp20/feature_defs.h>
+#include <string>
+
+namespace logid::backend::hidpp20 {
+    class FirmwareVersion : public Feature {
+    public:
+        static const uint16_t ID = FeatureID::FW_VERSION;
+
+        [[nodiscard]] uint16_t getID() final { return ID; }
+
+        enum Function : uint8_t {
+            GetEntityCount = 0,
+            GetFirmwareInfo = 1
+        };
+
+        enum EntityType : uint8_t {
+            MainApplication = 0,
+            Bootloader = 1,
+            Hardware = 2
+        };
+
+        struct FirmwareInfo {
+            uint8_t type;
+            std::string name;
+            uint8_t number;
+            uint8_t revision;
+            uint16_t build;
+        };
+
+        explicit FirmwareVersion(Device* device);
+
+        [[nodiscard]] uint8_t getEntityCount();
+
+        [[nodiscard]] FirmwareInfo getFirmwareInfo(uint8_t entity);
+
+        /* Identifies the main application firmware, e.g. "RQM68.01_B0009" */
+        [[nodiscard]] std::string getFirmwareString();
+    };
+}
+
+#endif //LOGID_BACKEND_HIDPP20_FEATURE_FIRMWAREVERSION_H
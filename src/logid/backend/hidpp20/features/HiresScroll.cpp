@@ -20,38 +20,49 @@
 
 using namespace logid::backend::hidpp20;
 
+namespace {
+    struct ModeParams {
+        uint8_t mode;
+
+        typedef Layout<Field<0, &ModeParams::mode>> layout;
+    };
+
+    struct RatchetParams {
+        bool ratchet;
+
+        typedef Layout<Field<0, &RatchetParams::ratchet>> layout;
+    };
+
+    namespace fn {
+        typedef FunctionDescriptor<HiresScroll::GetCapabilities,
+                NoParams, HiresScroll::Capabilities> GetCapabilities;
+        typedef FunctionDescriptor<HiresScroll::GetMode, NoParams, ModeParams> GetMode;
+        typedef FunctionDescriptor<HiresScroll::SetMode, ModeParams> SetMode;
+        typedef FunctionDescriptor<HiresScroll::GetRatchetState,
+                NoParams, RatchetParams> GetRatchetState;
+    }
+}
+
 HiresScroll::HiresScroll(Device* device) : Feature(device, ID) {
 }
 
 HiresScroll::Capabilities HiresScroll::getCapabilities() {
-    std::vector<uint8_t> params(0);
-    auto response = callFunction(GetCapabilities, params);
-
-    Capabilities capabilities{};
-    capabilities.multiplier = response[0];
-    capabilities.flags = response[1];
-    return capabilities;
+    return callStatic<fn::GetCapabilities>();
 }
 
 uint8_t HiresScroll::getMode() {
-    std::vector<uint8_t> params(0);
-    auto response = callFunction(GetMode, params);
-    return response[0];
+    return call<fn::GetMode>().mode;
 }
 
 void HiresScroll::setMode(uint8_t mode) {
-    std::vector<uint8_t> params(1);
-    params[0] = mode;
-    callFunction(SetMode, params);
+    write<fn::SetMode>({mode}, {.readback = GetMode, .readback_length = 1});
 }
 
 [[maybe_unused]] bool HiresScroll::getRatchetState() {
-    std::vector<uint8_t> params(0);
-    auto response = callFunction(GetRatchetState, params);
-    return params[0];
+    return call<fn::GetRatchetState>().ratchet;
 }
 
-HiresScroll::WheelStatus HiresScroll::wheelMovementEvent(const hidpp::Report& report) {
+HiresScroll::WheelStatus HiresScroll::wheelMovementEvent(hidpp::ReportView report) {
     assert(report.function() == WheelMovement);
     WheelStatus status{};
     status.hiRes = report.paramBegin()[0] & 1 << 4;
@@ -61,7 +72,7 @@ HiresScroll::WheelStatus HiresScroll::wheelMovementEvent(const hidpp::Report& re
 }
 
 [[maybe_unused]]
-HiresScroll::RatchetState HiresScroll::ratchetSwitchEvent(const hidpp::Report& report) {
+HiresScroll::RatchetState HiresScroll::ratchetSwitchEvent(hidpp::ReportView report) {
     assert(report.function() == RatchetSwitch);
     // Possible bad cast
     return static_cast<RatchetState>(report.paramBegin()[0]);
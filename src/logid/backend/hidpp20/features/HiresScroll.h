@@ -61,6 +61,9 @@ namespace logid::backend::hidpp20 {
         struct Capabilities {
             uint8_t multiplier;
             uint8_t flags;
+
+            typedef Layout<Field<0, &Capabilities::multiplier>,
+                    Field<1, &Capabilities::flags>> layout;
         };
 
         struct WheelStatus {
@@ -80,10 +83,10 @@ namespace logid::backend::hidpp20 {
         [[maybe_unused]]
         bool getRatchetState();
 
-        static WheelStatus wheelMovementEvent(const hidpp::Report& report);
+        static WheelStatus wheelMovementEvent(hidpp::ReportView report);
 
         [[maybe_unused]]
-        static RatchetState ratchetSwitchEvent(const hidpp::Report& report);
+        static RatchetState ratchetSwitchEvent(hidpp::ReportView report);
     };
 }
 
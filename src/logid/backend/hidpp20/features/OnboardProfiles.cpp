@@ -0,0 +1,136 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <backend/hidpp20/features/OnboardProfiles.h>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace logid::backend::hidpp20;
+
+namespace {
+    struct ModeParams {
+        uint8_t mode;
+
+        typedef Layout<Field<0, &ModeParams::mode>> layout;
+    };
+
+    struct ProfileParams {
+        uint16_t profile;
+
+        typedef Layout<Field<0, &ProfileParams::profile>> layout;
+    };
+
+    namespace fn {
+        typedef FunctionDescriptor<OnboardProfiles::GetInfo,
+                NoParams, OnboardProfiles::Info> GetInfo;
+        typedef FunctionDescriptor<OnboardProfiles::GetMode, NoParams, ModeParams> GetMode;
+        typedef FunctionDescriptor<OnboardProfiles::GetCurrentProfile,
+                NoParams, ProfileParams> GetCurrentProfile;
+    }
+}
+
+OnboardProfiles::OnboardProfiles(Device* dev) : Feature(dev, ID) {
+}
+
+OnboardProfiles::Info OnboardProfiles::getInfo() {
+    return callStatic<fn::GetInfo>();
+}
+
+OnboardProfiles::Mode OnboardProfiles::getMode() {
+    return static_cast<Mode>(call<fn::GetMode>().mode);
+}
+
+/* The setters and memory writes below are not shadowed, a memory write
+ * repeats the params of the one before whenever two chunks match. */
+void OnboardProfiles::setMode(Mode mode) {
+    std::vector<uint8_t> params = {mode};
+    callFunction(SetMode, params);
+}
+
+uint16_t OnboardProfiles::getCurrentProfile() {
+    return call<fn::GetCurrentProfile>().profile;
+}
+
+void OnboardProfiles::setCurrentProfile(uint16_t profile) {
+    std::vector<uint8_t> params = {(uint8_t) (profile >> 8), (uint8_t) (profile & 0xff)};
+    callFunction(SetCurrentProfile, params);
+}
+
+std::vector<uint8_t> OnboardProfiles::readSector(uint16_t sector, std::size_t size) {
+    if (size < chunk_size)
+        throw std::invalid_argument("sector smaller than a chunk");
+
+    std::vector<uint8_t> data(size);
+    for (std::size_t offset = 0; offset < size; offset += chunk_size) {
+        // The last chunk may only be read whole, so it overlaps the one before
+        auto read_offset = std::min(offset, size - chunk_size);
+        std::vector<uint8_t> params = {
+                (uint8_t) (sector >> 8), (uint8_t) (sector & 0xff),
+                (uint8_t) (read_offset >> 8), (uint8_t) (read_offset & 0xff)
+        };
+        auto response = callFunction(MemoryRead, params);
+        response.resize(chunk_size);
+        std::copy(response.begin(), response.end(),
+                  data.begin() + (std::ptrdiff_t) read_offset);
+    }
+
+    return data;
+}
+
+void OnboardProfiles::writeSector(uint16_t sector, const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> address = {
+            (uint8_t) (sector >> 8), (uint8_t) (sector & 0xff), 0, 0,
+            (uint8_t) (data.size() >> 8), (uint8_t) (data.size() & 0xff)
+    };
+    callFunction(MemoryAddrWrite, address);
+
+    for (std::size_t offset = 0; offset < data.size(); offset += chunk_size) {
+        std::vector<uint8_t> params(chunk_size, 0);
+        auto end = std::min(offset + chunk_size, data.size());
+        std::copy(data.begin() + (std::ptrdiff_t) offset,
+                  data.begin() + (std::ptrdiff_t) end, params.begin());
+        callFunction(MemoryWrite, params);
+    }
+
+    std::vector<uint8_t> params;
+    callFunction(MemoryWriteEnd, params);
+}
+
+uint16_t OnboardProfiles::sectorCRC(const std::vector<uint8_t>& data) {
+    uint16_t crc = 0xffff;
+    for (std::size_t i = 0; i + 2 < data.size(); ++i) {
+        crc ^= (uint16_t) (data[i] << 8);
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+    }
+    return crc;
+}
+
+bool OnboardProfiles::checkCRC(const std::vector<uint8_t>& data) {
+    if (data.size() < 2)
+        return false;
+    auto stored = (uint16_t) (data[data.size() - 2] << 8 | data[data.size() - 1]);
+    return stored == sectorCRC(data);
+}
+
+void OnboardProfiles::updateCRC(std::vector<uint8_t>& data) {
+    if (data.size() < 2)
+        return;
+    auto crc = sectorCRC(data);
+    data[data.size() - 2] = crc >> 8;
+    data[data.size() - 1] = crc & 0xff;
+}
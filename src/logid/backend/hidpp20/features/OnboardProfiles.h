@@ -0,0 +1,108 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_BACKEND_HIDPP20_FEATURE_ONBOARDPROFILES_H
+#define LOGID_BACKEND_HIDPP20_FEATURE_ONBOARDPROFILES_H
+
+#include <backend/hidpp20/Feature.h>
+#include <backend/hidpp20/feature_defs.h>
+
+namespace logid::backend::hidpp20 {
+    class OnboardProfiles : public Feature {
+    public:
+        static constexpr uint16_t ID = FeatureID::ONBOARD_PROFILES;
+
+        [[nodiscard]] uint16_t getID() final { return ID; }
+
+        enum Function : uint8_t {
+            GetInfo = 0,
+            SetMode = 1,
+            GetMode = 2,
+            SetCurrentProfile = 3,
+            GetCurrentProfile = 4,
+            MemoryRead = 5,
+            MemoryAddrWrite = 6,
+            MemoryWrite = 7,
+            MemoryWriteEnd = 8
+        };
+
+        enum Mode : uint8_t {
+            NoChange = 0,
+            Onboard = 1,
+            Host = 2
+        };
+
+        // Memory is read and written in chunks of this many bytes
+        static constexpr std::size_t chunk_size = 16;
+
+        // Sector 0 lists the profiles, ROM copies start at this sector
+        static constexpr uint16_t directory_sector = 0x0000;
+        static constexpr uint16_t rom_sector = 0x0100;
+
+        struct Info {
+            uint8_t memoryModel;
+            uint8_t profileFormat;
+            uint8_t macroFormat;
+            uint8_t profileCount;
+            uint8_t profileCountOOB;
+            uint8_t buttonCount;
+            uint8_t sectorCount;
+            uint16_t sectorSize;
+            uint8_t mechanicalLayout;
+            uint8_t variousInfo;
+
+            typedef Layout<Field<0, &Info::memoryModel>,
+                    Field<1, &Info::profileFormat>,
+                    Field<2, &Info::macroFormat>,
+                    Field<3, &Info::profileCount>,
+                    Field<4, &Info::profileCountOOB>,
+                    Field<5, &Info::buttonCount>,
+                    Field<6, &Info::sectorCount>,
+                    Field<7, &Info::sectorSize>,
+                    Field<9, &Info::mechanicalLayout>,
+                    Field<10, &Info::variousInfo>> layout;
+        };
+
+        explicit OnboardProfiles(Device* dev);
+
+        [[nodiscard]] Info getInfo();
+
+        [[nodiscard]] Mode getMode();
+
+        void setMode(Mode mode);
+
+        // Profiles are numbered from 1
+        [[nodiscard]] uint16_t getCurrentProfile();
+
+        void setCurrentProfile(uint16_t profile);
+
+        // size must be at least chunk_size
+        [[nodiscard]] std::vector<uint8_t> readSector(uint16_t sector, std::size_t size);
+
+        /* Replaces the whole sector, data must already end with its CRC */
+        void writeSector(uint16_t sector, const std::vector<uint8_t>& data);
+
+        // CRC-CCITT over everything but the last two bytes of a sector
+        [[nodiscard]] static uint16_t sectorCRC(const std::vector<uint8_t>& data);
+
+        [[nodiscard]] static bool checkCRC(const std::vector<uint8_t>& data);
+
+        static void updateCRC(std::vector<uint8_t>& data);
+    };
+}
+
+#endif //LOGID_BACKEND_HIDPP20_FEATURE_ONBOARDPROFILES_H
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <backend/hidpp20/features/ReportRate.h>
+
+using namespace logid::backend::hidpp20;
+
+namespace {
+    struct RateParams {
+        uint8_t interval;
+
+        typedef Layout<Field<0, &RateParams::interval>> layout;
+    };
+
+    namespace fn {
+        // Bit n is set when an interval of n + 1 ms is supported
+        typedef FunctionDescriptor<ReportRate::GetReportRateList,
+                NoParams, RateParams> GetReportRateList;
+        typedef FunctionDescriptor<ReportRate::GetReportRate, NoParams, RateParams> GetReportRate;
+        typedef FunctionDescriptor<ReportRate::SetReportRate, RateParams> SetReportRate;
+    }
+}
+
+ReportRate::ReportRate(Device* dev) : Feature(dev, ID) {
+}
+
+std::vector<uint8_t> ReportRate::getReportRateList() {
+    auto flags = callStatic<fn::GetReportRateList>().interval;
+    std::vector<uint8_t> intervals;
+    for (uint8_t i = 0; i < 8; ++i) {
+        if (flags & (1 << i))
+            intervals.push_back(i + 1);
+    }
+    return intervals;
+}
+
+uint8_t ReportRate::getReportRate() {
+    return call<fn::GetReportRate>().interval;
+}
+
+void ReportRate::setReportRate(uint8_t interval) {
+    write<fn::SetReportRate>({interval}, {.readback = GetReportRate, .readback_length = 1});
+}
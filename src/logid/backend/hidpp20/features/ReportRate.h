@@ -0,0 +1,49 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_BACKEND_HIDPP20_FEATURE_REPORTRATE_H
+#define LOGID_BACKEND_HIDPP20_FEATURE_REPORTRATE_H
+
+#include <backend/hidpp20/Feature.h>
+#include <backend/hidpp20/feature_defs.h>
+
+namespace logid::backend::hidpp20 {
+    class ReportRate : public Feature {
+    public:
+        static constexpr uint16_t ID = FeatureID::REPORT_RATE;
+
+        [[nodiscard]] uint16_t getID() final { return ID; }
+
+        enum Function : uint8_t {
+            GetReportRateList = 0,
+            GetReportRate = 1,
+            SetReportRate = 2
+        };
+
+        explicit ReportRate(Device* dev);
+
+        // Report intervals in ms the device supports, ascending
+        [[nodiscard]] std::vector<uint8_t> getReportRateList();
+
+        // The report interval in ms
+        [[nodiscard]] uint8_t getReportRate();
+
+        void setReportRate(uint8_t interval);
+    };
+}
+
+#endif //LOGID_BACKEND_HIDPP20_FEATURE_REPORTRATE_H
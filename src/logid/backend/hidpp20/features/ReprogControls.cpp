@@ -18,6 +18,7 @@
 #include <backend/hidpp20/features/ReprogControls.h>
 #include <backend/hidpp20/Error.h>
 #include <backend/hidpp20/Device.h>
+#include <algorithm>
 #include <cassert>
 
 using namespace logid::backend::hidpp20;
@@ -39,6 +40,9 @@ DEFINE_REPROG(ReprogControlsV4, ReprogControlsV3)
 
 template<typename T>
 std::shared_ptr<T> make_reprog(Device* dev) {
+    if (!dev->featureSupported(T::ID))
+        return {};
+
     try {
         return std::make_shared<T>(dev);
     } catch (UnsupportedFeature& e) {
@@ -62,7 +66,7 @@ std::shared_ptr<ReprogControls> ReprogControls::autoVersion(Device* dev) {
 
 uint8_t ReprogControls::getControlCount() {
     std::vector<uint8_t> params(0);
-    auto response = callFunction(GetControlCount, params);
+    auto response = callStaticFunction(GetControlCount, params);
     return response[0];
 }
 
@@ -70,7 +74,7 @@ ReprogControls::ControlInfo ReprogControls::getControlInfo(uint8_t index) {
     std::vector<uint8_t> params(1);
     ControlInfo info{};
     params[0] = index;
-    auto response = callFunction(GetControlInfo, params);
+    auto response = callStaticFunction(GetControlInfo, params);
 
     info.controlID = response[1];
     info.controlID |= response[0] << 8;
@@ -129,30 +133,31 @@ ReprogControls::ControlInfo ReprogControls::getControlIdInfo(uint16_t cid) {
     return report;
 }
 
-void ReprogControls::setControlReporting(uint8_t cid, ControlInfo info) {
+void ReprogControls::setControlReporting(uint16_t cid, ControlInfo info) {
     // This function does not exist pre-v4 and cannot be emulated, ignore.
     (void) cid;
     (void) info; // Suppress unused warnings
 }
 
-std::set<uint16_t> ReprogControls::divertedButtonEvent(
-        const hidpp::Report& report) {
+ReprogControls::DivertedButtons ReprogControls::divertedButtonEvent(
+        hidpp::ReportView report) {
     assert(report.function() == DivertedButtonEvent);
-    std::set<uint16_t> buttons;
-    uint8_t cids = std::distance(report.paramBegin(), report.paramEnd()) / 2;
-    for (uint8_t i = 0; i < cids; i++) {
+    DivertedButtons buttons{};
+    auto cids = std::min<std::size_t>(
+            std::distance(report.paramBegin(), report.paramEnd()) / 2,
+            max_diverted_buttons);
+    for (std::size_t i = 0; i < cids; i++) {
         uint16_t cid = report.paramBegin()[2 * i + 1];
         cid |= report.paramBegin()[2 * i] << 8;
         if (cid)
-            buttons.insert(cid);
+            buttons.cids[buttons.count++] = cid;
         else
             break;
     }
     return buttons;
 }
 
-ReprogControls::Move ReprogControls::divertedRawXYEvent(const hidpp::Report
-                                                        & report) {
+ReprogControls::Move ReprogControls::divertedRawXYEvent(hidpp::ReportView report) {
     assert(report.function() == DivertedRawXYEvent);
     Move move{};
     move.x = (int16_t) ((report.paramBegin()[0] << 8) | report.paramBegin()[1]);
@@ -173,12 +178,12 @@ ReprogControls::ControlInfo ReprogControlsV4::getControlReporting(uint16_t cid)
     return info;
 }
 
-void ReprogControlsV4::setControlReporting(uint8_t cid, ControlInfo info) {
+void ReprogControlsV4::setControlReporting(uint16_t cid, ControlInfo info) {
     std::vector<uint8_t> params(5);
     params[0] = (cid >> 8) & 0xff;
     params[1] = cid & 0xff;
     params[2] = info.flags;
     params[3] = (info.controlID >> 8) & 0xff;
     params[4] = info.controlID & 0xff;
-    callFunction(SetControlReporting, params);
+    writeFunction(SetControlReporting, params, {.length = 2});
 }
\ No newline at end of file
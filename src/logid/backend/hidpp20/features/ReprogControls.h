@@ -21,6 +21,8 @@
 #include <backend/hidpp20/feature_defs.h>
 #include <backend/hidpp20/Feature.h>
 #include <backend/hidpp/Report.h>
+#include <array>
+#include <atomic>
 #include <map>
 #include <set>
 #include <memory>
@@ -77,6 +79,18 @@ namespace logid::backend::hidpp20 {
             int16_t y;
         };
 
+        // A long report fits 8 CIDs
+        static constexpr std::size_t max_diverted_buttons = 8;
+
+        struct DivertedButtons {
+            std::array<uint16_t, max_diverted_buttons> cids;
+            std::size_t count;
+
+            [[nodiscard]] const uint16_t* begin() const { return cids.data(); }
+
+            [[nodiscard]] const uint16_t* end() const { return cids.data() + count; }
+        };
+
         static const uint16_t ID = FeatureID::REPROG_CONTROLS;
 
         [[nodiscard]] uint16_t getID() override { return ID; }
@@ -100,11 +114,11 @@ namespace logid::backend::hidpp20 {
         [[nodiscard]] virtual ControlInfo getControlReporting(uint16_t cid);
 
         // Only controlId (for remap) and flags will be read
-        virtual void setControlReporting(uint8_t cid, ControlInfo info);
+        virtual void setControlReporting(uint16_t cid, ControlInfo info);
 
-        [[nodiscard]] static std::set<uint16_t> divertedButtonEvent(const hidpp::Report& report);
+        [[nodiscard]] static DivertedButtons divertedButtonEvent(hidpp::ReportView report);
 
-        [[nodiscard]] static Move divertedRawXYEvent(const hidpp::Report& report);
+        [[nodiscard]] static Move divertedRawXYEvent(hidpp::ReportView report);
 
         [[nodiscard]] static std::shared_ptr<ReprogControls> autoVersion(Device* dev);
 
@@ -112,7 +126,8 @@ namespace logid::backend::hidpp20 {
         ReprogControls(Device* dev, uint16_t _id);
 
         std::map<uint16_t, ControlInfo> _cids;
-        bool _cids_initialized = false;
+        // Read without _cids_populating, set once _cids is complete
+        std::atomic<bool> _cids_initialized = false;
         std::mutex _cids_populating;
     };
 
@@ -162,7 +177,7 @@ namespace logid::backend::hidpp20 {
 
         [[nodiscard]] ControlInfo getControlReporting(uint16_t cid) override;
 
-        void setControlReporting(uint8_t cid, ControlInfo info) override;
+        void setControlReporting(uint16_t cid, ControlInfo info) override;
 
         explicit ReprogControlsV4(Device* dev);
 
@@ -20,6 +20,7 @@
 #include <backend/hidpp20/Feature.h>
 #include <backend/hidpp20/Error.h>
 
+using namespace logid::backend;
 using namespace logid::backend::hidpp20;
 
 namespace {
@@ -71,11 +72,16 @@ uint8_t Root::ping(uint8_t byte) {
 }
 
 std::tuple<uint8_t, uint8_t> Root::getVersion() {
-    std::vector<uint8_t> params(0);
-    auto response = this->callFunction(Root::Function::Ping, params);
+    return tryGetVersion().value();
+}
+
+Result<std::tuple<uint8_t, uint8_t>> Root::tryGetVersion() {
+    auto response = this->tryCallFunction(Root::Function::Ping, {});
+    if (!response)
+        return response.error();
 
-    if (response[0] == 0x11)
-        return std::make_tuple(1, 0);
+    if ((*response)[0] == 0x11)
+        return std::make_tuple<uint8_t, uint8_t>(1, 0);
 
-    return std::make_tuple(response[0], response[1]);
+    return std::make_tuple((*response)[0], (*response)[1]);
 }
\ No newline at end of file
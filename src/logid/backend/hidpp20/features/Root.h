@@ -43,6 +43,9 @@ namespace logid::backend::hidpp20 {
 
         std::tuple<uint8_t, uint8_t> getVersion();
 
+        // The first request to a device, absent and sleeping ones fail it
+        [[nodiscard]] Result<std::tuple<uint8_t, uint8_t>> tryGetVersion();
+
         enum FeatureFlag : uint8_t {
             Obsolete = 1 << 7,
             Hidden = 1 << 6,
@@ -16,9 +16,48 @@
  *
  */
 #include <backend/hidpp20/features/SmartShift.h>
+#include <backend/hidpp20/Device.h>
 
 using namespace logid::backend::hidpp20;
 
+namespace {
+    /* Shared by v1 and v2, v1 replies to GetStatus with the default
+     * auto disengage value in place of the torque. */
+    struct StatusParams {
+        uint8_t active;
+        uint8_t auto_disengage;
+        uint8_t torque;
+
+        typedef Layout<Field<0, &StatusParams::active>,
+                Field<1, &StatusParams::auto_disengage>,
+                Field<2, &StatusParams::torque>> layout;
+    };
+
+    struct CapabilitiesResponse {
+        uint8_t flags;
+        uint8_t auto_disengage;
+        uint8_t torque;
+        uint8_t max_force;
+
+        typedef Layout<Field<0, &CapabilitiesResponse::flags>,
+                Field<1, &CapabilitiesResponse::auto_disengage>,
+                Field<2, &CapabilitiesResponse::torque>,
+                Field<3, &CapabilitiesResponse::max_force>> layout;
+    };
+
+    namespace fn {
+        typedef FunctionDescriptor<SmartShift::GetStatus, NoParams, StatusParams> GetStatus;
+        typedef FunctionDescriptor<SmartShift::SetStatus, StatusParams> SetStatus;
+    }
+
+    namespace fn_v2 {
+        typedef FunctionDescriptor<SmartShiftV2::GetCapabilities,
+                NoParams, CapabilitiesResponse> GetCapabilities;
+        typedef FunctionDescriptor<SmartShiftV2::GetStatus, NoParams, StatusParams> GetStatus;
+        typedef FunctionDescriptor<SmartShiftV2::SetStatus, StatusParams> SetStatus;
+    }
+}
+
 SmartShift::SmartShift(Device* dev) : SmartShift(dev, ID) {
 }
 
@@ -31,6 +70,9 @@ SmartShiftV2::SmartShiftV2(Device* dev) : SmartShift(dev, ID) {
 
 template<typename T>
 std::shared_ptr<T> make_smartshift(Device* dev) {
+    if (!dev->featureSupported(T::ID))
+        return {};
+
     try {
         return std::make_shared<T>(dev);
     } catch (UnsupportedFeature& e) {
@@ -46,13 +88,11 @@ std::shared_ptr<SmartShift> SmartShift::autoVersion(Device* dev) {
 }
 
 SmartShift::Status SmartShift::getStatus() {
-    std::vector<uint8_t> params(0);
-
-    auto response = callFunction(GetStatus, params);
+    auto response = call<fn::GetStatus>();
 
     return {
-            .active = static_cast<bool>(response[0] - 1),
-            .autoDisengage = response[1],
+            .active = static_cast<bool>(response.active - 1),
+            .autoDisengage = response.auto_disengage,
             .torque = 0,
             .setActive = false,
             .setAutoDisengage = false,
@@ -61,65 +101,57 @@ SmartShift::Status SmartShift::getStatus() {
 }
 
 SmartShift::Defaults SmartShift::getDefaults() {
-    std::vector<uint8_t> params(0);
-
-    auto response = callFunction(GetStatus, params);
+    auto response = call<fn::GetStatus>();
 
     return {
-            .autoDisengage = response[2],
+            .autoDisengage = response.torque,
             .torque = 0,
             .maxForce = 0,
     };
 }
 
 void SmartShift::setStatus(Status status) {
-    std::vector<uint8_t> params(3);
+    StatusParams params{};
     if (status.setActive)
-        params[0] = status.active + 1;
+        params.active = status.active + 1;
     if (status.setAutoDisengage)
-        params[1] = status.autoDisengage;
-    callFunction(SetStatus, params);
+        params.auto_disengage = status.autoDisengage;
+    write<fn::SetStatus>(params);
 }
 
 SmartShift::Defaults SmartShiftV2::getDefaults() {
-    std::vector<uint8_t> params(0);
-    auto response = callFunction(GetCapabilities, params);
+    auto response = callStatic<fn_v2::GetCapabilities>();
 
     return {
-            .autoDisengage = response[1],
-            .torque = response[2],
-            .maxForce = response[3],
+            .autoDisengage = response.auto_disengage,
+            .torque = response.torque,
+            .maxForce = response.max_force,
     };
 }
 
 SmartShift::Status SmartShiftV2::getStatus() {
-    std::vector<uint8_t> params(0);
-    auto response = callFunction(GetStatus, params);
+    auto response = call<fn_v2::GetStatus>();
 
     return {
-            .active = static_cast<bool>(response[0] - 1),
-            .autoDisengage = response[1],
-            .torque = response[2],
+            .active = static_cast<bool>(response.active - 1),
+            .autoDisengage = response.auto_disengage,
+            .torque = response.torque,
             .setActive = false, .setAutoDisengage = false, .setTorque = false,
     };
 }
 
 void SmartShiftV2::setStatus(Status status) {
-    std::vector<uint8_t> params(3);
+    StatusParams params{};
     if (status.setActive)
-        params[0] = status.active + 1;
+        params.active = status.active + 1;
     if (status.setAutoDisengage)
-        params[1] = status.autoDisengage;
+        params.auto_disengage = status.autoDisengage;
     if (status.setTorque)
-        params[2] = status.torque;
+        params.torque = status.torque;
 
-    callFunction(SetStatus, params);
+    write<fn_v2::SetStatus>(params);
 }
 
 bool SmartShiftV2::supportsTorque() {
-    std::vector<uint8_t> params(0);
-    auto response = callFunction(GetCapabilities, params);
-
-    return static_cast<bool>(response[0] & 1);
+    return callStatic<fn_v2::GetCapabilities>().flags & 1;
 }
-
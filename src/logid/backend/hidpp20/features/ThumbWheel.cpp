@@ -21,53 +21,84 @@
 
 using namespace logid::backend::hidpp20;
 
+namespace {
+    struct InfoResponse {
+        uint16_t native_res;
+        uint16_t diverted_res;
+        bool default_direction;
+        uint8_t capabilities;
+        uint16_t time_elapsed;
+
+        typedef Layout<Field<0, &InfoResponse::native_res>,
+                Field<2, &InfoResponse::diverted_res>,
+                Field<4, &InfoResponse::default_direction>,
+                Field<5, &InfoResponse::capabilities>,
+                Field<6, &InfoResponse::time_elapsed>> layout;
+    };
+
+    struct StatusResponse {
+        bool diverted;
+        uint8_t flags;
+
+        typedef Layout<Field<0, &StatusResponse::diverted>,
+                Field<1, &StatusResponse::flags>> layout;
+    };
+
+    struct ReportingParams {
+        bool divert;
+        bool invert;
+
+        typedef Layout<Field<0, &ReportingParams::divert>,
+                Field<1, &ReportingParams::invert>> layout;
+    };
+
+    namespace fn {
+        typedef FunctionDescriptor<ThumbWheel::GetInfo, NoParams, InfoResponse> GetInfo;
+        typedef FunctionDescriptor<ThumbWheel::GetStatus, NoParams, StatusResponse> GetStatus;
+        typedef FunctionDescriptor<ThumbWheel::SetReporting,
+                ReportingParams, StatusResponse> SetReporting;
+    }
+}
+
 ThumbWheel::ThumbWheel(Device* dev) : Feature(dev, ID) {
 }
 
 ThumbWheel::ThumbwheelInfo ThumbWheel::getInfo() {
-    std::vector<uint8_t> params(0), response;
-    ThumbwheelInfo info{};
-    response = callFunction(GetInfo, params);
+    auto response = callStatic<fn::GetInfo>();
 
-    info.nativeRes = response[1];
-    info.nativeRes |= (response[0] << 8);
-    info.divertedRes = response[3];
-    info.divertedRes |= (response[2] << 8);
-    info.defaultDirection = response[4] ? 1 : -1; /* 1 increment to the right */
-    info.capabilities = response[5];
-    info.timeElapsed = response[7];
-    info.timeElapsed |= response[6] << 8;
+    ThumbwheelInfo info{};
+    info.nativeRes = response.native_res;
+    info.divertedRes = response.diverted_res;
+    info.defaultDirection = response.default_direction ? 1 : -1; /* 1 increment to the right */
+    info.capabilities = response.capabilities;
+    info.timeElapsed = response.time_elapsed;
 
     return info;
 }
 
 ThumbWheel::ThumbwheelStatus ThumbWheel::getStatus() {
-    std::vector<uint8_t> params(0), response;
-    ThumbwheelStatus status{};
-    response = callFunction(GetStatus, params);
+    auto response = call<fn::GetStatus>();
 
-    status.diverted = response[0];
-    status.inverted = response[1] & 1;
-    status.touch = response[1] & (1 << 1);
-    status.proxy = response[1] & (1 << 2);
+    ThumbwheelStatus status{};
+    status.diverted = response.diverted;
+    status.inverted = response.flags & 1;
+    status.touch = response.flags & (1 << 1);
+    status.proxy = response.flags & (1 << 2);
 
     return status;
 }
 
 ThumbWheel::ThumbwheelStatus ThumbWheel::setStatus(bool divert, bool invert) {
-    std::vector<uint8_t> params(2), response;
-    ThumbwheelStatus status{};
-    params[0] = divert;
-    params[1] = invert;
+    auto response = call<fn::SetReporting>({divert, invert});
 
-    response = callFunction(SetReporting, params);
-    status.diverted = response[0];
-    status.inverted = response[1] & 1;
+    ThumbwheelStatus status{};
+    status.diverted = response.diverted;
+    status.inverted = response.flags & 1;
 
     return status;
 }
 
-ThumbWheel::ThumbwheelEvent ThumbWheel::thumbwheelEvent(const hidpp::Report& report) {
+ThumbWheel::ThumbwheelEvent ThumbWheel::thumbwheelEvent(hidpp::ReportView report) {
     assert(report.function() == Event);
     ThumbwheelEvent event{};
     event.rotation = (int16_t) ((report.paramBegin()[0] << 8) | report.paramBegin()[1]);
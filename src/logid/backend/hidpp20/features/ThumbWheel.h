@@ -83,7 +83,7 @@ namespace logid::backend::hidpp20 {
 
         ThumbwheelStatus setStatus(bool divert, bool invert);
 
-        [[nodiscard]] static ThumbwheelEvent thumbwheelEvent(const hidpp::Report& report);
+        [[nodiscard]] static ThumbwheelEvent thumbwheelEvent(hidpp::ReportView report);
     };
 }
 
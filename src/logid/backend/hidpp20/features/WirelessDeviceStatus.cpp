@@ -24,7 +24,7 @@ WirelessDeviceStatus::WirelessDeviceStatus(Device* dev) : Feature(dev, ID) {
 }
 
 WirelessDeviceStatus::Status WirelessDeviceStatus::statusBroadcastEvent(
-        const hidpp::Report& report) {
+        hidpp::ReportView report) {
     assert(report.function() == StatusBroadcast);
     Status status = {};
     auto params = report.paramBegin();
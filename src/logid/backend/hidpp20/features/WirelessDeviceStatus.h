@@ -41,7 +41,7 @@ namespace logid::backend::hidpp20 {
             bool powerSwitch;
         };
 
-        static Status statusBroadcastEvent(const hidpp::Report& report);
+        static Status statusBroadcastEvent(hidpp::ReportView report);
     };
 }
 
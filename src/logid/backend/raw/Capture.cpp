@@ -0,0 +1,183 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <backend/raw/Capture.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+using namespace logid::backend::raw;
+using namespace std::chrono;
+
+std::atomic<CaptureWriter*> capture_detail::writer = nullptr;
+
+namespace {
+    constexpr std::size_t head_size = 12;
+    constexpr std::size_t file_buffer = 1 << 16;
+    // A crashed or killed daemon loses at most this much of the capture
+    constexpr auto flush_interval = milliseconds(100);
+
+    struct FileHeader {
+        char magic[8];
+        uint16_t version;
+        uint16_t reserved;
+        uint32_t reserved2;
+    };
+
+    static_assert(sizeof(FileHeader) == 16);
+}
+
+CaptureWriter::CaptureWriter(const std::string& file) :
+        _file(std::fopen(file.c_str(), "wb")) {
+    if (!_file)
+        throw std::system_error(errno, std::system_category(),
+                                "capture open failed");
+
+    std::setvbuf(_file, nullptr, _IOFBF, file_buffer);
+
+    FileHeader header{};
+    std::memcpy(header.magic, capture_magic, sizeof(header.magic));
+    header.version = capture_version;
+    if (std::fwrite(&header, sizeof(header), 1, _file) != 1) {
+        int err = errno;
+        std::fclose(_file);
+        throw std::system_error(err, std::system_category(),
+                                "capture write failed");
+    }
+}
+
+CaptureWriter::~CaptureWriter() noexcept {
+    std::fclose(_file);
+}
+
+void CaptureWriter::write(const std::string& path, bool out,
+                          steady_clock::time_point time,
+                          const uint8_t* data, std::size_t length) {
+    auto time_ns = static_cast<uint64_t>(
+            duration_cast<nanoseconds>(time.time_since_epoch()).count());
+
+    std::lock_guard lock(_mutex);
+    _record(time_ns, _nodeId(path), out ? capture_out : 0, data, length);
+
+    if (time - _last_flush >= flush_interval) {
+        std::fflush(_file);
+        _last_flush = time;
+    }
+}
+
+void CaptureWriter::flush() {
+    std::lock_guard lock(_mutex);
+    std::fflush(_file);
+}
+
+uint16_t CaptureWriter::_nodeId(const std::string& path) {
+    for (std::size_t i = 0; i < _nodes.size(); ++i) {
+        if (_nodes[i] == path)
+            return static_cast<uint16_t>(i);
+    }
+
+    auto id = static_cast<uint16_t>(_nodes.size());
+    _nodes.push_back(path);
+    _record(0, id, capture_node, reinterpret_cast<const uint8_t*>(path.data()),
+            path.size());
+    return id;
+}
+
+void CaptureWriter::_record(uint64_t time_ns, uint16_t node, uint8_t flags,
+                            const uint8_t* data, std::size_t length) {
+    uint8_t head[head_size];
+    length = std::min<std::size_t>(length, UINT8_MAX);
+    std::memcpy(head, &time_ns, sizeof(time_ns));
+    std::memcpy(head + 8, &node, sizeof(node));
+    head[10] = flags;
+    head[11] = static_cast<uint8_t>(length);
+
+    // A short write only costs the rest of the capture, never the daemon
+    std::fwrite(head, sizeof(head), 1, _file);
+    std::fwrite(data, 1, length, _file);
+}
+
+CaptureReader::CaptureReader(const std::string& file) :
+        _file(std::fopen(file.c_str(), "rb")) {
+    if (!_file)
+        throw std::system_error(errno, std::system_category(),
+                                "capture open failed");
+
+    FileHeader header{};
+    if (std::fread(&header, sizeof(header), 1, _file) != 1 ||
+        std::memcmp(header.magic, capture_magic, sizeof(header.magic)) != 0) {
+        std::fclose(_file);
+        throw std::runtime_error("not a logid capture");
+    }
+
+    if (header.version != capture_version) {
+        std::fclose(_file);
+        throw std::runtime_error("unsupported capture version");
+    }
+}
+
+CaptureReader::~CaptureReader() noexcept {
+    std::fclose(_file);
+}
+
+bool CaptureReader::next(CaptureRecord& record) {
+    while (true) {
+        uint8_t head[head_size];
+        if (std::fread(head, sizeof(head), 1, _file) != 1)
+            return false;
+
+        std::memcpy(&record.time_ns, head, sizeof(record.time_ns));
+        std::memcpy(&record.node, head + 8, sizeof(record.node));
+        record.flags = head[10];
+        record.data.resize(head[11]);
+
+        if (!record.data.empty() &&
+            std::fread(record.data.data(), record.data.size(), 1, _file) != 1)
+            return false; // Truncated by a killed writer
+
+        if (!(record.flags & capture_node))
+            return true;
+
+        if (record.node >= _nodes.size())
+            _nodes.resize(record.node + 1);
+        _nodes[record.node].assign(record.data.begin(), record.data.end());
+    }
+}
+
+const std::string& CaptureReader::nodePath(uint16_t node) const {
+    return _nodes.at(node);
+}
+
+const std::vector<std::string>& CaptureReader::nodes() const {
+    return _nodes;
+}
+
+void logid::backend::raw::startCapture(const std::string& file) {
+    if (capturing())
+        throw std::logic_error("capture already started");
+
+    // Reports are captured for the whole lifetime of the daemon
+    capture_detail::writer.store(new CaptureWriter(file), std::memory_order_release);
+
+    std::atexit([]() {
+        if (auto w = capture_detail::writer.load())
+            w->flush();
+    });
+}
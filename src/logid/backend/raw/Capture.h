@@ -0,0 +1,132 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_RAW_CAPTURE_H
+#define LOGID_BACKEND_RAW_CAPTURE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Binary capture of every report going through a RawDevice.
+ *
+ * The file starts with a header (magic "LOGIDCAP", u16 version, u16
+ * reserved, u32 reserved) followed by records of a fixed 12 byte head and
+ * the payload:
+ *   u64 time_ns   steady clock time the report was read or sent
+ *   u16 node      node id, defined by an earlier node record
+ *   u8  flags     capture_out, capture_node
+ *   u8  length    payload length
+ * Node records carry the hidraw path as their payload. Everything is in
+ * host byte order, captures are meant to be read back on the same machine
+ * or one of the same endianness.
+ */
+namespace logid::backend::raw {
+    static constexpr char capture_magic[8] = {'L', 'O', 'G', 'I', 'D', 'C', 'A', 'P'};
+    static constexpr uint16_t capture_version = 1;
+
+    static constexpr uint8_t capture_out = 1 << 0;
+    static constexpr uint8_t capture_node = 1 << 1;
+
+    struct CaptureRecord {
+        uint64_t time_ns;
+        uint16_t node;
+        uint8_t flags;
+        std::vector<uint8_t> data;
+
+        [[nodiscard]] bool out() const {
+            return flags & capture_out;
+        }
+    };
+
+    class CaptureWriter {
+    public:
+        explicit CaptureWriter(const std::string& file);
+
+        ~CaptureWriter() noexcept;
+
+        CaptureWriter(const CaptureWriter&) = delete;
+
+        CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+        void write(const std::string& path, bool out,
+                   std::chrono::steady_clock::time_point time,
+                   const uint8_t* data, std::size_t length);
+
+        void flush();
+
+    private:
+        uint16_t _nodeId(const std::string& path);
+
+        void _record(uint64_t time_ns, uint16_t node, uint8_t flags,
+                     const uint8_t* data, std::size_t length);
+
+        std::mutex _mutex;
+        FILE* _file;
+        std::vector<std::string> _nodes;
+        std::chrono::steady_clock::time_point _last_flush;
+    };
+
+    class CaptureReader {
+    public:
+        explicit CaptureReader(const std::string& file);
+
+        ~CaptureReader() noexcept;
+
+        CaptureReader(const CaptureReader&) = delete;
+
+        CaptureReader& operator=(const CaptureReader&) = delete;
+
+        /* Reads the next report record, node records are consumed along
+         * the way. Returns false at the end of the capture. */
+        bool next(CaptureRecord& record);
+
+        [[nodiscard]] const std::string& nodePath(uint16_t node) const;
+
+        [[nodiscard]] const std::vector<std::string>& nodes() const;
+
+    private:
+        FILE* _file;
+        std::vector<std::string> _nodes;
+    };
+
+    /* Starts capturing into file, an existing file is truncated. Called
+     * once, before any device is opened. */
+    void startCapture(const std::string& file);
+
+    namespace capture_detail {
+        extern std::atomic<CaptureWriter*> writer;
+    }
+
+    inline void captureReport(const std::string& path, bool out,
+                              std::chrono::steady_clock::time_point time,
+                              const uint8_t* data, std::size_t length) {
+        if (auto writer = capture_detail::writer.load(std::memory_order_acquire))
+            writer->write(path, out, time, data, length);
+    }
+
+    [[nodiscard]] inline bool capturing() {
+        return capture_detail::writer.load(std::memory_order_relaxed);
+    }
+}
+
+#endif //LOGID_BACKEND_RAW_CAPTURE_H
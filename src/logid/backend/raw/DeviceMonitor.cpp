@@ -24,17 +24,28 @@
 #include <util/task.h>
 #include <util/log.h>
 #include <system_error>
+#include <algorithm>
+#include <cstdio>
+#include <string_view>
 
 extern "C"
 {
 #include <libudev.h>
+#include <unistd.h>
+#include <fcntl.h>
 }
 
 using namespace logid;
 using namespace logid::backend::raw;
 
-DeviceMonitor::DeviceMonitor() : _io_monitor(std::make_shared<IOMonitor>()),
-                                 _ready(false) {
+DeviceMonitor::DeviceMonitor(int read_batch, int io_threads, bool edge_triggered,
+                             std::set<uint16_t> vendors, const thread_sched& io_sched) :
+        _ready(false), _read_batch(std::max(read_batch, 1)), _vendors(std::move(vendors)),
+        _retry(max_tries, std::chrono::milliseconds(ready_backoff * 8),
+               std::chrono::milliseconds(retry_spacing)) {
+    for (int i = 0; i < std::max(io_threads, 1); ++i)
+        _io_monitors.push_back(std::make_shared<IOMonitor>(edge_triggered, io_sched));
+
     int ret;
     _udev_context = udev_new();
     if (!_udev_context)
@@ -75,7 +86,7 @@ DeviceMonitor::DeviceMonitor() : _io_monitor(std::make_shared<IOMonitor>()),
 
 DeviceMonitor::~DeviceMonitor() {
     if (_ready)
-        _io_monitor->remove(_fd);
+        _io_monitors.front()->remove(_fd);
 
     if (_udev_monitor)
         udev_monitor_unref(_udev_monitor);
@@ -88,25 +99,34 @@ void DeviceMonitor::ready() {
         return;
     _ready = true;
 
-    _io_monitor->add(_fd, {
+    _io_monitors.front()->add(_fd, {
             [self_weak = _self]() {
                 if (auto self = self_weak.lock()) {
-                    struct udev_device* device = udev_monitor_receive_device(self->_udev_monitor);
-                    std::string action = udev_device_get_action(device);
-                    std::string dev_node = udev_device_get_devnode(device);
-
-                    if (action == "add")
-                        run_task([self_weak, dev_node]() {
-                            if (auto self = self_weak.lock())
-                                self->_addHandler(dev_node);
-                        });
-                    else if (action == "remove")
-                        run_task([self_weak, dev_node]() {
-                            if (auto self = self_weak.lock())
-                                self->_removeHandler(dev_node);
-                        });
-
-                    udev_device_unref(device);
+                    struct udev_device* device;
+                    /* Drain all pending events, required in edge-triggered mode */
+                    while ((device = udev_monitor_receive_device(self->_udev_monitor))) {
+                        const char* action_cstr = udev_device_get_action(device);
+                        const char* dev_node_cstr = udev_device_get_devnode(device);
+                        if (!action_cstr || !dev_node_cstr) {
+                            udev_device_unref(device);
+                            continue;
+                        }
+
+                        std::string action = action_cstr;
+                        std::string dev_node = dev_node_cstr;
+
+                        // Removing a node that was never added does nothing
+                        if (action == "add" && self->_wanted(device)) {
+                            self->_noteSeat(device, dev_node);
+                            self->_queueAdd(dev_node);
+                        } else if (action == "remove")
+                            self->_tasks.add(run_task([self_weak, dev_node]() {
+                                if (auto self = self_weak.lock())
+                                    self->_removeHandler(dev_node);
+                            }));
+
+                        udev_device_unref(device);
+                    }
                 }
             },
             []() {
@@ -131,6 +151,7 @@ void DeviceMonitor::enumerate() {
         throw std::system_error(-ret, std::system_category(),
                                 "udev_enumerate_scan_devices");
 
+    std::vector<std::string> nodes;
     struct udev_list_entry* udev_enum_entry;
     udev_list_entry_foreach(udev_enum_entry,
                             udev_enumerate_get_list_entry(udev_enum)) {
@@ -139,48 +160,118 @@ void DeviceMonitor::enumerate() {
         struct udev_device* device = udev_device_new_from_syspath(_udev_context, name);
         if (device) {
             const char* dev_node_cstr = udev_device_get_devnode(device);
-            if (dev_node_cstr) {
-                const std::string dev_node {dev_node_cstr};
-                udev_device_unref(device);
-
-                _addHandler(dev_node);
-            } else {
-                udev_device_unref(device);
+            if (dev_node_cstr && _wanted(device)) {
+                nodes.emplace_back(dev_node_cstr);
+                _noteSeat(device, nodes.back());
             }
+            udev_device_unref(device);
         }
     }
 
     udev_enumerate_unref(udev_enum);
+
+    {
+        std::lock_guard lock(_enum_mutex);
+        _enum_probed = 0;
+        _enum_total = nodes.size();
+        if (nodes.empty())
+            enumerationProgress(0, 0);
+    }
+    for (auto& node: nodes)
+        _queueAdd(node, true);
+}
+
+bool DeviceMonitor::_wanted(struct udev_device* device) const {
+    if (_vendors.empty())
+        return true;
+
+    struct udev_device* hid = udev_device_get_parent_with_subsystem_devtype(
+            device, "hid", nullptr);
+    const char* hid_id = hid ? udev_device_get_property_value(hid, "HID_ID") : nullptr;
+    unsigned int bus, vendor, product;
+    // Bus, vendor and product in hex, e.g. 0003:0000046D:0000C52B
+    if (!hid_id || sscanf(hid_id, "%x:%x:%x", &bus, &vendor, &product) != 3)
+        return true;
+
+    if (_vendors.contains(static_cast<uint16_t>(vendor)))
+        return true;
+
+    const char* dev_node = udev_device_get_devnode(device);
+    logPrintf(RAWREPORT, "Skipping %s of vendor %04x", dev_node ? dev_node : "?", vendor);
+    return false;
+}
+
+void DeviceMonitor::_noteSeat(struct udev_device* device, const std::string& dev_node) {
+    // ID_SEAT sits on whichever ancestor the seat rules tagged
+    const char* seat = nullptr;
+    for (auto d = device; d && !seat; d = udev_device_get_parent(d))
+        seat = udev_device_get_property_value(d, "ID_SEAT");
+
+    std::lock_guard lock(_seats_mutex);
+    if (seat && std::string_view(seat) != default_seat)
+        _seats[dev_node] = seat;
+    else
+        _seats.erase(dev_node);
+}
+
+std::string DeviceMonitor::seat(const std::string& path) const {
+    std::lock_guard lock(_seats_mutex);
+    auto it = _seats.find(path);
+    return it != _seats.end() ? it->second : default_seat;
+}
+
+std::tuple<uint32_t, uint32_t> DeviceMonitor::enumerationState() const {
+    return {_enum_probed, _enum_total};
+}
+
+void DeviceMonitor::enumerationProgress(uint32_t, uint32_t) {
+}
+
+void DeviceMonitor::_queueAdd(const std::string& device, bool enumerated) {
+    _tasks.add(run_task([self_weak = _self, device, enumerated]() {
+        if (auto self = self_weak.lock()) {
+            self->_addHandler(device);
+            if (enumerated) {
+                std::lock_guard lock(self->_enum_mutex);
+                self->enumerationProgress(++self->_enum_probed, self->_enum_total);
+            }
+        }
+    }, task_priority::background));
 }
 
 void DeviceMonitor::_addHandler(const std::string& device, int tries) {
+    std::optional<backend::DeviceNotReady::Reason> retry;
     try {
         auto supported_reports = backend::hidpp::getSupportedReports(
-                RawDevice::getReportDescriptor(device));
+                nodeInfo(device)->report_desc);
         if (supported_reports)
-            addDevice(device);
+            retry = addDevice(device);
         else
             logPrintf(DEBUG, "Unsupported device %s ignored", device.c_str());
     } catch (backend::DeviceNotReady& e) {
-        if (tries == max_tries) {
-            logPrintf(WARN, "Failed to add device %s after %d tries. Treating as failure.",
-                      device.c_str(), max_tries);
-        } else {
-            /* Do exponential backoff for 2^tries * backoff ms. */
-            std::chrono::milliseconds wait((1 << tries) * ready_backoff);
-            logPrintf(DEBUG, "Failed to add device %s on try %d, backing off for %dms",
-                      device.c_str(), tries + 1, wait.count());
-            run_task_after([self_weak = _self, device, tries]() {
-                if (auto self = self_weak.lock())
-                    self->_addHandler(device, tries + 1);
-            }, wait);
-        }
+        retry = e.reason();
     } catch (std::exception& e) {
         logPrintf(WARN, "Error adding device %s: %s", device.c_str(), e.what());
     }
+
+    if (!retry)
+        return;
+
+    bool scheduled = _retry.schedule(device, retry.value(), tries,
+                                     [self_weak = _self, device, tries]() {
+        if (auto self = self_weak.lock())
+            self->_addHandler(device, tries + 1);
+    });
+    if (scheduled)
+        logPrintf(DEBUG, "Failed to add device %s on try %d, retrying",
+                  device.c_str(), tries + 1);
+    else
+        logPrintf(WARN, "Failed to add device %s after %d tries. Treating as failure.",
+                  device.c_str(), max_tries);
 }
 
 void DeviceMonitor::_removeHandler(const std::string& device) {
+    _retry.cancel(device);
     try {
         removeDevice(device);
     } catch (std::exception& e) {
@@ -190,5 +281,65 @@ void DeviceMonitor::_removeHandler(const std::string& device) {
 }
 
 std::shared_ptr<IOMonitor> DeviceMonitor::ioMonitor() const {
-    return _io_monitor;
+    return *std::min_element(_io_monitors.begin(), _io_monitors.end(),
+                             [](const auto& a, const auto& b) {
+                                 return a->handlerCount() < b->handlerCount();
+                             });
+}
+
+std::vector<std::size_t> DeviceMonitor::ioHandlerCounts() const {
+    std::vector<std::size_t> ret;
+    for (auto& monitor: _io_monitors)
+        ret.push_back(monitor->handlerCount());
+    return ret;
+}
+
+std::vector<IOMonitor::DispatchStats> DeviceMonitor::ioDispatchStats() const {
+    std::vector<IOMonitor::DispatchStats> ret;
+    for (auto& monitor: _io_monitors)
+        ret.push_back(monitor->dispatchStats());
+    return ret;
+}
+
+std::vector<std::optional<IOMonitor::Stall>> DeviceMonitor::ioStalls() const {
+    std::vector<std::optional<IOMonitor::Stall>> ret;
+    for (auto& monitor: _io_monitors)
+        ret.push_back(monitor->stall());
+    return ret;
+}
+
+int DeviceMonitor::readBatch() const {
+    return _read_batch;
+}
+
+std::shared_ptr<const RawDevice::node_info> DeviceMonitor::nodeInfo(
+        const std::string& path, int fd) {
+    std::shared_ptr<const RawDevice::node_info> cached;
+    {
+        std::lock_guard lock(_node_info_lock);
+        auto it = _node_info.find(path);
+        if (it != _node_info.end())
+            cached = it->second;
+    }
+
+    auto info = RawDevice::getNodeInfo(fd, cached);
+    if (info != cached) {
+        std::lock_guard lock(_node_info_lock);
+        _node_info[path] = info;
+    }
+
+    return info;
+}
+
+std::shared_ptr<const RawDevice::node_info> DeviceMonitor::nodeInfo(
+        const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd == -1)
+        throw std::system_error(errno, std::system_category(),
+                                "open failed");
+
+    // fd is already closed if this throws
+    auto info = nodeInfo(path, fd);
+    ::close(fd);
+    return info;
 }
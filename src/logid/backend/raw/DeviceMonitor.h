@@ -23,18 +23,28 @@
 #include <mutex>
 #include <atomic>
 #include <memory>
+#include <vector>
+#include <map>
+#include <optional>
+#include <set>
+#include <tuple>
+#include <backend/raw/RawDevice.h>
+#include <backend/raw/IOMonitor.h>
+#include <backend/RetryScheduler.h>
+#include <util/task.h>
+#include <util/sched.h>
 
 extern "C"
 {
 struct udev;
 struct udev_monitor;
+struct udev_device;
 }
 
 namespace logid::backend::raw {
-    class IOMonitor;
-
     static constexpr int max_tries = 5;
     static constexpr int ready_backoff = 500;
+    static constexpr int retry_spacing = 20;
 
     template<typename T>
     class _deviceMonitorWrapper : public T {
@@ -54,10 +64,40 @@ namespace logid::backend::raw {
     public:
         virtual ~DeviceMonitor();
 
+        /* Probes every hidraw node present on the worker pool, nodes are
+         * probed concurrently and this returns once they are queued */
         void enumerate();
 
+        // Nodes probed by the last enumerate and how many it found
+        [[nodiscard]] std::tuple<uint32_t, uint32_t> enumerationState() const;
+
+        /* Returns the least loaded I/O thread, devices are spread across them */
         [[nodiscard]] std::shared_ptr<IOMonitor> ioMonitor() const;
 
+        // Handlers watched by each I/O thread
+        [[nodiscard]] std::vector<std::size_t> ioHandlerCounts() const;
+
+        // By I/O thread, see IOMonitor::setDispatchBudget
+        [[nodiscard]] std::vector<IOMonitor::DispatchStats> ioDispatchStats() const;
+
+        [[nodiscard]] std::vector<std::optional<IOMonitor::Stall>> ioStalls() const;
+
+        [[nodiscard]] int readBatch() const;
+
+        /* Static hidraw node info, cached across probes and reconnects.
+         * fd must be an open handle to path. */
+        [[nodiscard]] std::shared_ptr<const RawDevice::node_info> nodeInfo(
+                const std::string& path, int fd);
+
+        [[nodiscard]] std::shared_ptr<const RawDevice::node_info> nodeInfo(
+                const std::string& path);
+
+        /* The udev seat a node was tagged with when it was added, seat0
+         * if it was not */
+        [[nodiscard]] std::string seat(const std::string& path) const;
+
+        static constexpr auto default_seat = "seat0";
+
         template<typename T, typename... Args>
         static std::shared_ptr<T> make(Args... args) {
             auto device_monitor = _deviceMonitorWrapper<T>::make(std::forward<Args>(args)...);
@@ -68,33 +108,72 @@ namespace logid::backend::raw {
         }
 
     protected:
-        DeviceMonitor();
+        /* Only nodes of HID devices from one of vendors are opened, all
+         * are if vendors is empty. Every I/O thread runs with io_sched. */
+        DeviceMonitor(int read_batch, int io_threads, bool edge_triggered,
+                      std::set<uint16_t> vendors, const thread_sched& io_sched = {});
 
         // This should be run once the derived class is ready
         void ready();
 
-        virtual void addDevice(std::string device) = 0;
+        /* Returns why the node should be probed again if it should, a
+         * thrown DeviceNotReady is retried as well */
+        virtual std::optional<DeviceNotReady::Reason> addDevice(std::string device) = 0;
 
         virtual void removeDevice(std::string device) = 0;
 
+        /* Called each time a node from enumerate is probed, retries are
+         * not waited for. Calls do not overlap and probed only increases,
+         * probed == total once enumeration is done. */
+        virtual void enumerationProgress(uint32_t probed, uint32_t total);
+
         template<typename T>
         [[nodiscard]] std::weak_ptr<T> self() const {
             return std::dynamic_pointer_cast<T>(_self.lock());
         }
 
     private:
+        // Decided from udev properties alone, without opening the node
+        [[nodiscard]] bool _wanted(struct udev_device* device) const;
+
+        // Remembers the seat of a node about to be added
+        void _noteSeat(struct udev_device* device, const std::string& dev_node);
+
+        // Probes device on a worker, as hotplug and enumeration both do
+        void _queueAdd(const std::string& device, bool enumerated = false);
+
         void _addHandler(const std::string& device, int tries = 0);
 
         void _removeHandler(const std::string& device);
 
-        std::shared_ptr<IOMonitor> _io_monitor;
+        std::vector<std::shared_ptr<IOMonitor>> _io_monitors;
 
         struct udev* _udev_context;
         struct udev_monitor* _udev_monitor;
         int _fd;
         bool _ready;
 
+        const int _read_batch;
+        const std::set<uint16_t> _vendors;
+
+        // Nodes on seats other than seat0, udev is only asked on its own thread
+        mutable std::mutex _seats_mutex;
+        std::map<std::string, std::string> _seats;
+
+        RetryScheduler _retry;
+
+        std::atomic<uint32_t> _enum_probed = 0;
+        std::atomic<uint32_t> _enum_total = 0;
+        // Nodes are probed in parallel, progress is reported in order
+        std::mutex _enum_mutex;
+
+        std::mutex _node_info_lock;
+        std::map<std::string, std::shared_ptr<const RawDevice::node_info>> _node_info;
+
         std::weak_ptr<DeviceMonitor> _self;
+
+        // Hotplug work still queued is dropped with the monitor
+        task_set _tasks;
     };
 }
 
@@ -19,19 +19,50 @@
 #ifndef LOGID_BACKEND_RAW_DEFS_H
 #define LOGID_BACKEND_RAW_DEFS_H
 
-#include <functional>
+#include <util/function.h>
 #include <cstdint>
-#include <vector>
+#include <span>
+#include <optional>
 
 namespace logid::backend::raw {
+    /* Non-owning view of a report, only valid for the duration of the handler */
+    typedef std::span<const uint8_t> RawReport;
+
+    /* Declarative keys checked on the raw bytes before the condition runs,
+     * unset keys match anything. Handlers keyed on a device index are
+     * demultiplexed through a table in RawDevice. */
+    struct RawMatch {
+        // Only HID++ short and long reports
+        bool hidpp = false;
+        std::optional<uint8_t> device_index = {};
+        std::optional<uint8_t> sub_id = {};
+    };
+
     struct RawEventHandler {
-        std::function<bool(const std::vector<uint8_t>&)> condition;
-        std::function<void(const std::vector<uint8_t>&)> callback;
+        RawMatch match;
+        unique_function<bool(RawReport)> condition;
+        unique_function<void(RawReport)> callback;
 
-        RawEventHandler(std::function<bool(const std::vector<uint8_t>&)> cond,
-                        std::function<void(const std::vector<uint8_t>&)> call) :
+        RawEventHandler(unique_function<bool(RawReport)> cond,
+                        unique_function<void(RawReport)> call) :
                 condition(std::move(cond)), callback(std::move(call)) {
         }
+
+        RawEventHandler(RawMatch m, unique_function<bool(RawReport)> cond,
+                        unique_function<void(RawReport)> call) :
+                match(m), condition(std::move(cond)), callback(std::move(call)) {
+        }
+
+        [[nodiscard]] bool matches(RawReport report) const {
+            // HID++ header: report ID, device index, sub ID / feature index
+            if (match.hidpp && (report.size() < 3 || (report[0] != 0x10 && report[0] != 0x11)))
+                return false;
+            if (match.device_index && (report.size() < 2 || report[1] != *match.device_index))
+                return false;
+            if (match.sub_id && (report.size() < 3 || report[2] != *match.sub_id))
+                return false;
+            return true;
+        }
     };
 }
 
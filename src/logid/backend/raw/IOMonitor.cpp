@@ -17,7 +17,12 @@
  */
 #include <backend/raw/IOMonitor.h>
 #include <util/log.h>
+#include <util/trace.h>
 #include <optional>
+#include <array>
+#include <algorithm>
+#include <set>
+#include <system_error>
 
 extern "C"
 {
@@ -26,18 +31,424 @@ extern "C"
 #include <sys/eventfd.h>
 }
 
+using namespace logid;
 using namespace logid::backend::raw;
 
-IOHandler::IOHandler(std::function<void()> r,
-                     std::function<void()> hup,
-                     std::function<void()> err) :
+#ifdef LOGID_USE_IO_URING
+/* Multishot polls only need one completion slot per event */
+static constexpr unsigned ring_entries = 256;
+#else
+/* Events past this are simply picked up by the next epoll_wait */
+static constexpr int max_events = 64;
+#endif
+
+// Microseconds, 0 while dispatch is not timed
+static std::atomic<int64_t> dispatch_budget = 0;
+static constexpr std::chrono::seconds warning_interval(1);
+
+namespace {
+    /* The monitor timing a dispatch on this thread and what it runs now.
+     * slow is the first tag to end past the budget, the innermost one. */
+    struct tagged_dispatch {
+        IOMonitor* monitor = nullptr;
+        const char* name = nullptr;
+        std::source_location location;
+        std::optional<std::source_location> slow;
+    };
+
+    thread_local tagged_dispatch tagged;
+}
+
+IOHandler::IOHandler(unique_function<void()> r,
+                     unique_function<void()> hup,
+                     unique_function<void()> err,
+                     unique_function<void()> w,
+                     std::source_location loc) :
         read(std::move(r)),
         hangup(std::move(hup)),
-        error(std::move(err)) {
+        error(std::move(err)),
+        write(std::move(w)),
+        location(loc) {
 }
 
-IOMonitor::IOMonitor() : _epoll_fd(epoll_create1(0)),
-                         _event_fd(eventfd(0, EFD_NONBLOCK)) {
+static void run(IOHandler* handler, uint32_t events) {
+    try {
+        if (events & EPOLLIN)
+            handler->read();
+        if ((events & EPOLLOUT) && handler->write)
+            handler->write();
+        if (events & EPOLLHUP)
+            handler->hangup();
+        if (events & EPOLLERR)
+            handler->error();
+    } catch (std::exception& e) {
+        logPrintf(ERROR, "Unhandled I/O handler error: %s", e.what());
+    }
+}
+
+// Not read unless dispatch is timed
+static std::chrono::steady_clock::time_point batchStart() {
+    if (!dispatch_budget.load(std::memory_order_relaxed))
+        return {};
+    return std::chrono::steady_clock::now();
+}
+
+void IOMonitor::setDispatchBudget(std::chrono::microseconds budget) {
+    dispatch_budget = std::max<int64_t>(budget.count(), 0);
+}
+
+const char* IOMonitor::internName(const std::string& name) {
+    static std::mutex mutex;
+    static std::set<std::string> names;
+
+    std::lock_guard lock(mutex);
+    return names.insert(name).first->c_str();
+}
+
+void IOMonitor::_setBusy(const char* name, std::source_location location) noexcept {
+    _busy_seq.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    _busy_name.store(name, std::memory_order_relaxed);
+    _busy_file.store(location.file_name(), std::memory_order_relaxed);
+    _busy_line.store(location.line(), std::memory_order_relaxed);
+    _busy_seq.fetch_add(1, std::memory_order_release);
+}
+
+IOMonitor::Tag::Tag(std::source_location location) noexcept : _monitor(tagged.monitor) {
+    if (!_monitor)
+        return;
+
+    _outer = tagged.location;
+    _start = std::chrono::steady_clock::now();
+    tagged.location = location;
+    _monitor->_setBusy(tagged.name, location);
+}
+
+IOMonitor::Tag::~Tag() noexcept {
+    if (!_monitor)
+        return;
+
+    const std::chrono::microseconds budget(dispatch_budget.load(std::memory_order_relaxed));
+    if (!tagged.slow && std::chrono::steady_clock::now() - _start > budget)
+        tagged.slow = tagged.location;
+    tagged.location = _outer;
+    _monitor->_setBusy(tagged.name, _outer);
+}
+
+void IOMonitor::_dispatch(IOHandler* handler, uint32_t events) {
+    const auto budget = dispatch_budget.load(std::memory_order_relaxed);
+    if (!budget) {
+        run(handler, events);
+        return;
+    }
+
+    // See stall(), _busy_since is 0 from the last handler
+    _setBusy(handler->name, handler->location);
+    tagged = {this, handler->name, handler->location, std::nullopt};
+    const auto start = std::chrono::steady_clock::now();
+    _busy_since.store(start.time_since_epoch().count(), std::memory_order_release);
+
+    run(handler, events);
+
+    const auto end = std::chrono::steady_clock::now();
+    _busy_since.store(0, std::memory_order_relaxed);
+    tagged.monitor = nullptr;
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+    if (elapsed.count() > _max_dispatch_us.load(std::memory_order_relaxed))
+        _max_dispatch_us.store(elapsed.count(), std::memory_order_relaxed);
+    if (elapsed.count() <= budget)
+        return;
+
+    ++_slow_dispatches;
+    if (end - _last_warning >= warning_interval) {
+        _last_warning = end;
+        const auto where = tagged.slow.value_or(handler->location);
+        logPrintf(WARN, "I/O handler of %s ran for %.1f ms, in the one made at %s:%u",
+                  handler->name ? handler->name : "an fd", (double) elapsed.count() / 1000,
+                  where.file_name(), (unsigned) where.line());
+    }
+}
+
+IOMonitor::DispatchStats IOMonitor::dispatchStats() const noexcept {
+    return {_slow_dispatches, _slow_batches,
+            std::chrono::microseconds(_max_dispatch_us.load(std::memory_order_relaxed))};
+}
+
+std::optional<IOMonitor::Stall> IOMonitor::stall() const noexcept {
+    const auto budget = dispatch_budget.load(std::memory_order_relaxed);
+    const auto since = _busy_since.load(std::memory_order_acquire);
+    if (!budget || !since)
+        return std::nullopt;
+
+    // A tag is moving the location, a stuck handler would not be
+    const auto seq = _busy_seq.load(std::memory_order_acquire);
+    if (seq & 1)
+        return std::nullopt;
+
+    Stall stall{};
+    stall.name = _busy_name.load(std::memory_order_relaxed);
+    stall.file = _busy_file.load(std::memory_order_relaxed);
+    stall.line = _busy_line.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // Another handler or tag started meanwhile, the location may be its
+    if (_busy_since.load(std::memory_order_relaxed) != since ||
+        _busy_seq.load(std::memory_order_relaxed) != seq)
+        return std::nullopt;
+
+    stall.running = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch() -
+            std::chrono::steady_clock::duration(since));
+    if (stall.running.count() <= budget)
+        return std::nullopt;
+    return stall;
+}
+
+void IOMonitor::_checkBatch(std::chrono::steady_clock::time_point start, int events) {
+    const auto budget = dispatch_budget.load(std::memory_order_relaxed);
+    if (!budget || events < 2)
+        return;
+
+    const auto end = std::chrono::steady_clock::now();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+    if (elapsed.count() <= budget)
+        return;
+
+    ++_slow_batches;
+    if (end - _last_warning >= warning_interval) {
+        _last_warning = end;
+        logPrintf(WARN, "I/O batch of %d events took %.1f ms", events,
+                  (double) elapsed.count() / 1000);
+    }
+}
+
+#ifdef LOGID_USE_IO_URING
+
+/* Set in the user data of a poll removal, the rest is the handler. Handlers
+ * are aligned, so the bit is free. */
+static constexpr uint64_t remove_tag = 1;
+
+IOMonitor::IOMonitor(bool edge_triggered, thread_sched sched) :
+        _edge_triggered(edge_triggered) {
+    int ret = ::io_uring_queue_init(ring_entries, &_ring, 0);
+    if (ret < 0)
+        throw std::system_error(-ret, std::generic_category(),
+                                "failed to create io_uring");
+
+    _is_running = true;
+
+    _io_thread = std::make_unique<std::thread>([this, sched = std::move(sched)]() {
+        applyThreadSched(sched, "I/O");
+        _listen();
+    });
+}
+
+IOMonitor::~IOMonitor() noexcept {
+    _stop();
+
+    ::io_uring_queue_exit(&_ring);
+}
+
+void IOMonitor::_listen() {
+    while (_is_running) {
+        struct io_uring_cqe* cqe;
+        if (::io_uring_wait_cqe(&_ring, &cqe) < 0)
+            continue;
+        LOGID_TRACE(io_wake, this, ::io_uring_cq_ready(&_ring));
+        const auto batch_start = batchStart();
+
+        unsigned head;
+        unsigned seen = 0;
+        io_uring_for_each_cqe(&_ring, head, cqe) {
+            ++seen;
+            auto data = ::io_uring_cqe_get_data64(cqe);
+
+            /* A removal that found no poll, the poll already ended and
+             * will not complete again to free the handler */
+            if (data & remove_tag) {
+                if (cqe->res < 0)
+                    _reap(reinterpret_cast<IOHandler*>(data & ~remove_tag));
+                continue;
+            }
+
+            auto handler = reinterpret_cast<IOHandler*>(data);
+
+            /* Poll updates and the stop request carry no handler */
+            if (!handler)
+                continue;
+
+            /* Removed handlers are only freed on their final completion, so
+             * the pointer stays valid even if it was just removed. */
+            if (cqe->res > 0)
+                _dispatch(handler, cqe->res);
+            else if (cqe->res < 0 && cqe->res != -ECANCELED)
+                _dispatch(handler, EPOLLERR);
+
+            /* A poll that ended with an error is armed again, the fd would
+             * go silent otherwise. A closed fd is dropped. */
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                _complete(handler, cqe->res != -EBADF);
+        }
+
+        ::io_uring_cq_advance(&_ring, seen);
+        _checkBatch(batch_start, (int) seen);
+    }
+}
+
+void IOMonitor::_complete(IOHandler* handler, bool rearm) noexcept {
+    {
+        std::lock_guard lock(_fds_mutex);
+
+        /* The kernel may end a multishot poll on its own (e.g. CQ overflow) */
+        for (std::size_t fd = 0; fd < _fds.size(); ++fd) {
+            if (_fds[fd].get() == handler) {
+                try {
+                    if (rearm)
+                        _poll(handler, (int) fd, _write_interest[fd]);
+                    else
+                        logPrintf(ERROR, "io fd %zu was closed, it is no longer polled", fd);
+                } catch (std::exception& e) {
+                    logPrintf(ERROR, "Failed to rearm io fd %zu: %s", fd, e.what());
+                }
+                return;
+            }
+        }
+    }
+
+    _reap(handler);
+}
+
+void IOMonitor::_reap(IOHandler* handler) noexcept {
+    std::unique_ptr<IOHandler> retired;
+    {
+        std::lock_guard lock(_fds_mutex);
+        auto it = std::find_if(_retired.begin(), _retired.end(),
+                               [handler](const auto& x) { return x.get() == handler; });
+        if (it != _retired.end()) {
+            retired = std::move(*it);
+            _retired.erase(it);
+        }
+    }
+    // Handler is destroyed here, outside the lock
+}
+
+void IOMonitor::_poll(IOHandler* handler, int fd, bool write) {
+    std::lock_guard lock(_ring_mutex);
+    auto sqe = _getSqe();
+    ::io_uring_prep_poll_multishot(sqe, fd, _events(write));
+    if (!_edge_triggered)
+        sqe->len |= IORING_POLL_ADD_LEVEL;
+    ::io_uring_sqe_set_data64(sqe, reinterpret_cast<uint64_t>(handler));
+    ::io_uring_submit(&_ring);
+}
+
+struct io_uring_sqe* IOMonitor::_getSqe() {
+    auto sqe = ::io_uring_get_sqe(&_ring);
+    if (!sqe) {
+        // Submission queue is full, flush it and try again
+        ::io_uring_submit(&_ring);
+        sqe = ::io_uring_get_sqe(&_ring);
+    }
+
+    if (!sqe)
+        throw std::runtime_error("io_uring submission queue is full");
+
+    return sqe;
+}
+
+void IOMonitor::_stop() noexcept {
+    _is_running = false;
+    {
+        std::lock_guard lock(_ring_mutex);
+        // Without the nop the I/O thread may never wake up
+        struct io_uring_sqe* sqe;
+        while (!(sqe = ::io_uring_get_sqe(&_ring)))
+            ::io_uring_submit(&_ring);
+        ::io_uring_prep_nop(sqe);
+        ::io_uring_sqe_set_data64(sqe, 0);
+        ::io_uring_submit(&_ring);
+    }
+    _io_thread->join();
+}
+
+void IOMonitor::add(int fd, IOHandler handler) {
+    std::lock_guard lock(_fds_mutex);
+
+    if (fd < 0)
+        throw std::invalid_argument("invalid io fd");
+
+    if ((std::size_t) fd >= _fds.size()) {
+        _fds.resize(fd + 1);
+        _write_interest.resize(fd + 1);
+    } else if (_fds[fd]) {
+        throw std::runtime_error("duplicate io fd");
+    }
+
+    auto io_handler = std::make_unique<IOHandler>(std::move(handler));
+    _poll(io_handler.get(), fd, false);
+
+    _write_interest[fd] = false;
+    _fds[fd] = std::move(io_handler);
+    ++_handler_count;
+}
+
+void IOMonitor::remove(int fd) noexcept {
+    std::lock_guard lock(_fds_mutex);
+
+    if (fd >= 0 && (std::size_t) fd < _fds.size() && _fds[fd]) {
+        try {
+            std::lock_guard ring_lock(_ring_mutex);
+            auto sqe = _getSqe();
+            auto data = reinterpret_cast<uint64_t>(_fds[fd].get());
+            ::io_uring_prep_poll_remove(sqe, data);
+            ::io_uring_sqe_set_data64(sqe, data | remove_tag);
+            ::io_uring_submit(&_ring);
+        } catch (std::exception& e) {
+            logPrintf(ERROR, "Failed to remove io fd %d: %s", fd, e.what());
+        }
+
+        /* The poll keeps referencing this handler until its final completion,
+         * _complete frees it once the I/O thread has seen that. If the poll
+         * had already ended, the removal's completion frees it. */
+        _retired.push_back(std::move(_fds[fd]));
+        --_handler_count;
+    }
+}
+
+void IOMonitor::setWriteInterest(int fd, bool enabled) noexcept {
+    std::lock_guard lock(_fds_mutex);
+    if (fd < 0 || (std::size_t) fd >= _fds.size() || !_fds[fd])
+        return;
+
+    if (_write_interest[fd] == enabled)
+        return;
+    _write_interest[fd] = enabled;
+
+    try {
+        std::lock_guard ring_lock(_ring_mutex);
+        auto sqe = _getSqe();
+        auto data = reinterpret_cast<uint64_t>(_fds[fd].get());
+        ::io_uring_prep_poll_update(sqe, data, data, _events(enabled),
+                                    IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI);
+        ::io_uring_sqe_set_data64(sqe, 0);
+        ::io_uring_submit(&_ring);
+    } catch (std::exception& e) {
+        logPrintf(ERROR, "Failed to update io fd %d: %s", fd, e.what());
+    }
+}
+
+uint32_t IOMonitor::_events(bool write) const noexcept {
+    uint32_t events = EPOLLIN | EPOLLHUP | EPOLLERR;
+    if (write)
+        events |= EPOLLOUT;
+    return events;
+}
+
+#else
+
+IOMonitor::IOMonitor(bool edge_triggered, thread_sched sched) :
+        _edge_triggered(edge_triggered), _epoll_fd(epoll_create1(0)),
+        _event_fd(eventfd(0, EFD_NONBLOCK)) {
     if (_epoll_fd < 0) {
         if (_event_fd >= 0)
             close(_event_fd);
@@ -51,15 +462,17 @@ IOMonitor::IOMonitor() : _epoll_fd(epoll_create1(0)),
 
     struct epoll_event event{};
     event.events = EPOLLIN;
-    event.data.fd = _event_fd;
+    /* The event fd is the only entry without a handler */
+    event.data.ptr = nullptr;
 
     if (::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _event_fd, &event)) {
         throw std::system_error(errno, std::generic_category());
     }
 
-    _fds.emplace(_event_fd, nullptr);
+    _is_running = true;
 
-    _io_thread = std::make_unique<std::thread>([this]() {
+    _io_thread = std::make_unique<std::thread>([this, sched = std::move(sched)]() {
+        applyThreadSched(sched, "I/O");
         _listen();
     });
 }
@@ -75,93 +488,107 @@ IOMonitor::~IOMonitor() noexcept {
 }
 
 void IOMonitor::_listen() {
-    std::unique_lock lock(_run_mutex);
-    std::vector<struct epoll_event> events;
-
-    if (_is_running)
-        throw std::runtime_error("IOMonitor double run");
-
-    _is_running = true;
+    std::array<struct epoll_event, max_events> events{};
 
     while (_is_running) {
-        if (events.size() != _fds.size())
-            events.resize(_fds.size());
-
         int ev_count = ::epoll_wait(_epoll_fd, events.data(), (int) events.size(), -1);
+        LOGID_TRACE(io_wake, this, ev_count);
+        const auto batch_start = batchStart();
         for (int i = 0; i < ev_count; ++i) {
-            std::shared_ptr<IOHandler> handler;
-
-            if (events[i].data.fd == _event_fd) {
-                if (events[i].events & EPOLLIN) {
-                    lock.unlock();
-                    /* Wait until done yielding */
-                    const std::lock_guard yield_lock(_yield_mutex);
-                    uint64_t event;
-                    while (-1 != ::eventfd_read(_event_fd, &event)) { }
-                    lock.lock();
-                }
-            } else {
-                try {
-                    handler = _fds.at(events[i].data.fd);
-                } catch (std::out_of_range& e) {
-                    continue;
-                }
-
-                lock.unlock();
-                try {
-                    if (events[i].events & EPOLLIN)
-                        handler->read();
-                    if (events[i].events & EPOLLHUP)
-                        handler->hangup();
-                    if (events[i].events & EPOLLERR)
-                        handler->error();
-                } catch (std::exception& e) {
-                    logPrintf(ERROR, "Unhandled I/O handler error: %s", e.what());
-                }
-                lock.lock();
+            auto handler = static_cast<IOHandler*>(events[i].data.ptr);
 
+            if (!handler) {
+                uint64_t event;
+                // Drained on EAGAIN, not when interrupted
+                while (-1 != ::eventfd_read(_event_fd, &event) || errno == EINTR) { }
+                continue;
             }
+
+            /* Removed handlers are only reclaimed by this thread after the
+             * batch, so the pointer stays valid even if it was just removed. */
+            _dispatch(handler, events[i].events);
         }
+        _checkBatch(batch_start, ev_count);
+
+        if (_has_retired)
+            _reclaim();
     }
 }
 
+void IOMonitor::_reclaim() noexcept {
+    std::vector<std::unique_ptr<IOHandler>> retired;
+    {
+        std::lock_guard lock(_fds_mutex);
+        retired.swap(_retired);
+        _has_retired = false;
+    }
+    // Handlers are destroyed here, outside the lock
+}
+
 void IOMonitor::_stop() noexcept {
     _is_running = false;
-    _yield();
+    ::eventfd_write(_event_fd, 1);
     _io_thread->join();
 }
 
-std::unique_lock<std::mutex> IOMonitor::_yield() noexcept {
-    /* Prevent listener thread from grabbing lock during yielding */
-    std::unique_lock yield_lock(_yield_mutex);
+void IOMonitor::add(int fd, IOHandler handler) {
+    std::lock_guard lock(_fds_mutex);
 
-    std::unique_lock run_lock(_run_mutex, std::try_to_lock);
-    if (!run_lock.owns_lock()) {
-        ::eventfd_write(_event_fd, 1);
-        run_lock = std::unique_lock<std::mutex>(_run_mutex);
-    }
+    if (fd < 0)
+        throw std::invalid_argument("invalid io fd");
 
-    return run_lock;
-}
+    if ((std::size_t) fd >= _fds.size())
+        _fds.resize(fd + 1);
+    else if (_fds[fd])
+        throw std::runtime_error("duplicate io fd");
 
-void IOMonitor::add(int fd, IOHandler handler) {
-    const auto lock = _yield();
+    auto io_handler = std::make_unique<IOHandler>(std::move(handler));
 
     struct epoll_event event{};
-    event.events = EPOLLIN | EPOLLHUP | EPOLLERR;
-    event.data.fd = fd;
-
-    if (!_fds.contains(fd)) {
-        if (::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event))
-            throw std::system_error(errno, std::generic_category());
-        _fds.emplace(fd, std::make_shared<IOHandler>(std::move(handler)));
-    } else {
-        throw std::runtime_error("duplicate io fd");
-    }
+    event.events = _events(false);
+    event.data.ptr = io_handler.get();
+
+    if (::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event))
+        throw std::system_error(errno, std::generic_category());
+    _fds[fd] = std::move(io_handler);
+    ++_handler_count;
 }
 
 void IOMonitor::remove(int fd) noexcept {
-    const auto lock = _yield();
+    std::lock_guard lock(_fds_mutex);
     ::epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
-    _fds.erase(fd);
-}
\ No newline at end of file
+
+    if (fd >= 0 && (std::size_t) fd < _fds.size() && _fds[fd]) {
+        /* The I/O thread may be holding this handler from the current batch,
+         * defer freeing it until the thread is done with that batch. */
+        _retired.push_back(std::move(_fds[fd]));
+        _has_retired = true;
+        --_handler_count;
+    }
+}
+
+void IOMonitor::setWriteInterest(int fd, bool enabled) noexcept {
+    std::lock_guard lock(_fds_mutex);
+    if (fd < 0 || (std::size_t) fd >= _fds.size() || !_fds[fd])
+        return;
+
+    struct epoll_event event{};
+    event.events = _events(enabled);
+    event.data.ptr = _fds[fd].get();
+    ::epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+uint32_t IOMonitor::_events(bool write) const noexcept {
+    uint32_t events = EPOLLIN | EPOLLHUP | EPOLLERR;
+    if (write)
+        events |= EPOLLOUT;
+    if (_edge_triggered)
+        events |= EPOLLET;
+    return events;
+}
+
+#endif
+
+std::size_t IOMonitor::handlerCount() const noexcept {
+    return _handler_count;
+}
@@ -18,28 +18,51 @@
 #ifndef LOGID_BACKEND_RAW_IOMONITOR_H
 #define LOGID_BACKEND_RAW_IOMONITOR_H
 
+#include <util/function.h>
+#include <util/sched.h>
 #include <atomic>
+#include <chrono>
 #include <functional>
-#include <map>
 #include <memory>
 #include <mutex>
 #include <condition_variable>
+#include <optional>
+#include <source_location>
+#include <string>
 #include <thread>
+#include <vector>
+
+#ifdef LOGID_USE_IO_URING
+extern "C"
+{
+#include <liburing.h>
+}
+#endif
 
 namespace logid::backend::raw {
     struct IOHandler {
-        std::function<void()> read;
-        std::function<void()> hangup;
-        std::function<void()> error;
-
-        IOHandler(std::function<void()> r,
-                  std::function<void()> hup,
-                  std::function<void()> err);
+        unique_function<void()> read;
+        unique_function<void()> hangup;
+        unique_function<void()> error;
+        /* Only called while write interest is enabled for the fd */
+        unique_function<void()> write;
+        // Where the handler was made, names it when it runs past the budget
+        std::source_location location;
+        // What the handler serves, e.g. a device path, see IOMonitor::internName
+        const char* name = nullptr;
+
+        IOHandler(unique_function<void()> r,
+                  unique_function<void()> hup,
+                  unique_function<void()> err,
+                  unique_function<void()> w = {},
+                  std::source_location loc = std::source_location::current());
     };
 
     class IOMonitor {
     public:
-        IOMonitor();
+        /* In edge-triggered mode, read handlers must drain their fd. The
+         * I/O thread applies sched before it starts listening. */
+        explicit IOMonitor(bool edge_triggered = false, thread_sched sched = {});
 
         IOMonitor(IOMonitor&&) = delete;
 
@@ -53,22 +76,124 @@ namespace logid::backend::raw {
 
         void add(int fd, IOHandler handler);
 
+        /* The handler may still run once for events already being processed,
+         * but it is never freed while the I/O thread can still reference it. */
         void remove(int fd) noexcept;
+
+        /* Enables or disables EPOLLOUT notifications (IOHandler::write) */
+        void setWriteInterest(int fd, bool enabled) noexcept;
+
+        [[nodiscard]] std::size_t handlerCount() const noexcept;
+
+        struct DispatchStats {
+            // Handler runs and whole batches of them that went past the budget
+            uint64_t slow_dispatches;
+            uint64_t slow_batches;
+            std::chrono::microseconds max_dispatch;
+        };
+
+        struct Stall {
+            std::chrono::microseconds running;
+            // The handler's name, nullptr if it has none
+            const char* name;
+            // Where the innermost Tag or else the handler was made
+            const char* file;
+            uint_least32_t line;
+        };
+
+        /* Puts what runs on an I/O thread until destroyed on location, e.g.
+         * an event handler entry, so that a stall or a slow dispatch names
+         * it rather than the fd's handler. Nests, and does nothing off the
+         * I/O threads or while dispatch is untimed. */
+        class Tag {
+        public:
+            explicit Tag(std::source_location location) noexcept;
+
+            Tag(const Tag&) = delete;
+
+            Tag& operator=(const Tag&) = delete;
+
+            ~Tag() noexcept;
+
+        private:
+            IOMonitor* const _monitor;
+            std::source_location _outer;
+            std::chrono::steady_clock::time_point _start;
+        };
+
+        /* A copy of name that is never freed, so that a watchdog can read
+         * it while the handler goes away. Names are few, e.g. node paths. */
+        [[nodiscard]] static const char* internName(const std::string& name);
+
+        /* Handlers and batches running past budget are logged and counted
+         * by every monitor. Zero, the default, leaves dispatch untimed. */
+        static void setDispatchBudget(std::chrono::microseconds budget);
+
+        [[nodiscard]] DispatchStats dispatchStats() const noexcept;
+
+        /* The handler running now if it went past the budget, for a
+         * watchdog to call from another thread */
+        [[nodiscard]] std::optional<Stall> stall() const noexcept;
     private:
+        void _dispatch(IOHandler* handler, uint32_t events);
+
+        // Publishes what is running to stall()
+        void _setBusy(const char* name, std::source_location location) noexcept;
+
+        // Counts and logs a batch of events that went past the budget
+        void _checkBatch(std::chrono::steady_clock::time_point start, int events);
+
         void _listen(); // This is a blocking call
         void _stop() noexcept;
-        std::unique_lock<std::mutex> _yield() noexcept;
+        [[nodiscard]] uint32_t _events(bool write) const noexcept;
+#ifdef LOGID_USE_IO_URING
+        void _complete(IOHandler* handler, bool rearm) noexcept;
+        // Frees a removed handler whose poll has ended
+        void _reap(IOHandler* handler) noexcept;
+        void _poll(IOHandler* handler, int fd, bool write);
+        struct io_uring_sqe* _getSqe();
+#else
+        void _reclaim() noexcept;
+#endif
 
         std::unique_ptr<std::thread> _io_thread;
 
-        std::mutex _run_mutex;
-        std::mutex _yield_mutex;
+        /* Only taken by add/remove and when reclaiming, never per event */
+        std::mutex _fds_mutex;
+        /* Flat table indexed by fd, epoll events point directly into it */
+        std::vector<std::unique_ptr<IOHandler>> _fds;
+        std::vector<std::unique_ptr<IOHandler>> _retired;
+        std::atomic_bool _has_retired = false;
 
-        std::map<int, std::shared_ptr<IOHandler>> _fds;
         std::atomic_bool _is_running;
-
+        std::atomic<std::size_t> _handler_count = 0;
+
+        /* steady_clock nanoseconds when the running handler started, 0 in
+         * between. The handler's location is set before it, a reader
+         * checks it did not change to know the location is that one's.
+         * Tags move the location while the handler runs, _busy_seq is odd
+         * while they do. */
+        std::atomic<int64_t> _busy_since = 0;
+        std::atomic<uint32_t> _busy_seq = 0;
+        std::atomic<const char*> _busy_name = nullptr;
+        std::atomic<const char*> _busy_file = nullptr;
+        std::atomic<uint_least32_t> _busy_line = 0;
+        std::atomic<uint64_t> _slow_dispatches = 0;
+        std::atomic<uint64_t> _slow_batches = 0;
+        std::atomic<int64_t> _max_dispatch_us = 0;
+        // Only used by the I/O thread, warnings are kept to one a second
+        std::chrono::steady_clock::time_point _last_warning{};
+
+        const bool _edge_triggered;
+#ifdef LOGID_USE_IO_URING
+        /* Guards the submission queue, completions are only reaped by _listen */
+        std::mutex _ring_mutex;
+        struct io_uring _ring{};
+        std::vector<bool> _write_interest;
+#else
         const int _epoll_fd;
         const int _event_fd;
+#endif
     };
 }
 
@@ -19,12 +19,18 @@
 #include <backend/raw/RawDevice.h>
 #include <backend/raw/DeviceMonitor.h>
 #include <backend/raw/IOMonitor.h>
+#include <backend/raw/Capture.h>
+#include <backend/raw/Transport.h>
+#include <util/task.h>
 #include <util/log.h>
+#include <util/trace.h>
 
 #include <string>
 #include <system_error>
 #include <utility>
-#include <regex>
+#include <string_view>
+#include <algorithm>
+#include <cstring>
 
 extern "C"
 {
@@ -40,9 +46,27 @@ using namespace logid::backend::raw;
 using namespace logid::backend;
 using namespace std::chrono;
 
-static constexpr int max_write_tries = 8;
+static thread_local std::optional<steady_clock::time_point> report_time;
+
+// Sets report_time while a report is handled, cleared even if a handler throws
+class ReportTimeScope {
+public:
+    explicit ReportTimeScope(steady_clock::time_point time) {
+        report_time = time;
+    }
+
+    ~ReportTimeScope() {
+        report_time.reset();
+    }
 
-static const std::regex virtual_path_regex(R"~((.*\/)(.*:)([0-9]+))~");
+    ReportTimeScope(const ReportTimeScope&) = delete;
+
+    ReportTimeScope& operator=(const ReportTimeScope&) = delete;
+};
+
+static constexpr int max_write_tries = 8;
+static constexpr int write_backoff = 2;
+static constexpr int max_write_backoff = 100;
 
 int get_fd(const std::string& path) {
     int fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK);
@@ -109,34 +133,54 @@ std::string get_name(int fd) {
 
 RawDevice::RawDevice(std::string path, const std::shared_ptr<DeviceMonitor>& monitor) :
         _valid(true), _path(std::move(path)), _fd(get_fd(_path)),
-        _dev_info(get_dev_info(_fd)), _name(get_name(_fd)),
-        _report_desc(getReportDescriptor(_fd)), _io_monitor(monitor->ioMonitor()),
-        _event_handlers(std::make_shared<EventHandlerList<RawDevice>>()) {
+        _node_info(monitor->nodeInfo(_path, _fd)), _io_monitor(monitor->ioMonitor()),
+        _event_handlers(std::make_shared<EventHandlerList<RawDevice>>()),
+        _read_slots(monitor->readBatch()) {
+}
 
-    if (busType() == USB) {
-        auto phys = get_phys(_fd);
-        _sub_device = std::regex_match(phys, virtual_path_regex);
-    }
+RawDevice::RawDevice(std::string path, node_info info, std::shared_ptr<Transport> transport) :
+        _valid(true), _path(std::move(path)), _fd(-1),
+        _node_info(std::make_shared<const node_info>(std::move(info))),
+        _transport(std::move(transport)),
+        _event_handlers(std::make_shared<EventHandlerList<RawDevice>>()) {
 }
 
 void RawDevice::_ready() {
-    _io_monitor->add(_fd, {
+    if (_transport) {
+        _transport->_attach(_self);
+        return;
+    }
+
+    IOHandler handler{
             [self_weak = _self]() {
                 if (auto self = self_weak.lock())
                     self->_readReports();
             },
             [self_weak = _self]() {
-                if (auto self = self_weak.lock())
+                /* A hung up node stays so, it is not polled any longer
+                 * while a parked device still holds it */
+                if (auto self = self_weak.lock()) {
                     self->_valid = false;
+                    self->_io_monitor->remove(self->_fd);
+                }
             },
             [self_weak = _self]() {
                 if (auto self = self_weak.lock())
                     self->_valid = false;
+            },
+            [self_weak = _self]() {
+                if (auto self = self_weak.lock())
+                    self->_writeReports();
             }
-    });
+    };
+    handler.name = IOMonitor::internName(_path);
+    _io_monitor->add(_fd, std::move(handler));
 }
 
 RawDevice::~RawDevice() noexcept {
+    if (_fd == -1)
+        return;
+
     _io_monitor->remove(_fd);
     ::close(_fd);
 }
@@ -146,35 +190,46 @@ const std::string& RawDevice::rawPath() const {
 }
 
 const std::string& RawDevice::name() const {
-    return _name;
+    return _node_info->name;
 }
 
 [[maybe_unused]]
 int16_t RawDevice::vendorId() const {
-    return _dev_info.vid;
+    return _node_info->info.vid;
 }
 
 int16_t RawDevice::productId() const {
-    return _dev_info.pid;
+    return _node_info->info.pid;
 }
 
 RawDevice::BusType RawDevice::busType() const {
-    return _dev_info.bus_type;
+    return _node_info->info.bus_type;
 }
 
 bool RawDevice::isSubDevice() const {
-    return _sub_device;
+    return _node_info->sub_device;
 }
 
-std::vector<uint8_t> RawDevice::getReportDescriptor(const std::string& path) {
-    int fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK);
-    if (fd == -1)
-        throw std::system_error(errno, std::system_category(),
-                                "open failed");
-
-    auto report_desc = getReportDescriptor(fd);
-    ::close(fd);
-    return report_desc;
+std::shared_ptr<const RawDevice::node_info> RawDevice::getNodeInfo(
+        int fd, const std::shared_ptr<const node_info>& cached) {
+    /* hidraw nodes are reused across hotplug, so the identity is checked
+     * on every open. This is two ioctls instead of a full probe. */
+    auto info = get_dev_info(fd);
+    auto phys = get_phys(fd);
+
+    if (cached && cached->info.vid == info.vid && cached->info.pid == info.pid &&
+        cached->info.bus_type == info.bus_type && cached->phys == phys)
+        return cached;
+
+    bool sub_device = info.bus_type == USB && isVirtualPhys(phys);
+
+    return std::make_shared<const node_info>(node_info{
+            .info = info,
+            .phys = std::move(phys),
+            .name = get_name(fd),
+            .report_desc = getReportDescriptor(fd),
+            .sub_device = sub_device
+    });
 }
 
 std::vector<uint8_t> RawDevice::getReportDescriptor(int fd) {
@@ -194,55 +249,191 @@ std::vector<uint8_t> RawDevice::getReportDescriptor(int fd) {
     return {report_desc.value, report_desc.value + report_desc.size};
 }
 
+bool RawDevice::isVirtualPhys(std::string_view phys) {
+    auto colon = phys.rfind(':');
+    if (colon == std::string_view::npos || colon + 1 == phys.size())
+        return false;
+
+    for (auto c: phys.substr(colon + 1)) {
+        if (c < '0' || c > '9')
+            return false;
+    }
+
+    return phys.substr(0, colon).find('/') != std::string_view::npos;
+}
+
 const std::vector<uint8_t>& RawDevice::reportDescriptor() const {
-    return _report_desc;
+    return _node_info->report_desc;
 }
 
-void RawDevice::sendReport(const std::vector<uint8_t>& report) {
+void RawDevice::sendReport(RawReport report) {
     if (!_valid) {
         // We could throw an error here, but this will likely be closed soon.
         return;
     }
 
-    if (logid::global_loglevel <= LogLevel::RAWREPORT) {
-        printf("[RAWREPORT] %s OUT: ", _path.c_str());
-        for (auto& i: report)
-            printf("%02x ", i);
-        printf("\n");
+    LOGID_TRACE(raw_write, _path.c_str(), report.data(), report.size());
+    logReport(_path, true, 0, report.data(), report.size());
+    if (capturing())
+        captureReport(_path, true, steady_clock::now(), report.data(), report.size());
+
+    assert(report.size() <= max_data_length);
+
+    if (_transport) {
+        _transport->send(report);
+        return;
     }
 
+    std::lock_guard lock(_write_mutex);
+
+    /* Don't reorder reports, write immediately only if nothing is queued */
+    if (_write_queue.empty()) {
+        if (::write(_fd, report.data(), report.size()) != -1)
+            return;
 
-    for (int i = 0; i < max_write_tries && write(_fd, report.data(), report.size()) == -1; ++i) {
         auto err = errno;
-        if (err != EPIPE)
+        if (err != EPIPE && err != EAGAIN)
             throw std::system_error(err, std::system_category(),
                                     "sendReport write failed");
     }
+
+    /* The same report was queued last, sending it twice is redundant. One
+     * queued before another report is not, it may undo that report. */
+    if (!_write_queue.empty()) {
+        auto tail = _write_queue.back().report();
+        if (std::equal(report.begin(), report.end(), tail.begin(), tail.end()))
+            return;
+    }
+
+    auto& slot = _write_queue.emplace_back();
+    std::copy(report.begin(), report.end(), slot.data.begin());
+    slot.length = report.size();
+
+    if (!_write_backoff)
+        _io_monitor->setWriteInterest(_fd, true);
 }
 
-EventHandlerLock<RawDevice> RawDevice::addEventHandler(RawEventHandler handler) {
-    return {_event_handlers, _event_handlers->add(std::forward<RawEventHandler>(handler))};
+uint64_t RawDevice::writeRetries() const {
+    return _write_retries;
 }
 
-void RawDevice::_readReports() {
-    uint8_t buf[max_data_length];
-    ssize_t len;
+void RawDevice::_writeReports() {
+    std::lock_guard lock(_write_mutex);
+
+    while (!_write_queue.empty()) {
+        auto report = _write_queue.front().report();
+        if (::write(_fd, report.data(), report.size()) == -1) {
+            auto err = errno;
+            if (err == EAGAIN)
+                return;
+
+            if (err == EPIPE && ++_write_tries < max_write_tries) {
+                /* Device is likely out of range, back off before retrying */
+                _write_backoff = true;
+                ++_write_retries;
+                _io_monitor->setWriteInterest(_fd, false);
+                _retryWrites(_write_tries);
+                return;
+            }
 
-    while (-1 != (len = ::read(_fd, buf, max_data_length))) {
-        assert(len <= max_data_length);
-        std::vector<uint8_t> report(buf, buf + len);
+            logPrintf(WARN, "%s: dropping report after write failure: %s",
+                      _path.c_str(), std::strerror(err));
+        }
+
+        _write_tries = 0;
+        _write_queue.pop_front();
+    }
+
+    _io_monitor->setWriteInterest(_fd, false);
+}
 
-        if (logid::global_loglevel <= LogLevel::RAWREPORT) {
-            printf("[RAWREPORT] %s IN:  ", _path.c_str());
-            for (auto& i: report)
-                printf("%02x ", i);
-            printf("\n");
+void RawDevice::_retryWrites(int tries) {
+    std::chrono::milliseconds wait(std::min(write_backoff << tries, max_write_backoff));
+    run_task_after([self_weak = _self]() {
+        if (auto self = self_weak.lock()) {
+            std::lock_guard lock(self->_write_mutex);
+            self->_write_backoff = false;
+            if (!self->_write_queue.empty())
+                self->_io_monitor->setWriteInterest(self->_fd, true);
         }
+    }, wait);
+}
 
-        _handleEvent(report);
+EventHandlerLock<RawDevice> RawDevice::addEventHandler(RawEventHandler handler,
+                                                       std::source_location location) {
+    if (!handler.match.device_index)
+        return {_event_handlers, _event_handlers->add(std::move(handler), location)};
+
+    auto index = handler.match.device_index.value();
+    std::lock_guard lock(_indexed_mutex);
+    auto& list = _indexed_storage[index];
+    if (!list) {
+        list = std::make_shared<EventHandlerList<RawDevice>>();
+        _indexed_handlers[index].store(list.get(), std::memory_order_release);
     }
+
+    return {list, list->add(std::move(handler), location)};
+}
+
+void RawDevice::_readReports() {
+    std::size_t count;
+
+    /* Drain pending reports into the read slots before dispatching them.
+     * A full batch is dispatched before reading more, bounding latency. */
+    do {
+        ssize_t len;
+        count = 0;
+        while (count < _read_slots.size()) {
+            len = ::read(_fd, _read_slots[count].data.data(), max_data_length);
+            if (len == -1) {
+                // Edge triggered, only EAGAIN means the node is drained
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            assert(len <= max_data_length);
+            _read_slots[count].length = static_cast<std::size_t>(len);
+            _read_slots[count].time = steady_clock::now();
+            ++count;
+        }
+
+        for (std::size_t i = 0; i < count; ++i) {
+            auto report = _read_slots[i].report();
+            LOGID_TRACE(raw_read, _path.c_str(), report.data(), report.size());
+
+            logReport(_path, false, std::chrono::duration_cast<std::chrono::microseconds>(
+                    _read_slots[i].time.time_since_epoch()).count(), report.data(), report.size());
+            captureReport(_path, false, _read_slots[i].time, report.data(), report.size());
+
+            ReportTimeScope scope(_read_slots[i].time);
+            _handleEvent(report);
+        }
+    } while (count == _read_slots.size());
 }
 
-void RawDevice::_handleEvent(const std::vector<uint8_t>& report) {
+void RawDevice::_receive(RawReport report) {
+    if (!_valid)
+        return;
+
+    auto time = steady_clock::now();
+    LOGID_TRACE(raw_read, _path.c_str(), report.data(), report.size());
+    logReport(_path, false, duration_cast<microseconds>(time.time_since_epoch()).count(),
+              report.data(), report.size());
+    captureReport(_path, false, time, report.data(), report.size());
+
+    ReportTimeScope scope(time);
+    _handleEvent(report);
+}
+
+std::optional<steady_clock::time_point> RawDevice::readTime() {
+    return report_time;
+}
+
+void RawDevice::_handleEvent(RawReport report) {
+    if (report.size() > 1) {
+        if (auto list = _indexed_handlers[report[1]].load(std::memory_order_acquire))
+            list->run_all(report);
+    }
+
     _event_handlers->run_all(report);
 }
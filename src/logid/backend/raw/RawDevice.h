@@ -22,18 +22,26 @@
 #include <backend/raw/EventHandler.h>
 #include <backend/EventHandlerList.h>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <shared_mutex>
 #include <atomic>
 #include <future>
 #include <set>
 #include <list>
+#include <array>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <optional>
 
 namespace logid::backend::raw {
     class DeviceMonitor;
 
     class IOMonitor;
 
+    class Transport;
+
     template <typename T>
     class RawDeviceWrapper : public T {
     public:
@@ -44,6 +52,7 @@ namespace logid::backend::raw {
     class RawDevice {
         template <typename>
         friend class RawDeviceWrapper;
+        friend class Transport;
     public:
         static constexpr int max_data_length = 32;
         typedef RawEventHandler EventHandler;
@@ -60,6 +69,15 @@ namespace logid::backend::raw {
             BusType bus_type;
         };
 
+        /* Everything that stays fixed for the lifetime of a hidraw node */
+        struct node_info {
+            dev_info info;
+            std::string phys;
+            std::string name;
+            std::vector<uint8_t> report_desc;
+            bool sub_device;
+        };
+
         template <typename... Args>
         static std::shared_ptr<RawDevice> make(Args... args) {
             auto raw_dev = std::make_shared<RawDeviceWrapper<RawDevice>>(
@@ -84,40 +102,92 @@ namespace logid::backend::raw {
 
         [[nodiscard]] bool isSubDevice() const;
 
-        static std::vector<uint8_t> getReportDescriptor(const std::string& path);
-
         static std::vector<uint8_t> getReportDescriptor(int fd);
 
+        /* Virtual nodes created by hid_logitech_dj have a phys of the form
+         * ".../...:N", i.e. a '/' somewhere before a final ':' and a device
+         * number. */
+        [[nodiscard]] static bool isVirtualPhys(std::string_view phys);
+
+        /* Returns cached if it still describes the node behind fd,
+         * otherwise probes the node again. fd is closed on failure. */
+        static std::shared_ptr<const node_info> getNodeInfo(
+                int fd, const std::shared_ptr<const node_info>& cached);
+
         [[nodiscard]] const std::vector<uint8_t>& reportDescriptor() const;
 
-        void sendReport(const std::vector<uint8_t>& report);
+        void sendReport(RawReport report);
+
+        // Writes retried after the device did not take them, e.g. out of range
+        [[nodiscard]] uint64_t writeRetries() const;
+
+        [[nodiscard]] EventHandlerLock<RawDevice> addEventHandler(
+                RawEventHandler handler,
+                std::source_location location = std::source_location::current());
 
-        [[nodiscard]] EventHandlerLock<RawDevice> addEventHandler(RawEventHandler handler);
+        /* When the report being handled on this thread was read, empty
+         * outside of event handlers */
+        [[nodiscard]] static std::optional<std::chrono::steady_clock::time_point> readTime();
 
     private:
         RawDevice(std::string path, const std::shared_ptr<DeviceMonitor>& monitor);
 
+        /* Reports go through transport instead of a hidraw node, path only
+         * names the device */
+        RawDevice(std::string path, node_info info, std::shared_ptr<Transport> transport);
+
         void _ready();
 
+        void _receive(RawReport report);
+
         void _readReports();
 
+        void _writeReports();
+
+        void _retryWrites(int tries);
+
         std::atomic_bool _valid;
 
         const std::string _path;
         const int _fd;
-        const dev_info _dev_info;
-        const std::string _name;
-        const std::vector<uint8_t> _report_desc;
+        const std::shared_ptr<const node_info> _node_info;
 
         std::shared_ptr<IOMonitor> _io_monitor;
+        // Only set without a hidraw node, _fd is -1 then
+        const std::shared_ptr<Transport> _transport;
 
         std::weak_ptr<RawDevice> _self;
 
-        bool _sub_device = false;
-
+        // Handlers without a device index key
         std::shared_ptr<EventHandlerList<RawDevice>> _event_handlers;
 
-        void _handleEvent(const std::vector<uint8_t>& report);
+        /* Indexed by the device index key, a list is allocated on first use
+         * and lives as long as the device. */
+        std::array<std::atomic<EventHandlerList<RawDevice>*>, 256> _indexed_handlers{};
+        std::mutex _indexed_mutex;
+        std::array<std::shared_ptr<EventHandlerList<RawDevice>>, 256> _indexed_storage;
+
+        struct ReportSlot {
+            std::array<uint8_t, max_data_length> data;
+            std::size_t length;
+            std::chrono::steady_clock::time_point time;
+
+            [[nodiscard]] RawReport report() const {
+                return {data.data(), length};
+            }
+        };
+
+        /* Preallocated slots for reports drained in a single _readReports pass */
+        std::vector<ReportSlot> _read_slots;
+
+        /* Outbound reports waiting for the fd to become writable */
+        std::mutex _write_mutex;
+        std::deque<ReportSlot> _write_queue;
+        int _write_tries = 0;
+        bool _write_backoff = false;
+        std::atomic<uint64_t> _write_retries = 0;
+
+        void _handleEvent(RawReport report);
     };
 }
 
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <backend/raw/Transport.h>
+#include <backend/raw/RawDevice.h>
+
+using namespace logid::backend::raw;
+
+void Transport::receive(RawReport report) {
+    std::shared_ptr<RawDevice> device;
+    {
+        std::lock_guard lock(_device_mutex);
+        device = _device.lock();
+    }
+
+    if (device)
+        device->_receive(report);
+}
+
+void Transport::hangup() {
+    std::lock_guard lock(_device_mutex);
+    if (auto device = _device.lock())
+        device->_valid = false;
+}
+
+void Transport::_attach(const std::weak_ptr<RawDevice>& device) {
+    std::lock_guard lock(_device_mutex);
+    _device = device;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_BACKEND_RAW_TRANSPORT_H
+#define LOGID_BACKEND_RAW_TRANSPORT_H
+
+#include <backend/raw/EventHandler.h>
+#include <memory>
+#include <mutex>
+
+namespace logid::backend::raw {
+    class RawDevice;
+
+    /* Carries the reports of a RawDevice that is not backed by a hidraw
+     * node, e.g. a simulated device. Everything above RawDevice is unaware
+     * of the difference. */
+    class Transport {
+        friend class RawDevice;
+    public:
+        virtual ~Transport() = default;
+
+        // A report sent to the device, must not call receive() before returning
+        virtual void send(RawReport report) = 0;
+
+    protected:
+        // Hands a report read from the device to the RawDevice handlers
+        void receive(RawReport report);
+
+        // The device is gone, further reports are dropped
+        void hangup();
+
+    private:
+        void _attach(const std::weak_ptr<RawDevice>& device);
+
+        std::mutex _device_mutex;
+        std::weak_ptr<RawDevice> _device;
+    };
+}
+
+#endif //LOGID_BACKEND_RAW_TRANSPORT_H
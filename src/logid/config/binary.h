@@ -0,0 +1,312 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_CONFIG_BINARY_H
+#define LOGID_CONFIG_BINARY_H
+
+#include <config/map.h>
+#include <config/group.h>
+#include <ipcgull/property.h>
+#include <type_traits>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <optional>
+#include <variant>
+#include <string>
+#include <typeindex>
+#include <typeinfo>
+#include <list>
+#include <set>
+
+/* A compact snapshot of parsed config, only ever read back by the same
+ * build on the same machine. Values are stored in native byte order. */
+
+namespace logid::config {
+    struct bin_writer {
+        std::string& out;
+
+        void raw(const void* data, std::size_t size) {
+            out.append(static_cast<const char*>(data), size);
+        }
+
+        void length(std::size_t size) {
+            auto n = static_cast<uint32_t>(size);
+            raw(&n, sizeof(n));
+        }
+    };
+
+    struct bin_reader {
+        const char* pos;
+        const char* end;
+
+        void raw(void* data, std::size_t size) {
+            if (static_cast<std::size_t>(end - pos) < size)
+                throw std::out_of_range("truncated config snapshot");
+            std::memcpy(data, pos, size);
+            pos += size;
+        }
+
+        std::size_t length() {
+            uint32_t n;
+            raw(&n, sizeof(n));
+            return n;
+        }
+    };
+
+    /* Describes the layout of the snapshot rather than its contents, any
+     * change to the schema changes it. Groups are described once, where
+     * they appear again only their type is named. */
+    struct bin_signature {
+        std::string out;
+        std::set<std::type_index> seen;
+    };
+
+    inline void sign_name(bin_signature& s, const std::string& name) {
+        s.out += name;
+        s.out += ';';
+    }
+
+    template<typename T>
+    struct config_bin {
+        static void pack(bin_writer& w, const T& t) {
+            if constexpr (std::is_base_of<group, T>::value) {
+                t._pack(w);
+            } else {
+                static_assert(std::is_arithmetic<T>::value);
+                w.raw(&t, sizeof(t));
+            }
+        }
+
+        static void unpack(bin_reader& r, T& t) {
+            if constexpr (std::is_base_of<group, T>::value) {
+                t._unpack(r);
+            } else {
+                r.raw(&t, sizeof(t));
+            }
+        }
+
+        static void sign(bin_signature& s) {
+            sign_name(s, typeid(T).name());
+            if constexpr (std::is_base_of<group, T>::value) {
+                if (s.seen.insert(typeid(T)).second) {
+                    s.out += '{';
+                    T()._sign(s);
+                    s.out += '}';
+                }
+            }
+        }
+    };
+
+    template<>
+    struct config_bin<bool> {
+        static void pack(bin_writer& w, const bool& t) {
+            const uint8_t b = t;
+            w.raw(&b, 1);
+        }
+
+        static void unpack(bin_reader& r, bool& t) {
+            uint8_t b;
+            r.raw(&b, 1);
+            t = b;
+        }
+
+        static void sign(bin_signature& s) {
+            sign_name(s, "bool");
+        }
+    };
+
+    template<>
+    struct config_bin<std::string> {
+        static void pack(bin_writer& w, const std::string& t) {
+            w.length(t.size());
+            w.raw(t.data(), t.size());
+        }
+
+        static void unpack(bin_reader& r, std::string& t) {
+            t.resize(r.length());
+            r.raw(t.data(), t.size());
+        }
+
+        static void sign(bin_signature& s) {
+            sign_name(s, "string");
+        }
+    };
+
+    template<typename T>
+    struct config_bin<ipcgull::property<T>> {
+        static void pack(bin_writer& w, const ipcgull::property<T>& t) {
+            const T value = t;
+            config_bin<T>::pack(w, value);
+        }
+
+        static void unpack(bin_reader& r, ipcgull::property<T>& t) {
+            T value{};
+            config_bin<T>::unpack(r, value);
+            t = value;
+        }
+
+        static void sign(bin_signature& s) {
+            config_bin<T>::sign(s);
+        }
+    };
+
+    template<typename T>
+    struct config_bin<std::optional<T>> {
+        static void pack(bin_writer& w, const std::optional<T>& t) {
+            config_bin<bool>::pack(w, t.has_value());
+            if (t.has_value())
+                config_bin<T>::pack(w, t.value());
+        }
+
+        static void unpack(bin_reader& r, std::optional<T>& t) {
+            bool present;
+            config_bin<bool>::unpack(r, present);
+            if (present)
+                config_bin<T>::unpack(r, t.emplace());
+            else
+                t.reset();
+        }
+
+        static void sign(bin_signature& s) {
+            sign_name(s, "optional");
+            config_bin<T>::sign(s);
+        }
+    };
+
+    template<typename... T>
+    struct config_bin<std::variant<T...>> {
+    private:
+        template<std::size_t I>
+        static void unpack_as(bin_reader& r, std::variant<T...>& t, std::size_t index) {
+            if constexpr (I < sizeof...(T)) {
+                if (index == I)
+                    config_bin<std::variant_alternative_t<I, std::variant<T...>>>::unpack(
+                            r, t.template emplace<I>());
+                else
+                    unpack_as<I + 1>(r, t, index);
+            } else {
+                throw std::out_of_range("invalid variant in config snapshot");
+            }
+        }
+
+    public:
+        static void pack(bin_writer& w, const std::variant<T...>& t) {
+            w.length(t.index());
+            std::visit([&w](const auto& x) {
+                config_bin<std::decay_t<decltype(x)>>::pack(w, x);
+            }, t);
+        }
+
+        static void unpack(bin_reader& r, std::variant<T...>& t) {
+            unpack_as<0>(r, t, r.length());
+        }
+
+        static void sign(bin_signature& s) {
+            sign_name(s, "variant");
+            (config_bin<T>::sign(s), ...);
+            sign_name(s, "end");
+        }
+    };
+
+    template<typename T>
+    struct config_bin<std::list<T>> {
+        static void pack(bin_writer& w, const std::list<T>& t) {
+            w.length(t.size());
+            for (auto& x: t)
+                config_bin<T>::pack(w, x);
+        }
+
+        static void unpack(bin_reader& r, std::list<T>& t) {
+            t.clear();
+            for (auto n = r.length(); n > 0; --n)
+                config_bin<T>::unpack(r, t.emplace_back());
+        }
+
+        static void sign(bin_signature& s) {
+            sign_name(s, "list");
+            config_bin<T>::sign(s);
+        }
+    };
+
+    template<typename T>
+    struct config_bin<std::set<T>> {
+        static void pack(bin_writer& w, const std::set<T>& t) {
+            w.length(t.size());
+            for (auto& x: t)
+                config_bin<T>::pack(w, x);
+        }
+
+        static void unpack(bin_reader& r, std::set<T>& t) {
+            t.clear();
+            for (auto n = r.length(); n > 0; --n) {
+                T x{};
+                config_bin<T>::unpack(r, x);
+                t.emplace_hint(t.end(), std::move(x));
+            }
+        }
+
+        static void sign(bin_signature& s) {
+            sign_name(s, "set");
+            config_bin<T>::sign(s);
+        }
+    };
+
+    template<typename K, typename V, typename KeyName,
+            typename Cmp, typename Alloc>
+    struct config_bin<map<K, V, KeyName, Cmp, Alloc>> {
+        static void pack(bin_writer& w, const map<K, V, KeyName, Cmp, Alloc>& t) {
+            w.length(t.size());
+            for (auto& x: t) {
+                config_bin<K>::pack(w, x.first);
+                config_bin<V>::pack(w, x.second);
+            }
+        }
+
+        static void unpack(bin_reader& r, map<K, V, KeyName, Cmp, Alloc>& t) {
+            t.clear();
+            for (auto n = r.length(); n > 0; --n) {
+                K key{};
+                config_bin<K>::unpack(r, key);
+                config_bin<V>::unpack(r, t.emplace_hint(t.end(), std::move(key), V())->second);
+            }
+        }
+
+        static void sign(bin_signature& s) {
+            sign_name(s, "map");
+            config_bin<K>::sign(s);
+            config_bin<V>::sign(s);
+        }
+    };
+
+    template<typename T>
+    void pack(bin_writer& w, const T& t) {
+        config_bin<T>::pack(w, t);
+    }
+
+    template<typename T>
+    void unpack(bin_reader& r, T& t) {
+        config_bin<T>::unpack(r, t);
+    }
+
+    template<typename T>
+    void sign(bin_signature& s) {
+        config_bin<T>::sign(s);
+    }
+}
+
+#endif //LOGID_CONFIG_BINARY_H
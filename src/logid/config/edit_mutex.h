@@ -0,0 +1,92 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_CONFIG_EDIT_MUTEX_H
+#define LOGID_CONFIG_EDIT_MUTEX_H
+
+#include <shared_mutex>
+
+namespace logid::config {
+    /* Guards a part of the config that is changed at runtime. Locking it
+     * exclusively, as its setters do, also holds edits() shared, so whoever
+     * holds edits() exclusively sees no setter in the middle of a change.
+     * Readers only take this mutex. */
+    class edit_mutex {
+    public:
+        // Held exclusively to read the whole config, e.g. to write it out
+        static std::shared_mutex& edits() {
+            static std::shared_mutex mutex;
+            return mutex;
+        }
+
+        void lock() {
+            _enter();
+            try {
+                _mutex.lock();
+            } catch (...) {
+                _leave();
+                throw;
+            }
+        }
+
+        bool try_lock() {
+            _enter();
+            if (_mutex.try_lock())
+                return true;
+            _leave();
+            return false;
+        }
+
+        void unlock() {
+            _mutex.unlock();
+            _leave();
+        }
+
+        void lock_shared() {
+            _mutex.lock_shared();
+        }
+
+        bool try_lock_shared() {
+            return _mutex.try_lock_shared();
+        }
+
+        void unlock_shared() {
+            _mutex.unlock_shared();
+        }
+
+    private:
+        // Setters nest (e.g. actions made under the profile lock), edits() is taken once
+        static int& _depth() {
+            thread_local int depth = 0;
+            return depth;
+        }
+
+        static void _enter() {
+            if (_depth()++ == 0)
+                edits().lock_shared();
+        }
+
+        static void _leave() {
+            if (--_depth() == 0)
+                edits().unlock_shared();
+        }
+
+        std::shared_mutex _mutex;
+    };
+}
+
+#endif //LOGID_CONFIG_EDIT_MUTEX_H
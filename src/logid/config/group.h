@@ -20,8 +20,13 @@
 
 #include <libconfig.h++>
 #include <type_traits>
+#include <typeinfo>
 #include <functional>
 #include <utility>
+#include <string_view>
+#include <unordered_map>
+#include <array>
+#include <optional>
 
 namespace logid::config {
     template<typename T>
@@ -38,82 +43,264 @@ namespace logid::config {
     template<typename T>
     void append(libconfig::Setting& list, const T& t);
 
+    template<typename T>
+    bool equal(const T& a, const T& b);
+
+    // How a member of a group is loaded once its setting is found
+    template<typename T>
+    struct member_io;
+
+    struct bin_writer;
+    struct bin_reader;
+    struct bin_signature;
+
+    template<typename T>
+    void sign(bin_signature& s);
+
+    void sign_name(bin_signature& s, const std::string& name);
+
+    template<typename T>
+    void pack(bin_writer& w, const T& t);
+
+    template<typename T>
+    void unpack(bin_reader& r, T& t);
+
+    // Sections of a group left unset are taken from a base, see group::_inherit
+    template<typename T>
+    struct member_inherit {
+        static void inherit(T&, const T&) {}
+
+        static void strip(T&, const T&) {}
+    };
+
+    template<typename T>
+    struct member_inherit<std::optional<T>> {
+        static void inherit(std::optional<T>& t, const std::optional<T>& base) {
+            if (!t.has_value())
+                t = base;
+        }
+
+        static void strip(std::optional<T>& t, const std::optional<T>& base) {
+            if (t.has_value() && base.has_value() && config::equal(t.value(), base.value()))
+                t.reset();
+        }
+    };
+
     template<typename T, typename... M>
     struct group_io {
     };
 
     template<typename T>
     struct group_io<T> {
-        static void get(const libconfig::Setting&, T*,
-                        const std::vector<std::string>&, const std::size_t) {}
-
         static void set(libconfig::Setting&, const T*,
                         const std::vector<std::string>&, const std::size_t) {}
+
+        static bool equal(const T*, const T*) { return true; }
+
+        static void pack(bin_writer&, const T*) {}
+
+        static void unpack(bin_reader&, T*) {}
+
+        static void sign(bin_signature&, const std::vector<std::string>&, const std::size_t) {}
+
+        static void inherit(T*, const T*) {}
+
+        static void strip(T*, const T*) {}
     };
 
     template<typename T, typename A, typename... M>
     struct group_io<T, A, M...> {
-        static void get(const libconfig::Setting& s, T* t,
+        static void set(libconfig::Setting& s, const T* t,
                         const std::vector<std::string>& names,
                         const std::size_t index, A T::* arg, M T::*... rest) {
-            auto& x = t->*(arg);
-            A old{x};
+            config::set(s, names[index], t->*(arg));
+            group_io<T, M...>::set(s, t, names, index + 1, rest...);
+        }
+
+        static bool equal(const T* a, const T* b, A T::* arg, M T::*... rest) {
+            return config::equal(a->*(arg), b->*(arg)) &&
+                   group_io<T, M...>::equal(a, b, rest...);
+        }
+
+        static void pack(bin_writer& w, const T* t, A T::* arg, M T::*... rest) {
+            config::pack(w, t->*(arg));
+            group_io<T, M...>::pack(w, t, rest...);
+        }
+
+        static void unpack(bin_reader& r, T* t, A T::* arg, M T::*... rest) {
+            config::unpack(r, t->*(arg));
+            group_io<T, M...>::unpack(r, t, rest...);
+        }
+
+        static void sign(bin_signature& s, const std::vector<std::string>& names,
+                         const std::size_t index, A T::*, M T::*... rest) {
+            sign_name(s, names[index]);
+            config::sign<A>(s);
+            group_io<T, M...>::sign(s, names, index + 1, rest...);
+        }
+
+        static void inherit(T* t, const T* base, A T::* arg, M T::*... rest) {
+            member_inherit<A>::inherit(t->*(arg), base->*(arg));
+            group_io<T, M...>::inherit(t, base, rest...);
+        }
+
+        static void strip(T* t, const T* base, A T::* arg, M T::*... rest) {
+            member_inherit<A>::strip(t->*(arg), base->*(arg));
+            group_io<T, M...>::strip(t, base, rest...);
+        }
+    };
+
+    struct group;
+
+    // Names, accessors and comparison of a group type, made once per type
+    struct group_layout {
+        std::vector<std::string> names;
+        // Views into names
+        std::unordered_map<std::string_view, std::size_t> index;
+        std::function<void(const libconfig::Setting&, group*)> getter;
+        std::function<void(libconfig::Setting&, const group*)> setter;
+        std::function<bool(const group*, const group*)> comparer;
+        std::function<void(bin_writer&, const group*)> packer;
+        std::function<void(bin_reader&, group*)> unpacker;
+        std::function<void(bin_signature&)> signer;
+        std::function<void(group*, const group*)> inheritor;
+        std::function<void(group*, const group*)> stripper;
+    };
+
+    /* Loads a group in one pass over the setting's children, rather than
+     * looking up each member by name */
+    template<typename T, typename... M>
+    struct group_loader {
+        static void get(const libconfig::Setting& s, T* t,
+                        const group_layout& layout, M T::*... args) {
+            std::array<int, sizeof...(M)> at{};
+            at.fill(-1);
+            if (s.isGroup()) {
+                const int length = s.getLength();
+                for (int i = 0; i < length; ++i) {
+                    auto it = layout.index.find(s[i].getName());
+                    if (it != layout.index.end())
+                        at[it->second] = i;
+                }
+            }
+
+            // Fail before loading anything, as a variant tries the next type
+            std::size_t k = 0;
+            bool complete = true;
+            ((complete = complete && (at[k] >= 0 || !member_io<M>::required), ++k), ...);
+            if (!complete)
+                throw libconfig::SettingTypeException(s);
+
             try {
-                x = config::get<A>(s, names[index]);
-                group_io<T, M...>::get(s, t, names, index + 1, rest...);
+                _load(s, t, at, std::index_sequence_for<M...>(), args...);
             } catch (libconfig::SettingTypeException& e) {
-                x = old;
                 throw;
             } catch (libconfig::SettingException& e) {
-                x = old;
                 throw libconfig::SettingTypeException(s);
             }
         }
 
-        static void set(libconfig::Setting& s, const T* t,
-                        const std::vector<std::string>& names,
-                        const std::size_t index, A T::* arg, M T::*... rest) {
-            config::set(s, names[index], t->*(arg));
-            group_io<T, M...>::set(s, t, names, index + 1, rest...);
+    private:
+        template<std::size_t... I>
+        static void _load(const libconfig::Setting& s, T* t,
+                          const std::array<int, sizeof...(M)>& at,
+                          std::index_sequence<I...>, M T::*... args) {
+            ((at[I] >= 0 ? member_io<M>::load(s[at[I]], t->*args) : void()), ...);
         }
     };
 
+    // A base member as a member of T, lets derived groups list it
+    template<typename T, typename M, typename B>
+    constexpr M T::* member_of(M B::* member) {
+        return member;
+    }
+
     template<typename Sign>
     struct signed_group;
 
     struct group {
     private:
-        const std::vector<std::string> _names;
-        const std::function<void(const libconfig::Setting&, group*,
-                                 const std::vector<std::string>&)> _getter;
-        const std::function<void(libconfig::Setting&, const group*,
-                                 const std::vector<std::string>&)> _setter;
+        const group_layout* _layout;
 
         template<typename Sign>
         friend
         struct signed_group;
+
+        template<typename T, typename... M>
+        static const group_layout& _layoutOf(
+                const std::array<std::string, sizeof...(M)>& names, M T::*... args) {
+            // Every instance of T lists the same members
+            static const group_layout layout = [&names, args...]() {
+                group_layout l;
+                l.names.assign(names.begin(), names.end());
+                for (std::size_t i = 0; i < l.names.size(); ++i)
+                    l.index.emplace(l.names[i], i);
+                l.getter = [args...](const libconfig::Setting& s, group* g) {
+                    T* t = dynamic_cast<T*>(g);
+                    group_loader<T, M...>::get(s, t, layout, args...);
+                };
+                l.setter = [args...](libconfig::Setting& s, const group* g) {
+                    const T* t = dynamic_cast<const T*>(g);
+                    group_io<T, M...>::set(s, t, layout.names, 0, args...);
+                };
+                l.comparer = [args...](const group* a, const group* b) {
+                    const T* x = dynamic_cast<const T*>(a);
+                    const T* y = dynamic_cast<const T*>(b);
+                    return x && y && group_io<T, M...>::equal(x, y, args...);
+                };
+                l.packer = [args...](bin_writer& w, const group* g) {
+                    const T* t = dynamic_cast<const T*>(g);
+                    group_io<T, M...>::pack(w, t, args...);
+                };
+                l.unpacker = [args...](bin_reader& r, group* g) {
+                    T* t = dynamic_cast<T*>(g);
+                    group_io<T, M...>::unpack(r, t, args...);
+                };
+                l.signer = [args...](bin_signature& s) {
+                    group_io<T, M...>::sign(s, layout.names, 0, args...);
+                };
+                l.inheritor = [args...](group* g, const group* b) {
+                    T* t = dynamic_cast<T*>(g);
+                    const T* base = dynamic_cast<const T*>(b);
+                    if (t && base)
+                        group_io<T, M...>::inherit(t, base, args...);
+                };
+                l.stripper = [args...](group* g, const group* b) {
+                    T* t = dynamic_cast<T*>(g);
+                    const T* base = dynamic_cast<const T*>(b);
+                    if (t && base)
+                        group_io<T, M...>::strip(t, base, args...);
+                };
+                return l;
+            }();
+            return layout;
+        }
+
+        static const group_layout& _emptyLayout() {
+            static const group_layout layout{
+                    {}, {},
+                    [](const libconfig::Setting&, group*) {},
+                    [](libconfig::Setting&, const group*) {},
+                    [](const group* a, const group* b) {
+                        return typeid(*a) == typeid(*b);
+                    },
+                    [](bin_writer&, const group*) {},
+                    [](bin_reader&, group*) {},
+                    [](bin_signature&) {},
+                    [](group*, const group*) {},
+                    [](group*, const group*) {}};
+            return layout;
+        }
+
     protected:
         template<typename T, typename... M>
         explicit group(const std::array<std::string, sizeof...(M)>& names,
                        M T::*... args) :
-                _names(names.begin(), names.end()),
-                _getter([args...](const libconfig::Setting& s, group* g,
-                                  const std::vector<std::string>& names) {
-                    T* t = dynamic_cast<T*>(g);
-                    group_io<T, M...>::get(s, t, names, 0, args...);
-                }),
-                _setter([args...](libconfig::Setting& s, const group* g,
-                                  const std::vector<std::string>& names) {
-                    const T* t = dynamic_cast<const T*>(g);
-                    group_io<T, M...>::set(s, t, names, 0, args...);
-                }) {
+                _layout(&_layoutOf<T>(names, args...)) {
             static_assert(std::is_base_of<group, T>::value);
         }
 
-        group() : _getter([](const libconfig::Setting&, group*,
-                             const std::vector<std::string>&) {}),
-                  _setter([](libconfig::Setting&, const group*,
-                             const std::vector<std::string>&) {}) {}
+        group() : _layout(&_emptyLayout()) {}
 
     public:
         group(const group& o) = default;
@@ -131,11 +318,39 @@ namespace logid::config {
         virtual ~group() = default;
 
         virtual void _save(libconfig::Setting& setting) const {
-            _setter(setting, this, _names);
+            _layout->setter(setting, this);
         }
 
         virtual void _load(const libconfig::Setting& setting) {
-            _getter(setting, this, _names);
+            _layout->getter(setting, this);
+        }
+
+        // Whether o is the same group with equal members
+        [[nodiscard]] bool _equals(const group& o) const {
+            return _layout->comparer(this, &o);
+        }
+
+        void _pack(bin_writer& w) const {
+            _layout->packer(w, this);
+        }
+
+        void _unpack(bin_reader& r) {
+            _layout->unpacker(r, this);
+        }
+
+        // Describes the names and types of the members, not their values
+        void _sign(bin_signature& s) const {
+            _layout->signer(s);
+        }
+
+        // Optional members left unset are copied from base
+        void _inherit(const group& base) {
+            _layout->inheritor(this, &base);
+        }
+
+        // Optional members equal to those of base are unset again
+        void _strip(const group& base) {
+            _layout->stripper(this, &base);
         }
     };
 
@@ -186,14 +401,14 @@ namespace logid::config {
 
         void _save(libconfig::Setting& setting) const override {
             set(setting, _sig_field, _signature);
-            _setter(setting, this, _names);
+            _layout->setter(setting, this);
         }
 
         void _load(const libconfig::Setting& setting) override {
             if (normalize_signature<Sign>::make(get<Sign>(setting, _sig_field))
                 != _signature)
                 throw libconfig::SettingTypeException(setting);
-            _getter(setting, this, _names);
+            _layout->getter(setting, this);
         }
     };
 
@@ -27,12 +27,16 @@ namespace logid::actions {
 
     class ChangeProfile;
 
+    class ChordAction;
+
     class CycleDPI;
 
     class GestureAction;
 
     class KeypressAction;
 
+    class MacroAction;
+
     class NullAction;
 
     class ToggleHiresScroll;
@@ -41,6 +45,8 @@ namespace logid::actions {
 
     class AxisGesture;
 
+    class MomentumGesture;
+
     class IntervalGesture;
 
     class NullGesture;
@@ -130,6 +136,31 @@ namespace logid::config {
                                                     {"profile"}, &ChangeProfile::profile) {}
     };
 
+    struct MacroStep : public group {
+        // Either a key or an axis
+        std::optional<std::variant<uint, std::string>> key;
+        std::optional<std::variant<std::string, uint>> axis;
+        /* For keys 1 presses and 0 releases, a key without a value is
+         * tapped. For axes, the movement. */
+        std::optional<int> value;
+        // Milliseconds to wait before the next step
+        std::optional<int> delay;
+
+        MacroStep() : group({"key", "axis", "value", "delay"},
+                            &MacroStep::key,
+                            &MacroStep::axis,
+                            &MacroStep::value,
+                            &MacroStep::delay) {}
+    };
+
+    struct MacroAction : public signed_group<std::string> {
+        typedef actions::MacroAction action;
+        std::optional<std::list<MacroStep>> steps;
+
+        MacroAction() : signed_group<std::string>("type", "Macro",
+                                                  {"steps"}, &MacroAction::steps) {}
+    };
+
     typedef std::variant<
             NoAction,
             KeypressAction,
@@ -138,7 +169,8 @@ namespace logid::config {
             CycleDPI,
             ChangeDPI,
             ChangeHost,
-            ChangeProfile
+            ChangeProfile,
+            MacroAction
     > BasicAction;
 
     struct AxisGesture : public signed_group<std::string> {
@@ -146,12 +178,50 @@ namespace logid::config {
         std::optional<int> threshold;
         std::optional<std::variant<std::string, uint>> axis;
         std::optional<double> axis_multiplier;
+        // Milliseconds to sum movement over before emitting it, 0 disables
+        std::optional<int> coalesce;
+        // Weight of the previous velocity estimate in [0, 1), 0 disables
+        std::optional<double> smoothing;
+        // Gain added per unit/ms of velocity, 0 disables
+        std::optional<double> acceleration;
+
+    protected:
+        template<typename T, typename... M>
+        AxisGesture(const std::string& name,
+                    const std::array<std::string, sizeof...(M)>& names,
+                    M T::*... args) : signed_group("mode", name, names, args...) {}
 
-        AxisGesture() : signed_group("mode", "Axis",
-                                     {"threshold", "axis", "axis_multiplier"},
-                                     &AxisGesture::threshold,
-                                     &AxisGesture::axis,
-                                     &AxisGesture::axis_multiplier) {}
+    public:
+        AxisGesture() : AxisGesture("Axis",
+                                    {"threshold", "axis", "axis_multiplier",
+                                     "coalesce", "smoothing", "acceleration"},
+                                    &AxisGesture::threshold,
+                                    &AxisGesture::axis,
+                                    &AxisGesture::axis_multiplier,
+                                    &AxisGesture::coalesce,
+                                    &AxisGesture::smoothing,
+                                    &AxisGesture::acceleration) {}
+    };
+
+    struct MomentumGesture : public AxisGesture {
+        typedef actions::MomentumGesture gesture;
+        // Fraction of the speed kept per second of coasting, in (0, 1)
+        std::optional<double> friction;
+        // Coasting frames per second
+        std::optional<int> rate;
+
+        MomentumGesture() : AxisGesture(
+                "Momentum",
+                {"threshold", "axis", "axis_multiplier", "coalesce",
+                 "smoothing", "acceleration", "friction", "rate"},
+                member_of<MomentumGesture>(&MomentumGesture::threshold),
+                member_of<MomentumGesture>(&MomentumGesture::axis),
+                member_of<MomentumGesture>(&MomentumGesture::axis_multiplier),
+                member_of<MomentumGesture>(&MomentumGesture::coalesce),
+                member_of<MomentumGesture>(&MomentumGesture::smoothing),
+                member_of<MomentumGesture>(&MomentumGesture::acceleration),
+                &MomentumGesture::friction,
+                &MomentumGesture::rate) {}
     };
 
     struct IntervalGesture : public signed_group<std::string> {
@@ -209,6 +279,7 @@ namespace logid::config {
     typedef std::variant<
             NoGesture,
             AxisGesture,
+            MomentumGesture,
             IntervalGesture,
             FewPixelsGesture,
             ReleaseGesture,
@@ -220,11 +291,38 @@ namespace logid::config {
         typedef actions::GestureAction action;
         std::optional<map<std::string, Gesture, string_literal_of<keys::direction>,
                 less_caseless<std::string>>> gestures;
+        /* Distance after which a dominant direction is locked in and the
+         * other gestures stop receiving movement, 0 disables */
+        std::optional<int> commit;
+        // Movement within this distance of the origin on an axis is ignored
+        std::optional<int> deadzone;
+        /* How far another direction must lead the current one before the
+         * release picks it instead, 0 disables */
+        std::optional<int> hysteresis;
 
         GestureAction() : signed_group<std::string>(
                 "type", "Gestures",
-                {"gestures"},
-                &GestureAction::gestures) {}
+                {"gestures", "commit", "deadzone", "hysteresis"},
+                &GestureAction::gestures,
+                &GestureAction::commit,
+                &GestureAction::deadzone,
+                &GestureAction::hysteresis) {}
+    };
+
+    struct ChordAction : public signed_group<std::string> {
+        typedef actions::ChordAction action;
+        // CIDs of the controls that have to be held for action to run
+        std::optional<std::list<int>> buttons;
+        // Stored as "action" in the config, the name is taken by the typedef
+        std::optional<BasicAction> chord;
+        // Run when the other controls are not held
+        std::optional<BasicAction> fallback;
+
+        ChordAction() : signed_group<std::string>("type", "Chord",
+                                                  {"buttons", "action", "fallback"},
+                                                  &ChordAction::buttons,
+                                                  &ChordAction::chord,
+                                                  &ChordAction::fallback) {}
     };
 
     typedef std::variant<
@@ -236,6 +334,8 @@ namespace logid::config {
             ChangeDPI,
             ChangeHost,
             ChangeProfile,
+            MacroAction,
+            ChordAction,
             GestureAction
     > Action;
 
@@ -262,17 +362,37 @@ namespace logid::config {
         std::optional<bool> target;
         std::optional<Gesture> up;
         std::optional<Gesture> down;
+        // Milliseconds without scrolling after which the gestures start over
+        std::optional<int> session_gap;
 
-        HiresScroll() : group({"hires", "invert", "target", "up", "down"},
+        HiresScroll() : group({"hires", "invert", "target", "up", "down", "session_gap"},
                               &HiresScroll::hires,
                               &HiresScroll::invert,
                               &HiresScroll::target,
                               &HiresScroll::up,
-                              &HiresScroll::down) {}
+                              &HiresScroll::down,
+                              &HiresScroll::session_gap) {}
     };
 
     typedef std::variant<int, std::list<int>> DPI;
 
+    /* Switches settings by how fast the device moves, speeds are in
+     * counts per second as the device reports them */
+    struct Adaptive : public group {
+        // Wheel speed from which the ratchet is released
+        std::optional<int> freespin_speed;
+        // Percent below a speed the device has to slow to before switching back
+        std::optional<int> hysteresis;
+        // Milliseconds, the least time between two writes of a setting
+        std::optional<int> interval;
+        // Milliseconds, how long a report counts towards the speed
+        std::optional<int> window;
+
+        Adaptive() : group({"freespin_speed", "hysteresis", "interval", "window"},
+                           &Adaptive::freespin_speed, &Adaptive::hysteresis,
+                           &Adaptive::interval, &Adaptive::window) {}
+    };
+
     struct ThumbWheel : public group {
         std::optional<bool> divert;
         std::optional<bool> invert;
@@ -292,18 +412,39 @@ namespace logid::config {
 
     typedef map<uint16_t, Button, string_literal_of<keys::cid>> RemapButton;
 
+    struct OnboardProfiles : public group {
+        std::optional<int> profile;
+        std::optional<bool> buttons;
+        std::optional<bool> dpi;
+
+        OnboardProfiles() : group({"profile", "buttons", "dpi"},
+                                  &OnboardProfiles::profile, &OnboardProfiles::buttons,
+                                  &OnboardProfiles::dpi) {}
+    };
+
     struct Profile : public group {
         std::optional<DPI> dpi;
         std::optional<SmartShift> smartshift;
         std::optional<std::variant<bool, HiresScroll>> hiresscroll;
         std::optional<ThumbWheel> thumbwheel;
         std::optional<RemapButton> buttons;
+        std::optional<OnboardProfiles> onboard;
+        std::optional<Adaptive> adaptive;
+        // In Hz
+        std::optional<int> report_rate;
+        // A template whose sections this profile uses where it has none
+        std::optional<std::string> inherits;
+        // Switched to while one of these (e.g. window classes) has focus
+        std::optional<std::set<std::string>> applications;
 
         Profile() : group({"dpi", "smartshift", "hiresscroll",
-                           "buttons", "thumbwheel"},
+                           "buttons", "thumbwheel", "onboard", "adaptive", "report_rate",
+                           "inherits", "applications"},
                           &Profile::dpi, &Profile::smartshift,
                           &Profile::hiresscroll, &Profile::buttons,
-                          &Profile::thumbwheel) {}
+                          &Profile::thumbwheel, &Profile::onboard,
+                          &Profile::adaptive, &Profile::report_rate, &Profile::inherits,
+                          &Profile::applications) {}
     };
 
     struct Device : public group {
@@ -317,18 +458,119 @@ namespace logid::config {
         }
     };
 
+    struct Focus : public group {
+        // "hyprland", following its event socket
+        std::optional<std::string> source;
+        std::optional<std::string> socket;
+
+        Focus() : group({"source", "socket"},
+                        &Focus::source,
+                        &Focus::socket) {}
+    };
+
+    struct ThreadScheduling : public group {
+        // "fifo" or "rr" at priority, the default policy otherwise
+        std::optional<std::string> policy;
+        std::optional<int> priority;
+        std::optional<int> nice;
+        std::optional<std::set<int>> cpus;
+
+        ThreadScheduling() : group({"policy", "priority", "nice", "cpus"},
+                                   &ThreadScheduling::policy,
+                                   &ThreadScheduling::priority,
+                                   &ThreadScheduling::nice,
+                                   &ThreadScheduling::cpus) {}
+    };
+
+    typedef map<std::string, std::variant<Device, Profile>,
+            string_literal_of<keys::name>> Devices;
+
+    typedef map<std::string, Profile, string_literal_of<keys::name>> Templates;
+
     struct Config : public group {
-        std::optional<map<std::string,
-                std::variant<Device, Profile>, string_literal_of<keys::name>>> devices;
+        std::optional<Devices> devices;
+        // Profiles that device profiles inherit from, by name
+        std::optional<Templates> templates;
         std::optional<std::set<uint16_t>> ignore;
+        // USB vendor IDs of the HID devices to probe, empty probes all
+        std::optional<std::set<uint16_t>> vendors;
+        /* Product IDs added to the built-in receiver table, and of devices
+         * that only answer on the corded index. Either skips probing, for
+         * Logitech's vendor ID only. */
+        std::optional<std::set<uint16_t>> receivers;
+        std::optional<std::set<uint16_t>> corded;
         std::optional<double> io_timeout;
+        /* Milliseconds an I/O handler may run before it is logged and
+         * counted, unset or 0 leaves the I/O threads untimed. Read at
+         * startup only. */
+        std::optional<double> io_slo;
         std::optional<int> workers;
-
-        Config() : group({"devices", "ignore", "io_timeout", "workers"},
+        std::optional<int> max_workers;
+        std::optional<int> read_batch;
+        std::optional<int> io_threads;
+        std::optional<bool> edge_triggered;
+        // Applies to every I/O thread, read at startup only
+        std::optional<ThreadScheduling> io_scheduling;
+        std::optional<std::string> cache_dir;
+        std::optional<int> stability_pings;
+        std::optional<int> connection_debounce;
+        /* Milliseconds a disconnected device is kept for, it is revived
+         * instead of probed if it comes back in time */
+        std::optional<int> reconnect_grace;
+        std::optional<bool> per_device_input;
+        // Devices on a seat besides seat0 share an input device of that seat
+        std::optional<bool> per_seat_input;
+        /* Features no profile uses are only discovered once an action
+         * asks for them */
+        std::optional<bool> lazy_features;
+        // Reload when the config file changes, SIGHUP always reloads
+        std::optional<bool> watch_config;
+        /* Unix socket serving OpenMetrics text, nothing is served or
+         * collected for it while unset. Read at startup only. */
+        std::optional<std::string> metrics_socket;
+        /* No timer thread, timers fire from a timerfd on the I/O thread.
+         * Tasks still run on workers, of which there is one by default.
+         * Read at startup only. */
+        std::optional<bool> io_timers;
+        /* Locks the daemon in memory so the first event after a long idle
+         * does not fault. Read at startup only. */
+        std::optional<bool> lock_memory;
+        /* Where focus changes come from besides the SetFocus method, they
+         * pick profiles by their applications. Read at startup only. */
+        std::optional<Focus> focus;
+
+        Config() : group({"devices", "templates", "ignore", "vendors", "receivers", "corded",
+                          "io_timeout", "io_slo", "workers",
+                          "max_workers", "read_batch", "io_threads", "edge_triggered", "io_scheduling",
+                          "cache_dir", "stability_pings", "connection_debounce",
+                          "reconnect_grace", "per_device_input", "per_seat_input", "lazy_features",
+                          "watch_config", "metrics_socket", "io_timers", "lock_memory", "focus"},
                          &Config::devices,
+                         &Config::templates,
                          &Config::ignore,
+                         &Config::vendors,
+                         &Config::receivers,
+                         &Config::corded,
                          &Config::io_timeout,
-                         &Config::workers) {}
+                         &Config::io_slo,
+                         &Config::workers,
+                         &Config::max_workers,
+                         &Config::read_batch,
+                         &Config::io_threads,
+                         &Config::edge_triggered,
+                         &Config::io_scheduling,
+                         &Config::cache_dir,
+                         &Config::stability_pings,
+                         &Config::connection_debounce,
+                         &Config::reconnect_grace,
+                         &Config::per_device_input,
+                         &Config::per_seat_input,
+                         &Config::lazy_features,
+                         &Config::watch_config,
+                         &Config::metrics_socket,
+                         &Config::io_timers,
+                         &Config::lock_memory,
+                         &Config::focus) {}
     };
 }
 
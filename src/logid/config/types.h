@@ -20,6 +20,7 @@
 
 #include <config/map.h>
 #include <config/group.h>
+#include <config/binary.h>
 #include <ipcgull/property.h>
 #include <libconfig.h++>
 #include <type_traits>
@@ -414,6 +415,30 @@ namespace logid::config {
         }
     };
 
+    template<typename T>
+    struct member_io {
+        // Without it the group is not this one, e.g. another variant type
+        static constexpr bool required = true;
+
+        static void load(const libconfig::Setting& setting, T& t) {
+            t = config_io<T>::get(setting);
+        }
+    };
+
+    template<typename T>
+    struct member_io<std::optional<T>> {
+        static constexpr bool required = false;
+
+        static void load(const libconfig::Setting& setting, std::optional<T>& t) {
+            try {
+                t = config_io<T>::get(setting);
+            } catch (libconfig::SettingException& e) {
+                logError(setting, e);
+                t.reset();
+            }
+        }
+    };
+
     // Optionals may not appear as part of a list or array
     template<typename T, typename... Rest>
     struct config_io<std::variant<std::optional<T>, Rest...>> {
@@ -430,6 +455,74 @@ namespace logid::config {
         static_assert(!sizeof(std::optional<T>), "Invalid type");
     };
 
+    template<typename T>
+    struct config_eq {
+        static bool equal(const T& a, const T& b) {
+            if constexpr (std::is_base_of<group, T>::value)
+                return a._equals(b);
+            else
+                return a == b;
+        }
+    };
+
+    // Properties are only found outside of profiles, treated as changed
+    template<typename T>
+    struct config_eq<ipcgull::property<T>> {
+        static bool equal(const ipcgull::property<T>&, const ipcgull::property<T>&) {
+            return false;
+        }
+    };
+
+    template<typename T>
+    struct config_eq<std::optional<T>> {
+        static bool equal(const std::optional<T>& a, const std::optional<T>& b) {
+            if (a.has_value() != b.has_value())
+                return false;
+            return !a.has_value() || config::equal(a.value(), b.value());
+        }
+    };
+
+    template<typename... T>
+    struct config_eq<std::variant<T...>> {
+        static bool equal(const std::variant<T...>& a, const std::variant<T...>& b) {
+            if (a.index() != b.index())
+                return false;
+            return std::visit([&b](const auto& x) {
+                return config::equal(x, std::get<std::decay_t<decltype(x)>>(b));
+            }, a);
+        }
+    };
+
+    template<typename T>
+    struct config_eq<std::list<T>> {
+        static bool equal(const std::list<T>& a, const std::list<T>& b) {
+            if (a.size() != b.size())
+                return false;
+            for (auto x = a.begin(), y = b.begin(); x != a.end(); ++x, ++y)
+                if (!config::equal(*x, *y))
+                    return false;
+            return true;
+        }
+    };
+
+    template<typename K, typename V, typename KeyName, typename Cmp, typename Alloc>
+    struct config_eq<map<K, V, KeyName, Cmp, Alloc>> {
+        static bool equal(const map<K, V, KeyName, Cmp, Alloc>& a,
+                          const map<K, V, KeyName, Cmp, Alloc>& b) {
+            if (a.size() != b.size())
+                return false;
+            for (auto x = a.begin(), y = b.begin(); x != a.end(); ++x, ++y)
+                if (!(x->first == y->first) || !config::equal(x->second, y->second))
+                    return false;
+            return true;
+        }
+    };
+
+    template<typename T>
+    bool equal(const T& a, const T& b) {
+        return config_eq<T>::equal(a, b);
+    }
+
     template<typename T>
     void set(libconfig::Setting& parent,
              const std::string& name,
@@ -0,0 +1,202 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <features/Adaptive.h>
+#include <features/SmartShift.h>
+#include <backend/raw/RawDevice.h>
+#include <Configuration.h>
+#include <Device.h>
+#include <algorithm>
+#include <cmath>
+
+using namespace logid;
+using namespace logid::features;
+using namespace logid::backend;
+
+bool Adaptive::supported(Device* dev) {
+    return SmartShift::supported(dev) &&
+           dev->hidpp20().featureSupported(hidpp20::HiresScroll::ID);
+}
+
+Adaptive::Adaptive(Device* dev, config::Profile& profile) :
+        DeviceFeature(dev), _config(profile.adaptive) {
+    try {
+        _hires_scroll = std::make_shared<hidpp20::HiresScroll>(&dev->hidpp20());
+    } catch (hidpp20::UnsupportedFeature& e) {
+        throw UnsupportedFeature();
+    }
+
+    _makeConfig();
+}
+
+void Adaptive::_makeConfig() {
+    std::lock_guard lock(_switch_mutex);
+    _wheel.threshold = 0;
+    _release = 1 - defaults::adaptive_hysteresis / 100.0;
+    _interval = std::chrono::milliseconds(defaults::adaptive_interval);
+    _window = std::chrono::milliseconds(defaults::adaptive_window);
+
+    auto& config = _config.get();
+    if (!config.has_value())
+        return;
+    auto& conf = config.value();
+
+    _wheel.threshold = std::max(conf.freespin_speed.value_or(0), 0);
+
+    if (conf.hysteresis.has_value())
+        _release = 1 - std::clamp(conf.hysteresis.value(), 0, 100) / 100.0;
+    if (conf.interval.has_value())
+        _interval = std::chrono::milliseconds(std::max(conf.interval.value(), 0));
+    if (conf.window.has_value())
+        _window = std::chrono::milliseconds(std::max(conf.window.value(), 1));
+}
+
+void Adaptive::configure() {
+    auto now = clock::now();
+    std::lock_guard lock(_switch_mutex);
+    _wheel.pending.cancel();
+    _wheel.speed = 0;
+    _wheel.last_report.reset();
+    _wheel.fast = false;
+
+    // Otherwise the SmartShift feature already wrote the slow side
+    bool was_fast = _wheel.written.value_or(false);
+    _wheel.written.reset();
+    if (was_fast)
+        _write(_wheel, now);
+}
+
+void Adaptive::listen() {
+    if (_wheel_handler.empty()) {
+        _wheel_handler = _device->hidpp20().addEventRoute(
+                _hires_scroll->featureIndex(), hidpp20::HiresScroll::WheelMovement,
+                [this](hidpp::ReportView report) {
+                    auto event = hidpp20::HiresScroll::wheelMovementEvent(report);
+                    _report(_wheel, std::abs(event.deltaV));
+                });
+    }
+}
+
+void Adaptive::setProfile(config::Profile& profile) {
+    {
+        std::unique_lock lock(_config_mutex);
+        _config = profile.adaptive;
+    }
+    _makeConfig();
+}
+
+DeviceFeature::ProfileDiff Adaptive::compareProfiles(const config::Profile& from,
+                                                     const config::Profile& to) const {
+    return compareSection(from.adaptive, to.adaptive);
+}
+
+std::map<std::string, std::string> Adaptive::cachedState() {
+    std::map<std::string, std::string> state;
+    std::lock_guard lock(_switch_mutex);
+    if (_wheel.written)
+        state.emplace("wheel", _wheel.written.value() ? "fast" : "slow");
+    return state;
+}
+
+void Adaptive::_report(Switch& s, double counts) {
+    auto now = raw::RawDevice::readTime().value_or(clock::now());
+    std::lock_guard lock(_switch_mutex);
+    if (s.threshold <= 0)
+        return;
+
+    bool was_fast = s.fast;
+    _decide(s, now, counts);
+    // Only a change of side is worth a write or a timer
+    if (s.fast != was_fast)
+        _schedule(s, now);
+}
+
+void Adaptive::_decide(Switch& s, clock::time_point now, double counts) const {
+    if (s.last_report && now > s.last_report.value()) {
+        std::chrono::duration<double> elapsed = now - s.last_report.value();
+        s.speed *= std::exp(-elapsed / _window);
+    }
+    if (!s.last_report || now > s.last_report.value())
+        s.last_report = now;
+    s.speed += counts / _window.count();
+
+    // Hysteresis keeps a speed around the threshold from flapping
+    s.fast = s.speed > (s.fast ? s.threshold * _release : s.threshold);
+}
+
+void Adaptive::_schedule(Switch& s, clock::time_point now) {
+    // Whatever is pending already looks at the side when it runs
+    if (!s.pending.done())
+        return;
+
+    auto wait = std::chrono::milliseconds(0);
+    if (s.last_write) {
+        auto since = std::chrono::duration_cast<std::chrono::milliseconds>(
+                now - s.last_write.value());
+        wait = std::max(_interval - since, std::chrono::milliseconds(0));
+    }
+
+    if (s.written != s.fast && wait.count() == 0)
+        _write(s, now);
+    if (s.written == s.fast) {
+        if (!s.fast)
+            return;
+        wait = _interval;
+    }
+
+    // Reports stop coming when the device does, so it is checked for slowing down
+    s.pending = run_task_after([self_weak = self<Adaptive>(), s_ptr = &s]() {
+        if (auto self = self_weak.lock())
+            self->_check(*s_ptr);
+    }, std::max(wait, std::chrono::milliseconds(1)), task_priority::background);
+    _tasks.add(s.pending);
+}
+
+void Adaptive::_check(Switch& s) {
+    auto now = clock::now();
+    std::lock_guard lock(_switch_mutex);
+    if (s.threshold <= 0)
+        return;
+    _decide(s, now);
+    _schedule(s, now);
+}
+
+void Adaptive::_write(Switch& s, clock::time_point now) {
+    bool fast = s.fast;
+    s.written = fast;
+    s.last_write = now;
+
+    _device->postWrite("adaptive_ratchet", [self_weak = self<Adaptive>(), fast]() {
+        if (auto self = self_weak.lock())
+            self->_writeRatchet(fast);
+    });
+}
+
+void Adaptive::_writeRatchet(bool fast) {
+    auto feature = _device->getFeature<SmartShift>("smartshift");
+    if (!feature)
+        return;
+
+    // Active is the ratchet, kept current by the device's ratchet switch reports
+    if (feature->getStatus().active != fast)
+        return;
+
+    SmartShift::Status status{};
+    status.setActive = true;
+    status.active = !fast;
+    feature->setStatus(status);
+}
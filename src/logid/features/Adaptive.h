@@ -0,0 +1,108 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_FEATURE_ADAPTIVE_H
+#define LOGID_FEATURE_ADAPTIVE_H
+
+#include <features/DeviceFeature.h>
+#include <backend/hidpp20/features/HiresScroll.h>
+#include <backend/hidpp/Device.h>
+#include <config/schema.h>
+#include <util/task.h>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+
+namespace logid::features {
+    /* Releases the wheel's ratchet by how fast the wheel turns. Speed is
+     * measured from the reports logid gets, so only while the wheel
+     * targets HID++. A switch is written at most once per interval, and
+     * only when the SmartShift feature's cached state differs from it. */
+    class Adaptive : public DeviceFeature {
+    public:
+        void configure() final;
+
+        void listen() final;
+
+        void setProfile(config::Profile& profile) final;
+
+        [[nodiscard]] std::map<std::string, std::string> cachedState() final;
+
+        [[nodiscard]] ProfileDiff compareProfiles(const config::Profile& from,
+                                                  const config::Profile& to) const final;
+
+        [[nodiscard]] static bool supported(Device* dev);
+
+    protected:
+        Adaptive(Device* dev, config::Profile& profile);
+
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        // A setting with a slow and a fast side
+        struct Switch {
+            // Counts per second to go fast at, 0 leaves the setting alone
+            double threshold = 0;
+            // Counts per second, decaying over the window
+            double speed = 0;
+            std::optional<clock::time_point> last_report;
+            bool fast = false;
+            // The side last handed to the device, empty after configure
+            std::optional<bool> written;
+            std::optional<clock::time_point> last_write;
+            // A write held back by the interval, or the check for slowing down
+            task_handle pending;
+        };
+
+        void _makeConfig();
+
+        void _report(Switch& s, double counts);
+
+        /* Lets the speed decay to now, adds what was reported and picks
+         * the side, _switch_mutex held */
+        void _decide(Switch& s, clock::time_point now, double counts = 0) const;
+
+        // Writes the side or arms a check for it, _switch_mutex held
+        void _schedule(Switch& s, clock::time_point now);
+
+        void _check(Switch& s);
+
+        void _write(Switch& s, clock::time_point now);
+
+        void _writeRatchet(bool fast);
+
+        mutable config::edit_mutex _config_mutex;
+        std::reference_wrapper<std::optional<config::Adaptive>> _config;
+
+        std::mutex _switch_mutex;
+        Switch _wheel;
+        // Fraction of the threshold to stay fast down to
+        double _release = 1;
+        std::chrono::milliseconds _interval;
+        std::chrono::duration<double> _window;
+
+        // Checks still waiting are dropped with the feature
+        task_set _tasks;
+
+        std::shared_ptr<backend::hidpp20::HiresScroll> _hires_scroll;
+
+        EventHandlerLock<backend::hidpp::Device> _wheel_handler;
+    };
+}
+
+#endif //LOGID_FEATURE_ADAPTIVE_H
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <features/Battery.h>
+#include <util/log.h>
+#include <ipc_defs.h>
+
+using namespace logid::features;
+using namespace logid::backend;
+
+namespace {
+    constexpr std::chrono::milliseconds interval_discharging = std::chrono::minutes(10);
+    constexpr std::chrono::milliseconds interval_low = std::chrono::minutes(2);
+    // Charging, full, unreadable or covered by broadcasts
+    constexpr std::chrono::milliseconds interval_idle = std::chrono::minutes(30);
+    constexpr uint8_t low_level = 20;
+
+    /* Polls land on multiples of this, so devices on one receiver that come
+     * due close together are polled in the same wake-up of the radio */
+    constexpr std::chrono::milliseconds poll_grid = std::chrono::minutes(1);
+    // Lets the device settle after configuration before the first read
+    constexpr std::chrono::milliseconds settle_delay = std::chrono::seconds(1);
+
+    const char* statusName(uint8_t status) {
+        switch (status) {
+            case hidpp20::BatteryStatus::Discharging:
+                return "discharging";
+            case hidpp20::BatteryStatus::Recharging:
+                return "recharging";
+            case hidpp20::BatteryStatus::AlmostFull:
+                return "almost full";
+            case hidpp20::BatteryStatus::Full:
+                return "full";
+            case hidpp20::BatteryStatus::SlowRecharge:
+                return "slow recharge";
+            default:
+                return "error";
+        }
+    }
+}
+
+bool Battery::supported(Device* dev) {
+    return dev->hidpp20().featureSupported(hidpp20::BatteryStatus::ID);
+}
+
+Battery::Battery(Device* dev, config::Profile&) : DeviceFeature(dev) {
+    try {
+        _battery_status = std::make_shared<hidpp20::BatteryStatus>(&dev->hidpp20());
+    } catch (hidpp20::UnsupportedFeature& e) {
+        throw UnsupportedFeature();
+    }
+
+    _ipc_interface = _device->ipcNode()->make_interface<IPC>(this);
+}
+
+void Battery::configure() {
+    // Runs on wakeup, the level may have changed while the device slept
+    _schedule(settle_delay, false);
+}
+
+void Battery::listen() {
+    if (_ev_handler.empty()) {
+        _ev_handler = _device->hidpp20().addEventRoute(
+                _battery_status->featureIndex(),
+                hidpp20::BatteryStatus::StatusBroadcast,
+                [this](hidpp::ReportView report) {
+                    auto status = hidpp20::BatteryStatus::statusBroadcastEvent(report);
+                    _broadcasts = true;
+                    _update(status);
+                    _schedule(_interval());
+                });
+    }
+}
+
+void Battery::setProfile(config::Profile&) {
+}
+
+DeviceFeature::ProfileDiff Battery::compareProfiles(const config::Profile&,
+                                                    const config::Profile&) const {
+    return Unchanged;
+}
+
+std::map<std::string, std::string> Battery::cachedState() {
+    auto current = status();
+    if (!current)
+        return {};
+    return {{"level", std::to_string(current->level)},
+            {"status", statusName(current->status)}};
+}
+
+std::optional<hidpp20::BatteryStatus::Status> Battery::status() const {
+    std::lock_guard lock(_status_mutex);
+    return _status;
+}
+
+void Battery::_poll() {
+    try {
+        _update(_battery_status->getStatus());
+    } catch (std::exception& e) {
+        // Most likely asleep, the wakeup reconfiguration polls again
+        logPrintf(DEBUG, "%s:%d: battery poll failed: %s",
+                  _device->hidpp20().devicePath().c_str(),
+                  _device->hidpp20().deviceIndex(), e.what());
+    }
+
+    _schedule(_interval());
+}
+
+void Battery::_update(const hidpp20::BatteryStatus::Status& status) {
+    {
+        std::lock_guard lock(_status_mutex);
+        if (_status && _status->level == status.level &&
+            _status->nextLevel == status.nextLevel && _status->status == status.status)
+            return;
+        _status = status;
+    }
+
+    logPrintf(INFO, "%s:%d: battery at %d%%, %s",
+              _device->hidpp20().devicePath().c_str(),
+              _device->hidpp20().deviceIndex(), status.level, statusName(status.status));
+    _ipc_interface->notifyStatus(status);
+}
+
+std::chrono::milliseconds Battery::_interval() const {
+    if (_broadcasts)
+        return interval_idle;
+
+    std::lock_guard lock(_status_mutex);
+    if (!_status || _status->status != hidpp20::BatteryStatus::Discharging)
+        return interval_idle;
+
+    if (_status->level != 0 && _status->level <= low_level)
+        return interval_low;
+
+    return interval_discharging;
+}
+
+void Battery::_schedule(std::chrono::milliseconds delay, bool aligned) {
+    if (aligned) {
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch());
+        auto due = now + delay;
+        auto remainder = due % poll_grid;
+        if (remainder.count() != 0)
+            due += poll_grid - remainder;
+        delay = due - now;
+    }
+
+    std::lock_guard lock(_poll_lock);
+    _next_poll.cancel();
+    _next_poll = run_task_after([self_weak = self<Battery>()]() {
+        if (auto self = self_weak.lock()) {
+            {
+                std::lock_guard lock(self->_poll_lock);
+                self->_next_poll = {};
+            }
+            // Ordered against wakeups, which also talk to the device
+            self->_device->post([self_weak]() {
+                if (auto self = self_weak.lock())
+                    self->_poll();
+            });
+        }
+    }, delay, task_priority::background);
+    _tasks.add(_next_poll);
+}
+
+Battery::IPC::IPC(Battery* parent) :
+        ipcgull::interface(
+                SERVICE_ROOT_NAME ".Battery", {
+                        {"GetStatus", {this, &IPC::getStatus, {"level", "next_level", "status"}}}
+                }, {}, {
+                        {"StatusChanged", ipcgull::signal::make_signal<uint8_t, uint8_t, uint8_t>(
+                                {"level", "next_level", "status"})}
+                }),
+        _parent(*parent) {
+}
+
+std::tuple<uint8_t, uint8_t, uint8_t> Battery::IPC::getStatus() const {
+    auto status = _parent.status();
+    if (!status)
+        return {0, 0, hidpp20::BatteryStatus::OtherError};
+    return {status->level, status->nextLevel, status->status};
+}
+
+void Battery::IPC::notifyStatus(const hidpp20::BatteryStatus::Status& status) const {
+    emit_signal("StatusChanged", status.level, status.nextLevel, status.status);
+}
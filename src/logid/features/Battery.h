@@ -0,0 +1,92 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_FEATURE_BATTERY_H
+#define LOGID_FEATURE_BATTERY_H
+
+#include <features/DeviceFeature.h>
+#include <Device.h>
+#include <backend/hidpp20/features/BatteryStatus.h>
+#include <ipcgull/interface.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+
+namespace logid::features {
+    class Battery : public DeviceFeature {
+    public:
+        void configure() final;
+
+        void listen() final;
+
+        void setProfile(config::Profile& profile) final;
+
+        [[nodiscard]] std::map<std::string, std::string> cachedState() final;
+
+        [[nodiscard]] ProfileDiff compareProfiles(const config::Profile& from,
+                                                  const config::Profile& to) const final;
+
+        // The last status read or broadcast, empty until the first poll
+        [[nodiscard]] std::optional<backend::hidpp20::BatteryStatus::Status> status() const;
+
+        [[nodiscard]] static bool supported(Device* dev);
+
+    protected:
+        Battery(Device* dev, config::Profile& profile);
+
+    private:
+        void _poll();
+
+        void _update(const backend::hidpp20::BatteryStatus::Status& status);
+
+        /* Queues the next poll in place of any pending one, rounded up to
+         * the shared poll grid when aligned */
+        void _schedule(std::chrono::milliseconds delay, bool aligned = true);
+
+        [[nodiscard]] std::chrono::milliseconds _interval() const;
+
+        class IPC : public ipcgull::interface {
+        public:
+            explicit IPC(Battery* parent);
+
+            [[nodiscard]] std::tuple<uint8_t, uint8_t, uint8_t> getStatus() const;
+
+            void notifyStatus(const backend::hidpp20::BatteryStatus::Status& status) const;
+
+        private:
+            Battery& _parent;
+        };
+
+        std::shared_ptr<backend::hidpp20::BatteryStatus> _battery_status;
+
+        mutable std::mutex _status_mutex;
+        std::optional<backend::hidpp20::BatteryStatus::Status> _status;
+        // Once the device has broadcast a change, polling is only a fallback
+        std::atomic_bool _broadcasts = false;
+
+        std::mutex _poll_lock;
+        task_handle _next_poll;
+        task_set _tasks;
+
+        std::shared_ptr<IPC> _ipc_interface;
+
+        EventHandlerLock<backend::hidpp::Device> _ev_handler;
+    };
+}
+
+#endif //LOGID_FEATURE_BATTERY_H
@@ -24,41 +24,48 @@
 using namespace logid::features;
 using namespace logid::backend;
 
-uint16_t getClosestDPI(const hidpp20::AdjustableDPI::SensorDPIList& dpi_list,
-                       uint16_t dpi) {
-    if (dpi_list.isRange) {
-        const uint16_t min = *std::min_element(dpi_list.dpis.begin(), dpi_list.dpis.end());
-        const uint16_t max = *std::max_element(dpi_list.dpis.begin(), dpi_list.dpis.end());
-        if (!((dpi - min) % dpi_list.dpiStep) && dpi >= min && dpi <= max)
-            return dpi;
-        else if (dpi > max)
-            return max;
-        else if (dpi < min)
-            return min;
-        else
-            return (uint16_t) (min + round((double) (dpi - min) / dpi_list.dpiStep) *
-                                     dpi_list.dpiStep);
-    } else {
-        if (std::find(dpi_list.dpis.begin(), dpi_list.dpis.end(), dpi)
-            != dpi_list.dpis.end())
+DPI::SensorDPIs::SensorDPIs(hidpp20::AdjustableDPI::SensorDPIList dpi_list) :
+        list(std::move(dpi_list)), sorted(list.dpis), min(0), max(0) {
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    if (!sorted.empty()) {
+        min = sorted.front();
+        max = sorted.back();
+    }
+}
+
+uint16_t DPI::SensorDPIs::closest(uint16_t dpi) const {
+    if (sorted.empty())
+        return 0;
+
+    if (dpi <= min)
+        return min;
+    if (dpi >= max)
+        return max;
+
+    if (list.isRange) {
+        if (!list.dpiStep)
             return dpi;
-        else {
-            auto it = std::min_element(dpi_list.dpis.begin(), dpi_list.dpis.end(),
-                                       [dpi](uint16_t a, uint16_t b) {
-                                           return (dpi - a) < (dpi - b);
-                                       });
-            if (it == dpi_list.dpis.end())
-                return 0;
-            else
-                return *it;
-        }
+        // Round to the nearest step
+        const uint32_t steps = (dpi - min + list.dpiStep / 2) / list.dpiStep;
+        return (uint16_t) std::min<uint32_t>(min + steps * list.dpiStep, max);
     }
+
+    // min < dpi < max, so both neighbours exist
+    auto upper = std::lower_bound(sorted.begin(), sorted.end(), dpi);
+    auto lower = std::prev(upper);
+    return (dpi - *lower) < (*upper - dpi) ? *lower : *upper;
+}
+
+bool DPI::supported(Device* dev) {
+    return dev->hidpp20().featureSupported(hidpp20::ExtendedAdjustableDPI::ID) ||
+           dev->hidpp20().featureSupported(hidpp20::AdjustableDPI::ID);
 }
 
-DPI::DPI(Device* device) : DeviceFeature(device), _config(device->activeProfile().dpi) {
+DPI::DPI(Device* device, config::Profile& profile) : DeviceFeature(device),
+                                                     _config(profile.dpi) {
     try {
-        _adjustable_dpi = std::make_shared<hidpp20::AdjustableDPI>
-                (&device->hidpp20());
+        _adjustable_dpi = hidpp20::AdjustableDPI::autoVersion(&device->hidpp20());
     } catch (hidpp20::UnsupportedFeature& e) {
         throw UnsupportedFeature();
     }
@@ -69,6 +76,12 @@ DPI::DPI(Device* device) : DeviceFeature(device), _config(device->activeProfile(
 void DPI::configure() {
     std::shared_lock lock(_config_mutex);
 
+    // The device may have come back with different DPIs
+    {
+        std::lock_guard current_lock(_current_mutex);
+        _current_dpi.clear();
+    }
+
     if (_config.get().has_value()) {
         const auto& config = _config.get().value();
         if (std::holds_alternative<int>(config)) {
@@ -76,7 +89,9 @@ void DPI::configure() {
             _fillDPILists(0);
             std::shared_lock dpi_lock(_dpi_list_mutex);
             if (dpi != 0) {
-                _adjustable_dpi->setSensorDPI(0, getClosestDPI(_dpi_lists.at(0), dpi));
+                auto closest = _dpi_lists.at(0).closest(dpi);
+                _adjustable_dpi->setSensorDPI(0, closest);
+                _cacheDPI(0, closest);
             }
         } else {
             const auto& dpis = std::get<std::list<int>>(config);
@@ -85,7 +100,9 @@ void DPI::configure() {
             std::shared_lock dpi_lock(_dpi_list_mutex);
             for (const auto& dpi: dpis) {
                 if (dpi != 0) {
-                    _adjustable_dpi->setSensorDPI(i, getClosestDPI(_dpi_lists.at(i), dpi));
+                    auto closest = _dpi_lists.at(i).closest(dpi);
+                    _adjustable_dpi->setSensorDPI(i, closest);
+                    _cacheDPI(i, closest);
                     ++i;
                 }
             }
@@ -101,17 +118,83 @@ void DPI::setProfile(config::Profile& profile) {
     _config = profile.dpi;
 }
 
+DeviceFeature::ProfileDiff DPI::compareProfiles(const config::Profile& from,
+                                                const config::Profile& to) const {
+    return compareSection(from.dpi, to.dpi);
+}
+
+std::map<std::string, std::string> DPI::cachedState() {
+    std::map<std::string, std::string> state;
+    std::lock_guard lock(_current_mutex);
+    for (auto& [sensor, dpi]: _current_dpi)
+        state.emplace("sensor" + std::to_string(sensor), std::to_string(dpi));
+    return state;
+}
+
 uint16_t DPI::getDPI(uint8_t sensor) {
-    return _adjustable_dpi->getSensorDPI(sensor);
+    {
+        std::lock_guard lock(_current_mutex);
+        auto it = _current_dpi.find(sensor);
+        if (it != _current_dpi.end())
+            return it->second;
+    }
+
+    auto dpi = _adjustable_dpi->getSensorDPI(sensor);
+    _cacheDPI(sensor, dpi);
+    return dpi;
 }
 
 void DPI::setDPI(uint16_t dpi, uint8_t sensor) {
     if (dpi == 0)
         return;
+    auto closest = closestDPI(dpi, sensor);
+    _adjustable_dpi->setSensorDPI(sensor, closest);
+    _cacheDPI(sensor, closest);
+}
+
+uint16_t DPI::closestDPI(uint16_t dpi, uint8_t sensor) {
     _fillDPILists(sensor);
     std::shared_lock lock(_dpi_list_mutex);
-    auto dpi_list = _dpi_lists.at(sensor);
-    _adjustable_dpi->setSensorDPI(sensor, getClosestDPI(dpi_list, dpi));
+    return _dpi_lists.at(sensor).closest(dpi);
+}
+
+bool DPI::setDPI(uint16_t dpi, uint8_t sensor,
+                 std::function<void(std::exception_ptr)> error) {
+    if (dpi == 0)
+        return true;
+    uint16_t closest;
+    {
+        std::shared_lock lock(_dpi_list_mutex);
+        if (_dpi_lists.size() <= sensor)
+            return false;
+        closest = _dpi_lists[sensor].closest(dpi);
+    }
+
+    // Assumed to succeed, a failed write drops the cached value again
+    _cacheDPI(sensor, closest);
+    _adjustable_dpi->setSensorDPI(
+            sensor, closest,
+            [self_weak = self<DPI>(), sensor, closest, error = std::move(error)](
+                    const std::exception_ptr& e) {
+                if (auto self = self_weak.lock())
+                    self->_forgetDPI(sensor, closest);
+                if (error)
+                    error(e);
+            });
+    return true;
+}
+
+void DPI::_cacheDPI(uint8_t sensor, uint16_t dpi) {
+    std::lock_guard lock(_current_mutex);
+    _current_dpi[sensor] = dpi;
+}
+
+void DPI::_forgetDPI(uint8_t sensor, uint16_t dpi) {
+    std::lock_guard lock(_current_mutex);
+    // A value cached since belongs to a later write
+    auto it = _current_dpi.find(sensor);
+    if (it != _current_dpi.end() && it->second == dpi)
+        _current_dpi.erase(it);
 }
 
 void DPI::_fillDPILists(uint8_t sensor) {
@@ -123,7 +206,7 @@ void DPI::_fillDPILists(uint8_t sensor) {
     if (needs_fill) {
         std::unique_lock lock(_dpi_list_mutex);
         for (std::size_t i = _dpi_lists.size(); i <= sensor; i++) {
-            _dpi_lists.push_back(_adjustable_dpi->getSensorDPIList(i));
+            _dpi_lists.emplace_back(_adjustable_dpi->getSensorDPIList(i));
         }
     }
 }
@@ -144,7 +227,7 @@ uint8_t DPI::IPC::getSensors() const {
 std::tuple<std::vector<uint16_t>, uint16_t, bool> DPI::IPC::getDPIs(uint8_t sensor) const {
     _parent._fillDPILists(sensor);
     std::shared_lock lock(_parent._dpi_list_mutex);
-    auto& dpi_list = _parent._dpi_lists.at(sensor);
+    auto& dpi_list = _parent._dpi_lists.at(sensor).list;
     return {dpi_list.dpis, dpi_list.dpiStep, dpi_list.isRange};
 }
 
@@ -205,5 +288,9 @@ void DPI::IPC::setDPI(uint16_t dpi, uint8_t sensor) {
         }
     }
 
-    _parent.setDPI(dpi, sensor);
+    _parent._device->postWrite("dpi" + std::to_string(sensor),
+                              [self_weak = _parent.self<DPI>(), dpi, sensor]() {
+        if (auto self = self_weak.lock())
+            self->setDPI(dpi, sensor);
+    });
 }
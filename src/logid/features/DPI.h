@@ -22,6 +22,8 @@
 #include <features/DeviceFeature.h>
 #include <config/schema.h>
 #include <ipcgull/interface.h>
+#include <map>
+#include <mutex>
 #include <shared_mutex>
 
 namespace logid::features {
@@ -33,16 +35,53 @@ namespace logid::features {
 
         void setProfile(config::Profile& profile) final;
 
+        [[nodiscard]] std::map<std::string, std::string> cachedState() final;
+
+        [[nodiscard]] ProfileDiff compareProfiles(const config::Profile& from,
+                                                  const config::Profile& to) const final;
+
+        /* Cached after the first read and every set. A DPI changed by the
+         * device itself is only seen after the next configure. */
         uint16_t getDPI(uint8_t sensor = 0);
 
         void setDPI(uint16_t dpi, uint8_t sensor = 0);
 
+        // What setDPI would set, reads the sensor's DPI list if needed
+        [[nodiscard]] uint16_t closestDPI(uint16_t dpi, uint8_t sensor = 0);
+
+        /* Does not wait for the device, so it may be called from the I/O
+         * thread. Returns false without writing if the sensor's DPI list
+         * has not been read yet. error is run on a worker thread. */
+        bool setDPI(uint16_t dpi, uint8_t sensor,
+                    std::function<void(std::exception_ptr)> error);
+
+        [[nodiscard]] static bool supported(Device* dev);
+
+        // A sensor's DPI list with what resolving a DPI needs precomputed
+        struct SensorDPIs {
+            backend::hidpp20::AdjustableDPI::SensorDPIList list;
+            // Sorted, duplicates removed
+            std::vector<uint16_t> sorted;
+            uint16_t min;
+            uint16_t max;
+
+            explicit SensorDPIs(backend::hidpp20::AdjustableDPI::SensorDPIList dpi_list);
+
+            // 0 if the sensor lists no DPI
+            [[nodiscard]] uint16_t closest(uint16_t dpi) const;
+        };
+
     protected:
-        explicit DPI(Device* dev);
+        DPI(Device* dev, config::Profile& profile);
 
     private:
         void _fillDPILists(uint8_t sensor);
 
+        void _cacheDPI(uint8_t sensor, uint16_t dpi);
+
+        // Only if dpi is still the cached value
+        void _forgetDPI(uint8_t sensor, uint16_t dpi);
+
         class IPC : public ipcgull::interface {
         public:
             explicit IPC(DPI* parent);
@@ -60,11 +99,14 @@ namespace logid::features {
             DPI& _parent;
         };
 
-        mutable std::shared_mutex _config_mutex;
+        mutable config::edit_mutex _config_mutex;
         std::reference_wrapper<std::optional<config::DPI>> _config;
         std::shared_ptr<backend::hidpp20::AdjustableDPI> _adjustable_dpi;
         mutable std::shared_mutex _dpi_list_mutex;
-        std::vector<backend::hidpp20::AdjustableDPI::SensorDPIList> _dpi_lists;
+        std::vector<SensorDPIs> _dpi_lists;
+
+        std::mutex _current_mutex;
+        std::map<uint8_t, uint16_t> _current_dpi;
 
         std::shared_ptr<IPC> _ipc_interface;
     };
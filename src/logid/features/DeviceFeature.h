@@ -19,6 +19,9 @@
 #ifndef LOGID_FEATURES_DEVICEFEATURE_H
 #define LOGID_FEATURES_DEVICEFEATURE_H
 
+#include <config/edit_mutex.h>
+#include <util/memory.h>
+#include <map>
 #include <memory>
 #include <string>
 
@@ -28,6 +31,9 @@ namespace logid {
 
 namespace logid::config {
     struct Profile;
+
+    template<typename T>
+    bool equal(const T& a, const T& b);
 }
 
 namespace logid::features {
@@ -56,6 +62,7 @@ namespace logid::features {
 
     class DeviceFeature {
         std::weak_ptr<DeviceFeature> _self;
+        memory_charge _charge;
     public:
         virtual void configure() = 0;
 
@@ -63,6 +70,37 @@ namespace logid::features {
 
         virtual void setProfile(config::Profile& profile) = 0;
 
+        /* Called before profile is removed or reset, anything kept that
+         * refers to its config has to go */
+        virtual void dropProfile([[maybe_unused]] config::Profile& profile) {}
+
+        enum ProfileDiff {
+            Unchanged,
+            // configure() alone brings the device in line
+            Changed,
+            // Something from was left out of to, only a reset drops it
+            NeedsReset
+        };
+
+        /* Called after setProfile(to) on a profile switch, decides what the
+         * device does about the feature */
+        [[nodiscard]] virtual ProfileDiff compareProfiles(
+                [[maybe_unused]] const config::Profile& from,
+                [[maybe_unused]] const config::Profile& to) const {
+            return NeedsReset;
+        }
+
+        /* What is known of the device without asking it, for bulk state
+         * queries. Never does device I/O, empty until something is read. */
+        [[nodiscard]] virtual std::map<std::string, std::string> cachedState() {
+            return {};
+        }
+
+        // Counts bytes, the feature's own size, against account
+        void _account(std::shared_ptr<memory_account> account, std::size_t bytes) {
+            _charge.charge(std::move(account), memory_account::features, bytes);
+        }
+
         virtual ~DeviceFeature() = default;
 
         DeviceFeature(const DeviceFeature&) = delete;
@@ -79,6 +117,14 @@ namespace logid::features {
             return std::dynamic_pointer_cast<T>(_self.lock());
         }
 
+        // For sections whose configure() writes everything they hold
+        template<typename T>
+        [[nodiscard]] static ProfileDiff compareSection(const T& from, const T& to) {
+            if (config::equal(from, to))
+                return Unchanged;
+            return to.has_value() ? Changed : NeedsReset;
+        }
+
     public:
         template<typename T, typename... Args>
         static std::shared_ptr<T> make(Args... args) {
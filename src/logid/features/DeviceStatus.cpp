@@ -16,18 +16,24 @@
  *
  */
 #include <features/DeviceStatus.h>
-#include <util/task.h>
 
 using namespace logid::features;
 using namespace logid::backend;
 
-DeviceStatus::DeviceStatus(logid::Device* dev) : DeviceFeature(dev) {
+bool DeviceStatus::supported(Device* dev) {
     /* This feature is redundant on receivers since the receiver
      * handles wakeup/sleep events. If the device is connected on a
      * receiver, pretend this feature is unsupported.
      */
     if (dev->hidpp20().deviceIndex() >= hidpp::WirelessDevice1 &&
         dev->hidpp20().deviceIndex() <= hidpp::WirelessDevice6)
+        return false;
+
+    return dev->hidpp20().featureSupported(hidpp20::WirelessDeviceStatus::ID);
+}
+
+DeviceStatus::DeviceStatus(logid::Device* dev, config::Profile&) : DeviceFeature(dev) {
+    if (!supported(dev))
         throw UnsupportedFeature();
 
     try {
@@ -43,25 +49,21 @@ void DeviceStatus::configure() {
 
 void DeviceStatus::listen() {
     if (_ev_handler.empty()) {
-        _ev_handler = _device->hidpp20().addEventHandler(
-                {[index = _wireless_device_status->featureIndex()](
-                        const hidpp::Report& report) -> bool {
-                    return report.feature() == index &&
-                           report.function() ==
-                           hidpp20::WirelessDeviceStatus::StatusBroadcast;
-                },
-                 [self_weak = self<DeviceStatus>()](
-                         const hidpp::Report& report) {
-                     auto event = hidpp20::WirelessDeviceStatus::statusBroadcastEvent(report);
-                     if (event.reconfNeeded)
-                         run_task_after([self_weak]() {
-                             if (auto self = self_weak.lock())
-                                 self->_device->wakeup();
-                         }, std::chrono::milliseconds(100));
-                 }
+        _ev_handler = _device->hidpp20().addEventRoute(
+                _wireless_device_status->featureIndex(),
+                hidpp20::WirelessDeviceStatus::StatusBroadcast,
+                [this](hidpp::ReportView report) {
+                    auto event = hidpp20::WirelessDeviceStatus::statusBroadcastEvent(report);
+                    if (event.reconfNeeded)
+                        _device->requestWakeup();
                 });
     }
 }
 
 void DeviceStatus::setProfile(config::Profile&) {
 }
+
+DeviceFeature::ProfileDiff DeviceStatus::compareProfiles(const config::Profile&,
+                                                         const config::Profile&) const {
+    return Unchanged;
+}
@@ -32,12 +32,18 @@ namespace logid::features {
 
         void setProfile(config::Profile& profile) final;
 
+        [[nodiscard]] ProfileDiff compareProfiles(const config::Profile& from,
+                                                  const config::Profile& to) const final;
+
+        [[nodiscard]] static bool supported(Device* dev);
+
     protected:
-        explicit DeviceStatus(Device* dev);
+        DeviceStatus(Device* dev, config::Profile& profile);
 
     private:
-        EventHandlerLock<backend::hidpp::Device> _ev_handler;
         std::shared_ptr<backend::hidpp20::WirelessDeviceStatus> _wireless_device_status;
+
+        EventHandlerLock<backend::hidpp::Device> _ev_handler;
     };
 }
 
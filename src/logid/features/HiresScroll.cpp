@@ -16,6 +16,7 @@
  *
  */
 #include <features/HiresScroll.h>
+#include <backend/raw/RawDevice.h>
 #include <actions/gesture/AxisGesture.h>
 #include <Device.h>
 #include <InputDevice.h>
@@ -25,13 +26,17 @@ using namespace logid;
 using namespace logid::features;
 using namespace logid::backend;
 
-HiresScroll::HiresScroll(Device* dev) :
+bool HiresScroll::supported(Device* dev) {
+    return dev->hidpp20().featureSupported(hidpp20::HiresScroll::ID);
+}
+
+HiresScroll::HiresScroll(Device* dev, config::Profile& profile) :
         DeviceFeature(dev),
-        _config(dev->activeProfile().hiresscroll), _mode(0),
+        _config(profile.hiresscroll), _mode(0),
         _mask(0),
-        _node(dev->ipcNode()->make_child("hires_scroll")),
-        _up_node(_node->make_child("up")),
-        _down_node(_node->make_child("down")) {
+        _node(std::make_shared<lazy_node>(dev->ipcNode(), "hires_scroll")),
+        _up_node(std::make_shared<lazy_node>(_node, "up")),
+        _down_node(std::make_shared<lazy_node>(_node, "down")) {
 
     try {
         _hires_scroll = std::make_shared<hidpp20::HiresScroll>(&dev->hidpp20());
@@ -41,8 +46,6 @@ HiresScroll::HiresScroll(Device* dev) :
 
     _makeConfig();
 
-    _last_scroll = std::chrono::system_clock::now();
-
     _ipc_interface = dev->ipcNode()->make_interface<IPC>(this);
 }
 
@@ -50,6 +53,7 @@ void HiresScroll::_makeConfig() {
     auto& config = _config.get();
     _mode = 0;
     _mask = 0;
+    _session_gap = std::chrono::milliseconds(defaults::hires_session_gap);
 
     if (config.has_value()) {
         if (std::holds_alternative<bool>(config.value())) {
@@ -79,34 +83,33 @@ void HiresScroll::_makeConfig() {
 
         _makeGesture(_up_gesture, conf.up, "up");
         _makeGesture(_down_gesture, conf.down, "down");
+
+        if (conf.session_gap.has_value())
+            _session_gap = std::chrono::milliseconds(std::max(conf.session_gap.value(), 0));
     }
 }
 
 void HiresScroll::configure() {
     std::shared_lock lock(_config_mutex);
+    // The device may have come back in a different mode
+    _forgetMode();
     _configure();
 }
 
 void HiresScroll::_configure() {
-    auto mode = _hires_scroll->getMode();
+    auto mode = getMode();
     mode &= ~_mask;
     mode |= (_mode & _mask);
-    _hires_scroll->setMode(mode);
+    setMode(mode);
 }
 
 void HiresScroll::listen() {
     std::shared_lock lock(_config_mutex);
     if (_ev_handler.empty()) {
-        _ev_handler = _device->hidpp20().addEventHandler(
-                {[index = _hires_scroll->featureIndex()](
-                        const hidpp::Report& report) -> bool {
-                    return (report.feature() == index) &&
-                           (report.function() == hidpp20::HiresScroll::WheelMovement);
-                },
-                 [self_weak = self<HiresScroll>()](const hidpp::Report& report) {
-                     if (auto self = self_weak.lock())
-                         self->_handleScroll(self->_hires_scroll->wheelMovementEvent(report));
-                 }
+        _ev_handler = _device->hidpp20().addEventRoute(
+                _hires_scroll->featureIndex(), hidpp20::HiresScroll::WheelMovement,
+                [this](hidpp::ReportView report) {
+                    _handleScroll(_hires_scroll->wheelMovementEvent(report));
                 });
     }
 }
@@ -120,20 +123,72 @@ void HiresScroll::setProfile(config::Profile& profile) {
     _makeConfig();
 }
 
+DeviceFeature::ProfileDiff HiresScroll::compareProfiles(const config::Profile& from,
+                                                        const config::Profile& to) const {
+    auto diff = compareSection(from.hiresscroll, to.hiresscroll);
+    if (diff != Changed || !from.hiresscroll.has_value())
+        return diff;
+
+    // Both were made into config::HiresScroll by _makeConfig
+    auto old_conf = std::get_if<config::HiresScroll>(&from.hiresscroll.value());
+    auto new_conf = std::get_if<config::HiresScroll>(&to.hiresscroll.value());
+    if (!old_conf || !new_conf)
+        return NeedsReset;
+
+    // Mode bits left out of the new mask keep their old value
+    if ((old_conf->hires && !new_conf->hires) || (old_conf->invert && !new_conf->invert) ||
+        (old_conf->target && !new_conf->target))
+        return NeedsReset;
+    return Changed;
+}
+
+std::map<std::string, std::string> HiresScroll::cachedState() {
+    std::lock_guard lock(_device_mode_mutex);
+    if (!_device_mode)
+        return {};
+    return {{"mode", std::to_string(_device_mode.value())}};
+}
+
 uint8_t HiresScroll::getMode() {
-    return _hires_scroll->getMode();
+    {
+        std::lock_guard lock(_device_mode_mutex);
+        if (_device_mode)
+            return _device_mode.value();
+    }
+
+    return refreshMode();
+}
+
+uint8_t HiresScroll::refreshMode() {
+    auto mode = _hires_scroll->getMode();
+    std::lock_guard lock(_device_mode_mutex);
+    _device_mode = mode;
+    return mode;
 }
 
 void HiresScroll::setMode(uint8_t mode) {
-    _hires_scroll->setMode(mode);
+    try {
+        _hires_scroll->setMode(mode);
+    } catch (...) {
+        _forgetMode();
+        throw;
+    }
+
+    std::lock_guard lock(_device_mode_mutex);
+    _device_mode = mode;
+}
+
+void HiresScroll::_forgetMode() {
+    std::lock_guard lock(_device_mode_mutex);
+    _device_mode.reset();
 }
 
 void HiresScroll::_makeGesture(std::shared_ptr<actions::Gesture>& gesture,
                                std::optional<config::Gesture>& config,
                                const std::string& direction) {
     if (config.has_value()) {
-        gesture = actions::Gesture::makeGesture(_device, config.value(),
-                                                _node->make_child(direction));
+        auto& node = direction == "up" ? _up_node : _down_node;
+        gesture = actions::Gesture::makeGesture(_device, config.value(), node->get());
 
         _fixGesture(gesture);
     } else {
@@ -152,9 +207,24 @@ void HiresScroll::_fixGesture(const std::shared_ptr<actions::Gesture>& gesture)
 }
 
 void HiresScroll::_handleScroll(hidpp20::HiresScroll::WheelStatus event) {
+    _device->recordEvent(EventStream::Scroll, event.hiRes, 0, event.deltaV);
     std::shared_lock lock(_config_mutex);
-    auto now = std::chrono::system_clock::now();
-    if (std::chrono::duration_cast<std::chrono::seconds>(now - _last_scroll).count() >= 1) {
+    auto now = backend::raw::RawDevice::readTime().value_or(
+            std::chrono::steady_clock::now());
+    bool in_session = _last_scroll && now - _last_scroll.value() < _session_gap;
+    _last_scroll = now;
+
+    int16_t direction = event.deltaV > 0 ? 1 : (event.deltaV < 0 ? -1 : 0);
+    auto& gesture = direction > 0 ? _up_gesture : _down_gesture;
+
+    // Scrolling on in the same direction
+    if (in_session && direction == _last_direction) {
+        if (direction && gesture)
+            gesture->move((int16_t) (direction * event.deltaV));
+        return;
+    }
+
+    if (!in_session) {
         if (_up_gesture) {
             _up_gesture->release(false);
             _up_gesture->press(true);
@@ -163,38 +233,30 @@ void HiresScroll::_handleScroll(hidpp20::HiresScroll::WheelStatus event) {
             _down_gesture->release(false);
             _down_gesture->press(true);
         }
-
         _last_direction = 0;
     }
 
-    if (event.deltaV > 0) {
-        if (_last_direction == -1) {
-            if (_down_gesture) {
-                _down_gesture->release(false);
-                _down_gesture->press(true);
-            }
-        }
-        if (_up_gesture)
-            _up_gesture->move(event.deltaV);
-        _last_direction = 1;
-    } else if (event.deltaV < 0) {
-        if (_last_direction == 1) {
-            if (_up_gesture) {
-                _up_gesture->release(false);
-                _up_gesture->press(true);
-            }
+    if (!direction)
+        return;
+
+    // The direction left behind starts over when scrolled again
+    if (_last_direction == -direction) {
+        if (auto& previous = direction > 0 ? _down_gesture : _up_gesture) {
+            previous->release(false);
+            previous->press(true);
         }
-        if (_down_gesture)
-            _down_gesture->move((int16_t) -event.deltaV);
-        _last_direction = -1;
     }
 
-    _last_scroll = now;
+    if (gesture)
+        gesture->move((int16_t) (direction * event.deltaV));
+    _last_direction = direction;
 }
 
 HiresScroll::IPC::IPC(HiresScroll* parent) : ipcgull::interface(
         SERVICE_ROOT_NAME ".HiresScroll", {
                 {"GetConfig", {this, &IPC::getConfig, {"hires", "invert", "target"}}},
+                {"GetMode",   {this, &IPC::getMode,   {"mode"}}},
+                {"Refresh",   {this, &IPC::refresh,   {"mode"}}},
                 {"SetHires",  {this, &IPC::setHires,  {"hires"}}},
                 {"SetInvert", {this, &IPC::setInvert, {"invert"}}},
                 {"SetTarget", {this, &IPC::setTarget, {"target"}}},
@@ -224,6 +286,15 @@ std::tuple<bool, bool, bool> HiresScroll::IPC::getConfig() const {
     }
 }
 
+uint8_t HiresScroll::IPC::getMode() const {
+    return _parent.getMode();
+}
+
+uint8_t HiresScroll::IPC::refresh() {
+    // A sleeping device would only time out, the last mode read stands
+    return _parent._device->awake() ? _parent.refreshMode() : _parent.getMode();
+}
+
 config::HiresScroll& HiresScroll::IPC::_parentConfig() {
     auto& config = _parent._config.get();
     if (!config.has_value()) {
@@ -238,6 +309,15 @@ config::HiresScroll& HiresScroll::IPC::_parentConfig() {
     return std::get<config::HiresScroll>(config.value());
 }
 
+void HiresScroll::IPC::_postConfigure() {
+    _parent._device->postWrite("hiresscroll", [self_weak = _parent.self<HiresScroll>()]() {
+        if (auto self = self_weak.lock()) {
+            std::shared_lock lock(self->_config_mutex);
+            self->_configure();
+        }
+    });
+}
+
 void HiresScroll::IPC::setHires(bool hires) {
     std::unique_lock lock(_parent._config_mutex);
     _parentConfig().hires = hires;
@@ -248,7 +328,7 @@ void HiresScroll::IPC::setHires(bool hires) {
     else
         _parent._mode &= ~hidpp20::HiresScroll::Mode::HiRes;
 
-    _parent._configure();
+    _postConfigure();
 }
 
 void HiresScroll::IPC::setInvert(bool invert) {
@@ -261,7 +341,7 @@ void HiresScroll::IPC::setInvert(bool invert) {
     else
         _parent._mode &= ~hidpp20::HiresScroll::Mode::Inverted;
 
-    _parent._configure();
+    _postConfigure();
 }
 
 void HiresScroll::IPC::setTarget(bool target) {
@@ -274,7 +354,7 @@ void HiresScroll::IPC::setTarget(bool target) {
     else
         _parent._mode &= ~hidpp20::HiresScroll::Mode::Target;
 
-    _parent._configure();
+    _postConfigure();
 }
 
 void HiresScroll::IPC::setUp(const std::string& type) {
@@ -286,9 +366,9 @@ void HiresScroll::IPC::setUp(const std::string& type) {
         config.up = config::NoGesture();
     }
     _parent._up_gesture = actions::Gesture::makeGesture(
-            _parent._device, type, config.up.value(), _parent._up_node);
+            _parent._device, type, config.up.value(), _parent._up_node->get());
     if (!_parent._up_gesture->wheelCompatibility()) {
-        _parent._up_node.reset();
+        _parent._up_gesture.reset();
         config.up.reset();
 
         throw std::invalid_argument("incompatible gesture");
@@ -306,9 +386,9 @@ void HiresScroll::IPC::setDown(const std::string& type) {
         config.down = config::NoGesture();
     }
     _parent._down_gesture = actions::Gesture::makeGesture(
-            _parent._device, type, config.down.value(), _parent._down_node);
+            _parent._device, type, config.down.value(), _parent._down_node->get());
     if (!_parent._down_gesture->wheelCompatibility()) {
-        _parent._down_node.reset();
+        _parent._down_gesture.reset();
         config.down.reset();
 
         throw std::invalid_argument("incompatible gesture");
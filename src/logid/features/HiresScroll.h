@@ -22,7 +22,9 @@
 #include <actions/gesture/Gesture.h>
 #include <backend/hidpp20/features/HiresScroll.h>
 #include <backend/hidpp/Device.h>
+#include <util/lazy_node.h>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <variant>
 #include <chrono>
@@ -36,18 +38,27 @@ namespace logid::features {
 
         void setProfile(config::Profile& profile) final;
 
+        [[nodiscard]] std::map<std::string, std::string> cachedState() final;
+
+        [[nodiscard]] ProfileDiff compareProfiles(const config::Profile& from,
+                                                  const config::Profile& to) const final;
+
+        // Served from the last mode read or written
         [[nodiscard]] uint8_t getMode();
 
+        // Reads the mode from the device and replaces the cached one
+        uint8_t refreshMode();
+
         void setMode(uint8_t mode);
 
+        [[nodiscard]] static bool supported(Device* dev);
+
     protected:
-        explicit HiresScroll(Device* dev);
+        HiresScroll(Device* dev, config::Profile& profile);
 
     private:
         void _makeConfig();
 
-        EventHandlerLock<backend::hidpp::Device> _ev_handler;
-
         void _makeGesture(std::shared_ptr<actions::Gesture>& gesture,
                           std::optional<config::Gesture>& config,
                           const std::string& direction);
@@ -64,6 +75,10 @@ namespace logid::features {
 
             [[nodiscard]] std::tuple<bool, bool, bool> getConfig() const;
 
+            [[nodiscard]] uint8_t getMode() const;
+
+            uint8_t refresh();
+
             void setHires(bool hires);
 
             void setInvert(bool invert);
@@ -77,27 +92,38 @@ namespace logid::features {
         private:
             config::HiresScroll& _parentConfig();
 
+            void _postConfigure();
+
             HiresScroll& _parent;
         };
 
         std::shared_ptr<backend::hidpp20::HiresScroll> _hires_scroll;
-        std::chrono::time_point<std::chrono::system_clock> _last_scroll;
+        // Only touched by _handleScroll
+        std::optional<std::chrono::steady_clock::time_point> _last_scroll;
         int16_t _last_direction = 0;
+        std::chrono::milliseconds _session_gap;
 
-        mutable std::shared_mutex _config_mutex;
+        mutable config::edit_mutex _config_mutex;
         std::reference_wrapper<std::optional<std::variant<bool, config::HiresScroll>>> _config;
 
         uint8_t _mode;
         uint8_t _mask;
 
+        void _forgetMode();
+
+        std::mutex _device_mode_mutex;
+        std::optional<uint8_t> _device_mode;
+
         std::shared_ptr<actions::Gesture> _up_gesture;
         std::shared_ptr<actions::Gesture> _down_gesture;
 
-        std::shared_ptr<ipcgull::node> _node;
-        std::shared_ptr<ipcgull::node> _up_node;
-        std::shared_ptr<ipcgull::node> _down_node;
+        std::shared_ptr<lazy_node> _node;
+        std::shared_ptr<lazy_node> _up_node;
+        std::shared_ptr<lazy_node> _down_node;
 
         std::shared_ptr<IPC> _ipc_interface;
+
+        EventHandlerLock<backend::hidpp::Device> _ev_handler;
     };
 }
 
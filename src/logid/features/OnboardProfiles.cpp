@@ -0,0 +1,360 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <features/OnboardProfiles.h>
+#include <Device.h>
+#include <InputDevice.h>
+#include <util/log.h>
+#include <algorithm>
+#include <array>
+#include <linux/input-event-codes.h>
+
+using namespace logid::features;
+using namespace logid::backend;
+
+namespace {
+    // Profile layout shared by formats 1 to 5
+    constexpr std::size_t default_dpi_offset = 1;
+    constexpr std::size_t dpi_offset = 3;
+    constexpr std::size_t buttons_offset = 32;
+    constexpr std::size_t binding_size = 4;
+    constexpr std::size_t max_profile_buttons = 16;
+    constexpr uint8_t max_profile_format = 5;
+
+    constexpr uint8_t binding_hid = 0x80;
+    constexpr uint8_t binding_mouse = 0x01;
+    constexpr uint8_t binding_keyboard = 0x02;
+
+    // Standard mouse buttons by profile slot, i.e. HID button order
+    constexpr std::array<uint16_t, 5> mouse_button_cids = {
+            0x0050, // Left
+            0x0051, // Right
+            0x0052, // Middle
+            0x0053, // Back
+            0x0056, // Forward
+    };
+
+    // Linux key codes of HID keyboard page usages, starting at usage 0x04
+    constexpr uint8_t first_usage = 0x04;
+    constexpr std::array<uint8_t, 98> usage_keys = {
+            30, 48, 46, 32, 18, 33, 34, 35, 23, 36, 37, 38,
+            50, 49, 24, 25, 16, 19, 31, 20, 22, 47, 17, 45, 21, 44, 2, 3,
+            4, 5, 6, 7, 8, 9, 10, 11, 28, 1, 14, 15, 57, 12, 13, 26,
+            27, 43, 43, 39, 40, 41, 51, 52, 53, 58, 59, 60, 61, 62, 63, 64,
+            65, 66, 67, 68, 87, 88, 99, 70, 119, 110, 102, 104, 111, 107, 109, 106,
+            105, 108, 103, 69, 98, 55, 74, 78, 96, 79, 80, 81, 75, 76, 77, 71,
+            72, 73, 82, 83, 86, 127
+    };
+
+    // By bit of the HID modifier byte
+    constexpr std::array<uint, 8> modifier_keys = {
+            KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_LEFTALT, KEY_LEFTMETA,
+            KEY_RIGHTCTRL, KEY_RIGHTSHIFT, KEY_RIGHTALT, KEY_RIGHTMETA
+    };
+
+    std::optional<uint> keyCode(const std::variant<uint, std::string>& key) {
+        if (std::holds_alternative<uint>(key))
+            return std::get<uint>(key);
+        try {
+            return logid::InputDevice::toKeyCode(std::get<std::string>(key));
+        } catch (logid::InputDevice::InvalidEventCode& e) {
+            return {};
+        }
+    }
+}
+
+bool OnboardProfiles::supported(Device* dev) {
+    return dev->hidpp20().featureSupported(hidpp20::OnboardProfiles::ID);
+}
+
+OnboardProfiles::OnboardProfiles(Device* dev, config::Profile& profile) :
+        DeviceFeature(dev), _profile(profile) {
+    try {
+        _onboard_profiles = std::make_shared<hidpp20::OnboardProfiles>(&dev->hidpp20());
+    } catch (hidpp20::UnsupportedFeature& e) {
+        throw UnsupportedFeature();
+    }
+
+    _info = _onboard_profiles->getInfo();
+    if (!_usable(_info)) {
+        logPrintf(DEBUG, "%s:%d: unknown onboard profile format %d (memory model %d)",
+                  dev->hidpp20().devicePath().c_str(), dev->hidpp20().deviceIndex(),
+                  _info.profileFormat, _info.memoryModel);
+        throw UnsupportedFeature();
+    }
+}
+
+bool OnboardProfiles::_usable(const hidpp20::OnboardProfiles::Info& info) {
+    return info.memoryModel == 1 && info.profileFormat >= 1 &&
+           info.profileFormat <= max_profile_format &&
+           info.sectorSize >= buttons_offset + binding_size * mouse_button_cids.size() + 2;
+}
+
+void OnboardProfiles::configure() {
+    std::shared_lock lock(_config_mutex);
+    const auto& profile = _profile.get();
+    _active = false;
+
+    try {
+        if (!profile.onboard.has_value()) {
+            _leaveOnboard();
+            return;
+        }
+
+        const auto& config = profile.onboard.value();
+        const int number = config.profile.value_or(defaults::onboard_profile);
+        if (number < 1 || number > _info.profileCount) {
+            logPrintf(WARN, "%s:%d: no onboard profile %d, the device has %d",
+                      _device->hidpp20().devicePath().c_str(),
+                      _device->hidpp20().deviceIndex(), number, _info.profileCount);
+            _leaveOnboard();
+            return;
+        }
+
+        auto sector = _profileSector(number);
+        if (!sector) {
+            logPrintf(WARN, "%s:%d: onboard profile %d is not set up",
+                      _device->hidpp20().devicePath().c_str(),
+                      _device->hidpp20().deviceIndex(), number);
+            _leaveOnboard();
+            return;
+        }
+
+        auto data = _onboard_profiles->readSector(sector.value(), _info.sectorSize);
+        if (!hidpp20::OnboardProfiles::checkCRC(data)) {
+            logPrintf(WARN, "%s:%d: onboard profile %d is corrupt, leaving it alone",
+                      _device->hidpp20().devicePath().c_str(),
+                      _device->hidpp20().deviceIndex(), number);
+            _leaveOnboard();
+            return;
+        }
+
+        auto patched = data;
+        if (config.dpi.value_or(true) && profile.dpi.has_value())
+            _patchDPI(patched, profile.dpi.value());
+        if (config.buttons.value_or(true))
+            _patchButtons(patched, profile);
+        hidpp20::OnboardProfiles::updateCRC(patched);
+
+        // Flash wears, only write what changed
+        if (patched != data) {
+            /* The profile would not hold the bindings, the buttons stay
+             * diverted and the device in host mode */
+            if (sector.value() >= hidpp20::OnboardProfiles::rom_sector) {
+                logPrintf(WARN, "%s:%d: onboard profile %d is read-only",
+                          _device->hidpp20().devicePath().c_str(),
+                          _device->hidpp20().deviceIndex(), number);
+                _leaveOnboard();
+                return;
+            }
+
+            _onboard_profiles->writeSector(sector.value(), patched);
+            logPrintf(DEBUG, "%s:%d: wrote onboard profile %d",
+                      _device->hidpp20().devicePath().c_str(),
+                      _device->hidpp20().deviceIndex(), number);
+        }
+
+        if (_onboard_profiles->getMode() != hidpp20::OnboardProfiles::Onboard) {
+            _onboard_profiles->setMode(hidpp20::OnboardProfiles::Onboard);
+            _switched = true;
+        }
+        if (_onboard_profiles->getCurrentProfile() != number)
+            _onboard_profiles->setCurrentProfile(number);
+        _active = true;
+    } catch (std::exception& e) {
+        logPrintf(WARN, "%s:%d: failed to set up onboard profile: %s",
+                  _device->hidpp20().devicePath().c_str(),
+                  _device->hidpp20().deviceIndex(), e.what());
+        try {
+            _leaveOnboard();
+        } catch (std::exception& e2) {
+        }
+    }
+}
+
+void OnboardProfiles::_leaveOnboard() {
+    if (_switched) {
+        _onboard_profiles->setMode(hidpp20::OnboardProfiles::Host);
+        _switched = false;
+    }
+}
+
+bool OnboardProfiles::active() const {
+    return _active;
+}
+
+void OnboardProfiles::listen() {
+}
+
+void OnboardProfiles::setProfile(config::Profile& profile) {
+    std::unique_lock lock(_config_mutex);
+    _profile = profile;
+}
+
+DeviceFeature::ProfileDiff OnboardProfiles::compareProfiles(const config::Profile& from,
+                                                            const config::Profile& to) const {
+    // configure() also restores host mode when onboard is dropped
+    if (!config::equal(from.onboard, to.onboard))
+        return Changed;
+    if (!to.onboard.has_value())
+        return Unchanged;
+    if (!config::equal(from.dpi, to.dpi) || !config::equal(from.buttons, to.buttons))
+        return Changed;
+    return Unchanged;
+}
+
+std::optional<uint16_t> OnboardProfiles::_profileSector(uint16_t profile) {
+    auto directory = _onboard_profiles->readSector(
+            hidpp20::OnboardProfiles::directory_sector, _info.sectorSize);
+
+    // Never written, the device runs on its ROM profiles
+    if (!hidpp20::OnboardProfiles::checkCRC(directory))
+        return hidpp20::OnboardProfiles::rom_sector + profile - 1;
+
+    // Entries are an address, an enabled flag and a reserved byte
+    for (std::size_t i = 0, n = 1; i + 4 <= directory.size() - 2; i += 4, ++n) {
+        auto address = (uint16_t) (directory[i] << 8 | directory[i + 1]);
+        if (address == 0xffff)
+            break;
+        if (n == profile)
+            return address;
+    }
+
+    return {};
+}
+
+void OnboardProfiles::_patchDPI(std::vector<uint8_t>& sector, const config::DPI& dpi) const {
+    // The onboard table is for the first sensor
+    int value = 0;
+    if (std::holds_alternative<int>(dpi))
+        value = std::get<int>(dpi);
+    else if (!std::get<std::list<int>>(dpi).empty())
+        value = std::get<std::list<int>>(dpi).front();
+
+    if (value <= 0 || value > 0xffff)
+        return;
+
+    sector[default_dpi_offset] = 0;
+    sector[dpi_offset] = value & 0xff;
+    sector[dpi_offset + 1] = (value >> 8) & 0xff;
+}
+
+void OnboardProfiles::_patchButtons(std::vector<uint8_t>& sector,
+                                    const config::Profile& profile) const {
+    const std::size_t slots = std::min<std::size_t>(
+            {mouse_button_cids.size(), _info.buttonCount, max_profile_buttons});
+
+    /* Slots without a binding of ours go back to their mouse button, one
+     * bound by an earlier profile would stay otherwise */
+    for (std::size_t slot = 0; slot < slots; ++slot) {
+        std::optional<KeyBinding> binding;
+        if (profile.buttons.has_value()) {
+            auto it = profile.buttons->find(mouse_button_cids[slot]);
+            if (it != profile.buttons->end())
+                binding = keyBinding(it->second);
+        }
+
+        auto entry = sector.begin() + (std::ptrdiff_t) (buttons_offset + slot * binding_size);
+        entry[0] = binding_hid;
+        if (binding) {
+            entry[1] = binding_keyboard;
+            entry[2] = binding->modifiers;
+            entry[3] = binding->usage;
+        } else {
+            const uint16_t button = 1 << slot;
+            entry[1] = binding_mouse;
+            entry[2] = button >> 8;
+            entry[3] = button & 0xff;
+        }
+    }
+}
+
+std::optional<OnboardProfiles::KeyBinding> OnboardProfiles::keyBinding(
+        const config::Button& button) {
+    if (!button.action.has_value())
+        return {};
+
+    auto keypress = std::get_if<config::KeypressAction>(&button.action.value());
+    if (!keypress || !keypress->keys.has_value())
+        return {};
+
+    std::vector<std::variant<uint, std::string>> keys;
+    const auto& config = keypress->keys.value();
+    if (std::holds_alternative<std::string>(config))
+        keys.emplace_back(std::get<std::string>(config));
+    else if (std::holds_alternative<uint>(config))
+        keys.emplace_back(std::get<uint>(config));
+    else
+        for (const auto& key: std::get<std::list<std::variant<uint, std::string>>>(config))
+            keys.push_back(key);
+
+    KeyBinding binding{};
+    for (const auto& key: keys) {
+        auto code = keyCode(key);
+        if (!code)
+            return {};
+
+        auto modifier = std::find(modifier_keys.begin(), modifier_keys.end(), code.value());
+        if (modifier != modifier_keys.end()) {
+            binding.modifiers |= 1 << (modifier - modifier_keys.begin());
+            continue;
+        }
+
+        auto usage = std::find(usage_keys.begin(), usage_keys.end(), code.value());
+        // Only one key fits in the binding
+        if (usage == usage_keys.end() || binding.usage != 0)
+            return {};
+        binding.usage = first_usage + (usage - usage_keys.begin());
+    }
+
+    if (binding.usage == 0)
+        return {};
+    return binding;
+}
+
+std::optional<uint8_t> OnboardProfiles::slotOf(uint16_t cid) {
+    auto it = std::find(mouse_button_cids.begin(), mouse_button_cids.end(), cid);
+    if (it == mouse_button_cids.end())
+        return {};
+    return it - mouse_button_cids.begin();
+}
+
+std::set<uint16_t> OnboardProfiles::offloadedButtons(Device* dev,
+                                                     const config::Profile& profile) {
+    std::set<uint16_t> cids;
+    if (!supported(dev) || !profile.onboard.has_value() ||
+        !profile.onboard->buttons.value_or(true) || !profile.buttons.has_value())
+        return cids;
+
+    hidpp20::OnboardProfiles::Info info{};
+    try {
+        info = hidpp20::OnboardProfiles(&dev->hidpp20()).getInfo();
+    } catch (std::exception& e) {
+        return cids;
+    }
+
+    if (!_usable(info))
+        return cids;
+
+    for (const auto& button: profile.buttons.value()) {
+        auto slot = slotOf(button.first);
+        if (slot && slot.value() < info.buttonCount && keyBinding(button.second))
+            cids.insert(button.first);
+    }
+
+    return cids;
+}
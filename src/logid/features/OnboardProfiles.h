@@ -0,0 +1,96 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_FEATURE_ONBOARDPROFILES_H
+#define LOGID_FEATURE_ONBOARDPROFILES_H
+
+#include <features/DeviceFeature.h>
+#include <backend/hidpp20/features/OnboardProfiles.h>
+#include <config/schema.h>
+#include <atomic>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+
+namespace logid::features {
+    /* Writes what the profile's firmware can do without the host into the
+     * active onboard profile, currently the DPI and keys bound to the
+     * standard mouse buttons. Those buttons are then left undiverted. */
+    class OnboardProfiles : public DeviceFeature {
+    public:
+        void configure() final;
+
+        void listen() final;
+
+        void setProfile(config::Profile& profile) final;
+
+        [[nodiscard]] ProfileDiff compareProfiles(const config::Profile& from,
+                                                  const config::Profile& to) const final;
+
+        // A HID keyboard binding, usage is a key from the keyboard page
+        struct KeyBinding {
+            uint8_t modifiers;
+            uint8_t usage;
+        };
+
+        /* Set for a keypress of one key and any modifiers, which a profile
+         * button can send by itself */
+        [[nodiscard]] static std::optional<KeyBinding> keyBinding(const config::Button& button);
+
+        // Profile button slot of a standard mouse button
+        [[nodiscard]] static std::optional<uint8_t> slotOf(uint16_t cid);
+
+        /* CIDs of the buttons profile leaves to the device's firmware, empty
+         * unless the device supports onboard profiles and profile uses them */
+        [[nodiscard]] static std::set<uint16_t> offloadedButtons(
+                Device* dev, const config::Profile& profile);
+
+        [[nodiscard]] static bool supported(Device* dev);
+
+        /* Whether the last configure set up the onboard profile and left
+         * the device in onboard mode. Buttons are only left to it then. */
+        [[nodiscard]] bool active() const;
+
+    protected:
+        OnboardProfiles(Device* dev, config::Profile& profile);
+
+    private:
+        // Back to host mode if onboard mode was turned on by us
+        void _leaveOnboard();
+
+        // Sector holding onboard profile number profile, empty if there is none
+        std::optional<uint16_t> _profileSector(uint16_t profile);
+
+        void _patchDPI(std::vector<uint8_t>& sector, const config::DPI& dpi) const;
+
+        void _patchButtons(std::vector<uint8_t>& sector, const config::Profile& profile) const;
+
+        [[nodiscard]] static bool _usable(const backend::hidpp20::OnboardProfiles::Info& info);
+
+        mutable config::edit_mutex _config_mutex;
+        std::reference_wrapper<config::Profile> _profile;
+
+        std::shared_ptr<backend::hidpp20::OnboardProfiles> _onboard_profiles;
+        backend::hidpp20::OnboardProfiles::Info _info{};
+
+        // Whether onboard mode was turned on by us, host mode is restored if so
+        bool _switched = false;
+        std::atomic_bool _active = false;
+    };
+}
+
+#endif //LOGID_FEATURE_ONBOARDPROFILES_H
@@ -16,9 +16,11 @@
  *
  */
 #include <features/RemapButton.h>
+#include <features/OnboardProfiles.h>
 #include <actions/GestureAction.h>
 #include <Device.h>
 #include <sstream>
+#include <cctype>
 #include <util/log.h>
 #include <ipc_defs.h>
 
@@ -34,9 +36,18 @@ static constexpr auto hidpp20_reprog_rebind =
         (hidpp20::ReprogControls::ChangeTemporaryDivert |
          hidpp20::ReprogControls::ChangeRawXYDivert);
 
-RemapButton::RemapButton(Device* dev) : DeviceFeature(dev),
-                                        _config(dev->activeProfile().buttons),
-                                        _ipc_node(dev->ipcNode()->make_child("buttons")) {
+bool RemapButton::supported(Device* dev) {
+    auto& device = dev->hidpp20();
+    return device.featureSupported(hidpp20::ReprogControlsV4::ID) ||
+           device.featureSupported(hidpp20::ReprogControlsV3::ID) ||
+           device.featureSupported(hidpp20::ReprogControlsV2_2::ID) ||
+           device.featureSupported(hidpp20::ReprogControlsV2::ID) ||
+           device.featureSupported(hidpp20::ReprogControls::ID);
+}
+
+RemapButton::RemapButton(Device* dev, config::Profile& profile) :
+        DeviceFeature(dev), _config(profile.buttons),
+        _ipc_node(dev->ipcNode()->make_child("buttons")) {
     try {
         _reprog_controls = hidpp20::ReprogControls::autoVersion(
                 &dev->hidpp20());
@@ -51,15 +62,25 @@ RemapButton::RemapButton(Device* dev) : DeviceFeature(dev),
     if (!config.has_value())
         config = config::RemapButton();
 
+    _ordinals.reserve(_reprog_controls->getControls().size());
+    // Whatever ran before may have left any control diverted
+    _diverted.set();
+
     for (const auto& control: _reprog_controls->getControls()) {
         const auto i = _buttons.size();
-        Button::ConfigFunction func = [this, info = control.second](
+        Button::ConfigFunction func = [this, i, info = control.second](
                 const std::shared_ptr<actions::Action>& action) {
             hidpp20::ReprogControls::ControlInfo report{};
             report.controlID = info.controlID;
             report.flags = hidpp20_reprog_rebind;
 
-            if (action) {
+            bool offloaded = false;
+            if (i < max_buttons) {
+                std::lock_guard lock(_report_lock);
+                offloaded = _offloaded[i];
+            }
+
+            if (action && !offloaded) {
                 if ((action->reprogFlags() & hidpp20::ReprogControls::RawXYDiverted) &&
                     (!_reprog_controls->supportsRawXY() ||
                      !(info.additionalFlags & hidpp20::ReprogControls::RawXY)))
@@ -68,14 +89,36 @@ RemapButton::RemapButton(Device* dev) : DeviceFeature(dev),
 
                 report.flags |= action->reprogFlags();
             }
+
+            bool diverting = report.flags & ~hidpp20_reprog_rebind;
+            if (i < max_buttons) {
+                /* A control left undiverted stays that way, the device also
+                 * drops diversions on its own when it resets */
+                std::lock_guard lock(_report_lock);
+                if (!diverting && !_diverted[i])
+                    return;
+            }
             _reprog_controls->setControlReporting(info.controlID, report);
+            // A write that threw is made again next time
+            if (i < max_buttons) {
+                std::lock_guard lock(_report_lock);
+                _diverted[i] = diverting;
+            }
         };
-        _buttons.emplace(control.second.controlID,
-                         Button::make(control.second, (int) i,
-                                      _device, func, _ipc_node,
-                                      config.value()[control.first]));
+        auto button = Button::make(control.second, (int) i,
+                                   _device, func, _ipc_node,
+                                   config.value()[control.first]);
+        _buttons.emplace(control.second.controlID, button);
+        if (i < max_buttons) {
+            _ordinals.emplace(control.second.controlID, i);
+            _ordered.push_back(std::move(button));
+            if (control.second.additionalFlags & hidpp20::ReprogControls::RawXY)
+                _raw_xy_mask.set(i);
+        }
     }
 
+    _offloadable = _offloadedMask(profile);
+
     _ipc_interface = _device->ipcNode()->make_interface<IPC>(this);
 
     if (global_loglevel <= DEBUG) {
@@ -93,47 +136,41 @@ RemapButton::RemapButton(Device* dev) : DeviceFeature(dev),
 }
 
 void RemapButton::configure() {
+    /* Left to the onboard profile only if it was set up, which it is
+     * before this is configured */
+    {
+        auto onboard = _device->getFeature<OnboardProfiles>("onboard");
+        std::lock_guard lock(_report_lock);
+        _offloaded = onboard && onboard->active() ? _offloadable : button_mask();
+    }
+
     for (const auto& button: _buttons)
         button.second->configure();
 }
 
 void RemapButton::listen() {
     if (_ev_handler.empty()) {
-        _ev_handler = _device->hidpp20().addEventHandler(
-                {[index = _reprog_controls->featureIndex()](
-                        const hidpp::Report& report) -> bool {
-                    if (report.feature() == index) {
-                        switch (report.function()) {
-                            case hidpp20::ReprogControls::DivertedButtonEvent:
-                            case hidpp20::ReprogControls::DivertedRawXYEvent:
-                                return true;
-                            default:
-                                return false;
-                        }
-                    }
-                    return false;
-                },
-                 [self_weak = self<RemapButton>()](const hidpp::Report& report) -> void {
-                    auto self = self_weak.lock();
-                    if (!self)
+        _ev_handler = _device->hidpp20().addEventRoute(
+                _reprog_controls->featureIndex(),
+                hidpp20::ReprogControls::DivertedButtonEvent,
+                [this](hidpp::ReportView report) -> void {
+                    _buttonEvent(_reprog_controls->divertedButtonEvent(report));
+                });
+    }
+
+    if (_raw_xy_handler.empty()) {
+        _raw_xy_handler = _device->hidpp20().addEventRoute(
+                _reprog_controls->featureIndex(),
+                hidpp20::ReprogControls::DivertedRawXYEvent,
+                [this](hidpp::ReportView report) -> void {
+                    auto moving = _moving.load(std::memory_order_acquire);
+                    if (!moving)
                         return;
 
-                     switch (report.function()) {
-                         case hidpp20::ReprogControls::DivertedButtonEvent:
-                             self->_buttonEvent(
-                                     self->_reprog_controls->divertedButtonEvent(report));
-                             break;
-                         case hidpp20::ReprogControls::DivertedRawXYEvent: {
-                             auto divertedXY = self->_reprog_controls->divertedRawXYEvent(report);
-                             for (const auto& button: self->_buttons)
-                                 if (button.second->pressed())
-                                     button.second->move(divertedXY.x, divertedXY.y);
-                             break;
-                         }
-                         default:
-                             break;
-                     }
-                 }
+                    auto divertedXY = _reprog_controls->divertedRawXYEvent(report);
+                    for (const auto& button: *moving)
+                        if (button->pressed())
+                            button->move(divertedXY.x, divertedXY.y);
                 });
     }
 }
@@ -146,34 +183,107 @@ void RemapButton::setProfile(config::Profile& profile) {
         _config.get().emplace();
     auto& config = _config.get().value();
 
+    {
+        auto offloadable = _offloadedMask(profile);
+        std::lock_guard report_lock(_report_lock);
+        _offloadable = offloadable;
+    }
+
+    auto name = _device->activeProfileName();
     for(auto& button : _buttons)
-        button.second->setProfile(config[button.first]);
+        button.second->setProfile(config[button.first], name);
 }
 
-void RemapButton::_buttonEvent(const std::set<uint16_t>& new_state) {
+DeviceFeature::ProfileDiff RemapButton::compareProfiles(const config::Profile& from,
+                                                        const config::Profile& to) const {
+    // Every control's reporting is written, unmapped ones are undiverted
+    if (!config::equal(from.buttons, to.buttons))
+        return Changed;
+    return _offloadedMask(from) == _offloadedMask(to) ? Unchanged : Changed;
+}
+
+RemapButton::button_mask RemapButton::_offloadedMask(const config::Profile& profile) const {
+    auto cids = OnboardProfiles::offloadedButtons(_device, profile);
+    return maskOf({cids.begin(), cids.end()});
+}
+
+void RemapButton::dropProfile(config::Profile& profile) {
+    std::lock_guard<std::mutex> lock(_button_lock);
+    if (!profile.buttons.has_value())
+        return;
+
+    auto& config = profile.buttons.value();
+    for (auto& button: _buttons) {
+        auto it = config.find(button.first);
+        if (it != config.end())
+            button.second->dropProfile(it->second);
+    }
+}
+
+RemapButton::button_mask RemapButton::maskOf(const std::vector<uint16_t>& cids) const {
+    button_mask mask;
+    for (auto cid: cids) {
+        auto it = _ordinals.find(cid);
+        if (it != _ordinals.end())
+            mask.set(it->second);
+    }
+    return mask;
+}
+
+bool RemapButton::held(const button_mask& mask) const {
+    button_mask state;
+    for (std::size_t w = 0; w < mask_words; ++w)
+        state |= button_mask(_held[w].load(std::memory_order_acquire)) << (64 * w);
+    return (state & mask) == mask;
+}
+
+void RemapButton::_buttonEvent(
+        const hidpp20::ReprogControls::DivertedButtons& new_state) {
     // Ensure I/O doesn't occur while updating button state
     std::lock_guard<std::mutex> lock(_button_lock);
 
-    // Press all added buttons
-    for (const auto& i: new_state) {
-        auto old_i = _pressed_buttons.find(i);
-        if (old_i != _pressed_buttons.end()) {
-            _pressed_buttons.erase(old_i);
-        } else {
-            auto action = _buttons.find(i);
-            if (action != _buttons.end())
-                action->second->press();
-        }
+    button_mask state;
+    for (auto cid: new_state) {
+        auto it = _ordinals.find(cid);
+        if (it != _ordinals.end())
+            state.set(it->second);
     }
 
-    // Release all removed buttons
-    for (auto& i: _pressed_buttons) {
-        auto action = _buttons.find(i);
-        if (action != _buttons.end())
-            action->second->release();
+    auto pressed = state & ~_pressed_mask;
+    auto released = _pressed_mask & ~state;
+    _pressed_mask = state;
+
+    // Published first, so a chord pressed together with its buttons matches
+    const button_mask word_mask(~uint64_t(0));
+    for (std::size_t w = 0; w < mask_words; ++w)
+        _held[w].store(((state >> (64 * w)) & word_mask).to_ullong(),
+                       std::memory_order_release);
+
+    // Only rebuilt when a raw XY capable control changes
+    if (((pressed | released) & _raw_xy_mask).any()) {
+        auto held_xy = state & _raw_xy_mask;
+        std::shared_ptr<const std::vector<std::shared_ptr<Button>>> moving;
+        if (held_xy.any()) {
+            auto list = std::make_shared<std::vector<std::shared_ptr<Button>>>();
+            for (std::size_t i = 0; i < _ordered.size(); ++i)
+                if (held_xy[i])
+                    list->push_back(_ordered[i]);
+            moving = std::move(list);
+        }
+        _moving.store(std::move(moving), std::memory_order_release);
     }
 
-    _pressed_buttons = new_state;
+    // Press all added buttons, then release all removed ones
+    if (pressed.any()) {
+        for (std::size_t i = 0; i < _ordered.size(); ++i)
+            if (pressed[i])
+                _ordered[i]->press();
+    }
+    if (released.any()) {
+        for (std::size_t i = 0; i < _ordered.size(); ++i)
+            if (released[i])
+                _ordered[i]->release();
+    }
 }
 
 namespace logid::features {
@@ -200,7 +310,7 @@ Button::Button(Info info, int index,
                Device* device, ConfigFunction conf_func,
                const std::shared_ptr<ipcgull::node>& root,
                config::Button& config) :
-        _node(root->make_child(std::to_string(index))),
+        _node(root->make_child(std::to_string(index))), _action_node(_node),
         _device(device), _conf_func(std::move(conf_func)),
         _config(config),
         _info(info) {
@@ -213,39 +323,43 @@ void Button::_makeConfig() {
     auto& config = _config.get();
     if (config.action.has_value()) {
         try {
-            _action = Action::makeAction(_device, config.action.value(), _node);
+            _setAction(Action::makeAction(_device, config.action.value(), _action_node));
         } catch (std::exception& e) {
             logPrintf(WARN, "Error creating button action: %s", e.what());
         }
     }
 }
 
+void Button::_setAction(std::shared_ptr<Action> action) {
+    _action = std::move(action);
+    _dispatch = ActionRef(_action.get());
+}
+
 void Button::press() {
+    _device->recordEvent(EventStream::ButtonPress, _info.controlID);
     std::shared_lock lock(_action_lock);
     _first_move = true;
-    if (_action)
-        _action->press();
+    _dispatch.press();
 }
 
 void Button::release() const {
+    _device->recordEvent(EventStream::ButtonRelease, _info.controlID);
     std::shared_lock lock(_action_lock);
-    if (_action)
-        _action->release();
+    _dispatch.release();
 }
 
 void Button::move(int16_t x, int16_t y) {
+    _device->recordEvent(EventStream::Move, _info.controlID, x, y);
     std::shared_lock lock(_action_lock);
-    if (_action && !_first_move)
-        _action->move(x, y);
-    else if (_first_move)
+    if (_first_move)
         _first_move = false;
+    else
+        _dispatch.move(x, y);
 }
 
 bool Button::pressed() const {
     std::shared_lock lock(_action_lock);
-    if (_action)
-        return _action->pressed();
-    return false;
+    return _dispatch.pressed();
 }
 
 void Button::configure() const {
@@ -253,13 +367,58 @@ void Button::configure() const {
     _conf_func(_action);
 }
 
-void Button::setProfile(config::Button& config) {
+namespace {
+    // Object path elements may only hold [A-Za-z0-9_]
+    std::string node_name(const std::string& profile) {
+        std::string ret = "profile_";
+        for (auto c: profile)
+            ret += std::isalnum((unsigned char) c) ? c : '_';
+        return ret;
+    }
+}
+
+void Button::setProfile(config::Button& config, const std::string& profile) {
     std::unique_lock lock(_action_lock);
+
+    // The profile was reset, its config was replaced in place
+    if (&config == &_config.get()) {
+        _setAction(nullptr);
+        _makeConfig();
+        return;
+    }
+
+    if (_dispatch.pressed())
+        _dispatch.release();
+    _pooled[&_config.get()] = {_action_node, std::move(_action)};
+    _setAction(nullptr);
+
     _config = config;
-    _action.reset();
+    auto pooled = _pooled.find(&config);
+    if (pooled != _pooled.end()) {
+        _action_node = std::move(pooled->second.node);
+        _setAction(std::move(pooled->second.action));
+        _pooled.erase(pooled);
+        return;
+    }
+
+    auto name = node_name(profile);
+    auto& node = _profile_nodes[name];
+    if (!node)
+        node = _node->make_child(name);
+    _action_node = node;
     _makeConfig();
 }
 
+void Button::dropProfile(config::Button& config) {
+    std::unique_lock lock(_action_lock);
+    if (&config == &_config.get()) {
+        // Rebuilt by the setProfile that follows
+        _setAction(nullptr);
+    } else {
+        _pooled.erase(&config);
+    }
+}
+
 std::shared_ptr<ipcgull::node> Button::node() const {
     return _node;
 }
@@ -293,12 +452,16 @@ void Button::IPC::setAction(const std::string& type) {
 
     {
         std::unique_lock lock(_button._action_lock);
-        _button._action.reset();
-        _button._action = Action::makeAction(
+        _button._setAction(nullptr);
+        _button._setAction(Action::makeAction(
                 _button._device, type,
-                _button._config.get().action, _button._node);
+                _button._config.get().action, _button._action_node));
     }
-    _button.configure();
+    _button._device->postWrite("button" + std::to_string(_button._info.controlID),
+                              [self_weak = _button._self]() {
+        if (auto self = self_weak.lock())
+            self->configure();
+    });
 }
 
 RemapButton::IPC::IPC(RemapButton* parent) :
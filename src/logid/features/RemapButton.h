@@ -19,9 +19,13 @@
 #define LOGID_FEATURE_REMAPBUTTON_H
 
 #include <features/DeviceFeature.h>
-#include <actions/Action.h>
+#include <actions/ActionRef.h>
 #include <backend/hidpp20/features/ReprogControls.h>
 #include <backend/hidpp/Device.h>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <unordered_map>
 
 namespace logid::features {
     class RemapButton;
@@ -42,7 +46,10 @@ namespace logid::features {
 
         void move(int16_t x, int16_t y);
 
-        void setProfile(config::Button& config);
+        // profile names the node actions of a new profile are created on
+        void setProfile(config::Button& config, const std::string& profile);
+
+        void dropProfile(config::Button& config);
 
         [[nodiscard]] std::shared_ptr<ipcgull::node> node() const;
 
@@ -55,6 +62,9 @@ namespace logid::features {
 
         void _makeConfig();
 
+        // Requires a unique lock on _action_lock, or the constructor
+        void _setAction(std::shared_ptr<actions::Action> action);
+
         Button(Info info, int index,
                Device* device, ConfigFunction conf_func,
                const std::shared_ptr<ipcgull::node>& root,
@@ -72,6 +82,8 @@ namespace logid::features {
         };
 
         std::shared_ptr<ipcgull::node> _node;
+        // Holds the active profile's action, _node for the first profile
+        std::shared_ptr<ipcgull::node> _action_node;
 
         Device* _device;
         const ConfigFunction _conf_func;
@@ -80,6 +92,17 @@ namespace logid::features {
 
         mutable std::shared_mutex _action_lock;
         std::shared_ptr<actions::Action> _action;
+        // _action with its type resolved, what press, release and move call
+        actions::ActionRef _dispatch;
+        struct Pooled {
+            std::shared_ptr<ipcgull::node> node;
+            std::shared_ptr<actions::Action> action;
+        };
+        /* Actions of profiles that were active before, reused when switching
+         * back. Keyed by the profile's button config. */
+        std::map<const config::Button*, Pooled> _pooled;
+        // Nodes made for other profiles, the first profile uses _node
+        std::map<std::string, std::shared_ptr<ipcgull::node>> _profile_nodes;
         const Info _info;
 
         bool _first_move{};
@@ -91,24 +114,67 @@ namespace logid::features {
 
     class RemapButton : public DeviceFeature {
     public:
+        // Controls are counted in a byte
+        static constexpr std::size_t max_buttons = 256;
+
+        // Indexed by the ordinal each control was given on construction
+        typedef std::bitset<max_buttons> button_mask;
+
+        // Unknown CIDs are left out
+        [[nodiscard]] button_mask maskOf(const std::vector<uint16_t>& cids) const;
+
+        /* Whether every control in mask is held. Does not lock, so actions
+         * may call it from press. */
+        [[nodiscard]] bool held(const button_mask& mask) const;
+
         void configure() final;
 
         void listen() final;
 
         void setProfile(config::Profile& profile) final;
 
+        [[nodiscard]] ProfileDiff compareProfiles(const config::Profile& from,
+                                                  const config::Profile& to) const final;
+
+        void dropProfile(config::Profile& profile) final;
+
+        [[nodiscard]] static bool supported(Device* dev);
+
     protected:
-        explicit RemapButton(Device* dev);
+        RemapButton(Device* dev, config::Profile& profile);
 
     private:
-        void _buttonEvent(const std::set<uint16_t>& new_state);
+        void _buttonEvent(const backend::hidpp20::ReprogControls::DivertedButtons& new_state);
+
+        // Controls whose buttons profile leaves to the onboard profile
+        [[nodiscard]] button_mask _offloadedMask(const config::Profile& profile) const;
+
+        static constexpr std::size_t mask_words = max_buttons / 64;
 
         std::shared_ptr<backend::hidpp20::ReprogControls> _reprog_controls;
-        std::set<uint16_t> _pressed_buttons;
+        // Requires _button_lock
+        button_mask _pressed_mask;
+        // Copy of _pressed_mask for held()
+        std::array<std::atomic<uint64_t>, mask_words> _held{};
         std::mutex _button_lock;
 
         std::reference_wrapper<std::optional<config::RemapButton>> _config;
         std::map<uint16_t, std::shared_ptr<Button>> _buttons;
+        // By ordinal, fixed after construction like the CID lookup
+        std::vector<std::shared_ptr<Button>> _ordered;
+        std::unordered_map<uint16_t, std::size_t> _ordinals;
+        // Controls that can report raw XY
+        button_mask _raw_xy_mask;
+        // Controls whose last written reporting diverted them
+        button_mask _diverted;
+        // Controls the profile leaves to the onboard profile
+        button_mask _offloadable;
+        // Those of them left undiverted, once the onboard profile is set up
+        button_mask _offloaded;
+        std::mutex _report_lock;
+        /* Held controls out of _raw_xy_mask, replaced by _buttonEvent and
+         * read by the raw XY handler without locking */
+        std::atomic<std::shared_ptr<const std::vector<std::shared_ptr<Button>>>> _moving;
 
         std::shared_ptr<ipcgull::node> _ipc_node;
 
@@ -122,9 +188,10 @@ namespace logid::features {
             RemapButton& _parent;
         };
 
-        EventHandlerLock<backend::hidpp::Device> _ev_handler;
-
         std::shared_ptr<IPC> _ipc_interface;
+
+        EventHandlerLock<backend::hidpp::Device> _ev_handler;
+        EventHandlerLock<backend::hidpp::Device> _raw_xy_handler;
     };
 }
 
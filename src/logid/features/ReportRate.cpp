@@ -0,0 +1,153 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <features/ReportRate.h>
+#include <Device.h>
+#include <ipc_defs.h>
+#include <cstdlib>
+
+using namespace logid::features;
+using namespace logid::backend;
+
+bool ReportRate::supported(Device* dev) {
+    return dev->hidpp20().featureSupported(hidpp20::ReportRate::ID);
+}
+
+ReportRate::ReportRate(Device* dev, config::Profile& profile) :
+        DeviceFeature(dev), _config(profile.report_rate) {
+    try {
+        _report_rate = std::make_shared<hidpp20::ReportRate>(&dev->hidpp20());
+    } catch (hidpp20::UnsupportedFeature& e) {
+        throw UnsupportedFeature();
+    }
+
+    _intervals = _report_rate->getReportRateList();
+    if (_intervals.empty())
+        throw UnsupportedFeature();
+
+    _ipc_interface = _device->ipcNode()->make_interface<IPC>(this);
+}
+
+void ReportRate::configure() {
+    std::shared_lock lock(_config_mutex);
+
+    // The device may have come back at a different rate
+    {
+        std::lock_guard current_lock(_current_mutex);
+        _current_interval.reset();
+    }
+
+    auto& config = _config.get();
+    if (config.has_value() && config.value() > 0)
+        setRate(config.value());
+}
+
+void ReportRate::listen() {
+}
+
+void ReportRate::setProfile(config::Profile& profile) {
+    std::unique_lock lock(_config_mutex);
+    _config = profile.report_rate;
+}
+
+DeviceFeature::ProfileDiff ReportRate::compareProfiles(const config::Profile& from,
+                                                       const config::Profile& to) const {
+    return compareSection(from.report_rate, to.report_rate);
+}
+
+std::map<std::string, std::string> ReportRate::cachedState() {
+    std::lock_guard lock(_current_mutex);
+    if (!_current_interval || _current_interval.value() == 0)
+        return {};
+    return {{"rate", std::to_string(1000 / _current_interval.value())}};
+}
+
+uint16_t ReportRate::getRate() {
+    {
+        std::lock_guard lock(_current_mutex);
+        if (_current_interval)
+            return 1000 / _current_interval.value();
+    }
+
+    auto interval = _report_rate->getReportRate();
+    if (interval == 0)
+        return 0;
+
+    std::lock_guard lock(_current_mutex);
+    _current_interval = interval;
+    return 1000 / interval;
+}
+
+void ReportRate::setRate(uint16_t rate) {
+    if (rate == 0)
+        return;
+
+    auto interval = _closestInterval(rate);
+    try {
+        _report_rate->setReportRate(interval);
+    } catch (...) {
+        std::lock_guard lock(_current_mutex);
+        _current_interval.reset();
+        throw;
+    }
+
+    std::lock_guard lock(_current_mutex);
+    _current_interval = interval;
+}
+
+std::vector<uint16_t> ReportRate::getRates() const {
+    std::vector<uint16_t> rates;
+    for (auto it = _intervals.rbegin(); it != _intervals.rend(); ++it)
+        rates.push_back(1000 / *it);
+    return rates;
+}
+
+uint8_t ReportRate::_closestInterval(int rate) const {
+    // Compared as intervals, which is what the device is given
+    const int target = (1000 + rate / 2) / rate;
+    uint8_t closest = _intervals.front();
+    for (auto interval: _intervals) {
+        if (std::abs(interval - target) < std::abs(closest - target))
+            closest = interval;
+    }
+    return closest;
+}
+
+ReportRate::IPC::IPC(ReportRate* parent) : ipcgull::interface(
+        SERVICE_ROOT_NAME ".ReportRate", {
+                {"GetRates", {this, &IPC::getRates, {"rates"}}},
+                {"GetRate", {this, &IPC::getRate, {"rate"}}},
+                {"SetRate", {this, &IPC::setRate, {"rate"}}}
+        }, {}, {}), _parent(*parent) {
+}
+
+std::vector<uint16_t> ReportRate::IPC::getRates() const {
+    return _parent.getRates();
+}
+
+uint16_t ReportRate::IPC::getRate() const {
+    return _parent.getRate();
+}
+
+void ReportRate::IPC::setRate(uint16_t rate) {
+    std::unique_lock lock(_parent._config_mutex);
+    _parent._config.get() = rate;
+    _parent._device->postWrite("reportrate", [self_weak = _parent.self<ReportRate>(), rate]() {
+        if (auto self = self_weak.lock())
+            self->setRate(rate);
+    });
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_FEATURE_REPORTRATE_H
+#define LOGID_FEATURE_REPORTRATE_H
+
+#include <backend/hidpp20/features/ReportRate.h>
+#include <features/DeviceFeature.h>
+#include <config/schema.h>
+#include <ipcgull/interface.h>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+
+namespace logid::features {
+    class ReportRate : public DeviceFeature {
+    public:
+        void configure() final;
+
+        void listen() final;
+
+        void setProfile(config::Profile& profile) final;
+
+        [[nodiscard]] std::map<std::string, std::string> cachedState() final;
+
+        [[nodiscard]] ProfileDiff compareProfiles(const config::Profile& from,
+                                                  const config::Profile& to) const final;
+
+        // In Hz, cached after the first read and every set
+        uint16_t getRate();
+
+        // Rounded to the closest rate the device supports
+        void setRate(uint16_t rate);
+
+        [[nodiscard]] std::vector<uint16_t> getRates() const;
+
+        [[nodiscard]] static bool supported(Device* dev);
+
+    protected:
+        ReportRate(Device* dev, config::Profile& profile);
+
+    private:
+        [[nodiscard]] uint8_t _closestInterval(int rate) const;
+
+        class IPC : public ipcgull::interface {
+        public:
+            explicit IPC(ReportRate* parent);
+
+            [[nodiscard]] std::vector<uint16_t> getRates() const;
+
+            [[nodiscard]] uint16_t getRate() const;
+
+            void setRate(uint16_t rate);
+
+        private:
+            ReportRate& _parent;
+        };
+
+        mutable config::edit_mutex _config_mutex;
+        std::reference_wrapper<std::optional<int>> _config;
+        std::shared_ptr<backend::hidpp20::ReportRate> _report_rate;
+        // Supported intervals in ms, ascending
+        std::vector<uint8_t> _intervals;
+
+        std::mutex _current_mutex;
+        std::optional<uint8_t> _current_interval;
+
+        std::shared_ptr<IPC> _ipc_interface;
+    };
+}
+
+#endif //LOGID_FEATURE_REPORTRATE_H
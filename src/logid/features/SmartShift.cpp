@@ -22,14 +22,26 @@
 using namespace logid::features;
 using namespace logid::backend;
 
-SmartShift::SmartShift(Device* device) : DeviceFeature(device),
-                                         _config(device->activeProfile().smartshift) {
+bool SmartShift::supported(Device* dev) {
+    return dev->hidpp20().featureSupported(hidpp20::SmartShiftV2::ID) ||
+           dev->hidpp20().featureSupported(hidpp20::SmartShift::ID);
+}
+
+SmartShift::SmartShift(Device* device, config::Profile& profile) :
+        DeviceFeature(device), _config(profile.smartshift) {
     try {
         _smartshift = hidpp20::SmartShift::autoVersion(&device->hidpp20());
     } catch (hidpp20::UnsupportedFeature& e) {
         throw UnsupportedFeature();
     }
 
+    if (device->hidpp20().featureSupported(hidpp20::HiresScroll::ID)) {
+        try {
+            _hires_scroll = std::make_shared<hidpp20::HiresScroll>(&device->hidpp20());
+        } catch (hidpp20::UnsupportedFeature& e) {
+        }
+    }
+
     _torque_support = _smartshift->supportsTorque();
     _defaults = _smartshift->getDefaults();
 
@@ -59,6 +71,9 @@ SmartShift::SmartShift(Device* device) : DeviceFeature(device),
 
 void SmartShift::configure() {
     std::shared_lock lock(_config_mutex);
+    // The device may have come back in a different mode
+    _forgetStatus();
+
     auto& config = _config.get();
     if (config.has_value()) {
         const auto& conf = config.value();
@@ -78,6 +93,18 @@ void SmartShift::configure() {
 }
 
 void SmartShift::listen() {
+    if (_hires_scroll && _ev_handler.empty()) {
+        _ev_handler = _device->hidpp20().addEventRoute(
+                _hires_scroll->featureIndex(), hidpp20::HiresScroll::RatchetSwitch,
+                [this](hidpp::ReportView report) {
+                    auto state = hidpp20::HiresScroll::ratchetSwitchEvent(report);
+                    // The mode shift button bypasses the write shadow
+                    _smartshift->invalidateWrites();
+                    std::lock_guard lock(_status_mutex);
+                    if (_status)
+                        _status->active = state == hidpp20::HiresScroll::Ratchet;
+                });
+    }
 }
 
 void SmartShift::setProfile(config::Profile& profile) {
@@ -85,12 +112,73 @@ void SmartShift::setProfile(config::Profile& profile) {
     _config = profile.smartshift;
 }
 
+DeviceFeature::ProfileDiff SmartShift::compareProfiles(const config::Profile& from,
+                                                       const config::Profile& to) const {
+    auto diff = compareSection(from.smartshift, to.smartshift);
+    if (diff != Changed || !from.smartshift.has_value())
+        return diff;
+
+    // Only the fields that are set get written
+    auto& old_conf = from.smartshift.value();
+    auto& new_conf = to.smartshift.value();
+    if ((old_conf.on && !new_conf.on) || (old_conf.threshold && !new_conf.threshold) ||
+        (old_conf.torque && !new_conf.torque))
+        return NeedsReset;
+    return Changed;
+}
+
+std::map<std::string, std::string> SmartShift::cachedState() {
+    std::lock_guard lock(_status_mutex);
+    if (!_status)
+        return {};
+    std::map<std::string, std::string> state = {
+            {"active", _status->active ? "true" : "false"},
+            {"threshold", std::to_string(_status->autoDisengage)}};
+    if (_torque_support)
+        state.emplace("torque", std::to_string(_status->torque));
+    return state;
+}
+
 SmartShift::Status SmartShift::getStatus() const {
-    return _smartshift->getStatus();
+    {
+        std::lock_guard lock(_status_mutex);
+        if (_status)
+            return _status.value();
+    }
+
+    return refreshStatus();
+}
+
+SmartShift::Status SmartShift::refreshStatus() const {
+    auto status = _smartshift->getStatus();
+    std::lock_guard lock(_status_mutex);
+    _status = status;
+    return status;
 }
 
 void SmartShift::setStatus(Status status) {
-    _smartshift->setStatus(status);
+    try {
+        _smartshift->setStatus(status);
+    } catch (...) {
+        // Whatever part of it went through is unknown
+        _forgetStatus();
+        throw;
+    }
+
+    std::lock_guard lock(_status_mutex);
+    if (!_status)
+        return;
+    if (status.setActive)
+        _status->active = status.active;
+    if (status.setAutoDisengage)
+        _status->autoDisengage = status.autoDisengage;
+    if (status.setTorque)
+        _status->torque = status.torque;
+}
+
+void SmartShift::_forgetStatus() {
+    std::lock_guard lock(_status_mutex);
+    _status.reset();
 }
 
 const hidpp20::SmartShift::Defaults& SmartShift::getDefaults() const {
@@ -105,6 +193,8 @@ SmartShift::IPC::IPC(SmartShift* parent) :
         ipcgull::interface(
                 SERVICE_ROOT_NAME ".SmartShift", {
                         {"GetConfig",    {this, &IPC::getConfig,    {"active",    "threshold", "torque"}}},
+                        {"GetStatus",    {this, &IPC::getStatus,    {"active",    "threshold", "torque"}}},
+                        {"Refresh",      {this, &IPC::refresh,      {"active",    "threshold", "torque"}}},
                         {"SetActive",    {this, &IPC::setActive,    {"active",    "clear"}}},
                         {"SetThreshold", {this, &IPC::setThreshold, {"threshold", "clear"}}},
                         {"SetTorque",    {this, &IPC::setTorque,    {"torque",    "clear"}}},
@@ -132,6 +222,25 @@ std::tuple<uint8_t, uint8_t, uint8_t> SmartShift::IPC::getConfig() const {
     }
 }
 
+std::tuple<bool, uint8_t, uint8_t> SmartShift::IPC::getStatus() const {
+    auto status = _parent.getStatus();
+    return {status.active, status.autoDisengage, status.torque};
+}
+
+std::tuple<bool, uint8_t, uint8_t> SmartShift::IPC::refresh() {
+    // A sleeping device would only time out, the last status read stands
+    auto status = _parent._device->awake() ? _parent.refreshStatus() : _parent.getStatus();
+    return {status.active, status.autoDisengage, status.torque};
+}
+
+void SmartShift::IPC::_postStatus(const std::string& field, Status status) {
+    _parent._device->postWrite("smartshift." + field,
+                               [self_weak = _parent.self<SmartShift>(), status]() {
+        if (auto self = self_weak.lock())
+            self->setStatus(status);
+    });
+}
+
 void SmartShift::IPC::setActive(bool active, bool clear) {
     std::unique_lock lock(_parent._config_mutex);
     auto& config = _parent._config.get();
@@ -144,7 +253,7 @@ void SmartShift::IPC::setActive(bool active, bool clear) {
         config.value().on = active;
         Status status{};
         status.active = active, status.setActive = true;
-        _parent.setStatus(status);
+        _postStatus("active", status);
     }
 }
 
@@ -168,7 +277,7 @@ void SmartShift::IPC::setThreshold(uint8_t threshold, bool clear) {
         config.value().threshold = threshold;
         status.autoDisengage = threshold;
     }
-    _parent.setStatus(status);
+    _postStatus("threshold", status);
 }
 
 void SmartShift::IPC::setTorque(uint8_t torque, bool clear) {
@@ -196,5 +305,5 @@ void SmartShift::IPC::setTorque(uint8_t torque, bool clear) {
         config.value().torque = torque;
         status.torque = torque;
     }
-    _parent.setStatus(status);
+    _postStatus("torque", status);
 }
@@ -20,8 +20,12 @@
 
 #include <features/DeviceFeature.h>
 #include <backend/hidpp20/features/SmartShift.h>
+#include <backend/hidpp20/features/HiresScroll.h>
+#include <backend/hidpp/Device.h>
 #include <ipcgull/interface.h>
 #include <config/schema.h>
+#include <mutex>
+#include <optional>
 #include <shared_mutex>
 
 namespace logid::features {
@@ -33,33 +37,57 @@ namespace logid::features {
 
         void setProfile(config::Profile& profile) final;
 
+        [[nodiscard]] std::map<std::string, std::string> cachedState() final;
+
+        [[nodiscard]] ProfileDiff compareProfiles(const config::Profile& from,
+                                                  const config::Profile& to) const final;
+
         typedef backend::hidpp20::SmartShift::Status Status;
 
+        /* Served from the last status read or written, the wheel's ratchet
+         * switch keeps it current when the device reports it */
         [[nodiscard]] Status getStatus() const;
 
+        // Reads the status from the device and replaces the cached one
+        Status refreshStatus() const;
+
         void setStatus(Status status);
 
         [[nodiscard]] const backend::hidpp20::SmartShift::Defaults& getDefaults() const;
 
         [[nodiscard]] bool supportsTorque() const;
 
+        [[nodiscard]] static bool supported(Device* dev);
+
     protected:
-        explicit SmartShift(Device* dev);
+        SmartShift(Device* dev, config::Profile& profile);
 
     private:
-        mutable std::shared_mutex _config_mutex;
+        mutable config::edit_mutex _config_mutex;
         std::reference_wrapper<std::optional<config::SmartShift>> _config;
         std::shared_ptr<backend::hidpp20::SmartShift> _smartshift;
 
         backend::hidpp20::SmartShift::Defaults _defaults{};
         bool _torque_support = false;
 
+        void _forgetStatus();
+
+        mutable std::mutex _status_mutex;
+        mutable std::optional<Status> _status;
+
+        // Only made when the wheel reports ratchet switches
+        std::shared_ptr<backend::hidpp20::HiresScroll> _hires_scroll;
+
         class IPC : public ipcgull::interface {
         public:
             explicit IPC(SmartShift* parent);
 
             [[nodiscard]] std::tuple<uint8_t, uint8_t, uint8_t> getConfig() const;
 
+            [[nodiscard]] std::tuple<bool, uint8_t, uint8_t> getStatus() const;
+
+            std::tuple<bool, uint8_t, uint8_t> refresh();
+
             void setActive(bool active, bool clear);
 
             void setThreshold(uint8_t threshold, bool clear);
@@ -67,10 +95,16 @@ namespace logid::features {
             void setTorque(uint8_t torque, bool clear);
 
         private:
+            /* Each Status sets one field, which is kept under its own key
+             * so a write held back is not replaced by another field's. */
+            void _postStatus(const std::string& field, Status status);
+
             SmartShift& _parent;
         };
 
         std::shared_ptr<IPC> _ipc_interface;
+
+        EventHandlerLock<backend::hidpp::Device> _ev_handler;
     };
 }
 
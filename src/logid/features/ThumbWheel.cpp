@@ -31,10 +31,10 @@ using namespace logid;
 namespace {
     std::shared_ptr<actions::Action> _genAction(
             Device* dev, std::optional<config::BasicAction>& conf,
-            const std::shared_ptr<ipcgull::node>& parent) {
+            lazy_node& parent) {
         if (conf.has_value()) {
             try {
-                return actions::Action::makeAction(dev, conf.value(), parent);
+                return actions::Action::makeAction(dev, conf.value(), parent.get());
             } catch (actions::InvalidAction& e) {
                 logPrintf(WARN, "Mapping thumb wheel to invalid action");
             }
@@ -45,11 +45,11 @@ namespace {
 
     std::shared_ptr<actions::Gesture> _genGesture(
             Device* dev, std::optional<config::Gesture>& conf,
-            const std::shared_ptr<ipcgull::node>& parent, const std::string& direction) {
+            lazy_node& parent, const std::string& direction) {
         if (conf.has_value()) {
             try {
                 auto result = actions::Gesture::makeGesture(dev, conf.value(),
-                                                            parent->make_child(direction));
+                                                            parent.get()->make_child(direction));
                 if (!result->wheelCompatibility()) {
                     logPrintf(WARN, "Mapping thumb wheel to incompatible gesture");
                     return nullptr;
@@ -65,14 +65,19 @@ namespace {
     }
 }
 
-ThumbWheel::ThumbWheel(Device* dev) : DeviceFeature(dev), _wheel_info(),
-                                      _node(dev->ipcNode()->make_child("thumbwheel")),
-                                      _left_node(_node->make_child("left")),
-                                      _right_node(_node->make_child("right")),
-                                      _proxy_node(_node->make_child("proxy")),
-                                      _tap_node(_node->make_child("tap")),
-                                      _touch_node(_node->make_child("touch")),
-                                      _config(dev->activeProfile().thumbwheel) {
+bool ThumbWheel::supported(Device* dev) {
+    return dev->hidpp20().featureSupported(hidpp20::ThumbWheel::ID);
+}
+
+ThumbWheel::ThumbWheel(Device* dev, config::Profile& profile) :
+        DeviceFeature(dev), _wheel_info(),
+        _node(std::make_shared<lazy_node>(dev->ipcNode(), "thumbwheel")),
+        _left_node(std::make_shared<lazy_node>(_node, "left")),
+        _right_node(std::make_shared<lazy_node>(_node, "right")),
+        _proxy_node(std::make_shared<lazy_node>(_node, "proxy")),
+        _tap_node(std::make_shared<lazy_node>(_node, "tap")),
+        _touch_node(std::make_shared<lazy_node>(_node, "touch")),
+        _config(profile.thumbwheel) {
 
     try {
         _thumb_wheel = std::make_shared<hidpp20::ThumbWheel>(&dev->hidpp20());
@@ -80,10 +85,10 @@ ThumbWheel::ThumbWheel(Device* dev) : DeviceFeature(dev), _wheel_info(),
         throw UnsupportedFeature();
     }
 
-    _makeConfig();
-
     _wheel_info = _thumb_wheel->getInfo();
 
+    _makeConfig();
+
     logPrintf(DEBUG, "Thumb wheel detected (0x2150), capabilities:");
     logPrintf(DEBUG, "timestamp | touch | proximity | single tap");
     logPrintf(DEBUG, "%-9s | %-5s | %-9s | %-10s", FLAG_STR(Timestamp),
@@ -91,26 +96,28 @@ ThumbWheel::ThumbWheel(Device* dev) : DeviceFeature(dev), _wheel_info(),
     logPrintf(DEBUG, "Thumb wheel resolution: native (%d), diverted (%d)",
               _wheel_info.nativeRes, _wheel_info.divertedRes);
 
-    if (_left_gesture) {
-        _fixGesture(_left_gesture);
-    }
-
-    if (_right_gesture) {
-        _fixGesture(_right_gesture);
-    }
-
     _ipc_interface = dev->ipcNode()->make_interface<IPC>(this);
 }
 
 void ThumbWheel::_makeConfig() {
     if (_config.get().has_value()) {
         auto& conf = _config.get().value();
-        _left_gesture = _genGesture(_device, conf.left, _left_node, "left");
-        _right_gesture = _genGesture(_device, conf.right, _right_node, "right");
-        _touch_action = _genAction(_device, conf.touch, _touch_node);
-        _tap_action = _genAction(_device, conf.tap, _tap_node);
-        _proxy_action = _genAction(_device, conf.proxy, _proxy_node);
+        _left_gesture = _genGesture(_device, conf.left, *_left_node, "left");
+        _right_gesture = _genGesture(_device, conf.right, *_right_node, "right");
+        _touch_action = _genAction(_device, conf.touch, *_touch_node);
+        _tap_action = _genAction(_device, conf.tap, *_tap_node);
+        _proxy_action = _genAction(_device, conf.proxy, *_proxy_node);
     }
+
+    _fixGesture(_left_gesture);
+    _fixGesture(_right_gesture);
+    _publish();
+}
+
+void ThumbWheel::_publish() {
+    _bindings.store(std::make_shared<const Bindings>(Bindings{
+            _left_gesture, _right_gesture,
+            _proxy_action, _tap_action, _touch_action}), std::memory_order_release);
 }
 
 void ThumbWheel::configure() {
@@ -125,16 +132,10 @@ void ThumbWheel::configure() {
 
 void ThumbWheel::listen() {
     if (_ev_handler.empty()) {
-        _ev_handler = _device->hidpp20().addEventHandler(
-                {[index = _thumb_wheel->featureIndex()]
-                         (const hidpp::Report& report) -> bool {
-                    return (report.feature() == index) &&
-                           (report.function() == hidpp20::ThumbWheel::Event);
-                },
-                 [self_weak = self<ThumbWheel>()](const hidpp::Report& report) -> void {
-                     if (auto self = self_weak.lock())
-                        self->_handleEvent(self->_thumb_wheel->thumbwheelEvent(report));
-                 }
+        _ev_handler = _device->hidpp20().addEventRoute(
+                _thumb_wheel->featureIndex(), hidpp20::ThumbWheel::Event,
+                [this](hidpp::ReportView report) -> void {
+                    _handleEvent(_thumb_wheel->thumbwheelEvent(report));
                 });
     }
 }
@@ -150,11 +151,18 @@ void ThumbWheel::setProfile(config::Profile& profile) {
     _makeConfig();
 }
 
+DeviceFeature::ProfileDiff ThumbWheel::compareProfiles(const config::Profile& from,
+                                                       const config::Profile& to) const {
+    // Divert and invert are always written, the rest is not on the device
+    return compareSection(from.thumbwheel, to.thumbwheel);
+}
+
 void ThumbWheel::_handleEvent(hidpp20::ThumbWheel::ThumbwheelEvent event) {
-    std::shared_lock lock(_config_mutex);
+    _device->recordEvent(EventStream::ThumbWheel, event.flags, event.rotation);
+    auto bindings = _bindings.load(std::memory_order_acquire);
+
     if (event.flags & hidpp20::ThumbWheel::SingleTap) {
-        auto action = _tap_action;
-        if (action) {
+        if (auto& action = bindings->tap) {
             action->press();
             action->release();
         }
@@ -162,21 +170,21 @@ void ThumbWheel::_handleEvent(hidpp20::ThumbWheel::ThumbwheelEvent event) {
 
     if ((bool) (event.flags & hidpp20::ThumbWheel::Proxy) != _last_proxy) {
         _last_proxy = !_last_proxy;
-        if (_proxy_action) {
+        if (auto& action = bindings->proxy) {
             if (_last_proxy)
-                _proxy_action->press();
+                action->press();
             else
-                _proxy_action->release();
+                action->release();
         }
     }
 
     if ((bool) (event.flags & hidpp20::ThumbWheel::Touch) != _last_touch) {
         _last_touch = !_last_touch;
-        if (_touch_action) {
+        if (auto& action = bindings->touch) {
             if (_last_touch)
-                _touch_action->press();
+                action->press();
             else
-                _touch_action->release();
+                action->release();
         }
     }
 
@@ -184,33 +192,28 @@ void ThumbWheel::_handleEvent(hidpp20::ThumbWheel::ThumbwheelEvent event) {
         // Make right positive unless inverted
         event.rotation *= _wheel_info.defaultDirection;
 
-        if (event.rotationStatus == hidpp20::ThumbWheel::Start) {
-            if (_right_gesture)
-                _right_gesture->press(true);
-            if (_left_gesture)
-                _left_gesture->press(true);
+        /* Gestures are pressed once per rotation so remainders carry over
+         * between events. A session we missed the start of counts as new. */
+        if (event.rotationStatus == hidpp20::ThumbWheel::Start || !_rotating) {
+            if (bindings->right)
+                bindings->right->press(true);
+            if (bindings->left)
+                bindings->left->press(true);
+            _rotating = true;
         }
 
         if (event.rotation) {
-            int8_t direction = event.rotation > 0 ? 1 : -1;
-            std::shared_ptr<actions::Gesture> scroll_action;
-
-            if (direction > 0)
-                scroll_action = _right_gesture;
-            else
-                scroll_action = _left_gesture;
-
-            if (scroll_action) {
-                scroll_action->press(true);
-                scroll_action->move((int16_t) (direction * event.rotation));
-            }
+            auto& scroll_action = event.rotation > 0 ? bindings->right : bindings->left;
+            if (scroll_action)
+                scroll_action->move((int16_t) std::abs(event.rotation));
         }
 
         if (event.rotationStatus == hidpp20::ThumbWheel::Stop) {
-            if (_right_gesture)
-                _right_gesture->release(false);
-            if (_left_gesture)
-                _left_gesture->release(false);
+            if (bindings->right)
+                bindings->right->release(false);
+            if (bindings->left)
+                bindings->left->release(false);
+            _rotating = false;
         }
     }
 }
@@ -261,13 +264,21 @@ std::tuple<bool, bool> ThumbWheel::IPC::getConfig() const {
             config.value().invert.value_or(false)};
 }
 
+void ThumbWheel::IPC::_postStatus(bool divert, bool invert) {
+    _parent._device->postWrite("thumbwheel",
+                              [self_weak = _parent.self<ThumbWheel>(), divert, invert]() {
+        if (auto self = self_weak.lock())
+            self->_thumb_wheel->setStatus(divert, invert);
+    });
+}
+
 void ThumbWheel::IPC::setDivert(bool divert) {
     std::unique_lock lock(_parent._config_mutex);
 
     auto& config = _parentConfig();
     config.divert = divert;
 
-    _parent._thumb_wheel->setStatus(divert, config.invert.value_or(false));
+    _postStatus(divert, config.invert.value_or(false));
 }
 
 void ThumbWheel::IPC::setInvert(bool invert) {
@@ -276,7 +287,7 @@ void ThumbWheel::IPC::setInvert(bool invert) {
     auto& config = _parentConfig();
     config.invert = invert;
 
-    _parent._thumb_wheel->setStatus(config.divert.value_or(false), invert);
+    _postStatus(config.divert.value_or(false), invert);
 }
 
 void ThumbWheel::IPC::setLeft(const std::string& type) {
@@ -289,15 +300,17 @@ void ThumbWheel::IPC::setLeft(const std::string& type) {
         config.left = config::NoGesture();
     }
     _parent._left_gesture = actions::Gesture::makeGesture(
-            _parent._device, type, config.left.value(), _parent._left_node);
+            _parent._device, type, config.left.value(), _parent._left_node->get());
     if (!_parent._left_gesture->wheelCompatibility()) {
         _parent._left_gesture.reset();
         config.left.reset();
+        _parent._publish();
 
         throw std::invalid_argument("incompatible gesture");
     } else {
         _parent._fixGesture(_parent._left_gesture);
     }
+    _parent._publish();
 }
 
 void ThumbWheel::IPC::setRight(const std::string& type) {
@@ -309,15 +322,17 @@ void ThumbWheel::IPC::setRight(const std::string& type) {
         config.right = config::NoGesture();
     }
     _parent._right_gesture = actions::Gesture::makeGesture(
-            _parent._device, type, config.right.value(), _parent._right_node);
+            _parent._device, type, config.right.value(), _parent._right_node->get());
     if (!_parent._right_gesture->wheelCompatibility()) {
         _parent._right_gesture.reset();
         config.right.reset();
+        _parent._publish();
 
         throw std::invalid_argument("incompatible gesture");
     } else {
         _parent._fixGesture(_parent._right_gesture);
     }
+    _parent._publish();
 }
 
 void ThumbWheel::IPC::setProxy(const std::string& type) {
@@ -326,7 +341,8 @@ void ThumbWheel::IPC::setProxy(const std::string& type) {
     auto& config = _parentConfig();
 
     _parent._proxy_action = actions::Action::makeAction(
-            _parent._device, type, config.proxy, _parent._proxy_node);
+            _parent._device, type, config.proxy, _parent._proxy_node->get());
+    _parent._publish();
 }
 
 
@@ -336,7 +352,8 @@ void ThumbWheel::IPC::setTap(const std::string& type) {
     auto& config = _parentConfig();
 
     _parent._tap_action = actions::Action::makeAction(
-            _parent._device, type, config.tap, _parent._tap_node);
+            _parent._device, type, config.tap, _parent._tap_node->get());
+    _parent._publish();
 }
 
 
@@ -346,5 +363,6 @@ void ThumbWheel::IPC::setTouch(const std::string& type) {
     auto& config = _parentConfig();
 
     _parent._touch_action = actions::Action::makeAction(
-            _parent._device, type, config.touch, _parent._touch_node);
+            _parent._device, type, config.touch, _parent._touch_node->get());
+    _parent._publish();
 }
@@ -22,11 +22,15 @@
 #include <actions/gesture/Gesture.h>
 #include <backend/hidpp20/features/ThumbWheel.h>
 #include <backend/hidpp/Device.h>
+#include <util/lazy_node.h>
+#include <atomic>
 
 namespace logid::features {
     class ThumbWheel : public DeviceFeature {
     public:
-        explicit ThumbWheel(Device* dev);
+        ThumbWheel(Device* dev, config::Profile& profile);
+
+        [[nodiscard]] static bool supported(Device* dev);
 
         void configure() final;
 
@@ -34,6 +38,9 @@ namespace logid::features {
 
         void setProfile(config::Profile& profile) final;
 
+        [[nodiscard]] ProfileDiff compareProfiles(const config::Profile& from,
+                                                  const config::Profile& to) const final;
+
     private:
         void _makeConfig();
 
@@ -41,6 +48,9 @@ namespace logid::features {
 
         void _fixGesture(const std::shared_ptr<actions::Gesture>& gesture) const;
 
+        // Requires unique lock on _config_mutex or construction
+        void _publish();
+
         class IPC : public ipcgull::interface {
         public:
             explicit IPC(ThumbWheel* parent);
@@ -64,34 +74,48 @@ namespace logid::features {
         private:
             config::ThumbWheel& _parentConfig();
 
+            void _postStatus(bool divert, bool invert);
+
             ThumbWheel& _parent;
         };
 
         std::shared_ptr<backend::hidpp20::ThumbWheel> _thumb_wheel;
         backend::hidpp20::ThumbWheel::ThumbwheelInfo _wheel_info;
 
-        std::shared_ptr<ipcgull::node> _node;
+        std::shared_ptr<lazy_node> _node;
 
         std::shared_ptr<actions::Gesture> _left_gesture;
-        std::shared_ptr<ipcgull::node> _left_node;
+        std::shared_ptr<lazy_node> _left_node;
         std::shared_ptr<actions::Gesture> _right_gesture;
-        std::shared_ptr<ipcgull::node> _right_node;
+        std::shared_ptr<lazy_node> _right_node;
         std::shared_ptr<actions::Action> _proxy_action;
-        std::shared_ptr<ipcgull::node> _proxy_node;
+        std::shared_ptr<lazy_node> _proxy_node;
         std::shared_ptr<actions::Action> _tap_action;
-        std::shared_ptr<ipcgull::node> _tap_node;
+        std::shared_ptr<lazy_node> _tap_node;
         std::shared_ptr<actions::Action> _touch_action;
-        std::shared_ptr<ipcgull::node> _touch_node;
+        std::shared_ptr<lazy_node> _touch_node;
+
+        // What _handleEvent dispatches to, so events do not take the lock
+        struct Bindings {
+            std::shared_ptr<actions::Gesture> left;
+            std::shared_ptr<actions::Gesture> right;
+            std::shared_ptr<actions::Action> proxy;
+            std::shared_ptr<actions::Action> tap;
+            std::shared_ptr<actions::Action> touch;
+        };
+        std::atomic<std::shared_ptr<const Bindings>> _bindings;
 
+        // Only touched by _handleEvent
         bool _last_proxy = false;
         bool _last_touch = false;
+        bool _rotating = false;
 
-        mutable std::shared_mutex _config_mutex;
+        mutable config::edit_mutex _config_mutex;
         std::reference_wrapper<std::optional<config::ThumbWheel>> _config;
 
-        EventHandlerLock<backend::hidpp::Device> _ev_handler;
-
         std::shared_ptr<IPC> _ipc_interface;
+
+        EventHandlerLock<backend::hidpp::Device> _ev_handler;
     };
 }
 
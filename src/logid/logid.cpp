@@ -18,9 +18,13 @@
 
 #include <DeviceManager.h>
 #include <InputDevice.h>
+#include <backend/raw/Capture.h>
 #include <util/task.h>
 #include <util/log.h>
+#include <util/notify.h>
+#include <util/memory.h>
 #include <algorithm>
+#include <csignal>
 #include <ipc_defs.h>
 
 #ifndef LOGIOPS_VERSION
@@ -35,6 +39,10 @@ using namespace logid;
 
 struct CmdlineOptions {
     std::string config_file = default_config;
+    // Empty parses the config file on every start
+    std::string config_cache;
+    // Empty captures nothing
+    std::string capture_file;
 };
 
 LogLevel logid::global_loglevel = INFO;
@@ -43,6 +51,8 @@ enum class Option {
     None,
     Verbose,
     Config,
+    ConfigCache,
+    Capture,
     Help,
     Version
 };
@@ -58,6 +68,8 @@ void readCliOptions(const int argc, char** argv, CmdlineOptions& options) {
                     std::string op_str = argv[i];
                     if (op_str == "--verbose") option = Option::Verbose;
                     if (op_str == "--config") option = Option::Config;
+                    if (op_str == "--config-cache") option = Option::ConfigCache;
+                    if (op_str == "--capture") option = Option::Capture;
                     if (op_str == "--help") option = Option::Help;
                     if (op_str == "--version") option = Option::Version;
                     break;
@@ -71,6 +83,12 @@ void readCliOptions(const int argc, char** argv, CmdlineOptions& options) {
                 case 'c': // Config file path
                     option = Option::Config;
                     break;
+                case 'C': // Config snapshot directory
+                    option = Option::ConfigCache;
+                    break;
+                case 'r': // Raw report capture file
+                    option = Option::Capture;
+                    break;
                 case 'h': // Help
                     option = Option::Help;
                     break;
@@ -109,6 +127,22 @@ void readCliOptions(const int argc, char** argv, CmdlineOptions& options) {
                     options.config_file = argv[i];
                     break;
                 }
+                case Option::ConfigCache: {
+                    if (++i >= argc) {
+                        logPrintf(ERROR, "Config cache directory is not specified.");
+                        exit(EXIT_FAILURE);
+                    }
+                    options.config_cache = argv[i];
+                    break;
+                }
+                case Option::Capture: {
+                    if (++i >= argc) {
+                        logPrintf(ERROR, "Capture file is not specified.");
+                        exit(EXIT_FAILURE);
+                    }
+                    options.capture_file = argv[i];
+                    break;
+                }
                 case Option::Help:
                     printf(R"(logid version %s
 Usage: %s [options]
@@ -116,6 +150,8 @@ Possible options are:
     -v,--verbose [level]       Set log level to debug/info/warn/error (leave blank for debug)
     -V,--version               Print version number
     -c,--config [file path]    Change config file from default at %s
+    -C,--config-cache [dir]    Keep a parsed snapshot of the config file in dir
+    -r,--capture [file]        Record every HID++ report to file for logid-replay
     -h,--help                  Print this message.
 )", LOGIOPS_VERSION, argv[0], default_config);
                     exit(EXIT_SUCCESS);
@@ -141,15 +177,41 @@ int main(int argc, char** argv) {
      */
     setbuf(stdout, NULL);
 
+    /* SIGHUP reloads the config, it is read from a signalfd so every
+     * thread started from here on must have it blocked */
+    sigset_t reload_signals;
+    sigemptyset(&reload_signals);
+    sigaddset(&reload_signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &reload_signals, nullptr);
+
     // Read config
     try {
-        config = std::make_shared<Configuration>(options.config_file);
+        config = std::make_shared<Configuration>(options.config_file,
+                                               options.config_cache);
     } catch (std::exception &e) {
         logPrintf(ERROR, "%s", e.what());
         return EXIT_FAILURE;
     }
 
-    init_workers(config->workers.value_or(defaults::workers));
+    if (!options.capture_file.empty()) {
+        try {
+            backend::raw::startCapture(options.capture_file);
+        } catch (std::exception& e) {
+            logPrintf(ERROR, "Could not start capture: %s", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Before any thread is started, their stacks are locked as they are used
+    if (config->lock_memory.value_or(defaults::lock_memory)) {
+        const std::size_t devices = config->devices ? config->devices->size() : 0;
+        lockWorkingSet(defaults::locked_heap + devices * defaults::locked_heap_per_device);
+    }
+
+    const bool io_timers = config->io_timers.value_or(defaults::io_timers);
+    init_workers(config->workers.value_or(io_timers ? defaults::io_timers_workers :
+                                          defaults::workers),
+                 config->max_workers.value_or(defaults::max_workers), !io_timers);
 
 #ifdef USE_USER_BUS
     auto server_bus = ipcgull::IPCGULL_USER;
@@ -161,7 +223,9 @@ int main(int argc, char** argv) {
 
     //Create a virtual input device
     try {
-        virtual_input = std::make_unique<InputDevice>(virtual_input_name);
+        std::set<uint> keys, axes;
+        config->inputEvents(keys, axes);
+        virtual_input = std::make_shared<InputDevice>(virtual_input_name, keys, axes);
     } catch (std::system_error& e) {
         logPrintf(ERROR, "Could not create input device: %s", e.what());
         return EXIT_FAILURE;
@@ -170,8 +234,17 @@ int main(int argc, char** argv) {
     // Device manager runs on its own I/O thread asynchronously
     auto device_manager = DeviceManager::make<DeviceManager>(config, virtual_input, server);
 
+    device_manager->driveTimers();
+    device_manager->watchConfig();
+    device_manager->serveMetrics();
+    device_manager->watchFocus();
+    device_manager->watchIO();
+    // Only queues the probes, devices are announced over IPC as they come up
     device_manager->enumerate();
 
+    // IPC and input are up, devices still being probed report progress
+    notifyServiceManager("READY=1");
+
     try {
         server->start();
     } catch (ipcgull::connection_failed& e) {
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <tools/SimulatedStack.h>
+#include <backend/hidpp20/feature_defs.h>
+#include <backend/hidpp20/features/ReprogControls.h>
+#include <backend/hidpp20/features/HiresScroll.h>
+#include <DeviceManager.h>
+#include <InputDevice.h>
+#include <ipc_defs.h>
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <system_error>
+#include <unistd.h>
+
+using namespace logid;
+using namespace logid::tools;
+using namespace logid::backend;
+
+namespace {
+    // Functions not scripted below answer with zeros, up to this one
+    constexpr uint8_t scripted_functions = 8;
+}
+
+hidpp20::MockModel logid::tools::simulatedMouse(int latency_ms) {
+    hidpp20::MockModel model;
+    model.name = "Simulated Mouse";
+    model.latency = std::chrono::milliseconds(latency_ms);
+    model.features = {
+            {hidpp20::FeatureID::FW_VERSION},
+            {hidpp20::FeatureID::DEVICE_NAME},
+            {hidpp20::FeatureID::RESET},
+            {hidpp20::FeatureID::BATTERY_STATUS},
+            {hidpp20::FeatureID::ADJUSTABLE_DPI},
+            {hidpp20::FeatureID::SMART_SHIFT},
+            {hidpp20::FeatureID::HIRES_SCROLLING_V2},
+            {hidpp20::FeatureID::THUMB_WHEEL},
+            {hidpp20::FeatureID::REPROG_CONTROLS_V4, 4}};
+
+    for (auto& feature: model.features) {
+        // DeviceName is answered from the name
+        if (feature.id == hidpp20::FeatureID::DEVICE_NAME)
+            continue;
+        for (uint8_t function = 0; function < scripted_functions; ++function)
+            model.responses[{feature.id, function}] = {};
+    }
+
+    // One sensor, 400 to 4000 DPI in steps of 50
+    model.responses[{hidpp20::FeatureID::ADJUSTABLE_DPI, 0}] = {1};
+    model.responses[{hidpp20::FeatureID::ADJUSTABLE_DPI, 1}] =
+            {0x00, 0x01, 0x90, 0xe0, 0x32, 0x0f, 0xa0};
+    model.responses[{hidpp20::FeatureID::ADJUSTABLE_DPI, 2}] = {0x00, 0x03, 0x20, 0x03, 0x20};
+
+    model.responses[{hidpp20::FeatureID::HIRES_SCROLLING_V2, 0}] =
+            {8, hidpp20::HiresScroll::HasRatchet | hidpp20::HiresScroll::Invertible};
+
+    // Native and diverted resolution, turning right increments
+    model.responses[{hidpp20::FeatureID::THUMB_WHEEL, 0}] = {0x00, 0x12, 0x00, 0x78, 0x01};
+
+    model.responses[{hidpp20::FeatureID::REPROG_CONTROLS_V4, 0}] = {1};
+    model.responses[{hidpp20::FeatureID::REPROG_CONTROLS_V4, 1}] =
+            {0x00, 0xc3, 0x00, 0x9c,
+             hidpp20::ReprogControls::TemporaryDivertable |
+             hidpp20::ReprogControls::PersistentlyDivertable,
+             0, 0, 0, hidpp20::ReprogControls::RawXY};
+
+    return model;
+}
+
+SimulatedStack::SimulatedStack(const std::string& config, std::shared_ptr<InputDevice> input) {
+    auto path = (std::filesystem::temp_directory_path() / "logid-stack-XXXXXX").string();
+    int fd = mkstemp(path.data());
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "mkstemp");
+    _config_file = path;
+
+    auto left = config.size();
+    for (auto data = config.data(); left;) {
+        auto ret = ::write(fd, data, left);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            int err = errno;
+            ::close(fd);
+            unlink(_config_file.c_str());
+            throw std::system_error(err, std::generic_category(), "write");
+        }
+        data += ret;
+        left -= ret;
+    }
+    ::close(fd);
+
+    try {
+        auto configuration = std::make_shared<Configuration>(_config_file);
+        auto server = ipcgull::make_server(SERVICE_ROOT_NAME, server_root_node,
+                                           ipcgull::IPCGULL_USER);
+        _manager = DeviceManager::make<DeviceManager>(
+                configuration, std::move(input), server);
+    } catch (...) {
+        unlink(_config_file.c_str());
+        throw;
+    }
+}
+
+SimulatedStack::~SimulatedStack() {
+    for (auto& device: _devices)
+        _manager->removeExternalDevice(device);
+    _devices.clear();
+    _manager.reset();
+    unlink(_config_file.c_str());
+}
+
+std::shared_ptr<Device> SimulatedStack::addDevice(
+        const std::string& path, const std::shared_ptr<hidpp20::MockTransport>& transport) {
+    auto device = Device::make(hidpp20::MockTransport::makeDevice(path, transport),
+                               hidpp::DefaultDevice, _manager);
+    _manager->addExternalDevice(device);
+    _devices.push_back(device);
+    return device;
+}
+
+const std::shared_ptr<DeviceManager>& SimulatedStack::manager() const {
+    return _manager;
+}
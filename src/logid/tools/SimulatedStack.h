@@ -0,0 +1,69 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_TOOLS_SIMULATEDSTACK_H
+#define LOGID_TOOLS_SIMULATEDSTACK_H
+
+#include <backend/hidpp20/MockTransport.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace logid {
+    class Device;
+
+    class DeviceManager;
+
+    class InputDevice;
+}
+
+namespace logid::tools {
+    /* A mouse with every feature logid::Device makes for it scripted, one
+     * gesture capable button (0xc3) on its controls */
+    backend::hidpp20::MockModel simulatedMouse(int latency_ms = 0);
+
+    /* The daemon's DeviceManager with logid::Devices on simulated devices.
+     * No hidraw node is opened and the IPC server is never started. */
+    class SimulatedStack {
+    public:
+        /* config is the text of a config file, it is read back from a
+         * temporary file as the daemon would. input gets the actions'
+         * events, nullptr leaves them without one. */
+        explicit SimulatedStack(const std::string& config,
+                                std::shared_ptr<InputDevice> input = nullptr);
+
+        ~SimulatedStack();
+
+        SimulatedStack(const SimulatedStack&) = delete;
+
+        SimulatedStack& operator=(const SimulatedStack&) = delete;
+
+        // Brought up as a directly connected device on path
+        std::shared_ptr<Device> addDevice(
+                const std::string& path,
+                const std::shared_ptr<backend::hidpp20::MockTransport>& transport);
+
+        [[nodiscard]] const std::shared_ptr<DeviceManager>& manager() const;
+
+    private:
+        std::string _config_file;
+        std::shared_ptr<DeviceManager> _manager;
+        std::vector<std::shared_ptr<Device>> _devices;
+    };
+}
+
+#endif //LOGID_TOOLS_SIMULATEDSTACK_H
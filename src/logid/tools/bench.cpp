@@ -0,0 +1,381 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <tools/SimulatedStack.h>
+#include <backend/hidpp20/MockTransport.h>
+#include <backend/hidpp20/Device.h>
+#include <backend/hidpp20/feature_defs.h>
+#include <backend/hidpp20/features/HiresScroll.h>
+#include <backend/hidpp20/features/ReprogControls.h>
+#include <backend/hidpp20/features/ThumbWheel.h>
+#include <backend/raw/RawDevice.h>
+#include <Device.h>
+#include <DeviceManager.h>
+#include <InputDevice.h>
+#include <util/task.h>
+#include <util/log.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace logid;
+using namespace logid::backend;
+using namespace logid::tools;
+using namespace std::chrono;
+
+/* Exercises the daemon against simulated devices, no hardware, hidraw
+ * nodes or uinput are needed. */
+
+LogLevel logid::global_loglevel = WARN;
+
+namespace {
+    struct Options {
+        int devices = 200;
+        int events = 10000;
+        int latency_ms = 0;
+        int rate = 1000;
+        int idle_s = 60;
+    };
+
+    template <typename T>
+    double ms(T elapsed) {
+        return duration_cast<duration<double, std::milli>>(elapsed).count();
+    }
+
+    void printPercentiles(const char* what, std::vector<double> samples) {
+        if (samples.empty())
+            return;
+        std::sort(samples.begin(), samples.end());
+        auto at = [&samples](double p) {
+            return samples[static_cast<std::size_t>(p * static_cast<double>(samples.size() - 1))];
+        };
+        printf("%s: p50 %.3f ms, p99 %.3f ms, p999 %.3f ms, max %.3f ms\n",
+               what, at(0.5), at(0.99), at(0.999), samples.back());
+    }
+
+    // Every feature of the simulated mouse has something to write on bring-up
+    constexpr auto init_config = R"(
+devices: ({
+    name: "Simulated Mouse";
+    dpi: 1600;
+    smartshift: { on: true; threshold: 30; };
+    hiresscroll: { hires: true; invert: false; target: false; };
+    buttons: ({ cid: 0xc3; action: { type: "ToggleSmartShift"; }; });
+});
+cache_dir: "";
+)";
+
+    /* Brings devices up through the DeviceManager, as the daemon does on
+     * start: probing, the feature table, then each feature's configure */
+    void benchInit(const Options& options) {
+        SimulatedStack stack(init_config);
+        std::vector<std::shared_ptr<Device>> devices;
+        std::vector<double> times;
+        auto start = steady_clock::now();
+
+        for (int i = 0; i < options.devices; ++i) {
+            auto transport = std::make_shared<hidpp20::MockTransport>(
+                    simulatedMouse(options.latency_ms));
+
+            auto device_start = steady_clock::now();
+            devices.push_back(stack.addDevice("mock/" + std::to_string(i), transport));
+            times.push_back(ms(steady_clock::now() - device_start));
+        }
+
+        auto total = steady_clock::now() - start;
+        printf("init: %d devices in %.3f ms\n", options.devices, ms(total));
+        printPercentiles("init per device", std::move(times));
+
+        std::map<std::string, std::vector<double>> spans;
+        for (auto& device: devices) {
+            for (auto& span: device->hidpp20().initSpans())
+                spans[span.name].push_back(ms(span.time));
+        }
+        for (auto& [name, samples]: spans)
+            printPercentiles(("  " + name).c_str(), std::move(samples));
+    }
+
+    // Keeps the I/O watchdog running, battery polls are scheduled regardless
+    constexpr auto idle_config = R"(
+io_slo: 5.0;
+cache_dir: "";
+)";
+
+    /* Brings devices up through the DeviceManager and leaves them alone.
+     * Each timer wakeup in the wait must be owed to timers coming due or
+     * moving down the wheel, or to a rearm. */
+    void benchIdle(const Options& options) {
+        SimulatedStack stack(idle_config);
+        stack.manager()->watchIO();
+
+        for (int i = 0; i < options.devices; ++i)
+            stack.addDevice("mock/idle/" + std::to_string(i),
+                            std::make_shared<hidpp20::MockTransport>(simulatedMouse()));
+
+        // Bring-up leaves short timers behind, e.g. the first battery read
+        std::this_thread::sleep_for(seconds(2));
+
+        auto before = get_task_stats();
+        std::this_thread::sleep_for(seconds(options.idle_s));
+        auto after = get_task_stats();
+
+        auto wakeups = after.timer_wakeups - before.timer_wakeups;
+        auto expiries = after.timer_expiries - before.timer_expiries;
+        auto rearms = after.timer_rearms - before.timer_rearms;
+        printf("idle: %d devices, %llu timer wakeups in %d s for %llu expiries and "
+               "%llu rearms, %llu timers pending\n",
+               options.devices, (unsigned long long) wakeups, options.idle_s,
+               (unsigned long long) expiries, (unsigned long long) rearms,
+               (unsigned long long) after.timers);
+
+        // A wakeup may be counted before its expiry as the stats are taken
+        if (wakeups > expiries + rearms + 1)
+            throw std::runtime_error("timers woke up with nothing due");
+    }
+
+    struct Event {
+        uint8_t event;
+        std::vector<uint8_t> params;
+    };
+
+    /* An event stream of the simulated mouse, through the daemon's
+     * features and the bound actions to the virtual input device */
+    struct Stream {
+        const char* name;
+        // The simulated mouse's part of the config, binding the stream
+        const char* binding;
+        uint16_t feature;
+        // The i-th event of the stream
+        std::function<Event(int)> event;
+        // Frames written to the virtual input device for every cycle events
+        int frames;
+        int cycle = 1;
+        // Controls held down before the stream starts, e.g. for a gesture
+        std::vector<uint8_t> held = {};
+    };
+
+    const std::vector<Stream>& streams() {
+        static const std::vector<Stream> list = {
+                {"buttons", R"(buttons: ({ cid: 0xc3;
+                     action: { type: "Keypress"; keys: ["KEY_A"]; }; });)",
+                 hidpp20::FeatureID::REPROG_CONTROLS_V4,
+                 [](int i) {
+                     // Pressed and released in turn
+                     return Event{hidpp20::ReprogControls::DivertedButtonEvent,
+                                  i % 2 ? std::vector<uint8_t>{} :
+                                  std::vector<uint8_t>{0x00, 0xc3}};
+                 }, 1},
+                {"rawxy", R"(buttons: ({ cid: 0xc3; action: { type: "Gestures";
+                     gestures: ({ direction: "Right"; mode: "OnInterval";
+                         threshold: 0; interval: 4;
+                         action: { type: "Keypress"; keys: ["KEY_B"]; }; }); }; });)",
+                 hidpp20::FeatureID::REPROG_CONTROLS_V4,
+                 [](int) {
+                     // Each passes one interval, a press and a release
+                     return Event{hidpp20::ReprogControls::DivertedRawXYEvent,
+                                  {0x00, 0x04, 0xff, 0xfe}};
+                 }, 2, 1, {0x00, 0xc3}},
+                {"axis", R"(buttons: ({ cid: 0xc3; action: { type: "Gestures";
+                     gestures: ({ direction: "Right"; mode: "Axis";
+                         axis: "REL_HWHEEL_HI_RES"; threshold: 0; }); }; });)",
+                 hidpp20::FeatureID::REPROG_CONTROLS_V4,
+                 [](int) {
+                     // Each moves the axis by one frame
+                     return Event{hidpp20::ReprogControls::DivertedRawXYEvent,
+                                  {0x00, 0x04, 0xff, 0xfe}};
+                 }, 1, 1, {0x00, 0xc3}},
+                {"gesture", R"(buttons: ({ cid: 0xc3; action: { type: "Gestures";
+                     gestures: ({ direction: "Right"; mode: "OnRelease";
+                         action: { type: "Keypress"; keys: ["KEY_C"]; }; }); }; });)",
+                 hidpp20::FeatureID::REPROG_CONTROLS_V4,
+                 [](int i) {
+                     // Pressed, moved past the threshold and released
+                     switch (i % 3) {
+                         case 0:
+                             return Event{hidpp20::ReprogControls::DivertedButtonEvent,
+                                          {0x00, 0xc3}};
+                         case 1:
+                             return Event{hidpp20::ReprogControls::DivertedRawXYEvent,
+                                          {0x00, 0x64, 0x00, 0x00}};
+                         default:
+                             return Event{hidpp20::ReprogControls::DivertedButtonEvent, {}};
+                     }
+                 }, 2, 3},
+                {"scroll", R"(hiresscroll: { hires: true; target: true;
+                     up: { mode: "Axis"; axis: "REL_WHEEL_HI_RES"; }; };)",
+                 hidpp20::FeatureID::HIRES_SCROLLING_V2,
+                 [](int) {
+                     return Event{hidpp20::HiresScroll::WheelMovement, {0x10, 0x00, 0x08}};
+                 }, 1},
+                {"thumbwheel", R"(thumbwheel: { divert: true;
+                     right: { mode: "Axis"; axis: "REL_HWHEEL_HI_RES"; }; };)",
+                 hidpp20::FeatureID::THUMB_WHEEL,
+                 [](int i) {
+                     // Started once, then rotating
+                     return Event{hidpp20::ThumbWheel::Event,
+                                  {0x00, 0x02, 0x00, 0x10,
+                                   static_cast<uint8_t>(i ? 0x02 : 0x01)}};
+                 }, 1}};
+        return list;
+    }
+
+    /* Time from the report being read to the frame it results in being
+     * written, as InputDevice::emitLatency() counts it in the daemon */
+    void benchStream(const Stream& stream, const Options& options) {
+        // Whole cycles only
+        const int events = options.events / stream.cycle * stream.cycle;
+        const int expected = events / stream.cycle * stream.frames;
+        std::vector<double> latencies;
+        latencies.reserve(static_cast<std::size_t>(expected));
+        std::mutex mutex;
+        std::condition_variable cv;
+        int frames = 0;
+
+        auto input = std::make_shared<InputDevice>(
+                "logid-bench", [&](std::span<const input_event>) {
+                    auto read = raw::RawDevice::readTime();
+                    auto now = steady_clock::now();
+                    std::lock_guard lock(mutex);
+                    if (read)
+                        latencies.push_back(ms(now - *read));
+                    if (++frames == expected)
+                        cv.notify_all();
+                });
+
+        SimulatedStack stack(std::string(R"(devices: ({ name: "Simulated Mouse"; )") +
+                             stream.binding + R"( }); cache_dir: "";)", input);
+        auto transport = std::make_shared<hidpp20::MockTransport>(simulatedMouse(0));
+        stack.addDevice(std::string("mock/") + stream.name, transport);
+
+        if (!stream.held.empty())
+            transport->notify(hidpp::DefaultDevice, hidpp20::FeatureID::REPROG_CONTROLS_V4,
+                              hidpp20::ReprogControls::DivertedButtonEvent, stream.held);
+
+        // A zero rate sends as fast as possible, for throughput
+        const auto interval = options.rate > 0 ?
+                duration_cast<steady_clock::duration>(duration<double>(1.0 / options.rate)) :
+                steady_clock::duration::zero();
+
+        auto start = steady_clock::now();
+        for (int i = 0; i < events; ++i) {
+            if (interval.count())
+                std::this_thread::sleep_until(start + interval * i);
+            auto event = stream.event(i);
+            transport->notify(hidpp::DefaultDevice, stream.feature, event.event, event.params);
+        }
+
+        std::unique_lock lock(mutex);
+        if (!cv.wait_for(lock, seconds(30), [&]() { return frames >= expected; }))
+            throw std::runtime_error("events were lost");
+
+        auto total = steady_clock::now() - start;
+        printf("%s: %d events in %.3f ms, %.0f events/s\n", stream.name, events,
+               ms(total), events / duration<double>(total).count());
+        printPercentiles(stream.name, latencies);
+    }
+
+    void usage(const char* name) {
+        printf(R"(Usage: %s [options] [init|idle|buttons|rawxy|axis|gesture|scroll|thumbwheel]...
+Without a bench, all but idle are run.
+Possible options are:
+    -n,--devices [count]      Simulated devices for init (default 200)
+    -e,--events [count]       Events sent per stream (default 10000)
+    -r,--rate [hz]            Events per second, 0 sends them all at once (default 1000)
+    -l,--latency [ms]         Simulated response time of the devices
+    -i,--idle [seconds]       How long idle waits for (default 60)
+    -h,--help                 Print this message.
+)", name);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    std::vector<std::string> benches;
+
+    for (int i = 1; i < argc; ++i) {
+        auto number = [&]() {
+            if (++i >= argc) {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            return std::atoi(argv[i]);
+        };
+
+        std::string arg = argv[i];
+        if (arg == "-n" || arg == "--devices") {
+            options.devices = number();
+        } else if (arg == "-e" || arg == "--events") {
+            options.events = std::min(number(), 1 << 24);
+        } else if (arg == "-r" || arg == "--rate") {
+            options.rate = number();
+        } else if (arg == "-l" || arg == "--latency") {
+            options.latency_ms = number();
+        } else if (arg == "-i" || arg == "--idle") {
+            options.idle_s = number();
+        } else if (arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else {
+            benches.push_back(arg);
+        }
+    }
+
+    if (benches.empty()) {
+        benches = {"init"};
+        for (auto& stream: streams())
+            benches.emplace_back(stream.name);
+    }
+
+    init_workers(4, 16);
+
+    try {
+        for (auto& bench: benches) {
+            if (bench == "init") {
+                benchInit(options);
+                continue;
+            }
+            if (bench == "idle") {
+                benchIdle(options);
+                continue;
+            }
+
+            auto stream = std::find_if(streams().begin(), streams().end(),
+                                       [&bench](const Stream& s) { return bench == s.name; });
+            if (stream == streams().end()) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            benchStream(*stream, options);
+        }
+    } catch (std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,332 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <backend/raw/RawDevice.h>
+#include <backend/hidpp/Report.h>
+#include <features/DPI.h>
+#include <Configuration.h>
+#include <util/task.h>
+#include <util/log.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unistd.h>
+
+using namespace logid;
+using namespace logid::backend;
+using namespace std::chrono;
+
+/* Times the data structures on the hot paths in isolation, as a baseline
+ * for changes to them. Each case runs enough iterations to take at least
+ * the minimum time, the median of the repetitions is reported. */
+
+LogLevel logid::global_loglevel = WARN;
+
+namespace {
+    struct Options {
+        milliseconds min_time{200};
+        int repetitions = 5;
+    };
+
+    struct Case {
+        const char* name;
+        // Runs the operation iterations times
+        std::function<void(uint64_t iterations)> run;
+    };
+
+    // Keeps value from being optimized out
+    template <typename T>
+    void keep(const T& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    constexpr auto sample_config = R"(devices: (
+{
+    name: "Wireless Mouse MX Master";
+    smartshift: { on: true; threshold: 30; torque: 50; };
+    hiresscroll: { hires: true; invert: false; target: false; };
+    dpi: 1000;
+    buttons: (
+        {
+            cid: 0xc3;
+            action = {
+                type: "Gestures";
+                gestures: (
+                    { direction: "Up"; mode: "OnRelease";
+                      action = { type: "Keypress"; keys: ["KEY_UP"]; }; },
+                    { direction: "Down"; mode: "OnRelease";
+                      action = { type: "Keypress"; keys: ["KEY_DOWN"]; }; },
+                    { direction: "Left"; mode: "OnRelease";
+                      action = { type: "CycleDPI"; dpis: [400, 800, 1200, 1600]; }; },
+                    { direction: "Right"; mode: "OnRelease";
+                      action = { type: "ToggleSmartShift"; }; },
+                    { direction: "None"; mode: "NoPress"; }
+                );
+            };
+        },
+        {
+            cid: 0xc4;
+            action = { type: "ToggleSmartShift"; };
+        }
+    );
+    thumbwheel: {
+        divert: true;
+        left: { mode: "OnInterval"; interval: 2;
+                action = { type: "Keypress"; keys: ["KEY_VOLUMEDOWN"]; }; };
+        right: { mode: "OnInterval"; interval: 2;
+                 action = { type: "Keypress"; keys: ["KEY_VOLUMEUP"]; }; };
+    };
+}
+);
+)";
+
+    // A dispatch over handlers callbacks, only the last of which matches
+    Case dispatchCase(const char* name, int handlers) {
+        return {name, [handlers](uint64_t iterations) {
+            EventHandlerList<raw::RawDevice> list;
+            uint64_t matched = 0;
+            for (int i = 0; i < handlers; ++i) {
+                raw::RawMatch match{true, hidpp::DefaultDevice,
+                                    static_cast<uint8_t>(i + 1 == handlers ? 0x05 : 0x80 + i)};
+                list.add({match, {}, [&matched](raw::RawReport) { ++matched; }});
+            }
+
+            std::array<uint8_t, hidpp::Report::MaxDataLength> report{
+                    0x11, hidpp::DefaultDevice, 0x05, 0x00};
+            for (uint64_t i = 0; i < iterations; ++i)
+                list.run_all(raw::RawReport(report));
+            keep(matched);
+        }};
+    }
+
+    // Phys paths of a receiver, one of its devices, a wired mouse and a hub port
+    constexpr std::array<std::string_view, 4> sample_phys = {
+            "usb-0000:00:14.0-2/input2",
+            "usb-0000:00:14.0-2/input2:1",
+            "usb-0000:00:14.0-3/input0",
+            "usb-0000:00:14.0-4.1.3/input2:6"};
+
+    const std::vector<Case>& cases() {
+        static const std::vector<Case> list = {
+                dispatchCase("dispatch/1", 1),
+                dispatchCase("dispatch/8", 8),
+                dispatchCase("dispatch/32", 32),
+                dispatchCase("dispatch/64", 64),
+                {"phys/regex", [](uint64_t iterations) {
+                    // The pattern sub-device detection matched with before
+                    static const std::regex virtual_path_regex(R"~((.*\/)(.*:)([0-9]+))~");
+                    for (uint64_t i = 0; i < iterations; ++i) {
+                        std::string phys(sample_phys[i % sample_phys.size()]);
+                        keep(std::regex_match(phys, virtual_path_regex));
+                    }
+                }},
+                {"phys/match", [](uint64_t iterations) {
+                    for (uint64_t i = 0; i < iterations; ++i) {
+                        std::string phys(sample_phys[i % sample_phys.size()]);
+                        keep(raw::RawDevice::isVirtualPhys(phys));
+                    }
+                }},
+                {"report/construct", [](uint64_t iterations) {
+                    const std::array<uint8_t, 3> params{0x01, 0x02, 0x03};
+                    for (uint64_t i = 0; i < iterations; ++i) {
+                        hidpp::Report report(hidpp::Report::Type::Long, hidpp::DefaultDevice,
+                                             0x05, 0x01, 0x01);
+                        report.setParams(params);
+                        keep(report);
+                    }
+                }},
+                {"report/parse", [](uint64_t iterations) {
+                    std::array<uint8_t, hidpp::Report::MaxDataLength> raw{
+                            0x11, hidpp::DefaultDevice, 0x05, 0x11, 0x01, 0x02};
+                    for (uint64_t i = 0; i < iterations; ++i) {
+                        hidpp::Report report{std::span<const uint8_t>(raw)};
+                        keep(report);
+                    }
+                }},
+                {"report/view", [](uint64_t iterations) {
+                    std::array<uint8_t, hidpp::Report::MaxDataLength> raw{
+                            0x11, hidpp::DefaultDevice, 0x05, 0x11, 0x01, 0x02};
+                    for (uint64_t i = 0; i < iterations; ++i) {
+                        hidpp::ReportView view{std::span<const uint8_t>(raw)};
+                        keep(view.function());
+                    }
+                }},
+                {"task/run", [](uint64_t iterations) {
+                    std::mutex mutex;
+                    std::condition_variable done;
+                    std::atomic<uint64_t> left = iterations;
+                    for (uint64_t i = 0; i < iterations; ++i) {
+                        run_task([&]() {
+                            if (--left == 0) {
+                                std::lock_guard lock(mutex);
+                                done.notify_all();
+                            }
+                        });
+                    }
+                    std::unique_lock lock(mutex);
+                    done.wait(lock, [&left]() { return left == 0; });
+                }},
+                {"task/strand", [](uint64_t iterations) {
+                    strand s;
+                    std::mutex mutex;
+                    std::condition_variable done;
+                    uint64_t left = iterations;
+                    for (uint64_t i = 0; i < iterations; ++i) {
+                        s.post([&]() {
+                            // Strand tasks never overlap
+                            if (--left == 0) {
+                                std::lock_guard lock(mutex);
+                                done.notify_all();
+                            }
+                        });
+                    }
+                    std::unique_lock lock(mutex);
+                    done.wait(lock, [&left]() { return left == 0; });
+                }},
+                {"dpi/list", [](uint64_t iterations) {
+                    features::DPI::SensorDPIs dpis({{400, 600, 800, 1000, 1200, 1600, 2000,
+                                                     3200, 4000}, false, 0});
+                    for (uint64_t i = 0; i < iterations; ++i)
+                        keep(dpis.closest(static_cast<uint16_t>(200 + (i & 4095))));
+                }},
+                {"dpi/range", [](uint64_t iterations) {
+                    features::DPI::SensorDPIs dpis({{200, 4000}, true, 50});
+                    for (uint64_t i = 0; i < iterations; ++i)
+                        keep(dpis.closest(static_cast<uint16_t>(200 + (i & 4095))));
+                }},
+                {"config/parse", [](uint64_t iterations) {
+                    auto path = std::filesystem::temp_directory_path() /
+                                ("logid-microbench-" + std::to_string(getpid()) + ".cfg");
+                    std::ofstream(path) << sample_config;
+                    for (uint64_t i = 0; i < iterations; ++i) {
+                        Configuration config(path.string());
+                        keep(config);
+                    }
+                    std::filesystem::remove(path);
+                }},
+                {"config/snapshot", [](uint64_t iterations) {
+                    auto dir = std::filesystem::temp_directory_path() /
+                               ("logid-microbench-" + std::to_string(getpid()));
+                    std::filesystem::create_directories(dir);
+                    auto path = dir / "logid.cfg";
+                    std::ofstream(path) << sample_config;
+                    // The first load stores the snapshot the others read
+                    Configuration(path.string(), dir.string());
+                    for (uint64_t i = 0; i < iterations; ++i) {
+                        Configuration config(path.string(), dir.string());
+                        keep(config);
+                    }
+                    std::filesystem::remove_all(dir);
+                }}
+        };
+        return list;
+    }
+
+    double runOnce(const Case& c, uint64_t iterations) {
+        auto start = steady_clock::now();
+        c.run(iterations);
+        return duration<double, std::nano>(steady_clock::now() - start).count();
+    }
+
+    void runCase(const Case& c, const Options& options) {
+        // Doubles the iterations until one run takes the minimum time
+        uint64_t iterations = 1;
+        const double min_ns = duration<double, std::nano>(options.min_time).count();
+        while (runOnce(c, iterations) < min_ns && iterations < (uint64_t(1) << 40))
+            iterations *= 2;
+
+        std::vector<double> per_op;
+        for (int i = 0; i < options.repetitions; ++i)
+            per_op.push_back(runOnce(c, iterations) / static_cast<double>(iterations));
+        std::sort(per_op.begin(), per_op.end());
+
+        printf("%-20s %12llu iterations, median %10.1f ns/op, min %10.1f ns/op\n",
+               c.name, (unsigned long long) iterations, per_op[per_op.size() / 2],
+               per_op.front());
+    }
+
+    void usage(const char* name) {
+        printf(R"(Usage: %s [options] [case prefix]...
+Possible options are:
+    -t,--time [ms]            Minimum time of a run (default 200)
+    -r,--repetitions [count]  Runs per case, the median is reported (default 5)
+    -l,--list                 List the cases
+    -h,--help                 Print this message.
+)", name);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    std::vector<std::string> filters;
+
+    for (int i = 1; i < argc; ++i) {
+        auto number = [&]() {
+            if (++i >= argc) {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            return std::atoi(argv[i]);
+        };
+
+        std::string arg = argv[i];
+        if (arg == "-t" || arg == "--time") {
+            options.min_time = milliseconds(number());
+        } else if (arg == "-r" || arg == "--repetitions") {
+            options.repetitions = std::max(number(), 1);
+        } else if (arg == "-l" || arg == "--list") {
+            for (auto& c: cases())
+                printf("%s\n", c.name);
+            return EXIT_SUCCESS;
+        } else if (arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else {
+            filters.push_back(arg);
+        }
+    }
+
+    init_workers(4, 16);
+
+    try {
+        for (auto& c: cases()) {
+            // A case runs if any filter is a prefix of its name
+            if (!filters.empty() &&
+                std::none_of(filters.begin(), filters.end(), [&c](const std::string& f) {
+                    return std::string_view(c.name).starts_with(f);
+                }))
+                continue;
+            runCase(c, options);
+        }
+    } catch (std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,499 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <backend/raw/Capture.h>
+#include <backend/hidpp20/MockTransport.h>
+#include <backend/hidpp20/feature_defs.h>
+#include <backend/hidpp/defs.h>
+#include <backend/hidpp/Report.h>
+#include <tools/SimulatedStack.h>
+#include <backend/raw/RawDevice.h>
+#include <Device.h>
+#include <InputDevice.h>
+#include <util/log.h>
+#include <util/task.h>
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace logid;
+using namespace logid::backend;
+using namespace logid::backend::raw;
+
+/* Offline view of a capture recorded with logid --capture: a timeline of
+ * every report and the HID++ request/response round-trip times per node.
+ * With --replay, the HID++ 2.0 devices in it are brought up again as
+ * logid::Devices on simulated devices answering as the captured ones did,
+ * and what they sent on their own is fed back to them. The frames their
+ * actions write go to a mock InputDevice, to be printed or compared with
+ * those of an earlier replay. Only what the captured daemon asked for can
+ * be answered, so captures should be taken without a capability cache. */
+
+LogLevel logid::global_loglevel = WARN;
+
+namespace {
+    constexpr uint8_t hidpp10_error = 0x8f;
+    constexpr uint8_t hidpp20_error = 0xff;
+
+    // node, device index, feature/sub id, function/address
+    typedef std::tuple<uint16_t, uint8_t, uint8_t, uint8_t> request_key;
+
+    bool requestKey(const CaptureRecord& record, request_key& key) {
+        auto& d = record.data;
+        if (d.size() < 4)
+            return false;
+
+        if (!record.out() && d.size() >= 5 &&
+            (d[2] == hidpp10_error || d[2] == hidpp20_error)) {
+            key = {record.node, d[1], d[3], d[4]};
+            return true;
+        }
+
+        key = {record.node, d[1], d[2], d[3]};
+        return true;
+    }
+
+    uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+        if (sorted.empty())
+            return 0;
+        auto i = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1));
+        return sorted[i];
+    }
+
+    // A HID++ 2.0 device of the capture, with what it answered and sent
+    struct CapturedDevice {
+        std::string path;
+        hidpp::DeviceIndex index = hidpp::DefaultDevice;
+        hidpp20::MockModel model;
+        // Reports it sent on its own, by the time they were read
+        std::vector<std::pair<uint64_t, std::vector<uint8_t>>> events;
+    };
+
+    std::vector<uint8_t> trimmed(std::vector<uint8_t> params) {
+        while (!params.empty() && !params.back())
+            params.pop_back();
+        return params;
+    }
+
+    std::vector<CapturedDevice> capturedDevices(const char* file) {
+        struct exchange {
+            uint8_t feature_index;
+            uint8_t function;
+            std::vector<uint8_t> params;
+            std::vector<uint8_t> response;
+        };
+
+        struct seen {
+            bool hidpp20 = false;
+            std::tuple<uint8_t, uint8_t> protocol = {4, 2};
+            // Feature id, flags and version by index
+            std::map<uint8_t, hidpp20::MockModel::MockFeature> features;
+            std::vector<exchange> exchanges;
+            std::vector<std::pair<uint64_t, std::vector<uint8_t>>> events;
+        };
+
+        CaptureReader reader(file);
+        CaptureRecord record;
+        std::map<std::tuple<uint16_t, uint8_t>, seen> devices;
+        std::map<request_key, std::vector<uint8_t>> pending;
+
+        while (reader.next(record)) {
+            auto& d = record.data;
+            if (d.size() < hidpp::Report::HeaderLength + hidpp::ShortParamLength ||
+                (d[0] != hidpp::ReportType::Short && d[0] != hidpp::ReportType::Long))
+                continue;
+
+            request_key key;
+            requestKey(record, key);
+            std::vector<uint8_t> params(d.begin() + hidpp::Offset::Parameters, d.end());
+            if (record.out()) {
+                pending[key] = std::move(params);
+                continue;
+            }
+
+            auto& device = devices[{record.node, d[1]}];
+            auto request = pending.find(key);
+            if (request == pending.end()) {
+                // Responses carry the software ID of the request, events 0
+                if (!(d[3] & 0x0f) && device.features.contains(d[2]))
+                    device.events.emplace_back(record.time_ns, d);
+                continue;
+            }
+
+            auto request_params = std::move(request->second);
+            pending.erase(request);
+            if (d[2] == hidpp10_error || d[2] == hidpp20_error)
+                continue;
+
+            const uint8_t function = d[3] >> 4;
+            if (d[2] == 0 && function == 0) {
+                // GetFeature, the index of the feature asked for
+                device.hidpp20 = true;
+                if (params[0])
+                    device.features[params[0]] = {
+                            static_cast<uint16_t>(request_params[0] << 8 | request_params[1]),
+                            params[2], params[1]};
+            } else if (d[2] == 0 && function == 1) {
+                device.hidpp20 = true;
+                device.protocol = {params[0], params[1]};
+            }
+
+            device.exchanges.push_back({d[2], function, std::move(request_params),
+                                        std::move(params)});
+        }
+
+        std::vector<CapturedDevice> ret;
+        for (auto& [id, device]: devices) {
+            if (!device.hidpp20)
+                continue;
+
+            // The feature table as read through FeatureSet, always at index 1
+            for (auto& exchange: device.exchanges) {
+                if (exchange.feature_index == 1 && exchange.function == 1 &&
+                    exchange.params[0] > 1)
+                    device.features[exchange.params[0]] = {
+                            static_cast<uint16_t>(exchange.response[0] << 8 |
+                                                  exchange.response[1]),
+                            exchange.response[3], exchange.response[2]};
+            }
+
+            CapturedDevice captured;
+            captured.path = reader.nodePath(std::get<0>(id));
+            captured.index = std::get<1>(id);
+            captured.model.name = captured.path;
+            captured.model.protocol = device.protocol;
+
+            // The simulated device indexes its features in order after FeatureSet
+            uint8_t last = device.features.empty() ? 1 : device.features.rbegin()->first;
+            for (int index = 2; index <= last; ++index) {
+                auto feature = device.features.find(index);
+                // Never looked up, an id no device has keeps the indexes
+                captured.model.features.push_back(feature == device.features.end() ?
+                        hidpp20::MockModel::MockFeature{0xffff} : feature->second);
+            }
+
+            for (auto& exchange: device.exchanges) {
+                auto feature = device.features.find(exchange.feature_index);
+                if (exchange.feature_index < 2 || feature == device.features.end())
+                    continue;
+                captured.model.recorded[{feature->second.id, exchange.function,
+                                         trimmed(exchange.params)}] = exchange.response;
+            }
+
+            captured.events = std::move(device.events);
+            ret.push_back(std::move(captured));
+        }
+
+        return ret;
+    }
+
+    // A frame as one line, e.g. "REL_WHEEL_HI_RES 120 REL_WHEEL 1"
+    std::string frameText(std::span<const input_event> frame) {
+        std::string ret;
+        for (auto& event: frame) {
+            if (!ret.empty())
+                ret += ' ';
+            try {
+                ret += event.type == EV_KEY ? InputDevice::toKeyName(event.code) :
+                       InputDevice::toAxisName(event.code);
+            } catch (InputDevice::InvalidEventCode& e) {
+                ret += std::to_string(event.code);
+            }
+            ret += ' ' + std::to_string(event.value);
+        }
+        return ret;
+    }
+
+    // What the actions wrote during a replay
+    struct Emitted {
+        std::mutex mutex;
+        std::vector<std::string> frames;
+        // From reading the report to writing its frame, in ms
+        std::vector<double> costs;
+    };
+
+    struct ReplayOptions {
+        std::string config;
+        // Events back to back, not at their captured pace
+        bool fast = false;
+        bool print_frames = false;
+        // Frames of an earlier replay, as printed, to compare with
+        const char* expect = nullptr;
+    };
+
+    bool compareFrames(const std::vector<std::string>& frames, const char* file) {
+        std::ifstream in(file);
+        if (!in) {
+            printf("%s: could not be read\n", file);
+            return false;
+        }
+
+        std::string line;
+        std::size_t i = 0;
+        for (; std::getline(in, line); ++i) {
+            if (i >= frames.size()) {
+                printf("frame %zu: expected \"%s\", none was written\n", i, line.c_str());
+                return false;
+            }
+            if (frames[i] != line) {
+                printf("frame %zu: expected \"%s\", got \"%s\"\n", i, line.c_str(),
+                       frames[i].c_str());
+                return false;
+            }
+        }
+        if (i < frames.size()) {
+            printf("frame %zu: \"%s\" was not expected\n", i, frames[i].c_str());
+            return false;
+        }
+
+        printf("%zu frames match %s\n", frames.size(), file);
+        return true;
+    }
+
+    /* Brings every captured device up on the stack and feeds it what it
+     * sent, at the pace it was captured at unless fast */
+    bool replay(const char* file, const ReplayOptions& options) {
+        using namespace std::chrono;
+
+        auto captured = capturedDevices(file);
+        if (captured.empty()) {
+            printf("No HID++ 2.0 device in the capture\n");
+            return true;
+        }
+
+        Emitted emitted;
+        auto input = std::make_shared<InputDevice>(
+                "logid-replay", [&emitted](std::span<const input_event> frame) {
+                    auto read = RawDevice::readTime();
+                    auto now = steady_clock::now();
+                    auto text = frameText(frame);
+                    std::lock_guard lock(emitted.mutex);
+                    emitted.frames.push_back(std::move(text));
+                    if (read)
+                        emitted.costs.push_back(
+                                duration<double, std::milli>(now - *read).count());
+                });
+
+        tools::SimulatedStack stack(options.config, input);
+        bool ok = true;
+
+        std::vector<std::pair<uint64_t, std::pair<hidpp20::MockTransport*,
+                const std::vector<uint8_t>*>>> events;
+        std::vector<std::shared_ptr<hidpp20::MockTransport>> transports;
+        for (auto& device: captured) {
+            auto transport = std::make_shared<hidpp20::MockTransport>(device.model);
+            auto start = steady_clock::now();
+            try {
+                auto added = stack.addDevice(device.path + ":" + std::to_string(device.index),
+                                             transport);
+                printf("%s:%d: %s up in %.3f ms, %zu events\n", device.path.c_str(),
+                       device.index, added->name().c_str(),
+                       duration<double, std::milli>(steady_clock::now() - start).count(),
+                       device.events.size());
+            } catch (std::exception& e) {
+                printf("%s:%d: could not be brought up: %s\n", device.path.c_str(),
+                       device.index, e.what());
+                ok = false;
+                continue;
+            }
+
+            for (auto& [time, report]: device.events)
+                events.push_back({time, {transport.get(), &report}});
+            transports.push_back(std::move(transport));
+        }
+
+        std::sort(events.begin(), events.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first;
+        });
+
+        // The stack was brought up as directly connected devices
+        auto start = steady_clock::now();
+        for (auto& [time, event]: events) {
+            if (!options.fast)
+                std::this_thread::sleep_until(start + nanoseconds(time - events.front().first));
+            auto report = *event.second;
+            report[hidpp::Offset::DeviceIndex] = hidpp::DefaultDevice;
+            event.first->inject(report);
+        }
+
+        // Injected reports are delivered on a strand, let it drain
+        std::this_thread::sleep_for(milliseconds(100));
+        printf("%zu events replayed in %.3f s\n", events.size(),
+               duration<double>(steady_clock::now() - start).count());
+
+        std::lock_guard lock(emitted.mutex);
+        auto& costs = emitted.costs;
+        std::sort(costs.begin(), costs.end());
+        printf("%zu frames written", emitted.frames.size());
+        if (!costs.empty()) {
+            auto at = [&costs](double p) {
+                return costs[static_cast<std::size_t>(p * static_cast<double>(costs.size() - 1))];
+            };
+            printf(", read to write p50 %.3f ms, p99 %.3f ms, max %.3f ms",
+                   at(0.5), at(0.99), costs.back());
+        }
+        printf("\n");
+
+        if (options.print_frames) {
+            for (auto& frame: emitted.frames)
+                printf("%s\n", frame.c_str());
+        }
+
+        if (options.expect && !compareFrames(emitted.frames, options.expect))
+            ok = false;
+
+        return ok;
+    }
+
+    void usage(const char* name) {
+        printf(R"(Usage: %s [options] <capture file>
+Possible options are:
+    -d,--dump            Print every report in the capture
+    -r,--replay          Replay the capture through logid on simulated devices
+    -c,--config [file]   Config file the replay uses, none by default
+    -f,--fast            Replay the events back to back, not at their pace
+    -e,--emitted         Print the frames the replay wrote, one per line
+    -x,--expect [file]   Fail unless the replay writes the frames in file
+    -h,--help            Print this message.
+)", name);
+    }
+}
+
+int main(int argc, char** argv) {
+    bool dump = false;
+    bool run = false;
+    ReplayOptions options;
+    const char* file = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--dump")) {
+            dump = true;
+        } else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--replay")) {
+            run = true;
+        } else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--fast")) {
+            options.fast = true;
+        } else if (!strcmp(argv[i], "-e") || !strcmp(argv[i], "--emitted")) {
+            options.print_frames = true;
+        } else if (!strcmp(argv[i], "-x") || !strcmp(argv[i], "--expect")) {
+            if (++i >= argc) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            options.expect = argv[i];
+        } else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--config")) {
+            if (++i >= argc) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            std::ifstream in(argv[i]);
+            if (!in) {
+                fprintf(stderr, "%s: could not be read\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            std::stringstream text;
+            text << in.rdbuf();
+            options.config = text.str();
+        } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else {
+            file = argv[i];
+        }
+    }
+
+    if (!file) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    try {
+        CaptureReader reader(file);
+        CaptureRecord record;
+
+        std::map<request_key, uint64_t> pending;
+        std::map<uint16_t, std::vector<uint64_t>> round_trips;
+        std::map<uint16_t, std::pair<uint64_t, uint64_t>> counts;
+        uint64_t first = 0, last = 0;
+
+        while (reader.next(record)) {
+            if (!first)
+                first = record.time_ns;
+            last = record.time_ns;
+
+            auto& count = counts[record.node];
+            (record.out() ? count.first : count.second)++;
+
+            if (dump) {
+                printf("%12.6f %s %s", static_cast<double>(record.time_ns - first) / 1e9,
+                       reader.nodePath(record.node).c_str(), record.out() ? "OUT" : "IN ");
+                for (auto byte: record.data)
+                    printf(" %02x", byte);
+                printf("\n");
+            }
+
+            request_key key;
+            if (!requestKey(record, key))
+                continue;
+
+            if (record.out()) {
+                pending[key] = record.time_ns;
+            } else if (auto it = pending.find(key); it != pending.end()) {
+                round_trips[record.node].push_back(record.time_ns - it->second);
+                pending.erase(it);
+            }
+        }
+
+        printf("%.3f s captured\n", static_cast<double>(last - first) / 1e9);
+        for (auto& [node, count]: counts) {
+            auto& trips = round_trips[node];
+            std::sort(trips.begin(), trips.end());
+            printf("%s: %" PRIu64 " out, %" PRIu64 " in, %zu round trips",
+                   reader.nodePath(node).c_str(), count.first, count.second, trips.size());
+            if (!trips.empty())
+                printf(", p50 %.3f ms, p99 %.3f ms, max %.3f ms",
+                       static_cast<double>(percentile(trips, 0.5)) / 1e6,
+                       static_cast<double>(percentile(trips, 0.99)) / 1e6,
+                       static_cast<double>(trips.back()) / 1e6);
+            printf("\n");
+        }
+
+        if (run) {
+            init_workers(4, 16);
+            if (!replay(file, options))
+                return EXIT_FAILURE;
+        }
+    } catch (std::exception& e) {
+        fprintf(stderr, "%s: %s\n", file, e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
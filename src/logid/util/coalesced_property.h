@@ -0,0 +1,100 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_UTIL_COALESCED_PROPERTY_H
+#define LOGID_UTIL_COALESCED_PROPERTY_H
+
+#include <util/task.h>
+#include <ipcgull/property.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+namespace logid {
+    /* Publishes an IPC property at most once per window. A write after a
+     * quiet window goes out at once, later ones are held back to the end
+     * of the window and only the last value is sent, if it changed. */
+    template<typename T>
+    class coalesced_property {
+    public:
+        coalesced_property(ipcgull::property_permission permission, T value,
+                           std::chrono::milliseconds window) :
+                _property(permission, value), _window(window),
+                _state(std::make_shared<state>(std::move(value))) {
+        }
+
+        // For the interface's property table
+        [[nodiscard]] const ipcgull::property<T>& property() const {
+            return _property;
+        }
+
+        void set(T value) {
+            std::lock_guard lock(_state->mutex);
+            auto now = std::chrono::steady_clock::now();
+            if (!_state->waiting && now - _state->last >= _window) {
+                _state->last = now;
+                _publish(_property, *_state, std::move(value));
+                return;
+            }
+
+            _state->pending = std::move(value);
+            if (_state->waiting)
+                return;
+            _state->waiting = true;
+
+            /* Copies of a property share its value, the task holds its own
+             * and may outlive the owner */
+            auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    _window - (now - _state->last));
+            run_task_after([property = _property, state = _state]() mutable {
+                std::lock_guard lock(state->mutex);
+                state->waiting = false;
+                state->last = std::chrono::steady_clock::now();
+                if (state->pending) {
+                    _publish(property, *state, std::move(state->pending.value()));
+                    state->pending.reset();
+                }
+            }, delay, task_priority::background);
+        }
+
+    private:
+        struct state {
+            explicit state(T value) : published(std::move(value)) {}
+
+            std::mutex mutex;
+            T published;
+            std::optional<T> pending;
+            bool waiting = false;
+            std::chrono::steady_clock::time_point last{};
+        };
+
+        static void _publish(ipcgull::property<T>& property, state& s, T value) {
+            if (value == s.published)
+                return;
+            s.published = value;
+            property = std::move(value);
+        }
+
+        ipcgull::property<T> _property;
+        const std::chrono::milliseconds _window;
+        std::shared_ptr<state> _state;
+    };
+}
+
+#endif //LOGID_UTIL_COALESCED_PROPERTY_H
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_UTIL_FUNCTION_H
+#define LOGID_UTIL_FUNCTION_H
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace logid {
+    template<typename Signature>
+    class unique_function;
+
+    /* A move-only std::function. Callables of up to inline_size bytes, e.g.
+     * a weak_ptr and a report or an index, are stored in place instead of
+     * on the heap, and captures need not be copyable. One takes a cache
+     * line on 64-bit targets. */
+    template<typename R, typename... Args>
+    class unique_function<R(Args...)> {
+    public:
+        static constexpr std::size_t inline_size = 7 * sizeof(void*);
+
+        unique_function() noexcept = default;
+
+        // NOLINTNEXTLINE(google-explicit-constructor)
+        unique_function(std::nullptr_t) noexcept {}
+
+        template<typename F>
+        requires (!std::is_same_v<std::decay_t<F>, unique_function> &&
+                  std::is_invocable_r_v<R, std::decay_t<F>&, Args...>)
+        // NOLINTNEXTLINE(google-explicit-constructor)
+        unique_function(F&& f) {
+            typedef std::decay_t<F> callable_t;
+
+            // Empty std::functions and function pointers stay empty
+            if constexpr (requires { static_cast<bool>(f); }) {
+                if (!static_cast<bool>(f))
+                    return;
+            }
+
+            if constexpr (_fits_inline<callable_t>) {
+                ::new(static_cast<void*>(_storage)) callable_t(std::forward<F>(f));
+                _ops = &_inline_ops<callable_t>;
+            } else {
+                _heap() = new callable_t(std::forward<F>(f));
+                _ops = &_heap_ops<callable_t>;
+            }
+        }
+
+        unique_function(unique_function&& o) noexcept : _ops(o._ops) {
+            if (_ops) {
+                _ops->move(_storage, o._storage);
+                o._ops = nullptr;
+            }
+        }
+
+        unique_function& operator=(unique_function&& o) noexcept {
+            if (this != &o) {
+                reset();
+                if (o._ops) {
+                    o._ops->move(_storage, o._storage);
+                    _ops = o._ops;
+                    o._ops = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        unique_function& operator=(std::nullptr_t) noexcept {
+            reset();
+            return *this;
+        }
+
+        unique_function(const unique_function&) = delete;
+
+        unique_function& operator=(const unique_function&) = delete;
+
+        ~unique_function() {
+            reset();
+        }
+
+        void reset() noexcept {
+            if (_ops) {
+                _ops->destroy(_storage);
+                _ops = nullptr;
+            }
+        }
+
+        explicit operator bool() const noexcept {
+            return _ops != nullptr;
+        }
+
+        // Const like std::function's, the callable itself may be mutable
+        R operator()(Args... args) const {
+            if (!_ops)
+                throw std::bad_function_call();
+            return _ops->invoke(const_cast<unsigned char*>(_storage),
+                                std::forward<Args>(args)...);
+        }
+
+    private:
+        struct ops {
+            R (* invoke)(void*, Args&&...);
+            // Moves into uninitialized storage and destroys the source
+            void (* move)(void* to, void* from) noexcept;
+            void (* destroy)(void*) noexcept;
+        };
+
+        template<typename F>
+        static constexpr bool _fits_inline =
+                sizeof(F) <= inline_size &&
+                alignof(F) <= alignof(std::max_align_t) &&
+                std::is_nothrow_move_constructible_v<F>;
+
+        template<typename F>
+        static constexpr ops _inline_ops = {
+                [](void* s, Args&&... args) -> R {
+                    return std::invoke(*static_cast<F*>(s), std::forward<Args>(args)...);
+                },
+                [](void* to, void* from) noexcept {
+                    ::new(to) F(std::move(*static_cast<F*>(from)));
+                    static_cast<F*>(from)->~F();
+                },
+                [](void* s) noexcept {
+                    static_cast<F*>(s)->~F();
+                }
+        };
+
+        template<typename F>
+        static constexpr ops _heap_ops = {
+                [](void* s, Args&&... args) -> R {
+                    return std::invoke(**static_cast<F**>(s), std::forward<Args>(args)...);
+                },
+                [](void* to, void* from) noexcept {
+                    *static_cast<F**>(to) = *static_cast<F**>(from);
+                },
+                [](void* s) noexcept {
+                    delete *static_cast<F**>(s);
+                }
+        };
+
+        void*& _heap() noexcept {
+            return *reinterpret_cast<void**>(_storage);
+        }
+
+        alignas(std::max_align_t) unsigned char _storage[inline_size];
+        const ops* _ops = nullptr;
+    };
+}
+
+#endif //LOGID_UTIL_FUNCTION_H
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <util/id_allocator.h>
+
+using namespace logid;
+
+int id_allocator::allocate() {
+    std::lock_guard lock(_mutex);
+    if (_released.empty())
+        return _next++;
+
+    auto lowest = _released.begin();
+    int id = *lowest;
+    _released.erase(lowest);
+    return id;
+}
+
+void id_allocator::release(int id) {
+    std::lock_guard lock(_mutex);
+    if (id < 0 || id >= _next)
+        return;
+
+    if (id + 1 == _next) {
+        // Shrink past every ID released below, so the set stays small
+        --_next;
+        while (!_released.empty() && *_released.rbegin() + 1 == _next) {
+            _released.erase(std::prev(_released.end()));
+            --_next;
+        }
+    } else {
+        _released.insert(id);
+    }
+}
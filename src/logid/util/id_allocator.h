@@ -0,0 +1,41 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_UTIL_ID_ALLOCATOR_H
+#define LOGID_UTIL_ID_ALLOCATOR_H
+
+#include <mutex>
+#include <set>
+
+namespace logid {
+    /* Hands out the lowest unused non-negative ID. IDs given back below
+     * the highest handed out are kept ordered, so both are O(log n). */
+    class id_allocator {
+    public:
+        [[nodiscard]] int allocate();
+
+        void release(int id);
+
+    private:
+        std::mutex _mutex;
+        std::set<int> _released;
+        int _next = 0;
+    };
+}
+
+#endif //LOGID_UTIL_ID_ALLOCATOR_H
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <util/lazy_node.h>
+
+using namespace logid;
+
+lazy_node::lazy_node(std::shared_ptr<ipcgull::node> parent, std::string name) :
+        _parent(std::move(parent)), _name(std::move(name)) {
+}
+
+lazy_node::lazy_node(std::shared_ptr<lazy_node> parent, std::string name) :
+        _parent(std::move(parent)), _name(std::move(name)) {
+}
+
+std::shared_ptr<ipcgull::node> lazy_node::get() {
+    std::lock_guard lock(_mutex);
+    if (!_node) {
+        auto parent = std::holds_alternative<std::shared_ptr<ipcgull::node>>(_parent) ?
+                      std::get<std::shared_ptr<ipcgull::node>>(_parent) :
+                      std::get<std::shared_ptr<lazy_node>>(_parent)->get();
+        _node = parent->make_child(_name);
+    }
+    return _node;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_UTIL_LAZY_NODE_H
+#define LOGID_UTIL_LAZY_NODE_H
+
+#include <ipcgull/node.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <variant>
+
+namespace logid {
+    /* A child node that is only made, and so only registered on the bus,
+     * once something is put on it. Its parent may be lazy as well. */
+    class lazy_node {
+    public:
+        lazy_node(std::shared_ptr<ipcgull::node> parent, std::string name);
+
+        lazy_node(std::shared_ptr<lazy_node> parent, std::string name);
+
+        lazy_node(const lazy_node&) = delete;
+
+        lazy_node& operator=(const lazy_node&) = delete;
+
+        // Makes the node, and any lazy parents, on the first call
+        [[nodiscard]] std::shared_ptr<ipcgull::node> get();
+
+    private:
+        std::mutex _mutex;
+        std::variant<std::shared_ptr<ipcgull::node>, std::shared_ptr<lazy_node>> _parent;
+        const std::string _name;
+        std::shared_ptr<ipcgull::node> _node;
+    };
+}
+
+#endif //LOGID_UTIL_LAZY_NODE_H
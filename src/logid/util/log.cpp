@@ -17,26 +17,277 @@
  */
 
 #include <util/log.h>
+#include <atomic>
+#include <cerrno>
 #include <cstdio>
 #include <cstdarg>
+#include <cstring>
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <csignal>
+#include <pthread.h>
+#include <unistd.h>
 
 using namespace logid;
 
-void logid::logPrintf(LogLevel level, const char* format, ...) {
+namespace {
+    // Longer lines are cut short
+    constexpr std::size_t line_size = 512;
+    // A power of two
+    constexpr std::size_t ring_slots = 2048;
+
+    /* Lines are formatted by the thread logging them straight into a slot
+     * of a bounded MPSC ring (per-slot sequence numbers, so producers only
+     * contend on one CAS) and written out by a thread of their own. A full
+     * ring drops the line and counts it, nothing waits on the output. */
+    class async_logger {
+    public:
+        async_logger() : _slots(std::make_unique<slot[]>(ring_slots)) {
+            for (std::size_t i = 0; i < ring_slots; ++i)
+                _slots[i].sequence.store(i, std::memory_order_relaxed);
+            std::thread([this]() {
+                _blockSignals();
+                _run();
+            }).detach();
+        }
+
+        /* Never destroyed, threads may still log during exit. That only
+         * waits (briefly) for what was queued before. */
+        void flush() {
+            auto target = _head.load(std::memory_order_acquire);
+            for (int i = 0; i < 1000 && _written.load(std::memory_order_acquire) < target; ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        void log(LogLevel level, const char* format, va_list vargs) {
+            std::size_t pos;
+            auto s = _claim(pos);
+            if (!s)
+                return;
+
+            s->report = false;
+            s->error = level == ERROR || level == WARN;
+            s->length = format_line(s->text, level, format, vargs);
+            _publish(s, pos);
+        }
+
+        // Copied as is, the hex dump is left to the writer thread
+        void report(const std::string& path, bool out, int64_t time_us,
+                    const uint8_t* data, std::size_t length) {
+            std::size_t pos;
+            auto s = _claim(pos);
+            if (!s)
+                return;
+
+            s->report = true;
+            s->error = false;
+            s->out = out;
+            s->time_us = time_us;
+            s->length = std::min(path.size(), line_size);
+            std::memcpy(s->text, path.data(), s->length);
+            s->data_length = std::min(length, sizeof(s->data));
+            std::memcpy(s->data, data, s->data_length);
+            _publish(s, pos);
+        }
+
+        [[nodiscard]] uint64_t dropped() const {
+            return _total_dropped.load(std::memory_order_relaxed);
+        }
+
+        // The whole line including its newline, returns its length
+        static std::size_t format_line(char* text, LogLevel level,
+                                       const char* format, va_list vargs) {
+            int prefix = snprintf(text, line_size, "[%s] ", levelPrefix(level));
+            int length = vsnprintf(text + prefix, line_size - prefix, format, vargs);
+            std::size_t end = std::min((std::size_t) prefix + std::max(length, 0),
+                                       line_size - 1);
+            text[end] = '\n';
+            return end + 1;
+        }
+
+    private:
+        struct slot {
+            std::atomic<std::size_t> sequence;
+            bool error;
+            // The text is the node's path for a report
+            bool report;
+            bool out;
+            std::size_t length;
+            char text[line_size];
+            int64_t time_us;
+            std::size_t data_length;
+            uint8_t data[64];
+        };
+
+        slot* _claim(std::size_t& pos) {
+            pos = _head.load(std::memory_order_relaxed);
+            for (;;) {
+                auto s = &_slots[pos & (ring_slots - 1)];
+                auto sequence = s->sequence.load(std::memory_order_acquire);
+                auto diff = (intptr_t) sequence - (intptr_t) pos;
+                if (diff == 0) {
+                    if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        return s;
+                } else if (diff < 0) {
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                    return nullptr;
+                } else {
+                    pos = _head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        void _publish(slot* s, std::size_t pos) {
+            s->sequence.store(pos + 1, std::memory_order_release);
+            _wake();
+        }
+
+        static void _formatReport(std::string& out, const slot& s) {
+            static constexpr char hex[] = "0123456789abcdef";
+            out += "[RAWREPORT] ";
+            out.append(s.text, s.length);
+            if (s.out) {
+                out += " OUT: ";
+            } else {
+                // Read time keeps a captured log replayable with its pacing
+                out += " IN @" + std::to_string(s.time_us) + ": ";
+            }
+            for (std::size_t i = 0; i < s.data_length; ++i) {
+                out += hex[s.data[i] >> 4];
+                out += hex[s.data[i] & 0xf];
+                out += ' ';
+            }
+            out += '\n';
+        }
+
+        void _wake() {
+            _ready.fetch_add(1, std::memory_order_release);
+            _ready.notify_one();
+        }
+
+        /* Started by whoever logs first, possibly before main blocks SIGHUP
+         * for the signalfd. Delivered here a reload would kill the daemon. */
+        static void _blockSignals() {
+            sigset_t signals;
+            sigfillset(&signals);
+            // Raised by a fault in this thread, blocking them is undefined
+            for (int sig: {SIGSEGV, SIGBUS, SIGFPE, SIGILL})
+                sigdelset(&signals, sig);
+            pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        }
+
+        void _run() {
+            std::string out, err;
+            for (;;) {
+                auto seen = _ready.load(std::memory_order_acquire);
+                _drain(out, err);
+
+                if (auto dropped = _dropped.exchange(0, std::memory_order_relaxed)) {
+                    _total_dropped.fetch_add(dropped, std::memory_order_relaxed);
+                    err += "[WARN] " + std::to_string(dropped) + " log lines dropped\n";
+                }
+
+                // One write per stream for everything drained
+                _write(STDOUT_FILENO, out);
+                _write(STDERR_FILENO, err);
+                _written.store(_tail, std::memory_order_release);
+
+                if (_empty())
+                    _ready.wait(seen, std::memory_order_acquire);
+            }
+        }
+
+        void _drain(std::string& out, std::string& err) {
+            for (;;) {
+                auto& s = _slots[_tail & (ring_slots - 1)];
+                if (s.sequence.load(std::memory_order_acquire) != _tail + 1)
+                    return;
+                if (s.report)
+                    _formatReport(out, s);
+                else
+                    (s.error ? err : out).append(s.text, s.length);
+                s.sequence.store(_tail + ring_slots, std::memory_order_release);
+                ++_tail;
+            }
+        }
+
+        [[nodiscard]] bool _empty() const {
+            return _slots[_tail & (ring_slots - 1)].sequence.load(
+                    std::memory_order_acquire) != _tail + 1;
+        }
+
+        static void _write(int fd, std::string& text) {
+            std::size_t written = 0;
+            while (written < text.size()) {
+                auto ret = ::write(fd, text.data() + written, text.size() - written);
+                if (ret < 0 && errno == EINTR)
+                    continue;
+                if (ret <= 0)
+                    break;
+                written += ret;
+            }
+            text.clear();
+        }
+
+        std::unique_ptr<slot[]> _slots;
+        std::atomic<std::size_t> _head = 0;
+        // Only touched by the writer thread
+        std::size_t _tail = 0;
+
+        std::atomic<uint32_t> _ready = 0;
+        std::atomic<uint64_t> _dropped = 0;
+        std::atomic<uint64_t> _total_dropped = 0;
+        std::atomic<std::size_t> _written = 0;
+    };
+
+    async_logger& logger() {
+        static auto instance = []() {
+            auto logger = new async_logger();
+            std::atexit([]() { logid::flushLog(); });
+            return logger;
+        }();
+        return *instance;
+    }
+}
+
+void (logid::logPrintf)(LogLevel level, const char* format, ...) {
     if (global_loglevel > level) return;
 
     va_list vargs;
     va_start(vargs, format);
 
-    FILE* stream = stdout;
-    if (level == ERROR || level == WARN)
-        stream = stderr;
+    /* Errors are usually followed by an exit or terminate, which would
+     * take anything still queued with it. What was queued before goes
+     * out first, so the error keeps its place in the log. */
+    if (level == ERROR) {
+        char text[line_size];
+        auto length = async_logger::format_line(text, level, format, vargs);
+        va_end(vargs);
+        logger().flush();
+        [[maybe_unused]] auto ret = ::write(STDERR_FILENO, text, length);
+        return;
+    }
+
+    logger().log(level, format, vargs);
+    va_end(vargs);
+}
+
+void logid::_logReport(const std::string& path, bool out, int64_t time_us,
+                       const uint8_t* data, std::size_t length) {
+    logger().report(path, out, time_us, data, length);
+}
+
+void logid::flushLog() {
+    logger().flush();
+}
 
-    fprintf(stream, "[%s] ", levelPrefix(level));
-    vfprintf(stream, format, vargs);
-    fprintf(stream, "\n");
+uint64_t logid::droppedLogLines() {
+    return logger().dropped();
 }
 
 const char* logid::levelPrefix(LogLevel level) {
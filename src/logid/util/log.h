@@ -18,6 +18,8 @@
 #ifndef LOGID_LOG_H
 #define LOGID_LOG_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 namespace logid {
@@ -33,11 +35,35 @@ namespace logid {
 
     extern LogLevel global_loglevel;
 
-    void logPrintf(LogLevel level, const char* format, ...);
+    /* Formats on the calling thread and queues the line for a writer
+     * thread, lines are dropped rather than waited for if it falls
+     * behind. ERROR lines are written at once. */
+    void (logPrintf)(LogLevel level, const char* format, ...);
+
+    void _logReport(const std::string& path, bool out, int64_t time_us,
+                    const uint8_t* data, std::size_t length);
+
+    /* Traces a raw report as a binary record, formatted later by the
+     * writer thread. time_us is the read time of reports read. */
+    inline void logReport(const std::string& path, bool out, int64_t time_us,
+                          const uint8_t* data, std::size_t length) {
+        if (global_loglevel <= RAWREPORT)
+            _logReport(path, out, time_us, data, length);
+    }
+
+    // Waits up to a second for the lines queued so far, done at exit
+    void flushLog();
+
+    // Lines dropped so far because the writer fell behind
+    [[nodiscard]] uint64_t droppedLogLines();
 
     const char* levelPrefix(LogLevel level);
 
     LogLevel toLogLevel(std::string s);
 }
 
+/* A log level that is off costs a branch, the arguments are not evaluated */
+#define logPrintf(level, ...) \
+    (::logid::global_loglevel > (level) ? void() : (::logid::logPrintf)(level, __VA_ARGS__))
+
 #endif //LOGID_LOG_H
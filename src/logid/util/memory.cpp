@@ -0,0 +1,68 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <util/memory.h>
+#include <util/log.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+
+extern "C"
+{
+#include <malloc.h>
+#include <sys/mman.h>
+}
+
+using namespace logid;
+
+bool logid::lockWorkingSet(std::size_t reserve) {
+    /* Freed memory stays in the heap and large blocks come from it too,
+     * nothing that was faulted in is handed back */
+    mallopt(M_TRIM_THRESHOLD, INT_MAX);
+    // The largest threshold glibc takes
+    mallopt(M_MMAP_THRESHOLD, static_cast<int>(4 * 1024 * 1024 * sizeof(long)));
+    /* Other threads would allocate from arenas of their own, which the
+     * reserve never faulted in. All of them share the main one instead. */
+    mallopt(M_ARENA_MAX, 1);
+
+    if (reserve) {
+        if (auto pool = static_cast<char*>(malloc(reserve))) {
+            memset(pool, 0, reserve);
+            // Compilers may drop a memset right before free otherwise
+            asm volatile("" : : "r"(pool) : "memory");
+            free(pool);
+        }
+    }
+
+    // Faults in everything mapped so far
+    if (mlockall(MCL_CURRENT) < 0) {
+        logPrintf(WARN, "Could not lock memory: %s", strerror(errno));
+        return false;
+    }
+
+    /* Thread stacks are mostly untouched, locking them on fault instead
+     * keeps each one from pinning its whole size */
+    if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) < 0) {
+        logPrintf(WARN, "Could not lock new mappings: %s", strerror(errno));
+        return false;
+    }
+
+    logPrintf(INFO, "Locked memory, %zu KiB of heap faulted in", reserve / 1024);
+    return true;
+}
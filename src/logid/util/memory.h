@@ -0,0 +1,92 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_UTIL_MEMORY_H
+#define LOGID_UTIL_MEMORY_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace logid {
+    /* Keeps the daemon resident: what is mapped now is faulted in and
+     * locked, later mappings are locked as they are touched. The heap
+     * is never trimmed, every thread allocates from it and reserve bytes
+     * of it are faulted in up front, so allocations on the event path
+     * come from locked pages. Call it before starting threads. Returns
+     * false, after logging why, if the memory could not be locked. */
+    bool lockWorkingSet(std::size_t reserve);
+
+    /* Bytes allocated on behalf of one owner, e.g. a device, by what they
+     * are for. Objects charge themselves with a memory_charge. */
+    class memory_account {
+    public:
+        enum kind {
+            features,
+            actions,
+            kinds
+        };
+
+        void add(kind k, std::ptrdiff_t bytes) {
+            _bytes[k].fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] std::size_t bytes(kind k) const {
+            return static_cast<std::size_t>(_bytes[k].load(std::memory_order_relaxed));
+        }
+
+    private:
+        std::array<std::atomic<std::ptrdiff_t>, kinds> _bytes{};
+    };
+
+    /* Holds a charge against an account until it is destroyed, keeping
+     * the account alive for as long as the object outlives its owner */
+    class memory_charge {
+    public:
+        memory_charge() = default;
+
+        memory_charge(const memory_charge&) = delete;
+
+        memory_charge& operator=(const memory_charge&) = delete;
+
+        ~memory_charge() {
+            if (_account)
+                _account->add(_kind, -static_cast<std::ptrdiff_t>(_bytes));
+        }
+
+        // Replaces any earlier charge
+        void charge(std::shared_ptr<memory_account> account, memory_account::kind kind,
+                    std::size_t bytes) {
+            if (_account)
+                _account->add(_kind, -static_cast<std::ptrdiff_t>(_bytes));
+            _account = std::move(account);
+            _kind = kind;
+            _bytes = bytes;
+            if (_account)
+                _account->add(_kind, static_cast<std::ptrdiff_t>(_bytes));
+        }
+
+    private:
+        std::shared_ptr<memory_account> _account;
+        memory_account::kind _kind = memory_account::features;
+        std::size_t _bytes = 0;
+    };
+}
+
+#endif //LOGID_UTIL_MEMORY_H
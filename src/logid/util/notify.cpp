@@ -0,0 +1,60 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <util/notify.h>
+#include <util/log.h>
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+
+extern "C"
+{
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+using namespace logid;
+
+void logid::notifyServiceManager(const std::string& state) {
+    const char* socket_path = getenv("NOTIFY_SOCKET");
+    if (!socket_path || !*socket_path)
+        return;
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    const auto length = strlen(socket_path);
+    if (length >= sizeof(address.sun_path) ||
+        (socket_path[0] != '/' && socket_path[0] != '@'))
+        return;
+    memcpy(address.sun_path, socket_path, length);
+    // A leading @ stands for the abstract namespace
+    if (address.sun_path[0] == '@')
+        address.sun_path[0] = '\0';
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return;
+
+    auto size = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + length);
+    if (sendto(fd, state.data(), state.size(), MSG_NOSIGNAL,
+               reinterpret_cast<sockaddr*>(&address), size) < 0)
+        logPrintf(DEBUG, "Could not notify the service manager: %s", strerror(errno));
+    close(fd);
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_UTIL_NOTIFY_H
+#define LOGID_UTIL_NOTIFY_H
+
+#include <string>
+
+namespace logid {
+    /* Sends state (e.g. "READY=1") to the service manager as sd_notify
+     * does, without linking libsystemd. Does nothing outside of systemd. */
+    void notifyServiceManager(const std::string& state);
+}
+
+#endif //LOGID_UTIL_NOTIFY_H
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <util/sched.h>
+#include <util/log.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+extern "C"
+{
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+}
+
+using namespace logid;
+
+namespace {
+    const char* policyName(int policy) {
+        switch (policy) {
+            case SCHED_FIFO:
+                return "fifo";
+            case SCHED_RR:
+                return "rr";
+            case SCHED_OTHER:
+                return "other";
+            default:
+                return "unknown";
+        }
+    }
+
+    // As in /proc, e.g. 0-3,6
+    std::string cpuList(const cpu_set_t& set) {
+        std::string list;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, &set))
+                continue;
+
+            int last = cpu;
+            while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &set))
+                ++last;
+
+            if (!list.empty())
+                list += ',';
+            list += std::to_string(cpu);
+            if (last != cpu)
+                list += '-' + std::to_string(last);
+            cpu = last;
+        }
+        return list;
+    }
+}
+
+void logid::applyThreadSched(const thread_sched& sched, const std::string& name) {
+    const bool configured = sched.policy || sched.nice || !sched.cpus.empty();
+
+    if (sched.nice && setpriority(PRIO_PROCESS, gettid(), *sched.nice) < 0)
+        logPrintf(WARN, "Could not set the nice level of the %s thread to %d: %s",
+                  name.c_str(), *sched.nice, strerror(errno));
+
+    if (sched.policy) {
+        sched_param param{};
+        param.sched_priority = std::clamp(sched.priority,
+                                          sched_get_priority_min(*sched.policy),
+                                          sched_get_priority_max(*sched.policy));
+        int ret = pthread_setschedparam(pthread_self(), *sched.policy, &param);
+        if (ret)
+            logPrintf(WARN, "Could not schedule the %s thread as %s %d: %s",
+                      name.c_str(), policyName(*sched.policy), param.sched_priority,
+                      strerror(ret));
+    }
+
+    if (!sched.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto cpu: sched.cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        }
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret)
+            logPrintf(WARN, "Could not pin the %s thread to CPUs %s: %s",
+                      name.c_str(), cpuList(set).c_str(), strerror(ret));
+    }
+
+    int policy = SCHED_OTHER;
+    sched_param param{};
+    pthread_getschedparam(pthread_self(), &policy, &param);
+    int nice = getpriority(PRIO_PROCESS, gettid());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+
+    logPrintf(configured ? INFO : DEBUG, "%s thread runs as %s %d, nice %d, on CPUs %s",
+              name.c_str(), policyName(policy), param.sched_priority, nice,
+              cpuList(set).c_str());
+}
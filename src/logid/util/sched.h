@@ -0,0 +1,42 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LOGID_UTIL_SCHED_H
+#define LOGID_UTIL_SCHED_H
+
+#include <optional>
+#include <set>
+#include <string>
+
+namespace logid {
+    // How a thread is scheduled, anything unset is left as inherited
+    struct thread_sched {
+        // SCHED_FIFO or SCHED_RR, run at priority
+        std::optional<int> policy;
+        int priority = 1;
+        std::optional<int> nice;
+        // CPUs the thread may run on, all of them if empty
+        std::set<int> cpus;
+    };
+
+    /* Applies sched to the calling thread and reports what it ended up
+     * with as name. Failures, e.g. without CAP_SYS_NICE, are only logged. */
+    void applyThreadSched(const thread_sched& sched, const std::string& name);
+}
+
+#endif //LOGID_UTIL_SCHED_H
@@ -16,115 +16,793 @@
  *
  */
 #include <util/task.h>
-#include <queue>
-#include <optional>
+#include <util/log.h>
+#include <util/trace.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <bit>
+#include <map>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 using namespace logid;
 using namespace std::chrono;
 
-struct task_less {
-private:
-    std::greater<> greater;
-public:
-    bool operator()(const task& a, const task& b) const {
-        return greater(a.time, b.time);
-    }
+namespace {
+    // Totals for every task queued from one call site
+    struct origin_stats {
+        std::string location;
+        std::atomic<uint64_t> runs = 0;
+        std::atomic<uint64_t> run_us = 0;
+        std::atomic<uint64_t> max_run_us = 0;
+    };
+}
+
+struct logid::task_state {
+    unique_function<void()> function;
+    task_priority priority = task_priority::normal;
+    origin_stats* origin = nullptr;
+    // Set once by whichever of running or cancelling comes first
+    std::atomic_bool claimed = false;
+    int64_t expiry = 0;
+    // Wheel position, guarded by timer_mutex, level is -1 outside the wheel
+    int level = -1;
+    std::size_t slot = 0;
 };
 
-static std::priority_queue<task, std::vector<task>, task_less> tasks {};
-static std::mutex task_mutex {};
-static std::condition_variable task_cv {};
-static std::atomic_bool workers_init = false;
-static std::atomic_bool workers_run = false;
+namespace {
+    typedef unique_function<void()> task_function;
 
-void stop_workers() {
-    std::unique_lock lock(task_mutex);
-    if (workers_init) {
-        workers_run = false;
-        lock.unlock();
-        task_cv.notify_all();
+    constexpr std::size_t priority_count = 3;
+
+    struct queued_task {
+        task_function function;
+        steady_clock::time_point queued;
+        origin_stats* origin;
+    };
+
+    /* Each worker owns a queue and steals from the others when it runs dry,
+     * so submitters and workers rarely contend on the same lock. */
+    struct worker_queue {
+        std::mutex mutex;
+        std::array<std::deque<queued_task>, priority_count> tasks;
+    };
 
-        /* Wait for all workers to end */
-        lock.lock();
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::atomic<std::size_t> next_queue = 0;
+    thread_local std::optional<std::size_t> current_worker;
+
+    std::atomic_bool workers_init = false;
+    std::atomic_bool workers_run = false;
+
+    /* Queued task count per lane, workers only sleep while they have
+     * nothing they may take */
+    std::array<std::atomic<long>, priority_count> pending{};
+    std::atomic<int> idle = 0;
+    /* Normal and background tasks being run, kept below low_limit */
+    std::atomic<std::size_t> low_running = 0;
+    std::atomic<std::size_t> low_limit = 1;
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+
+    /* Tasks commonly block on HID++ I/O. When every worker has been busy
+     * without finishing anything for worker_stall, the timer thread adds a
+     * helper (up to max_workers), helpers retire after worker_retire idle.
+     * Helpers share the queues of the base workers. */
+    constexpr milliseconds worker_stall(100);
+    constexpr seconds worker_retire(30);
+    std::size_t base_workers = 0;
+    std::size_t max_workers = 0;
+    std::atomic<std::size_t> worker_total = 0;
+    std::atomic<steady_clock::rep> last_progress = 0;
+    // Set while the timer thread is watching for a stall
+    std::atomic_bool stall_watch = false;
+
+    /* Statistics are relaxed atomics, readers only get a rough snapshot */
+    typedef std::array<std::atomic<uint64_t>, task_stats::buckets> histogram;
+    histogram wait_histogram{};
+    histogram run_histogram{};
+    std::atomic<uint64_t> total_runs = 0;
+    std::atomic<long> max_queued = 0;
+
+    std::shared_mutex origins_mutex;
+    std::map<std::pair<std::string_view, uint_least32_t>, origin_stats> origins;
+
+    origin_stats* origin_of(const std::source_location& location) {
+        std::pair<std::string_view, uint_least32_t> key(location.file_name(), location.line());
+        {
+            std::shared_lock lock(origins_mutex);
+            auto it = origins.find(key);
+            if (it != origins.end())
+                return &it->second;
+        }
+
+        std::unique_lock lock(origins_mutex);
+        auto [it, inserted] = origins.try_emplace(key);
+        if (inserted) {
+            auto file = key.first.substr(key.first.find_last_of('/') + 1);
+            it->second.location = std::string(file) + ":" + std::to_string(key.second);
+        }
+        return &it->second;
     }
-}
 
-void worker() {
-    std::unique_lock lock(task_mutex);
-    while (workers_run) {
-        task_cv.wait(lock, []() { return !tasks.empty() || !workers_run; });
+    void record(histogram& h, uint64_t us) {
+        auto bucket = std::min<std::size_t>(std::bit_width(us), task_stats::buckets - 1);
+        h[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record_max(std::atomic<uint64_t>& max, uint64_t value) {
+        auto current = max.load(std::memory_order_relaxed);
+        while (current < value && !max.compare_exchange_weak(current, value,
+                                                             std::memory_order_relaxed));
+    }
+
+    void record_origin(origin_stats* origin, steady_clock::duration run) {
+        if (!origin)
+            return;
+
+        auto us = (uint64_t) duration_cast<microseconds>(run).count();
+        origin->runs.fetch_add(1, std::memory_order_relaxed);
+        origin->run_us.fetch_add(us, std::memory_order_relaxed);
+        record_max(origin->max_run_us, us);
+    }
+
+    void record_run(const queued_task& task, steady_clock::time_point start,
+                    steady_clock::time_point end) {
+        record(wait_histogram, duration_cast<microseconds>(start - task.queued).count());
+        record(run_histogram, duration_cast<microseconds>(end - start).count());
+        total_runs.fetch_add(1, std::memory_order_relaxed);
+        record_origin(task.origin, end - start);
+    }
+
+    /* Delayed tasks live in a hierarchical timing wheel with 10ms ticks.
+     * Level 0 holds the next 256 ticks, levels 1 and 2 have 64 slots of
+     * 256 and 16384 ticks whose timers cascade down as their slot comes up.
+     * A dedicated thread advances the wheel and only wakes for ticks that
+     * may have work. */
+    constexpr milliseconds timer_tick(10);
+    constexpr int level0_bits = 8;
+    constexpr int level_bits = 6;
+    constexpr int timer_levels = 3;
+    constexpr int64_t level0_mask = (1 << level0_bits) - 1;
+    constexpr int64_t level_mask = (1 << level_bits) - 1;
+
+    constexpr int level_shift(int level) {
+        return level ? level0_bits + level_bits * (level - 1) : 0;
+    }
+
+    typedef std::vector<std::shared_ptr<task_state>> timer_slot;
+
+    std::array<std::array<timer_slot, 1 << level0_bits>, timer_levels> timer_wheel;
+    std::size_t timer_count = 0;
+    std::atomic<uint64_t> timer_wakeups = 0;
+    /* Wakeups that had timers to fire or move down, and changes to when
+     * the timers wake, see task_stats */
+    std::atomic<uint64_t> timer_expiries = 0;
+    std::atomic<uint64_t> timer_rearms = 0;
+    int64_t wheel_tick = 0;
+    std::optional<int64_t> timer_wakeup;
+    std::mutex timer_mutex;
+    std::condition_variable timer_cv;
+    /* With io_timers, timers are driven from this timerfd instead of
+     * timer_worker, -1 otherwise. timer_armed is the time it is set for. */
+    int timer_fd = -1;
+    std::optional<steady_clock::time_point> timer_armed;
+
+    int64_t tick_of(steady_clock::time_point time) {
+        return duration_cast<milliseconds>(time.time_since_epoch()) / timer_tick;
+    }
+
+    steady_clock::time_point time_of(int64_t tick) {
+        return steady_clock::time_point(duration_cast<steady_clock::duration>(tick * timer_tick));
+    }
+
+    // Requires timer_mutex
+    void arm_timer_fd(std::optional<steady_clock::time_point> time) {
+        timer_armed = time;
+
+        itimerspec spec{};
+        if (time) {
+            // steady_clock is CLOCK_MONOTONIC, a zero value would disarm it
+            auto ns = std::max<int64_t>(duration_cast<nanoseconds>(
+                    time->time_since_epoch()).count(), 1);
+            spec.it_value.tv_sec = ns / 1000000000;
+            spec.it_value.tv_nsec = ns % 1000000000;
+        }
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    /* Has the timers looked at again by time at the latest.
+     * Requires timer_mutex */
+    void wake_timers(steady_clock::time_point time) {
+        if (timer_fd < 0)
+            timer_cv.notify_one();
+        else if (!timer_armed || time < *timer_armed)
+            arm_timer_fd(time);
+    }
+
+    void submit(task_function function, task_priority priority, origin_stats* origin) {
+        auto lane = static_cast<std::size_t>(priority);
+        std::size_t index = current_worker ? *current_worker :
+                            next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+        {
+            auto& queue = *queues[index];
+            std::lock_guard lock(queue.mutex);
+            queue.tasks[lane].push_back({std::move(function), steady_clock::now(), origin});
+        }
+        LOGID_TRACE(task_enqueue, origin ? origin->location.c_str() : nullptr, lane);
+
+        ++pending[lane];
+        auto depth = pending[0] + pending[1] + pending[2];
+        auto high = max_queued.load(std::memory_order_relaxed);
+        while (high < depth && !max_queued.compare_exchange_weak(high, depth,
+                                                                 std::memory_order_relaxed));
+        if (idle > 0) {
+            std::lock_guard lock(sleep_mutex);
+            sleep_cv.notify_one();
+        }
+
+        // Nobody can take it right away, have the timer thread watch for a stall
+        bool held = idle == 0 || (lane > 0 && low_running >= low_limit);
+        if (held && worker_total < max_workers && !stall_watch.exchange(true)) {
+            std::lock_guard lock(timer_mutex);
+            wake_timers(steady_clock::now());
+        }
+    }
+
+    bool queued() {
+        return pending[0] > 0 || pending[1] > 0 || pending[2] > 0;
+    }
+
+    bool has_work() {
+        return pending[0] > 0 ||
+               (low_running < low_limit && (pending[1] > 0 || pending[2] > 0));
+    }
+
+    std::optional<queued_task> take_lane(std::size_t self, std::size_t lane) {
+        if (pending[lane] <= 0)
+            return std::nullopt;
+
+        for (std::size_t i = 0; i < queues.size(); ++i) {
+            auto& queue = *queues[(self + i) % queues.size()];
+            std::lock_guard lock(queue.mutex);
+            if (!queue.tasks[lane].empty()) {
+                // Own queue and stolen tasks are both taken oldest first
+                auto task = std::move(queue.tasks[lane].front());
+                queue.tasks[lane].pop_front();
+                --pending[lane];
+                return task;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    void release_low() {
+        --low_running;
+        // Lower lanes may have been held back by the limit
+        if (idle > 0 && (pending[1] > 0 || pending[2] > 0)) {
+            std::lock_guard lock(sleep_mutex);
+            sleep_cv.notify_one();
+        }
+    }
+
+    // Sets low when the task counts against low_limit
+    std::optional<queued_task> take(std::size_t self, bool& low) {
+        low = false;
+        if (auto task = take_lane(self, 0))
+            return task;
+
+        if (pending[1] <= 0 && pending[2] <= 0)
+            return std::nullopt;
+
+        if (low_running.fetch_add(1) >= low_limit) {
+            release_low();
+            return std::nullopt;
+        }
+
+        for (std::size_t lane = 1; lane < priority_count; ++lane) {
+            if (auto task = take_lane(self, lane)) {
+                low = true;
+                return task;
+            }
+        }
+
+        release_low();
+        return std::nullopt;
+    }
+
+    std::size_t add_workers(long count) {
+        auto total = worker_total.fetch_add(count) + count;
+        // One worker is kept for interactive tasks when there is more than one
+        low_limit = std::max<std::size_t>(total, 2) - 1;
+        return total;
+    }
+
+    void mark_progress(steady_clock::time_point now) {
+        last_progress = now.time_since_epoch().count();
+    }
+
+    void worker(std::size_t index) {
+        bool helper = index >= base_workers;
+        current_worker = index % queues.size();
+
+        while (workers_run) {
+            bool low;
+            if (auto task = take(*current_worker, low)) {
+                auto start = steady_clock::now();
+                mark_progress(start);
+                LOGID_TRACE(task_start, task->origin ? task->origin->location.c_str() : nullptr,
+                            index);
+                try {
+                    task->function();
+                } catch (std::exception& e) {
+                    ExceptionHandler::Default(e);
+                }
+
+                auto end = steady_clock::now();
+                LOGID_TRACE(task_finish, task->origin ? task->origin->location.c_str() : nullptr,
+                            index);
+                mark_progress(end);
+                record_run(*task, start, end);
+                if (low)
+                    release_low();
+                continue;
+            }
+
+            std::unique_lock lock(sleep_mutex);
+            ++idle;
+            auto wake = []() { return has_work() || !workers_run; };
+            if (!helper) {
+                sleep_cv.wait(lock, wake);
+            } else if (!sleep_cv.wait_for(lock, worker_retire, wake)) {
+                --idle;
+                add_workers(-1);
+                return;
+            }
+            --idle;
+        }
+    }
+
+    // Whether no worker has started or finished a task for worker_stall
+    bool workers_stalled(steady_clock::time_point now) {
+        if (!queued())
+            return false;
+
+        return now - steady_clock::time_point(steady_clock::duration(last_progress)) >=
+               worker_stall;
+    }
+
+    // Requires timer_mutex
+    void check_stall() {
+        if (worker_total >= max_workers)
+            return;
+
+        auto now = steady_clock::now();
+        if (!workers_stalled(now))
+            return;
+
+        auto index = add_workers(1) - 1;
+        mark_progress(now);
+        logPrintf(DEBUG, "All %d workers blocked, adding a helper", (int) index);
+        std::thread(&worker, index).detach();
+    }
+
+    // Requires timer_mutex
+    void wheel_insert(const std::shared_ptr<task_state>& state) {
+        auto expiry = std::max(state->expiry, wheel_tick);
+
+        int level = 0;
+        if (expiry - wheel_tick > level0_mask) {
+            level = 1;
+            if ((expiry >> level_shift(1)) - (wheel_tick >> level_shift(1)) > level_mask) {
+                level = 2;
+                // Past the top level, cascaded again once its slot comes up
+                expiry = std::min(expiry, wheel_tick + (level_mask << level_shift(2)));
+            }
+        }
+
+        auto mask = level ? level_mask : level0_mask;
+        state->level = level;
+        state->slot = (expiry >> level_shift(level)) & mask;
+        timer_wheel[level][state->slot].push_back(state);
+    }
+
+    // Requires timer_mutex, returns whether any timers were moved
+    bool wheel_cascade(int level, std::size_t slot) {
+        auto timers = std::move(timer_wheel[level][slot]);
+        timer_wheel[level][slot].clear();
+        for (auto& state: timers)
+            wheel_insert(state);
+        return !timers.empty();
+    }
+
+    // Requires timer_mutex, returns whether a cascade moved any timers
+    bool wheel_advance(std::vector<std::shared_ptr<task_state>>& due) {
+        auto tick = ++wheel_tick;
+
+        bool cascaded = false;
+        if ((tick & level0_mask) == 0) {
+            if (((tick >> level_shift(1)) & level_mask) == 0)
+                cascaded = wheel_cascade(2, (tick >> level_shift(2)) & level_mask);
+            cascaded |= wheel_cascade(1, (tick >> level_shift(1)) & level_mask);
+        }
+
+        auto timers = std::move(timer_wheel[0][tick & level0_mask]);
+        timer_wheel[0][tick & level0_mask].clear();
+        for (auto& state: timers) {
+            state->level = -1;
+            --timer_count;
+            due.push_back(std::move(state));
+        }
+        return cascaded;
+    }
+
+    // Whether the cascade at tick, a level 0 boundary, moves any timers down
+    bool wheel_cascades(int64_t tick) {
+        auto slot1 = (tick >> level_shift(1)) & level_mask;
+        if (!timer_wheel[1][slot1].empty())
+            return true;
+        return slot1 == 0 && !timer_wheel[2][(tick >> level_shift(2)) & level_mask].empty();
+    }
+
+    // Requires timer_mutex
+    void wheel_update_wakeup() {
+        timer_wakeup.reset();
+        if (!timer_count)
+            return;
+
+        /* Wake for the next occupied level 0 slot or the next cascade that
+         * has timers to move, empty cascades are skipped over when the
+         * wheel catches up. */
+        for (auto tick = wheel_tick + 1; tick <= wheel_tick + level0_mask + 1; ++tick) {
+            if (!timer_wheel[0][tick & level0_mask].empty() ||
+                ((tick & level0_mask) == 0 && wheel_cascades(tick))) {
+                timer_wakeup = tick;
+                return;
+            }
+        }
+
+        auto boundary = ((wheel_tick >> level_shift(1)) + 2) << level_shift(1);
+        for (int i = 0; i < (1 << (2 * level_bits)); ++i, boundary += level0_mask + 1) {
+            if (wheel_cascades(boundary)) {
+                timer_wakeup = boundary;
+                return;
+            }
+        }
+    }
+
+    void run_state(const std::shared_ptr<task_state>& state) {
+        if (state->claimed.exchange(true))
+            return;
+
+        auto function = std::move(state->function);
+        function();
+    }
+
+    /* Fires due timers and looks for a stall, returns when to run again.
+     * Requires timer_mutex, unlocked while submitting. */
+    std::optional<steady_clock::time_point> timer_pass(std::unique_lock<std::mutex>& lock) {
+        timer_wakeups.fetch_add(1, std::memory_order_relaxed);
+
+        std::vector<std::shared_ptr<task_state>> due;
+        auto now_tick = tick_of(steady_clock::now());
+        bool cascaded = false;
+        while (wheel_tick < now_tick)
+            cascaded |= wheel_advance(due);
+        wheel_update_wakeup();
+        if (cascaded || !due.empty())
+            timer_expiries.fetch_add(1, std::memory_order_relaxed);
+
+        if (!due.empty()) {
+            lock.unlock();
+            for (auto& state: due)
+                submit([state]() { run_state(state); }, state->priority, state->origin);
+            lock.lock();
+        }
 
         if (!workers_run)
-            break;
+            return std::nullopt;
 
-        /* top task is in the future, wait */
-        if (tasks.top().time >= system_clock::now()) {
-            auto wait = tasks.top().time - system_clock::now();
-            task_cv.wait_for(lock, wait, []() {
-                return (!tasks.empty() && (tasks.top().time < system_clock::now())) ||
-                    !workers_run;
-            });
+        /* Cleared before looking, a submit that saturates the pool
+         * afterwards wakes the timers again. */
+        stall_watch = false;
+        check_stall();
 
+        std::optional<steady_clock::time_point> wakeup;
+        if (timer_wakeup)
+            wakeup = time_of(*timer_wakeup);
+        if (queued() && worker_total < max_workers) {
+            stall_watch = true;
+            auto stall = steady_clock::time_point(steady_clock::duration(last_progress)) +
+                         worker_stall;
+            wakeup = wakeup ? std::min(*wakeup, stall) : stall;
+        }
+
+        return wakeup;
+    }
+
+    void timer_worker() {
+        std::unique_lock lock(timer_mutex);
+        while (workers_run) {
+            auto wakeup = timer_pass(lock);
             if (!workers_run)
                 break;
+
+            // Timers added while unlocked lower timer_wakeup
+            if (wakeup)
+                timer_cv.wait_until(lock, *wakeup);
+            else
+                timer_cv.wait(lock);
         }
+    }
 
-        if (!tasks.empty()) {
-            /* May have timed out and is no longer empty */
-            auto f = tasks.top().function;
-            tasks.pop();
+    /* Timers this far out or more get slack. Rounding their expiry up to
+     * a power of two ticks within it lines up timers due close together. */
+    constexpr milliseconds slack_delay(1000);
+    constexpr int slack_divisor = 32;
 
-            lock.unlock();
-            try {
-                f();
-            } catch(std::exception& e) {
-                ExceptionHandler::Default(e);
+    int64_t slack_ticks(milliseconds delay, task_priority priority) {
+        if (priority == task_priority::interactive || delay < slack_delay)
+            return 1;
+        return (int64_t) std::bit_floor((uint64_t) (delay / slack_divisor / timer_tick));
+    }
+
+    task_handle schedule(const std::shared_ptr<task_state>& state,
+                         steady_clock::time_point deadline, int64_t slack) {
+        std::lock_guard lock(timer_mutex);
+        // The wheel idles without timers, catch up before inserting
+        if (!timer_count)
+            wheel_tick = std::max(wheel_tick, tick_of(steady_clock::now()));
+
+        // Round up, timers never fire early
+        state->expiry = tick_of(deadline - steady_clock::duration(1)) + 1;
+        state->expiry = (state->expiry + slack - 1) / slack * slack;
+        wheel_insert(state);
+        ++timer_count;
+
+        if (!timer_wakeup || state->expiry < *timer_wakeup) {
+            timer_wakeup = state->expiry;
+            timer_rearms.fetch_add(1, std::memory_order_relaxed);
+            wake_timers(time_of(state->expiry));
+        }
+
+        return task_handle(state);
+    }
+}
+
+bool task_handle::cancel() {
+    auto state = _state.lock();
+    if (!state || state->claimed.exchange(true))
+        return false;
+
+    std::lock_guard lock(timer_mutex);
+    if (state->level >= 0) {
+        auto& slot = timer_wheel[state->level][state->slot];
+        auto it = std::find(slot.begin(), slot.end(), state);
+        if (it != slot.end()) {
+            std::swap(*it, slot.back());
+            slot.pop_back();
+            --timer_count;
+        }
+        state->level = -1;
+        // The timers still wake for it, with nothing to fire
+        if (timer_wakeup && state->expiry == *timer_wakeup)
+            timer_rearms.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Drop captures right away
+    state->function = nullptr;
+
+    return true;
+}
+
+bool task_handle::done() const {
+    return _state.expired();
+}
+
+task_set::~task_set() {
+    cancel();
+}
+
+void task_set::add(task_handle handle) {
+    std::lock_guard lock(_mutex);
+    std::erase_if(_tasks, [](const task_handle& h) { return h.done(); });
+    _tasks.push_back(std::move(handle));
+}
+
+void task_set::cancel() {
+    std::vector<task_handle> tasks;
+    {
+        std::lock_guard lock(_mutex);
+        tasks.swap(_tasks);
+    }
+
+    for (auto& task: tasks)
+        task.cancel();
+}
+
+void stop_workers() {
+    if (workers_init) {
+        workers_run = false;
+
+        {
+            std::lock_guard lock(sleep_mutex);
+            sleep_cv.notify_all();
+        }
+
+        std::lock_guard lock(timer_mutex);
+        timer_cv.notify_all();
+    }
+}
+
+struct strand::state {
+    std::mutex mutex;
+    std::deque<std::shared_ptr<task_state>> tasks;
+    // Whether a drain is queued or running
+    bool scheduled = false;
+};
+
+static constexpr std::size_t strand_batch = 8;
+
+strand::strand() : _state(std::make_shared<state>()) {
+}
+
+task_handle strand::post(unique_function<void()> function, std::source_location location) {
+    auto task = std::make_shared<task_state>();
+    task->function = std::move(function);
+    task->origin = origin_of(location);
+    task_handle handle(task);
+
+    bool schedule;
+    {
+        std::lock_guard lock(_state->mutex);
+        _state->tasks.push_back(std::move(task));
+        schedule = !_state->scheduled;
+        _state->scheduled = true;
+    }
+
+    if (schedule)
+        submit([s = _state]() { _drain(s); }, task_priority::normal, nullptr);
+
+    return handle;
+}
+
+void strand::_drain(const std::shared_ptr<state>& s) {
+    for (std::size_t i = 0; i < strand_batch; ++i) {
+        std::shared_ptr<task_state> task;
+        {
+            std::lock_guard lock(s->mutex);
+            if (s->tasks.empty()) {
+                s->scheduled = false;
+                return;
             }
-            lock.lock();
+            task = std::move(s->tasks.front());
+            s->tasks.pop_front();
+        }
+
+        // A failing task must not stall the rest of the strand
+        auto start = steady_clock::now();
+        try {
+            run_state(task);
+        } catch (std::exception& e) {
+            ExceptionHandler::Default(e);
         }
+        record_origin(task->origin, steady_clock::now() - start);
     }
+
+    submit([s]() { _drain(s); }, task_priority::normal, nullptr);
 }
 
-void logid::init_workers(int worker_count) {
-    std::lock_guard lock(task_mutex);
+void logid::init_workers(int worker_count, int max_worker_count, bool timer_thread) {
     assert(!workers_init);
 
+    if (!timer_thread) {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd < 0)
+            logPrintf(WARN, "Could not create a timerfd, timers get a thread: %s",
+                      strerror(errno));
+    }
+
+    worker_count = std::max(worker_count, 1);
     for (int i = 0; i < worker_count; ++i)
-        std::thread(&worker).detach();
+        queues.push_back(std::make_unique<worker_queue>());
+    base_workers = worker_count;
+    max_workers = std::max(max_worker_count, worker_count);
+    add_workers(worker_count);
+    mark_progress(steady_clock::now());
+
+    wheel_tick = tick_of(steady_clock::now());
 
-    workers_init = true;
     workers_run = true;
+    workers_init = true;
+
+    for (int i = 0; i < worker_count; ++i)
+        std::thread(&worker, (std::size_t) i).detach();
+    if (timer_fd < 0)
+        std::thread(&timer_worker).detach();
 
     atexit(&stop_workers);
 }
 
-void logid::run_task(std::function<void()> function) {
-    task t{
-            .function = std::move(function),
-            .time = std::chrono::system_clock::now()
-    };
-
-    run_task(t);
+int logid::timer_event_fd() {
+    return timer_fd;
 }
 
-void logid::run_task_after(std::function<void()> function, std::chrono::milliseconds delay) {
-    task t{
-            .function = std::move(function),
-            .time = system_clock::now() + delay
-    };
+void logid::run_timers() {
+    if (timer_fd < 0)
+        return;
+
+    uint64_t expirations;
+    while (read(timer_fd, &expirations, sizeof(expirations)) > 0);
 
-    run_task(t);
+    std::unique_lock lock(timer_mutex);
+    // Disarmed once the workers stop
+    arm_timer_fd(workers_run ? timer_pass(lock) : std::nullopt);
 }
 
-void logid::run_task(task t) {
-    std::lock_guard lock(task_mutex);
+task_handle logid::run_task(unique_function<void()> function, task_priority priority,
+                            std::source_location location) {
+    return run_task_after(std::move(function), milliseconds(0), priority, location);
+}
 
-    if (!workers_init) {
+task_handle logid::run_task_after(unique_function<void()> function,
+                                  std::chrono::milliseconds delay,
+                                  task_priority priority,
+                                  std::source_location location) {
+    if (!workers_init)
         throw std::runtime_error("tasks queued before work queue ready");
+
+    auto state = std::make_shared<task_state>();
+    state->function = std::move(function);
+    state->priority = priority;
+    state->origin = origin_of(location);
+
+    if (delay.count() > 0)
+        return schedule(state, steady_clock::now() + delay, slack_ticks(delay, priority));
+
+    submit([state]() { run_state(state); }, priority, state->origin);
+    return task_handle(state);
+}
+
+task_handle logid::run_task(task t, std::source_location location) {
+    return run_task_after(std::move(t.function),
+                          duration_cast<milliseconds>(t.time - steady_clock::now()),
+                          task_priority::normal, location);
+}
+
+task_stats logid::get_task_stats() {
+    task_stats stats{};
+    stats.workers = worker_total;
+    stats.queued = std::max<long>(pending[0] + pending[1] + pending[2], 0);
+    {
+        std::lock_guard lock(timer_mutex);
+        stats.timers = timer_count;
+    }
+    stats.timer_wakeups = timer_wakeups;
+    stats.timer_expiries = timer_expiries;
+    stats.timer_rearms = timer_rearms;
+    stats.max_queued = max_queued;
+    stats.runs = total_runs;
+    for (std::size_t i = 0; i < task_stats::buckets; ++i) {
+        stats.wait_us[i] = wait_histogram[i];
+        stats.run_us[i] = run_histogram[i];
     }
 
-    tasks.emplace(std::move(t));
-    // TODO: only need to wake up at top
-    task_cv.notify_one();
+    std::shared_lock lock(origins_mutex);
+    for (auto& [key, origin]: origins)
+        stats.origins.push_back({origin.location, origin.runs, origin.run_us,
+                                 origin.max_run_us});
+
+    return stats;
 }
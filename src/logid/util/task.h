@@ -19,21 +19,144 @@
 #define LOGID_TASK_H
 
 #include <util/ExceptionHandler.h>
-#include <functional>
+#include <util/function.h>
+#include <array>
+#include <source_location>
+#include <string>
 #include <memory>
 #include <future>
+#include <mutex>
+#include <vector>
+#include <deque>
 
 namespace logid {
     struct task {
-        std::function<void()> function;
-        std::chrono::time_point<std::chrono::system_clock> time;
+        unique_function<void()> function;
+        // Steady so that a change of wall clock does not move the task
+        std::chrono::steady_clock::time_point time;
     };
 
-    void init_workers(int worker_count);
+    /* Lanes are served in order. Normal and background tasks never occupy
+     * the last free worker, so interactive work (e.g., actions run from a
+     * button press) does not wait behind I/O-bound device setup. */
+    enum class task_priority {
+        interactive,
+        normal,
+        background,
+    };
+
+    struct task_state;
+
+    /* Refers to a task queued with run_task_after, cancelling drops the
+     * task (and its captures) if it has not started running yet. */
+    class task_handle {
+    public:
+        task_handle() = default;
+
+        explicit task_handle(std::weak_ptr<task_state> state) : _state(std::move(state)) {}
+
+        // Returns whether the task was still waiting
+        bool cancel();
+
+        // True once the task has run or was cancelled
+        [[nodiscard]] bool done() const;
+
+    private:
+        std::weak_ptr<task_state> _state;
+    };
+
+    /* Tracks the tasks queued on behalf of an owner, those still waiting
+     * are cancelled when the owner goes away. */
+    class task_set {
+    public:
+        task_set() = default;
+
+        task_set(const task_set&) = delete;
+
+        task_set& operator=(const task_set&) = delete;
+
+        ~task_set();
+
+        void add(task_handle handle);
+
+        void cancel();
+
+    private:
+        std::mutex _mutex;
+        std::vector<task_handle> _tasks;
+    };
+
+    /* Runs the tasks posted to it one at a time and in order on the worker
+     * pool. Nothing holds a worker while the strand is empty, and a long
+     * queue yields to other work between batches. */
+    class strand {
+    public:
+        strand();
+
+        task_handle post(unique_function<void()> function,
+                         std::source_location location = std::source_location::current());
+
+    private:
+        struct state;
+
+        static void _drain(const std::shared_ptr<state>& s);
+
+        std::shared_ptr<state> _state;
+    };
+
+    /* Starts worker_count workers, helpers are added up to max_worker_count
+     * while all of them are blocked. Without timer_thread the timers are
+     * driven from timer_event_fd by whoever polls it. */
+    void init_workers(int worker_count, int max_worker_count, bool timer_thread = true);
+
+    /* Readable when run_timers is due, -1 while timers have a thread */
+    [[nodiscard]] int timer_event_fd();
+    void run_timers();
+
+    /* The caller's location tags the task in task_stats. Delays of a second
+     * or more, except for interactive tasks, may run up to 1/32 of the
+     * delay late so that timers due around the same time share a wakeup. */
+    task_handle run_task(unique_function<void()> function,
+                         task_priority priority = task_priority::normal,
+                         std::source_location location = std::source_location::current());
+    task_handle run_task_after(unique_function<void()> function, std::chrono::milliseconds delay,
+                               task_priority priority = task_priority::normal,
+                               std::source_location location = std::source_location::current());
+    task_handle run_task(task t,
+                         std::source_location location = std::source_location::current());
+
+    /* A snapshot of the scheduler counters. Histogram bucket n counts
+     * durations in [2^(n-1), 2^n) microseconds, the last one is open. */
+    struct task_stats {
+        static constexpr std::size_t buckets = 24;
+
+        struct origin {
+            std::string location;
+            uint64_t runs;
+            uint64_t run_us;
+            uint64_t max_run_us;
+        };
+
+        std::size_t workers;
+        uint64_t queued;
+        // Delayed tasks still waiting
+        uint64_t timers;
+        // Times the timers were looked at, with nothing pending this stays put
+        uint64_t timer_wakeups;
+        /* Of those, the ones that fired timers or moved them down the
+         * wheel. Any other is owed to a rearm: a timer due earlier than
+         * the one waited for, or that one being cancelled. */
+        uint64_t timer_expiries;
+        uint64_t timer_rearms;
+        uint64_t max_queued;
+        uint64_t runs;
+        // Enqueue (or timer expiry) to start
+        std::array<uint64_t, buckets> wait_us;
+        std::array<uint64_t, buckets> run_us;
+        std::vector<origin> origins;
+    };
 
-    void run_task(std::function<void()> function);
-    void run_task_after(std::function<void()> function, std::chrono::milliseconds delay);
-    void run_task(task t);
+    [[nodiscard]] task_stats get_task_stats();
 }
 
 #endif //LOGID_TASK_H
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2019-2023 PixlOne
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOGID_UTIL_TRACE_H
+#define LOGID_UTIL_TRACE_H
+
+/* Static trace points in the logid provider, built with USE_USDT. Each is
+ * a single nop until a tracer attaches, e.g.
+ *   bpftrace -e 'usdt:/usr/bin/logid:logid:raw_read { ... }'
+ * Without USE_USDT they vanish and their arguments are not evaluated, so
+ * arguments must not have side effects. Arguments are integers or
+ * pointers, at most 12 of them.
+ *
+ * io_wake(monitor, events)
+ * raw_read(path, data, length), raw_write(path, data, length)
+ * hidpp_send_begin(device, index, sub_id or feature, address or function)
+ * hidpp_send_end(device, answered)
+ * dispatch_begin(list, handlers), dispatch_end(list)
+ * task_enqueue(location, priority), task_start(location, worker),
+ * task_finish(location, worker)
+ * input_emit(fd, events) */
+#ifdef LOGID_USE_USDT
+#define SDT_USE_VARIADIC
+#include <sys/sdt.h>
+#define LOGID_TRACE(name, ...) STAP_PROBEV(logid, name, ##__VA_ARGS__)
+#else
+#define LOGID_TRACE(name, ...) do { } while (false)
+#endif
+
+#endif //LOGID_UTIL_TRACE_H